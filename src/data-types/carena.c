@@ -0,0 +1,555 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2005 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "carena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef WIN32
+#include <malloc.h>
+#endif
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+#include <pthread.h>
+#endif
+#endif
+
+#include "chash.h"
+
+#define CARENA_DEFAULT_BLOCK_SIZE (16 * 1024)
+
+/* every allocation is prefixed with its size so that carena_realloc()
+   can copy the content, the union gives the alignment of the
+   returned pointers */
+
+union carena_header {
+  size_t size;
+  double d;
+  void * p;
+  long l;
+};
+
+#define CARENA_ALIGN(size) \
+  (((size) + sizeof(union carena_header) - 1) & \
+      ~(sizeof(union carena_header) - 1))
+
+struct carena_block {
+  struct carena_block * next;
+  size_t size;
+  size_t used;
+  union carena_header data[1];
+};
+
+#define BLOCK_DATA(block) ((char *) (block)->data)
+
+/* current and deferred arenas of the thread */
+
+enum {
+  SLOT_CURRENT,
+  SLOT_DEFERRED,
+  SLOT_COUNT
+};
+
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+static pthread_key_t slot_key[SLOT_COUNT];
+static pthread_once_t slot_once = PTHREAD_ONCE_INIT;
+
+static void slot_key_init(void)
+{
+  int i;
+  
+  for(i = 0 ; i < SLOT_COUNT ; i ++)
+    pthread_key_create(&slot_key[i], NULL);
+}
+
+#define SLOT_GET(slot) ((carena *) pthread_getspecific(slot_key[slot]))
+#define SLOT_SET(slot, arena) pthread_setspecific(slot_key[slot], arena)
+#define SLOT_INIT() pthread_once(&slot_once, slot_key_init)
+#define ATOMIC_INC(value) __atomic_add_fetch(&(value), 1, __ATOMIC_RELAXED)
+#define ATOMIC_DEC(value) __atomic_sub_fetch(&(value), 1, __ATOMIC_RELAXED)
+#define ATOMIC_GET(value) __atomic_load_n(&(value), __ATOMIC_RELAXED)
+#elif defined(WIN32)
+static __declspec(thread) carena * slot_arena[SLOT_COUNT];
+#define SLOT_GET(slot) slot_arena[slot]
+#define SLOT_SET(slot, arena) slot_arena[slot] = (arena)
+#define SLOT_INIT()
+#define ATOMIC_INC(value) InterlockedIncrement((LONG volatile *) &(value))
+#define ATOMIC_DEC(value) InterlockedDecrement((LONG volatile *) &(value))
+#define ATOMIC_GET(value) InterlockedCompareExchange((LONG volatile *) &(value), 0, 0)
+#else
+#error "What are your threads?"
+#endif
+#else
+static carena * slot_arena[SLOT_COUNT];
+#define SLOT_GET(slot) slot_arena[slot]
+#define SLOT_SET(slot, arena) slot_arena[slot] = (arena)
+#define SLOT_INIT()
+#define ATOMIC_INC(value) ((value) ++)
+#define ATOMIC_DEC(value) ((value) --)
+#define ATOMIC_GET(value) (value)
+#endif
+
+/* number of arenas set in the slots of all threads, the allocation
+   functions don't look up the thread arenas when it is zero. A thread
+   only reads its own slots, which it set before, so the counter needs
+   no ordering with the other memory accesses. */
+
+static int active_count = 0;
+
+static inline carena * get_slot(int slot)
+{
+  if (ATOMIC_GET(active_count) == 0)
+    return NULL;
+  
+  return SLOT_GET(slot);
+}
+
+static carena * set_slot(int slot, carena * arena)
+{
+  carena * old;
+  
+  SLOT_INIT();
+  old = SLOT_GET(slot);
+  if (old == arena)
+    return old;
+  
+  SLOT_SET(slot, arena);
+  
+  if (old == NULL)
+    ATOMIC_INC(active_count);
+  else if (arena == NULL)
+    ATOMIC_DEC(active_count);
+  
+  return old;
+}
+
+#define get_current() get_slot(SLOT_CURRENT)
+
+carena * carena_set_current(carena * arena)
+{
+  return set_slot(SLOT_CURRENT, arena);
+}
+
+carena * carena_get_current(void)
+{
+  return get_slot(SLOT_CURRENT);
+}
+
+carena * carena_set_deferred(carena * arena)
+{
+  return set_slot(SLOT_DEFERRED, arena);
+}
+
+carena * carena_get_deferred(void)
+{
+  return get_slot(SLOT_DEFERRED);
+}
+
+/*
+  Blocks are allocated on a multiple of block_align, the size of the
+  regular blocks, and the large blocks hold a single allocation at
+  their start. The block of an allocation is then at the address of
+  the allocation rounded down to block_align and a lookup in
+  block_table tells whether a pointer comes from the arena, without
+  reading the memory of foreign pointers.
+*/
+
+#ifdef WIN32
+#define block_aligned_free(block) _aligned_free(block)
+#else
+#define block_aligned_free(block) free(block)
+#endif
+
+static struct carena_block * block_new(carena * arena, size_t size)
+{
+  struct carena_block * block;
+  size_t alloc_size;
+  chashdatum key;
+  chashdatum value;
+  int r;
+  
+  alloc_size = offsetof(struct carena_block, data) + size;
+#ifdef WIN32
+  block = _aligned_malloc(alloc_size, arena->block_align);
+  if (block == NULL)
+    return NULL;
+#else
+  if (posix_memalign((void **) &block, arena->block_align, alloc_size) != 0)
+    return NULL;
+#endif
+  
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+  
+  key.data = &block;
+  key.len = sizeof(block);
+  value.data = block;
+  value.len = 0;
+  r = chash_set(arena->block_table, &key, &value, NULL);
+  if (r < 0) {
+    block_aligned_free(block);
+    return NULL;
+  }
+  
+  return block;
+}
+
+static void block_free(carena * arena, struct carena_block * block)
+{
+  chashdatum key;
+  
+  key.data = &block;
+  key.len = sizeof(block);
+  chash_delete(arena->block_table, &key, NULL);
+  block_aligned_free(block);
+}
+
+carena * carena_new(size_t block_size)
+{
+  carena * arena;
+  size_t block_align;
+  
+  if (block_size == 0)
+    block_size = CARENA_DEFAULT_BLOCK_SIZE;
+  
+  block_align = sizeof(union carena_header);
+  while (block_align < offsetof(struct carena_block, data) + block_size)
+    block_align *= 2;
+  
+  arena = malloc(sizeof(* arena));
+  if (arena == NULL)
+    return NULL;
+  
+  arena->block_table = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
+  if (arena->block_table == NULL) {
+    free(arena);
+    return NULL;
+  }
+  
+  arena->first = NULL;
+  arena->current = NULL;
+  /* the regular blocks fill their alignment */
+  arena->block_align = block_align;
+  arena->block_size = (block_align - offsetof(struct carena_block, data)) &
+    ~(sizeof(union carena_header) - 1);
+  arena->allocations = 0;
+  arena->bytes = 0;
+  arena->blocks = 0;
+  
+  return arena;
+}
+
+void carena_free(carena * arena)
+{
+  struct carena_block * block;
+  
+  block = arena->first;
+  while (block != NULL) {
+    struct carena_block * next;
+    
+    next = block->next;
+    block_aligned_free(block);
+    block = next;
+  }
+  
+  chash_free(arena->block_table);
+  free(arena);
+}
+
+void carena_reset(carena * arena)
+{
+  struct carena_block * block;
+  struct carena_block * kept;
+  
+  kept = NULL;
+  block = arena->first;
+  while (block != NULL) {
+    struct carena_block * next;
+    
+    next = block->next;
+    if ((kept == NULL) && (block->size == arena->block_size)) {
+      kept = block;
+      kept->next = NULL;
+      kept->used = 0;
+    }
+    else {
+      block_free(arena, block);
+    }
+    block = next;
+  }
+  
+  arena->first = kept;
+  arena->current = kept;
+  arena->allocations = 0;
+  arena->bytes = 0;
+  arena->blocks = (kept != NULL) ? 1 : 0;
+}
+
+void * carena_alloc(carena * arena, size_t size)
+{
+  struct carena_block * block;
+  union carena_header * header;
+  size_t needed;
+  
+  needed = sizeof(* header) + CARENA_ALIGN(size);
+  
+  block = arena->current;
+  if ((block == NULL) || (block->size - block->used < needed)) {
+    if (needed > arena->block_size / 4) {
+      /* large allocations get their own block, the current block
+         is kept for the next small allocations */
+      block = block_new(arena, needed);
+      if (block == NULL)
+        return NULL;
+      
+      block->next = arena->first;
+      arena->first = block;
+      if (arena->current == NULL)
+        arena->current = block;
+    }
+    else {
+      block = block_new(arena, arena->block_size);
+      if (block == NULL)
+        return NULL;
+      
+      block->next = arena->first;
+      arena->first = block;
+      arena->current = block;
+    }
+    arena->blocks ++;
+  }
+  
+  header = (union carena_header *) (BLOCK_DATA(block) + block->used);
+  header->size = size;
+  block->used += needed;
+  
+  arena->allocations ++;
+  arena->bytes += size;
+  
+  return header + 1;
+}
+
+static struct carena_block * find_block(carena * arena, const void * ptr)
+{
+  struct carena_block * block;
+  const char * p;
+  
+  p = ptr;
+  block = (struct carena_block *)
+    ((uintptr_t) p & ~((uintptr_t) arena->block_align - 1));
+  if ((block == NULL) || (block != arena->current)) {
+    chashdatum key;
+    chashdatum value;
+    int r;
+    
+    key.data = &block;
+    key.len = sizeof(block);
+    r = chash_get(arena->block_table, &key, &value);
+    if (r < 0)
+      return NULL;
+  }
+  
+  if ((p > BLOCK_DATA(block)) && (p < BLOCK_DATA(block) + block->used))
+    return block;
+  
+  return NULL;
+}
+
+int carena_contains(carena * arena, const void * ptr)
+{
+  return find_block(arena, ptr) != NULL;
+}
+
+/* returns 1 if ptr is the last allocation of the block */
+
+static inline int is_last(struct carena_block * block, const void * ptr)
+{
+  const union carena_header * header;
+  
+  header = ((const union carena_header *) ptr) - 1;
+  return (const char *) (header + 1) + CARENA_ALIGN(header->size) ==
+    BLOCK_DATA(block) + block->used;
+}
+
+void * carena_malloc(size_t size)
+{
+  carena * arena;
+  
+  arena = get_current();
+  if (arena == NULL)
+    return malloc(size);
+  
+  return carena_alloc(arena, size);
+}
+
+void * carena_calloc(size_t count, size_t size)
+{
+  carena * arena;
+  void * ptr;
+  
+  arena = get_current();
+  if (arena == NULL)
+    return calloc(count, size);
+  
+  if ((size != 0) && (count > (size_t) -1 / size))
+    return NULL;
+  
+  ptr = carena_alloc(arena, count * size);
+  if (ptr == NULL)
+    return NULL;
+  memset(ptr, 0, count * size);
+  
+  return ptr;
+}
+
+void * carena_realloc(void * ptr, size_t size)
+{
+  carena * arena;
+  struct carena_block * block;
+  union carena_header * header;
+  void * new_ptr;
+  
+  arena = get_current();
+  if (arena == NULL)
+    return realloc(ptr, size);
+  
+  if (ptr == NULL)
+    return carena_alloc(arena, size);
+  
+  block = find_block(arena, ptr);
+  if (block == NULL)
+    return realloc(ptr, size);
+  
+  header = ((union carena_header *) ptr) - 1;
+  
+  /* the last allocation of the block can grow in place */
+  if (is_last(block, ptr)) {
+    size_t start;
+    
+    start = (char *) ptr - BLOCK_DATA(block);
+    if (block->size - start >= CARENA_ALIGN(size)) {
+      if (size > header->size)
+        arena->bytes += size - header->size;
+      block->used = start + CARENA_ALIGN(size);
+      header->size = size;
+      return ptr;
+    }
+  }
+  
+  if (size <= header->size)
+    return ptr;
+  
+  new_ptr = carena_alloc(arena, size);
+  if (new_ptr == NULL)
+    return NULL;
+  memcpy(new_ptr, ptr, header->size);
+  
+  return new_ptr;
+}
+
+char * carena_strndup(const char * str, size_t len)
+{
+  carena * arena;
+  size_t str_len;
+  char * dup;
+  
+  str_len = 0;
+  while ((str_len < len) && (str[str_len] != '\0'))
+    str_len ++;
+  
+  arena = get_current();
+  if (arena == NULL)
+    dup = malloc(str_len + 1);
+  else
+    dup = carena_alloc(arena, str_len + 1);
+  if (dup == NULL)
+    return NULL;
+  
+  memcpy(dup, str, str_len);
+  dup[str_len] = '\0';
+  
+  return dup;
+}
+
+char * carena_strdup(const char * str)
+{
+  carena * arena;
+  size_t len;
+  char * dup;
+  
+  arena = get_current();
+  if (arena == NULL)
+    return strdup(str);
+  
+  len = strlen(str) + 1;
+  dup = carena_alloc(arena, len);
+  if (dup == NULL)
+    return NULL;
+  memcpy(dup, str, len);
+  
+  return dup;
+}
+
+void carena_release(void * ptr)
+{
+  int slot;
+  
+  if (ptr == NULL)
+    return;
+  
+  for(slot = 0 ; slot < SLOT_COUNT ; slot ++) {
+    carena * arena;
+    struct carena_block * block;
+    
+    arena = get_slot(slot);
+    if (arena == NULL)
+      continue;
+    
+    block = find_block(arena, ptr);
+    if (block != NULL) {
+      /* temporary values freed right after their allocation
+         give back their space */
+      if ((slot == SLOT_CURRENT) && is_last(block, ptr))
+        block->used = (char *) (((union carena_header *) ptr) - 1) -
+          BLOCK_DATA(block);
+      return;
+    }
+  }
+  
+  free(ptr);
+}
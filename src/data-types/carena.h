@@ -0,0 +1,156 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2005 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CARENA_H
+#define CARENA_H
+
+#ifndef LIBETPAN_CONFIG_H
+#       include <libetpan/libetpan-config.h>
+#endif
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  carena - region allocator for parse trees.
+
+  While an arena is the current arena of a thread, the IMF and MIME
+  parsers (and the clist cells they create) allocate from it instead
+  of the heap. The whole tree is then released with a single call to
+  carena_free().
+
+    arena = carena_new(0);
+    old = carena_set_current(arena);
+    r = mailimf_fields_parse(message, length, &cur_token, &fields);
+    carena_set_current(old);
+    ...
+    carena_free(arena);
+
+  Trees allocated from an arena must not be passed to the *_free()
+  functions unless the arena is current; in that case, freeing is
+  a no-op for memory owned by the arena. Trees parsed while no arena
+  is current are plain heap trees and are released with *_free() as
+  usual.
+*/
+
+struct carena_block;
+struct chash;
+
+typedef struct carena_s {
+  struct carena_block * first;
+  struct carena_block * current;
+  size_t block_size;
+  
+  /* blocks are aligned on block_align, block_table maps their
+     addresses to find the block of a pointer */
+  size_t block_align;
+  struct chash * block_table;
+  
+  /* statistics */
+  unsigned long allocations;
+  size_t bytes;
+  unsigned int blocks;
+} carena;
+
+/* carena_new() creates an arena, block_size is the size of the
+   allocated chunks, 0 uses the default size */
+LIBETPAN_EXPORT
+carena * carena_new(size_t block_size);
+
+/* carena_free() releases the arena and everything allocated from it */
+LIBETPAN_EXPORT
+void carena_free(carena * arena);
+
+/* carena_reset() releases everything allocated from the arena but
+   keeps the first block for reuse */
+LIBETPAN_EXPORT
+void carena_reset(carena * arena);
+
+LIBETPAN_EXPORT
+void * carena_alloc(carena * arena, size_t size);
+
+/* carena_set_current() sets the arena used by the parsers in the
+   calling thread and returns the previous one, NULL disables it */
+LIBETPAN_EXPORT
+carena * carena_set_current(carena * arena);
+
+LIBETPAN_EXPORT
+carena * carena_get_current(void);
+
+/*
+  carena_set_deferred() sets the deferred arena of the calling thread
+  and returns the previous one. The allocation functions don't use
+  it, a parser that builds only a part of its result from an arena
+  makes it current around that part. Memory of the deferred arena is
+  not released by carena_release().
+*/
+
+LIBETPAN_EXPORT
+carena * carena_set_deferred(carena * arena);
+
+LIBETPAN_EXPORT
+carena * carena_get_deferred(void);
+
+/* carena_contains() returns 1 if ptr was allocated from the arena */
+LIBETPAN_EXPORT
+int carena_contains(carena * arena, const void * ptr);
+
+/* allocation functions used by the parsers, they use the current
+   arena if any, the heap otherwise */
+
+LIBETPAN_EXPORT
+void * carena_malloc(size_t size);
+
+LIBETPAN_EXPORT
+void * carena_calloc(size_t count, size_t size);
+
+LIBETPAN_EXPORT
+void * carena_realloc(void * ptr, size_t size);
+
+LIBETPAN_EXPORT
+char * carena_strdup(const char * str);
+
+LIBETPAN_EXPORT
+char * carena_strndup(const char * str, size_t len);
+
+/* carena_release() does nothing for memory of the current or deferred
+   arena and calls free() otherwise */
+LIBETPAN_EXPORT
+void carena_release(void * ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2005 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+  Redirects the allocation functions, and the ones of clist, to the
+  current arena of the thread, see carena.h. This file must be
+  included after all the system headers of the source file.
+*/
+
+#ifndef CARENA_WRAPPERS_H
+#define CARENA_WRAPPERS_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "carena.h"
+
+#undef malloc
+#undef calloc
+#undef realloc
+#undef strdup
+#undef strndup
+#undef free
+
+#define malloc carena_malloc
+#define calloc carena_calloc
+#define realloc carena_realloc
+#define strdup carena_strdup
+#define strndup carena_strndup
+#define free carena_release
+
+#undef clist_new
+#undef clist_free
+#undef clist_prepend
+#undef clist_append
+#undef clist_insert_before
+#undef clist_insert_after
+#undef clist_delete
+
+#define clist_new clist_new_arena
+#define clist_free clist_free_arena
+#define clist_prepend(lst, data) clist_prepend_arena(lst, data)
+#define clist_append(lst, data) clist_append_arena(lst, data)
+#define clist_insert_before clist_insert_before_arena
+#define clist_insert_after clist_insert_after_arena
+#define clist_delete clist_delete_arena
+
+#endif
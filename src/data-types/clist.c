@@ -47,14 +47,37 @@
 
 #include "clist.h"
 
+#include "carena.h"
+
+/*
+  the _arena variants allocate from the current arena of the thread
+  and release with carena_release(), the other functions always use
+  the heap
+*/
+
+static inline void clist_init(clist * lst) {
+  lst->first = lst->last = NULL;
+  lst->count = 0;
+}
+
 clist * clist_new(void) {
   clist * lst;
   
   lst = (clist *) malloc(sizeof(clist));
   if (!lst) return NULL;
   
-  lst->first = lst->last = NULL;
-  lst->count = 0;
+  clist_init(lst);
+  
+  return lst;
+}
+
+clist * clist_new_arena(void) {
+  clist * lst;
+  
+  lst = (clist *) carena_malloc(sizeof(clist));
+  if (!lst) return NULL;
+  
+  clist_init(lst);
   
   return lst;
 }
@@ -72,6 +95,19 @@ void clist_free(clist * lst) {
   free(lst);
 }
 
+void clist_free_arena(clist * lst) {
+  clistcell * l1, * l2;
+  
+  l1 = lst->first;
+  while (l1) {
+    l2 = l1->next;
+    carena_release(l1);
+    l1 = l2;
+  }
+  
+  carena_release(lst);
+}
+
 #ifdef NO_MACROS
 int clist_isempty(clist * lst) {
   return ((lst->first==lst->last) && (lst->last==NULL));
@@ -117,21 +153,24 @@ int clist_prepend(clist * lst, void * data) {
 int clist_append(clist * lst, void * data) {
   return clist_insert_after(lst, lst->last, data);
 }
-#endif
 
-int clist_insert_before(clist * lst, clistiter * iter, void * data) {
-  clistcell * c;
+int clist_prepend_arena(clist * lst, void * data) {
+  return clist_insert_before_arena(lst, lst->first, data);
+}
 
-  c = (clistcell *) malloc(sizeof(clistcell));
-  if (!c) return -1;
+int clist_append_arena(clist * lst, void * data) {
+  return clist_insert_after_arena(lst, lst->last, data);
+}
+#endif
 
-  c->data = data;
+static inline void clist_link_before(clist * lst, clistiter * iter,
+    clistcell * c) {
   lst->count++;
   
   if (clist_isempty(lst)) {
     c->previous = c->next = NULL;
     lst->first = lst->last = c;
-    return 0;
+    return;
   }
   
   if (!iter) {
@@ -139,9 +178,9 @@ int clist_insert_before(clist * lst, clistiter * iter, void * data) {
     c->previous->next = c;
     c->next = NULL;
     lst->last = c;
-    return 0;
+    return;
   }
-
+  
   c->previous = iter->previous;
   c->next = iter;
   c->next->previous = c;
@@ -149,23 +188,16 @@ int clist_insert_before(clist * lst, clistiter * iter, void * data) {
     c->previous->next = c;
   else
     lst->first = c;
-
-  return 0;
 }
 
-int clist_insert_after(clist * lst, clistiter * iter, void * data) {
-  clistcell * c;
-
-  c = (clistcell *) malloc(sizeof(clistcell));
-  if (!c) return -1;
-
-  c->data = data;
+static inline void clist_link_after(clist * lst, clistiter * iter,
+    clistcell * c) {
   lst->count++;
   
   if (clist_isempty(lst)) {
     c->previous = c->next = NULL;
     lst->first = lst->last = c;
-    return 0;
+    return;
   }
   
   if (!iter) {
@@ -173,9 +205,9 @@ int clist_insert_after(clist * lst, clistiter * iter, void * data) {
     c->previous->next = c;
     c->next = NULL;
     lst->last = c;
-    return 0;
+    return;
   }
-
+  
   c->previous = iter;
   c->next = iter->next;
   if (c->next)
@@ -183,20 +215,16 @@ int clist_insert_after(clist * lst, clistiter * iter, void * data) {
   else
     lst->last = c;
   c->previous->next = c;
-
-  return 0;
 }
 
-clistiter * clist_delete(clist * lst, clistiter * iter) {
+static inline clistiter * clist_unlink(clist * lst, clistiter * iter) {
   clistiter * ret;
   
-  if (!iter) return NULL;
-
-  if (iter->previous) 
+  if (iter->previous)
     iter->previous->next = iter->next;
   else
     lst->first = iter->next;
-
+  
   if (iter->next) {
     iter->next->previous = iter->previous;
     ret = iter->next;
@@ -204,9 +232,78 @@ clistiter * clist_delete(clist * lst, clistiter * iter) {
     lst->last = iter->previous;
     ret = NULL;
   }
+  
+  lst->count--;
+  
+  return ret;
+}
 
+int clist_insert_before(clist * lst, clistiter * iter, void * data) {
+  clistcell * c;
+  
+  c = (clistcell *) malloc(sizeof(clistcell));
+  if (!c) return -1;
+  
+  c->data = data;
+  clist_link_before(lst, iter, c);
+  
+  return 0;
+}
+
+int clist_insert_before_arena(clist * lst, clistiter * iter, void * data) {
+  clistcell * c;
+  
+  c = (clistcell *) carena_malloc(sizeof(clistcell));
+  if (!c) return -1;
+  
+  c->data = data;
+  clist_link_before(lst, iter, c);
+  
+  return 0;
+}
+
+int clist_insert_after(clist * lst, clistiter * iter, void * data) {
+  clistcell * c;
+  
+  c = (clistcell *) malloc(sizeof(clistcell));
+  if (!c) return -1;
+  
+  c->data = data;
+  clist_link_after(lst, iter, c);
+  
+  return 0;
+}
+
+int clist_insert_after_arena(clist * lst, clistiter * iter, void * data) {
+  clistcell * c;
+  
+  c = (clistcell *) carena_malloc(sizeof(clistcell));
+  if (!c) return -1;
+  
+  c->data = data;
+  clist_link_after(lst, iter, c);
+  
+  return 0;
+}
+
+clistiter * clist_delete(clist * lst, clistiter * iter) {
+  clistiter * ret;
+  
+  if (!iter) return NULL;
+  
+  ret = clist_unlink(lst, iter);
   free(iter);
-  lst->count--;
+  
+  return ret;
+}
+
+clistiter * clist_delete_arena(clist * lst, clistiter * iter) {
+  clistiter * ret;
+  
+  if (!iter) return NULL;
+  
+  ret = clist_unlink(lst, iter);
+  carena_release(iter);
   
   return ret;
 }
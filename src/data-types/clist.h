@@ -70,6 +70,18 @@ clist *      clist_new(void);
 LIBETPAN_EXPORT
 void        clist_free(clist *);
 
+/*
+  The _arena variants allocate the list and its cells from the current
+  arena of the thread and release them with carena_release(), see
+  carena.h. The parsers use them through carena_wrappers.h, the other
+  functions always use the heap.
+*/
+LIBETPAN_EXPORT
+clist *      clist_new_arena(void);
+
+LIBETPAN_EXPORT
+void        clist_free_arena(clist *);
+
 /* Some of the following routines can be implemented as macros to
    be faster. If you don't want it, define NO_MACROS */
 #ifdef NO_MACROS
@@ -100,6 +112,10 @@ int         clist_prepend(clist *, void *);
 
 /* Inserts this data pointer at the end of the list */
 int         clist_append(clist *, void *);
+
+int         clist_prepend_arena(clist *, void *);
+
+int         clist_append_arena(clist *, void *);
 #else
 #define     clist_isempty(lst)             (((lst)->first==(lst)->last) && ((lst)->last==NULL))
 #define     clist_count(lst)               ((lst)->count)
@@ -110,6 +126,8 @@ int         clist_append(clist *, void *);
 #define     clist_content(iter)            (iter ? (iter)->data : NULL)
 #define     clist_prepend(lst, data)  (clist_insert_before(lst, (lst)->first, data))
 #define     clist_append(lst, data)   (clist_insert_after(lst, (lst)->last, data))
+#define     clist_prepend_arena(lst, data)  (clist_insert_before_arena(lst, (lst)->first, data))
+#define     clist_append_arena(lst, data)   (clist_insert_after_arena(lst, (lst)->last, data))
 #endif
 
 /* Inserts this data pointer before the element pointed by the iterator */
@@ -120,11 +138,20 @@ int         clist_insert_before(clist *, clistiter *, void *);
 LIBETPAN_EXPORT
 int         clist_insert_after(clist *, clistiter *, void *);
 
+LIBETPAN_EXPORT
+int         clist_insert_before_arena(clist *, clistiter *, void *);
+
+LIBETPAN_EXPORT
+int         clist_insert_after_arena(clist *, clistiter *, void *);
+
 /* Deletes the element pointed by the iterator.
    Returns an iterator to the next element. */
 LIBETPAN_EXPORT
 clistiter *   clist_delete(clist *, clistiter *);
 
+LIBETPAN_EXPORT
+clistiter *   clist_delete_arena(clist *, clistiter *);
+
 typedef void (* clist_func)(void *, void *);
 
 LIBETPAN_EXPORT
@@ -0,0 +1,558 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2005 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "cohash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define COHASH_MINSIZE 16
+
+/* the table is grown when it is more than 7/8 full */
+#define COHASH_FULL(count, size) ((uint64_t) (count) * 8 > (uint64_t) (size) * 7)
+
+/*
+  hash function, this is the wyhash construction (64 bits
+  multiply and fold of the input with fixed secrets)
+*/
+
+static const uint64_t cohash_secret[4] = {
+  0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+  0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+static inline void cohash_mum(uint64_t * a, uint64_t * b)
+{
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r;
+
+  r = (__uint128_t) * a * * b;
+  * a = (uint64_t) r;
+  * b = (uint64_t) (r >> 64);
+#else
+  uint64_t ha, hb, la, lb;
+  uint64_t rh, rm0, rm1, rl;
+  uint64_t t, lo, hi, c;
+
+  ha = * a >> 32;
+  hb = * b >> 32;
+  la = (uint32_t) * a;
+  lb = (uint32_t) * b;
+  rh = ha * hb;
+  rm0 = ha * lb;
+  rm1 = hb * la;
+  rl = la * lb;
+  t = rl + (rm0 << 32);
+  c = t < rl;
+  lo = t + (rm1 << 32);
+  c += lo < t;
+  hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+  * a = lo;
+  * b = hi;
+#endif
+}
+
+static inline uint64_t cohash_mix(uint64_t a, uint64_t b)
+{
+  cohash_mum(&a, &b);
+  return a ^ b;
+}
+
+static inline uint64_t cohash_read8(const unsigned char * p)
+{
+  uint64_t v;
+
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static inline uint64_t cohash_read4(const unsigned char * p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, 4);
+  return v;
+}
+
+LIBETPAN_EXPORT
+uint64_t cohash_func(const void * data, size_t len)
+{
+  const unsigned char * p;
+  uint64_t seed;
+  uint64_t a;
+  uint64_t b;
+
+  p = data;
+  seed = cohash_mix(cohash_secret[0], cohash_secret[1]);
+
+  if (len <= 16) {
+    if (len >= 4) {
+      a = (cohash_read4(p) << 32) | cohash_read4(p + ((len >> 3) << 2));
+      b = (cohash_read4(p + len - 4) << 32) |
+        cohash_read4(p + len - 4 - ((len >> 3) << 2));
+    }
+    else if (len > 0) {
+      a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+      b = 0;
+    }
+    else {
+      a = 0;
+      b = 0;
+    }
+  }
+  else {
+    size_t i;
+
+    i = len;
+    if (i > 48) {
+      uint64_t see1;
+      uint64_t see2;
+
+      see1 = seed;
+      see2 = seed;
+      do {
+        seed = cohash_mix(cohash_read8(p) ^ cohash_secret[1],
+            cohash_read8(p + 8) ^ seed);
+        see1 = cohash_mix(cohash_read8(p + 16) ^ cohash_secret[2],
+            cohash_read8(p + 24) ^ see1);
+        see2 = cohash_mix(cohash_read8(p + 32) ^ cohash_secret[3],
+            cohash_read8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = cohash_mix(cohash_read8(p) ^ cohash_secret[1],
+          cohash_read8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = cohash_read8(p + i - 16);
+    b = cohash_read8(p + i - 8);
+  }
+
+  a ^= cohash_secret[1];
+  b ^= seed;
+  cohash_mum(&a, &b);
+
+  return cohash_mix(a ^ cohash_secret[0] ^ len, b ^ cohash_secret[1]);
+}
+
+static inline uint32_t cohash_key_func(const void * data, unsigned int len)
+{
+  return (uint32_t) cohash_func(data, len);
+}
+
+static inline int cohash_key_inline(cohash * hash, unsigned int len)
+{
+  return hash->copykey && (len <= COHASH_INLINE_KEY);
+}
+
+static inline void * cohash_cell_key(struct cohashcell * cell)
+{
+  if (cell->key_inline)
+    return cell->key.data;
+  return cell->key.ptr;
+}
+
+static inline void * cohash_dup(const void * data, unsigned int len)
+{
+  void * r;
+
+  /* malloc(0) may return NULL */
+  r = malloc(len > 0 ? len : 1);
+  if (r == NULL)
+    return NULL;
+  memcpy(r, data, len);
+  return r;
+}
+
+static void cohash_cell_release(cohash * hash, struct cohashcell * cell)
+{
+  if (hash->copykey && !cell->key_inline)
+    free(cell->key.ptr);
+  if (hash->copyvalue)
+    free(cell->value);
+}
+
+/* Robin Hood insertion of an entry that is not in the table */
+
+static void cohash_place(struct cohashcell * cells, unsigned int mask,
+    struct cohashcell * entry)
+{
+  struct cohashcell tmp;
+  unsigned int pos;
+
+  pos = entry->func & mask;
+  entry->dist = 1;
+  while (1) {
+    struct cohashcell * cell;
+
+    cell = &cells[pos];
+    if (cell->dist == 0) {
+      * cell = * entry;
+      return;
+    }
+    if (cell->dist < entry->dist) {
+      tmp = * cell;
+      * cell = * entry;
+      * entry = tmp;
+    }
+    pos = (pos + 1) & mask;
+    entry->dist ++;
+  }
+}
+
+static int cohash_resize(cohash * hash, unsigned int size)
+{
+  struct cohashcell * cells;
+  unsigned int i;
+
+  cells = calloc(size, sizeof(* cells));
+  if (cells == NULL)
+    return -1;
+
+  for(i = 0 ; i < hash->size ; i ++) {
+    struct cohashcell entry;
+
+    if (hash->cells[i].dist == 0)
+      continue;
+    entry = hash->cells[i];
+    cohash_place(cells, size - 1, &entry);
+  }
+
+  free(hash->cells);
+  hash->cells = cells;
+  hash->size = size;
+  hash->mask = size - 1;
+
+  return 0;
+}
+
+LIBETPAN_EXPORT
+int cohash_reserve(cohash * hash, unsigned int count)
+{
+  uint64_t size;
+
+  size = hash->size;
+  while (COHASH_FULL(count, size))
+    size *= 2;
+  if (size > 0x80000000U)
+    return -1;
+  if (size == hash->size)
+    return 0;
+
+  return cohash_resize(hash, (unsigned int) size);
+}
+
+LIBETPAN_EXPORT
+cohash * cohash_new(unsigned int size, int flags)
+{
+  cohash * hash;
+
+  hash = malloc(sizeof(* hash));
+  if (hash == NULL)
+    goto err;
+
+  hash->count = 0;
+  hash->size = COHASH_MINSIZE;
+  hash->mask = COHASH_MINSIZE - 1;
+  hash->copykey = flags & CHASH_COPYKEY;
+  hash->copyvalue = flags & CHASH_COPYVALUE;
+  hash->cells = calloc(hash->size, sizeof(* hash->cells));
+  if (hash->cells == NULL)
+    goto free;
+
+  if (cohash_reserve(hash, size) < 0)
+    goto free_cells;
+
+  return hash;
+
+ free_cells:
+  free(hash->cells);
+ free:
+  free(hash);
+ err:
+  return NULL;
+}
+
+LIBETPAN_EXPORT
+void cohash_clear(cohash * hash)
+{
+  unsigned int i;
+
+  for(i = 0 ; i < hash->size ; i ++) {
+    if (hash->cells[i].dist != 0)
+      cohash_cell_release(hash, &hash->cells[i]);
+  }
+  memset(hash->cells, 0, hash->size * sizeof(* hash->cells));
+  hash->count = 0;
+}
+
+LIBETPAN_EXPORT
+void cohash_free(cohash * hash)
+{
+  cohash_clear(hash);
+  free(hash->cells);
+  free(hash);
+}
+
+static struct cohashcell * cohash_find(cohash * hash, uint32_t func,
+    chashdatum * key)
+{
+  unsigned int pos;
+  uint32_t dist;
+
+  pos = func & hash->mask;
+  dist = 1;
+  while (1) {
+    struct cohashcell * cell;
+
+    cell = &hash->cells[pos];
+    /* an entry further than its own slot would be is not there */
+    if (cell->dist < dist)
+      return NULL;
+    if ((cell->func == func) && (cell->key_len == key->len) &&
+        (memcmp(cohash_cell_key(cell), key->data, key->len) == 0))
+      return cell;
+    pos = (pos + 1) & hash->mask;
+    dist ++;
+  }
+}
+
+LIBETPAN_EXPORT
+int cohash_get(cohash * hash, chashdatum * key, chashdatum * result)
+{
+  struct cohashcell * cell;
+
+  cell = cohash_find(hash, cohash_key_func(key->data, key->len), key);
+  if (cell == NULL)
+    return -1;
+
+  result->data = cell->value;
+  result->len = cell->value_len;
+
+  return 0;
+}
+
+LIBETPAN_EXPORT
+int cohash_set(cohash * hash,
+    chashdatum * key,
+    chashdatum * value,
+    chashdatum * oldvalue)
+{
+  struct cohashcell * cell;
+  struct cohashcell entry;
+  uint32_t func;
+  void * data;
+
+  if (key->len > COHASH_MAX_KEY_LEN)
+    return -1;
+
+  func = cohash_key_func(key->data, key->len);
+
+  cell = cohash_find(hash, func, key);
+  if (cell != NULL) {
+    if (hash->copyvalue) {
+      data = cohash_dup(value->data, value->len);
+      if (data == NULL)
+        return -1;
+      free(cell->value);
+      if (oldvalue != NULL) {
+        oldvalue->data = NULL;
+        oldvalue->len = 0;
+      }
+    }
+    else {
+      data = value->data;
+      if (oldvalue != NULL) {
+        oldvalue->data = cell->value;
+        oldvalue->len = cell->value_len;
+      }
+    }
+    cell->value = data;
+    cell->value_len = value->len;
+    if (!hash->copykey)
+      cell->key.ptr = key->data;
+
+    return 0;
+  }
+
+  if (oldvalue != NULL) {
+    oldvalue->data = NULL;
+    oldvalue->len = 0;
+  }
+
+  if (COHASH_FULL(hash->count + 1, hash->size)) {
+    if (cohash_reserve(hash, hash->count + 1) < 0)
+      goto err;
+  }
+
+  entry.func = func;
+  entry.key_len = key->len;
+  entry.key_inline = cohash_key_inline(hash, key->len);
+  if (entry.key_inline)
+    memcpy(entry.key.data, key->data, key->len);
+  else if (hash->copykey) {
+    entry.key.ptr = cohash_dup(key->data, key->len);
+    if (entry.key.ptr == NULL)
+      goto err;
+  }
+  else
+    entry.key.ptr = key->data;
+
+  entry.value_len = value->len;
+  if (hash->copyvalue) {
+    entry.value = cohash_dup(value->data, value->len);
+    if (entry.value == NULL)
+      goto free_key;
+  }
+  else
+    entry.value = value->data;
+
+  cohash_place(hash->cells, hash->mask, &entry);
+  hash->count ++;
+
+  return 0;
+
+ free_key:
+  if (hash->copykey && !entry.key_inline)
+    free(entry.key.ptr);
+ err:
+  return -1;
+}
+
+LIBETPAN_EXPORT
+int cohash_set_bulk(cohash * hash,
+    chashdatum * keys,
+    chashdatum * values,
+    unsigned int count)
+{
+  unsigned int i;
+
+  if (cohash_reserve(hash, hash->count + count) < 0)
+    return -1;
+
+  for(i = 0 ; i < count ; i ++) {
+    if (cohash_set(hash, &keys[i], &values[i], NULL) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+LIBETPAN_EXPORT
+int cohash_delete(cohash * hash, chashdatum * key, chashdatum * oldvalue)
+{
+  struct cohashcell * cell;
+  unsigned int pos;
+
+  cell = cohash_find(hash, cohash_key_func(key->data, key->len), key);
+  if (cell == NULL)
+    return -1;
+
+  if (oldvalue != NULL) {
+    if (hash->copyvalue) {
+      oldvalue->data = NULL;
+      oldvalue->len = 0;
+    }
+    else {
+      oldvalue->data = cell->value;
+      oldvalue->len = cell->value_len;
+    }
+  }
+  cohash_cell_release(hash, cell);
+
+  /* backward shift of the following entries, no tombstone is left */
+  pos = (unsigned int) (cell - hash->cells);
+  while (1) {
+    unsigned int next;
+
+    next = (pos + 1) & hash->mask;
+    if (hash->cells[next].dist <= 1)
+      break;
+    hash->cells[pos] = hash->cells[next];
+    hash->cells[pos].dist --;
+    pos = next;
+  }
+  hash->cells[pos].dist = 0;
+  hash->count --;
+
+  return 0;
+}
+
+LIBETPAN_EXPORT
+cohashiter * cohash_begin(cohash * hash)
+{
+  unsigned int i;
+
+  for(i = 0 ; i < hash->size ; i ++) {
+    if (hash->cells[i].dist != 0)
+      return &hash->cells[i];
+  }
+
+  return NULL;
+}
+
+LIBETPAN_EXPORT
+cohashiter * cohash_next(cohash * hash, cohashiter * iter)
+{
+  unsigned int i;
+
+  if (iter == NULL)
+    return NULL;
+
+  for(i = (unsigned int) (iter - hash->cells) + 1 ; i < hash->size ; i ++) {
+    if (hash->cells[i].dist != 0)
+      return &hash->cells[i];
+  }
+
+  return NULL;
+}
+
+LIBETPAN_EXPORT
+void cohash_key(cohashiter * iter, chashdatum * result)
+{
+  result->data = cohash_cell_key(iter);
+  result->len = iter->key_len;
+}
+
+LIBETPAN_EXPORT
+void cohash_value(cohashiter * iter, chashdatum * result)
+{
+  result->data = iter->value;
+  result->len = iter->value_len;
+}
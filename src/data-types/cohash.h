@@ -0,0 +1,161 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2005 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef COHASH_H
+#define COHASH_H
+
+#ifndef LIBETPAN_CONFIG_H
+#       include <libetpan/libetpan-config.h>
+#endif
+
+#include <libetpan/chash.h>
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  cohash - open addressing hash table.
+
+  cohash is an alternative to chash with the same interface, keys and
+  values are given as chashdatum and the same copy flags are used.
+  The entries are stored in a single array (Robin Hood hashing), keys
+  of up to COHASH_INLINE_KEY bytes are copied inside the entry, so that
+  a table with small keys makes no allocation per entry.
+
+  Differences with chash :
+  - the iterators are invalidated by any change to the table.
+  - the data pointer of a key that is copied inline may change when
+    the table is changed, values are never copied inline.
+*/
+
+#define COHASH_INLINE_KEY 16
+#define COHASH_MAX_KEY_LEN 0x7fffffffU
+
+struct cohashcell {
+  uint32_t func;
+  /* probe distance + 1, 0 for an empty entry */
+  uint32_t dist;
+  unsigned int key_len : 31;
+  /* the key is copied in key.data */
+  unsigned int key_inline : 1;
+  unsigned int value_len;
+  union {
+    void * ptr;
+    char data[COHASH_INLINE_KEY];
+  } key;
+  void * value;
+};
+
+struct cohash {
+  unsigned int size;
+  unsigned int count;
+  unsigned int mask;
+  int copyvalue;
+  int copykey;
+  struct cohashcell * cells;
+};
+
+typedef struct cohash cohash;
+typedef struct cohashcell cohashiter;
+
+/* Allocates a new (empty) hash using this initial size and the given
+   flags (CHASH_COPYNONE, CHASH_COPYKEY, CHASH_COPYVALUE or
+   CHASH_COPYALL) */
+LIBETPAN_EXPORT
+cohash * cohash_new(unsigned int size, int flags);
+
+LIBETPAN_EXPORT
+void cohash_free(cohash * hash);
+
+LIBETPAN_EXPORT
+void cohash_clear(cohash * hash);
+
+/* Adds an entry in the hash table, an existing entry for this key is
+   replaced. (* oldvalue) is the previous value if it is not copied,
+   the data pointer is NULL otherwise. Returns 0 on success, -1 on
+   error or when the key is longer than COHASH_MAX_KEY_LEN. */
+LIBETPAN_EXPORT
+int cohash_set(cohash * hash,
+    chashdatum * key,
+    chashdatum * value,
+    chashdatum * oldvalue);
+
+/* Adds count entries, the table is resized once beforehand. */
+LIBETPAN_EXPORT
+int cohash_set_bulk(cohash * hash,
+    chashdatum * keys,
+    chashdatum * values,
+    unsigned int count);
+
+/* Returns 0 and the value of the key if it is found, -1 otherwise. */
+LIBETPAN_EXPORT
+int cohash_get(cohash * hash,
+    chashdatum * key, chashdatum * result);
+
+/* Removes the entry of this key, (* oldvalue) is its value if it is
+   not copied, the data pointer is NULL otherwise. Returns -1 if the
+   key is not found. */
+LIBETPAN_EXPORT
+int cohash_delete(cohash * hash,
+    chashdatum * key,
+    chashdatum * oldvalue);
+
+/* Makes room for count entries without further resize. */
+LIBETPAN_EXPORT
+int cohash_reserve(cohash * hash, unsigned int count);
+
+LIBETPAN_EXPORT
+cohashiter * cohash_begin(cohash * hash);
+
+LIBETPAN_EXPORT
+cohashiter * cohash_next(cohash * hash, cohashiter * iter);
+
+LIBETPAN_EXPORT
+void cohash_key(cohashiter * iter, chashdatum * result);
+
+LIBETPAN_EXPORT
+void cohash_value(cohashiter * iter, chashdatum * result);
+
+/* hash function used by the table, 64 bits wyhash-style mix */
+LIBETPAN_EXPORT
+uint64_t cohash_func(const void * data, size_t len);
+
+#define cohash_count(hash) ((hash)->count)
+#define cohash_size(hash) ((hash)->size)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -40,8 +40,12 @@
 #include "connect.h"
 
 #include "mailstream.h"
+#include "mailstream_socket.h"
+
+#include "chash.h"
 
 #include <sys/types.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #ifdef HAVE_UNISTD_H
@@ -58,6 +62,12 @@
 #	include <sys/socket.h>
 #	include <unistd.h>
 #       include <arpa/inet.h>
+#	include <sys/time.h>
+#endif
+#ifdef LIBETPAN_REENTRANT
+#if HAVE_PTHREAD_H
+#	include <pthread.h>
+#endif
 #endif
 
 #include "syscall_wrappers.h"
@@ -108,6 +118,7 @@ static int verify_sock_errors(int s)
 }
 #endif
 
+#ifndef HAVE_IPV6
 static int wait_connect(int s, int r, time_t timeout_seconds)
 {
   fd_set fds;
@@ -150,6 +161,7 @@ static int wait_connect(int s, int r, time_t timeout_seconds)
   
   return 0;
 }
+#endif
 
 int mail_tcp_connect(const char * server, uint16_t port)
 {
@@ -169,22 +181,571 @@ int mail_tcp_connect_with_local_address(const char * server, uint16_t port,
 
 int mail_tcp_connect_with_local_address_timeout(const char * server, uint16_t port,
     const char * local_address, uint16_t local_port, time_t timeout)
+{
+  return mail_tcp_connect_with_stats(server, port, local_address, local_port,
+      timeout, NULL);
+}
+
+static unsigned long long now_usec(void)
+{
+#ifdef WIN32
+  return (unsigned long long) GetTickCount64() * 1000;
+#else
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return (unsigned long long) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+static void close_socket(int s)
+{
+#ifdef WIN32
+  closesocket(s);
+#else
+  Close(s);
+#endif
+}
+
+#ifdef HAVE_IPV6
+
+/*
+  RFC 8305 "Connection Attempt Delay", a new connection attempt is
+  started when the previous ones did not succeed in this delay.
+*/
+
+#define CONNECT_ATTEMPT_DELAY_USEC 250000
+#define CONNECT_MAX_ATTEMPTS 16
+#define DNS_CACHE_MAX_COUNT 128
+
+struct connect_address {
+  int ca_family;
+  int ca_socktype;
+  int ca_protocol;
+  socklen_t ca_addrlen;
+  struct sockaddr_storage ca_addr;
+};
+
+struct connect_address_list {
+  time_t cal_expires;
+  unsigned int cal_count;
+  struct connect_address cal_tab[1];
+};
+
+#ifdef LIBETPAN_REENTRANT
+#if HAVE_PTHREAD_H
+#define MUTEX_LOCK(x) pthread_mutex_lock(x)
+#define MUTEX_UNLOCK(x) pthread_mutex_unlock(x)
+static pthread_mutex_t dns_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#else
+#define MUTEX_LOCK(x)
+#define MUTEX_UNLOCK(x)
+#endif
+#else
+#define MUTEX_LOCK(x)
+#define MUTEX_UNLOCK(x)
+#endif
+
+/* the resolved addresses, the key is "server:port" */
+static chash * dns_cache = NULL;
+static time_t dns_cache_ttl = 0;
+
+static struct connect_address_list * address_list_new(unsigned int count)
+{
+  struct connect_address_list * list;
+
+  list = malloc(sizeof(* list) + count * sizeof(struct connect_address));
+  if (list == NULL)
+    return NULL;
+  list->cal_expires = 0;
+  list->cal_count = 0;
+
+  return list;
+}
+
+static struct connect_address_list *
+address_list_dup(struct connect_address_list * list)
+{
+  struct connect_address_list * dup;
+
+  dup = address_list_new(list->cal_count);
+  if (dup == NULL)
+    return NULL;
+  memcpy(dup, list, sizeof(* list) +
+      list->cal_count * sizeof(struct connect_address));
+
+  return dup;
+}
+
+static void address_list_add(struct connect_address_list * list,
+    struct addrinfo * ai)
+{
+  struct connect_address * address;
+
+  if (ai->ai_addrlen > sizeof(address->ca_addr))
+    return;
+
+  address = &list->cal_tab[list->cal_count];
+  address->ca_family = ai->ai_family;
+  address->ca_socktype = ai->ai_socktype;
+  address->ca_protocol = ai->ai_protocol;
+  address->ca_addrlen = ai->ai_addrlen;
+  memcpy(&address->ca_addr, ai->ai_addr, ai->ai_addrlen);
+  list->cal_count ++;
+}
+
+/*
+  the addresses are sorted by getaddrinfo() (RFC 6724), they are
+  interleaved by address family starting with the family of the first
+  one (RFC 8305 section 4) so that an unreachable family does not
+  delay the connection more than one attempt delay.
+*/
+
+static struct connect_address_list * resolve(const char * server,
+    const char * port_str)
+{
+  struct addrinfo hints;
+  struct addrinfo * res;
+  struct addrinfo * ai;
+  struct addrinfo * other;
+  struct connect_address_list * list;
+  unsigned int count;
+  int first_family;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+
+  res = NULL;
+  if (getaddrinfo(server, port_str, &hints, &res) != 0)
+    return NULL;
+
+  count = 0;
+  for(ai = res ; ai != NULL ; ai = ai->ai_next)
+    count ++;
+
+  list = address_list_new(count);
+  if (list == NULL) {
+    freeaddrinfo(res);
+    return NULL;
+  }
+
+  first_family = res->ai_family;
+  ai = res;
+  other = res;
+  while ((ai != NULL) || (other != NULL)) {
+    while ((ai != NULL) && (ai->ai_family != first_family))
+      ai = ai->ai_next;
+    if (ai != NULL) {
+      address_list_add(list, ai);
+      ai = ai->ai_next;
+    }
+    while ((other != NULL) && (other->ai_family == first_family))
+      other = other->ai_next;
+    if (other != NULL) {
+      address_list_add(list, other);
+      other = other->ai_next;
+    }
+  }
+
+  freeaddrinfo(res);
+
+  return list;
+}
+
+static void dns_cache_flush(void)
+{
+  chashiter * iter;
+
+  if (dns_cache == NULL)
+    return;
+
+  for(iter = chash_begin(dns_cache) ; iter != NULL ;
+      iter = chash_next(dns_cache, iter)) {
+    chashdatum value;
+
+    chash_value(iter, &value);
+    free(value.data);
+  }
+  chash_clear(dns_cache);
+}
+
+static struct connect_address_list * dns_cache_lookup(const char * key)
+{
+  struct connect_address_list * list;
+  chashdatum hash_key;
+  chashdatum value;
+  int r;
+
+  list = NULL;
+  hash_key.data = (void *) key;
+  hash_key.len = (unsigned int) strlen(key);
+
+  MUTEX_LOCK(&dns_cache_lock);
+  if ((dns_cache_ttl != 0) && (dns_cache != NULL)) {
+    r = chash_get(dns_cache, &hash_key, &value);
+    if (r == 0) {
+      struct connect_address_list * cached;
+
+      cached = value.data;
+      if (cached->cal_expires > time(NULL)) {
+        /* the entry can be replaced by another connection */
+        list = address_list_dup(cached);
+      }
+      else {
+        chash_delete(dns_cache, &hash_key, NULL);
+        free(cached);
+      }
+    }
+  }
+  MUTEX_UNLOCK(&dns_cache_lock);
+
+  return list;
+}
+
+static void dns_cache_store(const char * key,
+    struct connect_address_list * list)
+{
+  struct connect_address_list * cached;
+  chashdatum hash_key;
+  chashdatum value;
+  int r;
+
+  hash_key.data = (void *) key;
+  hash_key.len = (unsigned int) strlen(key);
+
+  MUTEX_LOCK(&dns_cache_lock);
+  if (dns_cache_ttl == 0)
+    goto unlock;
+
+  if (dns_cache == NULL) {
+    dns_cache = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
+    if (dns_cache == NULL)
+      goto unlock;
+  }
+
+  r = chash_get(dns_cache, &hash_key, &value);
+  if (r == 0) {
+    chash_delete(dns_cache, &hash_key, NULL);
+    free(value.data);
+  }
+  else if (chash_count(dns_cache) >= DNS_CACHE_MAX_COUNT) {
+    dns_cache_flush();
+  }
+
+  cached = address_list_dup(list);
+  if (cached == NULL)
+    goto unlock;
+  cached->cal_expires = time(NULL) + dns_cache_ttl;
+
+  value.data = cached;
+  value.len = 0;
+  r = chash_set(dns_cache, &hash_key, &value, NULL);
+  if (r < 0)
+    free(cached);
+
+ unlock:
+  MUTEX_UNLOCK(&dns_cache_lock);
+}
+
+static void dns_cache_remove(const char * key)
+{
+  chashdatum hash_key;
+  chashdatum value;
+  int r;
+
+  hash_key.data = (void *) key;
+  hash_key.len = (unsigned int) strlen(key);
+
+  MUTEX_LOCK(&dns_cache_lock);
+  if (dns_cache != NULL) {
+    r = chash_get(dns_cache, &hash_key, &value);
+    if (r == 0) {
+      chash_delete(dns_cache, &hash_key, NULL);
+      free(value.data);
+    }
+  }
+  MUTEX_UNLOCK(&dns_cache_lock);
+}
+
+static int bind_local_address(int s, int family,
+    const char * local_address, uint16_t local_port)
+{
+  struct addrinfo la_hints;
+  struct addrinfo * la_res;
+  char local_port_str[6];
+  char * p_local_port_str;
+  int r;
+
+  memset(&la_hints, 0, sizeof(la_hints));
+  la_hints.ai_family = family;
+  la_hints.ai_socktype = SOCK_STREAM;
+  la_hints.ai_flags = AI_PASSIVE;
+
+  if (local_port != 0) {
+    snprintf(local_port_str, sizeof(local_port_str), "%d", local_port);
+    p_local_port_str = local_port_str;
+  }
+  else {
+    p_local_port_str = NULL;
+  }
+  la_res = NULL;
+  r = getaddrinfo(local_address, p_local_port_str, &la_hints, &la_res);
+  if (r != 0)
+    return -1;
+  r = bind(s, (struct sockaddr *) la_res->ai_addr, la_res->ai_addrlen);
+  freeaddrinfo(la_res);
+  if (r == -1)
+    return -1;
+
+  return 0;
+}
+
+/*
+  starts a non-blocking connection, (* p_connected) is set to 1
+  when the connection is already established
+*/
+
+static int start_connect(struct connect_address * address,
+    const char * local_address, uint16_t local_port, int * p_connected)
+{
+  int s;
+  int r;
+
+  s = socket(address->ca_family, address->ca_socktype, address->ca_protocol);
+  if (s == -1)
+    return -1;
+
+  // Christopher Lyon Anderson - prevent SigPipe
+  // patch by fdik
+  if (!libetpan_deliver_sigpipe) {
+#ifdef SO_NOSIGPIPE
+    int kOne = 1;
+    int err = setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &kOne, sizeof(kOne));
+    if (err != 0)
+      goto close_socket;
+#endif
+  }
+
+  if ((local_address != NULL) || (local_port != 0)) {
+    r = bind_local_address(s, address->ca_family, local_address, local_port);
+    if (r < 0)
+      goto close_socket;
+  }
+
+  r = prepare_fd(s);
+  if (r == -1)
+    goto close_socket;
+
+  r = connect(s, (struct sockaddr *) &address->ca_addr, address->ca_addrlen);
+  if (r == 0) {
+    * p_connected = 1;
+    return s;
+  }
+  if (errno != EINPROGRESS)
+    goto close_socket;
+
+  * p_connected = 0;
+  return s;
+
+ close_socket:
+  close_socket(s);
+  return -1;
+}
+
+/*
+  RFC 8305 connection: the connection to the next address is started
+  after the attempt delay or when the previous attempts failed, the
+  first established connection is kept. The timeout applies to the
+  whole connection.
+*/
+
+static int connect_address_list(struct connect_address_list * list,
+    const char * local_address, uint16_t local_port, time_t timeout,
+    struct mail_tcp_connect_stats * stats)
+{
+  int pending_fd[CONNECT_MAX_ATTEMPTS];
+  int pending_family[CONNECT_MAX_ATTEMPTS];
+  unsigned int pending_count;
+  unsigned int next;
+  unsigned long long current;
+  unsigned long long deadline;
+  unsigned long long next_attempt;
+  unsigned int i;
+  int connected;
+  int family;
+  int s;
+  int r;
+
+  current = now_usec();
+  if (timeout == 0)
+    deadline = current + (unsigned long long) mailstream_network_delay.tv_sec * 1000000 +
+      mailstream_network_delay.tv_usec;
+  else
+    deadline = current + (unsigned long long) timeout * 1000000;
+
+  s = -1;
+  family = AF_UNSPEC;
+  pending_count = 0;
+  next = 0;
+  next_attempt = current;
+  while (1) {
+    fd_set write_fds;
+    fd_set error_fds;
+    struct timeval delay;
+    unsigned long long wait_until;
+    int max_fd;
+
+    current = now_usec();
+
+    if ((next < list->cal_count) && (pending_count < CONNECT_MAX_ATTEMPTS) &&
+        ((pending_count == 0) || (current >= next_attempt))) {
+      struct connect_address * address;
+      int fd;
+
+      address = &list->cal_tab[next];
+      next ++;
+      if (stats != NULL)
+        stats->tcs_attempts ++;
+
+      fd = start_connect(address, local_address, local_port, &connected);
+      if (fd == -1)
+        continue;
+      if (connected) {
+        s = fd;
+        family = address->ca_family;
+        break;
+      }
+      pending_fd[pending_count] = fd;
+      pending_family[pending_count] = address->ca_family;
+      pending_count ++;
+      next_attempt = current + CONNECT_ATTEMPT_DELAY_USEC;
+      continue;
+    }
+
+    if (pending_count == 0)
+      break;
+    if (current >= deadline)
+      break;
+
+    wait_until = deadline;
+    if ((next < list->cal_count) && (pending_count < CONNECT_MAX_ATTEMPTS) &&
+        (next_attempt < wait_until))
+      wait_until = next_attempt;
+    delay.tv_sec = (long) ((wait_until - current) / 1000000);
+    delay.tv_usec = (long) ((wait_until - current) % 1000000);
+
+    FD_ZERO(&write_fds);
+    FD_ZERO(&error_fds);
+    max_fd = -1;
+    for(i = 0 ; i < pending_count ; i ++) {
+      FD_SET(pending_fd[i], &write_fds);
+      FD_SET(pending_fd[i], &error_fds);
+      if (pending_fd[i] > max_fd)
+        max_fd = pending_fd[i];
+    }
+
+    /* TODO: how to cancel this ? -> could be cancelled using a cancel fd */
+    r = Select(max_fd + 1, NULL, &write_fds, &error_fds, &delay);
+    if (r < 0)
+      break;
+    if (r == 0)
+      continue;
+
+    i = 0;
+    while (i < pending_count) {
+      if (!FD_ISSET(pending_fd[i], &write_fds) &&
+          !FD_ISSET(pending_fd[i], &error_fds)) {
+        i ++;
+        continue;
+      }
+
+      if (verify_sock_errors(pending_fd[i]) == 0) {
+        s = pending_fd[i];
+        family = pending_family[i];
+        pending_fd[i] = pending_fd[pending_count - 1];
+        pending_family[i] = pending_family[pending_count - 1];
+        pending_count --;
+        break;
+      }
+
+      /* failed, the next address is tried now */
+      close_socket(pending_fd[i]);
+      pending_fd[i] = pending_fd[pending_count - 1];
+      pending_family[i] = pending_family[pending_count - 1];
+      pending_count --;
+      next_attempt = current;
+    }
+    if (s != -1)
+      break;
+  }
+
+  for(i = 0 ; i < pending_count ; i ++)
+    close_socket(pending_fd[i]);
+
+  if ((s != -1) && (stats != NULL))
+    stats->tcs_family = family;
+
+  return s;
+}
+
+#endif
+
+void mail_tcp_set_dns_cache_ttl(time_t ttl)
+{
+#ifdef HAVE_IPV6
+  MUTEX_LOCK(&dns_cache_lock);
+  dns_cache_ttl = ttl;
+  if (ttl == 0) {
+    dns_cache_flush();
+    if (dns_cache != NULL) {
+      chash_free(dns_cache);
+      dns_cache = NULL;
+    }
+  }
+  MUTEX_UNLOCK(&dns_cache_lock);
+#endif
+}
+
+void mail_tcp_flush_dns_cache(void)
+{
+#ifdef HAVE_IPV6
+  MUTEX_LOCK(&dns_cache_lock);
+  dns_cache_flush();
+  MUTEX_UNLOCK(&dns_cache_lock);
+#endif
+}
+
+int mail_tcp_connect_with_stats(const char * server, uint16_t port,
+    const char * local_address, uint16_t local_port, time_t timeout,
+    struct mail_tcp_connect_stats * stats)
 {
 #ifndef HAVE_IPV6
   struct hostent * remotehost;
   struct sockaddr_in sa;
 #else /* HAVE_IPV6 */
-  struct addrinfo hints, *res, *ai;
-  struct addrinfo la_hints;
+  struct connect_address_list * list;
+  char key[1024];
   char port_str[6];
 #endif
+  unsigned long long start;
 #ifdef WIN32
   SOCKET s;
+#ifndef HAVE_IPV6
   long r;
+#endif
 #else
   int s;
+#ifndef HAVE_IPV6
   int r;
 #endif
+#endif
+
+  if (stats != NULL)
+    memset(stats, 0, sizeof(* stats));
+  start = now_usec();
 
 #ifndef HAVE_IPV6
   s = socket(PF_INET, SOCK_STREAM, 0);
@@ -216,6 +777,12 @@ int mail_tcp_connect_with_local_address_timeout(const char * server, uint16_t po
   sa.sin_port = htons(port);
   memcpy(&sa.sin_addr, remotehost->h_addr, remotehost->h_length);
   
+  if (stats != NULL) {
+    stats->tcs_dns_usec = (unsigned long) (now_usec() - start);
+    stats->tcs_attempts = 1;
+  }
+  start = now_usec();
+
   r = prepare_fd(s);
   if (r == -1) {
     goto close_socket;
@@ -226,111 +793,52 @@ int mail_tcp_connect_with_local_address_timeout(const char * server, uint16_t po
   if (r == -1) {
     goto close_socket;
   }
+
+  if (stats != NULL) {
+    stats->tcs_connect_usec = (unsigned long) (now_usec() - start);
+    stats->tcs_family = AF_INET;
+  }
 #else /* HAVE_IPV6 */
-  memset(&hints, 0, sizeof(hints));
-  hints.ai_family = AF_UNSPEC;
-  hints.ai_socktype = SOCK_STREAM;
-  hints.ai_protocol = IPPROTO_TCP;
-  
-  memset(&la_hints, 0, sizeof(la_hints));
-  la_hints.ai_family = AF_UNSPEC;
-  la_hints.ai_socktype = SOCK_STREAM;
-  la_hints.ai_flags = AI_PASSIVE;
-  
   /* convert port from integer to string. */
   snprintf(port_str, sizeof(port_str), "%d", port);
-  
-  res = NULL;
-  if (getaddrinfo(server, port_str, &hints, &res) != 0)
-    goto err;
+  snprintf(key, sizeof(key), "%s:%s", server, port_str);
 
-  s = -1;
-  for (ai = res; ai != NULL; ai = ai->ai_next) {
-    s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
-
-    if (s == -1)
-      continue;
-    
-    // Christopher Lyon Anderson - prevent SigPipe
-    // patch by fdik
-if (!libetpan_deliver_sigpipe) {
-#ifdef SO_NOSIGPIPE
-    int kOne = 1;
-    int err = setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &kOne, sizeof(kOne));
-    if (err != 0)
-        continue;
-#endif
-}
-    if ((local_address != NULL) || (local_port != 0)) {
-      char local_port_str[6];
-      char * p_local_port_str;
-      struct addrinfo * la_res;
-      
-      if (local_port != 0) {
-        snprintf(local_port_str, sizeof(local_port_str), "%d", local_port);
-        p_local_port_str = local_port_str;
-      }
-      else {
-        p_local_port_str = NULL;
-      }
-      la_res = NULL;
-      r = getaddrinfo(local_address, p_local_port_str, &la_hints, &la_res);
-      if (r != 0)
-        goto close_socket;
-      r = bind(s, (struct sockaddr *) la_res->ai_addr, la_res->ai_addrlen);
-      if (la_res != NULL)
-        freeaddrinfo(la_res);
-      if (r == -1)
-        goto close_socket;
-    }
-    
-    r = prepare_fd(s);
-    if (r == -1) {
-      goto close_socket;
-    }
- 
-    r = connect(s, ai->ai_addr, ai->ai_addrlen);
-    r = wait_connect(s, r, timeout);
-    
-    if (r != -1) {
-      r = verify_sock_errors(s);
-    }
-
-    if (r == -1) {
-      if (ai->ai_next) {
-#ifdef WIN32
-	  closesocket(s);
-#else
-      Close(s);
-#endif
-	  continue;
-      } else {
-        goto close_socket;
-      }
+  list = dns_cache_lookup(key);
+  if (list != NULL) {
+    if (stats != NULL)
+      stats->tcs_dns_cached = 1;
+  }
+  else {
+    list = resolve(server, port_str);
+    if (list == NULL)
+      goto err;
+    if (list->cal_count == 0) {
+      free(list);
+      goto err;
     }
-    /* if we're here, we're good */
-    break;
+    dns_cache_store(key, list);
   }
-  
-  if (res != NULL)
-    freeaddrinfo(res);
+  if (stats != NULL)
+    stats->tcs_dns_usec = (unsigned long) (now_usec() - start);
+  start = now_usec();
 
-  if (ai == NULL)
+  s = connect_address_list(list, local_address, local_port, timeout, stats);
+  free(list);
+  if (s == -1) {
+    /* the addresses might have changed */
+    dns_cache_remove(key);
     goto err;
+  }
+
+  if (stats != NULL)
+    stats->tcs_connect_usec = (unsigned long) (now_usec() - start);
 #endif
   return s;
   
+#ifndef HAVE_IPV6
  close_socket:
-#ifdef HAVE_IPV6
-  if (res != NULL)
-    freeaddrinfo(res);
-#endif
-#ifdef WIN32
-  closesocket(s);
-#else
-  Close(s);
+  close_socket(s);
 #endif
  err:
   return -1;
 }
-
@@ -498,3 +498,103 @@ int mail_cache_db_get_keys(struct mail_cache_db * cache_db,
   return -1;
 }
 #endif
+
+#if DBVERS > 1
+int mail_cache_db_get_keys_with_prefix(struct mail_cache_db * cache_db,
+    const void * prefix, size_t prefix_len,
+    int (* callback)(const void * key, size_t key_len, void * cb_data),
+    void * cb_data)
+{
+  DB * dbp;
+  int r;
+  int res;
+  DBC * dbcp;
+  DBT db_key;
+  DBT db_data;
+  u_int32_t flags;
+  
+  dbp = cache_db->internal_database;
+  
+#if DB_VERSION_MAJOR == 2 && DB_VERSION_MINOR < 6
+  r = dbp->cursor(dbp, NULL, &dbcp);
+#else
+  r = dbp->cursor(dbp, NULL, &dbcp, 0);
+#endif  
+  if (r != 0)
+    return -1;
+  
+  memset(&db_key, 0, sizeof(db_key));
+  memset(&db_data, 0, sizeof(db_data));
+  db_key.data = (void *) prefix;
+  db_key.size = prefix_len;
+  
+  res = 0;
+  flags = DB_SET_RANGE;
+  while (1) {
+    r = dbcp->c_get(dbcp, &db_key, &db_data, flags);
+    if (r != 0)
+      break;
+    flags = DB_NEXT;
+    
+    if ((db_key.size < prefix_len) ||
+        (memcmp(db_key.data, prefix, prefix_len) != 0))
+      break;
+    
+    r = callback(db_key.data, db_key.size, cb_data);
+    if (r < 0) {
+      res = -1;
+      break;
+    }
+  }
+  
+  r = dbcp->c_close(dbcp);
+  if (r != 0)
+    return -1;
+  
+  return res;
+}
+#elif DBVERS == 1
+int mail_cache_db_get_keys_with_prefix(struct mail_cache_db * cache_db,
+    const void * prefix, size_t prefix_len,
+    int (* callback)(const void * key, size_t key_len, void * cb_data),
+    void * cb_data)
+{
+  DB * dbp;
+  int r;
+  DBT db_key;
+  DBT db_data;
+  
+  dbp = cache_db->internal_database;
+  
+  db_key.data = (void *) prefix;
+  db_key.size = prefix_len;
+  
+  r = dbp->seq(dbp, &db_key, &db_data, R_CURSOR);
+  if (r == -1)
+    return -1;
+  
+  while (r == 0) {
+    if ((db_key.size < prefix_len) ||
+        (memcmp(db_key.data, prefix, prefix_len) != 0))
+      break;
+    
+    r = callback(db_key.data, db_key.size, cb_data);
+    if (r < 0)
+      return -1;
+    
+    r = dbp->seq(dbp, &db_key, &db_data, R_NEXT);
+    if (r < 0)
+      return -1;
+  }
+  
+  return 0;
+}
+#else
+int mail_cache_db_get_keys_with_prefix(struct mail_cache_db * cache_db,
+    const void * prefix, size_t prefix_len,
+    int (* callback)(const void * key, size_t key_len, void * cb_data),
+    void * cb_data)
+{
+  return -1;
+}
+#endif
@@ -151,6 +151,20 @@ int mail_cache_db_clean_up(struct mail_cache_db * cache_db,
 int mail_cache_db_get_keys(struct mail_cache_db * cache_db,
     chash * keys);
 
+/*
+  mail_cache_db_get_keys_with_prefix()
+
+  This function will call the given callback for each key of the
+  database that starts with the given prefix, in the order of the keys.
+  The iteration stops when the callback returns a negative value.
+  The database must not be modified by the callback.
+*/
+
+int mail_cache_db_get_keys_with_prefix(struct mail_cache_db * cache_db,
+    const void * prefix, size_t prefix_len,
+    int (* callback)(const void * key, size_t key_len, void * cb_data),
+    void * cb_data);
+
 #ifdef __cplusplus
 }
 #endif
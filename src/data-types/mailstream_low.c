@@ -65,6 +65,7 @@
 #include "mailstream_cancel.h"
 
 #include "syscall_wrappers.h"
+#include "carena.h"
 
 #define LOG_FILE "libetpan-stream-debug.log"
 
@@ -340,6 +341,7 @@ static inline void mailstream_logger_internal(mailstream_low * s, int is_stream_
   const char * buffer, size_t size)
 {
   int log_type = -1;
+  carena * old_arena;
   
   if (s->logger == NULL)
     return;
@@ -411,7 +413,10 @@ static inline void mailstream_logger_internal(mailstream_low * s, int is_stream_
   if (log_type == -1)
     return;
   
+  /* the logger of the application doesn't allocate from the arena */
+  old_arena = carena_set_current(NULL);
   s->logger(s, log_type, buffer, size, s->logger_context);
+  carena_set_current(old_arena);
 }
 
 carray * mailstream_low_get_certificate_chain(mailstream_low * s)
@@ -52,6 +52,51 @@ void mailstream_socket_set_use_read(mailstream * stream, int use_read);
 mailstream * mailstream_socket_open(int fd);
 mailstream * mailstream_socket_open_timeout(int fd, time_t timeout);
 
+/* connection */
+
+/*
+  mail_tcp_connect_with_stats() connects to the given port of the
+  server and returns the socket, -1 on error. local_address and
+  local_port are optional. The addresses of the server are tried in
+  the order of RFC 8305, alternating the address families, a new
+  connection attempt is started every 250 ms until one of them
+  succeeds. The timeout applies to the whole connection.
+
+  stats can be NULL, otherwise it is filled with the duration of the
+  phases of the connection:
+
+  - tcs_dns_usec is the duration of the name resolution in microseconds
+  - tcs_dns_cached is 1 when the addresses were found in the DNS cache
+  - tcs_connect_usec is the duration of the TCP connection in
+    microseconds
+  - tcs_attempts is the number of addresses that were tried
+  - tcs_family is the address family of the connection
+*/
+
+struct mail_tcp_connect_stats {
+  unsigned long tcs_dns_usec;
+  int tcs_dns_cached;
+  unsigned long tcs_connect_usec;
+  unsigned int tcs_attempts;
+  int tcs_family;
+};
+
+int mail_tcp_connect_with_stats(const char * server, uint16_t port,
+    const char * local_address, uint16_t local_port, time_t timeout,
+    struct mail_tcp_connect_stats * stats);
+
+/*
+  mail_tcp_set_dns_cache_ttl() enables the cache of the resolved
+  addresses shared by the connections of the process. The addresses
+  are kept ttl seconds, 0 disables the cache (default). An entry is
+  removed when none of its addresses could be connected.
+
+  mail_tcp_flush_dns_cache() removes all the cached addresses.
+*/
+
+void mail_tcp_set_dns_cache_ttl(time_t ttl);
+void mail_tcp_flush_dns_cache(void);
+
 #ifdef __cplusplus
 }
 #endif
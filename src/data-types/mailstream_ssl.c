@@ -71,7 +71,10 @@
 #	ifdef HAVE_SYS_SELECT_H
 #		include <sys/select.h>
 #	endif
+#	include <sys/socket.h>
+#	include <netdb.h>
 #endif
+#include <ctype.h>
 
 #if LIBETPAN_IOS_DISABLE_SSL
 #undef USE_SSL
@@ -99,6 +102,7 @@
 
 #include "mmapstring.h"
 #include "mailstream_cancel.h"
+#include "chash.h"
 
 #include "syscall_wrappers.h"
 
@@ -126,6 +130,10 @@ struct mailstream_ssl_data {
   SSL * ssl_conn;
   SSL_CTX * ssl_ctx;
   struct mailstream_cancel * cancel;
+  struct mailstream_ssl_cache * cache;
+  char * cache_key;
+  /* the session is not kept after an error or a cancel */
+  int failed;
 };
 
 #else
@@ -134,6 +142,9 @@ struct mailstream_ssl_data {
   gnutls_session session;
   gnutls_certificate_credentials_t xcred;
   struct mailstream_cancel * cancel;
+  struct mailstream_ssl_cache * cache;
+  char * cache_key;
+  int failed;
 };
 #endif
 #endif
@@ -156,6 +167,10 @@ struct mailstream_ssl_data {
 #	define MUTEX_UNLOCK(x)
 #endif
 static int openssl_init_done = 0;
+#ifndef USE_GNUTLS
+static int ssl_cache_key_index = -1;
+static int ssl_cache_index = -1;
+#endif
 #endif
 
 // Used to make OpenSSL thread safe
@@ -288,6 +303,10 @@ static inline void mailstream_ssl_init(void)
     
     openssl_init_done = 1;
   }
+  if (ssl_cache_key_index < 0)
+    ssl_cache_key_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+  if (ssl_cache_index < 0)
+    ssl_cache_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
 #else
   gnutls_global_init();
 #endif
@@ -378,6 +397,361 @@ static mailstream_low_driver local_mailstream_ssl_driver = {
 mailstream_low_driver * mailstream_ssl_driver = &local_mailstream_ssl_driver;
 #endif
 
+/*
+  TLS session cache
+
+  The sessions are stored by "host:port", or by the address of the
+  peer when the host name is not known, and are protected by ssl_lock.
+  The session of a connection configured by a callback is only resumed
+  by the connections configured by the same callback and data, the key
+  ends with their addresses.
+  A connection keeps a reference to the cache that was set when it
+  was opened, its session is stored in this cache.
+*/
+
+#define DEFAULT_SSL_CACHE_SIZE 64
+
+#ifdef USE_SSL
+struct mailstream_ssl_cache_entry {
+#ifndef USE_GNUTLS
+  SSL_SESSION * session;
+#else
+  gnutls_datum_t data;
+#endif
+};
+#endif
+
+struct mailstream_ssl_cache {
+  /* the caller and the connections that use the cache */
+  unsigned int ref_count;
+  unsigned int max_count;
+  unsigned long hits;
+  unsigned long misses;
+#ifdef USE_SSL
+  chash * sessions; /* (struct mailstream_ssl_cache_entry *) */
+#ifndef USE_GNUTLS
+  SSL_CTX * ssl_ctx;
+  SSL_CTX * tls_ctx;
+#endif
+#endif
+};
+
+#ifdef USE_SSL
+/* the cache used by the new connections */
+static struct mailstream_ssl_cache * current_cache = NULL;
+
+static void ssl_cache_entry_free(struct mailstream_ssl_cache_entry * entry)
+{
+#ifndef USE_GNUTLS
+  SSL_SESSION_free(entry->session);
+#else
+  gnutls_free(entry->data.data);
+#endif
+  free(entry);
+}
+
+static void ssl_cache_flush(struct mailstream_ssl_cache * cache)
+{
+  chashiter * iter;
+
+  for(iter = chash_begin(cache->sessions) ; iter != NULL ;
+      iter = chash_next(cache->sessions, iter)) {
+    chashdatum value;
+
+    chash_value(iter, &value);
+    ssl_cache_entry_free(value.data);
+  }
+  chash_clear(cache->sessions);
+}
+
+static struct mailstream_ssl_cache_entry *
+ssl_cache_lookup(struct mailstream_ssl_cache * cache, const char * key)
+{
+  chashdatum hkey;
+  chashdatum value;
+
+  hkey.data = (void *) key;
+  hkey.len = (unsigned int) strlen(key);
+  if (chash_get(cache->sessions, &hkey, &value) < 0)
+    return NULL;
+
+  return value.data;
+}
+
+/* the cache owns the entry on success */
+
+static int ssl_cache_store(struct mailstream_ssl_cache * cache,
+    const char * key, struct mailstream_ssl_cache_entry * entry)
+{
+  chashdatum hkey;
+  chashdatum value;
+
+  hkey.data = (void *) key;
+  hkey.len = (unsigned int) strlen(key);
+  if (chash_get(cache->sessions, &hkey, &value) == 0) {
+    chash_delete(cache->sessions, &hkey, NULL);
+    ssl_cache_entry_free(value.data);
+  }
+  else if (chash_count(cache->sessions) >= cache->max_count) {
+    chashiter * iter;
+    chashdatum old_key;
+
+    /* makes room by dropping any entry */
+    iter = chash_begin(cache->sessions);
+    chash_key(iter, &old_key);
+    chash_value(iter, &value);
+    chash_delete(cache->sessions, &old_key, NULL);
+    ssl_cache_entry_free(value.data);
+  }
+
+  value.data = entry;
+  value.len = 0;
+  return chash_set(cache->sessions, &hkey, &value, NULL);
+}
+
+static void ssl_cache_count(struct mailstream_ssl_cache * cache, int resumed)
+{
+  MUTEX_LOCK(&ssl_lock);
+  if (resumed)
+    cache->hits ++;
+  else
+    cache->misses ++;
+  MUTEX_UNLOCK(&ssl_lock);
+}
+
+static void ssl_cache_destroy(struct mailstream_ssl_cache * cache)
+{
+  ssl_cache_flush(cache);
+  chash_free(cache->sessions);
+#ifndef USE_GNUTLS
+  /* the connections keep a reference to the contexts */
+  if (cache->ssl_ctx != NULL)
+    SSL_CTX_free(cache->ssl_ctx);
+  if (cache->tls_ctx != NULL)
+    SSL_CTX_free(cache->tls_ctx);
+#endif
+  free(cache);
+}
+
+/* returns a new reference to the cache of the new connections */
+
+static struct mailstream_ssl_cache * ssl_cache_ref_current(void)
+{
+  struct mailstream_ssl_cache * cache;
+
+  MUTEX_LOCK(&ssl_lock);
+  cache = current_cache;
+  if (cache != NULL)
+    cache->ref_count ++;
+  MUTEX_UNLOCK(&ssl_lock);
+
+  return cache;
+}
+
+static void ssl_cache_unref(struct mailstream_ssl_cache * cache)
+{
+  unsigned int ref_count;
+
+  MUTEX_LOCK(&ssl_lock);
+  cache->ref_count --;
+  ref_count = cache->ref_count;
+  MUTEX_UNLOCK(&ssl_lock);
+
+  if (ref_count == 0)
+    ssl_cache_destroy(cache);
+}
+
+static void ssl_cache_key_append_hex(char * p, const void * data, size_t len)
+{
+  const unsigned char * bytes;
+  size_t i;
+
+  bytes = data;
+  for(i = 0 ; i < len ; i ++) {
+    * p ++ = "0123456789abcdef"[bytes[i] >> 4];
+    * p ++ = "0123456789abcdef"[bytes[i] & 0xf];
+  }
+  * p = '\0';
+}
+
+static char * ssl_cache_key_new(int fd, const char * host, uint16_t port,
+    void (* callback)(struct mailstream_ssl_context * ssl_context, void * cb_data),
+    void * cb_data)
+{
+  char * key;
+  size_t size;
+  char * p;
+
+  if (host != NULL) {
+    /* ":" and the port */
+    size = strlen(host) + 7;
+    key = malloc(size);
+    if (key == NULL)
+      return NULL;
+    snprintf(key, size, "%s:%u", host, (unsigned int) port);
+  }
+  else {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    char name[NI_MAXHOST];
+    char service[NI_MAXSERV];
+
+    addr_len = sizeof(addr);
+    if (getpeername(fd, (struct sockaddr *) &addr, &addr_len) < 0)
+      return NULL;
+    if (getnameinfo((struct sockaddr *) &addr, addr_len, name, sizeof(name),
+            service, sizeof(service), NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+      return NULL;
+    /* "[", "]:" and the terminating NUL */
+    size = strlen(name) + strlen(service) + 4;
+    key = malloc(size);
+    if (key == NULL)
+      return NULL;
+    snprintf(key, size, "[%s]:%s", name, service);
+  }
+
+  for(p = key ; * p != '\0' ; p ++)
+    * p = (char) tolower((unsigned char) * p);
+
+  if (callback != NULL) {
+    char * new_key;
+    size_t len;
+
+    /* "/", the callback, "/", the data and the terminating NUL */
+    len = strlen(key);
+    new_key = realloc(key, len + 2 * (sizeof(callback) + sizeof(cb_data)) + 3);
+    if (new_key == NULL) {
+      free(key);
+      return NULL;
+    }
+    key = new_key;
+    p = key + len;
+    * p ++ = '/';
+    ssl_cache_key_append_hex(p, &callback, sizeof(callback));
+    p += strlen(p);
+    * p ++ = '/';
+    ssl_cache_key_append_hex(p, &cb_data, sizeof(cb_data));
+  }
+
+  return key;
+}
+
+/* the server name indication is not sent for an address */
+
+static int host_is_address(const char * host)
+{
+  if (strchr(host, ':') != NULL)
+    return 1;
+
+  return strspn(host, "0123456789.") == strlen(host);
+}
+#endif
+
+LIBETPAN_EXPORT
+struct mailstream_ssl_cache * mailstream_ssl_cache_new(unsigned int max_count)
+{
+#ifdef USE_SSL
+  struct mailstream_ssl_cache * cache;
+
+  cache = malloc(sizeof(* cache));
+  if (cache == NULL)
+    goto err;
+
+  if (max_count == 0)
+    max_count = DEFAULT_SSL_CACHE_SIZE;
+  cache->ref_count = 1;
+  cache->max_count = max_count;
+  cache->hits = 0;
+  cache->misses = 0;
+  cache->sessions = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
+  if (cache->sessions == NULL)
+    goto free;
+#ifndef USE_GNUTLS
+  cache->ssl_ctx = NULL;
+  cache->tls_ctx = NULL;
+#endif
+
+  return cache;
+
+ free:
+  free(cache);
+ err:
+  return NULL;
+#else
+  return NULL;
+#endif
+}
+
+LIBETPAN_EXPORT
+void mailstream_ssl_cache_free(struct mailstream_ssl_cache * cache)
+{
+#ifdef USE_SSL
+  mailstream_ssl_init_lock();
+  MUTEX_LOCK(&ssl_lock);
+  if (current_cache == cache)
+    current_cache = NULL;
+  MUTEX_UNLOCK(&ssl_lock);
+
+  /* the open connections release it when they are closed */
+  ssl_cache_unref(cache);
+#endif
+}
+
+LIBETPAN_EXPORT
+void mailstream_ssl_cache_flush(struct mailstream_ssl_cache * cache)
+{
+#ifdef USE_SSL
+  mailstream_ssl_init_lock();
+  MUTEX_LOCK(&ssl_lock);
+  ssl_cache_flush(cache);
+  MUTEX_UNLOCK(&ssl_lock);
+#endif
+}
+
+LIBETPAN_EXPORT
+void mailstream_ssl_cache_get_stats(struct mailstream_ssl_cache * cache,
+    unsigned long * p_hits, unsigned long * p_misses)
+{
+#ifdef USE_SSL
+  mailstream_ssl_init_lock();
+  MUTEX_LOCK(&ssl_lock);
+  * p_hits = cache->hits;
+  * p_misses = cache->misses;
+  MUTEX_UNLOCK(&ssl_lock);
+#else
+  * p_hits = 0;
+  * p_misses = 0;
+#endif
+}
+
+LIBETPAN_EXPORT
+void mailstream_ssl_set_cache(struct mailstream_ssl_cache * cache)
+{
+#ifdef USE_SSL
+  mailstream_ssl_init_lock();
+  MUTEX_LOCK(&ssl_lock);
+  current_cache = cache;
+  MUTEX_UNLOCK(&ssl_lock);
+#endif
+}
+
+LIBETPAN_EXPORT
+struct mailstream_ssl_cache * mailstream_ssl_get_cache(void)
+{
+#ifdef USE_SSL
+  struct mailstream_ssl_cache * cache;
+
+  mailstream_ssl_init_lock();
+  MUTEX_LOCK(&ssl_lock);
+  cache = current_cache;
+  MUTEX_UNLOCK(&ssl_lock);
+
+  return cache;
+#else
+  return NULL;
+#endif
+}
+
 /* file descriptor must be given in (default) blocking-mode */
 
 #ifdef USE_SSL
@@ -406,8 +780,92 @@ static int mailstream_openssl_client_cert_cb(SSL *ssl, X509 **x509, EVP_PKEY **p
 		return 0;
 }
 
+/*
+  a new session is received after the handshake with TLS 1.3,
+  it is stored in the cache of the connection when it has a key
+*/
+
+static int ssl_cache_new_session_cb(SSL * ssl_conn, SSL_SESSION * session)
+{
+  struct mailstream_ssl_cache * cache;
+  char * key;
+  struct mailstream_ssl_cache_entry * entry;
+  int stored;
+
+  cache = SSL_get_ex_data(ssl_conn, ssl_cache_index);
+  key = SSL_get_ex_data(ssl_conn, ssl_cache_key_index);
+  if ((cache == NULL) || (key == NULL))
+    return 0;
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+  if (!SSL_SESSION_is_resumable(session))
+    return 0;
+#endif
+
+  entry = malloc(sizeof(* entry));
+  if (entry == NULL)
+    return 0;
+  entry->session = session;
+
+  stored = 0;
+  MUTEX_LOCK(&ssl_lock);
+  if (ssl_cache_store(cache, key, entry) == 0)
+    stored = 1;
+  MUTEX_UNLOCK(&ssl_lock);
+
+  if (!stored) {
+    free(entry);
+    return 0;
+  }
+
+  /* the cache keeps the reference to the session */
+  return 1;
+}
+
+static void ssl_ctx_setup(SSL_CTX * ctx, int use_cache)
+{
+  SSL_CTX_set_client_cert_cb(ctx, mailstream_openssl_client_cert_cb);
+  if (use_cache) {
+    SSL_CTX_set_session_cache_mode(ctx,
+        SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, ssl_cache_new_session_cb);
+  }
+}
+
+/* returns a new reference to the context of the cache */
+
+static SSL_CTX * ssl_cache_get_ctx(struct mailstream_ssl_cache * cache,
+    int starttls, SSL_METHOD * method)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  SSL_CTX ** p_ctx;
+  SSL_CTX * ctx;
+
+  ctx = NULL;
+  MUTEX_LOCK(&ssl_lock);
+  if (starttls)
+    p_ctx = &cache->tls_ctx;
+  else
+    p_ctx = &cache->ssl_ctx;
+  if (* p_ctx == NULL) {
+    * p_ctx = SSL_CTX_new(method);
+    if (* p_ctx == NULL)
+      goto unlock;
+    ssl_ctx_setup(* p_ctx, 1);
+  }
+  ctx = * p_ctx;
+  SSL_CTX_up_ref(ctx);
+
+ unlock:
+  MUTEX_UNLOCK(&ssl_lock);
+  return ctx;
+#else
+  return NULL;
+#endif
+}
+
 static struct mailstream_ssl_data * ssl_data_new_full(int fd, time_t timeout,
-	SSL_METHOD * method, void (* callback)(struct mailstream_ssl_context * ssl_context, void * cb_data),
+	SSL_METHOD * method, int starttls, const char * host, uint16_t port,
+	void (* callback)(struct mailstream_ssl_context * ssl_context, void * cb_data),
 	void * cb_data)
 {
   struct mailstream_ssl_data * ssl_data;
@@ -416,32 +874,65 @@ static struct mailstream_ssl_data * ssl_data_new_full(int fd, time_t timeout,
   SSL_CTX * tmp_ctx;
   struct mailstream_cancel * cancel;
   struct mailstream_ssl_context * ssl_context = NULL;
+  struct mailstream_ssl_cache * cache;
+  char * cache_key;
 #ifdef SSL_MODE_RELEASE_BUFFERS
   long mode = 0;
 #endif
   
   mailstream_ssl_init();
   
-  tmp_ctx = SSL_CTX_new(method);
-  if (tmp_ctx == NULL)
-    goto err;
+  /*
+    a connection configured by a callback has its own context,
+    its session is shared with the connections that use the same
+    callback and data
+  */
+  tmp_ctx = NULL;
+  cache = ssl_cache_ref_current();
+  if ((cache != NULL) && (callback == NULL))
+    tmp_ctx = ssl_cache_get_ctx(cache, starttls, method);
+  
+  if (tmp_ctx == NULL) {
+    tmp_ctx = SSL_CTX_new(method);
+    if (tmp_ctx == NULL)
+      goto unref_cache;
+  
+    if (callback != NULL) {
+      ssl_context = mailstream_ssl_context_new(tmp_ctx, fd);
+      callback(ssl_context, cb_data);
+    }
   
-  if (callback != NULL) {
-    ssl_context = mailstream_ssl_context_new(tmp_ctx, fd);
-    callback(ssl_context, cb_data);
+    SSL_CTX_set_app_data(tmp_ctx, ssl_context);
+    ssl_ctx_setup(tmp_ctx, cache != NULL);
   }
   
-  SSL_CTX_set_app_data(tmp_ctx, ssl_context);
-  SSL_CTX_set_client_cert_cb(tmp_ctx, mailstream_openssl_client_cert_cb);
+  cache_key = NULL;
+  if (cache != NULL)
+    cache_key = ssl_cache_key_new(fd, host, port, callback, cb_data);
+  
   ssl_conn = (SSL *) SSL_new(tmp_ctx);
+  if (ssl_conn == NULL)
+    goto free_ctx;
   
 #ifdef SSL_MODE_RELEASE_BUFFERS
   mode = SSL_get_mode(ssl_conn);
   SSL_set_mode(ssl_conn, mode | SSL_MODE_RELEASE_BUFFERS);
 #endif
   
-  if (ssl_conn == NULL)
-    goto free_ctx;
+  if ((host != NULL) && !host_is_address(host))
+    SSL_set_tlsext_host_name(ssl_conn, (char *) host);
+  
+  if (cache_key != NULL) {
+    struct mailstream_ssl_cache_entry * entry;
+    
+    SSL_set_ex_data(ssl_conn, ssl_cache_index, cache);
+    SSL_set_ex_data(ssl_conn, ssl_cache_key_index, cache_key);
+    MUTEX_LOCK(&ssl_lock);
+    entry = ssl_cache_lookup(cache, cache_key);
+    if (entry != NULL)
+      SSL_set_session(ssl_conn, entry->session);
+    MUTEX_UNLOCK(&ssl_lock);
+  }
   
   if (SSL_set_fd(ssl_conn, fd) == 0)
     goto free_ssl_conn;
@@ -468,6 +959,9 @@ again:
   if (r <= 0)
     goto free_ssl_conn;
   
+  if (cache_key != NULL)
+    ssl_cache_count(cache, SSL_session_reused(ssl_conn));
+  
   cancel = mailstream_cancel_new();
   if (cancel == NULL)
     goto free_ssl_conn;
@@ -484,6 +978,9 @@ again:
   ssl_data->ssl_conn = ssl_conn;
   ssl_data->ssl_ctx = tmp_ctx;
   ssl_data->cancel = cancel;
+  ssl_data->cache = cache;
+  ssl_data->cache_key = cache_key;
+  ssl_data->failed = 0;
   mailstream_ssl_context_free(ssl_context);
 
   return ssl_data;
@@ -495,20 +992,27 @@ again:
  free_ctx:
   SSL_CTX_free(tmp_ctx);
   mailstream_ssl_context_free(ssl_context);
- err:
+  free(cache_key);
+ unref_cache:
+  if (cache != NULL)
+    ssl_cache_unref(cache);
   return NULL;
 }
 
 static struct mailstream_ssl_data * ssl_data_new(int fd, time_t timeout,
+	const char * host, uint16_t port,
 	void (* callback)(struct mailstream_ssl_context * ssl_context, void * cb_data), void * cb_data)
 {
-  return ssl_data_new_full(fd, timeout, SSLv23_client_method(), callback, cb_data);
+  return ssl_data_new_full(fd, timeout, SSLv23_client_method(), 0,
+      host, port, callback, cb_data);
 }
 
 static struct mailstream_ssl_data * tls_data_new(int fd, time_t timeout,
+  const char * host, uint16_t port,
   void (* callback)(struct mailstream_ssl_context * ssl_context, void * cb_data), void * cb_data)
 {
-  return ssl_data_new_full(fd, timeout, TLSv1_client_method(), callback, cb_data);
+  return ssl_data_new_full(fd, timeout, TLSv1_client_method(), 1,
+      host, port, callback, cb_data);
 }
 
 #else
@@ -550,7 +1054,37 @@ static int mailstream_gnutls_client_cert_cb(gnutls_session session,
 	return 0;
 }
 
+/*
+  the session is stored when the connection is closed, the tickets
+  of TLS 1.3 are received after the handshake
+*/
+
+static void ssl_cache_store_session(struct mailstream_ssl_cache * cache,
+    gnutls_session session, const char * key)
+{
+  struct mailstream_ssl_cache_entry * entry;
+  int stored;
+
+  entry = malloc(sizeof(* entry));
+  if (entry == NULL)
+    return;
+  if (gnutls_session_get_data2(session, &entry->data) < 0) {
+    free(entry);
+    return;
+  }
+
+  stored = 0;
+  MUTEX_LOCK(&ssl_lock);
+  if (ssl_cache_store(cache, key, entry) == 0)
+    stored = 1;
+  MUTEX_UNLOCK(&ssl_lock);
+
+  if (!stored)
+    ssl_cache_entry_free(entry);
+}
+
 static struct mailstream_ssl_data * ssl_data_new(int fd, time_t timeout,
+  const char * host, uint16_t port,
   void (* callback)(struct mailstream_ssl_context * ssl_context, void * cb_data), void * cb_data)
 {
   struct mailstream_ssl_data * ssl_data;
@@ -560,6 +1094,8 @@ static struct mailstream_ssl_data * ssl_data_new(int fd, time_t timeout,
   int r;
   struct mailstream_ssl_context * ssl_context = NULL;
   unsigned int timeout_value;
+  struct mailstream_ssl_cache * cache;
+  char * cache_key;
   
   mailstream_ssl_init();
   
@@ -570,6 +1106,15 @@ static struct mailstream_ssl_data * ssl_data_new(int fd, time_t timeout,
   if (session == NULL || r != 0)
     return NULL;
   
+  /*
+    the session of a connection configured by a callback is shared
+    with the connections that use the same callback and data
+  */
+  cache_key = NULL;
+  cache = ssl_cache_ref_current();
+  if (cache != NULL)
+    cache_key = ssl_cache_key_new(fd, host, port, callback, cb_data);
+  
   if (callback != NULL) {
     ssl_context = mailstream_ssl_context_new(session, fd);
     callback(ssl_context, cb_data);
@@ -603,6 +1148,19 @@ static struct mailstream_ssl_data * ssl_data_new(int fd, time_t timeout,
 	gnutls_handshake_set_timeout(session, timeout_value);
 #endif
 
+  if ((host != NULL) && !host_is_address(host))
+    gnutls_server_name_set(session, GNUTLS_NAME_DNS, host, strlen(host));
+
+  if (cache_key != NULL) {
+    struct mailstream_ssl_cache_entry * entry;
+
+    MUTEX_LOCK(&ssl_lock);
+    entry = ssl_cache_lookup(cache, cache_key);
+    if (entry != NULL)
+      gnutls_session_set_data(session, entry->data.data, entry->data.size);
+    MUTEX_UNLOCK(&ssl_lock);
+  }
+
   do {
     r = gnutls_handshake(session);
   } while (r == GNUTLS_E_AGAIN || r == GNUTLS_E_INTERRUPTED);
@@ -611,6 +1169,9 @@ static struct mailstream_ssl_data * ssl_data_new(int fd, time_t timeout,
     gnutls_perror(r);
     goto free_ssl_conn;
   }
+
+  if (cache_key != NULL)
+    ssl_cache_count(cache, gnutls_session_is_resumed(session));
   
   cancel = mailstream_cancel_new();
   if (cancel == NULL)
@@ -628,6 +1189,9 @@ static struct mailstream_ssl_data * ssl_data_new(int fd, time_t timeout,
   ssl_data->session = session;
   ssl_data->xcred = xcred;
   ssl_data->cancel = cancel;
+  ssl_data->cache = cache;
+  ssl_data->cache_key = cache_key;
+  ssl_data->failed = 0;
   
   mailstream_ssl_context_free(ssl_context);
 
@@ -639,25 +1203,40 @@ static struct mailstream_ssl_data * ssl_data_new(int fd, time_t timeout,
   gnutls_certificate_free_credentials(xcred);
   mailstream_ssl_context_free(ssl_context);
   gnutls_deinit(session);
+  free(cache_key);
+  if (cache != NULL)
+    ssl_cache_unref(cache);
  err:
   return NULL;
 }
 static struct mailstream_ssl_data * tls_data_new(int fd, time_t timeout,
+  const char * host, uint16_t port,
   void (* callback)(struct mailstream_ssl_context * ssl_context, void * cb_data), void * cb_data)
 {
-  return ssl_data_new(fd, timeout, callback, cb_data);
+  return ssl_data_new(fd, timeout, host, port, callback, cb_data);
 }
 #endif
 
 static void  ssl_data_free(struct mailstream_ssl_data * ssl_data)
 {
   mailstream_cancel_free(ssl_data->cancel);
+  free(ssl_data->cache_key);
+  if (ssl_data->cache != NULL)
+    ssl_cache_unref(ssl_data->cache);
   free(ssl_data);
 }
 
 #ifndef USE_GNUTLS
 static void  ssl_data_close(struct mailstream_ssl_data * ssl_data)
 {
+  /*
+    OpenSSL makes the session of a connection that is freed without
+    shutdown not resumable, it is still valid for the cache when the
+    connection did not fail.
+  */
+  if ((ssl_data->cache_key != NULL) && !ssl_data->failed)
+    SSL_set_shutdown(ssl_data->ssl_conn,
+        SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
   SSL_free(ssl_data->ssl_conn);
   ssl_data->ssl_conn = NULL;
   SSL_CTX_free(ssl_data->ssl_ctx);
@@ -672,6 +1251,9 @@ static void  ssl_data_close(struct mailstream_ssl_data * ssl_data)
 #else
 static void  ssl_data_close(struct mailstream_ssl_data * ssl_data)
 {
+  if ((ssl_data->cache_key != NULL) && !ssl_data->failed)
+    ssl_cache_store_session(ssl_data->cache, ssl_data->session,
+        ssl_data->cache_key);
   gnutls_certificate_free_credentials(ssl_data->xcred);
   gnutls_deinit(ssl_data->session);
 
@@ -692,6 +1274,7 @@ static void  ssl_data_close(struct mailstream_ssl_data * ssl_data)
 #endif
 
 static mailstream_low * mailstream_low_ssl_open_full(int fd, int starttls, time_t timeout,
+  const char * host, uint16_t port,
   void (* callback)(struct mailstream_ssl_context * ssl_context, void * cb_data), void * cb_data)
 {
 #ifdef USE_SSL
@@ -699,9 +1282,9 @@ static mailstream_low * mailstream_low_ssl_open_full(int fd, int starttls, time_
   struct mailstream_ssl_data * ssl_data;
 
   if (starttls)
-    ssl_data = tls_data_new(fd, timeout, callback, cb_data);
+    ssl_data = tls_data_new(fd, timeout, host, port, callback, cb_data);
   else
-    ssl_data = ssl_data_new(fd, timeout, callback, cb_data);
+    ssl_data = ssl_data_new(fd, timeout, host, port, callback, cb_data);
 
   if (ssl_data == NULL)
     goto err;
@@ -734,12 +1317,12 @@ mailstream_low * mailstream_low_tls_open(int fd)
 
 mailstream_low * mailstream_low_ssl_open_timeout(int fd, time_t timeout)
 {
-  return mailstream_low_ssl_open_full(fd, 0, timeout, NULL, NULL);
+  return mailstream_low_ssl_open_full(fd, 0, timeout, NULL, 0, NULL, NULL);
 }
 
 mailstream_low * mailstream_low_tls_open_timeout(int fd, time_t timeout)
 {
-  return mailstream_low_ssl_open_full(fd, 1, timeout, NULL, NULL);
+  return mailstream_low_ssl_open_full(fd, 1, timeout, NULL, 0, NULL, NULL);
 }
 
 #ifdef USE_SSL
@@ -848,8 +1431,10 @@ static ssize_t mailstream_low_ssl_read(mailstream_low * s,
 
   ssl_data = (struct mailstream_ssl_data *) s->data;
   
-  if (mailstream_cancel_cancelled(ssl_data->cancel))
+  if (mailstream_cancel_cancelled(ssl_data->cancel)) {
+    ssl_data->failed = 1;
     return -1;
+  }
   
   while (1) {
     int ssl_r;
@@ -868,11 +1453,14 @@ static ssize_t mailstream_low_ssl_read(mailstream_low * s,
       
     case SSL_ERROR_WANT_READ:
       r = wait_read(s);
-      if (r < 0)
+      if (r < 0) {
+        ssl_data->failed = 1;
         return r;
+      }
       break;
       
     default:
+      ssl_data->failed = 1;
       return -1;
     }
   }
@@ -885,8 +1473,10 @@ static ssize_t mailstream_low_ssl_read(mailstream_low * s,
   int r;
 
   ssl_data = (struct mailstream_ssl_data *) s->data;
-  if (mailstream_cancel_cancelled(ssl_data->cancel))
+  if (mailstream_cancel_cancelled(ssl_data->cancel)) {
+    ssl_data->failed = 1;
     return -1;
+  }
   
   while (1) {
     r = gnutls_record_recv(ssl_data->session, buf, count);
@@ -905,11 +1495,14 @@ static ssize_t mailstream_low_ssl_read(mailstream_low * s,
     case GNUTLS_E_AGAIN:
     case GNUTLS_E_INTERRUPTED:
       r = wait_read(s);
-      if (r < 0)
+      if (r < 0) {
+        ssl_data->failed = 1;
         return r;
+      }
       break;
       
     default:
+      ssl_data->failed = 1;
       return -1;
     }
   }
@@ -999,6 +1592,8 @@ static ssize_t mailstream_low_ssl_write(mailstream_low * s,
   
   ssl_data = (struct mailstream_ssl_data *) s->data;
   r = wait_write(s);
+  if (r < 0)
+    ssl_data->failed = 1;
   if (r <= 0)
     return r;
   
@@ -1018,6 +1613,7 @@ static ssize_t mailstream_low_ssl_write(mailstream_low * s,
     return 0;
     
   default:
+    ssl_data->failed = 1;
     return r;
   }
 }
@@ -1030,6 +1626,8 @@ static ssize_t mailstream_low_ssl_write(mailstream_low * s,
   
   ssl_data = (struct mailstream_ssl_data *) s->data;
   r = wait_write(s);
+  if (r < 0)
+    ssl_data->failed = 1;
   if (r <= 0)
     return r;
   
@@ -1046,6 +1644,7 @@ static ssize_t mailstream_low_ssl_write(mailstream_low * s,
     return 0;
     
   default:
+    ssl_data->failed = 1;
     return r;
   }
 }
@@ -1072,12 +1671,19 @@ mailstream * mailstream_ssl_open_with_callback(int fd,
 
 mailstream * mailstream_ssl_open_with_callback_timeout(int fd, time_t timeout,
     void (* callback)(struct mailstream_ssl_context * ssl_context, void * data), void * data)
+{
+  return mailstream_ssl_open_with_host(fd, NULL, 0, timeout, callback, data);
+}
+
+mailstream * mailstream_ssl_open_with_host(int fd,
+    const char * host, uint16_t port, time_t timeout,
+    void (* callback)(struct mailstream_ssl_context * ssl_context, void * data), void * data)
 {
 #ifdef USE_SSL
   mailstream_low * low;
   mailstream * s;
 
-  low = mailstream_low_ssl_open_with_callback_timeout(fd, timeout, callback, data);
+  low = mailstream_low_ssl_open_with_host(fd, host, port, timeout, callback, data);
   if (low == NULL)
     goto err;
 
@@ -1174,6 +1780,7 @@ static void mailstream_low_ssl_cancel(mailstream_low * s)
   struct mailstream_ssl_data * data;
   
   data = s->data;
+  data->failed = 1;
   mailstream_cancel_notify(data->cancel);
 #endif
 }
@@ -1187,7 +1794,7 @@ mailstream_low * mailstream_low_ssl_open_with_callback(int fd,
 mailstream_low * mailstream_low_ssl_open_with_callback_timeout(int fd, time_t timeout,
     void (* callback)(struct mailstream_ssl_context * ssl_context, void * data), void * data)
 {
-  return mailstream_low_ssl_open_full(fd, 0, timeout, callback, data);
+  return mailstream_low_ssl_open_full(fd, 0, timeout, NULL, 0, callback, data);
 }
 
 mailstream_low * mailstream_low_tls_open_with_callback(int fd,
@@ -1199,7 +1806,21 @@ mailstream_low * mailstream_low_tls_open_with_callback(int fd,
 mailstream_low * mailstream_low_tls_open_with_callback_timeout(int fd, time_t timeout,
     void (* callback)(struct mailstream_ssl_context * ssl_context, void * data), void * data)
 {
-  return mailstream_low_ssl_open_full(fd, 1, timeout, callback, data);
+  return mailstream_low_ssl_open_full(fd, 1, timeout, NULL, 0, callback, data);
+}
+
+mailstream_low * mailstream_low_ssl_open_with_host(int fd,
+    const char * host, uint16_t port, time_t timeout,
+    void (* callback)(struct mailstream_ssl_context * ssl_context, void * data), void * data)
+{
+  return mailstream_low_ssl_open_full(fd, 0, timeout, host, port, callback, data);
+}
+
+mailstream_low * mailstream_low_tls_open_with_host(int fd,
+    const char * host, uint16_t port, time_t timeout,
+    void (* callback)(struct mailstream_ssl_context * ssl_context, void * data), void * data)
+{
+  return mailstream_low_ssl_open_full(fd, 1, timeout, host, port, callback, data);
 }
 
 int mailstream_ssl_set_client_certicate(struct mailstream_ssl_context * ssl_context,
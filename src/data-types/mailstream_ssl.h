@@ -37,6 +37,10 @@
 
 #define MAILSTREAM_SSL_H
 
+#ifdef HAVE_INTTYPES_H
+#	include <inttypes.h>
+#endif
+
 #include <libetpan/mailstream.h>
 
 #ifdef __cplusplus
@@ -129,6 +133,82 @@ void * mailstream_ssl_get_openssl_ssl_ctx(struct mailstream_ssl_context * ssl_co
 LIBETPAN_EXPORT
 int mailstream_ssl_get_fd(struct mailstream_ssl_context * ssl_context);
 
+/*
+  the mailstream_*_open_with_host() functions are the same as
+  mailstream_*_open_with_callback_timeout(), the host name is sent to
+  the server (server name indication) and identifies the TLS session
+  in the cache with the port.
+*/
+
+LIBETPAN_EXPORT
+mailstream * mailstream_ssl_open_with_host(int fd,
+    const char * host, uint16_t port, time_t timeout,
+    void (* callback)(struct mailstream_ssl_context * ssl_context, void * data), void * data);
+
+LIBETPAN_EXPORT
+mailstream_low * mailstream_low_ssl_open_with_host(int fd,
+    const char * host, uint16_t port, time_t timeout,
+    void (* callback)(struct mailstream_ssl_context * ssl_context, void * data), void * data);
+
+LIBETPAN_EXPORT
+mailstream_low * mailstream_low_tls_open_with_host(int fd,
+    const char * host, uint16_t port, time_t timeout,
+    void (* callback)(struct mailstream_ssl_context * ssl_context, void * data), void * data);
+
+/*
+  TLS session cache
+
+  When a cache is set with mailstream_ssl_set_cache(), the connections
+  share one SSL context for each protocol (OpenSSL only, the CA store
+  and the settings are loaded once) and resume the TLS session of the
+  previous connection to the same server (session ticket, TLS 1.3 PSK
+  or session ID). The server is given by the host name and the port
+  of mailstream_*_open_with_host(), or by the address of the peer.
+  The connections configured by a callback use their own context, since
+  the callback can change the verification or the client certificate.
+  Their session is only resumed by the connections to the same server
+  configured by the same callback with the same data.
+
+  mailstream_ssl_cache_new() creates a cache of max_count sessions,
+    64 when max_count is 0. NULL is returned on error or when TLS
+    is not available.
+
+  mailstream_ssl_cache_free() releases the cache, it is no longer used
+    by the new connections if it was set. The sessions are released
+    when the last connection that uses the cache is closed.
+
+  mailstream_ssl_cache_flush() removes all the sessions.
+
+  mailstream_ssl_cache_get_stats() returns the number of connections
+    of the cache that resumed a session (hits) and the number of
+    connections that needed a full handshake (misses).
+
+  mailstream_ssl_set_cache() sets the cache used by the new
+    connections of the process, NULL disables the cache (default).
+    The cache remains owned by the caller.
+*/
+
+struct mailstream_ssl_cache;
+
+LIBETPAN_EXPORT
+struct mailstream_ssl_cache * mailstream_ssl_cache_new(unsigned int max_count);
+
+LIBETPAN_EXPORT
+void mailstream_ssl_cache_free(struct mailstream_ssl_cache * cache);
+
+LIBETPAN_EXPORT
+void mailstream_ssl_cache_flush(struct mailstream_ssl_cache * cache);
+
+LIBETPAN_EXPORT
+void mailstream_ssl_cache_get_stats(struct mailstream_ssl_cache * cache,
+    unsigned long * p_hits, unsigned long * p_misses);
+
+LIBETPAN_EXPORT
+void mailstream_ssl_set_cache(struct mailstream_ssl_cache * cache);
+
+LIBETPAN_EXPORT
+struct mailstream_ssl_cache * mailstream_ssl_get_cache(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -40,7 +40,7 @@
 #include "mmapstring.h"
 #include "mmapstring_private.h"
 
-#include "chash.h"
+#include "cohash.h"
 
 #include <stdlib.h>
 #ifdef WIN32
@@ -91,7 +91,7 @@ static size_t mmap_string_ceil = MMAP_STRING_DEFAULT_CEIL;
 #	define MUTEX_LOCK(x) 
 #	define MUTEX_UNLOCK(x)
 #endif
-static chash * mmapstring_hashtable = NULL;
+static cohash * mmapstring_hashtable = NULL;
 
 void mmapstring_init_lock(void)
 {
@@ -109,7 +109,7 @@ void mmapstring_uninit_lock(void)
 
 static void mmapstring_hashtable_init(void)
 {
-  mmapstring_hashtable = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
+  mmapstring_hashtable = cohash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
 }
 
 void mmap_string_set_tmpdir(const char * directory)
@@ -121,7 +121,7 @@ void mmap_string_set_tmpdir(const char * directory)
 
 int mmap_string_ref(MMAPString * string)
 {
-  chash * ht;
+  cohash * ht;
   int r;
   chashdatum key;
   chashdatum data;
@@ -144,7 +144,7 @@ int mmap_string_ref(MMAPString * string)
   data.data = string;
   data.len = 0;
   
-  r = chash_set(mmapstring_hashtable, &key, &data, NULL);
+  r = cohash_set(mmapstring_hashtable, &key, &data, NULL);
  
   MUTEX_UNLOCK(&mmapstring_lock);
   
@@ -157,7 +157,7 @@ int mmap_string_ref(MMAPString * string)
 int mmap_string_unref(char * str)
 {
   MMAPString * string;
-  chash * ht;
+  cohash * ht;
   chashdatum key;
   chashdatum data;
   int r;
@@ -178,16 +178,16 @@ int mmap_string_unref(char * str)
   key.data = &str;
   key.len = sizeof(str);
 
-  r = chash_get(ht, &key, &data);
+  r = cohash_get(ht, &key, &data);
   if (r < 0)
     string = NULL;
   else
     string = data.data;
   
   if (string != NULL) {
-    chash_delete(ht, &key, NULL);
-    if (chash_count(ht) == 0) {
-      chash_free(ht);
+    cohash_delete(ht, &key, NULL);
+    if (cohash_count(ht) == 0) {
+      cohash_free(ht);
       mmapstring_hashtable = NULL;
     }
   }
@@ -23,6 +23,7 @@ static int mkstemp(char *template)
 #else
 #include <unistd.h>
 #include <sys/select.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
 #endif
@@ -347,6 +348,25 @@ static inline int Select(
 }
 #define select >@<
 
+#ifndef WIN32
+static inline int Poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    int r;
+
+    do {
+        r = poll(fds, nfds, timeout);
+
+        if (libetpan_cancel_read_write) {
+            libetpan_cancel_read_write = 0;
+            break;
+        }
+    } while (r == -1 && errno == EINTR);
+
+    return r;
+}
+#define poll >@<
+#endif
+
 #ifndef WIN32
 static inline int Fcntl(int fildes, int cmd, void *structure)
 {
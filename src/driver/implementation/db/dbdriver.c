@@ -133,7 +133,9 @@ static mailsession_driver local_db_session_driver = {
   /* sess_get_messages_list */ get_messages_list,
   /* sess_get_envelopes_list */ get_envelopes_list,
   /* sess_remove_message */ NULL,
-  /* sess_login_sasl */ NULL
+  /* sess_login_sasl */ NULL,
+
+  /* sess_build_thread */ NULL
 };
 
 mailsession_driver * db_session_driver = &local_db_session_driver;
@@ -143,60 +145,6 @@ static inline struct db_session_state_data * get_data(mailsession * session)
   return session->sess_data;
 }
 
-static int flags_store_process(mailsession * session)
-{
-  unsigned int i;
-  MMAPString * mmapstr;
-  int r;
-  int res;
-  struct mail_cache_db * maildb;
-  struct db_session_state_data * data;
-  struct mail_flags_store * flags_store;
-  
-  data = get_data(session);
-  
-  flags_store = data->db_flags_store;
-  
-  if (carray_count(flags_store->fls_tab) == 0)
-    return MAIL_NO_ERROR;
-  
-  mmapstr = mmap_string_new("");
-  if (mmapstr == NULL) {
-    res = MAIL_ERROR_MEMORY;
-    goto err;
-  }
-  
-  r = mail_cache_db_open_lock(data->db_filename, &maildb);
-  if (r < 0) {
-    res = MAIL_ERROR_FILE;
-    goto free_mmapstr;
-  }
-  
-  for(i = 0 ; i < carray_count(flags_store->fls_tab) ; i ++) {
-    mailmessage * msg;
-    char key[PATH_MAX];
-    
-    msg = carray_get(flags_store->fls_tab, i);
-    
-    snprintf(key, sizeof(key), "%lu-flags", (unsigned long) msg->msg_index);
-    
-    r = generic_cache_flags_write(maildb, mmapstr,
-        key, msg->msg_flags);
-  }
-  
-  mail_flags_store_clear(flags_store);
-  
-  mail_cache_db_close_unlock(data->db_filename, maildb);
-  mmap_string_free(mmapstr);
-  
-  return MAIL_NO_ERROR;
-  
- free_mmapstr:
-  mmap_string_free(mmapstr);
- err:
-  return res;
-}
-
 static int db_get_next_msg_number(struct mail_cache_db * maildb,
     uint32_t * p_num)
 {
@@ -262,14 +210,347 @@ static int db_get_next_msg_number(struct mail_cache_db * maildb,
   return res;
 }
 
-static int db_set_message_list(struct mail_cache_db * maildb,
-    carray * msglist)
+/*
+  Each message has a key "msg-XXXXXXXX" where XXXXXXXX is the number
+  of the message in hexadecimal, so that the keys are ordered by
+  message number. The number of messages and the number of unseen
+  messages are kept in the "counters" record and updated along with
+  the messages, while the database is locked. MAIL_FLAG_NEW is never
+  stored in the flags cache, so there are no recent messages.
+
+  The database has no transactions, the "counters-dirty" record is
+  written before the messages are changed and removed when the
+  counters are written. When it is found at open, the changes were
+  interrupted and the counters are computed again from the messages.
+
+  Older databases keep the list of messages in a single
+  "message-list" record, they are converted when opened.
+*/
+
+#define MSG_KEY_PREFIX "msg-"
+#define COUNTERS_DIRTY_KEY "counters-dirty"
+
+struct db_counters {
+  uint32_t cnt_messages;
+  uint32_t cnt_unseen;
+};
+
+static void db_counters_add_flags(struct db_counters * counters,
+    struct mail_flags * flags, int delta)
+{
+  if ((flags->fl_flags & MAIL_FLAG_SEEN) == 0)
+    counters->cnt_unseen += delta;
+}
+
+static int db_counters_read(struct mail_cache_db * maildb,
+    MMAPString * mmapstr, struct db_counters * counters)
+{
+  void * serialized;
+  size_t serialized_len;
+  size_t cur_token;
+  int r;
+  
+  r = mail_cache_db_get(maildb, "counters", strlen("counters"),
+      &serialized, &serialized_len);
+  if (r < 0)
+    return MAIL_ERROR_CACHE_MISS;
+  
+  mmap_string_set_size(mmapstr, 0);
+  if (mmap_string_append_len(mmapstr, serialized, serialized_len) == NULL)
+    return MAIL_ERROR_MEMORY;
+  
+  cur_token = 0;
+  r = mailimf_cache_int_read(mmapstr, &cur_token, &counters->cnt_messages);
+  if (r != MAIL_NO_ERROR)
+    return r;
+  r = mailimf_cache_int_read(mmapstr, &cur_token, &counters->cnt_unseen);
+  if (r != MAIL_NO_ERROR)
+    return r;
+  
+  return MAIL_NO_ERROR;
+}
+
+static int db_counters_write(struct mail_cache_db * maildb,
+    MMAPString * mmapstr, struct db_counters * counters)
+{
+  size_t cur_token;
+  int r;
+  
+  mmap_string_set_size(mmapstr, 0);
+  cur_token = 0;
+  r = mailimf_cache_int_write(mmapstr, &cur_token, counters->cnt_messages);
+  if (r != MAIL_NO_ERROR)
+    return r;
+  r = mailimf_cache_int_write(mmapstr, &cur_token, counters->cnt_unseen);
+  if (r != MAIL_NO_ERROR)
+    return r;
+  
+  r = mail_cache_db_put(maildb, "counters", strlen("counters"),
+      mmapstr->str, mmapstr->len);
+  if (r < 0)
+    return MAIL_ERROR_FILE;
+  
+  /* if this fails, the counters are only computed again at open */
+  mail_cache_db_del(maildb, COUNTERS_DIRTY_KEY, strlen(COUNTERS_DIRTY_KEY));
+  
+  return MAIL_NO_ERROR;
+}
+
+/* to be called before the messages are changed, see above */
+
+static int db_counters_begin(struct mail_cache_db * maildb)
+{
+  int r;
+  
+  r = mail_cache_db_put(maildb, COUNTERS_DIRTY_KEY,
+      strlen(COUNTERS_DIRTY_KEY), "", 0);
+  if (r < 0)
+    return MAIL_ERROR_FILE;
+  
+  return MAIL_NO_ERROR;
+}
+
+static int db_counters_dirty(struct mail_cache_db * maildb)
+{
+  size_t len;
+  int r;
+  
+  r = mail_cache_db_get_size(maildb, COUNTERS_DIRTY_KEY,
+      strlen(COUNTERS_DIRTY_KEY), &len);
+  
+  return (r >= 0);
+}
+
+static int db_add_message_key(struct mail_cache_db * maildb, uint32_t num)
 {
-  MMAPString * mmapstr;
   char key_value[PATH_MAX];
   int r;
+  
+  snprintf(key_value, sizeof(key_value), MSG_KEY_PREFIX "%08lx",
+      (unsigned long) num);
+  r = mail_cache_db_put(maildb, key_value, strlen(key_value), "", 0);
+  if (r < 0)
+    return MAIL_ERROR_FILE;
+  
+  return MAIL_NO_ERROR;
+}
+
+static void db_delete_message_keys(struct mail_cache_db * maildb,
+    uint32_t num)
+{
+  char key_value[PATH_MAX];
+  
+  snprintf(key_value, sizeof(key_value), MSG_KEY_PREFIX "%08lx",
+      (unsigned long) num);
+  mail_cache_db_del(maildb, key_value, strlen(key_value));
+  snprintf(key_value, sizeof(key_value), "%lu", (unsigned long) num);
+  mail_cache_db_del(maildb, key_value, strlen(key_value));
+  snprintf(key_value, sizeof(key_value), "%lu-envelope", (unsigned long) num);
+  mail_cache_db_del(maildb, key_value, strlen(key_value));
+  snprintf(key_value, sizeof(key_value), "%lu-flags", (unsigned long) num);
+  mail_cache_db_del(maildb, key_value, strlen(key_value));
+}
+
+static int collect_message_key(const void * key, size_t key_len,
+    void * cb_data)
+{
+  carray * msglist;
+  char num_str[9];
+  uint32_t * msg;
+  int r;
+  
+  msglist = cb_data;
+  
+  if (key_len != strlen(MSG_KEY_PREFIX) + 8)
+    return 0;
+  
+  memcpy(num_str, (const char *) key + strlen(MSG_KEY_PREFIX), 8);
+  num_str[8] = '\0';
+  
+  msg = malloc(sizeof(* msg));
+  if (msg == NULL)
+    return -1;
+  * msg = (uint32_t) strtoul(num_str, NULL, 16);
+  
+  r = carray_add(msglist, msg, NULL);
+  if (r < 0) {
+    free(msg);
+    return -1;
+  }
+  
+  return 0;
+}
+
+static int db_get_message_list(struct mail_cache_db * maildb,
+    carray ** p_msglist)
+{
+  carray * msglist;
+  int r;
   unsigned int i;
-  size_t cur_token;
+  
+  msglist = carray_new(16);
+  if (msglist == NULL)
+    return MAIL_ERROR_MEMORY;
+  
+  r = mail_cache_db_get_keys_with_prefix(maildb,
+      MSG_KEY_PREFIX, strlen(MSG_KEY_PREFIX), collect_message_key, msglist);
+  if (r < 0) {
+    for(i = 0 ; i < carray_count(msglist) ; i ++)
+      free(carray_get(msglist, i));
+    carray_free(msglist);
+    return MAIL_ERROR_MEMORY;
+  }
+  
+  * p_msglist = msglist;
+  
+  return MAIL_NO_ERROR;
+}
+
+static int db_get_old_message_list(struct mail_cache_db * maildb,
+    carray ** p_msglist)
+{
+  carray * msglist;
+  void * serialized;
+  size_t serialized_len;
+  int r;
+  char key_value[PATH_MAX];
+  int res;
+  unsigned int i;
+
+  msglist = carray_new(16);
+  if (msglist == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+  
+  snprintf(key_value, sizeof(key_value), "message-list");
+  r = mail_cache_db_get(maildb, key_value, strlen(key_value),
+      &serialized, &serialized_len);
+  if (r >= 0) {
+    MMAPString * mmapstr;
+    size_t cur_token;
+    
+    /* collect message list */
+    
+    mmapstr = mmap_string_new_len(serialized, serialized_len);
+    if (mmapstr == NULL) {
+      res = MAIL_ERROR_MEMORY;
+      goto free_msglist;
+    }
+    
+    cur_token = 0;
+    do {
+      uint32_t num;
+      uint32_t * msg;
+      
+      r = mailimf_cache_int_read(mmapstr, &cur_token, &num);
+      if (r != MAIL_NO_ERROR)
+        break;
+      
+      msg = malloc(sizeof(* msg));
+      if (msg == NULL) {
+        res = MAIL_ERROR_MEMORY;
+        mmap_string_free(mmapstr);
+        goto free_msglist;
+      }
+      * msg = num;
+      
+      r = carray_add(msglist, msg, NULL);
+      if (r < 0) {
+        res = MAIL_ERROR_MEMORY;
+        free(msg);
+        mmap_string_free(mmapstr);
+        goto free_msglist;
+      }
+    } while (1);
+    
+    mmap_string_free(mmapstr);
+  }
+  
+  * p_msglist = msglist;
+  
+  return MAIL_NO_ERROR;
+  
+ free_msglist:
+  for(i = 0 ; i < carray_count(msglist) ; i ++) {
+    uint32_t * msg;
+    
+    msg = carray_get(msglist, i);
+    free(msg);
+  }
+  carray_free(msglist);
+ err:
+  return res;
+}
+
+/* computes the counters from the messages */
+
+static int db_counters_rebuild(struct mail_cache_db * maildb,
+    MMAPString * mmapstr)
+{
+  struct db_counters counters;
+  carray * msglist;
+  unsigned int i;
+  int r;
+  int res;
+  
+  r = db_get_message_list(maildb, &msglist);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto err;
+  }
+  
+  memset(&counters, 0, sizeof(counters));
+  for(i = 0 ; i < carray_count(msglist) ; i ++) {
+    char key_value[PATH_MAX];
+    struct mail_flags * flags;
+    uint32_t * msg;
+    
+    msg = carray_get(msglist, i);
+    
+    counters.cnt_messages ++;
+    snprintf(key_value, sizeof(key_value), "%lu-flags",
+        (unsigned long) * msg);
+    r = generic_cache_flags_read(maildb, mmapstr, key_value, &flags);
+    if (r == MAIL_NO_ERROR) {
+      db_counters_add_flags(&counters, flags, 1);
+      mail_flags_free(flags);
+    }
+  }
+  
+  r = db_counters_write(maildb, mmapstr, &counters);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_msglist;
+  }
+  
+  for(i = 0 ; i < carray_count(msglist) ; i ++)
+    free(carray_get(msglist, i));
+  carray_free(msglist);
+  
+  return MAIL_NO_ERROR;
+  
+ free_msglist:
+  for(i = 0 ; i < carray_count(msglist) ; i ++)
+    free(carray_get(msglist, i));
+  carray_free(msglist);
+ err:
+  return res;
+}
+
+/*
+  converts the "message-list" record of older databases and computes
+  the counters again when they are missing or were not written after
+  the last change of the messages.
+*/
+
+static int db_upgrade(struct mail_cache_db * maildb)
+{
+  struct db_counters counters;
+  MMAPString * mmapstr;
+  carray * msglist;
+  unsigned int i;
+  int r;
   int res;
   
   mmapstr = mmap_string_new("");
@@ -278,109 +559,162 @@ static int db_set_message_list(struct mail_cache_db * maildb,
     goto err;
   }
   
-  cur_token = 0;
+  r = db_counters_read(maildb, mmapstr, &counters);
+  if ((r == MAIL_NO_ERROR) && !db_counters_dirty(maildb)) {
+    mmap_string_free(mmapstr);
+    return MAIL_NO_ERROR;
+  }
+  
+  r = db_counters_begin(maildb);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_mmapstr;
+  }
+  
+  r = db_get_old_message_list(maildb, &msglist);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_mmapstr;
+  }
+  
   for(i = 0 ; i < carray_count(msglist) ; i ++) {
     uint32_t * msg;
     
     msg = carray_get(msglist, i);
-    r = mailimf_cache_int_write(mmapstr, &cur_token, * msg);
+    
+    r = db_add_message_key(maildb, * msg);
     if (r != MAIL_NO_ERROR) {
       res = r;
-      goto free_mmapstr;
+      goto free_msglist;
     }
   }
   
-  snprintf(key_value, sizeof(key_value), "message-list");
-  r = mail_cache_db_put(maildb, key_value, strlen(key_value),
-      mmapstr->str, mmapstr->len);
-  if (r < 0) {
-    res = MAIL_ERROR_FILE;
-    goto err;
+  r = db_counters_rebuild(maildb, mmapstr);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_msglist;
   }
   
+  mail_cache_db_del(maildb, "message-list", strlen("message-list"));
+  
+  for(i = 0 ; i < carray_count(msglist) ; i ++)
+    free(carray_get(msglist, i));
+  carray_free(msglist);
   mmap_string_free(mmapstr);
   
   return MAIL_NO_ERROR;
   
+ free_msglist:
+  for(i = 0 ; i < carray_count(msglist) ; i ++)
+    free(carray_get(msglist, i));
+  carray_free(msglist);
  free_mmapstr:
   mmap_string_free(mmapstr);
  err:
   return res;
 }
 
-static int db_get_message_list(struct mail_cache_db * maildb,
-    carray ** p_msglist)
+static int db_open_lock(struct db_session_state_data * data,
+    struct mail_cache_db ** pmaildb)
 {
-  carray * msglist;
-  void * serialized;
-  size_t serialized_len;
+  struct mail_cache_db * maildb;
   int r;
-  char key_value[PATH_MAX];
-  int res;
-  unsigned int i;
+  
+  r = mail_cache_db_open_lock(data->db_filename, &maildb);
+  if (r < 0)
+    return MAIL_ERROR_FILE;
+  
+  r = db_upgrade(maildb);
+  if (r != MAIL_NO_ERROR) {
+    mail_cache_db_close_unlock(data->db_filename, maildb);
+    return r;
+  }
+  
+  * pmaildb = maildb;
+  
+  return MAIL_NO_ERROR;
+}
 
-  msglist = carray_new(16);
-  if (msglist == NULL) {
+static int flags_store_process(mailsession * session)
+{
+  unsigned int i;
+  MMAPString * mmapstr;
+  int r;
+  int res;
+  struct mail_cache_db * maildb;
+  struct db_session_state_data * data;
+  struct mail_flags_store * flags_store;
+  struct db_counters counters;
+  
+  data = get_data(session);
+  
+  flags_store = data->db_flags_store;
+  
+  if (carray_count(flags_store->fls_tab) == 0)
+    return MAIL_NO_ERROR;
+  
+  mmapstr = mmap_string_new("");
+  if (mmapstr == NULL) {
     res = MAIL_ERROR_MEMORY;
     goto err;
   }
   
-  snprintf(key_value, sizeof(key_value), "message-list");
-  r = mail_cache_db_get(maildb, key_value, strlen(key_value),
-      &serialized, &serialized_len);
-  if (r >= 0) {
-    MMAPString * mmapstr;
-    size_t cur_token;
+  r = db_open_lock(data, &maildb);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_mmapstr;
+  }
+  
+  r = db_counters_read(maildb, mmapstr, &counters);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto close_db;
+  }
+  
+  r = db_counters_begin(maildb);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto close_db;
+  }
+  
+  for(i = 0 ; i < carray_count(flags_store->fls_tab) ; i ++) {
+    mailmessage * msg;
+    char key[PATH_MAX];
+    struct mail_flags * old_flags;
     
-    /* collect message list */
+    msg = carray_get(flags_store->fls_tab, i);
     
-    mmapstr = mmap_string_new_len(serialized, serialized_len);
-    if (mmapstr == NULL) {
-      res = MAIL_ERROR_MEMORY;
-      goto free_msglist;
-    }
+    snprintf(key, sizeof(key), "%lu-flags", (unsigned long) msg->msg_index);
     
-    cur_token = 0;
-    do {
-      uint32_t num;
-      uint32_t * msg;
-      
-      r = mailimf_cache_int_read(mmapstr, &cur_token, &num);
-      if (r != MAIL_NO_ERROR)
-        break;
-      
-      msg = malloc(sizeof(* msg));
-      if (msg == NULL) {
-        res = MAIL_ERROR_MEMORY;
-        mmap_string_free(mmapstr);
-        goto free_msglist;
-      }
-      * msg = num;
-      
-      r = carray_add(msglist, msg, NULL);
-      if (r < 0) {
-        res = MAIL_ERROR_MEMORY;
-        free(msg);
-        mmap_string_free(mmapstr);
-        goto free_msglist;
-      }
-    } while (1);
+    r = generic_cache_flags_read(maildb, mmapstr, key, &old_flags);
+    if (r == MAIL_NO_ERROR) {
+      db_counters_add_flags(&counters, old_flags, -1);
+      mail_flags_free(old_flags);
+    }
     
-    mmap_string_free(mmapstr);
+    r = generic_cache_flags_write(maildb, mmapstr,
+        key, msg->msg_flags);
+    if (r == MAIL_NO_ERROR)
+      db_counters_add_flags(&counters, msg->msg_flags, 1);
   }
   
-  * p_msglist = msglist;
+  mail_flags_store_clear(flags_store);
+  
+  r = db_counters_write(maildb, mmapstr, &counters);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto close_db;
+  }
+  
+  mail_cache_db_close_unlock(data->db_filename, maildb);
+  mmap_string_free(mmapstr);
   
   return MAIL_NO_ERROR;
   
- free_msglist:
-  for(i = 0 ; i < carray_count(msglist) ; i ++) {
-    uint32_t * msg;
-    
-    msg = carray_get(msglist, i);
-    free(msg);
-  }
-  carray_free(msglist);
+ close_db:
+  mail_cache_db_close_unlock(data->db_filename, maildb);
+ free_mmapstr:
+  mmap_string_free(mmapstr);
  err:
   return res;
 }
@@ -449,16 +783,16 @@ static int expunge_folder(mailsession * session)
   unsigned int i;
   struct db_session_state_data * data;
   int res;
-  chash * msg_table;
   MMAPString * mmapstr;
+  struct db_counters counters;
   
   data = get_data(session);
   
   flags_store_process(session);
   
-  r = mail_cache_db_open_lock(data->db_filename, &maildb);
-  if (r < 0) {
-    res = MAIL_ERROR_FILE;
+  r = db_open_lock(data, &maildb);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
     goto err;
   }
   
@@ -468,72 +802,52 @@ static int expunge_folder(mailsession * session)
     goto close_db;
   }
   
-  msg_table = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
-  if (msg_table == NULL) {
+  mmapstr = mmap_string_new("");
+  if (mmapstr == NULL) {
     res = MAIL_ERROR_MEMORY;
     goto free_msglist;
   }
   
-  mmapstr = mmap_string_new("");
-  if (mmapstr == NULL) {
-    res = MAIL_ERROR_MEMORY;
-    goto free_msgtable;
+  r = db_counters_begin(maildb);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_mmapstr;
   }
   
-  i = 0;
-  while (i < carray_count(msglist)) {
+  memset(&counters, 0, sizeof(counters));
+  for(i = 0 ; i < carray_count(msglist) ; i ++) {
     uint32_t num;
     uint32_t * msg;
-    chashdatum key;
-    chashdatum value;
     struct mail_flags * flags;
-    int deleted;
     
     msg = carray_get(msglist, i);
     num = * msg;
     
-    deleted = 0;
     snprintf(key_value, sizeof(key_value), "%lu-flags",
         (unsigned long) num);
     r = generic_cache_flags_read(maildb, mmapstr, key_value, &flags);
-    if (r == MAIL_NO_ERROR) {
-      if ((flags->fl_flags & MAIL_FLAG_DELETED) != 0)
-        deleted = 1;
+    if (r != MAIL_NO_ERROR) {
+      counters.cnt_messages ++;
+      continue;
     }
     
-    if (!deleted) {
-      snprintf(key_value, sizeof(key_value), "%lu", (unsigned long) num);
-      key.data = key_value;
-      key.len = (unsigned int) strlen(key_value);
-      chash_set(msg_table, &key, &value, NULL);
-      
-      snprintf(key_value, sizeof(key_value), "%lu-envelope",
-          (unsigned long) num);
-      key.data = key_value;
-      key.len = (unsigned int) strlen(key_value);
-      chash_set(msg_table, &key, &value, NULL);
-      
-      snprintf(key_value, sizeof(key_value), "%lu-flags",
-          (unsigned long) num);
-      key.data = key_value;
-      key.len = (unsigned int) strlen(key_value);
-      chash_set(msg_table, &key, &value, NULL);
-      
-      i ++;
+    if ((flags->fl_flags & MAIL_FLAG_DELETED) != 0) {
+      db_delete_message_keys(maildb, num);
     }
     else {
-      free(msg);
-      carray_delete(msglist, i);
+      counters.cnt_messages ++;
+      db_counters_add_flags(&counters, flags, 1);
     }
+    mail_flags_free(flags);
   }
   
-  mmap_string_free(mmapstr);
-  
-  r = mail_cache_db_clean_up(maildb, msg_table);
-  
-  chash_free(msg_table);
+  r = db_counters_write(maildb, mmapstr, &counters);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_mmapstr;
+  }
   
-  r = db_set_message_list(maildb, msglist);
+  mmap_string_free(mmapstr);
   
   for(i = 0 ; i < carray_count(msglist) ; i ++) {
     uint32_t * msg;
@@ -547,8 +861,8 @@ static int expunge_folder(mailsession * session)
   
   return MAIL_NO_ERROR;
 
- free_msgtable:
-  chash_free(msg_table);
+ free_mmapstr:
+  mmap_string_free(mmapstr);
  free_msglist:
   for(i = 0 ; i < carray_count(msglist) ; i ++) {
     uint32_t * msg;
@@ -556,6 +870,7 @@ static int expunge_folder(mailsession * session)
     msg = carray_get(msglist, i);
     free(msg);
   }
+  carray_free(msglist);
  close_db:
   mail_cache_db_close_unlock(data->db_filename, maildb);
  err:
@@ -567,89 +882,46 @@ static int status_folder(mailsession * session, const char * mb,
     uint32_t * result_unseen)
 {
   struct mail_cache_db * maildb;
-  char key_value[PATH_MAX];
   MMAPString * mmapstr;
-  uint32_t messages;
-  uint32_t recent;
-  uint32_t unseen;
   struct db_session_state_data * data;
+  struct db_counters counters;
   int r;
   int res;
-  carray * msglist;
-  unsigned int i;
   
   data = get_data(session);
   
   flags_store_process(session);
   
-  r = mail_cache_db_open_lock(data->db_filename, &maildb);
-  if (r < 0) {
-    res = MAIL_ERROR_FILE;
-    goto err;
-  }
-
-  r = db_get_message_list(maildb, &msglist);
+  r = db_open_lock(data, &maildb);
   if (r != MAIL_NO_ERROR) {
     res = r;
-    goto close_db;
+    goto err;
   }
 
   mmapstr = mmap_string_new("");
   if (mmapstr == NULL) {
     res = MAIL_ERROR_MEMORY;
-    goto free_list;
+    goto close_db;
   }
   
-  messages = 0;
-  recent = 0;
-  unseen = 0;
-  for(i = 0 ; i < carray_count(msglist) ; i ++) {
-    uint32_t num;
-    uint32_t * msg;
-    struct mail_flags * flags;
-    
-    msg = carray_get(msglist, i);
-    num = * msg;
-    free(msg);
-    carray_set(msglist, i, NULL);
-    
-    messages ++;
-    
-    snprintf(key_value, sizeof(key_value), "%lu-flags", (unsigned long) num);
-    
-    r = generic_cache_flags_read(maildb, mmapstr, key_value, &flags);
-    if (r == MAIL_NO_ERROR) {
-      if ((flags->fl_flags & MAIL_FLAG_NEW) != 0) {
-        recent ++;
-      }
-      if ((flags->fl_flags & MAIL_FLAG_SEEN) == 0) {
-        unseen ++;
-      }
-      mail_flags_free(flags);
-    }
+  r = db_counters_read(maildb, mmapstr, &counters);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_mmapstr;
   }
 
   mmap_string_free(mmapstr);
   
-  carray_free(msglist);
-  
   mail_cache_db_close_unlock(data->db_filename, maildb);
 
-  * result_messages = messages;
-  * result_unseen = unseen;
-  * result_recent = recent;
+  * result_messages = counters.cnt_messages;
+  * result_unseen = counters.cnt_unseen;
+  * result_recent = 0;
   
   return MAIL_NO_ERROR;
   
- free_list:
-  for(i = 0 ; i < carray_count(msglist) ; i ++) {
-    uint32_t * msg;
-    
-    msg = carray_get(msglist, i);
-    if (msg != NULL)
-      free(msg);
-  }
-  carray_free(msglist);
+ free_mmapstr:
+  mmap_string_free(mmapstr);
  close_db:
   mail_cache_db_close_unlock(data->db_filename, maildb);
  err:
@@ -695,9 +967,6 @@ static int append_message(mailsession * session,
 static int append_message_flags(mailsession * session,
     const char * message, size_t size, struct mail_flags * flags)
 {
-  carray * msglist;
-  unsigned int i;
-  uint32_t * msg;
   uint32_t num;
   char key_value[PATH_MAX];
   MMAPString * mmapstr;
@@ -705,59 +974,25 @@ static int append_message_flags(mailsession * session,
   struct db_session_state_data * data;
   size_t cur_token;
   struct mailimf_fields * fields;
+  struct db_counters counters;
   int r;
   int res;
   
   data = get_data(session);
   
-  r = mail_cache_db_open_lock(data->db_filename, &maildb);
-  if (r < 0) {
-    res = MAIL_ERROR_FILE;
-    goto err;
-  }
-  
-  num = 0;
-  r = db_get_next_msg_number(maildb, &num);
+  r = db_open_lock(data, &maildb);
   if (r != MAIL_NO_ERROR) {
     res = r;
     goto err;
   }
   
-  r = db_get_message_list(maildb, &msglist);
+  num = 0;
+  r = db_get_next_msg_number(maildb, &num);
   if (r != MAIL_NO_ERROR) {
     res = r;
     goto close_db;
   }
   
-  msg = malloc(sizeof(* msg));
-  if (msg == NULL) {
-    res = MAIL_ERROR_MEMORY;
-    goto free_msglist;
-  }
-  
-  * msg = num;
-  
-  r = carray_add(msglist, msg, NULL);
-  if (r < 0) {
-    res = MAIL_ERROR_MEMORY;
-    free(msg);
-    goto free_msglist;
-  }
-  
-  r = db_set_message_list(maildb, msglist);
-  if (r != MAIL_NO_ERROR) {
-    res = r;
-    goto free_msglist;
-  }
-  
-  /* free msglist */
-  
-  for(i = 0 ; i < carray_count(msglist) ; i ++) {
-    msg = carray_get(msglist, i);
-    free(msg);
-  }
-  carray_free(msglist);
-  
   snprintf(key_value, sizeof(key_value), "%lu", (unsigned long) num);
   
   r = mail_cache_db_put(maildb, key_value, strlen(key_value),
@@ -795,8 +1030,6 @@ static int append_message_flags(mailsession * session,
   r = mail_cache_db_put(maildb, key_value, strlen(key_value),
       mmapstr->str, mmapstr->len);
   
-  mmap_string_free(mmapstr);
-  
   mailimf_fields_free(fields);
   
   /* write flags */
@@ -804,33 +1037,52 @@ static int append_message_flags(mailsession * session,
   if (flags != NULL) {
     snprintf(key_value, sizeof(key_value), "%lu-flags", (unsigned long) num);
     
-    mmapstr = mmap_string_new("");
-    if (mmapstr == NULL) {
-      res = MAIL_ERROR_MEMORY;
-      goto close_db;
-    }
-    
     r = generic_cache_flags_write(maildb, mmapstr,
         key_value, flags);
-    
-    mmap_string_free(mmapstr);
-    
     if (r != MAIL_NO_ERROR) {
       res = MAIL_ERROR_FILE;
-      goto close_db;
+      goto free_mmapstr;
     }
   }
   
+  /* add to the list of messages */
+  
+  r = db_counters_read(maildb, mmapstr, &counters);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_mmapstr;
+  }
+  
+  r = db_counters_begin(maildb);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_mmapstr;
+  }
+  
+  r = db_add_message_key(maildb, num);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_mmapstr;
+  }
+  
+  counters.cnt_messages ++;
+  if (flags != NULL)
+    db_counters_add_flags(&counters, flags, 1);
+  
+  r = db_counters_write(maildb, mmapstr, &counters);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_mmapstr;
+  }
+  
+  mmap_string_free(mmapstr);
+  
   mail_cache_db_close_unlock(data->db_filename, maildb);
   
   return MAIL_NO_ERROR;
   
- free_msglist:
-  for(i = 0 ; i < carray_count(msglist) ; i ++) {
-    msg = carray_get(msglist, i);
-    free(msg);
-  }
-  carray_free(msglist);
+ free_mmapstr:
+  mmap_string_free(mmapstr);
  close_db:
   mail_cache_db_close_unlock(data->db_filename, maildb);
  err:
@@ -852,9 +1104,9 @@ static int get_messages_list(mailsession * session,
   
   data = get_data(session);
   
-  r = mail_cache_db_open_lock(data->db_filename, &maildb);
-  if (r < 0) {
-    res = MAIL_ERROR_FILE;
+  r = db_open_lock(data, &maildb);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
     goto err;
   }
   
@@ -960,9 +1212,9 @@ static int get_envelopes_list(mailsession * session,
   
   flags_store_process(session);
   
-  r = mail_cache_db_open_lock(data->db_filename, &maildb);
-  if (r < 0) {
-    res = MAIL_ERROR_FILE;
+  r = db_open_lock(data, &maildb);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
     goto err;
   }
   
@@ -1007,9 +1259,7 @@ static int get_envelopes_list(mailsession * session,
 
 static int check_folder(mailsession * session)
 {
-  flags_store_process(session);
-  
-  return MAIL_NO_ERROR;
+  return flags_store_process(session);
 }
 
 static int get_message(mailsession * session,
@@ -1025,9 +1275,9 @@ static int get_message(mailsession * session,
   
   data = get_data(session);
   
-  r = mail_cache_db_open_lock(data->db_filename, &maildb);
-  if (r < 0) {
-    res = MAIL_ERROR_FILE;
+  r = db_open_lock(data, &maildb);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
     goto err;
   }
   
@@ -60,7 +60,9 @@ static mailstorage_driver db_mailstorage_driver = {
   /* sto_name               */ "db",
   /* sto_connect            */ db_mailstorage_connect,
   /* sto_get_folder_session */ db_mailstorage_get_folder_session,
-  /* sto_uninitialize       */ db_mailstorage_uninitialize
+  /* sto_uninitialize       */ db_mailstorage_uninitialize,
+  /* sto_new_session        */ NULL,
+  /* sto_get_server_key     */ NULL
 };
 
 LIBETPAN_EXPORT
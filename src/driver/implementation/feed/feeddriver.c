@@ -127,6 +127,8 @@ static mailsession_driver local_feed_session_driver = {
   /* sess_remove_message */ NULL,
 
   /* sess_login_sasl */ NULL,
+
+  /* sess_build_thread */ NULL,
 };
 
 
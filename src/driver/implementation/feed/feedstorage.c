@@ -62,6 +62,8 @@ static mailstorage_driver feed_mailstorage_driver = {
   /* sto_connect            */ feed_mailstorage_connect,
   /* sto_get_folder_session */ feed_mailstorage_get_folder_session,
   /* sto_uninitialize       */ feed_mailstorage_uninitialize,
+  /* sto_new_session        */ NULL,
+  /* sto_get_server_key     */ NULL
 };
 
 int feed_mailstorage_init(struct mailstorage * storage,
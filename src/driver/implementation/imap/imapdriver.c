@@ -141,6 +141,10 @@ static int imapdriver_login_sasl(mailsession * session,
 
 static int imapdriver_remove_message(mailsession * session, uint32_t num);
 
+static int imapdriver_build_thread(mailsession * session, int type,
+    struct mailmessage_list * env_list,
+    struct mailmessage_tree ** result);
+
 static int imapdriver_parameters(mailsession * session,
     int id, void * value);
 
@@ -188,7 +192,9 @@ static mailsession_driver local_imap_session_driver = {
   /* sess_get_envelopes_list */ imapdriver_get_envelopes_list,
   /* sess_remove_message */ imapdriver_remove_message,
 
-  /* sess_login_sasl */ imapdriver_login_sasl
+  /* sess_login_sasl */ imapdriver_login_sasl,
+
+  /* sess_build_thread */ imapdriver_build_thread
 };
 
 mailsession_driver * imap_session_driver = &local_imap_session_driver;
@@ -208,6 +214,7 @@ static int imapdriver_initialize(mailsession * session)
   struct imap_session_state_data * data;
   mailimap * imap;
   struct mail_flags_store * flags_store;
+  struct mail_keyword_table * keywords;
 
   imap = mailimap_new(0, NULL);
   if (imap == NULL)
@@ -217,18 +224,25 @@ static int imapdriver_initialize(mailsession * session)
   if (flags_store == NULL)
     goto free_session;
 
+  keywords = mail_keyword_table_new();
+  if (keywords == NULL)
+    goto free_flags_store;
+
   data = malloc(sizeof(* data));
   if (data == NULL)
-    goto free_flags_store;
+    goto free_keywords;
 
   data->imap_mailbox = NULL;
   data->imap_session = imap;
   data->imap_flags_store = flags_store;
+  data->imap_keywords = keywords;
 
   session->sess_data = data;
 
   return MAIL_NO_ERROR;
 
+ free_keywords:
+  mail_keyword_table_free(keywords);
  free_flags_store:
   mail_flags_store_free(flags_store);
  free_session:
@@ -237,30 +251,49 @@ static int imapdriver_initialize(mailsession * session)
   return MAIL_ERROR_MEMORY;
 }
 
+/*
+  consecutive messages with the same flags are stored with a single
+  command, the flags are compared in their compact form.
+  This is the only use of the compact form in the driver: the flags
+  fetched from the server are still converted with imap_flags_to_flags()
+  to a mail_flags for each message, since msg_flags is read by the
+  callers.
+*/
+
 static void imap_flags_store_process(mailimap * imap,
-				     struct mail_flags_store * flags_store)
+				     struct mail_flags_store * flags_store,
+				     struct mail_keyword_table * keywords)
 {
   unsigned int i;
   int r;
   mailmessage * first;
   mailmessage * last;
+  struct mail_flags_compact first_flags;
+  struct mail_flags_compact msg_flags;
+  int first_valid;
 
   mail_flags_store_sort(flags_store);
 
   if (carray_count(flags_store->fls_tab) == 0)
     return;
   
+  mail_flags_compact_init(&first_flags);
+  mail_flags_compact_init(&msg_flags);
+
   first = carray_get(flags_store->fls_tab, 0);
   last = first;
+  r = mail_flags_compact_from_flags(keywords, first->msg_flags, &first_flags);
+  first_valid = (r == MAIL_NO_ERROR);
 
   for(i = 1 ; i < carray_count(flags_store->fls_tab) ; i ++) {
     mailmessage * msg;
 
     msg = carray_get(flags_store->fls_tab, i);
 
-    if (last->msg_index + 1 == msg->msg_index) {
-      r = mail_flags_compare(first->msg_flags, msg->msg_flags);
-      if (r == 0) {
+    if (first_valid && (last->msg_index + 1 == msg->msg_index)) {
+      r = mail_flags_compact_from_flags(keywords, msg->msg_flags, &msg_flags);
+      if ((r == MAIL_NO_ERROR) &&
+          (mail_flags_compact_compare(&first_flags, &msg_flags) == 0)) {
 	last = msg;
 	continue;
       }
@@ -271,11 +304,15 @@ static void imap_flags_store_process(mailimap * imap,
 
     first = msg;
     last = msg;
+    r = mail_flags_compact_from_flags(keywords, first->msg_flags, &first_flags);
+    first_valid = (r == MAIL_NO_ERROR);
   }
 
   r = imap_store_flags(imap, first->msg_index, last->msg_index,
       first->msg_flags);
   
+  mail_flags_compact_clear(&msg_flags);
+  mail_flags_compact_clear(&first_flags);
   mail_flags_store_clear(flags_store);
 }
 
@@ -286,8 +323,9 @@ static void imapdriver_uninitialize(mailsession * session)
   data = get_data(session);
 
   imap_flags_store_process(data->imap_session,
-      data->imap_flags_store);
+      data->imap_flags_store, data->imap_keywords);
   mail_flags_store_free(data->imap_flags_store); 
+  mail_keyword_table_free(data->imap_keywords);
   
   mailimap_free(data->imap_session);
   if (data->imap_mailbox != NULL)
@@ -321,7 +359,8 @@ static int imapdriver_logout(mailsession * session)
   int r;
 
   imap_flags_store_process(get_imap_session(session),
-			   get_data(session)->imap_flags_store);
+			   get_data(session)->imap_flags_store,
+			   get_data(session)->imap_keywords);
 
   r = mailimap_logout(get_imap_session(session));
 
@@ -407,7 +446,8 @@ static int imapdriver_check_folder(mailsession * session)
   int r;
 
   imap_flags_store_process(get_imap_session(session),
-			   get_data(session)->imap_flags_store);
+			   get_data(session)->imap_flags_store,
+			   get_data(session)->imap_keywords);
 
   r = mailimap_check(get_imap_session(session));
 
@@ -435,7 +475,8 @@ static int imapdriver_select_folder(mailsession * session, const char * mb)
       return MAIL_NO_ERROR;
 
   imap_flags_store_process(get_imap_session(session),
-			   get_data(session)->imap_flags_store);
+			   get_data(session)->imap_flags_store,
+			   get_data(session)->imap_keywords);
 
   r = mailimap_select(get_imap_session(session), mb);
 
@@ -464,7 +505,8 @@ static int imapdriver_expunge_folder(mailsession * session)
   int r;
 
   imap_flags_store_process(get_imap_session(session),
-			   get_data(session)->imap_flags_store);
+			   get_data(session)->imap_flags_store,
+			   get_data(session)->imap_keywords);
 
   r = mailimap_expunge(get_imap_session(session));
 
@@ -876,7 +918,8 @@ imapdriver_get_envelopes_list(mailsession * session,
   }
 
   imap_flags_store_process(get_imap_session(session),
-			   get_data(session)->imap_flags_store);
+			   get_data(session)->imap_flags_store,
+			   get_data(session)->imap_keywords);
 
   exists = get_imap_session(session)->imap_selection_info->sel_exists;
 
@@ -1273,6 +1316,16 @@ err:
 	return res;
 }
 
+static int imapdriver_build_thread(mailsession * session, int type,
+    struct mailmessage_list * env_list,
+    struct mailmessage_tree ** result)
+{
+  if (get_imap_session(session)->imap_selection_info == NULL)
+    return MAIL_ERROR_BAD_STATE;
+
+  return imap_build_thread(get_imap_session(session), type, env_list, result);
+}
+
 static int imapdriver_parameters(mailsession * session,
     int id, void * value)
 {
@@ -149,6 +149,10 @@ static int imapdriver_cached_login_sasl(mailsession * session,
     const char * login, const char * auth_name,
     const char * password, const char * realm);
 
+static int imapdriver_cached_build_thread(mailsession * session, int type,
+    struct mailmessage_list * env_list,
+    struct mailmessage_tree ** result);
+
 static mailsession_driver local_imap_cached_session_driver = {
   /* sess_name */ "imap-cached",
 
@@ -195,7 +199,9 @@ static mailsession_driver local_imap_cached_session_driver = {
 #if 0
   /* sess_search_messages */ imapdriver_cached_search_messages,
 #endif
-  /* sess_cached_login_sasl */ imapdriver_cached_login_sasl
+  /* sess_cached_login_sasl */ imapdriver_cached_login_sasl,
+
+  /* sess_build_thread */ imapdriver_cached_build_thread
 };
 
 mailsession_driver * imap_cached_session_driver =
@@ -1545,3 +1551,11 @@ static int imapdriver_cached_login_sasl(mailsession * session,
       login, auth_name,
       password, realm);
 }
+
+static int imapdriver_cached_build_thread(mailsession * session, int type,
+    struct mailmessage_list * env_list,
+    struct mailmessage_tree ** result)
+{
+  return mailsession_build_thread(get_ancestor(session), type,
+      env_list, result);
+}
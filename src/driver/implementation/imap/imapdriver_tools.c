@@ -51,6 +51,8 @@
 #include "generic_cache.h"
 #include "mailmessage.h"
 #include "mail_cache_db.h"
+#include "cohash.h"
+#include "mailthread_types.h"
 
 
 
@@ -2518,10 +2520,11 @@ imap_fetch_result_to_envelop_list(clist * fetch_result,
   clistiter * cur;
   int r;
   unsigned int i;
-  chash * msg_hash;
+  cohash * msg_hash;
   int res;
   
-  msg_hash = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
+  /* sized for all the messages, the keys are stored inline */
+  msg_hash = cohash_new(carray_count(env_list->msg_tab), CHASH_COPYKEY);
   if (msg_hash == NULL) {
     res = MAIL_ERROR_MEMORY;
     goto err;
@@ -2537,7 +2540,7 @@ imap_fetch_result_to_envelop_list(clist * fetch_result,
     key.len = sizeof(msg->msg_index);
     value.data = msg;
     value.len = 0;
-    r = chash_set(msg_hash, &key, &value, NULL);
+    r = cohash_set(msg_hash, &key, &value, NULL);
     if (r < 0) {
       res = MAIL_ERROR_MEMORY;
       goto free_hash;
@@ -2567,7 +2570,7 @@ imap_fetch_result_to_envelop_list(clist * fetch_result,
         
         key.data = &uid;
         key.len = sizeof(uid);
-        r = chash_get(msg_hash, &key, &value);
+        r = cohash_get(msg_hash, &key, &value);
         if (r == 0) {
 	  mailmessage * msg;
           
@@ -2594,12 +2597,196 @@ imap_fetch_result_to_envelop_list(clist * fetch_result,
     }
   }
   
-  chash_free(msg_hash);
+  cohash_free(msg_hash);
   
   return MAIL_NO_ERROR;
   
  free_hash:
-  chash_free(msg_hash);
+  cohash_free(msg_hash);
+ err:
+  return res;
+}
+
+static int imap_thread_node_to_tree(struct mailimap_thread_node * node,
+    cohash * msg_hash, struct mailmessage_tree ** result)
+{
+  mailmessage * msg;
+  struct mailmessage_tree * tree;
+  struct mailmessage_tree * child_tree;
+  clistiter * cur;
+  int r;
+  int res;
+
+  msg = NULL;
+  if (node->thr_number != 0) {
+    chashdatum key;
+    chashdatum value;
+
+    key.data = &node->thr_number;
+    key.len = sizeof(node->thr_number);
+    r = cohash_get(msg_hash, &key, &value);
+    if (r == 0)
+      msg = value.data;
+  }
+
+  tree = mailmessage_tree_new(NULL, (time_t) -1, msg);
+  if (tree == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+
+  for(cur = clist_begin(node->thr_children) ; cur != NULL ;
+      cur = clist_next(cur)) {
+    r = imap_thread_node_to_tree(clist_content(cur), msg_hash, &child_tree);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+    if (child_tree == NULL)
+      continue;
+
+    r = carray_add(tree->node_children, child_tree, NULL);
+    if (r < 0) {
+      mailmessage_tree_free_recursive(child_tree);
+      res = MAIL_ERROR_MEMORY;
+      goto free;
+    }
+    child_tree->node_parent = tree;
+  }
+
+  /*
+    a message that is missing or not in the list is only kept
+    when it joins several replies
+  */
+  if ((msg == NULL) && (carray_count(tree->node_children) <= 1)) {
+    child_tree = NULL;
+    if (carray_count(tree->node_children) == 1) {
+      child_tree = carray_get(tree->node_children, 0);
+      child_tree->node_parent = NULL;
+    }
+    mailmessage_tree_free(tree);
+    tree = child_tree;
+  }
+
+  * result = tree;
+
+  return MAIL_NO_ERROR;
+
+ free:
+  mailmessage_tree_free_recursive(tree);
+ err:
+  return res;
+}
+
+int imap_build_thread(mailimap * imap, int type,
+    struct mailmessage_list * env_list,
+    struct mailmessage_tree ** result)
+{
+  int algorithm;
+  clist * thread_result;
+  clistiter * cur;
+  cohash * msg_hash;
+  struct mailmessage_tree * root;
+  struct mailmessage_tree * tree;
+  unsigned int i;
+  int r;
+  int res;
+
+  switch (type) {
+  case MAIL_THREAD_REFERENCES:
+    algorithm = MAILIMAP_THREAD_REFERENCES;
+    break;
+  case MAIL_THREAD_ORDEREDSUBJECT:
+    algorithm = MAILIMAP_THREAD_ORDEREDSUBJECT;
+    break;
+  default:
+    return MAIL_ERROR_NOT_IMPLEMENTED;
+  }
+
+  if ((imap->imap_connection_info == NULL) ||
+      (imap->imap_connection_info->imap_capability == NULL)) {
+    struct mailimap_capability_data * cap_data;
+
+    r = mailimap_capability(imap, &cap_data);
+    if (r != MAILIMAP_NO_ERROR)
+      return imap_error_to_mail_error(r);
+    mailimap_capability_data_free(cap_data);
+  }
+
+  if (!mailimap_has_thread(imap, algorithm))
+    return MAIL_ERROR_NOT_IMPLEMENTED;
+
+  r = mailimap_uid_thread(imap, algorithm, NULL, NULL, &thread_result);
+  if (r == MAILIMAP_ERROR_EXTENSION) {
+    /* the server answered NO or BAD, the threads are built locally */
+    res = MAIL_ERROR_NOT_IMPLEMENTED;
+    goto err;
+  }
+  if (r != MAILIMAP_NO_ERROR) {
+    res = imap_error_to_mail_error(r);
+    goto err;
+  }
+
+  msg_hash = cohash_new(carray_count(env_list->msg_tab), CHASH_COPYKEY);
+  if (msg_hash == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_thread;
+  }
+
+  for(i = 0 ; i < carray_count(env_list->msg_tab) ; i ++) {
+    chashdatum key;
+    chashdatum value;
+    mailmessage * msg;
+
+    msg = carray_get(env_list->msg_tab, i);
+    key.data = &msg->msg_index;
+    key.len = sizeof(msg->msg_index);
+    value.data = msg;
+    value.len = 0;
+    r = cohash_set(msg_hash, &key, &value, NULL);
+    if (r < 0) {
+      res = MAIL_ERROR_MEMORY;
+      goto free_hash;
+    }
+  }
+
+  root = mailmessage_tree_new(NULL, (time_t) -1, NULL);
+  if (root == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_hash;
+  }
+
+  for(cur = clist_begin(thread_result) ; cur != NULL ; cur = clist_next(cur)) {
+    r = imap_thread_node_to_tree(clist_content(cur), msg_hash, &tree);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto free_root;
+    }
+    if (tree == NULL)
+      continue;
+
+    r = carray_add(root->node_children, tree, NULL);
+    if (r < 0) {
+      mailmessage_tree_free_recursive(tree);
+      res = MAIL_ERROR_MEMORY;
+      goto free_root;
+    }
+    tree->node_parent = root;
+  }
+
+  cohash_free(msg_hash);
+  mailimap_thread_result_free(thread_result);
+
+  * result = root;
+
+  return MAIL_NO_ERROR;
+
+ free_root:
+  mailmessage_tree_free_recursive(root);
+ free_hash:
+  cohash_free(msg_hash);
+ free_thread:
+  mailimap_thread_result_free(thread_result);
  err:
   return res;
 }
@@ -3230,6 +3417,94 @@ int imap_flags_to_flags(struct mailimap_msg_att_dynamic * att_dyn,
   return MAIL_ERROR_MEMORY;
 }
 
+static int compact_add_keyword(struct mail_keyword_table * table,
+    struct mail_flags_compact * flags, const char * keyword)
+{
+  uint32_t indx;
+  int r;
+
+  r = mail_keyword_table_intern(table, keyword, strlen(keyword), &indx);
+  if (r != MAIL_NO_ERROR)
+    return r;
+
+  return mail_flags_compact_add_keyword(flags, indx);
+}
+
+int imap_flags_to_compact_flags(struct mail_keyword_table * table,
+    struct mailimap_msg_att_dynamic * att_dyn,
+    struct mail_flags_compact * result)
+{
+  struct mail_flags_compact flags;
+  clistiter * cur;
+  int res;
+  int r;
+
+  mail_flags_compact_init(&flags);
+
+  if (att_dyn->att_list != NULL) {
+    for(cur = clist_begin(att_dyn->att_list) ; cur != NULL ;
+        cur = clist_next(cur)) {
+      struct mailimap_flag_fetch * flag_fetch;
+
+      flag_fetch = clist_content(cur);
+      if (flag_fetch->fl_type == MAILIMAP_FLAG_FETCH_RECENT) {
+        flags.fc_flags |= MAIL_FLAG_NEW;
+        continue;
+      }
+
+      switch (flag_fetch->fl_flag->fl_type) {
+      case MAILIMAP_FLAG_ANSWERED:
+        flags.fc_flags |= MAIL_FLAG_ANSWERED;
+        break;
+      case MAILIMAP_FLAG_FLAGGED:
+        flags.fc_flags |= MAIL_FLAG_FLAGGED;
+        break;
+      case MAILIMAP_FLAG_DELETED:
+        flags.fc_flags |= MAIL_FLAG_DELETED;
+        break;
+      case MAILIMAP_FLAG_SEEN:
+        flags.fc_flags |= MAIL_FLAG_SEEN;
+        break;
+      case MAILIMAP_FLAG_DRAFT:
+        r = compact_add_keyword(table, &flags, "Draft");
+        if (r != MAIL_NO_ERROR) {
+          res = r;
+          goto free;
+        }
+        break;
+      case MAILIMAP_FLAG_KEYWORD:
+        if (strcasecmp(flag_fetch->fl_flag->fl_data.fl_keyword,
+                "$Forwarded") == 0) {
+          flags.fc_flags |= MAIL_FLAG_FORWARDED;
+          break;
+        }
+        r = compact_add_keyword(table, &flags,
+            flag_fetch->fl_flag->fl_data.fl_keyword);
+        if (r != MAIL_NO_ERROR) {
+          res = r;
+          goto free;
+        }
+        break;
+      case MAILIMAP_FLAG_EXTENSION:
+        /* do nothing */
+        break;
+      }
+    }
+    /* see imap_flags_to_flags() */
+    if ((flags.fc_flags & MAIL_FLAG_SEEN) && (flags.fc_flags & MAIL_FLAG_NEW))
+      flags.fc_flags &= ~MAIL_FLAG_NEW;
+  }
+
+  mail_flags_compact_clear(result);
+  * result = flags;
+
+  return MAIL_NO_ERROR;
+
+ free:
+  mail_flags_compact_clear(&flags);
+  return res;
+}
+
 int imap_flags_to_imap_flags(struct mail_flags * flags,
     struct mailimap_flag_list ** result)
 {
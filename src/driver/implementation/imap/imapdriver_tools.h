@@ -69,6 +69,17 @@ int
 imap_fetch_result_to_envelop_list(clist * fetch_result,
     struct mailmessage_list * env_list);
 
+/*
+  imap_build_thread() builds the threads of the messages of env_list
+  with the THREAD command, the envelopes are not fetched.
+  MAIL_ERROR_NOT_IMPLEMENTED is returned when the server does not
+  implement the threading algorithm.
+*/
+
+int imap_build_thread(mailimap * imap, int type,
+    struct mailmessage_list * env_list,
+    struct mailmessage_tree ** result);
+
 int imap_body_to_body(struct mailimap_body * imap_body,
     struct mailmime ** result);
 
@@ -81,6 +92,16 @@ int imap_flags_to_imap_flags(struct mail_flags * flags,
 int imap_flags_to_flags(struct mailimap_msg_att_dynamic * att_dyn,
     struct mail_flags ** result);
 
+/*
+  imap_flags_to_compact_flags() is imap_flags_to_flags() for the
+  compact form, the keywords are interned in the given table.
+  (* result) must be initialized with mail_flags_compact_init().
+*/
+
+int imap_flags_to_compact_flags(struct mail_keyword_table * table,
+    struct mailimap_msg_att_dynamic * att_dyn,
+    struct mail_flags_compact * result);
+
 #ifdef __cplusplus
 }
 #endif
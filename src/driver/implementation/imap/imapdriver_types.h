@@ -41,6 +41,7 @@
 
 #include <libetpan/mailimap.h>
 #include <libetpan/maildriver_types.h>
+#include <libetpan/maildriver_keywords.h>
 #include <libetpan/generic_cache_types.h>
 #include <libetpan/mailstorage_types.h>
 
@@ -56,6 +57,7 @@ struct imap_session_state_data {
   struct mail_flags_store * imap_flags_store;
   void (* imap_ssl_callback)(struct mailstream_ssl_context * ssl_context, void * data);
   void * imap_ssl_cb_data;
+  struct mail_keyword_table * imap_keywords;
 };
 
 enum {
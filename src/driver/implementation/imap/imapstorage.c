@@ -40,6 +40,7 @@
 #include "imapstorage.h"
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "mail.h"
@@ -58,12 +59,18 @@ static int
 imap_mailstorage_get_folder_session(struct mailstorage * storage,
     char * pathname, mailsession ** result);
 static void imap_mailstorage_uninitialize(struct mailstorage * storage);
+static int imap_mailstorage_new_session(struct mailstorage * storage,
+    mailsession ** result);
+static int imap_mailstorage_get_server_key(struct mailstorage * storage,
+    char * key, size_t size);
 
 static mailstorage_driver imap_mailstorage_driver = {
   /* sto_name               */ "imap",
   /* sto_connect            */ imap_mailstorage_connect,
   /* sto_get_folder_session */ imap_mailstorage_get_folder_session,
-  /* sto_uninitialize       */ imap_mailstorage_uninitialize
+  /* sto_uninitialize       */ imap_mailstorage_uninitialize,
+  /* sto_new_session        */ imap_mailstorage_new_session,
+  /* sto_get_server_key     */ imap_mailstorage_get_server_key
 };
 
 LIBETPAN_EXPORT
@@ -475,3 +482,25 @@ imap_mailstorage_get_folder_session(struct mailstorage * storage,
  err:
   return res;
 }
+
+static int imap_mailstorage_new_session(struct mailstorage * storage,
+    mailsession ** result)
+{
+  return imap_connect(storage, result);
+}
+
+static int imap_mailstorage_get_server_key(struct mailstorage * storage,
+    char * key, size_t size)
+{
+  struct imap_mailstorage * imap_storage;
+  
+  imap_storage = storage->sto_data;
+  
+  if (imap_storage->imap_servername == NULL)
+    return MAIL_ERROR_INVAL;
+  
+  snprintf(key, size, "%s:%u", imap_storage->imap_servername,
+      (unsigned int) imap_storage->imap_port);
+  
+  return MAIL_NO_ERROR;
+}
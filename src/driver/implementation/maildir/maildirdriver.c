@@ -71,6 +71,9 @@ static int initialize(mailsession * session);
 
 static void uninitialize(mailsession * session);
 
+static int parameters(mailsession * session,
+    int id, void * value);
+
 static int connect_path(mailsession * session, const char * path);
 
 static int logout(mailsession * session);
@@ -113,7 +116,7 @@ static mailsession_driver local_maildir_session_driver = {
   /* sess_initialize */ initialize,
   /* sess_uninitialize */ uninitialize,
 
-  /* sess_parameters */ NULL,
+  /* sess_parameters */ parameters,
 
   /* sess_connect_stream */ NULL,
   /* sess_connect_path */ connect_path,
@@ -153,7 +156,9 @@ static mailsession_driver local_maildir_session_driver = {
 #if 0
   /* sess_search_messages */ maildriver_generic_search_messages,
 #endif
-  /* sess_login_sasl */ NULL
+  /* sess_login_sasl */ NULL,
+
+  /* sess_build_thread */ NULL
 };
 
 mailsession_driver * maildir_session_driver = &local_maildir_session_driver;
@@ -182,6 +187,8 @@ static int initialize(mailsession * session)
     goto err;
 
   data->md_session = NULL;
+  data->md_incremental = 0;
+  data->md_watch = 0;
   
   data->md_flags_store = mail_flags_store_new();
   if (data->md_flags_store == NULL)
@@ -216,6 +223,55 @@ static void uninitialize(mailsession * session)
 }
 
 
+static int apply_parameters(struct maildir_session_state_data * data,
+    struct maildir * md)
+{
+  int r;
+
+  maildir_set_incremental_update(md, data->md_incremental);
+  if (data->md_watch) {
+    r = maildir_watch_start(md);
+    if (r != MAILDIR_NO_ERROR) {
+      /* the directories will be scanned */
+      data->md_watch = 0;
+      return maildirdriver_maildir_error_to_mail_error(r);
+    }
+  }
+  else {
+    maildir_watch_stop(md);
+  }
+
+  return MAIL_NO_ERROR;
+}
+
+static int parameters(mailsession * session,
+    int id, void * value)
+{
+  struct maildir_session_state_data * data;
+  int * param;
+
+  data = get_data(session);
+  param = value;
+
+  switch (id) {
+  case MAILDIRDRIVER_SET_INCREMENTAL_UPDATE:
+    data->md_incremental = * param;
+    break;
+
+  case MAILDIRDRIVER_SET_WATCH:
+    data->md_watch = * param;
+    break;
+
+  default:
+    return MAIL_ERROR_INVAL;
+  }
+
+  if (data->md_session != NULL)
+    return apply_parameters(data, data->md_session);
+
+  return MAIL_NO_ERROR;
+}
+
 static int connect_path(mailsession * session, const char * path)
 {
   struct maildir * md;
@@ -233,6 +289,9 @@ static int connect_path(mailsession * session, const char * path)
     goto err;
   }
   
+  /* when the maildir can't be watched, the directories are scanned */
+  apply_parameters(get_data(session), md);
+  
   r = maildir_update(md);
   if (r != MAILDIR_NO_ERROR) {
     res = maildirdriver_maildir_error_to_mail_error(r);
@@ -155,7 +155,9 @@ static mailsession_driver local_maildir_cached_session_driver = {
 #if 0
   /* sess_search_messages */ maildriver_generic_search_messages,
 #endif
-  /* sess_login_sasl */ NULL
+  /* sess_login_sasl */ NULL,
+
+  /* sess_build_thread */ NULL
 };
 
 mailsession_driver * maildir_cached_session_driver =
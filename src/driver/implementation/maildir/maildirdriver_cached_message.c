@@ -71,6 +71,10 @@ static int prefetch(mailmessage * msg_info);
 
 static void prefetch_free(struct generic_message_t * msg);
 
+static int prefetch_header(mailmessage * msg_info);
+
+static void prefetch_header_free(struct generic_message_t * msg);
+
 static int initialize(mailmessage * msg_info);
 
 static void check(mailmessage * msg_info);
@@ -238,6 +242,50 @@ static void prefetch_free(struct generic_message_t * msg)
   }
 }
 
+/*
+  the file is mapped and closed right away, only the pages holding
+  the header will be read while it is parsed.
+*/
+
+static int prefetch_header(mailmessage * msg_info)
+{
+  struct generic_message_t * msg;
+  char * filename;
+  int fd;
+  char * mapping;
+  struct maildir * md;
+  
+  md = get_maildir_session(msg_info);
+  
+  if (msg_info->msg_uid == NULL)
+    return MAIL_ERROR_INVAL;
+  
+  filename = maildir_message_get(md, msg_info->msg_uid);
+  if (filename == NULL)
+    return MAIL_ERROR_MEMORY;
+  
+  fd = Open(filename, O_RDONLY);
+  free(filename);
+  if (fd == -1)
+    return MAIL_ERROR_FILE;
+  
+  mapping = mmap(NULL, msg_info->msg_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  Close(fd);
+  if (mapping == (char *)MAP_FAILED)
+    return MAIL_ERROR_FILE;
+  
+  msg = msg_info->msg_data;
+  msg->msg_header = mapping;
+  msg->msg_header_length = msg_info->msg_size;
+  
+  return MAIL_NO_ERROR;
+}
+
+static void prefetch_header_free(struct generic_message_t * msg)
+{
+  munmap(msg->msg_header, msg->msg_header_length);
+}
+
 static int initialize(mailmessage * msg_info)
 {
   struct generic_message_t * msg;
@@ -250,6 +298,8 @@ static int initialize(mailmessage * msg_info)
   msg = msg_info->msg_data;
   msg->msg_prefetch = prefetch;
   msg->msg_prefetch_free = prefetch_free;
+  msg->msg_prefetch_header = prefetch_header;
+  msg->msg_prefetch_header_free = prefetch_header_free;
 
   return MAIL_NO_ERROR;
 }
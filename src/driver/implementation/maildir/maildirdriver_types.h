@@ -51,6 +51,18 @@ extern "C" {
 struct maildir_session_state_data {
   struct maildir * md_session;
   struct mail_flags_store * md_flags_store;
+  int md_incremental;
+  int md_watch;
+};
+
+/*
+  the cached driver gives unknown parameters to the maildir driver,
+  the identifiers must not collide.
+*/
+
+enum {
+  MAILDIRDRIVER_SET_INCREMENTAL_UPDATE = 16,
+  MAILDIRDRIVER_SET_WATCH
 };
 
 enum {
@@ -61,7 +61,9 @@ static mailstorage_driver maildir_mailstorage_driver = {
   /* sto_name               */ "maildir",
   /* sto_connect            */ maildir_mailstorage_connect,
   /* sto_get_folder_session */ maildir_mailstorage_get_folder_session,
-  /* sto_uninitialize       */ maildir_mailstorage_uninitialize
+  /* sto_uninitialize       */ maildir_mailstorage_uninitialize,
+  /* sto_new_session        */ NULL,
+  /* sto_get_server_key     */ NULL
 };
 
 LIBETPAN_EXPORT
@@ -153,7 +153,9 @@ static mailsession_driver local_mbox_session_driver = {
 #if 0
   /* sess_search_messages */ maildriver_generic_search_messages,
 #endif
-  /* sess_login_sasl */ NULL
+  /* sess_login_sasl */ NULL,
+
+  /* sess_build_thread */ NULL
 };
 
 mailsession_driver * mbox_session_driver = &local_mbox_session_driver;
@@ -180,6 +182,7 @@ static int mboxdriver_initialize(mailsession * session)
 
   data->mbox_force_read_only = FALSE;
   data->mbox_force_no_uid = TRUE;
+  data->mbox_index_filename = NULL;
 
   session->sess_data = data;
   
@@ -205,6 +208,7 @@ static void mboxdriver_uninitialize(mailsession * session)
 
   free_state(data);
 
+  free(data->mbox_index_filename);
   free(data);
 }
 
@@ -235,6 +239,22 @@ static int mboxdriver_parameters(mailsession * session,
       data->mbox_force_no_uid = * param;
       return MAIL_NO_ERROR;
     }
+
+  case MBOXDRIVER_SET_INDEX_FILENAME:
+    {
+      char * filename;
+
+      filename = NULL;
+      if (value != NULL) {
+        filename = strdup(value);
+        if (filename == NULL)
+          return MAIL_ERROR_MEMORY;
+      }
+
+      free(data->mbox_index_filename);
+      data->mbox_index_filename = filename;
+      return MAIL_NO_ERROR;
+    }
   }
 
   return MAIL_ERROR_INVAL;
@@ -252,11 +272,12 @@ static int mboxdriver_connect_path(mailsession * session, const char * path)
   if (mbox_data->mbox_folder != NULL)
     return MAIL_ERROR_BAD_STATE;
 
-  r = mailmbox_init(path,
-		    mbox_data->mbox_force_read_only,
-		    mbox_data->mbox_force_no_uid,
-		    0,
-		    &folder);
+  r = mailmbox_init_with_index(path,
+      mbox_data->mbox_index_filename,
+      mbox_data->mbox_force_read_only,
+      mbox_data->mbox_force_no_uid,
+      0,
+      &folder);
   
   if (r != MAILMBOX_NO_ERROR)
     return mboxdriver_mbox_error_to_mail_error(r);
@@ -389,6 +410,8 @@ mboxdriver_get_envelopes_list(mailsession * session,
 			      struct mailmessage_list * env_list)
 {
   struct mailmbox_folder * folder;
+  struct maildriver_envelope_parser * parser;
+  unsigned int thread_count;
   unsigned int i;
   int r;
   int res;
@@ -405,6 +428,15 @@ mboxdriver_get_envelopes_list(mailsession * session,
     goto err;
   }
 
+  /*
+    headers are pointers into the mapping of the mailbox, they stay
+    valid as long as the read lock is held.
+  */
+  parser = NULL;
+  thread_count = maildriver_get_envelope_parser_thread_count();
+  if (thread_count > 1)
+    parser = maildriver_envelope_parser_new(thread_count, 0);
+
   for(i = 0 ; i < carray_count(env_list->msg_tab) ; i ++) {
     mailmessage * msg;
     struct mailimf_fields * fields;
@@ -423,7 +455,12 @@ mboxdriver_get_envelopes_list(mailsession * session,
         msg->msg_index, &headers, &headers_len);
     if (r != MAILMBOX_NO_ERROR) {
       res = mboxdriver_mbox_error_to_mail_error(r);
-      goto unlock;
+      goto free_parser;
+    }
+
+    if (parser != NULL) {
+      maildriver_envelope_parser_add(parser, msg, headers, headers_len);
+      continue;
     }
 
     cur_token = 0;
@@ -436,11 +473,15 @@ mboxdriver_get_envelopes_list(mailsession * session,
     msg->msg_fields = fields;
   }
 
+  if (parser != NULL)
+    maildriver_envelope_parser_free(parser);
   mailmbox_read_unlock(folder);
 
   return MAIL_NO_ERROR;
 
- unlock:
+ free_parser:
+  if (parser != NULL)
+    maildriver_envelope_parser_free(parser);
   mailmbox_read_unlock(folder);
  err:
   return res;
@@ -165,7 +165,9 @@ static mailsession_driver local_mbox_cached_session_driver = {
 #if 0
   /* sess_search_messages */ maildriver_generic_search_messages,
 #endif
-  /* sess_login_sasl */ NULL
+  /* sess_login_sasl */ NULL,
+
+  /* sess_build_thread */ NULL
 };
 
 mailsession_driver * mbox_cached_session_driver =
@@ -636,11 +638,12 @@ static int mboxdriver_cached_connect_path(mailsession * session, const char * pa
 
   ancestor_data = get_ancestor_data(session);
 
-  r = mailmbox_init(path,
-		    ancestor_data->mbox_force_read_only,
-		    ancestor_data->mbox_force_no_uid,
-		    written_uid,
-		    &folder);
+  r = mailmbox_init_with_index(path,
+      ancestor_data->mbox_index_filename,
+      ancestor_data->mbox_force_read_only,
+      ancestor_data->mbox_force_no_uid,
+      written_uid,
+      &folder);
 
   if (r != MAILMBOX_NO_ERROR) {
     cached_data->mbox_quoted_mb = NULL;
@@ -63,6 +63,10 @@ static int mbox_prefetch(mailmessage * msg_info);
 
 static void mbox_prefetch_free(struct generic_message_t * msg);
 
+static int mbox_prefetch_header(mailmessage * msg_info);
+
+static void mbox_prefetch_header_free(struct generic_message_t * msg);
+
 static int mbox_initialize(mailmessage * msg_info);
 
 static void mbox_uninitialize(mailmessage * msg_info);
@@ -161,6 +165,49 @@ static void mbox_prefetch_free(struct generic_message_t * msg)
   }
 }
 
+/*
+  the header is used in place in the mapping of the mailbox, the
+  mailbox stays locked until the header is released.
+*/
+
+static int mbox_prefetch_header(mailmessage * msg_info)
+{
+  struct generic_message_t * msg;
+  struct mailmbox_folder * folder;
+  int r;
+  char * header;
+  size_t header_len;
+
+  folder = get_mbox_session(msg_info);
+  if (folder == NULL)
+    return MAIL_ERROR_BAD_STATE;
+
+  r = mailmbox_validate_read_lock(folder);
+  if (r != MAILMBOX_NO_ERROR)
+    return mboxdriver_mbox_error_to_mail_error(r);
+
+  r = mailmbox_fetch_msg_headers_no_lock(folder, msg_info->msg_index,
+      &header, &header_len);
+  if (r != MAILMBOX_NO_ERROR) {
+    mailmbox_read_unlock(folder);
+    return mboxdriver_mbox_error_to_mail_error(r);
+  }
+
+  msg = msg_info->msg_data;
+
+  msg->msg_header_data = folder;
+  msg->msg_header = header;
+  msg->msg_header_length = header_len;
+
+  return MAIL_NO_ERROR;
+}
+
+static void mbox_prefetch_header_free(struct generic_message_t * msg)
+{
+  mailmbox_read_unlock(msg->msg_header_data);
+  msg->msg_header_data = NULL;
+}
+
 static int mbox_initialize(mailmessage * msg_info)
 {
   struct generic_message_t * msg;
@@ -209,6 +256,8 @@ static int mbox_initialize(mailmessage * msg_info)
 
   msg->msg_prefetch = mbox_prefetch;
   msg->msg_prefetch_free = mbox_prefetch_free;
+  msg->msg_prefetch_header = mbox_prefetch_header;
+  msg->msg_prefetch_header_free = mbox_prefetch_header_free;
   msg_info->msg_uid = uid;
 
   return MAIL_NO_ERROR;
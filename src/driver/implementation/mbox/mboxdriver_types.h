@@ -49,13 +49,16 @@ extern "C" {
 
 enum {
   MBOXDRIVER_SET_READ_ONLY = 1,
-  MBOXDRIVER_SET_NO_UID
+  MBOXDRIVER_SET_NO_UID,
+  /* value is a (const char *), the filename of the index, NULL to disable */
+  MBOXDRIVER_SET_INDEX_FILENAME = 5
 };
 
 struct mbox_session_state_data {
   struct mailmbox_folder * mbox_folder;
   int mbox_force_read_only;
   int mbox_force_no_uid;
+  char * mbox_index_filename;
 };
 
 /* cached version */
@@ -66,7 +69,8 @@ enum {
   MBOXDRIVER_CACHED_SET_NO_UID,
   /* cache specific */
   MBOXDRIVER_CACHED_SET_CACHE_DIRECTORY,
-  MBOXDRIVER_CACHED_SET_FLAGS_DIRECTORY
+  MBOXDRIVER_CACHED_SET_FLAGS_DIRECTORY,
+  MBOXDRIVER_CACHED_SET_INDEX_FILENAME
 };
 
 struct mbox_cached_session_state_data {
@@ -60,7 +60,9 @@ static mailstorage_driver mbox_mailstorage_driver = {
   /* sto_name               */ "mbox",
   /* sto_connect            */ mbox_mailstorage_connect,
   /* sto_get_folder_session */ mbox_mailstorage_get_folder_session,
-  /* sto_uninitialize       */ mbox_mailstorage_uninitialize
+  /* sto_uninitialize       */ mbox_mailstorage_uninitialize,
+  /* sto_new_session        */ NULL,
+  /* sto_get_server_key     */ NULL
 };
 
 LIBETPAN_EXPORT
@@ -63,6 +63,10 @@ static int mh_prefetch(mailmessage * msg_info);
 
 static void mh_prefetch_free(struct generic_message_t * msg);
 
+static int mh_prefetch_header(mailmessage * msg_info);
+
+static void mh_prefetch_header_free(struct generic_message_t * msg);
+
 static int mh_initialize(mailmessage * msg_info);
 
 static int mh_fetch_size(mailmessage * msg_info,
@@ -166,6 +170,37 @@ static void mh_prefetch_free(struct generic_message_t * msg)
   }
 }
 
+static int mh_prefetch_header(mailmessage * msg_info)
+{
+  struct generic_message_t * msg;
+  int r;
+  char * mapping;
+  size_t size;
+  size_t begin;
+
+  r = mhdriver_map_message(get_ancestor_session(msg_info), msg_info->msg_index,
+      &mapping, &size, &begin);
+  if (r != MAIL_NO_ERROR)
+    return r;
+
+  msg = msg_info->msg_data;
+
+  msg->msg_header_data = mapping;
+  msg->msg_header = mapping + begin;
+  msg->msg_header_length = size - begin;
+
+  return MAIL_NO_ERROR;
+}
+
+static void mh_prefetch_header_free(struct generic_message_t * msg)
+{
+  char * mapping;
+
+  mapping = msg->msg_header_data;
+  munmap(mapping, msg->msg_header + msg->msg_header_length - mapping);
+  msg->msg_header_data = NULL;
+}
+
 static int mh_initialize(mailmessage * msg_info)
 {
   struct generic_message_t * msg;
@@ -202,6 +237,8 @@ static int mh_initialize(mailmessage * msg_info)
   msg = msg_info->msg_data;
   msg->msg_prefetch = mh_prefetch;
   msg->msg_prefetch_free = mh_prefetch_free;
+  msg->msg_prefetch_header = mh_prefetch_header;
+  msg->msg_prefetch_header_free = mh_prefetch_header_free;
   msg_info->msg_uid = uid;
 
   return MAIL_NO_ERROR;
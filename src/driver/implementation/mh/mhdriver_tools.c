@@ -130,14 +130,13 @@ cached_get_mh_cur_folder(mailsession * session)
   return get_mh_cur_folder(cached_get_ancestor(session));
 }
 
-int mhdriver_fetch_message(mailsession * session, uint32_t indx,
-			   char ** result, size_t * result_len)
+int mhdriver_map_message(mailsession * session, uint32_t indx,
+    char ** result, size_t * result_len, size_t * result_start)
 {
   size_t size;
   size_t cur_token;
   struct mailmh_folder * folder;
   int fd;
-  MMAPString * mmapstr;
   char * str;
   int res;
   int r;
@@ -156,7 +155,7 @@ int mhdriver_fetch_message(mailsession * session, uint32_t indx,
 
   default:
     res = mhdriver_mh_error_to_mail_error(r);
-    goto Close;
+    goto err;
   }
 
   r = mhdriver_fetch_size(session, indx, &size);
@@ -175,9 +174,10 @@ int mhdriver_fetch_message(mailsession * session, uint32_t indx,
     res = MAIL_ERROR_FETCH;
     goto Close;
   }
+  
+  Close(fd);
 
   /* strip "From " header for broken implementations */
-  /* XXX - called twice, make a function */
   cur_token = 0;
   if (size > 5) {
     if (strncmp("From ", str, 5) == 0) {
@@ -195,6 +195,34 @@ int mhdriver_fetch_message(mailsession * session, uint32_t indx,
     }
   }
   
+  * result = str;
+  * result_len = size;
+  * result_start = cur_token;
+
+  return MAIL_NO_ERROR;
+
+ Close:
+  Close(fd);
+ err:
+  return res;
+}
+
+int mhdriver_fetch_message(mailsession * session, uint32_t indx,
+			   char ** result, size_t * result_len)
+{
+  size_t size;
+  size_t cur_token;
+  MMAPString * mmapstr;
+  char * str;
+  int res;
+  int r;
+
+  r = mhdriver_map_message(session, indx, &str, &size, &cur_token);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto err;
+  }
+  
   mmapstr = mmap_string_new_len(str + cur_token, size - cur_token);
   if (mmapstr == NULL) {
     res = MAIL_ERROR_MEMORY;
@@ -207,7 +235,6 @@ int mhdriver_fetch_message(mailsession * session, uint32_t indx,
   }
 
   munmap(str, size);
-  Close(fd);
 
   * result = mmapstr->str;
   * result_len = mmapstr->len;
@@ -218,8 +245,6 @@ int mhdriver_fetch_message(mailsession * session, uint32_t indx,
   mmap_string_free(mmapstr);
  unmap:
   munmap(str, size);
- Close:
-  Close(fd);
  err:
   return res;
 }
@@ -231,64 +256,16 @@ int mhdriver_fetch_header(mailsession * session, uint32_t indx,
   size_t size;
   size_t cur_token;
   size_t begin;
-  struct mailmh_folder * folder;
-  int fd;
   MMAPString * mmapstr;
   char * str;
   int res;
   int r;
 
-  folder = get_mh_cur_folder(session);
-  if (folder == NULL) {
-    res = MAIL_ERROR_BAD_STATE;
+  r = mhdriver_map_message(session, indx, &str, &size, &cur_token);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
     goto err;
   }
-
-  r = mailmh_folder_get_message_fd(folder, indx, O_RDONLY, &fd);
-
-  switch (r) {
-  case MAILMH_NO_ERROR:
-    break;
-
-  default:
-    res = mhdriver_mh_error_to_mail_error(r);
-    goto Close;
-  }
-
-  r = mhdriver_fetch_size(session, indx, &size);
-
-  switch (r) {
-  case MAILMH_NO_ERROR:
-    break;
-
-  default:
-    res = mhdriver_mh_error_to_mail_error(r);
-    goto Close;
-  }
-
-  str = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
-  if (str == (char *)MAP_FAILED) {
-    res = MAIL_ERROR_FETCH;
-    goto Close;
-  }
-
-  /* strip "From " header for broken implementations */
-  cur_token = 0;
-  if (size > 5) {
-    if (strncmp("From ", str, 5) == 0) {
-      cur_token += 5;
-      
-      while (1) {
-        if (str[cur_token] == '\n') {
-          cur_token ++;
-          break;
-        }
-        if (cur_token >= size)
-          break;
-        cur_token ++;
-      }
-    }
-  }
     
   begin = cur_token;
 
@@ -314,7 +291,6 @@ int mhdriver_fetch_header(mailsession * session, uint32_t indx,
   }
 
   munmap(str, size);
-  Close(fd);
 
   * result = mmapstr->str;
   * result_len = mmapstr->len;
@@ -325,8 +301,6 @@ int mhdriver_fetch_header(mailsession * session, uint32_t indx,
   mmap_string_free(mmapstr);
  unmap:
   munmap(str, size);
- Close:
-  Close(fd);
  err:
   return res;
 }
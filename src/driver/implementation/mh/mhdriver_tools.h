@@ -47,6 +47,15 @@ extern "C" {
 
 int mhdriver_mh_error_to_mail_error(int error);
 
+/*
+  mhdriver_map_message() maps the file of the message, the header
+  begins at (* result_start), after a "From " line written by broken
+  implementations. The mapping is released with munmap().
+*/
+
+int mhdriver_map_message(mailsession * session, uint32_t indx,
+    char ** result, size_t * result_len, size_t * result_start);
+
 int mhdriver_fetch_message(mailsession * session, uint32_t indx,
 			   char ** result, size_t * result_len);
 
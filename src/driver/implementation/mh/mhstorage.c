@@ -57,7 +57,9 @@ static mailstorage_driver mh_mailstorage_driver = {
   /* sto_name               */ "mh",
   /* sto_connect            */ mh_mailstorage_connect,
   /* sto_get_folder_session */ mh_mailstorage_get_folder_session,
-  /* sto_uninitialize       */ mh_mailstorage_uninitialize
+  /* sto_uninitialize       */ mh_mailstorage_uninitialize,
+  /* sto_new_session        */ NULL,
+  /* sto_get_server_key     */ NULL
 };
 
 LIBETPAN_EXPORT
@@ -483,6 +483,31 @@ static int fetch_size(mailmessage * msg_info,
 }
 
 
+static int fetch_envelope(mailmessage * msg_info,
+    struct mailimf_fields ** result)
+{
+  char * header;
+  size_t length;
+  size_t cur_token;
+  struct mailimf_fields * fields;
+  int r;
+  
+  r = fetch_header(msg_info, &header, &length);
+  if (r != MAIL_NO_ERROR)
+    return r;
+  
+  cur_token = 0;
+  r = mailimf_envelope_fields_parse(header, length, &cur_token, &fields);
+  fetch_result_free(msg_info, header);
+  if (r != MAILIMF_NO_ERROR)
+    return maildriver_imf_error_to_mail_error(r);
+  
+  * result = fields;
+  
+  return MAIL_NO_ERROR;
+}
+
+
 static mailmessage_driver local_mime_message_driver = {
   /* msg_name */ "mime",
   
@@ -503,7 +528,7 @@ static mailmessage_driver local_mime_message_driver = {
   /* msg_fetch_section_header */ fetch_section_header,
   /* msg_fetch_section_mime */ fetch_section_mime,
   /* msg_fetch_section_body */ fetch_section_body,
-  /* msg_fetch_envelope */ mailmessage_generic_fetch_envelope,
+  /* msg_fetch_envelope */ fetch_envelope,
 
   /* msg_get_flags */ NULL
 };
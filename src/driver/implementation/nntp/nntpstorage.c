@@ -62,7 +62,9 @@ static mailstorage_driver nntp_mailstorage_driver = {
   /* sto_name               */ "nntp",
   /* sto_connect            */ nntp_mailstorage_connect,
   /* sto_get_folder_session */ nntp_mailstorage_get_folder_session,
-  /* sto_uninitialize       */ nntp_mailstorage_uninitialize
+  /* sto_uninitialize       */ nntp_mailstorage_uninitialize,
+  /* sto_new_session        */ NULL,
+  /* sto_get_server_key     */ NULL
 };
 
 LIBETPAN_EXPORT
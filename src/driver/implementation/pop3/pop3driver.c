@@ -135,7 +135,9 @@ static mailsession_driver local_pop3_session_driver = {
   /* sess_get_envelopes_list */ maildriver_generic_get_envelopes_list,
   /* sess_remove_message */ pop3driver_remove_message,
 
-  /* sess_login_sasl */ pop3driver_login_sasl
+  /* sess_login_sasl */ pop3driver_login_sasl,
+
+  /* sess_build_thread */ NULL
 };
 
 mailsession_driver * pop3_session_driver = &local_pop3_session_driver;
@@ -173,7 +173,9 @@ static mailsession_driver local_pop3_cached_session_driver = {
 #if 0
   /* sess_search_messages */ maildriver_generic_search_messages,
 #endif
-  /* sess_login_sasl */ pop3driver_cached_login_sasl
+  /* sess_login_sasl */ pop3driver_cached_login_sasl,
+
+  /* sess_build_thread */ NULL
 };
 
 mailsession_driver * pop3_cached_session_driver =
@@ -60,7 +60,9 @@ static mailstorage_driver pop3_mailstorage_driver = {
   /* sto_name               */ "pop3",
   /* sto_connect            */ pop3_mailstorage_connect,
   /* sto_get_folder_session */ pop3_mailstorage_get_folder_session,
-  /* sto_uninitialize       */ pop3_mailstorage_uninitialize
+  /* sto_uninitialize       */ pop3_mailstorage_uninitialize,
+  /* sto_new_session        */ NULL,
+  /* sto_get_server_key     */ NULL
 };
 
 LIBETPAN_EXPORT
@@ -439,3 +439,15 @@ int mailsession_login_sasl(mailsession * session, const char * auth_type,
       login, auth_name,
       password, realm);
 }
+
+LIBETPAN_EXPORT
+int mailsession_build_thread(mailsession * session, int type,
+    struct mailmessage_list * env_list,
+    struct mailmessage_tree ** result)
+{
+  if (session->sess_driver->sess_build_thread == NULL)
+    return MAIL_ERROR_NOT_IMPLEMENTED;
+
+  return session->sess_driver->sess_build_thread(session, type,
+      env_list, result);
+}
@@ -39,6 +39,7 @@
 
 #include <libetpan/maildriver_types.h>
 #include <libetpan/maildriver_types_helper.h>
+#include <libetpan/maildriver_keywords.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -600,6 +601,45 @@ int mailsession_login_sasl(mailsession * session, const char * auth_type,
     const char * login, const char * auth_name,
     const char * password, const char * realm);
 
+/*
+  mailsession_build_thread builds the threads of the messages of the
+  list on the server, without fetching the envelopes. The nodes of the
+  result refer to the messages of env_list and have no date nor
+  message-ID. mail_build_session_thread() falls back on local
+  threading when the server cannot do it.
+
+  @param type MAIL_THREAD_REFERENCES or MAIL_THREAD_ORDEREDSUBJECT
+  @param env_list the list of messages returned by
+    mailsession_get_messages_list()
+  @param result the tree will be stored in (* result), it has to be
+    freed with mailmessage_tree_free_recursive()
+
+  @return MAIL_NO_ERROR is returned on success, MAIL_ERROR_NOT_IMPLEMENTED
+    is returned if the threads have to be built locally (the server
+    does not support the algorithm or rejected the request),
+    MAIL_ERROR_XXX is returned on error
+*/
+
+LIBETPAN_EXPORT
+int mailsession_build_thread(mailsession * session, int type,
+    struct mailmessage_list * env_list,
+    struct mailmessage_tree ** result);
+
+/*
+  maildriver_set_envelope_parser_thread_count sets the number of threads
+  used to parse the headers of the messages when envelopes are fetched
+  from local mailboxes (maildir, MH, mbox).
+  
+  @param count number of threads, 0 or 1 will parse the headers on the
+    calling thread (the default)
+*/
+
+LIBETPAN_EXPORT
+void maildriver_set_envelope_parser_thread_count(unsigned int count);
+
+LIBETPAN_EXPORT
+unsigned int maildriver_get_envelope_parser_thread_count(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,468 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2005 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "maildriver_keywords.h"
+
+#include "maildriver_errors.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define KEYWORD_HASH_SIZE 64
+#define KEYWORD_MAX_STACK 256
+
+struct mail_keyword_table * mail_keyword_table_new(void)
+{
+  struct mail_keyword_table * table;
+
+  table = malloc(sizeof(* table));
+  if (table == NULL)
+    goto err;
+
+  table->kw_hash = chash_new(KEYWORD_HASH_SIZE, CHASH_COPYALL);
+  if (table->kw_hash == NULL)
+    goto free;
+
+  table->kw_tab = carray_new(16);
+  if (table->kw_tab == NULL)
+    goto free_hash;
+
+  return table;
+
+ free_hash:
+  chash_free(table->kw_hash);
+ free:
+  free(table);
+ err:
+  return NULL;
+}
+
+void mail_keyword_table_free(struct mail_keyword_table * table)
+{
+  unsigned int i;
+
+  for(i = 0 ; i < carray_count(table->kw_tab) ; i ++)
+    free(carray_get(table->kw_tab, i));
+  carray_free(table->kw_tab);
+  chash_free(table->kw_hash);
+  free(table);
+}
+
+/*
+  the hash key is the lower case keyword, it is built in the given
+  buffer when the keyword is short enough
+*/
+
+static char * keyword_key(const char * keyword, size_t length,
+    char * buffer)
+{
+  char * key;
+  size_t i;
+
+  if (length <= KEYWORD_MAX_STACK)
+    key = buffer;
+  else {
+    key = malloc(length);
+    if (key == NULL)
+      return NULL;
+  }
+
+  for(i = 0 ; i < length ; i ++) {
+    char ch;
+
+    ch = keyword[i];
+    if ((ch >= 'A') && (ch <= 'Z'))
+      ch = ch - 'A' + 'a';
+    key[i] = ch;
+  }
+
+  return key;
+}
+
+static void keyword_key_free(char * key, char * buffer)
+{
+  if (key != buffer)
+    free(key);
+}
+
+int mail_keyword_table_lookup(struct mail_keyword_table * table,
+    const char * keyword, size_t length, uint32_t * result)
+{
+  char buffer[KEYWORD_MAX_STACK];
+  chashdatum key;
+  chashdatum value;
+  int r;
+
+  key.data = keyword_key(keyword, length, buffer);
+  if (key.data == NULL)
+    return MAIL_ERROR_MEMORY;
+  key.len = (unsigned int) length;
+
+  r = chash_get(table->kw_hash, &key, &value);
+  keyword_key_free(key.data, buffer);
+  if (r < 0)
+    return MAIL_ERROR_INVAL;
+
+  memcpy(result, value.data, sizeof(* result));
+
+  return MAIL_NO_ERROR;
+}
+
+int mail_keyword_table_intern(struct mail_keyword_table * table,
+    const char * keyword, size_t length, uint32_t * result)
+{
+  char buffer[KEYWORD_MAX_STACK];
+  chashdatum key;
+  chashdatum value;
+  unsigned int indx;
+  uint32_t keyword_index;
+  char * str;
+  int res;
+  int r;
+
+  key.data = keyword_key(keyword, length, buffer);
+  if (key.data == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+  key.len = (unsigned int) length;
+
+  r = chash_get(table->kw_hash, &key, &value);
+  if (r == 0) {
+    memcpy(result, value.data, sizeof(* result));
+    keyword_key_free(key.data, buffer);
+    return MAIL_NO_ERROR;
+  }
+
+  str = malloc(length + 1);
+  if (str == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_key;
+  }
+  memcpy(str, keyword, length);
+  str[length] = '\0';
+
+  r = carray_add(table->kw_tab, str, &indx);
+  if (r < 0) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_str;
+  }
+
+  keyword_index = indx;
+  value.data = &keyword_index;
+  value.len = sizeof(keyword_index);
+  r = chash_set(table->kw_hash, &key, &value, NULL);
+  if (r < 0) {
+    res = MAIL_ERROR_MEMORY;
+    goto delete;
+  }
+
+  keyword_key_free(key.data, buffer);
+
+  * result = keyword_index;
+
+  return MAIL_NO_ERROR;
+
+ delete:
+  carray_delete_fast(table->kw_tab, indx);
+ free_str:
+  free(str);
+ free_key:
+  keyword_key_free(key.data, buffer);
+ err:
+  return res;
+}
+
+const char * mail_keyword_table_get(struct mail_keyword_table * table,
+    uint32_t indx)
+{
+  if (indx >= carray_count(table->kw_tab))
+    return NULL;
+
+  return carray_get(table->kw_tab, indx);
+}
+
+void mail_flags_compact_init(struct mail_flags_compact * flags)
+{
+  flags->fc_flags = 0;
+  flags->fc_keywords = 0;
+  flags->fc_extra_count = 0;
+  flags->fc_extra = NULL;
+}
+
+void mail_flags_compact_clear(struct mail_flags_compact * flags)
+{
+  free(flags->fc_extra);
+  mail_flags_compact_init(flags);
+}
+
+int mail_flags_compact_copy(struct mail_flags_compact * dest,
+    struct mail_flags_compact * src)
+{
+  uint32_t * extra;
+
+  extra = NULL;
+  if (src->fc_extra_count != 0) {
+    extra = malloc(src->fc_extra_count * sizeof(* extra));
+    if (extra == NULL)
+      return MAIL_ERROR_MEMORY;
+    memcpy(extra, src->fc_extra, src->fc_extra_count * sizeof(* extra));
+  }
+
+  free(dest->fc_extra);
+  dest->fc_flags = src->fc_flags;
+  dest->fc_keywords = src->fc_keywords;
+  dest->fc_extra_count = src->fc_extra_count;
+  dest->fc_extra = extra;
+
+  return MAIL_NO_ERROR;
+}
+
+/*
+  returns the position of the given index in fc_extra, or the position
+  where it would be inserted
+*/
+
+static uint32_t extra_find(struct mail_flags_compact * flags, uint32_t indx)
+{
+  uint32_t left;
+  uint32_t right;
+
+  left = 0;
+  right = flags->fc_extra_count;
+  while (left < right) {
+    uint32_t middle;
+
+    middle = left + (right - left) / 2;
+    if (flags->fc_extra[middle] < indx)
+      left = middle + 1;
+    else
+      right = middle;
+  }
+
+  return left;
+}
+
+int mail_flags_compact_add_keyword(struct mail_flags_compact * flags,
+    uint32_t indx)
+{
+  uint32_t * extra;
+  uint32_t pos;
+
+  if (indx < MAIL_FLAGS_COMPACT_BITS) {
+    flags->fc_keywords |= 1U << indx;
+    return MAIL_NO_ERROR;
+  }
+
+  pos = extra_find(flags, indx);
+  if ((pos < flags->fc_extra_count) && (flags->fc_extra[pos] == indx))
+    return MAIL_NO_ERROR;
+
+  /* the arrays are small, they are kept at the exact size */
+  extra = realloc(flags->fc_extra,
+      (flags->fc_extra_count + 1) * sizeof(* extra));
+  if (extra == NULL)
+    return MAIL_ERROR_MEMORY;
+
+  memmove(extra + pos + 1, extra + pos,
+      (flags->fc_extra_count - pos) * sizeof(* extra));
+  extra[pos] = indx;
+  flags->fc_extra = extra;
+  flags->fc_extra_count ++;
+
+  return MAIL_NO_ERROR;
+}
+
+void mail_flags_compact_remove_keyword(struct mail_flags_compact * flags,
+    uint32_t indx)
+{
+  uint32_t pos;
+
+  if (indx < MAIL_FLAGS_COMPACT_BITS) {
+    flags->fc_keywords &= ~(1U << indx);
+    return;
+  }
+
+  pos = extra_find(flags, indx);
+  if ((pos >= flags->fc_extra_count) || (flags->fc_extra[pos] != indx))
+    return;
+
+  memmove(flags->fc_extra + pos, flags->fc_extra + pos + 1,
+      (flags->fc_extra_count - pos - 1) * sizeof(* flags->fc_extra));
+  flags->fc_extra_count --;
+  if (flags->fc_extra_count == 0) {
+    free(flags->fc_extra);
+    flags->fc_extra = NULL;
+  }
+}
+
+int mail_flags_compact_has_keyword(struct mail_flags_compact * flags,
+    uint32_t indx)
+{
+  uint32_t pos;
+
+  if (indx < MAIL_FLAGS_COMPACT_BITS)
+    return (flags->fc_keywords & (1U << indx)) != 0;
+
+  pos = extra_find(flags, indx);
+
+  return (pos < flags->fc_extra_count) && (flags->fc_extra[pos] == indx);
+}
+
+int mail_flags_compact_compare(struct mail_flags_compact * flags1,
+    struct mail_flags_compact * flags2)
+{
+  if (flags1->fc_flags != flags2->fc_flags)
+    return -1;
+  if (flags1->fc_keywords != flags2->fc_keywords)
+    return -1;
+  if (flags1->fc_extra_count != flags2->fc_extra_count)
+    return -1;
+  if (flags1->fc_extra_count == 0)
+    return 0;
+
+  return memcmp(flags1->fc_extra, flags2->fc_extra,
+      flags1->fc_extra_count * sizeof(* flags1->fc_extra));
+}
+
+int mail_flags_compact_from_flags(struct mail_keyword_table * table,
+    struct mail_flags * flags, struct mail_flags_compact * result)
+{
+  struct mail_flags_compact compact;
+  clistiter * cur;
+  int res;
+  int r;
+
+  mail_flags_compact_init(&compact);
+  compact.fc_flags = flags->fl_flags;
+
+  if (flags->fl_extension != NULL) {
+    for(cur = clist_begin(flags->fl_extension) ; cur != NULL ;
+        cur = clist_next(cur)) {
+      char * keyword;
+      uint32_t indx;
+
+      keyword = clist_content(cur);
+      r = mail_keyword_table_intern(table, keyword, strlen(keyword), &indx);
+      if (r != MAIL_NO_ERROR) {
+        res = r;
+        goto free;
+      }
+
+      r = mail_flags_compact_add_keyword(&compact, indx);
+      if (r != MAIL_NO_ERROR) {
+        res = r;
+        goto free;
+      }
+    }
+  }
+
+  mail_flags_compact_clear(result);
+  * result = compact;
+
+  return MAIL_NO_ERROR;
+
+ free:
+  mail_flags_compact_clear(&compact);
+  return res;
+}
+
+static int flags_append_keyword(struct mail_keyword_table * table,
+    struct mail_flags * flags, uint32_t indx)
+{
+  const char * keyword;
+  char * str;
+  int r;
+
+  keyword = mail_keyword_table_get(table, indx);
+  if (keyword == NULL)
+    return MAIL_ERROR_INVAL;
+
+  str = strdup(keyword);
+  if (str == NULL)
+    return MAIL_ERROR_MEMORY;
+
+  r = clist_append(flags->fl_extension, str);
+  if (r < 0) {
+    free(str);
+    return MAIL_ERROR_MEMORY;
+  }
+
+  return MAIL_NO_ERROR;
+}
+
+int mail_flags_compact_to_flags(struct mail_keyword_table * table,
+    struct mail_flags_compact * flags, struct mail_flags ** result)
+{
+  struct mail_flags * mail_flags;
+  uint32_t i;
+  int res;
+  int r;
+
+  mail_flags = mail_flags_new_empty();
+  if (mail_flags == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+  mail_flags->fl_flags = flags->fc_flags;
+
+  for(i = 0 ; i < MAIL_FLAGS_COMPACT_BITS ; i ++) {
+    if ((flags->fc_keywords & (1U << i)) == 0)
+      continue;
+
+    r = flags_append_keyword(table, mail_flags, i);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+  }
+
+  for(i = 0 ; i < flags->fc_extra_count ; i ++) {
+    r = flags_append_keyword(table, mail_flags, flags->fc_extra[i]);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+  }
+
+  * result = mail_flags;
+
+  return MAIL_NO_ERROR;
+
+ free:
+  mail_flags_free(mail_flags);
+ err:
+  return res;
+}
@@ -0,0 +1,189 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2005 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef MAILDRIVER_KEYWORDS_H
+
+#define MAILDRIVER_KEYWORDS_H
+
+#include <libetpan/maildriver_types.h>
+#include <libetpan/chash.h>
+#include <libetpan/carray.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  mail_keyword_table is a table of interned flag keywords
+  (extension flags such as $Junk or Gmail labels), usually one per
+  session.
+
+  Each keyword gets an index that does not change for the life of the
+  table. Keywords are compared case-insensitively, the spelling of the
+  first occurrence is kept.
+
+  - kw_hash maps the lower case keywords to their index
+
+  - kw_tab maps the indexes to the keywords (char *)
+*/
+
+struct mail_keyword_table {
+  chash * kw_hash;
+  carray * kw_tab;
+};
+
+LIBETPAN_EXPORT
+struct mail_keyword_table * mail_keyword_table_new(void);
+
+LIBETPAN_EXPORT
+void mail_keyword_table_free(struct mail_keyword_table * table);
+
+/*
+  mail_keyword_table_intern() returns in (* result) the index of the
+  given keyword, the keyword is added to the table if needed.
+
+  @return MAIL_NO_ERROR is returned on success, MAIL_ERROR_MEMORY
+    is returned on error
+*/
+
+LIBETPAN_EXPORT
+int mail_keyword_table_intern(struct mail_keyword_table * table,
+    const char * keyword, size_t length, uint32_t * result);
+
+/*
+  mail_keyword_table_lookup() returns in (* result) the index of the
+  given keyword, MAIL_ERROR_INVAL is returned when the keyword has
+  not been interned.
+*/
+
+LIBETPAN_EXPORT
+int mail_keyword_table_lookup(struct mail_keyword_table * table,
+    const char * keyword, size_t length, uint32_t * result);
+
+/* returns the keyword with the given index, or NULL */
+
+LIBETPAN_EXPORT
+const char * mail_keyword_table_get(struct mail_keyword_table * table,
+    uint32_t indx);
+
+#define mail_keyword_table_count(table) carray_count((table)->kw_tab)
+
+/*
+  mail_flags_compact is the compact form of mail_flags, the keywords
+  are the indexes of a mail_keyword_table.
+
+  - fc_flags is the standard flags value (MAIL_FLAG_XXX)
+
+  - fc_keywords is the bitset of the keywords with an index below 32
+
+  - fc_extra is the sorted array of the other keyword indexes,
+    fc_extra_count is the size of the array. fc_extra is NULL when
+    there are none, which is the case for most of the messages.
+
+  Two compact flags that refer to the same table have the same value
+  if and only if they have the same flags and keywords.
+
+  The compact form does not replace mail_flags: msg_flags, and the
+  flags returned by the drivers and read from their caches, are still
+  a mail_flags allocated for each message. The IMAP driver only uses
+  the compact form to group the messages of its flags store.
+  imap_flags_to_compact_flags() and generic_cache_flags_compact_read()
+  are for callers that keep their own copy of the flags in compact
+  form.
+*/
+
+struct mail_flags_compact {
+  uint32_t fc_flags;
+  uint32_t fc_keywords;
+  uint32_t fc_extra_count;
+  uint32_t * fc_extra;
+};
+
+#define MAIL_FLAGS_COMPACT_BITS 32
+
+LIBETPAN_EXPORT
+void mail_flags_compact_init(struct mail_flags_compact * flags);
+
+/* releases fc_extra, the flags are empty after the call */
+
+LIBETPAN_EXPORT
+void mail_flags_compact_clear(struct mail_flags_compact * flags);
+
+LIBETPAN_EXPORT
+int mail_flags_compact_copy(struct mail_flags_compact * dest,
+    struct mail_flags_compact * src);
+
+LIBETPAN_EXPORT
+int mail_flags_compact_add_keyword(struct mail_flags_compact * flags,
+    uint32_t indx);
+
+LIBETPAN_EXPORT
+void mail_flags_compact_remove_keyword(struct mail_flags_compact * flags,
+    uint32_t indx);
+
+LIBETPAN_EXPORT
+int mail_flags_compact_has_keyword(struct mail_flags_compact * flags,
+    uint32_t indx);
+
+/*
+  mail_flags_compact_compare() returns 0 if the flags are the same,
+  a non-zero value otherwise.
+*/
+
+LIBETPAN_EXPORT
+int mail_flags_compact_compare(struct mail_flags_compact * flags1,
+    struct mail_flags_compact * flags2);
+
+/*
+  mail_flags_compact_from_flags() converts the given flags to their
+  compact form, the keywords are interned in the given table.
+  (* result) must be initialized with mail_flags_compact_init(),
+  its previous content is replaced.
+*/
+
+LIBETPAN_EXPORT
+int mail_flags_compact_from_flags(struct mail_keyword_table * table,
+    struct mail_flags * flags, struct mail_flags_compact * result);
+
+/*
+  mail_flags_compact_to_flags() builds a mail_flags from the compact
+  form, to be released with mail_flags_free().
+*/
+
+LIBETPAN_EXPORT
+int mail_flags_compact_to_flags(struct mail_keyword_table * table,
+    struct mail_flags_compact * flags, struct mail_flags ** result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
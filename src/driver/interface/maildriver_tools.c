@@ -52,15 +52,363 @@
 #ifdef HAVE_UNISTD_H
 #	include <unistd.h>
 #endif
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+#	include <pthread.h>
+#	define ENVELOPE_PARSER_USE_THREADS
+#endif
+#endif
 #include "maildriver.h"
 #include "mailmessage.h"
+#include "mailmessage_tools.h"
 #include "mailstream.h"
 #include "mailmime.h"
 #include "mail_cache_db.h"
 
+/* ********************************************************************* */
+/* parallel envelope parsing */
+
+/* number of headers that can be queued per worker thread */
+#define ENVELOPE_PARSER_JOBS_PER_THREAD 16
+
+static unsigned int envelope_parser_thread_count = 0;
+
+void maildriver_set_envelope_parser_thread_count(unsigned int count)
+{
+  envelope_parser_thread_count = count;
+}
+
+unsigned int maildriver_get_envelope_parser_thread_count(void)
+{
+  return envelope_parser_thread_count;
+}
+
+struct envelope_parser_job {
+  mailmessage * msg;
+  char * header;
+  size_t length;
+  struct mailimf_fields * fields;
+  int done;
+};
+
+struct maildriver_envelope_parser {
+  int flush_messages;
+  unsigned int window;
+  struct envelope_parser_job * jobs;
+  /*
+    jobs in [head, next) are being parsed or are parsed,
+    jobs in [next, tail) are waiting for a worker.
+  */
+  unsigned int head;
+  unsigned int next;
+  unsigned int tail;
+  unsigned int thread_count;
+#ifdef ENVELOPE_PARSER_USE_THREADS
+  int terminate;
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+  pthread_t * threads;
+#endif
+};
+
+static void envelope_parser_job_parse(struct envelope_parser_job * job)
+{
+  size_t cur_token;
+  struct mailimf_fields * fields;
+  int r;
+
+  cur_token = 0;
+  r = mailimf_envelope_fields_parse(job->header, job->length,
+      &cur_token, &fields);
+  if (r == MAILIMF_NO_ERROR)
+    job->fields = fields;
+  else
+    job->fields = NULL;
+}
+
+/* runs on the caller thread, in the order the messages were added */
+
+static void
+envelope_parser_job_complete(struct maildriver_envelope_parser * parser,
+    mailmessage * msg, char * header, struct mailimf_fields * fields)
+{
+  if (fields != NULL) {
+    if (msg->msg_fields == NULL)
+      msg->msg_fields = fields;
+    else
+      mailimf_fields_free(fields);
+  }
+  
+  if (parser->flush_messages) {
+    mailmessage_fetch_result_free(msg, header);
+    mailmessage_flush(msg);
+  }
+}
+
+#ifdef ENVELOPE_PARSER_USE_THREADS
+static void * envelope_parser_thread(void * data)
+{
+  struct maildriver_envelope_parser * parser;
+  
+  parser = data;
+  
+  pthread_mutex_lock(&parser->lock);
+  while (1) {
+    struct envelope_parser_job * job;
+    
+    while ((parser->next == parser->tail) && !parser->terminate)
+      pthread_cond_wait(&parser->work_cond, &parser->lock);
+    
+    if (parser->next == parser->tail)
+      break;
+    
+    job = &parser->jobs[parser->next % parser->window];
+    parser->next ++;
+    pthread_mutex_unlock(&parser->lock);
+    
+    envelope_parser_job_parse(job);
+    
+    pthread_mutex_lock(&parser->lock);
+    job->done = 1;
+    pthread_cond_signal(&parser->done_cond);
+  }
+  pthread_mutex_unlock(&parser->lock);
+  
+  return NULL;
+}
+
+/* must be called with the lock held */
+
+static void
+envelope_parser_reap(struct maildriver_envelope_parser * parser,
+    unsigned int max_pending)
+{
+  while (parser->tail - parser->head > max_pending) {
+    struct envelope_parser_job * job;
+    mailmessage * msg;
+    char * header;
+    struct mailimf_fields * fields;
+    
+    job = &parser->jobs[parser->head % parser->window];
+    while (!job->done)
+      pthread_cond_wait(&parser->done_cond, &parser->lock);
+    
+    msg = job->msg;
+    header = job->header;
+    fields = job->fields;
+    parser->head ++;
+    
+    /*
+      only the caller thread adds jobs, the slot can't be reused
+      while the lock is released.
+    */
+    pthread_mutex_unlock(&parser->lock);
+    envelope_parser_job_complete(parser, msg, header, fields);
+    pthread_mutex_lock(&parser->lock);
+  }
+}
+#endif
+
+struct maildriver_envelope_parser *
+maildriver_envelope_parser_new(unsigned int thread_count, int flush_messages)
+{
+  struct maildriver_envelope_parser * parser;
+  
+  parser = malloc(sizeof(* parser));
+  if (parser == NULL)
+    goto err;
+  
+  parser->flush_messages = flush_messages;
+  parser->head = 0;
+  parser->next = 0;
+  parser->tail = 0;
+  parser->thread_count = 0;
+  parser->window = 1;
+  parser->jobs = NULL;
+  
+#ifdef ENVELOPE_PARSER_USE_THREADS
+  if (thread_count > 1) {
+    unsigned int i;
+    
+    parser->window = thread_count * ENVELOPE_PARSER_JOBS_PER_THREAD;
+    parser->jobs = malloc(parser->window * sizeof(* parser->jobs));
+    if (parser->jobs == NULL)
+      goto free;
+    
+    parser->threads = malloc(thread_count * sizeof(* parser->threads));
+    if (parser->threads == NULL)
+      goto free_jobs;
+    
+    parser->terminate = 0;
+    if (pthread_mutex_init(&parser->lock, NULL) != 0)
+      goto free_threads;
+    if (pthread_cond_init(&parser->work_cond, NULL) != 0)
+      goto destroy_lock;
+    if (pthread_cond_init(&parser->done_cond, NULL) != 0)
+      goto destroy_work_cond;
+    
+    for(i = 0 ; i < thread_count ; i ++) {
+      if (pthread_create(&parser->threads[i], NULL,
+              envelope_parser_thread, parser) != 0)
+        break;
+      parser->thread_count ++;
+    }
+    
+    /* could not start any worker, parse on the caller thread */
+    if (parser->thread_count == 0) {
+      pthread_cond_destroy(&parser->done_cond);
+      pthread_cond_destroy(&parser->work_cond);
+      pthread_mutex_destroy(&parser->lock);
+      free(parser->threads);
+      free(parser->jobs);
+      parser->jobs = NULL;
+      parser->window = 1;
+    }
+  }
+  
+  return parser;
+  
+ destroy_work_cond:
+  pthread_cond_destroy(&parser->work_cond);
+ destroy_lock:
+  pthread_mutex_destroy(&parser->lock);
+ free_threads:
+  free(parser->threads);
+ free_jobs:
+  free(parser->jobs);
+ free:
+  free(parser);
+ err:
+  return NULL;
+#else
+  (void) thread_count;
+  
+  return parser;
+  
+ err:
+  return NULL;
+#endif
+}
+
+int maildriver_envelope_parser_add(struct maildriver_envelope_parser * parser,
+    mailmessage * msg, char * header, size_t length)
+{
+#ifdef ENVELOPE_PARSER_USE_THREADS
+  struct envelope_parser_job * job;
+#endif
+  
+  if (parser->thread_count == 0) {
+    struct envelope_parser_job inline_job;
+    
+    inline_job.msg = msg;
+    inline_job.header = header;
+    inline_job.length = length;
+    envelope_parser_job_parse(&inline_job);
+    envelope_parser_job_complete(parser, msg, header, inline_job.fields);
+    
+    return MAIL_NO_ERROR;
+  }
+  
+#ifdef ENVELOPE_PARSER_USE_THREADS
+  pthread_mutex_lock(&parser->lock);
+  envelope_parser_reap(parser, parser->window - 1);
+  
+  job = &parser->jobs[parser->tail % parser->window];
+  job->msg = msg;
+  job->header = header;
+  job->length = length;
+  job->fields = NULL;
+  job->done = 0;
+  parser->tail ++;
+  
+  pthread_cond_signal(&parser->work_cond);
+  pthread_mutex_unlock(&parser->lock);
+#endif
+  
+  return MAIL_NO_ERROR;
+}
+
+void maildriver_envelope_parser_free(struct maildriver_envelope_parser * parser)
+{
+#ifdef ENVELOPE_PARSER_USE_THREADS
+  if (parser->thread_count != 0) {
+    unsigned int i;
+    
+    pthread_mutex_lock(&parser->lock);
+    envelope_parser_reap(parser, 0);
+    parser->terminate = 1;
+    pthread_cond_broadcast(&parser->work_cond);
+    pthread_mutex_unlock(&parser->lock);
+    
+    for(i = 0 ; i < parser->thread_count ; i ++)
+      pthread_join(parser->threads[i], NULL);
+    
+    pthread_cond_destroy(&parser->done_cond);
+    pthread_cond_destroy(&parser->work_cond);
+    pthread_mutex_destroy(&parser->lock);
+    free(parser->threads);
+    free(parser->jobs);
+  }
+#endif
+  
+  free(parser);
+}
+
 /* ********************************************************************* */
 /* tools */
 
+static int
+get_envelopes_list_parallel(struct mailmessage_list * env_list,
+    unsigned int thread_count)
+{
+  struct maildriver_envelope_parser * parser;
+  int r;
+  unsigned i;
+
+  parser = maildriver_envelope_parser_new(thread_count, 1);
+  if (parser == NULL)
+    return MAIL_ERROR_MEMORY;
+  
+  for(i = 0 ; i < carray_count(env_list->msg_tab) ; i ++) {
+    mailmessage * msg;
+    char * header;
+    size_t length;
+    
+    msg = carray_get(env_list->msg_tab, i);
+    
+    if (msg->msg_fields != NULL)
+      continue;
+    
+    /*
+      header fetching uses the session and stays on the caller thread,
+      only drivers using the generic envelope parser can be handed
+      to the workers.
+    */
+    if (msg->msg_driver->msg_fetch_envelope !=
+        mailmessage_generic_fetch_envelope) {
+      struct mailimf_fields * fields;
+      
+      r = mailmessage_fetch_envelope(msg, &fields);
+      if (r == MAIL_NO_ERROR)
+        msg->msg_fields = fields;
+      mailmessage_flush(msg);
+      continue;
+    }
+    
+    r = mailmessage_fetch_header(msg, &header, &length);
+    if (r != MAIL_NO_ERROR) {
+      mailmessage_flush(msg);
+      continue;
+    }
+    
+    maildriver_envelope_parser_add(parser, msg, header, length);
+  }
+  
+  maildriver_envelope_parser_free(parser);
+  
+  return MAIL_NO_ERROR;
+}
 
 int
 maildriver_generic_get_envelopes_list(mailsession * session,
@@ -69,6 +417,12 @@ maildriver_generic_get_envelopes_list(mailsession * session,
   int r;
   unsigned i;
 
+  if (envelope_parser_thread_count > 1) {
+    r = get_envelopes_list_parallel(env_list, envelope_parser_thread_count);
+    if (r == MAIL_NO_ERROR)
+      return MAIL_NO_ERROR;
+  }
+
   for(i = 0 ; i < carray_count(env_list->msg_tab) ; i ++) {
     mailmessage * msg;
     
@@ -48,6 +48,32 @@ int
 maildriver_generic_get_envelopes_list(mailsession * session,
     struct mailmessage_list * env_list);
 
+/*
+  maildriver_envelope_parser parses envelopes of headers on a pool of
+  worker threads. The results are stored in msg_fields of the
+  messages, on the caller thread, in the order the messages were added.
+
+  If flush_messages is set, the parser owns the given headers, they
+  are released with mailmessage_fetch_result_free() and the message is
+  flushed once the envelope is stored. Otherwise, the headers must stay
+  valid until maildriver_envelope_parser_free() returns.
+
+  When thread_count is lower than 2 or when threads are not available,
+  the headers are parsed on the caller thread.
+*/
+
+struct maildriver_envelope_parser;
+
+struct maildriver_envelope_parser *
+maildriver_envelope_parser_new(unsigned int thread_count, int flush_messages);
+
+int maildriver_envelope_parser_add(struct maildriver_envelope_parser * parser,
+    mailmessage * msg, char * header, size_t length);
+
+/* waits for all pending headers to be parsed and releases the workers */
+
+void maildriver_envelope_parser_free(struct maildriver_envelope_parser * parser);
+
 #if 0
 int maildriver_generic_search_messages(mailsession * session, char * charset,
     struct mail_search_key * key,
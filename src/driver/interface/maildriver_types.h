@@ -64,6 +64,8 @@ typedef struct mailmessage_driver mailmessage_driver;
 
 typedef struct mailmessage mailmessage;
 
+struct mailmessage_tree;
+
 
 /*
   mailmessage_list is a list of mailmessage
@@ -440,6 +442,11 @@ void mail_search_result_free(struct mail_search_result * search_result);
   - get_message_by_uid returns a mailmessage structure that corresponds
       to the given message unique identifier.
 
+  - build_thread() builds the threads of the messages of the
+      mailmessage_list without fetching their envelopes, when the
+      server can do it. MAIL_ERROR_NOT_IMPLEMENTED is returned when
+      the threads have to be built locally.
+
   * mandatory functions are the following :
 
   - connect_stream() of connect_path()
@@ -549,6 +556,10 @@ struct mailsession_driver {
       const char * remote_ip_port,
       const char * login, const char * auth_name,
       const char * password, const char * realm);
+
+  int (* sess_build_thread)(mailsession * session, int type,
+      struct mailmessage_list * env_list,
+      struct mailmessage_tree ** result);
 };
 
 
@@ -803,6 +814,18 @@ struct generic_message_t {
   char * msg_message;
   size_t msg_length;
   void * msg_data;
+  
+  /*
+    optional, fetches only the beginning of the message, at least up to
+    the end of the header, into msg_header and msg_header_length.
+    It is released by msg_prefetch_header_free() as soon as the header
+    has been used.
+  */
+  int (* msg_prefetch_header)(mailmessage * msg_info);
+  void (* msg_prefetch_header_free)(struct generic_message_t * msg);
+  char * msg_header;
+  size_t msg_header_length;
+  void * msg_header_data;
 };
 
 LIBETPAN_EXPORT
@@ -64,6 +64,12 @@ mailmessage_generic_initialize(mailmessage * msg_info)
   msg->msg_prefetch_free = NULL;
   msg->msg_data = NULL;
 
+  msg->msg_prefetch_header = NULL;
+  msg->msg_prefetch_header_free = NULL;
+  msg->msg_header = NULL;
+  msg->msg_header_length = 0;
+  msg->msg_header_data = NULL;
+
   msg_info->msg_data = msg;
 
   return MAIL_NO_ERROR;
@@ -82,6 +88,11 @@ void mailmessage_generic_flush(mailmessage * msg_info)
     if (msg->msg_prefetch_free != NULL)
       msg->msg_prefetch_free(msg);
     msg->msg_fetched = 0;
+    if (msg->msg_header != NULL) {
+      if (msg->msg_prefetch_header_free != NULL)
+        msg->msg_prefetch_header_free(msg);
+      msg->msg_header = NULL;
+    }
   }
 }
 
@@ -121,6 +132,78 @@ mailmessage_generic_prefetch(mailmessage * msg_info)
   return MAIL_NO_ERROR;
 }
 
+/*
+  the header is fetched alone when the message has not been fetched
+  yet and the driver is able to do it. It is then released by
+  mailmessage_generic_prefetch_header_free().
+*/
+
+static int
+mailmessage_generic_prefetch_header(mailmessage * msg_info,
+    char ** result, size_t * result_len)
+{
+  struct generic_message_t * msg;
+  int r;
+  
+  msg = msg_info->msg_data;
+  
+  if (msg->msg_fetched || (msg->msg_prefetch_header == NULL)) {
+    r = mailmessage_generic_prefetch(msg_info);
+    if (r != MAIL_NO_ERROR)
+      return r;
+    
+    * result = msg->msg_message;
+    * result_len = msg->msg_length;
+    
+    return MAIL_NO_ERROR;
+  }
+  
+  r = msg->msg_prefetch_header(msg_info);
+  if (r != MAIL_NO_ERROR)
+    return r;
+  
+  * result = msg->msg_header;
+  * result_len = msg->msg_header_length;
+  
+  return MAIL_NO_ERROR;
+}
+
+static void
+mailmessage_generic_prefetch_header_free(mailmessage * msg_info)
+{
+  struct generic_message_t * msg;
+  
+  msg = msg_info->msg_data;
+  
+  if (msg->msg_header == NULL)
+    return;
+  
+  if (msg->msg_prefetch_header_free != NULL)
+    msg->msg_prefetch_header_free(msg);
+  msg->msg_header = NULL;
+  msg->msg_header_length = 0;
+}
+
+static size_t get_header_length(const char * message, size_t length)
+{
+  size_t cur_token;
+  int r;
+  
+  cur_token = 0;
+  
+  while (1) {
+    r = mailimf_ignore_field_parse(message, length, &cur_token);
+    if (r == MAILIMF_NO_ERROR) {
+      /* do nothing */
+    }
+    else
+      break;
+  }
+  mailimf_crlf_parse(message, length, &cur_token);
+  
+  return cur_token;
+}
+
 static int
 mailmessage_generic_prefetch_bodystructure(mailmessage * msg_info)
 {
@@ -236,33 +319,19 @@ int mailmessage_generic_fetch_header(mailmessage * msg_info,
   MMAPString * mmapstr;
   char * headers;
   int res;
-  struct generic_message_t * msg;
 
-  msg = msg_info->msg_data;
-  r = mailmessage_generic_prefetch(msg_info);
+  r = mailmessage_generic_prefetch_header(msg_info, &message, &length);
   if (r != MAIL_NO_ERROR) {
     res = r;
     goto err;
   }
 
-  message = msg->msg_message;
-  length = msg->msg_length;
-  cur_token = 0;
-  
-  while (1) {
-    r = mailimf_ignore_field_parse(message, length, &cur_token);
-    if (r == MAILIMF_NO_ERROR) {
-      /* do nothing */
-    }
-    else
-      break;
-  }
-  mailimf_crlf_parse(message, length, &cur_token);
+  cur_token = get_header_length(message, length);
   
   mmapstr = mmap_string_new_len(message, cur_token);
   if (mmapstr == NULL) {
     res = MAIL_ERROR_MEMORY;
-    goto err;
+    goto free_header;
   }
   
   r = mmap_string_ref(mmapstr);
@@ -271,6 +340,8 @@ int mailmessage_generic_fetch_header(mailmessage * msg_info,
     goto free_mmap;
   }
   
+  mailmessage_generic_prefetch_header_free(msg_info);
+  
   headers = mmapstr->str;
 
   * result = headers;
@@ -280,6 +351,8 @@ int mailmessage_generic_fetch_header(mailmessage * msg_info,
 
  free_mmap:
   mmap_string_free(mmapstr);
+ free_header:
+  mailmessage_generic_prefetch_header_free(msg_info);
  err:
   return res;
 }
@@ -304,17 +377,7 @@ int mailmessage_generic_fetch_body(mailmessage * msg_info,
 
   message = msg->msg_message;
   length = msg->msg_length;
-  cur_token = 0;
-
-  while (1) {
-    r = mailimf_ignore_field_parse(message, length, &cur_token);
-    if (r == MAILIMF_NO_ERROR) {
-      /* do nothing */
-    }
-    else
-      break;
-  }
-  mailimf_crlf_parse(message, length, &cur_token);
+  cur_token = get_header_length(message, length);
 
   mmapstr = mmap_string_new_len(message + cur_token, length - cur_token);
   if (mmapstr == NULL) {
@@ -574,7 +637,31 @@ int mailmessage_generic_fetch_envelope(mailmessage * msg_info,
   char * header;
   size_t length;
   struct mailimf_fields * fields;
+  struct generic_message_t * msg;
 
+  msg = msg_info->msg_data;
+  if (msg->msg_fetched || (msg->msg_prefetch_header != NULL)) {
+    /* parse the header in place, parsing stops at the end of the header */
+    r = mailmessage_generic_prefetch_header(msg_info, &header, &length);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto err;
+    }
+    
+    cur_token = 0;
+    r = mailimf_envelope_fields_parse(header, length, &cur_token,
+        &fields);
+    mailmessage_generic_prefetch_header_free(msg_info);
+    if (r != MAILIMF_NO_ERROR) {
+      res = maildriver_imf_error_to_mail_error(r);
+      goto err;
+    }
+    
+    * result = fields;
+    
+    return MAIL_NO_ERROR;
+  }
+  
   r = mailmessage_fetch_header(msg_info, &header, &length);
   if (r != MAIL_NO_ERROR) {
     res = r;
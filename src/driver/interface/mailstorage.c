@@ -40,13 +40,54 @@
 #include "mailstorage.h"
 
 #include "maildriver.h"
+#include "chash.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+#include <pthread.h>
+#define MUTEX_LOCK(x) pthread_mutex_lock(x)
+#define MUTEX_UNLOCK(x) pthread_mutex_unlock(x)
+#define HAVE_SERVER_SESSIONS_LOCK
+#define POOL_LOCK_INIT(pool) pthread_mutex_init(&(pool)->lock, NULL)
+#define POOL_LOCK_DESTROY(pool) pthread_mutex_destroy(&(pool)->lock)
+#define POOL_LOCK(pool) pthread_mutex_lock(&(pool)->lock)
+#define POOL_UNLOCK(pool) pthread_mutex_unlock(&(pool)->lock)
+#elif (defined WIN32)
+#include <windows.h>
+#define POOL_LOCK_INIT(pool) (InitializeCriticalSection(&(pool)->lock), 0)
+#define POOL_LOCK_DESTROY(pool) DeleteCriticalSection(&(pool)->lock)
+#define POOL_LOCK(pool) EnterCriticalSection(&(pool)->lock)
+#define POOL_UNLOCK(pool) LeaveCriticalSection(&(pool)->lock)
+#endif
+#endif
+#ifndef HAVE_SERVER_SESSIONS_LOCK
+#define MUTEX_LOCK(x)
+#define MUTEX_UNLOCK(x)
+#endif
+#ifndef POOL_LOCK
+#define POOL_LOCK_INIT(pool) 0
+#define POOL_LOCK_DESTROY(pool) do {} while (0)
+#define POOL_LOCK(pool) do {} while (0)
+#define POOL_UNLOCK(pool) do {} while (0)
+#endif
 
 static int mailstorage_get_folder(struct mailstorage * storage,
     char * pathname, mailsession ** result);
 
+static int pool_get_session(struct mailstorage * storage,
+    struct mailfolder * folder, mailsession ** result);
+
+static int pool_release_session(struct mailstorage * storage,
+    mailsession * session);
+
+static void pool_free(struct mailstorage_pool * pool);
+
+static void pool_close_idle_sessions(struct mailstorage_pool * pool,
+    int all);
+
 LIBETPAN_EXPORT
 struct mailfolder * mailfolder_new(struct mailstorage * storage,
     const char * pathname, const char * virtual_name)
@@ -159,11 +200,33 @@ int mailfolder_connect(struct mailfolder * folder)
     return MAIL_NO_ERROR;
   }
   
-  r = mailstorage_get_folder(folder->fld_storage, folder->fld_pathname,
-      &session);
-  if (r != MAIL_NO_ERROR) {
-    res = r;
-    goto err;
+  if (folder->fld_storage->sto_pool != NULL) {
+    r = pool_get_session(folder->fld_storage, folder, &session);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto err;
+    }
+    
+    if (session == NULL) {
+      /* all the sessions of the pool are used */
+      session = folder->fld_storage->sto_session;
+      if ((folder->fld_pathname != NULL) &&
+          (session->sess_driver->sess_select_folder != NULL)) {
+        r = mailsession_select_folder(session, folder->fld_pathname);
+        if (r != MAIL_NO_ERROR) {
+          res = r;
+          goto err;
+        }
+      }
+    }
+  }
+  else {
+    r = mailstorage_get_folder(folder->fld_storage, folder->fld_pathname,
+        &session);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto err;
+    }
   }
   folder->fld_session = session;
   folder->fld_shared_session = (session == folder->fld_storage->sto_session);
@@ -193,7 +256,7 @@ void mailfolder_disconnect(struct mailfolder * folder)
     clist_delete(folder->fld_storage->sto_shared_folders, folder->fld_pos);
     folder->fld_pos = NULL;
   }
-  else {
+  else if (!pool_release_session(folder->fld_storage, folder->fld_session)) {
     mailsession_logout(folder->fld_session);
     mailsession_free(folder->fld_session);
   }
@@ -265,6 +328,7 @@ struct mailstorage * mailstorage_new(const char * sto_id)
   storage->sto_data = NULL;
   storage->sto_session = NULL;
   storage->sto_driver = NULL;
+  storage->sto_pool = NULL;
   storage->sto_shared_folders = clist_new();
   if (storage->sto_shared_folders == NULL)
     goto free_id;
@@ -286,6 +350,9 @@ void mailstorage_free(struct mailstorage * storage)
   if (storage->sto_session != NULL)
     mailstorage_disconnect(storage);
   
+  if (storage->sto_pool != NULL)
+    pool_free(storage->sto_pool);
+  
   if (storage->sto_driver != NULL) {
     if (storage->sto_driver->sto_uninitialize != NULL)
       storage->sto_driver->sto_uninitialize(storage);
@@ -328,6 +395,9 @@ void mailstorage_disconnect(struct mailstorage * storage)
     mailfolder_disconnect(folder);
   }
 
+  if (storage->sto_pool != NULL)
+    pool_close_idle_sessions(storage->sto_pool, 1);
+
   if (storage->sto_session == NULL)
     return;
 
@@ -354,3 +424,500 @@ static int mailstorage_get_folder(struct mailstorage * storage,
   return storage->sto_driver->sto_get_folder_session(storage,
       pathname, result);
 }
+
+
+/* session pool */
+
+#define SERVER_KEY_SIZE 256
+
+struct pool_session {
+  mailsession * session;
+  /* mailbox selected on the session */
+  char * pathname;
+  /* folder using the session, NULL when the session is idle */
+  struct mailfolder * folder;
+  time_t last_use;
+};
+
+/*
+  lock is held by all the operations on the pool. The pool is kept
+  until the storage is freed, even when it is disabled, so that it
+  can't be freed while another thread waits for the lock.
+*/
+
+struct mailstorage_pool {
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+  pthread_mutex_t lock;
+#elif (defined WIN32)
+  CRITICAL_SECTION lock;
+#endif
+#endif
+  unsigned int max_sessions;
+  time_t idle_timeout;
+  carray * sessions; /* array of (struct pool_session *) */
+  /* empty when the server is unknown */
+  char server_key[SERVER_KEY_SIZE];
+};
+
+#ifdef HAVE_SERVER_SESSIONS_LOCK
+static pthread_mutex_t server_sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*
+  number of sessions opened by the pools on each server, the key is the
+  key of the server and the count is stored as the length of the value.
+*/
+static chash * server_sessions = NULL;
+static unsigned int max_server_sessions = 0;
+
+/* returns 1 if a session can be opened on the server */
+
+static int server_session_acquire(const char * server_key)
+{
+  chashdatum key;
+  chashdatum value;
+  unsigned int count;
+  int res;
+  int r;
+
+  if (server_key[0] == '\0')
+    return 1;
+
+  MUTEX_LOCK(&server_sessions_lock);
+  if (server_sessions == NULL) {
+    server_sessions = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
+    if (server_sessions == NULL) {
+      res = 0;
+      goto unlock;
+    }
+  }
+
+  key.data = (void *) server_key;
+  key.len = (unsigned int) strlen(server_key);
+  count = 0;
+  r = chash_get(server_sessions, &key, &value);
+  if (r == 0)
+    count = value.len;
+
+  if ((max_server_sessions != 0) && (count >= max_server_sessions)) {
+    res = 0;
+    goto unlock;
+  }
+
+  value.data = NULL;
+  value.len = count + 1;
+  r = chash_set(server_sessions, &key, &value, NULL);
+  res = (r == 0);
+
+ unlock:
+  MUTEX_UNLOCK(&server_sessions_lock);
+
+  return res;
+}
+
+static void server_session_release(const char * server_key)
+{
+  chashdatum key;
+  chashdatum value;
+  int r;
+
+  if (server_key[0] == '\0')
+    return;
+
+  MUTEX_LOCK(&server_sessions_lock);
+  key.data = (void *) server_key;
+  key.len = (unsigned int) strlen(server_key);
+  r = chash_get(server_sessions, &key, &value);
+  if (r == 0) {
+    if (value.len <= 1) {
+      chash_delete(server_sessions, &key, NULL);
+    }
+    else {
+      value.len --;
+      chash_set(server_sessions, &key, &value, NULL);
+    }
+  }
+  MUTEX_UNLOCK(&server_sessions_lock);
+}
+
+LIBETPAN_EXPORT
+void mailstorage_set_max_server_sessions(unsigned int max_sessions)
+{
+  MUTEX_LOCK(&server_sessions_lock);
+  max_server_sessions = max_sessions;
+  MUTEX_UNLOCK(&server_sessions_lock);
+}
+
+static struct mailstorage_pool * pool_new(struct mailstorage * storage)
+{
+  struct mailstorage_pool * pool;
+  int r;
+
+  pool = malloc(sizeof(* pool));
+  if (pool == NULL)
+    goto err;
+
+  pool->max_sessions = 0;
+  pool->idle_timeout = 0;
+  pool->sessions = carray_new(4);
+  if (pool->sessions == NULL)
+    goto free;
+
+  if (POOL_LOCK_INIT(pool) != 0)
+    goto free_sessions;
+
+  pool->server_key[0] = '\0';
+  if (storage->sto_driver->sto_get_server_key != NULL) {
+    r = storage->sto_driver->sto_get_server_key(storage,
+        pool->server_key, sizeof(pool->server_key));
+    if (r != MAIL_NO_ERROR)
+      pool->server_key[0] = '\0';
+  }
+
+  return pool;
+
+ free_sessions:
+  carray_free(pool->sessions);
+ free:
+  free(pool);
+ err:
+  return NULL;
+}
+
+static void pool_session_close(struct mailstorage_pool * pool,
+    unsigned int indx)
+{
+  struct pool_session * pool_session;
+
+  pool_session = carray_get(pool->sessions, indx);
+  carray_delete(pool->sessions, indx);
+
+  mailsession_logout(pool_session->session);
+  mailsession_free(pool_session->session);
+  server_session_release(pool->server_key);
+  free(pool_session->pathname);
+  free(pool_session);
+}
+
+/*
+  closes the idle sessions that timed out, all the idle sessions when
+  all is set.
+*/
+
+static void pool_close_idle_sessions_no_lock(struct mailstorage_pool * pool,
+    int all)
+{
+  unsigned int i;
+  time_t now;
+
+  now = time(NULL);
+  i = 0;
+  while (i < carray_count(pool->sessions)) {
+    struct pool_session * pool_session;
+
+    pool_session = carray_get(pool->sessions, i);
+    if ((pool_session->folder == NULL) &&
+        (all || (pool_session->last_use + pool->idle_timeout <= now))) {
+      pool_session_close(pool, i);
+      continue;
+    }
+    i ++;
+  }
+}
+
+static void pool_close_idle_sessions(struct mailstorage_pool * pool,
+    int all)
+{
+  POOL_LOCK(pool);
+  pool_close_idle_sessions_no_lock(pool, all);
+  POOL_UNLOCK(pool);
+}
+
+static void pool_free(struct mailstorage_pool * pool)
+{
+  while (carray_count(pool->sessions) > 0)
+    pool_session_close(pool, 0);
+  carray_free(pool->sessions);
+  POOL_LOCK_DESTROY(pool);
+  free(pool);
+}
+
+static int pool_select(struct pool_session * pool_session,
+    struct mailfolder * folder)
+{
+  char * pathname;
+  int r;
+
+  if (folder->fld_pathname == NULL)
+    return MAIL_ERROR_INVAL;
+
+  pathname = strdup(folder->fld_pathname);
+  if (pathname == NULL)
+    return MAIL_ERROR_MEMORY;
+
+  r = mailsession_select_folder(pool_session->session, pathname);
+  if (r != MAIL_NO_ERROR) {
+    free(pathname);
+    return r;
+  }
+
+  free(pool_session->pathname);
+  pool_session->pathname = pathname;
+
+  return MAIL_NO_ERROR;
+}
+
+static int pool_open_session(struct mailstorage * storage,
+    struct mailfolder * folder, struct pool_session ** result)
+{
+  struct mailstorage_pool * pool;
+  struct pool_session * pool_session;
+  mailsession * session;
+  int res;
+  int r;
+
+  pool = storage->sto_pool;
+
+  r = storage->sto_driver->sto_new_session(storage, &session);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto err;
+  }
+
+  pool_session = malloc(sizeof(* pool_session));
+  if (pool_session == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_session;
+  }
+  pool_session->session = session;
+  pool_session->pathname = NULL;
+  pool_session->folder = NULL;
+  pool_session->last_use = time(NULL);
+
+  r = pool_select(pool_session, folder);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_pool_session;
+  }
+
+  r = carray_add(pool->sessions, pool_session, NULL);
+  if (r < 0) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_pathname;
+  }
+
+  * result = pool_session;
+
+  return MAIL_NO_ERROR;
+
+ free_pathname:
+  free(pool_session->pathname);
+ free_pool_session:
+  free(pool_session);
+ free_session:
+  mailsession_logout(session);
+  mailsession_free(session);
+ err:
+  return res;
+}
+
+/*
+  pool_get_session() returns an idle session where the mailbox of the
+  folder is selected, else a new session, else the idle session that
+  was used the least recently. NULL is returned when all the sessions
+  are used.
+*/
+
+static int pool_get_session_no_lock(struct mailstorage * storage,
+    struct mailfolder * folder, mailsession ** result)
+{
+  struct mailstorage_pool * pool;
+  struct pool_session * pool_session;
+  struct pool_session * lru_session;
+  unsigned int i;
+  int r;
+
+  pool = storage->sto_pool;
+  * result = NULL;
+
+  if ((pool->max_sessions == 0) || (folder->fld_pathname == NULL))
+    return MAIL_NO_ERROR;
+
+  pool_close_idle_sessions_no_lock(pool, 0);
+
+  i = 0;
+  while (i < carray_count(pool->sessions)) {
+    pool_session = carray_get(pool->sessions, i);
+    if ((pool_session->folder == NULL) &&
+        (strcmp(pool_session->pathname, folder->fld_pathname) == 0)) {
+      /* the connection may have been closed by the server */
+      r = mailsession_noop(pool_session->session);
+      if ((r == MAIL_NO_ERROR) || (r == MAIL_ERROR_NOT_IMPLEMENTED))
+        goto found;
+
+      pool_session_close(pool, i);
+      continue;
+    }
+    i ++;
+  }
+
+  if ((carray_count(pool->sessions) < pool->max_sessions) &&
+      server_session_acquire(pool->server_key)) {
+    r = pool_open_session(storage, folder, &pool_session);
+    if (r != MAIL_NO_ERROR) {
+      server_session_release(pool->server_key);
+      return r;
+    }
+
+    goto found;
+  }
+
+  lru_session = NULL;
+  for(i = 0 ; i < carray_count(pool->sessions) ; i ++) {
+    pool_session = carray_get(pool->sessions, i);
+    if (pool_session->folder != NULL)
+      continue;
+    if ((lru_session == NULL) ||
+        (pool_session->last_use < lru_session->last_use))
+      lru_session = pool_session;
+  }
+
+  if (lru_session == NULL)
+    return MAIL_NO_ERROR;
+
+  pool_session = lru_session;
+  r = pool_select(pool_session, folder);
+  if (r != MAIL_NO_ERROR) {
+    for(i = 0 ; i < carray_count(pool->sessions) ; i ++) {
+      if (carray_get(pool->sessions, i) == pool_session) {
+        pool_session_close(pool, i);
+        break;
+      }
+    }
+    return r;
+  }
+
+ found:
+  pool_session->folder = folder;
+  pool_session->last_use = time(NULL);
+  * result = pool_session->session;
+
+  return MAIL_NO_ERROR;
+}
+
+static int pool_get_session(struct mailstorage * storage,
+    struct mailfolder * folder, mailsession ** result)
+{
+  int r;
+
+  POOL_LOCK(storage->sto_pool);
+  r = pool_get_session_no_lock(storage, folder, result);
+  POOL_UNLOCK(storage->sto_pool);
+
+  return r;
+}
+
+/*
+  pool_release_session() gives the session back to the pool, it returns
+  0 if the session does not belong to the pool.
+*/
+
+static int pool_release_session(struct mailstorage * storage,
+    mailsession * session)
+{
+  struct mailstorage_pool * pool;
+  unsigned int i;
+
+  pool = storage->sto_pool;
+  if (pool == NULL)
+    return 0;
+
+  POOL_LOCK(pool);
+  for(i = 0 ; i < carray_count(pool->sessions) ; i ++) {
+    struct pool_session * pool_session;
+
+    pool_session = carray_get(pool->sessions, i);
+    if (pool_session->session != session)
+      continue;
+
+    pool_session->folder = NULL;
+    pool_session->last_use = time(NULL);
+
+    /* the pool was reduced meanwhile */
+    if (carray_count(pool->sessions) > pool->max_sessions)
+      pool_session_close(pool, i);
+    else
+      pool_close_idle_sessions_no_lock(pool, 0);
+    POOL_UNLOCK(pool);
+
+    return 1;
+  }
+  POOL_UNLOCK(pool);
+
+  return 0;
+}
+
+LIBETPAN_EXPORT
+int mailstorage_set_session_pool(struct mailstorage * storage,
+    unsigned int max_sessions, time_t idle_timeout)
+{
+  struct mailstorage_pool * pool;
+  unsigned int i;
+
+  pool = storage->sto_pool;
+
+  if (max_sessions == 0) {
+    if (pool == NULL)
+      return MAIL_NO_ERROR;
+
+    /* the sessions used by folders are closed when they are released */
+    POOL_LOCK(pool);
+    pool->max_sessions = 0;
+    pool_close_idle_sessions_no_lock(pool, 1);
+    POOL_UNLOCK(pool);
+
+    return MAIL_NO_ERROR;
+  }
+
+  if ((storage->sto_driver == NULL) ||
+      (storage->sto_driver->sto_new_session == NULL))
+    return MAIL_ERROR_NOT_IMPLEMENTED;
+
+  if (pool == NULL) {
+    pool = pool_new(storage);
+    if (pool == NULL)
+      return MAIL_ERROR_MEMORY;
+    storage->sto_pool = pool;
+  }
+
+  POOL_LOCK(pool);
+  pool->max_sessions = max_sessions;
+  pool->idle_timeout = idle_timeout;
+
+  /* the pool is reduced */
+  i = 0;
+  while ((carray_count(pool->sessions) > max_sessions) &&
+      (i < carray_count(pool->sessions))) {
+    struct pool_session * pool_session;
+
+    pool_session = carray_get(pool->sessions, i);
+    if (pool_session->folder == NULL) {
+      pool_session_close(pool, i);
+      continue;
+    }
+    i ++;
+  }
+  POOL_UNLOCK(pool);
+
+  return MAIL_NO_ERROR;
+}
+
+LIBETPAN_EXPORT
+void mailstorage_close_idle_sessions(struct mailstorage * storage)
+{
+  if (storage->sto_pool == NULL)
+    return;
+
+  pool_close_idle_sessions(storage->sto_pool, 0);
+}
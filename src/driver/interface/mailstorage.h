@@ -79,6 +79,57 @@ LIBETPAN_EXPORT
 int mailstorage_noop(struct mailstorage * storage);
 
 
+/* session pool */
+
+/*
+  mailstorage_set_session_pool() enables a pool of sessions for the
+  folders of the storage, so that folders used at the same time have
+  their own connection instead of selecting their mailbox in turn on the
+  session of the storage.
+
+  @param max_sessions is the number of sessions of the pool, in addition
+    to the session of the storage. When all of them are used, the next
+    folders share the session of the storage. 0 disables the pool,
+    which is the default.
+
+  @param idle_timeout is the delay in seconds after which a session that
+    is no more used by a folder is closed. Until then, it is given back
+    first to the folder that used it last, which avoids to select the
+    mailbox again.
+
+  @return MAIL_ERROR_NOT_IMPLEMENTED is returned if the driver of the
+    storage cannot create additional sessions.
+
+  The pool can be changed and its folders connected from several
+  threads, but the first call that enables the pool must be made
+  before the folders of the storage are used by other threads.
+*/
+
+LIBETPAN_EXPORT
+int mailstorage_set_session_pool(struct mailstorage * storage,
+    unsigned int max_sessions, time_t idle_timeout);
+
+/*
+  mailstorage_close_idle_sessions() closes the sessions of the pool that
+  were not used for longer than the idle timeout. This is also done when
+  a folder is connected or disconnected, an application can call it
+  regularly to close the connections earlier.
+*/
+
+LIBETPAN_EXPORT
+void mailstorage_close_idle_sessions(struct mailstorage * storage);
+
+/*
+  mailstorage_set_max_server_sessions() limits the number of sessions
+  opened by the pools of all the storages on a same server (same
+  address and port). The main session of each storage is not counted.
+  0 means no limit, which is the default.
+*/
+
+LIBETPAN_EXPORT
+void mailstorage_set_max_server_sessions(unsigned int max_sessions);
+
+
 /* folder */
 
 LIBETPAN_EXPORT
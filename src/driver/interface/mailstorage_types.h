@@ -44,6 +44,7 @@ extern "C" {
 #endif
 
 struct mailstorage;
+struct mailstorage_pool;
 
 typedef struct mailstorage_driver mailstorage_driver;
 
@@ -91,6 +92,14 @@ typedef struct mailstorage_driver mailstorage_driver;
       It depends on the efficiency of the mail driver.
 
   - uninitialize() frees the data created with mailstorage constructor.
+
+  - new_session() creates a new session, independant from the session
+      used by the storage, with no mailbox selected. It is optional and
+      used by the session pool.
+
+  - get_server_key() writes the identifier of the server of the storage,
+      such as "server:port", the number of sessions opened by the pools
+      on a server can be limited. It is optional.
 */
 
 struct mailstorage_driver {
@@ -99,6 +108,10 @@ struct mailstorage_driver {
   int (* sto_get_folder_session)(struct mailstorage * storage,
       char * pathname, mailsession ** result);
   void (* sto_uninitialize)(struct mailstorage * storage);
+  int (* sto_new_session)(struct mailstorage * storage,
+      mailsession ** result);
+  int (* sto_get_server_key)(struct mailstorage * storage,
+      char * key, size_t size);
 };
 
 /*
@@ -114,6 +127,9 @@ struct mailstorage_driver {
   - driver is the driver for the storage.
 
   - shared_folders is the list of folders returned by the storage.
+
+  - pool is the pool of sessions of the folders, NULL when it is not
+      enabled (see mailstorage_set_session_pool()).
 */
 
 struct mailstorage {
@@ -124,6 +140,8 @@ struct mailstorage {
   clist * sto_shared_folders; /* list of (struct mailfolder *) */
   
   void * sto_user_data;
+  
+  struct mailstorage_pool * sto_pool;
 };
 
 
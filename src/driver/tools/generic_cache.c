@@ -311,6 +311,125 @@ static int generic_flags_write(MMAPString * mmapstr, size_t * indx,
 
 
 
+/*
+  the compact flags are read and written with the same format as
+  mail_flags, the keywords are interned directly from the buffer
+*/
+
+static int generic_flags_compact_read(MMAPString * mmapstr, size_t * indx,
+    struct mail_keyword_table * table, struct mail_flags_compact * result)
+{
+  struct mail_flags_compact compact;
+  uint32_t value;
+  uint32_t count;
+  uint32_t i;
+  int r;
+  int res;
+
+  mail_flags_compact_init(&compact);
+
+  r = mailimf_cache_int_read(mmapstr, indx, &value);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto err;
+  }
+  compact.fc_flags = value;
+
+  r = mailimf_cache_int_read(mmapstr, indx, &count);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto err;
+  }
+
+  for(i = 0 ; i < count ; i ++) {
+    char * keyword;
+    size_t length;
+    uint32_t keyword_index;
+
+    r = mailimf_cache_string_ref_read(mmapstr, indx, &keyword, &length);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+    if (keyword == NULL)
+      continue;
+
+    r = mail_keyword_table_intern(table, keyword, length, &keyword_index);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+
+    r = mail_flags_compact_add_keyword(&compact, keyword_index);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+  }
+
+  mail_flags_compact_clear(result);
+  * result = compact;
+
+  return MAIL_NO_ERROR;
+
+ free:
+  mail_flags_compact_clear(&compact);
+ err:
+  return res;
+}
+
+static int generic_flags_compact_keyword_write(MMAPString * mmapstr,
+    size_t * indx, struct mail_keyword_table * table, uint32_t keyword_index)
+{
+  const char * keyword;
+
+  keyword = mail_keyword_table_get(table, keyword_index);
+  if (keyword == NULL)
+    return MAIL_ERROR_INVAL;
+
+  return mailimf_cache_string_write(mmapstr, indx,
+      (char *) keyword, strlen(keyword));
+}
+
+static int generic_flags_compact_write(MMAPString * mmapstr, size_t * indx,
+    struct mail_keyword_table * table, struct mail_flags_compact * flags)
+{
+  uint32_t count;
+  uint32_t i;
+  int r;
+
+  r = mailimf_cache_int_write(mmapstr, indx,
+      flags->fc_flags & ~MAIL_FLAG_NEW);
+  if (r != MAIL_NO_ERROR)
+    return r;
+
+  count = flags->fc_extra_count;
+  for(i = 0 ; i < MAIL_FLAGS_COMPACT_BITS ; i ++)
+    if ((flags->fc_keywords & (1U << i)) != 0)
+      count ++;
+
+  r = mailimf_cache_int_write(mmapstr, indx, count);
+  if (r != MAIL_NO_ERROR)
+    return r;
+
+  for(i = 0 ; i < MAIL_FLAGS_COMPACT_BITS ; i ++) {
+    if ((flags->fc_keywords & (1U << i)) == 0)
+      continue;
+    r = generic_flags_compact_keyword_write(mmapstr, indx, table, i);
+    if (r != MAIL_NO_ERROR)
+      return r;
+  }
+
+  for(i = 0 ; i < flags->fc_extra_count ; i ++) {
+    r = generic_flags_compact_keyword_write(mmapstr, indx, table,
+        flags->fc_extra[i]);
+    if (r != MAIL_NO_ERROR)
+      return r;
+  }
+
+  return MAIL_NO_ERROR;
+}
+
 static struct mail_flags * mail_flags_dup(struct mail_flags * flags)
 {
   clist * list;
@@ -741,6 +860,53 @@ int generic_cache_flags_write(struct mail_cache_db * cache_db,
   return res;
 }
 
+int generic_cache_flags_compact_read(struct mail_cache_db * cache_db,
+    MMAPString * mmapstr, char * keyname,
+    struct mail_keyword_table * table, struct mail_flags_compact * result)
+{
+  int r;
+  size_t cur_token;
+  void * data;
+  size_t data_len;
+
+  data = NULL;
+  data_len = 0;
+  r = mail_cache_db_get(cache_db, keyname, strlen(keyname), &data, &data_len);
+  if (r != 0)
+    return MAIL_ERROR_CACHE_MISS;
+
+  r = mail_serialize_clear(mmapstr, &cur_token);
+  if (r != MAIL_NO_ERROR)
+    return r;
+
+  if (mmap_string_append_len(mmapstr, data, data_len) == NULL)
+    return MAIL_ERROR_MEMORY;
+
+  return generic_flags_compact_read(mmapstr, &cur_token, table, result);
+}
+
+int generic_cache_flags_compact_write(struct mail_cache_db * cache_db,
+    MMAPString * mmapstr, char * keyname,
+    struct mail_keyword_table * table, struct mail_flags_compact * flags)
+{
+  int r;
+  size_t cur_token;
+
+  r = mail_serialize_clear(mmapstr, &cur_token);
+  if (r != MAIL_NO_ERROR)
+    return r;
+
+  r = generic_flags_compact_write(mmapstr, &cur_token, table, flags);
+  if (r != MAIL_NO_ERROR)
+    return r;
+
+  r = mail_cache_db_put(cache_db, keyname, strlen(keyname),
+      mmapstr->str, mmapstr->len);
+  if (r != 0)
+    return MAIL_ERROR_FILE;
+
+  return MAIL_NO_ERROR;
+}
 
 int generic_cache_delete(struct mail_cache_db * cache_db,
     char * keyname)
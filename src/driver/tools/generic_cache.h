@@ -43,6 +43,7 @@ extern "C" {
 
 #include "generic_cache_types.h"
 #include "mailmessage_types.h"
+#include "maildriver_keywords.h"
 #include "chash.h"
 #include "carray.h"
 #include "mail_cache_db_types.h"
@@ -68,6 +69,21 @@ int generic_cache_flags_write(struct mail_cache_db * cache_db,
     MMAPString * mmapstr,
     char * keyname, struct mail_flags * flags);
   
+/*
+  generic_cache_flags_compact_read() and generic_cache_flags_compact_write()
+  use the same format as generic_cache_flags_read() and
+  generic_cache_flags_write(), without building a mail_flags
+  for each message. The keywords are interned in the given table.
+*/
+
+int generic_cache_flags_compact_read(struct mail_cache_db * cache_db,
+    MMAPString * mmapstr, char * keyname,
+    struct mail_keyword_table * table, struct mail_flags_compact * result);
+
+int generic_cache_flags_compact_write(struct mail_cache_db * cache_db,
+    MMAPString * mmapstr, char * keyname,
+    struct mail_keyword_table * table, struct mail_flags_compact * flags);
+
 int generic_cache_delete(struct mail_cache_db * cache_db, char * keyname);
 
 #if 0
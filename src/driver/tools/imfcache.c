@@ -278,6 +278,40 @@ int mailimf_cache_string_read(MMAPString * mmapstr, size_t * indx,
   return MAIL_NO_ERROR;
 }
 
+int mailimf_cache_string_ref_read(MMAPString * mmapstr, size_t * indx,
+    char ** result, size_t * result_len)
+{
+  int r;
+  uint32_t length;
+  uint32_t type;
+  char * str;
+
+  r = mailimf_cache_int_read(mmapstr, indx, &type);
+  if (r != MAIL_NO_ERROR)
+    return r;
+
+  if (type == CACHE_NULL_POINTER) {
+    str = NULL;
+    length = 0;
+  }
+  else {
+    r = mailimf_cache_int_read(mmapstr, indx, &length);
+    if (r != MAIL_NO_ERROR)
+      return r;
+
+    if (* indx + length > mmapstr->len)
+      return MAIL_ERROR_FILE;
+
+    str = mmapstr->str + * indx;
+    * indx += length;
+  }
+
+  * result = str;
+  * result_len = length;
+
+  return MAIL_NO_ERROR;
+}
+
 int mailimf_cache_fields_write(MMAPString * mmapstr, size_t * indx,
 			       struct mailimf_fields * fields)
 {
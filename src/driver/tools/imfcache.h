@@ -63,6 +63,15 @@ int mailimf_cache_int_read(MMAPString * mmapstr, size_t * indx,
 int mailimf_cache_string_read(MMAPString * mmapstr, size_t * indx,
 			      char ** result);
 
+/*
+  mailimf_cache_string_ref_read() does not copy the string,
+  (* result) points into the buffer, it is not terminated and is
+  NULL for a NULL string.
+*/
+
+int mailimf_cache_string_ref_read(MMAPString * mmapstr, size_t * indx,
+    char ** result, size_t * result_len);
+
 int mailimf_cache_fields_write(MMAPString * mmapstr, size_t * indx,
 			       struct mailimf_fields * fields);
 int mailimf_cache_fields_read(MMAPString * mmapstr, size_t * indx,
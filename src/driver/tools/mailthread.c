@@ -47,9 +47,11 @@
 
 #include "mail.h"
 #include "chash.h"
+#include "cohash.h"
 #include "carray.h"
 #include "clist.h"
 #include "mailmessage.h"
+#include "maildriver.h"
 #include "timeutils.h"
 #ifdef WIN32
 #	include "win_etpan.h"
@@ -68,6 +70,22 @@ static inline char * get_msg_id(mailmessage * msg)
     return NULL;
 }
 
+/*
+  a message without Message-ID or with a duplicate one gets a unique
+  key, a parsed Message-ID never contains '<' so they can not
+  collide with a real one
+*/
+
+static char * get_synthetic_msg_id(unsigned int * counter)
+{
+  char msgid[32];
+
+  snprintf(msgid, sizeof(msgid), "<thread-%u>", * counter);
+  (* counter) ++;
+
+  return strdup(msgid);
+}
+
 static inline clist * get_ref(mailmessage * msg)
 {
   if (msg->msg_single_fields.fld_references != NULL)
@@ -181,7 +199,7 @@ static inline int skip_subj_refwd(char * subj, size_t * begin,
   return TRUE;
 }
 
-static inline int skip_subj_leader(struct mailmessage_tree * tree,
+static inline int skip_subj_leader(int * p_is_reply,
 				   char * subj, size_t * begin,
 				   size_t length)
 {
@@ -201,7 +219,7 @@ static inline int skip_subj_leader(struct mailmessage_tree * tree,
     }
     if (!skip_subj_refwd(subj, &cur_token, length))
       return FALSE;
-    tree->node_is_reply = TRUE;
+    * p_is_reply = TRUE;
   }
 
   * begin = cur_token;
@@ -211,7 +229,7 @@ static inline int skip_subj_leader(struct mailmessage_tree * tree,
 
 
 static char * extract_subject(char * default_from,
-    struct mailmessage_tree * tree,
+    int * p_is_reply,
     char * str)
 {
   char * subj;
@@ -324,7 +342,7 @@ static char * extract_subject(char * default_from,
 
 	subj[len - 5] = '\0';
 	len -= 5;
-	tree->node_is_reply = TRUE;
+	* p_is_reply = TRUE;
       }
     }
 
@@ -338,7 +356,7 @@ static char * extract_subject(char * default_from,
 	subj-leader ABNF.
       */
     
-      if (skip_subj_leader(tree, subj, &begin, len))
+      if (skip_subj_leader(p_is_reply, subj, &begin, len))
 	do_repeat_5 = TRUE;
 
       /*
@@ -382,7 +400,7 @@ static char * extract_subject(char * default_from,
 	if (subj[len - 1] != ']')
 	  saved_begin = begin;
 	else {
-	  tree->node_is_reply = TRUE;
+	  * p_is_reply = TRUE;
 
 	  subj[len - 1] = '\0';
 	  len --;
@@ -414,15 +432,93 @@ static char * extract_subject(char * default_from,
   return subj;
 }
 
-static int get_extracted_subject(char * default_from,
+/*
+  base subjects are cached by raw subject, the messages of a thread
+  usually have the same subject
+*/
+
+struct subject_cache_entry {
+  char * base_subject;
+  int is_reply;
+};
+
+static cohash * subject_cache_new(void)
+{
+  return cohash_new(128, CHASH_COPYKEY);
+}
+
+static void subject_cache_free(cohash * subject_cache)
+{
+  cohashiter * iter;
+
+  for(iter = cohash_begin(subject_cache) ; iter != NULL ;
+      iter = cohash_next(subject_cache, iter)) {
+    struct subject_cache_entry * entry;
+    chashdatum value;
+
+    cohash_value(iter, &value);
+    entry = value.data;
+    free(entry->base_subject);
+    free(entry);
+  }
+  cohash_free(subject_cache);
+}
+
+static char * extract_subject_cached(cohash * subject_cache,
+    char * default_from, int * p_is_reply, char * str)
+{
+  struct subject_cache_entry * entry;
+  chashdatum key;
+  chashdatum value;
+  char * subj;
+  int is_reply;
+  int r;
+
+  key.data = str;
+  key.len = (unsigned int) strlen(str);
+  if (cohash_get(subject_cache, &key, &value) == 0) {
+    entry = value.data;
+    if (entry->is_reply)
+      * p_is_reply = TRUE;
+    return strdup(entry->base_subject);
+  }
+
+  is_reply = FALSE;
+  subj = extract_subject(default_from, &is_reply, str);
+  if (subj == NULL)
+    return NULL;
+  if (is_reply)
+    * p_is_reply = TRUE;
+
+  /* the subject is not cached on error */
+  entry = malloc(sizeof(* entry));
+  if (entry == NULL)
+    return subj;
+  entry->base_subject = subj;
+  entry->is_reply = is_reply;
+
+  value.data = entry;
+  value.len = 0;
+  r = cohash_set(subject_cache, &key, &value, NULL);
+  if (r < 0) {
+    free(entry);
+    return subj;
+  }
+
+  return strdup(subj);
+}
+
+static int get_extracted_subject(cohash * subject_cache,
+    char * default_from,
     struct mailmessage_tree * tree,
     char ** result)
 {
   if (tree->node_msg->msg_single_fields.fld_subject != NULL) {
     char * subj;
 
-    subj = extract_subject(default_from,
-        tree, tree->node_msg->msg_single_fields.fld_subject->sbj_value);
+    subj = extract_subject_cached(subject_cache, default_from,
+        &tree->node_is_reply,
+        tree->node_msg->msg_single_fields.fld_subject->sbj_value);
     if (subj == NULL)
       return MAIL_ERROR_MEMORY;
     
@@ -434,7 +530,8 @@ static int get_extracted_subject(char * default_from,
   return MAIL_ERROR_SUBJECT_NOT_FOUND;
 }
 
-static int get_thread_subject(char * default_from,
+static int get_thread_subject(cohash * subject_cache,
+    char * default_from,
     struct mailmessage_tree * tree,
     char ** result)
 {
@@ -444,7 +541,8 @@ static int get_thread_subject(char * default_from,
 
   if (tree->node_msg != NULL) {
     if (tree->node_msg->msg_fields != NULL) {
-      r = get_extracted_subject(default_from, tree, &thread_subject);
+      r = get_extracted_subject(subject_cache, default_from, tree,
+          &thread_subject);
 
       if (r != MAIL_NO_ERROR)
 	return r;
@@ -459,7 +557,8 @@ static int get_thread_subject(char * default_from,
     
     child = carray_get(tree->node_children, i);
 
-    r = get_thread_subject(default_from, child, &thread_subject);
+    r = get_thread_subject(subject_cache, default_from, child,
+        &thread_subject);
     
     switch (r) {
     case MAIL_NO_ERROR:
@@ -506,20 +605,17 @@ static inline time_t get_date(mailmessage * msg)
   return timeval;
 }
 
+/* the parents of maybe_child are followed, this is O(depth) */
+
 static inline int is_descendant(struct mailmessage_tree * node,
 			 struct mailmessage_tree * maybe_child)
 {
-  unsigned int i;
-
-  for(i = 0 ; i < carray_count(node->node_children) ; i++) {
-    struct mailmessage_tree * tree;
+  struct mailmessage_tree * tree;
 
-    tree = carray_get(node->node_children, i);
-    if (tree == maybe_child)
+  for(tree = maybe_child->node_parent ; tree != NULL ;
+      tree = tree->node_parent) {
+    if (tree == node)
       return TRUE;
-    if (carray_count(tree->node_children) != 0)
-      if (is_descendant(tree, maybe_child))
-	return TRUE;
   }
 
   return FALSE;
@@ -678,6 +774,76 @@ static int tree_subj_time_comp(struct mailmessage_tree ** ptree1,
 
 
 
+/*
+  sort with the order of mailthread_tree_timecomp(), the dates and
+  message numbers are read once in an array of keys
+*/
+
+struct sort_key {
+  time_t date;
+  uint32_t index;
+  struct mailmessage_tree * tree;
+};
+
+#define SORT_KEY_STACK_COUNT 64
+
+static int sort_key_comp(const void * p1, const void * p2)
+{
+  const struct sort_key * key1;
+  const struct sort_key * key2;
+
+  key1 = p1;
+  key2 = p2;
+
+  if ((key1->date == (time_t) -1) || (key2->date == (time_t) -1))
+    return (int) ((long) key1->index - (long) key2->index);
+
+  if (key1->date < key2->date)
+    return -1;
+  if (key1->date > key2->date)
+    return 1;
+  return 0;
+}
+
+static int sort_by_date(carray * children)
+{
+  struct sort_key stack_keys[SORT_KEY_STACK_COUNT];
+  struct sort_key * keys;
+  unsigned int count;
+  unsigned int i;
+
+  count = carray_count(children);
+  if (count < 2)
+    return 0;
+
+  if (count <= SORT_KEY_STACK_COUNT)
+    keys = stack_keys;
+  else {
+    keys = malloc(count * sizeof(* keys));
+    if (keys == NULL)
+      return -1;
+  }
+
+  for(i = 0 ; i < count ; i ++) {
+    struct mailmessage_tree * tree;
+
+    tree = carray_get(children, i);
+    keys[i].date = tree_get_date(tree);
+    keys[i].index = tree_get_index(tree);
+    keys[i].tree = tree;
+  }
+
+  qsort(keys, count, sizeof(* keys), sort_key_comp);
+
+  for(i = 0 ; i < count ; i ++)
+    carray_set(children, i, keys[i].tree);
+
+  if (keys != stack_keys)
+    free(keys);
+
+  return 0;
+}
+
 int mail_thread_sort(struct mailmessage_tree * tree,
     int (* comp_func)(struct mailmessage_tree **,
         struct mailmessage_tree **),
@@ -701,6 +867,10 @@ int mail_thread_sort(struct mailmessage_tree * tree,
     }
   }
 
+  if ((comp_func == mailthread_tree_timecomp) &&
+      (sort_by_date(tree->node_children) == 0))
+    return MAIL_NO_ERROR;
+
   qsort(carray_data(tree->node_children), carray_count(tree->node_children),
       sizeof(struct mailmessage_tree *),
 	(int (*)(const void *, const void *)) comp_func);
@@ -722,15 +892,17 @@ mail_build_thread_references(char * default_from,
 {
   int r;
   int res;
-  chash * msg_id_hash;
+  cohash * msg_id_hash;
   unsigned int cur;
   struct mailmessage_tree * root;
   carray * rootlist;
   carray * msg_list;
   unsigned int i;
-  chash * subject_hash;
+  cohash * subject_hash;
+  cohash * subject_cache;
+  unsigned int synthetic_count;
 
-  msg_id_hash = chash_new(128, CHASH_COPYNONE);
+  msg_id_hash = cohash_new(carray_count(env_list->msg_tab), CHASH_COPYNONE);
   if (msg_id_hash == NULL) {
     res = MAIL_ERROR_MEMORY;
     goto err;
@@ -743,6 +915,7 @@ mail_build_thread_references(char * default_from,
   }
   rootlist = root->node_children;
 
+  synthetic_count = 0;
   msg_list = carray_new(128);
   if (msg_list == NULL) {
     res = MAIL_ERROR_MEMORY;
@@ -768,14 +941,14 @@ mail_build_thread_references(char * default_from,
       msgid = get_msg_id(msg);
 
       if (msgid == NULL) {
-	msgid = mailimf_get_message_id();
+	msgid = get_synthetic_msg_id(&synthetic_count);
       }
       else {
 	hashkey.data = msgid;
 	hashkey.len = (unsigned int) strlen(msgid);
 	
-	if (chash_get(msg_id_hash, &hashkey, &hashdata) == 0)
-	  msgid = mailimf_get_message_id();
+	if (cohash_get(msg_id_hash, &hashkey, &hashdata) == 0)
+	  msgid = get_synthetic_msg_id(&synthetic_count);
 	else
 	  msgid = strdup(msgid);
       }
@@ -806,7 +979,7 @@ mail_build_thread_references(char * default_from,
       hashdata.data = env_tree;
       hashdata.len = 0;
       
-      r = chash_set(msg_id_hash, &hashkey, &hashdata, &hashold);
+      r = cohash_set(msg_id_hash, &hashkey, &hashdata, &hashold);
       if (r < 0) {
 	res = MAIL_ERROR_MEMORY;
 	goto free_list;
@@ -860,7 +1033,7 @@ mail_build_thread_references(char * default_from,
 	hashkey.data = msgid;
 	hashkey.len = (unsigned int) strlen(msgid);
 	
-	r = chash_get(msg_id_hash, &hashkey, &hashdata);
+	r = cohash_get(msg_id_hash, &hashkey, &hashdata);
 	if (r < 0) {
 	  /* not found, create a dummy message */
 	  msgid = strdup(msgid);
@@ -889,7 +1062,7 @@ mail_build_thread_references(char * default_from,
 	  hashdata.data = env_cur_tree;
 	  hashdata.len = 0;
 	  
-	  r = chash_set(msg_id_hash, &hashkey, &hashdata, &hashold);
+	  r = cohash_set(msg_id_hash, &hashkey, &hashdata, &hashold);
 	  if (r < 0) {
 	    res = MAIL_ERROR_MEMORY;
 	    goto free_list;
@@ -946,7 +1119,7 @@ mail_build_thread_references(char * default_from,
     }
   }
 
-  chash_free(msg_id_hash);
+  cohash_free(msg_id_hash);
   msg_id_hash = NULL;
 
   /* (2) Gather together all of the messages that have no parents
@@ -1003,12 +1176,18 @@ mail_build_thread_references(char * default_from,
        messages.
     */
 
-    subject_hash = chash_new(128, CHASH_COPYVALUE);
+    subject_hash = cohash_new(carray_count(rootlist), CHASH_COPYVALUE);
     if (subject_hash == NULL) {
       res = MAIL_ERROR_MEMORY;
       goto free_list;
     }
 
+    subject_cache = subject_cache_new();
+    if (subject_cache == NULL) {
+      res = MAIL_ERROR_MEMORY;
+      goto free_subject_hash;
+    }
+
     /*
       (B) Populate the subject table with one message per
       extracted subject.  For each child of the root:
@@ -1028,7 +1207,8 @@ mail_build_thread_references(char * default_from,
 	if the current message is a dummy.
       */
 
-      r = get_thread_subject(default_from, env_tree, &base_subject);
+      r = get_thread_subject(subject_cache, default_from, env_tree,
+          &base_subject);
 
       /*
 	(ii) If the extracted subject is empty, skip this
@@ -1051,7 +1231,7 @@ mail_build_thread_references(char * default_from,
       }
       else {
 	res = r;
-	goto free_subject_hash;
+	goto free_subject_cache;
       }
 
       env_tree->node_base_subject = base_subject;
@@ -1064,7 +1244,7 @@ mail_build_thread_references(char * default_from,
       key.data = base_subject;
       key.len = (unsigned int) strlen(base_subject);
 
-      r = chash_get(subject_hash, &key, &data);
+      r = cohash_get(subject_hash, &key, &data);
 
       if (r < 0) {
 	/*
@@ -1076,10 +1256,10 @@ mail_build_thread_references(char * default_from,
 	data.data = &cur;
 	data.len = sizeof(cur);
 
-	r = chash_set(subject_hash, &key, &data, NULL);
+	r = cohash_set(subject_hash, &key, &data, NULL);
 	if (r < 0) {
 	  res = MAIL_ERROR_MEMORY;
-	  goto free_subject_hash;
+	  goto free_subject_cache;
 	}
       }
       else {
@@ -1115,10 +1295,10 @@ mail_build_thread_references(char * default_from,
 	  data.data = &cur;
 	  data.len = sizeof(cur);
 	
-	  r = chash_set(subject_hash, &key, &data, NULL);
+	  r = cohash_set(subject_hash, &key, &data, NULL);
 	  if (r < 0) {
 	    res = MAIL_ERROR_MEMORY;
-	    goto free_subject_hash;
+	    goto free_subject_cache;
 	  }
 	}
       }
@@ -1168,7 +1348,7 @@ mail_build_thread_references(char * default_from,
       key.data = env_tree->node_base_subject;
       key.len = (unsigned int) strlen(env_tree->node_base_subject);
 
-      r = chash_get(subject_hash, &key, &data);
+      r = cohash_get(subject_hash, &key, &data);
       if (r < 0)
 	goto next_msg;
 
@@ -1204,7 +1384,7 @@ mail_build_thread_references(char * default_from,
             carray_count(env_tree->node_children));
         if (r < 0) {
           res = MAIL_ERROR_MEMORY;
-          goto free_subject_hash;
+          goto free_subject_cache;
         }
 
         for(i = 0 ; i < carray_count(env_tree->node_children) ; i ++) {
@@ -1232,7 +1412,7 @@ mail_build_thread_references(char * default_from,
 	r = carray_add(main_tree->node_children, env_tree, NULL);
 	if (r < 0) {
 	  res = MAIL_ERROR_MEMORY;
-	  goto free_subject_hash;
+	  goto free_subject_cache;
 	}
         /* set parent */
         env_tree->node_parent = main_tree;
@@ -1251,7 +1431,7 @@ mail_build_thread_references(char * default_from,
 	r = carray_add(main_tree->node_children, env_tree, NULL);
 	if (r < 0) {
 	  res = MAIL_ERROR_MEMORY;
-	  goto free_subject_hash;
+	  goto free_subject_cache;
 	}
         /* set parent */
         env_tree->node_parent = main_tree;
@@ -1277,7 +1457,7 @@ mail_build_thread_references(char * default_from,
 	new_main_tree = mailmessage_tree_new(NULL, (time_t) -1, NULL);
 	if (new_main_tree == NULL) {
 	  res = MAIL_ERROR_MEMORY;
-	  goto free_subject_hash;
+	  goto free_subject_cache;
 	}
 
 	/* main_tree->node_base_subject is never NULL */
@@ -1286,7 +1466,7 @@ mail_build_thread_references(char * default_from,
 	if (base_subject == NULL) {
 	  mailmessage_tree_free(new_main_tree);
 	  res = MAIL_ERROR_MEMORY;
-	  goto free_subject_hash;
+	  goto free_subject_cache;
 	}
 
 	new_main_tree->node_base_subject = base_subject;
@@ -1295,13 +1475,13 @@ mail_build_thread_references(char * default_from,
 	if (r < 0) {
 	  mailmessage_tree_free(new_main_tree);
 	  res = MAIL_ERROR_MEMORY;
-	  goto free_subject_hash;
+	  goto free_subject_cache;
 	}
 
 	r = carray_add(new_main_tree->node_children, main_tree, NULL);
 	if (r < 0) {
 	  res = MAIL_ERROR_MEMORY;
-	  goto free_subject_hash;
+	  goto free_subject_cache;
 	}
         /* set parent */
         main_tree->node_parent = new_main_tree;
@@ -1311,7 +1491,7 @@ mail_build_thread_references(char * default_from,
 	r = carray_add(new_main_tree->node_children, env_tree, NULL);
 	if (r < 0) {
 	  res = MAIL_ERROR_MEMORY;
-	  goto free_subject_hash;
+	  goto free_subject_cache;
 	}
         /* set parent */
         env_tree->node_parent = new_main_tree;
@@ -1321,11 +1501,11 @@ mail_build_thread_references(char * default_from,
 	data.data = &last;
 	data.len = sizeof(last);
       
-	r = chash_set(subject_hash, &key, &data, NULL);
+	r = cohash_set(subject_hash, &key, &data, NULL);
 
 	if (r < 0) {
 	  res = MAIL_ERROR_MEMORY;
-	  goto free_subject_hash;
+	  goto free_subject_cache;
 	}
       }
 
@@ -1349,7 +1529,8 @@ mail_build_thread_references(char * default_from,
     }
     carray_set_size(rootlist, i);
     
-    chash_free(subject_hash);
+    subject_cache_free(subject_cache);
+    cohash_free(subject_hash);
   }
 
   /*
@@ -1390,8 +1571,10 @@ mail_build_thread_references(char * default_from,
 
   return MAIL_NO_ERROR;
 
+ free_subject_cache:
+  subject_cache_free(subject_cache);
  free_subject_hash:
-  chash_free(subject_hash);
+  cohash_free(subject_hash);
  free_list:
   if (msg_list != NULL) {
     for(i = 0 ; i < carray_count(msg_list) ; i ++)
@@ -1402,7 +1585,7 @@ mail_build_thread_references(char * default_from,
   mailmessage_tree_free_recursive(root);
  free_hash:
   if (msg_id_hash != NULL)
-    chash_free(msg_id_hash);
+    cohash_free(msg_id_hash);
  err:
   return res;
 }
@@ -1422,12 +1605,19 @@ mail_build_thread_orderedsubject(char * default_from,
   struct mailmessage_tree * root;
   int res;
   int r;
+  cohash * subject_cache;
   struct mailmessage_tree * current_thread;
 
+  subject_cache = subject_cache_new();
+  if (subject_cache == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+
   root = mailmessage_tree_new(NULL, (time_t) -1, NULL);
   if (root == NULL) {
     res = MAIL_ERROR_MEMORY;
-    goto err;
+    goto free_subject_cache;
   }
   rootlist = root->node_children;
 
@@ -1466,7 +1656,8 @@ mail_build_thread_orderedsubject(char * default_from,
 	goto free;
       }
 
-      r = get_extracted_subject(default_from, env_tree, &base_subject);
+      r = get_extracted_subject(subject_cache, default_from, env_tree,
+          &base_subject);
       switch (r) {
       case MAIL_NO_ERROR:
 	env_tree->node_base_subject = base_subject;
@@ -1563,12 +1754,16 @@ mail_build_thread_orderedsubject(char * default_from,
     goto free;
   }
 
+  subject_cache_free(subject_cache);
+
   * result = root;
 
   return MAIL_NO_ERROR;
 
  free:
   mailmessage_tree_free_recursive(root);
+ free_subject_cache:
+  subject_cache_free(subject_cache);
  err:
   return res;
 }
@@ -1586,11 +1781,18 @@ mail_build_thread_none(char * default_from,
   struct mailmessage_tree * root;
   int res;
   int r;
+  cohash * subject_cache;
+
+  subject_cache = subject_cache_new();
+  if (subject_cache == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
 
   root = mailmessage_tree_new(NULL, (time_t) -1, NULL);
   if (root == NULL) {
     res = MAIL_ERROR_MEMORY;
-    goto err;
+    goto free_subject_cache;
   }
   rootlist = root->node_children;
 
@@ -1624,7 +1826,8 @@ mail_build_thread_none(char * default_from,
 	goto free;
       }
 
-      r = get_extracted_subject(default_from, env_tree, &base_subject);
+      r = get_extracted_subject(subject_cache, default_from, env_tree,
+          &base_subject);
       switch (r) {
       case MAIL_NO_ERROR:
 	env_tree->node_base_subject = base_subject;
@@ -1649,12 +1852,16 @@ mail_build_thread_none(char * default_from,
     goto free;
   }
   
+  subject_cache_free(subject_cache);
+
   * result = root;
 
   return MAIL_NO_ERROR;
 
  free:
   mailmessage_tree_free_recursive(root);
+ free_subject_cache:
+  subject_cache_free(subject_cache);
  err:
   return res;
 }
@@ -1692,3 +1899,1352 @@ int mail_build_thread(int type, char * default_from,
     return MAIL_ERROR_NOT_IMPLEMENTED;
   }
 }
+
+int mail_build_session_thread(mailsession * session, int type,
+    char * default_from,
+    struct mailmessage_list * env_list,
+    struct mailmessage_tree ** result,
+    int (* comp_func)(struct mailmessage_tree **,
+        struct mailmessage_tree **))
+{
+  int r;
+
+  r = mailsession_build_thread(session, type, env_list, result);
+  switch (r) {
+  case MAIL_NO_ERROR:
+    if (comp_func != NULL) {
+      r = mail_thread_sort(* result, comp_func, TRUE);
+      if (r != MAIL_NO_ERROR) {
+        mailmessage_tree_free_recursive(* result);
+        return r;
+      }
+    }
+    return MAIL_NO_ERROR;
+
+  case MAIL_ERROR_STREAM:
+  case MAIL_ERROR_CONNECT:
+  case MAIL_ERROR_FATAL:
+    /* the connection is lost, the envelopes could not be fetched either */
+    return r;
+
+  default:
+    /* the server can't or won't build the threads, build them locally */
+    break;
+  }
+
+  r = mailsession_get_envelopes_list(session, env_list);
+  if (r != MAIL_NO_ERROR)
+    return r;
+
+  return mail_build_thread(type, default_from, env_list, result, comp_func);
+}
+
+
+/*
+  incremental threading
+
+  The context keeps the containers of the references threading
+  (message-ID table and parent/child links) between two builds. A
+  container that has no parent is the root of a thread and caches the
+  tree built for this thread, only the threads changed since the last
+  build are built and sorted again. The subject merge and the sort of
+  the top-level siblings are done on each build, with the subjects
+  extracted when the messages were added.
+*/
+
+struct mail_thread_container {
+  char * msgid;
+  mailmessage * msg; /* NULL for a dummy */
+  time_t date;
+  char * base_subject;
+  int is_reply;
+  /* referenced containers, in the order of the references */
+  carray * refs;
+  /* messages that are present or reference this container */
+  unsigned int ref_count;
+
+  struct mail_thread_container * parent;
+  /*
+    candidate parents given by the references, in the order the links
+    were made, and the one that links the container to its parent
+  */
+  carray * links; /* array of (struct mail_thread_link *) */
+  struct mail_thread_link * parent_link;
+  carray * children;
+
+  /* the following fields are used by the root of a thread */
+  unsigned int root_index;
+  int dirty;
+  unsigned int dirty_index;
+  struct mailmessage_tree * thread;
+};
+
+/* a parent/child link made by the references of a message */
+struct mail_thread_link {
+  struct mail_thread_container * parent;
+  /* container of the message that has the references */
+  struct mail_thread_container * owner;
+};
+
+/* children of a cached tree changed by the subject merge */
+struct mail_thread_undo {
+  struct mailmessage_tree * node;
+  carray * children;
+};
+
+struct mail_thread_context {
+  int use_subject;
+  char * default_from;
+  int (* comp_func)(struct mailmessage_tree **,
+      struct mailmessage_tree **);
+
+  cohash * msgid_hash;
+  cohash * msg_hash;
+  unsigned int synthetic_count;
+  cohash * subject_cache;
+  carray * roots;
+  carray * dirty;
+
+  struct mailmessage_tree * root;
+  carray * merge_list;
+  carray * undo_list;
+};
+
+static void thread_restore(struct mail_thread_context * ctx)
+{
+  unsigned int i;
+
+  /* latest changes first, the first saved children are kept */
+  i = carray_count(ctx->undo_list);
+  while (i > 0) {
+    struct mail_thread_undo * undo;
+    struct mailmessage_tree * node;
+    unsigned int j;
+
+    i --;
+    undo = carray_get(ctx->undo_list, i);
+    node = undo->node;
+    carray_free(node->node_children);
+    node->node_children = undo->children;
+    for(j = 0 ; j < carray_count(node->node_children) ; j ++) {
+      struct mailmessage_tree * child;
+
+      child = carray_get(node->node_children, j);
+      child->node_parent = node;
+    }
+    free(undo);
+  }
+  carray_set_size(ctx->undo_list, 0);
+
+  for(i = 0 ; i < carray_count(ctx->merge_list) ; i ++)
+    mailmessage_tree_free(carray_get(ctx->merge_list, i));
+  carray_set_size(ctx->merge_list, 0);
+
+  carray_set_size(ctx->root->node_children, 0);
+}
+
+/* the children of a cached node are copied before they are changed */
+
+static int thread_save_children(struct mail_thread_context * ctx,
+    struct mailmessage_tree * node)
+{
+  struct mail_thread_undo * undo;
+  carray * children;
+  unsigned int count;
+  int r;
+
+  count = carray_count(node->node_children);
+  children = carray_new(count + 1);
+  if (children == NULL)
+    goto err;
+  r = carray_set_size(children, count);
+  if (r < 0)
+    goto free_children;
+  if (count > 0)
+    memcpy(carray_data(children), carray_data(node->node_children),
+        count * sizeof(void *));
+
+  undo = malloc(sizeof(* undo));
+  if (undo == NULL)
+    goto free_children;
+  undo->node = node;
+  undo->children = node->node_children;
+
+  r = carray_add(ctx->undo_list, undo, NULL);
+  if (r < 0)
+    goto free_undo;
+
+  node->node_children = children;
+
+  return MAIL_NO_ERROR;
+
+ free_undo:
+  free(undo);
+ free_children:
+  carray_free(children);
+ err:
+  return MAIL_ERROR_MEMORY;
+}
+
+static int thread_mark_dirty(struct mail_thread_context * ctx,
+    struct mail_thread_container * container)
+{
+  int r;
+
+  while (container->parent != NULL)
+    container = container->parent;
+
+  if (container->dirty)
+    return MAIL_NO_ERROR;
+
+  r = carray_add(ctx->dirty, container, &container->dirty_index);
+  if (r < 0)
+    return MAIL_ERROR_MEMORY;
+  container->dirty = TRUE;
+
+  return MAIL_NO_ERROR;
+}
+
+static int thread_root_add(struct mail_thread_context * ctx,
+    struct mail_thread_container * container)
+{
+  int r;
+
+  r = carray_add(ctx->roots, container, &container->root_index);
+  if (r < 0)
+    return MAIL_ERROR_MEMORY;
+
+  return thread_mark_dirty(ctx, container);
+}
+
+static void thread_root_remove(struct mail_thread_context * ctx,
+    struct mail_thread_container * container)
+{
+  struct mail_thread_container * last;
+
+  last = carray_get(ctx->roots, carray_count(ctx->roots) - 1);
+  carray_set(ctx->roots, container->root_index, last);
+  last->root_index = container->root_index;
+  carray_set_size(ctx->roots, carray_count(ctx->roots) - 1);
+
+  if (container->thread != NULL) {
+    mailmessage_tree_free_recursive(container->thread);
+    container->thread = NULL;
+  }
+
+  if (container->dirty) {
+    last = carray_get(ctx->dirty, carray_count(ctx->dirty) - 1);
+    carray_set(ctx->dirty, container->dirty_index, last);
+    last->dirty_index = container->dirty_index;
+    carray_set_size(ctx->dirty, carray_count(ctx->dirty) - 1);
+    container->dirty = FALSE;
+  }
+}
+
+static int thread_is_ancestor(struct mail_thread_container * node,
+    struct mail_thread_container * maybe_ancestor)
+{
+  while (node != NULL) {
+    if (node == maybe_ancestor)
+      return TRUE;
+    node = node->parent;
+  }
+
+  return FALSE;
+}
+
+static int thread_link(struct mail_thread_context * ctx,
+    struct mail_thread_container * child,
+    struct mail_thread_link * link)
+{
+  int r;
+
+  r = carray_add(link->parent->children, child, NULL);
+  if (r < 0)
+    return MAIL_ERROR_MEMORY;
+
+  thread_root_remove(ctx, child);
+  child->parent = link->parent;
+  child->parent_link = link;
+
+  return thread_mark_dirty(ctx, child->parent);
+}
+
+static int thread_unlink(struct mail_thread_context * ctx,
+    struct mail_thread_container * child)
+{
+  struct mail_thread_container * parent;
+  unsigned int i;
+  int r;
+
+  parent = child->parent;
+  r = thread_mark_dirty(ctx, parent);
+  if (r != MAIL_NO_ERROR)
+    return r;
+
+  for(i = 0 ; i < carray_count(parent->children) ; i ++) {
+    if (carray_get(parent->children, i) == child) {
+      carray_delete(parent->children, i);
+      break;
+    }
+  }
+  child->parent = NULL;
+  child->parent_link = NULL;
+
+  return thread_root_add(ctx, child);
+}
+
+/*
+  same rules as steps (1)(A) and (1)(B) of mail_build_thread(), the
+  first link that does not make a loop gives the parent. The links
+  that lose are kept in case the winning one is removed.
+*/
+
+static int thread_add_link(struct mail_thread_context * ctx,
+    struct mail_thread_container * child,
+    struct mail_thread_container * parent,
+    struct mail_thread_container * owner)
+{
+  struct mail_thread_link * link;
+  int r;
+
+  link = malloc(sizeof(* link));
+  if (link == NULL)
+    return MAIL_ERROR_MEMORY;
+  link->parent = parent;
+  link->owner = owner;
+
+  r = carray_add(child->links, link, NULL);
+  if (r < 0) {
+    free(link);
+    return MAIL_ERROR_MEMORY;
+  }
+
+  if (child->parent != NULL)
+    return MAIL_NO_ERROR;
+
+  /* would make a loop */
+  if (thread_is_ancestor(parent, child))
+    return MAIL_NO_ERROR;
+
+  return thread_link(ctx, child, link);
+}
+
+/*
+  the parent is given again by the first of the remaining links, as if
+  the message that made the removed link had not been added
+*/
+
+static int thread_remove_link(struct mail_thread_context * ctx,
+    struct mail_thread_container * child,
+    struct mail_thread_container * parent,
+    struct mail_thread_container * owner)
+{
+  struct mail_thread_link * link;
+  unsigned int i;
+  int r;
+
+  link = NULL;
+  for(i = 0 ; i < carray_count(child->links) ; i ++) {
+    link = carray_get(child->links, i);
+    if ((link->parent == parent) && (link->owner == owner))
+      break;
+  }
+  if (i == carray_count(child->links))
+    return MAIL_NO_ERROR;
+  carray_delete_slow(child->links, i);
+
+  if (child->parent_link != link) {
+    free(link);
+    return MAIL_NO_ERROR;
+  }
+  free(link);
+
+  r = thread_unlink(ctx, child);
+  if (r != MAIL_NO_ERROR)
+    return r;
+
+  for(i = 0 ; i < carray_count(child->links) ; i ++) {
+    link = carray_get(child->links, i);
+    if (!thread_is_ancestor(link->parent, child))
+      return thread_link(ctx, child, link);
+  }
+
+  return MAIL_NO_ERROR;
+}
+
+static struct mail_thread_container *
+thread_container_new(struct mail_thread_context * ctx, char * msgid)
+{
+  struct mail_thread_container * container;
+  chashdatum key;
+  chashdatum value;
+  int r;
+
+  container = malloc(sizeof(* container));
+  if (container == NULL)
+    goto err;
+
+  container->msgid = msgid;
+  container->msg = NULL;
+  container->date = (time_t) -1;
+  container->base_subject = NULL;
+  container->is_reply = FALSE;
+  container->refs = NULL;
+  container->ref_count = 0;
+  container->parent = NULL;
+  container->parent_link = NULL;
+  container->dirty = FALSE;
+  container->thread = NULL;
+  container->links = carray_new(1);
+  if (container->links == NULL)
+    goto free;
+  container->children = carray_new(4);
+  if (container->children == NULL)
+    goto free_links;
+
+  key.data = msgid;
+  key.len = (unsigned int) strlen(msgid);
+  value.data = container;
+  value.len = 0;
+  r = cohash_set(ctx->msgid_hash, &key, &value, NULL);
+  if (r < 0)
+    goto free_children;
+
+  r = thread_root_add(ctx, container);
+  if (r != MAIL_NO_ERROR)
+    goto delete;
+
+  return container;
+
+ delete:
+  cohash_delete(ctx->msgid_hash, &key, NULL);
+ free_children:
+  carray_free(container->children);
+ free_links:
+  carray_free(container->links);
+ free:
+  free(container);
+ err:
+  return NULL;
+}
+
+static void thread_links_free(carray * links)
+{
+  unsigned int i;
+
+  for(i = 0 ; i < carray_count(links) ; i ++)
+    free(carray_get(links, i));
+  carray_free(links);
+}
+
+static void thread_container_free(struct mail_thread_context * ctx,
+    struct mail_thread_container * container)
+{
+  chashdatum key;
+
+  /* links are removed with the references, this is not expected */
+  while (carray_count(container->children) > 0)
+    thread_unlink(ctx, carray_get(container->children, 0));
+
+  if (container->parent != NULL)
+    thread_unlink(ctx, container);
+  thread_root_remove(ctx, container);
+
+  key.data = container->msgid;
+  key.len = (unsigned int) strlen(container->msgid);
+  cohash_delete(ctx->msgid_hash, &key, NULL);
+
+  if (container->refs != NULL)
+    carray_free(container->refs);
+  thread_links_free(container->links);
+  carray_free(container->children);
+  free(container->base_subject);
+  free(container->msgid);
+  free(container);
+}
+
+static void thread_container_unref(struct mail_thread_context * ctx,
+    struct mail_thread_container * container)
+{
+  container->ref_count --;
+  if (container->ref_count == 0)
+    thread_container_free(ctx, container);
+}
+
+static struct mail_thread_container *
+thread_container_get(struct mail_thread_context * ctx, char * msgid)
+{
+  struct mail_thread_container * container;
+  chashdatum key;
+  chashdatum value;
+
+  key.data = msgid;
+  key.len = (unsigned int) strlen(msgid);
+  if (cohash_get(ctx->msgid_hash, &key, &value) == 0)
+    return value.data;
+
+  msgid = strdup(msgid);
+  if (msgid == NULL)
+    return NULL;
+
+  container = thread_container_new(ctx, msgid);
+  if (container == NULL) {
+    free(msgid);
+    return NULL;
+  }
+
+  return container;
+}
+
+static struct mail_thread_container *
+thread_container_lookup(struct mail_thread_context * ctx,
+    mailmessage * msg)
+{
+  chashdatum key;
+  chashdatum value;
+
+  key.data = &msg;
+  key.len = sizeof(msg);
+  if (cohash_get(ctx->msg_hash, &key, &value) < 0)
+    return NULL;
+
+  return value.data;
+}
+
+LIBETPAN_EXPORT
+struct mail_thread_context *
+mail_thread_context_new(int type, char * default_from,
+    int (* comp_func)(struct mailmessage_tree **,
+        struct mailmessage_tree **))
+{
+  struct mail_thread_context * ctx;
+
+  switch (type) {
+  case MAIL_THREAD_REFERENCES:
+  case MAIL_THREAD_REFERENCES_NO_SUBJECT:
+    break;
+  default:
+    goto err;
+  }
+
+  ctx = malloc(sizeof(* ctx));
+  if (ctx == NULL)
+    goto err;
+
+  ctx->use_subject = (type == MAIL_THREAD_REFERENCES);
+  if (comp_func == NULL)
+    comp_func = mailthread_tree_timecomp;
+  ctx->comp_func = comp_func;
+
+  if (default_from != NULL) {
+    ctx->default_from = strdup(default_from);
+    if (ctx->default_from == NULL)
+      goto free;
+  }
+  else
+    ctx->default_from = NULL;
+
+  ctx->msgid_hash = cohash_new(128, CHASH_COPYNONE);
+  if (ctx->msgid_hash == NULL)
+    goto free_default_from;
+
+  ctx->msg_hash = cohash_new(128, CHASH_COPYKEY);
+  if (ctx->msg_hash == NULL)
+    goto free_msgid_hash;
+  ctx->synthetic_count = 0;
+
+  ctx->subject_cache = subject_cache_new();
+  if (ctx->subject_cache == NULL)
+    goto free_msg_hash;
+
+  ctx->roots = carray_new(128);
+  if (ctx->roots == NULL)
+    goto free_subject_cache;
+
+  ctx->dirty = carray_new(128);
+  if (ctx->dirty == NULL)
+    goto free_roots;
+
+  ctx->merge_list = carray_new(16);
+  if (ctx->merge_list == NULL)
+    goto free_dirty;
+
+  ctx->undo_list = carray_new(16);
+  if (ctx->undo_list == NULL)
+    goto free_merge_list;
+
+  ctx->root = mailmessage_tree_new(NULL, (time_t) -1, NULL);
+  if (ctx->root == NULL)
+    goto free_undo_list;
+
+  return ctx;
+
+ free_undo_list:
+  carray_free(ctx->undo_list);
+ free_merge_list:
+  carray_free(ctx->merge_list);
+ free_dirty:
+  carray_free(ctx->dirty);
+ free_roots:
+  carray_free(ctx->roots);
+ free_subject_cache:
+  subject_cache_free(ctx->subject_cache);
+ free_msg_hash:
+  cohash_free(ctx->msg_hash);
+ free_msgid_hash:
+  cohash_free(ctx->msgid_hash);
+ free_default_from:
+  free(ctx->default_from);
+ free:
+  free(ctx);
+ err:
+  return NULL;
+}
+
+LIBETPAN_EXPORT
+void mail_thread_context_free(struct mail_thread_context * ctx)
+{
+  cohashiter * iter;
+
+  thread_restore(ctx);
+
+  for(iter = cohash_begin(ctx->msgid_hash) ; iter != NULL ;
+      iter = cohash_next(ctx->msgid_hash, iter)) {
+    struct mail_thread_container * container;
+    chashdatum value;
+
+    cohash_value(iter, &value);
+    container = value.data;
+    if (container->thread != NULL)
+      mailmessage_tree_free_recursive(container->thread);
+    if (container->refs != NULL)
+      carray_free(container->refs);
+    thread_links_free(container->links);
+    carray_free(container->children);
+    free(container->base_subject);
+    free(container->msgid);
+    free(container);
+  }
+
+  mailmessage_tree_free(ctx->root);
+  carray_free(ctx->undo_list);
+  carray_free(ctx->merge_list);
+  carray_free(ctx->dirty);
+  carray_free(ctx->roots);
+  subject_cache_free(ctx->subject_cache);
+  cohash_free(ctx->msg_hash);
+  cohash_free(ctx->msgid_hash);
+  free(ctx->default_from);
+  free(ctx);
+}
+
+LIBETPAN_EXPORT
+int mail_thread_context_add(struct mail_thread_context * ctx,
+    mailmessage * msg)
+{
+  struct mail_thread_container * container;
+  char * msgid;
+  clist * ref;
+  clistiter * cur;
+  struct mail_thread_container * last;
+  chashdatum key;
+  chashdatum value;
+  int r;
+  int res;
+
+  if (thread_container_lookup(ctx, msg) != NULL)
+    return MAIL_NO_ERROR;
+
+  mailmessage_resolve_single_fields(msg);
+  if (msg->msg_fields == NULL)
+    return MAIL_NO_ERROR;
+
+  thread_restore(ctx);
+
+  container = NULL;
+  msgid = get_msg_id(msg);
+  if (msgid != NULL) {
+    key.data = msgid;
+    key.len = (unsigned int) strlen(msgid);
+    if (cohash_get(ctx->msgid_hash, &key, &value) == 0) {
+      container = value.data;
+      /* duplicate message-ID */
+      if (container->msg != NULL)
+        container = NULL;
+    }
+    else {
+      container = thread_container_get(ctx, msgid);
+      if (container == NULL) {
+        res = MAIL_ERROR_MEMORY;
+        goto err;
+      }
+    }
+  }
+
+  if (container == NULL) {
+    msgid = get_synthetic_msg_id(&ctx->synthetic_count);
+    if (msgid == NULL) {
+      res = MAIL_ERROR_MEMORY;
+      goto err;
+    }
+    container = thread_container_new(ctx, msgid);
+    if (container == NULL) {
+      free(msgid);
+      res = MAIL_ERROR_MEMORY;
+      goto err;
+    }
+  }
+
+  container->refs = carray_new(4);
+  if (container->refs == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto release;
+  }
+
+  key.data = &msg;
+  key.len = sizeof(msg);
+  value.data = container;
+  value.len = 0;
+  r = cohash_set(ctx->msg_hash, &key, &value, NULL);
+  if (r < 0) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_refs;
+  }
+
+  container->msg = msg;
+  container->ref_count ++;
+  container->date = get_date(msg);
+  container->is_reply = FALSE;
+  if (ctx->use_subject && (msg->msg_single_fields.fld_subject != NULL)) {
+    /* subjects of removed messages are dropped from time to time */
+    if (cohash_count(ctx->subject_cache) >
+        2 * cohash_count(ctx->msg_hash) + 1024) {
+      cohash * subject_cache;
+
+      subject_cache = subject_cache_new();
+      if (subject_cache != NULL) {
+        subject_cache_free(ctx->subject_cache);
+        ctx->subject_cache = subject_cache;
+      }
+    }
+    container->base_subject = extract_subject_cached(ctx->subject_cache,
+        ctx->default_from, &container->is_reply,
+        msg->msg_single_fields.fld_subject->sbj_value);
+    if (container->base_subject == NULL) {
+      res = MAIL_ERROR_MEMORY;
+      goto error;
+    }
+  }
+
+  r = thread_mark_dirty(ctx, container);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto error;
+  }
+
+  ref = get_ref(msg);
+  if (ref == NULL)
+    ref = get_in_reply_to(msg);
+  if (ref == NULL)
+    return MAIL_NO_ERROR;
+
+  last = NULL;
+  for(cur = clist_begin(ref) ; cur != NULL ; cur = clist_next(cur)) {
+    struct mail_thread_container * ref_container;
+
+    ref_container = thread_container_get(ctx, clist_content(cur));
+    if (ref_container == NULL) {
+      res = MAIL_ERROR_MEMORY;
+      goto error;
+    }
+    r = carray_add(container->refs, ref_container, NULL);
+    if (r < 0) {
+      if (ref_container->ref_count == 0)
+        thread_container_free(ctx, ref_container);
+      res = MAIL_ERROR_MEMORY;
+      goto error;
+    }
+    ref_container->ref_count ++;
+
+    if (last != NULL) {
+      r = thread_add_link(ctx, ref_container, last, container);
+      if (r != MAIL_NO_ERROR) {
+        res = r;
+        goto error;
+      }
+    }
+    last = ref_container;
+  }
+
+  if (last != NULL) {
+    r = thread_add_link(ctx, container, last, container);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto error;
+    }
+  }
+
+  return MAIL_NO_ERROR;
+
+ error:
+  /* the links that were made are removed with the message */
+  mail_thread_context_remove(ctx, msg);
+  return res;
+
+ free_refs:
+  carray_free(container->refs);
+  container->refs = NULL;
+ release:
+  if (container->ref_count == 0)
+    thread_container_free(ctx, container);
+ err:
+  return res;
+}
+
+LIBETPAN_EXPORT
+int mail_thread_context_add_list(struct mail_thread_context * ctx,
+    struct mailmessage_list * env_list)
+{
+  unsigned int i;
+  int r;
+
+  for(i = 0 ; i < carray_count(env_list->msg_tab) ; i ++) {
+    mailmessage * msg;
+
+    msg = carray_get(env_list->msg_tab, i);
+    if (msg == NULL)
+      continue;
+
+    r = mail_thread_context_add(ctx, msg);
+    if (r != MAIL_NO_ERROR)
+      return r;
+  }
+
+  return MAIL_NO_ERROR;
+}
+
+LIBETPAN_EXPORT
+int mail_thread_context_remove(struct mail_thread_context * ctx,
+    mailmessage * msg)
+{
+  struct mail_thread_container * container;
+  struct mail_thread_container * last;
+  chashdatum key;
+  unsigned int i;
+  int r;
+  int res;
+
+  container = thread_container_lookup(ctx, msg);
+  if (container == NULL)
+    return MAIL_ERROR_MSG_NOT_FOUND;
+
+  thread_restore(ctx);
+
+  key.data = &msg;
+  key.len = sizeof(msg);
+  cohash_delete(ctx->msg_hash, &key, NULL);
+
+  res = thread_mark_dirty(ctx, container);
+
+  container->msg = NULL;
+  container->date = (time_t) -1;
+  free(container->base_subject);
+  container->base_subject = NULL;
+  container->is_reply = FALSE;
+
+  /* the links are removed in the order they were made */
+  last = NULL;
+  for(i = 0 ; i < carray_count(container->refs) ; i ++) {
+    struct mail_thread_container * ref_container;
+
+    ref_container = carray_get(container->refs, i);
+    if (last != NULL) {
+      r = thread_remove_link(ctx, ref_container, last, container);
+      if (r != MAIL_NO_ERROR)
+        res = r;
+    }
+    last = ref_container;
+  }
+  if (last != NULL) {
+    r = thread_remove_link(ctx, container, last, container);
+    if (r != MAIL_NO_ERROR)
+      res = r;
+  }
+
+  for(i = 0 ; i < carray_count(container->refs) ; i ++)
+    thread_container_unref(ctx, carray_get(container->refs, i));
+  carray_free(container->refs);
+  container->refs = NULL;
+
+  thread_container_unref(ctx, container);
+
+  return res;
+}
+
+/*
+  children of a dummy are promoted to the level of the dummy, as
+  in step (3) of mail_build_thread()
+*/
+
+static int thread_build_node(struct mail_thread_context * ctx,
+    struct mail_thread_container * container,
+    struct mailmessage_tree * parent)
+{
+  struct mailmessage_tree * node;
+  char * msgid;
+  unsigned int i;
+  int r;
+  int res;
+
+  if (container->msg == NULL) {
+    for(i = 0 ; i < carray_count(container->children) ; i ++) {
+      r = thread_build_node(ctx, carray_get(container->children, i), parent);
+      if (r != MAIL_NO_ERROR)
+        return r;
+    }
+    return MAIL_NO_ERROR;
+  }
+
+  msgid = strdup(container->msgid);
+  if (msgid == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+
+  node = mailmessage_tree_new(msgid, container->date, container->msg);
+  if (node == NULL) {
+    free(msgid);
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+  node->node_is_reply = container->is_reply;
+
+  for(i = 0 ; i < carray_count(container->children) ; i ++) {
+    r = thread_build_node(ctx, carray_get(container->children, i), node);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+  }
+
+  r = carray_add(parent->node_children, node, NULL);
+  if (r < 0) {
+    res = MAIL_ERROR_MEMORY;
+    goto free;
+  }
+  node->node_parent = parent;
+
+  return MAIL_NO_ERROR;
+
+ free:
+  mailmessage_tree_free_recursive(node);
+ err:
+  return res;
+}
+
+static char * thread_subject(struct mail_thread_context * ctx,
+    struct mailmessage_tree * tree)
+{
+  unsigned int i;
+
+  if (tree->node_msg != NULL)
+    return thread_container_lookup(ctx, tree->node_msg)->base_subject;
+
+  for(i = 0 ; i < carray_count(tree->node_children) ; i ++) {
+    char * subject;
+
+    subject = thread_subject(ctx, carray_get(tree->node_children, i));
+    if (subject != NULL)
+      return subject;
+  }
+
+  return NULL;
+}
+
+static int thread_build(struct mail_thread_context * ctx,
+    struct mail_thread_container * container)
+{
+  struct mailmessage_tree * top;
+  char * subject;
+  char * msgid;
+  int r;
+  int res;
+
+  if (container->thread != NULL) {
+    mailmessage_tree_free_recursive(container->thread);
+    container->thread = NULL;
+  }
+
+  /* the node of a message is added as a child of top */
+  msgid = NULL;
+  if (container->msg == NULL) {
+    msgid = strdup(container->msgid);
+    if (msgid == NULL) {
+      res = MAIL_ERROR_MEMORY;
+      goto err;
+    }
+  }
+
+  top = mailmessage_tree_new(msgid, (time_t) -1, NULL);
+  if (top == NULL) {
+    free(msgid);
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+
+  r = thread_build_node(ctx, container, top);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free;
+  }
+
+  if (container->msg != NULL) {
+    struct mailmessage_tree * node;
+
+    node = carray_get(top->node_children, 0);
+    carray_set_size(top->node_children, 0);
+    mailmessage_tree_free(top);
+    top = node;
+  }
+  else {
+    /*
+      a dummy is kept at the top-level when it has more than
+      one child
+    */
+    switch (carray_count(top->node_children)) {
+    case 0:
+      mailmessage_tree_free(top);
+      return MAIL_NO_ERROR;
+
+    case 1: {
+      struct mailmessage_tree * node;
+
+      node = carray_get(top->node_children, 0);
+      carray_set_size(top->node_children, 0);
+      mailmessage_tree_free(top);
+      top = node;
+      break;
+    }
+    }
+  }
+  top->node_parent = NULL;
+
+  r = mail_thread_sort(top, ctx->comp_func, TRUE);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free;
+  }
+
+  subject = NULL;
+  if (ctx->use_subject)
+    subject = thread_subject(ctx, top);
+  if ((subject != NULL) && (* subject != '\0')) {
+    top->node_base_subject = strdup(subject);
+    if (top->node_base_subject == NULL) {
+      res = MAIL_ERROR_MEMORY;
+      goto free;
+    }
+  }
+
+  container->thread = top;
+
+  return MAIL_NO_ERROR;
+
+ free:
+  mailmessage_tree_free_recursive(top);
+ err:
+  return res;
+}
+
+static int thread_add_child(struct mail_thread_context * ctx,
+    struct mailmessage_tree * parent, struct mailmessage_tree * child)
+{
+  int r;
+
+  r = thread_save_children(ctx, parent);
+  if (r != MAIL_NO_ERROR)
+    return r;
+
+  r = carray_add(parent->node_children, child, NULL);
+  if (r < 0)
+    return MAIL_ERROR_MEMORY;
+  child->node_parent = parent;
+
+  return MAIL_NO_ERROR;
+}
+
+/*
+  step (5) of mail_build_thread(), the cached trees are not changed,
+  the children that are added to them are undone by thread_restore()
+*/
+
+static int thread_merge_subject(struct mail_thread_context * ctx)
+{
+  carray * rootlist;
+  cohash * subject_hash;
+  unsigned int cur;
+  unsigned int i;
+  int r;
+  int res;
+
+  rootlist = ctx->root->node_children;
+
+  subject_hash = cohash_new(carray_count(rootlist), CHASH_COPYVALUE);
+  if (subject_hash == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+
+  /* the first thread in date order is kept for each subject */
+
+  for(cur = 0 ; cur < carray_count(rootlist) ; cur ++) {
+    struct mailmessage_tree * env_tree;
+    chashdatum key;
+    chashdatum data;
+
+    env_tree = carray_get(rootlist, cur);
+    if (env_tree->node_base_subject == NULL)
+      continue;
+
+    key.data = env_tree->node_base_subject;
+    key.len = (unsigned int) strlen(env_tree->node_base_subject);
+    if (cohash_get(subject_hash, &key, &data) == 0)
+      continue;
+
+    data.data = &cur;
+    data.len = sizeof(cur);
+    r = cohash_set(subject_hash, &key, &data, NULL);
+    if (r < 0) {
+      res = MAIL_ERROR_MEMORY;
+      goto free_subject_hash;
+    }
+  }
+
+  cur = 0;
+  while (cur < carray_count(rootlist)) {
+    struct mailmessage_tree * env_tree;
+    struct mailmessage_tree * main_tree;
+    unsigned int * main_cur;
+    chashdatum key;
+    chashdatum data;
+
+    env_tree = carray_get(rootlist, cur);
+    if ((env_tree == NULL) || (env_tree->node_base_subject == NULL)) {
+      cur ++;
+      continue;
+    }
+
+    key.data = env_tree->node_base_subject;
+    key.len = (unsigned int) strlen(env_tree->node_base_subject);
+    r = cohash_get(subject_hash, &key, &data);
+    if (r < 0) {
+      cur ++;
+      continue;
+    }
+
+    main_cur = data.data;
+    if (* main_cur == cur) {
+      cur ++;
+      continue;
+    }
+
+    main_tree = carray_get(rootlist, * main_cur);
+
+    if ((env_tree->node_msg == NULL) && (main_tree->node_msg == NULL)) {
+      /* the children of both dummies become siblings */
+      r = thread_save_children(ctx, main_tree);
+      if (r != MAIL_NO_ERROR) {
+        res = r;
+        goto free_subject_hash;
+      }
+      r = thread_save_children(ctx, env_tree);
+      if (r != MAIL_NO_ERROR) {
+        res = r;
+        goto free_subject_hash;
+      }
+      for(i = 0 ; i < carray_count(env_tree->node_children) ; i ++) {
+        struct mailmessage_tree * child;
+
+        child = carray_get(env_tree->node_children, i);
+        r = carray_add(main_tree->node_children, child, NULL);
+        if (r < 0) {
+          res = MAIL_ERROR_MEMORY;
+          goto free_subject_hash;
+        }
+        child->node_parent = main_tree;
+      }
+      carray_delete_fast(rootlist, cur);
+    }
+    else if ((main_tree->node_msg == NULL) ||
+        (env_tree->node_is_reply && !main_tree->node_is_reply)) {
+      r = thread_add_child(ctx, main_tree, env_tree);
+      if (r != MAIL_NO_ERROR) {
+        res = r;
+        goto free_subject_hash;
+      }
+      carray_delete_fast(rootlist, cur);
+    }
+    else {
+      struct mailmessage_tree * new_main_tree;
+      char * base_subject;
+      unsigned int last;
+
+      base_subject = strdup(main_tree->node_base_subject);
+      if (base_subject == NULL) {
+        res = MAIL_ERROR_MEMORY;
+        goto free_subject_hash;
+      }
+
+      new_main_tree = mailmessage_tree_new(NULL, (time_t) -1, NULL);
+      if (new_main_tree == NULL) {
+        free(base_subject);
+        res = MAIL_ERROR_MEMORY;
+        goto free_subject_hash;
+      }
+      new_main_tree->node_base_subject = base_subject;
+
+      r = carray_add(ctx->merge_list, new_main_tree, NULL);
+      if (r < 0) {
+        mailmessage_tree_free(new_main_tree);
+        res = MAIL_ERROR_MEMORY;
+        goto free_subject_hash;
+      }
+
+      r = carray_add(rootlist, new_main_tree, &last);
+      if (r < 0) {
+        res = MAIL_ERROR_MEMORY;
+        goto free_subject_hash;
+      }
+      new_main_tree->node_parent = ctx->root;
+
+      r = carray_add(new_main_tree->node_children, main_tree, NULL);
+      if (r < 0) {
+        res = MAIL_ERROR_MEMORY;
+        goto free_subject_hash;
+      }
+      main_tree->node_parent = new_main_tree;
+      carray_delete_fast(rootlist, * main_cur);
+
+      r = carray_add(new_main_tree->node_children, env_tree, NULL);
+      if (r < 0) {
+        res = MAIL_ERROR_MEMORY;
+        goto free_subject_hash;
+      }
+      env_tree->node_parent = new_main_tree;
+      carray_delete_fast(rootlist, cur);
+
+      data.data = &last;
+      data.len = sizeof(last);
+      r = cohash_set(subject_hash, &key, &data, NULL);
+      if (r < 0) {
+        res = MAIL_ERROR_MEMORY;
+        goto free_subject_hash;
+      }
+    }
+  }
+
+  i = 0;
+  for(cur = 0 ; cur < carray_count(rootlist) ; cur ++) {
+    struct mailmessage_tree * env_tree;
+
+    env_tree = carray_get(rootlist, cur);
+    if (env_tree == NULL)
+      continue;
+
+    carray_set(rootlist, i, env_tree);
+    i ++;
+  }
+  carray_set_size(rootlist, i);
+
+  cohash_free(subject_hash);
+
+  /* only the nodes that got new children are sorted again */
+
+  for(i = 0 ; i < carray_count(ctx->undo_list) ; i ++) {
+    struct mail_thread_undo * undo;
+
+    undo = carray_get(ctx->undo_list, i);
+    mail_thread_sort(undo->node, ctx->comp_func, FALSE);
+  }
+  for(i = 0 ; i < carray_count(ctx->merge_list) ; i ++)
+    mail_thread_sort(carray_get(ctx->merge_list, i), ctx->comp_func, FALSE);
+
+  return MAIL_NO_ERROR;
+
+ free_subject_hash:
+  cohash_free(subject_hash);
+ err:
+  return res;
+}
+
+LIBETPAN_EXPORT
+int mail_thread_context_build(struct mail_thread_context * ctx,
+    struct mailmessage_tree ** result)
+{
+  carray * rootlist;
+  unsigned int i;
+  int r;
+  int res;
+
+  thread_restore(ctx);
+
+  /* the dirty roots are built from the end, they are kept on error */
+  while (carray_count(ctx->dirty) > 0) {
+    struct mail_thread_container * container;
+
+    container = carray_get(ctx->dirty, carray_count(ctx->dirty) - 1);
+    r = thread_build(ctx, container);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto err;
+    }
+    container->dirty = FALSE;
+    carray_set_size(ctx->dirty, carray_count(ctx->dirty) - 1);
+  }
+
+  rootlist = ctx->root->node_children;
+  for(i = 0 ; i < carray_count(ctx->roots) ; i ++) {
+    struct mail_thread_container * container;
+
+    container = carray_get(ctx->roots, i);
+    if (container->thread == NULL)
+      continue;
+
+    r = carray_add(rootlist, container->thread, NULL);
+    if (r < 0) {
+      res = MAIL_ERROR_MEMORY;
+      goto restore;
+    }
+    container->thread->node_parent = ctx->root;
+  }
+
+  if (ctx->use_subject) {
+    r = mail_thread_sort(ctx->root, mailthread_tree_timecomp, FALSE);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto restore;
+    }
+
+    r = thread_merge_subject(ctx);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto restore;
+    }
+  }
+
+  r = mail_thread_sort(ctx->root, ctx->comp_func, FALSE);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto restore;
+  }
+
+  * result = ctx->root;
+
+  return MAIL_NO_ERROR;
+
+ restore:
+  thread_restore(ctx);
+ err:
+  return res;
+}
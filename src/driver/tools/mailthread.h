@@ -104,6 +104,97 @@ LIBETPAN_EXPORT
 int mailthread_tree_timecomp(struct mailmessage_tree ** ptree1,
     struct mailmessage_tree ** ptree2);
 
+/*
+  mail_build_session_thread constructs the message tree of the messages
+  of a session.
+
+  The threads are built by the server when it can, using
+  mailsession_build_thread(): no envelope is downloaded and the nodes
+  have no date, message-ID nor subject. The messages are in the order
+  given by the server when comp_func is NULL, otherwise the threads
+  and their replies are sorted with comp_func, which only sees
+  node_msg (mailthread_tree_timecomp() sorts them by message index).
+  The envelope of a message can be fetched when it is displayed with
+  mailmessage_fetch_envelope().
+  When the server does not support the algorithm or rejects the
+  request, the envelopes of the list are fetched and the result is
+  the one of mail_build_thread(). Only the errors of the connection
+  are returned.
+
+  @param env_list is the message list returned by
+    mailsession_get_messages_list(), the envelopes need not be fetched.
+
+  The other parameters are the ones of mail_build_thread().
+*/
+
+LIBETPAN_EXPORT
+int mail_build_session_thread(mailsession * session, int type,
+    char * default_from,
+    struct mailmessage_list * env_list,
+    struct mailmessage_tree ** result,
+    int (* comp_func)(struct mailmessage_tree **,
+        struct mailmessage_tree **));
+
+/*
+  incremental threading
+
+  A threading context keeps the message-ID table and the links between
+  messages from one build to the next one. Messages are added and
+  removed as the folder changes, and mail_thread_context_build() only
+  builds and sorts again the threads that were changed.
+  The result is the one of mail_build_thread() when the messages are
+  added in the order of the list, except that a thread whose first
+  message is missing is merged by the subject of its earliest message
+  and that a message whose Message-ID was a duplicate one keeps a
+  unique key when the first message with this Message-ID is removed.
+
+  mail_thread_context_new() creates a context, type is
+    MAIL_THREAD_REFERENCES or MAIL_THREAD_REFERENCES_NO_SUBJECT,
+    default_from and comp_func are the same as for mail_build_thread().
+    NULL is returned on error or for another type of threading.
+
+  mail_thread_context_add() adds a message, its header fields must have
+    been fetched. A message already in the context is left unchanged.
+    The message must stay valid until it is removed or the context is
+    released.
+
+  mail_thread_context_add_list() adds all the messages of the list.
+
+  mail_thread_context_remove() removes a message,
+    MAIL_ERROR_MSG_NOT_FOUND is returned if it was not added.
+
+  mail_thread_context_build() returns the message tree in (* result).
+    The tree belongs to the context, it must not be freed or changed
+    and it is valid until the next call on the context.
+*/
+
+struct mail_thread_context;
+
+LIBETPAN_EXPORT
+struct mail_thread_context *
+mail_thread_context_new(int type, char * default_from,
+    int (* comp_func)(struct mailmessage_tree **,
+        struct mailmessage_tree **));
+
+LIBETPAN_EXPORT
+void mail_thread_context_free(struct mail_thread_context * ctx);
+
+LIBETPAN_EXPORT
+int mail_thread_context_add(struct mail_thread_context * ctx,
+    mailmessage * msg);
+
+LIBETPAN_EXPORT
+int mail_thread_context_add_list(struct mail_thread_context * ctx,
+    struct mailmessage_list * env_list);
+
+LIBETPAN_EXPORT
+int mail_thread_context_remove(struct mail_thread_context * ctx,
+    mailmessage * msg);
+
+LIBETPAN_EXPORT
+int mail_thread_context_build(struct mail_thread_context * ctx,
+    struct mailmessage_tree ** result);
+
 #ifdef __cplusplus
 }
 #endif
@@ -49,6 +49,7 @@
 #ifdef LIBETPAN_REENTRANT
 #if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
 #include <pthread.h>
+#define ENGINE_USE_THREADS
 #elif (defined WIN32)
 #include <windows.h>
 #endif
@@ -59,12 +60,22 @@
 /* ************************************************************* */
 /* Message ref info */
 
+/*
+  ref_count is updated with atomic operations, the lock of the element
+  only protects the MIME structure of the message, which is built on the
+  first reference and flushed on the last one.
+
+  prefetched holds the LIBETPAN_PREFETCH_XXX flags of the data fetched in
+  the background and not used yet, it is updated with atomic operations.
+*/
+
 struct message_ref_elt {
   mailmessage * msg;
   int ref_count;
   int mime_ref_count;
   struct mailfolder * folder;
   int lost;
+  int prefetched;
 #ifdef LIBETPAN_REENTRANT
 #if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
   pthread_mutex_t lock;
@@ -78,13 +89,87 @@ struct message_ref_elt {
 #if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
 #define LOCK(lock) pthread_mutex_lock(&lock);
 #define UNLOCK(lock) pthread_mutex_unlock(&lock);
+#define READ_LOCK(lock) pthread_rwlock_rdlock(&lock);
+#define READ_UNLOCK(lock) pthread_rwlock_unlock(&lock);
+#define WRITE_LOCK(lock) pthread_rwlock_wrlock(&lock);
+#define WRITE_UNLOCK(lock) pthread_rwlock_unlock(&lock);
+#define ATOMIC_INC(value) __atomic_add_fetch(&(value), 1, __ATOMIC_ACQ_REL)
+#define ATOMIC_DEC(value) __atomic_sub_fetch(&(value), 1, __ATOMIC_ACQ_REL)
+#define ATOMIC_GET(value) __atomic_load_n(&(value), __ATOMIC_ACQUIRE)
+#define ATOMIC_SET_BITS(value, bits) \
+  __atomic_fetch_or(&(value), (bits), __ATOMIC_ACQ_REL)
+#define ATOMIC_CLEAR_BITS(value, bits) \
+  __atomic_fetch_and(&(value), ~(bits), __ATOMIC_ACQ_REL)
 #elif (defined WIN32)
 #define LOCK(lock) EnterCriticalSection(&lock);
 #define UNLOCK(lock) LeaveCriticalSection(&lock);
+#define READ_LOCK(lock) AcquireSRWLockShared(&lock);
+#define READ_UNLOCK(lock) ReleaseSRWLockShared(&lock);
+#define WRITE_LOCK(lock) AcquireSRWLockExclusive(&lock);
+#define WRITE_UNLOCK(lock) ReleaseSRWLockExclusive(&lock);
+#define ATOMIC_INC(value) InterlockedIncrement((LONG volatile *) &(value))
+#define ATOMIC_DEC(value) InterlockedDecrement((LONG volatile *) &(value))
+#define ATOMIC_GET(value) InterlockedCompareExchange((LONG volatile *) &(value), 0, 0)
+#define ATOMIC_SET_BITS(value, bits) \
+  InterlockedOr((LONG volatile *) &(value), (bits))
+#define ATOMIC_CLEAR_BITS(value, bits) \
+  InterlockedAnd((LONG volatile *) &(value), ~(bits))
 #endif
 #else
 #define LOCK(lock) do {} while (0)
 #define UNLOCK(lock) do {} while (0)
+#define READ_LOCK(lock) do {} while (0)
+#define READ_UNLOCK(lock) do {} while (0)
+#define WRITE_LOCK(lock) do {} while (0)
+#define WRITE_UNLOCK(lock) do {} while (0)
+#define ATOMIC_INC(value) (++ (value))
+#define ATOMIC_DEC(value) (-- (value))
+#define ATOMIC_GET(value) (value)
+#define ATOMIC_SET_BITS(value, bits) fetch_set_bits(&(value), (bits))
+#define ATOMIC_CLEAR_BITS(value, bits) fetch_clear_bits(&(value), (bits))
+
+/* these return the previous value, as the atomic versions */
+
+static inline int fetch_set_bits(int * value, int bits)
+{
+  int previous;
+  
+  previous = * value;
+  * value |= bits;
+  
+  return previous;
+}
+
+static inline int fetch_clear_bits(int * value, int bits)
+{
+  int previous;
+  
+  previous = * value;
+  * value &= ~bits;
+  
+  return previous;
+}
+#endif
+
+/* read-write lock of the tables of the engine */
+
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+#define RWLOCK_INIT(lock) pthread_rwlock_init(&lock, NULL)
+#define RWLOCK_DESTROY(lock) pthread_rwlock_destroy(&lock)
+#define MUTEX_INIT(lock) pthread_mutex_init(&lock, NULL)
+#define MUTEX_DESTROY(lock) pthread_mutex_destroy(&lock)
+#elif (defined WIN32)
+#define RWLOCK_INIT(lock) (InitializeSRWLock(&lock), 0)
+#define RWLOCK_DESTROY(lock) do {} while (0)
+#define MUTEX_INIT(lock) (InitializeCriticalSection(&lock), 0)
+#define MUTEX_DESTROY(lock) DeleteCriticalSection(&lock)
+#endif
+#else
+#define RWLOCK_INIT(lock) 0
+#define RWLOCK_DESTROY(lock) do {} while (0)
+#define MUTEX_INIT(lock) 0
+#define MUTEX_DESTROY(lock) do {} while (0)
 #endif
 
 static struct message_ref_elt *
@@ -112,6 +197,7 @@ message_ref_elt_new(struct mailfolder * folder, mailmessage * msg)
   ref->mime_ref_count = 0;
   ref->folder = folder;
   ref->lost = 0;
+  ref->prefetched = 0;
   
   return ref;
   
@@ -135,46 +221,39 @@ static void message_ref_elt_free(struct message_ref_elt * ref_elt)
 
 static inline int message_ref(struct message_ref_elt * ref_elt)
 {
-  int count;
-  
-  LOCK(ref_elt->lock);
-  ref_elt->ref_count ++;
-  count = ref_elt->ref_count;
-  UNLOCK(ref_elt->lock);
-  
-  return count;
+  return ATOMIC_INC(ref_elt->ref_count);
 }
 
 static inline int message_unref(struct message_ref_elt * ref_elt)
 {
-  int count;
-  
-  LOCK(ref_elt->lock);
-  ref_elt->ref_count --;
-  count = ref_elt->ref_count;
-  UNLOCK(ref_elt->lock);
-  
-  return count;
+  return ATOMIC_DEC(ref_elt->ref_count);
 }
 
+/*
+  the caller holds a reference on the message so that the element is
+  not removed while the structure is built.
+*/
 
 static inline int message_mime_ref(struct mailprivacy * privacy,
-    struct message_ref_elt * ref_elt)
+    struct message_ref_elt * ref_elt, int * p_cached)
 {
   int r;
   int count;
   
+  LOCK(ref_elt->lock);
+  * p_cached = 0;
   if (ref_elt->mime_ref_count == 0) {
     struct mailmime * mime;
-
+    
+    /* the structure may have been built by the prefetch */
+    * p_cached = (ref_elt->msg->msg_mime != NULL);
     r = mailprivacy_msg_get_bodystructure(privacy, ref_elt->msg, &mime);
-    if (r != MAIL_NO_ERROR)
+    if (r != MAIL_NO_ERROR) {
+      UNLOCK(ref_elt->lock);
       return -r;
+    }
   }
   
-  message_ref(ref_elt);
-  
-  LOCK(ref_elt->lock);
   ref_elt->mime_ref_count ++;
   count = ref_elt->mime_ref_count;
   UNLOCK(ref_elt->lock);
@@ -182,13 +261,40 @@ static inline int message_mime_ref(struct mailprivacy * privacy,
   return count;
 }
 
+/*
+  message_mime_prefetch() builds the MIME structure of a message that
+  has no MIME reference, the next message_mime_ref() then uses it.
+  returns 1 if the structure was built, 0 if it already existed.
+*/
+
+static inline int message_mime_prefetch(struct mailprivacy * privacy,
+    struct message_ref_elt * ref_elt)
+{
+  int r;
+  int built;
+  
+  built = 0;
+  LOCK(ref_elt->lock);
+  if ((ref_elt->mime_ref_count == 0) && (ref_elt->msg->msg_mime == NULL)) {
+    struct mailmime * mime;
+    
+    r = mailprivacy_msg_get_bodystructure(privacy, ref_elt->msg, &mime);
+    if (r != MAIL_NO_ERROR) {
+      UNLOCK(ref_elt->lock);
+      return -r;
+    }
+    built = 1;
+  }
+  UNLOCK(ref_elt->lock);
+  
+  return built;
+}
+
 static inline int message_mime_unref(struct mailprivacy * privacy,
     struct message_ref_elt * ref_elt)
 {
   int count;
   
-  message_unref(ref_elt);
-  
   LOCK(ref_elt->lock);
   ref_elt->mime_ref_count --;
   
@@ -199,6 +305,8 @@ static inline int message_mime_unref(struct mailprivacy * privacy,
   
   UNLOCK(ref_elt->lock);
   
+  message_unref(ref_elt);
+  
   return count;
 }
 
@@ -206,8 +314,32 @@ static inline int message_mime_unref(struct mailprivacy * privacy,
 /* ************************************************************* */
 /* Folder ref info */
 
+/*
+  the lock of the folder is taken for reading to look up a message and
+  for writing to add or remove messages, the lookups of several threads
+  are then done concurrently.
+
+  session_lock serializes the use of the session of the folder when the
+  folder does not share the session of the storage.
+  session_storage_locked is what folder_session_lock() returned for the
+  caller of libetpan_message_session_lock(), it is only used while the
+  session is locked.
+*/
+
 struct folder_ref_info {
   struct mailfolder * folder;
+  struct mailprivacy * privacy;
+  
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+  pthread_rwlock_t lock;
+  pthread_mutex_t session_lock;
+#elif (defined WIN32)
+  SRWLOCK lock;
+  CRITICAL_SECTION session_lock;
+#endif
+#endif
+  int session_storage_locked;
   
   /* msg => msg_ref_info */
   chash * msg_hash;
@@ -219,7 +351,8 @@ struct folder_ref_info {
 };
 
 static struct folder_ref_info *
-folder_ref_info_new(struct mailfolder * folder
+folder_ref_info_new(struct mailfolder * folder,
+    struct mailprivacy * privacy
     /*, struct message_folder_finder * msg_folder_finder */)
 {
   struct folder_ref_info * ref_info;
@@ -229,10 +362,18 @@ folder_ref_info_new(struct mailfolder * folder
     goto err;
   
   ref_info->folder = folder;
+  ref_info->privacy = privacy;
+  ref_info->session_storage_locked = 0;
+  
+  if (RWLOCK_INIT(ref_info->lock) != 0)
+    goto free;
+  
+  if (MUTEX_INIT(ref_info->session_lock) != 0)
+    goto destroy_lock;
   
   ref_info->msg_hash = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
   if (ref_info->msg_hash == NULL)
-    goto free;
+    goto destroy_session_lock;
 
   ref_info->uid_hash = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYNONE);
   if (ref_info->uid_hash == NULL)
@@ -244,6 +385,10 @@ folder_ref_info_new(struct mailfolder * folder
   
  free_msg_hash:
   chash_free(ref_info->msg_hash);
+ destroy_session_lock:
+  MUTEX_DESTROY(ref_info->session_lock);
+ destroy_lock:
+  RWLOCK_DESTROY(ref_info->lock);
  free:
   free(ref_info);
  err:
@@ -254,9 +399,17 @@ static void folder_ref_info_free(struct folder_ref_info * ref_info)
 {
   chash_free(ref_info->uid_hash);
   chash_free(ref_info->msg_hash);
+  MUTEX_DESTROY(ref_info->session_lock);
+  RWLOCK_DESTROY(ref_info->lock);
   free(ref_info);
 }
 
+/*
+  folder_info_get_msg_ref(), folder_info_get_msg_by_uid(),
+  folder_message_add() and folder_message_remove() are called with the
+  lock of the folder held.
+*/
+
 static struct message_ref_elt *
 folder_info_get_msg_ref(struct folder_ref_info * ref_info, mailmessage * msg)
 {
@@ -300,9 +453,14 @@ static int folder_message_ref(struct folder_ref_info * ref_info,
     mailmessage * msg)
 {
   struct message_ref_elt * msg_ref;
+  int count;
   
+  READ_LOCK(ref_info->lock);
   msg_ref = folder_info_get_msg_ref(ref_info, msg);
-  return message_ref(msg_ref);
+  count = message_ref(msg_ref);
+  READ_UNLOCK(ref_info->lock);
+  
+  return count;
 }
 
 static void folder_message_remove(struct folder_ref_info * ref_info,
@@ -319,33 +477,79 @@ static int folder_message_unref(struct folder_ref_info * ref_info,
 {
   struct message_ref_elt * msg_ref;
   int count;
+  int removed;
   
+  READ_LOCK(ref_info->lock);
   msg_ref = folder_info_get_msg_ref(ref_info, msg);
   
-  if (msg_ref->ref_count == 0) {
+  if (ATOMIC_GET(msg_ref->ref_count) == 0) {
 #ifdef ETPAN_APP_DEBUG
     ETPAN_APP_DEBUG((engine_app, "** BUG detected negative ref count !"));
 #endif
   }
   
   count = message_unref(msg_ref);
+  READ_UNLOCK(ref_info->lock);
+  
   if (count == 0) {
-    folder_message_remove(ref_info, msg);
-    mailmessage_free(msg);
+    /* the message may have been referenced again or removed meanwhile */
+    removed = 0;
+    WRITE_LOCK(ref_info->lock);
+    msg_ref = folder_info_get_msg_ref(ref_info, msg);
+    if ((msg_ref != NULL) && (ATOMIC_GET(msg_ref->ref_count) == 0)) {
+      folder_message_remove(ref_info, msg);
+      removed = 1;
+    }
+    WRITE_UNLOCK(ref_info->lock);
+    
+    if (removed) {
+      /* the structure was prefetched and not used */
+      if (msg->msg_mime != NULL)
+        mailprivacy_msg_flush(ref_info->privacy, msg);
+      mailmessage_free(msg);
+    }
   }
   
   return count;
 }
 
 static int folder_message_mime_ref(struct mailprivacy * privacy,
+    struct folder_ref_info * ref_info,
+    mailmessage * msg, int * p_cached)
+{
+  struct message_ref_elt * msg_ref;
+  int count;
+  
+  READ_LOCK(ref_info->lock);
+  msg_ref = folder_info_get_msg_ref(ref_info, msg);
+  if (msg_ref != NULL)
+    message_ref(msg_ref);
+  READ_UNLOCK(ref_info->lock);
+  if (msg_ref == NULL)
+    return -MAIL_ERROR_INVAL;
+  
+  count = message_mime_ref(privacy, msg_ref, p_cached);
+  if (count < 0)
+    message_unref(msg_ref);
+  
+  return count;
+}
+
+/* the caller holds a reference on the message */
+
+static int folder_message_mime_prefetch(struct mailprivacy * privacy,
     struct folder_ref_info * ref_info,
     mailmessage * msg)
 {
   struct message_ref_elt * msg_ref;
   
+  READ_LOCK(ref_info->lock);
   msg_ref = folder_info_get_msg_ref(ref_info, msg);
+  READ_UNLOCK(ref_info->lock);
+  if (msg_ref == NULL)
+    return -MAIL_ERROR_INVAL;
   
-  return message_mime_ref(privacy, msg_ref);
+  return message_mime_prefetch(privacy, msg_ref);
 }
 
 static int folder_message_mime_unref(struct mailprivacy * privacy,
@@ -354,10 +558,49 @@ static int folder_message_mime_unref(struct mailprivacy * privacy,
 {
   struct message_ref_elt * msg_ref;
   
+  READ_LOCK(ref_info->lock);
   msg_ref = folder_info_get_msg_ref(ref_info, msg);
+  READ_UNLOCK(ref_info->lock);
+  
   return message_mime_unref(privacy, msg_ref);
 }
 
+#ifdef ENGINE_USE_THREADS
+/*
+  folder_message_set_prefetched() records that data of the message were
+  prefetched, folder_message_take_prefetched() returns whether they were
+  and clears the flags, so that each prefetch is counted once as a hit.
+*/
+
+static void folder_message_set_prefetched(struct folder_ref_info * ref_info,
+    mailmessage * msg, int flags)
+{
+  struct message_ref_elt * msg_ref;
+  
+  READ_LOCK(ref_info->lock);
+  msg_ref = folder_info_get_msg_ref(ref_info, msg);
+  if (msg_ref != NULL)
+    ATOMIC_SET_BITS(msg_ref->prefetched, flags);
+  READ_UNLOCK(ref_info->lock);
+}
+
+static int folder_message_take_prefetched(struct folder_ref_info * ref_info,
+    mailmessage * msg, int flags)
+{
+  struct message_ref_elt * msg_ref;
+  int prefetched;
+  
+  prefetched = 0;
+  READ_LOCK(ref_info->lock);
+  msg_ref = folder_info_get_msg_ref(ref_info, msg);
+  if (msg_ref != NULL)
+    prefetched = ATOMIC_CLEAR_BITS(msg_ref->prefetched, flags) & flags;
+  READ_UNLOCK(ref_info->lock);
+  
+  return prefetched;
+}
+#endif
+
 static int folder_message_add(struct folder_ref_info * ref_info,
     mailmessage * msg)
 {
@@ -446,6 +689,9 @@ static int folder_update_msg_list(struct folder_ref_info * ref_info,
     goto err;
   }
   
+  /* the list is fetched before the lock is taken */
+  WRITE_LOCK(ref_info->lock);
+  
   for(iter = chash_begin(ref_info->msg_hash) ; iter != NULL ;
       iter = chash_next(ref_info->msg_hash, iter)) {
     struct message_ref_elt * msg_ref;
@@ -530,9 +776,11 @@ static int folder_update_msg_list(struct folder_ref_info * ref_info,
     mailmessage * msg;
     
     msg = carray_get(new_env_list->msg_tab, i);
-    folder_message_ref(ref_info, msg);
+    message_ref(folder_info_get_msg_ref(ref_info, msg));
   }
   
+  WRITE_UNLOCK(ref_info->lock);
+  
   * p_new_msg_list = new_env_list;
   * p_lost_msg_list = lost_msg_list;
   
@@ -548,13 +796,13 @@ static int folder_update_msg_list(struct folder_ref_info * ref_info,
     msg = carray_get(new_env_list->msg_tab, i);
     msg_ref = folder_info_get_msg_ref(ref_info, msg);
     if (msg_ref != NULL) {
-      if (msg_ref->ref_count == 0)
+      if (ATOMIC_GET(msg_ref->ref_count) == 0)
         folder_message_remove(ref_info, msg);
     }
   }
   carray_set_size(new_env_list->msg_tab, 0);
   mailmessage_list_free(new_env_list);
-  goto err;
+  goto unlock;
  free_remaining:
   for(i = 0 ; i < carray_count(new_env_list->msg_tab) ; i ++) {
     mailmessage * msg;
@@ -563,7 +811,7 @@ static int folder_update_msg_list(struct folder_ref_info * ref_info,
     msg = carray_get(new_env_list->msg_tab, i);
     msg_ref = folder_info_get_msg_ref(ref_info, msg);
     if (msg_ref != NULL) {
-      if (msg_ref->ref_count == 0)
+      if (ATOMIC_GET(msg_ref->ref_count) == 0)
         folder_message_remove(ref_info, msg);
     }
   }
@@ -575,6 +823,8 @@ static int folder_update_msg_list(struct folder_ref_info * ref_info,
   }
   carray_set_size(new_env_list->msg_tab, 0);
   mailmessage_list_free(new_env_list);
+ unlock:
+  WRITE_UNLOCK(ref_info->lock);
  err:
   return res;
 }
@@ -610,15 +860,37 @@ static void folder_free_msg_list(struct folder_ref_info * ref_info,
 /* ************************************************************* */
 /* Storage ref info */
 
+/*
+  session_lock serializes the use of the session of the storage, and of
+  the folders that share it, by the engine calls and by the prefetch
+  thread of the storage. It is also held to connect and disconnect
+  folders.
+*/
+
 struct storage_ref_info {
   struct mailstorage * storage;
+  struct mailprivacy * privacy;
+  
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+  pthread_rwlock_t lock;
+  pthread_mutex_t session_lock;
+#elif (defined WIN32)
+  SRWLOCK lock;
+  CRITICAL_SECTION session_lock;
+#endif
+#endif
   
   /* folder => folder_ref_info */
   chash * folder_ref_info;
+  
+  /* created on the first prefetch request */
+  struct prefetch_queue * prefetch;
 };
 
 static struct storage_ref_info *
-storage_ref_info_new(struct mailstorage * storage
+storage_ref_info_new(struct mailstorage * storage,
+    struct mailprivacy * privacy
     /*, struct message_folder_finder * msg_folder_finder */)
 {
   struct storage_ref_info * ref_info;
@@ -628,13 +900,25 @@ storage_ref_info_new(struct mailstorage * storage
     goto err;
   
   ref_info->storage = storage;
+  ref_info->privacy = privacy;
+  ref_info->prefetch = NULL;
+  
+  if (RWLOCK_INIT(ref_info->lock) != 0)
+    goto free;
+  
+  if (MUTEX_INIT(ref_info->session_lock) != 0)
+    goto destroy_lock;
   
   ref_info->folder_ref_info = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
   if (ref_info->folder_ref_info == NULL)
-    goto free;
+    goto destroy_session_lock;
 
   return ref_info;
   
+ destroy_session_lock:
+  MUTEX_DESTROY(ref_info->session_lock);
+ destroy_lock:
+  RWLOCK_DESTROY(ref_info->lock);
  free:
   free(ref_info);
  err:
@@ -644,9 +928,48 @@ storage_ref_info_new(struct mailstorage * storage
 static void storage_ref_info_free(struct storage_ref_info * ref_info)
 {
   chash_free(ref_info->folder_ref_info);
+  MUTEX_DESTROY(ref_info->session_lock);
+  RWLOCK_DESTROY(ref_info->lock);
   free(ref_info);
 }
 
+/*
+  folder_session_lock() locks the session used by the folder. A folder
+  with a session of its own (see mailstorage_set_session_pool()) only
+  locks that session, so that the folders of a storage are used
+  concurrently. It returns whether the session of the storage was
+  locked, which is given to folder_session_unlock().
+*/
+
+static int folder_session_lock(struct storage_ref_info * ref_info,
+    struct folder_ref_info * folder_ref_info)
+{
+  struct mailfolder * folder;
+  
+  folder = folder_ref_info->folder;
+  
+  LOCK(ref_info->session_lock);
+  if ((folder != NULL) && (folder->fld_session != NULL) &&
+      (!folder->fld_shared_session)) {
+    LOCK(folder_ref_info->session_lock);
+    UNLOCK(ref_info->session_lock);
+    return 0;
+  }
+  
+  return 1;
+}
+
+static void folder_session_unlock(struct storage_ref_info * ref_info,
+    struct folder_ref_info * folder_ref_info, int storage_locked)
+{
+  if (storage_locked) {
+    UNLOCK(ref_info->session_lock);
+  }
+  else {
+    UNLOCK(folder_ref_info->session_lock);
+  }
+}
+
 
 static struct folder_ref_info *
 storage_get_folder_ref(struct storage_ref_info * ref_info,
@@ -659,7 +982,9 @@ storage_get_folder_ref(struct storage_ref_info * ref_info,
 
   key.data = &folder;
   key.len = sizeof(folder);
+  READ_LOCK(ref_info->lock);
   r = chash_get(ref_info->folder_ref_info, &key, &value);
+  READ_UNLOCK(ref_info->lock);
   if (r < 0)
     return NULL;
 
@@ -677,7 +1002,8 @@ storage_folder_add_ref(struct storage_ref_info * ref_info,
   chashdatum value;
   int r;
   
-  folder_ref = folder_ref_info_new(folder /*, ref_info->msg_folder_finder */);
+  folder_ref = folder_ref_info_new(folder, ref_info->privacy
+      /*, ref_info->msg_folder_finder */);
   if (folder_ref == NULL)
     goto err;
   
@@ -685,7 +1011,9 @@ storage_folder_add_ref(struct storage_ref_info * ref_info,
   key.len = sizeof(folder);
   value.data = folder_ref;
   value.len = 0;
+  WRITE_LOCK(ref_info->lock);
   r = chash_set(ref_info->folder_ref_info, &key, &value, NULL);
+  WRITE_UNLOCK(ref_info->lock);
   if (r < 0)
     goto free;
 
@@ -708,46 +1036,24 @@ static void storage_folder_remove_ref(struct storage_ref_info * ref_info,
   
   key.data = &folder;
   key.len = sizeof(folder);
+  WRITE_LOCK(ref_info->lock);
   r = chash_get(ref_info->folder_ref_info, &key, &value);
-  if (r < 0)
-      return;
+  if (r < 0) {
+    WRITE_UNLOCK(ref_info->lock);
+    return;
+  }
   
   folder_ref = value.data;
   
-  if (folder_ref == NULL)
+  if (folder_ref == NULL) {
+    WRITE_UNLOCK(ref_info->lock);
     return;
-  
-  folder_ref_info_free(folder_ref);
+  }
   
   chash_delete(ref_info->folder_ref_info, &key, &value);
-}
-
-static int storage_folder_get_msg_list(struct storage_ref_info * ref_info,
-    struct mailfolder * folder,
-    struct mailmessage_list ** p_new_msg_list,
-    struct mailmessage_list ** p_lost_msg_list)
-{
-  struct folder_ref_info * folder_ref_info;
-  
-  folder_ref_info = storage_get_folder_ref(ref_info, folder);
-  if (folder_ref_info == NULL)
-    return MAIL_ERROR_INVAL;
-  
-  return folder_update_msg_list(folder_ref_info,
-      p_new_msg_list, p_lost_msg_list);
-}
-
-static int storage_folder_fetch_env_list(struct storage_ref_info * ref_info,
-    struct mailfolder * folder,
-    struct mailmessage_list * msg_list)
-{
-  struct folder_ref_info * folder_ref_info;
-  
-  folder_ref_info = storage_get_folder_ref(ref_info, folder);
-  if (folder_ref_info == NULL)
-    return MAIL_ERROR_INVAL;
+  WRITE_UNLOCK(ref_info->lock);
   
-  return folder_fetch_env_list(folder_ref_info, msg_list);
+  folder_ref_info_free(folder_ref);
 }
 
 static void
@@ -773,6 +1079,7 @@ folder_restore_session(struct folder_ref_info * ref_info)
   
   session = ref_info->folder->fld_session;
   
+  READ_LOCK(ref_info->lock);
   for(iter = chash_begin(ref_info->msg_hash) ; iter != NULL ;
       iter = chash_next(ref_info->msg_hash, iter)) {
     chashdatum key;
@@ -791,6 +1098,7 @@ folder_restore_session(struct folder_ref_info * ref_info)
       ancestor_msg->msg_session = imap_cached_data->imap_ancestor;
     }
   }
+  READ_UNLOCK(ref_info->lock);
 }
 
 static void
@@ -798,6 +1106,7 @@ storage_restore_message_session(struct storage_ref_info * ref_info)
 {
   chashiter * iter;
 
+  READ_LOCK(ref_info->lock);
   for(iter = chash_begin(ref_info->folder_ref_info) ; iter != NULL ;
       iter = chash_next(ref_info->folder_ref_info, iter)) {
     chashdatum data;
@@ -814,6 +1123,7 @@ storage_restore_message_session(struct storage_ref_info * ref_info)
       }
     }
   }
+  READ_UNLOCK(ref_info->lock);
 }
 
 
@@ -903,6 +1213,9 @@ static int storage_folder_connect(struct storage_ref_info * ref_info,
     }
   }
   
+  /* waits for the calls using the session of the folder */
+  LOCK(folder_ref_info->session_lock);
+  
   /* connect folder */
   
   r = folder_connect(ref_info, folder);
@@ -932,6 +1245,8 @@ static int storage_folder_connect(struct storage_ref_info * ref_info,
     goto disconnect;
   }
   
+  UNLOCK(folder_ref_info->session_lock);
+  
   storage_restore_message_session(ref_info);
   
   return MAIL_NO_ERROR;
@@ -939,6 +1254,7 @@ static int storage_folder_connect(struct storage_ref_info * ref_info,
  disconnect:
   folder_disconnect(ref_info, folder);
  remove_ref:
+  UNLOCK(folder_ref_info->session_lock);
   storage_folder_remove_ref(ref_info, folder);
  err:
   return res;
@@ -947,7 +1263,18 @@ static int storage_folder_connect(struct storage_ref_info * ref_info,
 static void storage_folder_disconnect(struct storage_ref_info * ref_info,
     struct mailfolder * folder)
 {
+  struct folder_ref_info * folder_ref_info;
+  
+  folder_ref_info = storage_get_folder_ref(ref_info, folder);
+  
+  /* waits for the calls using the session of the folder */
+  if (folder_ref_info != NULL) {
+    LOCK(folder_ref_info->session_lock);
+  }
   mailfolder_disconnect(folder);
+  if (folder_ref_info != NULL) {
+    UNLOCK(folder_ref_info->session_lock);
+  }
   storage_folder_remove_ref(ref_info, folder);
 }
 
@@ -1002,12 +1329,19 @@ static void storage_disconnect(struct storage_ref_info * ref_info)
   chashiter * iter;
 
   /* disconnect folders */
-  while ((iter = chash_begin(ref_info->folder_ref_info)) != NULL) {
+  while (1) {
     chashdatum key;
     struct mailfolder * folder;
     
-    chash_key(iter, &key);
-    memcpy(&folder, key.data, sizeof(folder));
+    READ_LOCK(ref_info->lock);
+    iter = chash_begin(ref_info->folder_ref_info);
+    if (iter != NULL) {
+      chash_key(iter, &key);
+      memcpy(&folder, key.data, sizeof(folder));
+    }
+    READ_UNLOCK(ref_info->lock);
+    if (iter == NULL)
+      break;
     
     storage_folder_disconnect(ref_info, folder);
   }
@@ -1018,72 +1352,784 @@ static void storage_disconnect(struct storage_ref_info * ref_info)
 
 
 /* ************************************************************* */
-/* interface for mailengine */
+/* Prefetch */
 
-struct mailengine {
-  struct mailprivacy * privacy;
-  
-#ifdef LIBETPAN_REENTRANT
-#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
-  pthread_mutex_t storage_hash_lock;
-#elif (defined WIN32)
-  CRITICAL_SECTION storage_hash_lock;
-#endif
-#endif  
-  /* storage => storage_ref_info */
-  chash * storage_hash;
-};
+/*
+  The prefetch requests of a storage are queued by priority and handled
+  by a thread of the storage. The thread fetches the messages by batches
+  with the session lock held, so the calls of the application on the
+  storage run between two batches, and a request of higher priority
+  preempts the current one. A request holds a reference on its messages
+  until it is done or cancelled.
+*/
 
-static struct storage_ref_info *
-get_storage_ref_info(struct mailengine * engine,
-    struct mailstorage * storage)
-{
-  chashdatum key;
-  chashdatum data;
-  int r;
-  struct storage_ref_info * ref_info;
-  
-  key.data = &storage;
-  key.len = sizeof(storage);
-  LOCK(engine->storage_hash_lock);
-  r = chash_get(engine->storage_hash, &key, &data);
-  UNLOCK(engine->storage_hash_lock);
-  if (r < 0)
-    return NULL;
-  
-  ref_info = data.data;
+#define PREFETCH_ENVELOPE_BATCH_SIZE 64
+#define PREFETCH_BODY_BATCH_SIZE 8
 
-  return ref_info;
-}
+#ifdef ENGINE_USE_THREADS
 
-static struct storage_ref_info *
-add_storage_ref_info(struct mailengine * engine,
-    struct mailstorage * storage)
+struct prefetch_request {
+  int id;
+  int flags;
+  int priority;
+  int cancelled;
+  struct folder_ref_info * folder_ref_info;
+  carray * msg_tab;
+  /* index of the next message to fetch */
+  unsigned int next;
+};
+
+struct prefetch_queue {
+  pthread_mutex_t lock;
+  /* signaled when a request is queued or when the thread must stop */
+  pthread_cond_t queue_cond;
+  /* signaled when the thread is done with the current request */
+  pthread_cond_t done_cond;
+  pthread_t thread;
+  int stop;
+  int last_id;
+  /* waiting requests, by decreasing priority */
+  clist * requests;
+  struct prefetch_request * current;
+  struct libetpan_prefetch_stats stats;
+};
+
+static struct prefetch_request *
+prefetch_request_new(struct folder_ref_info * folder_ref_info,
+    carray * msg_tab, unsigned int first, unsigned int count,
+    int flags, int priority)
 {
-  chashdatum key;
-  chashdatum data;
+  struct prefetch_request * request;
+  unsigned int i;
   int r;
-  struct storage_ref_info * ref_info;
   
-  ref_info = storage_ref_info_new(storage
-      /* , &engine->msg_folder_finder */);
-  if (ref_info == NULL)
+  request = malloc(sizeof(* request));
+  if (request == NULL)
     goto err;
   
-  key.data = &storage;
-  key.len = sizeof(storage);
-  data.data = ref_info;
-  data.len = 0;
+  request->id = 0;
+  request->flags = flags;
+  request->priority = priority;
+  request->cancelled = 0;
+  request->folder_ref_info = folder_ref_info;
+  request->next = 0;
   
-  LOCK(engine->storage_hash_lock);
-  r = chash_set(engine->storage_hash, &key, &data, NULL);
-  UNLOCK(engine->storage_hash_lock);
-  if (r < 0)
+  request->msg_tab = carray_new(count);
+  if (request->msg_tab == NULL)
     goto free;
   
-  ref_info = data.data;
-  
-  return ref_info;
+  /* the messages are referenced while the request exists */
+  READ_LOCK(folder_ref_info->lock);
+  for(i = first ; i < first + count ; i ++) {
+    struct message_ref_elt * msg_ref;
+    mailmessage * msg;
+    
+    msg = carray_get(msg_tab, i);
+    msg_ref = folder_info_get_msg_ref(folder_ref_info, msg);
+    if (msg_ref == NULL)
+      goto unlock;
+    
+    r = carray_add(request->msg_tab, msg, NULL);
+    if (r < 0)
+      goto unlock;
+    message_ref(msg_ref);
+  }
+  READ_UNLOCK(folder_ref_info->lock);
+  
+  return request;
+  
+ unlock:
+  READ_UNLOCK(folder_ref_info->lock);
+  for(i = 0 ; i < carray_count(request->msg_tab) ; i ++)
+    folder_message_unref(folder_ref_info, carray_get(request->msg_tab, i));
+  carray_free(request->msg_tab);
+ free:
+  free(request);
+ err:
+  return NULL;
+}
+
+static void prefetch_request_free(struct prefetch_request * request)
+{
+  unsigned int i;
+  
+  for(i = 0 ; i < carray_count(request->msg_tab) ; i ++)
+    folder_message_unref(request->folder_ref_info,
+        carray_get(request->msg_tab, i));
+  carray_free(request->msg_tab);
+  free(request);
+}
+
+/* called with the lock of the queue held */
+
+static int prefetch_queue_add(struct prefetch_queue * queue,
+    struct prefetch_request * request)
+{
+  clistiter * cur;
+  
+  for(cur = clist_begin(queue->requests) ; cur != NULL ;
+      cur = clist_next(cur)) {
+    struct prefetch_request * queued;
+    
+    queued = clist_content(cur);
+    if (queued->priority < request->priority)
+      break;
+  }
+  
+  if (cur == NULL)
+    return clist_append(queue->requests, request);
+  else
+    return clist_insert_before(queue->requests, cur, request);
+}
+
+/*
+  prefetch_batch() fetches the messages [first, first + count[ of the
+  request.
+*/
+
+static int prefetch_batch(struct storage_ref_info * ref_info,
+    struct prefetch_request * request,
+    unsigned int first, unsigned int count)
+{
+  struct prefetch_queue * queue;
+  struct folder_ref_info * folder_ref_info;
+  struct mailfolder * folder;
+  unsigned int envelope_count;
+  unsigned int body_count;
+  unsigned int i;
+  int storage_locked;
+  int r;
+  int res;
+  
+  queue = ref_info->prefetch;
+  folder_ref_info = request->folder_ref_info;
+  folder = folder_ref_info->folder;
+  envelope_count = 0;
+  body_count = 0;
+  
+  storage_locked = folder_session_lock(ref_info, folder_ref_info);
+  
+  if (folder->fld_session == NULL) {
+    res = MAIL_ERROR_BAD_STATE;
+    goto unlock;
+  }
+  
+  if ((request->flags & LIBETPAN_PREFETCH_ENVELOPE) != 0) {
+    struct mailmessage_list * env_list;
+    carray * msg_tab;
+    
+    msg_tab = carray_new(count);
+    if (msg_tab == NULL) {
+      res = MAIL_ERROR_MEMORY;
+      goto unlock;
+    }
+    
+    for(i = first ; i < first + count ; i ++) {
+      mailmessage * msg;
+      
+      msg = carray_get(request->msg_tab, i);
+      if (msg->msg_fields != NULL)
+        continue;
+      
+      r = carray_add(msg_tab, msg, NULL);
+      if (r < 0) {
+        carray_free(msg_tab);
+        res = MAIL_ERROR_MEMORY;
+        goto unlock;
+      }
+    }
+    
+    env_list = mailmessage_list_new(msg_tab);
+    if (env_list == NULL) {
+      carray_free(msg_tab);
+      res = MAIL_ERROR_MEMORY;
+      goto unlock;
+    }
+    
+    r = MAIL_NO_ERROR;
+    if (carray_count(msg_tab) > 0)
+      r = mailfolder_get_envelopes_list(folder, env_list);
+    
+    for(i = 0 ; i < carray_count(msg_tab) ; i ++) {
+      mailmessage * msg;
+      
+      msg = carray_get(msg_tab, i);
+      if (msg->msg_fields != NULL) {
+        folder_message_set_prefetched(folder_ref_info, msg,
+            LIBETPAN_PREFETCH_ENVELOPE);
+        envelope_count ++;
+      }
+    }
+    
+    /* the messages belong to the request */
+    carray_set_size(msg_tab, 0);
+    mailmessage_list_free(env_list);
+    
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto unlock;
+    }
+  }
+  
+  if ((request->flags & LIBETPAN_PREFETCH_BODY) != 0) {
+    /* the MIME structure is what libetpan_message_mime_ref() uses, it
+       is kept in the message until the last MIME reference */
+    for(i = first ; i < first + count ; i ++) {
+      mailmessage * msg;
+      
+      msg = carray_get(request->msg_tab, i);
+      r = folder_message_mime_prefetch(ref_info->privacy,
+          folder_ref_info, msg);
+      if (r == -MAIL_ERROR_STREAM) {
+        res = MAIL_ERROR_STREAM;
+        goto unlock;
+      }
+      /* already built, or the message may have been removed meanwhile */
+      if (r <= 0)
+        continue;
+      
+      folder_message_set_prefetched(folder_ref_info, msg,
+          LIBETPAN_PREFETCH_BODY);
+      body_count ++;
+    }
+  }
+  
+  res = MAIL_NO_ERROR;
+  
+ unlock:
+  folder_session_unlock(ref_info, folder_ref_info, storage_locked);
+  
+  pthread_mutex_lock(&queue->lock);
+  queue->stats.pf_envelope_count += envelope_count;
+  queue->stats.pf_body_count += body_count;
+  pthread_mutex_unlock(&queue->lock);
+  
+  return res;
+}
+
+/*
+  prefetch_run() returns 1 when the request is done, 0 when a request of
+  higher priority was queued, the request is then queued again.
+*/
+
+static int prefetch_run(struct storage_ref_info * ref_info,
+    struct prefetch_request * request)
+{
+  struct prefetch_queue * queue;
+  unsigned int batch_size;
+  unsigned int count;
+  int preempted;
+  int r;
+  
+  queue = ref_info->prefetch;
+  if ((request->flags & LIBETPAN_PREFETCH_BODY) != 0)
+    batch_size = PREFETCH_BODY_BATCH_SIZE;
+  else
+    batch_size = PREFETCH_ENVELOPE_BATCH_SIZE;
+  
+  count = 0;
+  while (1) {
+    pthread_mutex_lock(&queue->lock);
+    request->next += count;
+    if (request->cancelled ||
+        (request->next >= carray_count(request->msg_tab))) {
+      pthread_mutex_unlock(&queue->lock);
+      return 1;
+    }
+    
+    preempted = 0;
+    if (!clist_isempty(queue->requests)) {
+      struct prefetch_request * first;
+      
+      first = clist_content(clist_begin(queue->requests));
+      if (first->priority > request->priority)
+        preempted = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    if (preempted)
+      return 0;
+    
+    count = carray_count(request->msg_tab) - request->next;
+    if (count > batch_size)
+      count = batch_size;
+    
+    r = prefetch_batch(ref_info, request, request->next, count);
+    if (r != MAIL_NO_ERROR) {
+      pthread_mutex_lock(&queue->lock);
+      queue->stats.pf_error_count ++;
+      pthread_mutex_unlock(&queue->lock);
+      return 1;
+    }
+  }
+}
+
+static void * prefetch_thread(void * data)
+{
+  struct storage_ref_info * ref_info;
+  struct prefetch_queue * queue;
+  
+  ref_info = data;
+  queue = ref_info->prefetch;
+  
+  pthread_mutex_lock(&queue->lock);
+  while (1) {
+    struct prefetch_request * request;
+    clistiter * first;
+    int done;
+    
+    while (!queue->stop && clist_isempty(queue->requests))
+      pthread_cond_wait(&queue->queue_cond, &queue->lock);
+    if (queue->stop)
+      break;
+    
+    first = clist_begin(queue->requests);
+    request = clist_content(first);
+    clist_delete(queue->requests, first);
+    queue->current = request;
+    pthread_mutex_unlock(&queue->lock);
+    
+    done = prefetch_run(ref_info, request);
+    
+    pthread_mutex_lock(&queue->lock);
+    if ((!done) && (!request->cancelled)) {
+      if (prefetch_queue_add(queue, request) < 0)
+        done = 1;
+    }
+    else {
+      done = 1;
+    }
+    
+    if (done) {
+      /* the messages are released before the request is reported done */
+      pthread_mutex_unlock(&queue->lock);
+      prefetch_request_free(request);
+      pthread_mutex_lock(&queue->lock);
+    }
+    
+    queue->current = NULL;
+    pthread_cond_broadcast(&queue->done_cond);
+  }
+  pthread_mutex_unlock(&queue->lock);
+  
+  return NULL;
+}
+
+static struct prefetch_queue * prefetch_queue_new(void)
+{
+  struct prefetch_queue * queue;
+  
+  queue = malloc(sizeof(* queue));
+  if (queue == NULL)
+    goto err;
+  
+  if (pthread_mutex_init(&queue->lock, NULL) != 0)
+    goto free;
+  if (pthread_cond_init(&queue->queue_cond, NULL) != 0)
+    goto destroy_lock;
+  if (pthread_cond_init(&queue->done_cond, NULL) != 0)
+    goto destroy_queue_cond;
+  
+  queue->requests = clist_new();
+  if (queue->requests == NULL)
+    goto destroy_done_cond;
+  
+  queue->stop = 0;
+  queue->last_id = 0;
+  queue->current = NULL;
+  memset(&queue->stats, 0, sizeof(queue->stats));
+  
+  return queue;
+  
+ destroy_done_cond:
+  pthread_cond_destroy(&queue->done_cond);
+ destroy_queue_cond:
+  pthread_cond_destroy(&queue->queue_cond);
+ destroy_lock:
+  pthread_mutex_destroy(&queue->lock);
+ free:
+  free(queue);
+ err:
+  return NULL;
+}
+
+static void prefetch_queue_free(struct prefetch_queue * queue)
+{
+  clist_free(queue->requests);
+  pthread_cond_destroy(&queue->done_cond);
+  pthread_cond_destroy(&queue->queue_cond);
+  pthread_mutex_destroy(&queue->lock);
+  free(queue);
+}
+
+/* returns the queue of the storage, the thread is started on first use */
+
+static struct prefetch_queue *
+storage_get_prefetch_queue(struct storage_ref_info * ref_info)
+{
+  struct prefetch_queue * queue;
+  
+  WRITE_LOCK(ref_info->lock);
+  queue = ref_info->prefetch;
+  if (queue == NULL) {
+    queue = prefetch_queue_new();
+    if (queue != NULL) {
+      ref_info->prefetch = queue;
+      if (pthread_create(&queue->thread, NULL,
+              prefetch_thread, ref_info) != 0) {
+        ref_info->prefetch = NULL;
+        prefetch_queue_free(queue);
+        queue = NULL;
+      }
+    }
+  }
+  WRITE_UNLOCK(ref_info->lock);
+  
+  return queue;
+}
+
+static struct prefetch_queue *
+storage_prefetch_queue(struct storage_ref_info * ref_info)
+{
+  struct prefetch_queue * queue;
+  
+  READ_LOCK(ref_info->lock);
+  queue = ref_info->prefetch;
+  READ_UNLOCK(ref_info->lock);
+  
+  return queue;
+}
+
+static int prefetch_request_match(struct prefetch_request * request,
+    struct folder_ref_info * folder_ref_info, int id)
+{
+  if ((folder_ref_info != NULL) &&
+      (request->folder_ref_info != folder_ref_info))
+    return 0;
+  if ((id != 0) && (request->id != id))
+    return 0;
+  
+  return 1;
+}
+
+/*
+  storage_prefetch_cancel() cancels the matching requests, all the
+  requests of the storage if folder_ref_info is NULL. When wait is set,
+  it returns once the thread released the messages of the requests.
+*/
+
+static void storage_prefetch_cancel(struct storage_ref_info * ref_info,
+    struct folder_ref_info * folder_ref_info, int id, int wait)
+{
+  struct prefetch_queue * queue;
+  clist * cancelled;
+  clistiter * cur;
+  
+  queue = storage_prefetch_queue(ref_info);
+  if (queue == NULL)
+    return;
+  
+  cancelled = clist_new();
+  
+  pthread_mutex_lock(&queue->lock);
+  cur = clist_begin(queue->requests);
+  while (cur != NULL) {
+    struct prefetch_request * request;
+    
+    request = clist_content(cur);
+    if (prefetch_request_match(request, folder_ref_info, id) &&
+        (cancelled != NULL) && (clist_append(cancelled, request) == 0)) {
+      cur = clist_delete(queue->requests, cur);
+      queue->stats.pf_cancelled_count ++;
+    }
+    else {
+      cur = clist_next(cur);
+    }
+  }
+  
+  if ((queue->current != NULL) &&
+      prefetch_request_match(queue->current, folder_ref_info, id)) {
+    queue->current->cancelled = 1;
+    queue->stats.pf_cancelled_count ++;
+    
+    while (wait && (queue->current != NULL) &&
+        prefetch_request_match(queue->current, folder_ref_info, id))
+      pthread_cond_wait(&queue->done_cond, &queue->lock);
+  }
+  pthread_mutex_unlock(&queue->lock);
+  
+  if (cancelled != NULL) {
+    for(cur = clist_begin(cancelled) ; cur != NULL ; cur = clist_next(cur))
+      prefetch_request_free(clist_content(cur));
+    clist_free(cancelled);
+  }
+}
+
+/* stops the thread of the storage, before the storage is removed */
+
+static void storage_prefetch_stop(struct storage_ref_info * ref_info)
+{
+  struct prefetch_queue * queue;
+  
+  queue = storage_prefetch_queue(ref_info);
+  if (queue == NULL)
+    return;
+  
+  storage_prefetch_cancel(ref_info, NULL, 0, 0);
+  
+  pthread_mutex_lock(&queue->lock);
+  queue->stop = 1;
+  pthread_cond_signal(&queue->queue_cond);
+  pthread_mutex_unlock(&queue->lock);
+  
+  pthread_join(queue->thread, NULL);
+  
+  /* requests queued again by a preempted request */
+  storage_prefetch_cancel(ref_info, NULL, 0, 0);
+  
+  WRITE_LOCK(ref_info->lock);
+  ref_info->prefetch = NULL;
+  WRITE_UNLOCK(ref_info->lock);
+  
+  prefetch_queue_free(queue);
+}
+
+static int storage_prefetch(struct storage_ref_info * ref_info,
+    struct folder_ref_info * folder_ref_info,
+    carray * msg_tab, unsigned int first, unsigned int count,
+    int flags, int priority)
+{
+  struct prefetch_queue * queue;
+  struct prefetch_request * request;
+  int id;
+  int r;
+  
+  queue = storage_get_prefetch_queue(ref_info);
+  if (queue == NULL)
+    goto err;
+  
+  request = prefetch_request_new(folder_ref_info, msg_tab, first, count,
+      flags, priority);
+  if (request == NULL)
+    goto err;
+  
+  pthread_mutex_lock(&queue->lock);
+  queue->last_id ++;
+  if (queue->last_id <= 0)
+    queue->last_id = 1;
+  id = queue->last_id;
+  request->id = id;
+  r = prefetch_queue_add(queue, request);
+  if (r == 0)
+    pthread_cond_signal(&queue->queue_cond);
+  pthread_mutex_unlock(&queue->lock);
+  if (r < 0)
+    goto free_request;
+  
+  return id;
+  
+ free_request:
+  prefetch_request_free(request);
+ err:
+  return -MAIL_ERROR_MEMORY;
+}
+
+/*
+  the hits are only counted once prefetch was used on the storage.
+*/
+
+static void storage_prefetch_count_envelopes(struct storage_ref_info * ref_info,
+    struct folder_ref_info * folder_ref_info,
+    struct mailmessage_list * msg_list)
+{
+  struct prefetch_queue * queue;
+  unsigned int hits;
+  unsigned int misses;
+  unsigned int i;
+  
+  queue = storage_prefetch_queue(ref_info);
+  if (queue == NULL)
+    return;
+  
+  hits = 0;
+  misses = 0;
+  for(i = 0 ; i < carray_count(msg_list->msg_tab) ; i ++) {
+    mailmessage * msg;
+    
+    msg = carray_get(msg_list->msg_tab, i);
+    if (folder_message_take_prefetched(folder_ref_info, msg,
+            LIBETPAN_PREFETCH_ENVELOPE))
+      hits ++;
+    else if (msg->msg_fields == NULL)
+      misses ++;
+  }
+  
+  pthread_mutex_lock(&queue->lock);
+  queue->stats.pf_envelope_hits += hits;
+  queue->stats.pf_envelope_misses += misses;
+  pthread_mutex_unlock(&queue->lock);
+}
+
+/* cached tells whether the structure already existed */
+
+static void storage_prefetch_count_body(struct storage_ref_info * ref_info,
+    struct folder_ref_info * folder_ref_info, mailmessage * msg,
+    int cached)
+{
+  struct prefetch_queue * queue;
+  int hit;
+  
+  queue = storage_prefetch_queue(ref_info);
+  if (queue == NULL)
+    return;
+  
+  hit = folder_message_take_prefetched(folder_ref_info, msg,
+      LIBETPAN_PREFETCH_BODY) && cached;
+  
+  pthread_mutex_lock(&queue->lock);
+  if (hit)
+    queue->stats.pf_body_hits ++;
+  else
+    queue->stats.pf_body_misses ++;
+  pthread_mutex_unlock(&queue->lock);
+}
+
+static void storage_get_prefetch_stats(struct storage_ref_info * ref_info,
+    struct libetpan_prefetch_stats * stats)
+{
+  struct prefetch_queue * queue;
+  clistiter * cur;
+  
+  memset(stats, 0, sizeof(* stats));
+  
+  queue = storage_prefetch_queue(ref_info);
+  if (queue == NULL)
+    return;
+  
+  pthread_mutex_lock(&queue->lock);
+  * stats = queue->stats;
+  for(cur = clist_begin(queue->requests) ; cur != NULL ;
+      cur = clist_next(cur)) {
+    struct prefetch_request * request;
+    
+    request = clist_content(cur);
+    stats->pf_queue_depth ++;
+    stats->pf_pending_count += carray_count(request->msg_tab) - request->next;
+  }
+  if (queue->current != NULL) {
+    stats->pf_queue_depth ++;
+    stats->pf_pending_count +=
+      carray_count(queue->current->msg_tab) - queue->current->next;
+  }
+  pthread_mutex_unlock(&queue->lock);
+}
+
+#else
+
+static void storage_prefetch_cancel(struct storage_ref_info * ref_info,
+    struct folder_ref_info * folder_ref_info, int id, int wait)
+{
+}
+
+static void storage_prefetch_stop(struct storage_ref_info * ref_info)
+{
+}
+
+static int storage_prefetch(struct storage_ref_info * ref_info,
+    struct folder_ref_info * folder_ref_info,
+    carray * msg_tab, unsigned int first, unsigned int count,
+    int flags, int priority)
+{
+  return -MAIL_ERROR_NOT_IMPLEMENTED;
+}
+
+static void storage_prefetch_count_envelopes(struct storage_ref_info * ref_info,
+    struct folder_ref_info * folder_ref_info,
+    struct mailmessage_list * msg_list)
+{
+}
+
+static void storage_prefetch_count_body(struct storage_ref_info * ref_info,
+    struct folder_ref_info * folder_ref_info, mailmessage * msg,
+    int cached)
+{
+}
+
+static void storage_get_prefetch_stats(struct storage_ref_info * ref_info,
+    struct libetpan_prefetch_stats * stats)
+{
+  memset(stats, 0, sizeof(* stats));
+}
+
+#endif
+
+
+/* ************************************************************* */
+/* interface for mailengine */
+
+struct mailengine {
+  struct mailprivacy * privacy;
+  
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+  pthread_rwlock_t storage_hash_lock;
+#elif (defined WIN32)
+  SRWLOCK storage_hash_lock;
+#endif
+#endif  
+  /* storage => storage_ref_info */
+  chash * storage_hash;
+};
+
+static struct storage_ref_info *
+get_storage_ref_info(struct mailengine * engine,
+    struct mailstorage * storage)
+{
+  chashdatum key;
+  chashdatum data;
+  int r;
+  struct storage_ref_info * ref_info;
+  
+  key.data = &storage;
+  key.len = sizeof(storage);
+  READ_LOCK(engine->storage_hash_lock);
+  r = chash_get(engine->storage_hash, &key, &data);
+  READ_UNLOCK(engine->storage_hash_lock);
+  if (r < 0)
+    return NULL;
+  
+  ref_info = data.data;
+
+  return ref_info;
+}
+
+static struct storage_ref_info *
+add_storage_ref_info(struct mailengine * engine,
+    struct mailstorage * storage)
+{
+  chashdatum key;
+  chashdatum data;
+  int r;
+  struct storage_ref_info * ref_info;
+  
+  ref_info = storage_ref_info_new(storage, engine->privacy
+      /* , &engine->msg_folder_finder */);
+  if (ref_info == NULL)
+    goto err;
+  
+  key.data = &storage;
+  key.len = sizeof(storage);
+  data.data = ref_info;
+  data.len = 0;
+  
+  WRITE_LOCK(engine->storage_hash_lock);
+  r = chash_set(engine->storage_hash, &key, &data, NULL);
+  WRITE_UNLOCK(engine->storage_hash_lock);
+  if (r < 0)
+    goto free;
+  
+  ref_info = data.data;
+  
+  return ref_info;
   
  free:
   storage_ref_info_free(ref_info);
@@ -1098,22 +2144,26 @@ remove_storage_ref_info(struct mailengine * engine,
   chashdatum key;
   chashdatum data;
   struct storage_ref_info * ref_info;
+  int r;
   
   key.data = &storage;
   key.len = sizeof(storage);
   
-  LOCK(engine->storage_hash_lock);
+  WRITE_LOCK(engine->storage_hash_lock);
   
-  chash_get(engine->storage_hash, &key, &data);
-  ref_info = data.data;
+  r = chash_get(engine->storage_hash, &key, &data);
+  ref_info = NULL;
+  if (r == 0) {
+    ref_info = data.data;
+    chash_delete(engine->storage_hash, &key, NULL);
+  }
+  
+  WRITE_UNLOCK(engine->storage_hash_lock);
   
   if (ref_info != NULL) {
+    storage_prefetch_stop(ref_info);
     storage_ref_info_free(ref_info);
-    
-    chash_delete(engine->storage_hash, &key, NULL);
   }
-  
-  LOCK(engine->storage_hash_lock);
 }
 
 struct mailengine *
@@ -1128,30 +2178,18 @@ libetpan_engine_new(struct mailprivacy * privacy)
   
   engine->privacy = privacy;
   
-#ifdef LIBETPAN_REENTRANT
-#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
-  r = pthread_mutex_init(&engine->storage_hash_lock, NULL);
+  r = RWLOCK_INIT(engine->storage_hash_lock);
   if (r != 0)
     goto free;
-#elif (defined WIN32)
-  InitializeCriticalSection(&engine->storage_hash_lock);
-#endif
-#endif
   
   engine->storage_hash = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
   if (engine->storage_hash == NULL)
-    goto destroy_mutex;
+    goto destroy_lock;
 
   return engine;
   
- destroy_mutex:
-#ifdef LIBETPAN_REENTRANT
-#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
-  pthread_mutex_destroy(&engine->storage_hash_lock);
-#elif (defined WIN32)
-  DeleteCriticalSection(&engine->storage_hash_lock);
-#endif
-#endif
+ destroy_lock:
+  RWLOCK_DESTROY(engine->storage_hash_lock);
  free:
   free(engine);
  err:
@@ -1161,24 +2199,16 @@ libetpan_engine_new(struct mailprivacy * privacy)
 void libetpan_engine_free(struct mailengine * engine)
 {
   chash_free(engine->storage_hash);
-#ifdef LIBETPAN_REENTRANT
-#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
-  pthread_mutex_destroy(&engine->storage_hash_lock);
-#elif (defined WIN32)
-  DeleteCriticalSection(&engine->storage_hash_lock);
-#endif
-#endif  
+  RWLOCK_DESTROY(engine->storage_hash_lock);
   free(engine);
 }
 
-static struct folder_ref_info *
-message_get_folder_ref(struct mailengine * engine,
+static struct storage_ref_info *
+message_get_storage_ref(struct mailengine * engine,
     mailmessage * msg)
 {
   struct mailfolder * folder;
   struct mailstorage * storage;
-  struct storage_ref_info * storage_ref_info;
-  struct folder_ref_info * folder_ref_info;
   
   folder = msg->msg_folder;
   if (folder == NULL)
@@ -1186,9 +2216,19 @@ message_get_folder_ref(struct mailengine * engine,
   else
     storage = folder->fld_storage;
   
-  storage_ref_info = get_storage_ref_info(engine, storage);
+  return get_storage_ref_info(engine, storage);
+}
+
+static struct folder_ref_info *
+message_get_folder_ref(struct mailengine * engine,
+    mailmessage * msg)
+{
+  struct storage_ref_info * storage_ref_info;
+  struct folder_ref_info * folder_ref_info;
   
-  folder_ref_info = storage_get_folder_ref(storage_ref_info, folder);
+  storage_ref_info = message_get_storage_ref(engine, msg);
+  
+  folder_ref_info = storage_get_folder_ref(storage_ref_info, msg->msg_folder);
   
   return folder_ref_info;
 }
@@ -1217,21 +2257,69 @@ int libetpan_message_unref(struct mailengine * engine,
 int libetpan_message_mime_ref(struct mailengine * engine,
     mailmessage * msg)
 {
+  struct storage_ref_info * storage_ref_info;
   struct folder_ref_info * ref_info;
+  int storage_locked;
+  int count;
+  int cached;
   
-  ref_info = message_get_folder_ref(engine, msg);
+  storage_ref_info = message_get_storage_ref(engine, msg);
+  ref_info = storage_get_folder_ref(storage_ref_info, msg->msg_folder);
+  
+  storage_locked = folder_session_lock(storage_ref_info, ref_info);
+  count = folder_message_mime_ref(engine->privacy, ref_info, msg, &cached);
+  folder_session_unlock(storage_ref_info, ref_info, storage_locked);
   
-  return folder_message_mime_ref(engine->privacy, ref_info, msg);
+  /* first reference, the structure was prefetched or built by this call */
+  if (count == 1)
+    storage_prefetch_count_body(storage_ref_info, ref_info, msg, cached);
+  
+  return count;
 }
 
 int libetpan_message_mime_unref(struct mailengine * engine,
     mailmessage * msg)
 {
+  struct storage_ref_info * storage_ref_info;
   struct folder_ref_info * ref_info;
+  int storage_locked;
+  int count;
   
-  ref_info = message_get_folder_ref(engine, msg);
+  storage_ref_info = message_get_storage_ref(engine, msg);
+  ref_info = storage_get_folder_ref(storage_ref_info, msg->msg_folder);
+  
+  storage_locked = folder_session_lock(storage_ref_info, ref_info);
+  count = folder_message_mime_unref(engine->privacy, ref_info, msg);
+  folder_session_unlock(storage_ref_info, ref_info, storage_locked);
   
-  return folder_message_mime_unref(engine->privacy, ref_info, msg);
+  return count;
+}
+
+void libetpan_message_session_lock(struct mailengine * engine,
+    mailmessage * msg)
+{
+  struct storage_ref_info * storage_ref_info;
+  struct folder_ref_info * ref_info;
+  int storage_locked;
+  
+  storage_ref_info = message_get_storage_ref(engine, msg);
+  ref_info = storage_get_folder_ref(storage_ref_info, msg->msg_folder);
+  
+  storage_locked = folder_session_lock(storage_ref_info, ref_info);
+  ref_info->session_storage_locked = storage_locked;
+}
+
+void libetpan_message_session_unlock(struct mailengine * engine,
+    mailmessage * msg)
+{
+  struct storage_ref_info * storage_ref_info;
+  struct folder_ref_info * ref_info;
+  
+  storage_ref_info = message_get_storage_ref(engine, msg);
+  ref_info = storage_get_folder_ref(storage_ref_info, msg->msg_folder);
+  
+  folder_session_unlock(storage_ref_info, ref_info,
+      ref_info->session_storage_locked);
 }
 
 int libetpan_folder_get_msg_list(struct mailengine * engine,
@@ -1240,11 +2328,22 @@ int libetpan_folder_get_msg_list(struct mailengine * engine,
     struct mailmessage_list ** p_lost_msg_list)
 {
   struct storage_ref_info * ref_info;
+  struct folder_ref_info * folder_ref_info;
+  int storage_locked;
+  int r;
   
   ref_info = get_storage_ref_info(engine, folder->fld_storage);
   
-  return storage_folder_get_msg_list(ref_info, folder,
+  folder_ref_info = storage_get_folder_ref(ref_info, folder);
+  if (folder_ref_info == NULL)
+    return MAIL_ERROR_INVAL;
+  
+  storage_locked = folder_session_lock(ref_info, folder_ref_info);
+  r = folder_update_msg_list(folder_ref_info,
       p_new_msg_list, p_lost_msg_list);
+  folder_session_unlock(ref_info, folder_ref_info, storage_locked);
+  
+  return r;
 }
 
 int libetpan_folder_fetch_env_list(struct mailengine * engine,
@@ -1252,10 +2351,22 @@ int libetpan_folder_fetch_env_list(struct mailengine * engine,
     struct mailmessage_list * msg_list)
 {
   struct storage_ref_info * ref_info;
+  struct folder_ref_info * folder_ref_info;
+  int storage_locked;
+  int r;
   
   ref_info = get_storage_ref_info(engine, folder->fld_storage);
   
-  return storage_folder_fetch_env_list(ref_info, folder, msg_list);
+  folder_ref_info = storage_get_folder_ref(ref_info, folder);
+  if (folder_ref_info == NULL)
+    return MAIL_ERROR_INVAL;
+  
+  storage_locked = folder_session_lock(ref_info, folder_ref_info);
+  storage_prefetch_count_envelopes(ref_info, folder_ref_info, msg_list);
+  r = folder_fetch_env_list(folder_ref_info, msg_list);
+  folder_session_unlock(ref_info, folder_ref_info, storage_locked);
+  
+  return r;
 }
 
 void libetpan_folder_free_msg_list(struct mailengine * engine,
@@ -1311,10 +2422,15 @@ int libetpan_storage_connect(struct mailengine * engine,
     struct mailstorage * storage)
 {
   struct storage_ref_info * ref_info;
+  int r;
   
   ref_info = get_storage_ref_info(engine, storage);
   
-  return storage_connect(ref_info);
+  LOCK(ref_info->session_lock);
+  r = storage_connect(ref_info);
+  UNLOCK(ref_info->session_lock);
+  
+  return r;
 }
 
 
@@ -1325,17 +2441,27 @@ void libetpan_storage_disconnect(struct mailengine * engine,
   
   ref_info = get_storage_ref_info(engine, storage);
   
+  /* the prefetched messages are released before the folders are removed */
+  storage_prefetch_cancel(ref_info, NULL, 0, 1);
+  
+  LOCK(ref_info->session_lock);
   storage_disconnect(ref_info);
+  UNLOCK(ref_info->session_lock);
 }
 
 int libetpan_storage_used(struct mailengine * engine,
     struct mailstorage * storage)
 {
   struct storage_ref_info * ref_info;
+  int used;
   
   ref_info = get_storage_ref_info(engine, storage);
   
-  return (chash_count(ref_info->folder_ref_info) != 0);
+  READ_LOCK(ref_info->lock);
+  used = (chash_count(ref_info->folder_ref_info) != 0);
+  READ_UNLOCK(ref_info->lock);
+  
+  return used;
 }
 
 
@@ -1343,10 +2469,15 @@ int libetpan_folder_connect(struct mailengine * engine,
     struct mailfolder * folder)
 {
   struct storage_ref_info * ref_info;
+  int r;
   
   ref_info = get_storage_ref_info(engine, folder->fld_storage);
   
-  return storage_folder_connect(ref_info, folder);
+  LOCK(ref_info->session_lock);
+  r = storage_folder_connect(ref_info, folder);
+  UNLOCK(ref_info->session_lock);
+  
+  return r;
 }
 
 
@@ -1354,10 +2485,72 @@ void libetpan_folder_disconnect(struct mailengine * engine,
     struct mailfolder * folder)
 {
   struct storage_ref_info * ref_info;
+  struct folder_ref_info * folder_ref_info;
   
   ref_info = get_storage_ref_info(engine, folder->fld_storage);
   
+  /* the prefetched messages are released before the folder is removed */
+  folder_ref_info = storage_get_folder_ref(ref_info, folder);
+  if (folder_ref_info != NULL)
+    storage_prefetch_cancel(ref_info, folder_ref_info, 0, 1);
+  
+  LOCK(ref_info->session_lock);
   storage_folder_disconnect(ref_info, folder);
+  UNLOCK(ref_info->session_lock);
+}
+
+
+int libetpan_folder_prefetch(struct mailengine * engine,
+    struct mailfolder * folder,
+    struct mailmessage_list * msg_list,
+    unsigned int first, unsigned int count,
+    int flags, int priority)
+{
+  struct storage_ref_info * ref_info;
+  struct folder_ref_info * folder_ref_info;
+  
+  if ((folder == NULL) || (count == 0) ||
+      (first > carray_count(msg_list->msg_tab)) ||
+      (count > carray_count(msg_list->msg_tab) - first) ||
+      ((flags & (LIBETPAN_PREFETCH_ENVELOPE | LIBETPAN_PREFETCH_BODY)) == 0))
+    return -MAIL_ERROR_INVAL;
+  
+  ref_info = get_storage_ref_info(engine, folder->fld_storage);
+  
+  folder_ref_info = storage_get_folder_ref(ref_info, folder);
+  if (folder_ref_info == NULL)
+    return -MAIL_ERROR_INVAL;
+  
+  return storage_prefetch(ref_info, folder_ref_info, msg_list->msg_tab,
+      first, count, flags, priority);
+}
+
+
+void libetpan_folder_prefetch_cancel(struct mailengine * engine,
+    struct mailfolder * folder, int id)
+{
+  struct storage_ref_info * ref_info;
+  struct folder_ref_info * folder_ref_info;
+  
+  ref_info = get_storage_ref_info(engine, folder->fld_storage);
+  
+  folder_ref_info = storage_get_folder_ref(ref_info, folder);
+  if (folder_ref_info == NULL)
+    return;
+  
+  storage_prefetch_cancel(ref_info, folder_ref_info, id, 0);
+}
+
+
+void libetpan_storage_get_prefetch_stats(struct mailengine * engine,
+    struct mailstorage * storage,
+    struct libetpan_prefetch_stats * stats)
+{
+  struct storage_ref_info * ref_info;
+  
+  ref_info = get_storage_ref_info(engine, storage);
+  
+  storage_get_prefetch_stats(ref_info, stats);
 }
 
 
@@ -1403,7 +2596,9 @@ int libetpan_message_register(struct mailengine * engine,
 
   folder_ref_info = storage_get_folder_ref(storage_ref_info, folder);
   
+  WRITE_LOCK(folder_ref_info->lock);
   r = folder_message_add(folder_ref_info, msg);
+  WRITE_UNLOCK(folder_ref_info->lock);
   if (r != MAIL_NO_ERROR) {
     res = r;
     goto err;
@@ -1435,8 +2630,10 @@ static void folder_debug(struct folder_ref_info * folder_ref_info, FILE * f)
       fprintf(f, "folder [no name]\n");
   }
   
+  READ_LOCK(folder_ref_info->lock);
   fprintf(f, "message count: %i\n", chash_count(folder_ref_info->msg_hash));
   fprintf(f, "UID count: %i\n", chash_count(folder_ref_info->uid_hash));
+  READ_UNLOCK(folder_ref_info->lock);
   fprintf(f, "folder debug -- end\n");
 }
 
@@ -1454,6 +2651,7 @@ static void storage_debug(struct storage_ref_info * storage_ref_info, FILE * f)
     else
       fprintf(f, "storage [no name]\n");
   }
+  READ_LOCK(storage_ref_info->lock);
   fprintf(f, "folder count: %i\n",
       chash_count(storage_ref_info->folder_ref_info));
 
@@ -1467,6 +2665,7 @@ static void storage_debug(struct storage_ref_info * storage_ref_info, FILE * f)
     
     folder_debug(folder_ref_info, f);
   }
+  READ_UNLOCK(storage_ref_info->lock);
   fprintf(f, "storage debug -- end\n");
 }
 
@@ -1476,6 +2675,7 @@ void libetpan_engine_debug(struct mailengine * engine, FILE * f)
   
   fprintf(f, "mail engine debug -- begin\n");
   
+  READ_LOCK(engine->storage_hash_lock);
   for(iter = chash_begin(engine->storage_hash) ; iter != NULL ;
       iter = chash_next(engine->storage_hash, iter)) {
     chashdatum data;
@@ -1486,6 +2686,7 @@ void libetpan_engine_debug(struct mailengine * engine, FILE * f)
     
     storage_debug(storage_ref_info, f);
   }
+  READ_UNLOCK(engine->storage_hash_lock);
 
   fprintf(f, "mail engine debug -- end\n");
 }
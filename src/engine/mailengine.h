@@ -97,6 +97,25 @@ int libetpan_message_mime_ref(struct mailengine * engine,
 int libetpan_message_mime_unref(struct mailengine * engine,
     mailmessage * msg);
 
+/*
+  libetpan_message_session_lock() and libetpan_message_session_unlock()
+  lock and unlock the session used by the message, the one used by the
+  prefetch thread of the storage and by the other libetpan_ calls.
+  
+  They must be called around the calls that use the session of a
+  message directly, for example mailmessage_fetch(),
+  mailmessage_fetch_section() or mailprivacy_msg_fetch_section(), as
+  long as libetpan_folder_prefetch() may have been called for the
+  storage. The lock is not recursive: no other libetpan_ call on the
+  same storage can be made while it is held.
+*/
+
+void libetpan_message_session_lock(struct mailengine * engine,
+    mailmessage * msg);
+
+void libetpan_message_session_unlock(struct mailengine * engine,
+    mailmessage * msg);
+
 /*
   message list
 */
@@ -126,6 +145,77 @@ void libetpan_folder_free_msg_list(struct mailengine * engine,
     struct mailmessage_list * env_list);
 
 
+/*
+  prefetch
+*/
+
+enum {
+  LIBETPAN_PREFETCH_ENVELOPE = 1 << 0,
+  LIBETPAN_PREFETCH_BODY     = 1 << 1
+};
+
+/*
+  libetpan_folder_prefetch() queues the fetch in background of the
+  envelopes and/or the MIME structures of count messages of msg_list,
+  starting at index first. msg_list must have been returned by
+  libetpan_folder_get_msg_list().
+
+  The requests of a storage are handled by a thread of the storage, the
+  highest priority first, for example the visible messages with a high
+  priority and their neighbors with a lower one. The messages are
+  fetched by batches, which fill the caches of the driver, and the
+  envelopes are then returned at once by libetpan_folder_fetch_env_list().
+  The envelope of a message must not be read before
+  libetpan_folder_fetch_env_list() returned it. The MIME structure is
+  kept in the message for the next libetpan_message_mime_ref().
+  The fetches of the thread use the session of the folder, the other
+  uses of that session must then hold libetpan_message_session_lock().
+
+  returns the identifier of the request (> 0), or -MAIL_ERROR_XXX.
+  -MAIL_ERROR_NOT_IMPLEMENTED is returned when libetpan is built without
+  threads.
+*/
+
+int libetpan_folder_prefetch(struct mailengine * engine,
+    struct mailfolder * folder,
+    struct mailmessage_list * msg_list,
+    unsigned int first, unsigned int count,
+    int flags, int priority);
+
+/*
+  libetpan_folder_prefetch_cancel() cancels the request with the given
+  identifier, or all the requests of the folder if id is 0, for example
+  when the messages are scrolled out of view. A request being fetched
+  stops after the current batch.
+*/
+
+void libetpan_folder_prefetch_cancel(struct mailengine * engine,
+    struct mailfolder * folder, int id);
+
+/*
+  hits are the messages whose envelope (or MIME structure) was asked
+  after a prefetch, misses are the ones that had to be fetched at that
+  time.
+*/
+
+struct libetpan_prefetch_stats {
+  unsigned int pf_queue_depth;     /* requests queued or being fetched */
+  unsigned int pf_pending_count;   /* messages not fetched yet */
+  unsigned long pf_envelope_count; /* envelopes prefetched */
+  unsigned long pf_body_count;     /* MIME structures prefetched */
+  unsigned long pf_cancelled_count;
+  unsigned long pf_error_count;
+  unsigned long pf_envelope_hits;
+  unsigned long pf_envelope_misses;
+  unsigned long pf_body_hits;
+  unsigned long pf_body_misses;
+};
+
+void libetpan_storage_get_prefetch_stats(struct mailengine * engine,
+    struct mailstorage * storage,
+    struct libetpan_prefetch_stats * stats);
+
+
 /*
   connect and disconnect storage
 */
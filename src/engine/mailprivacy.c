@@ -51,7 +51,54 @@
 #endif
 #include <stdlib.h>
 #include <string.h>
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+#	include <pthread.h>
+#	define PRIVACY_USE_THREADS
+#endif
+#endif
 #include "mailprivacy_tools.h"
+#include "mailprivacy_tools_private.h"
+
+/*
+  When workers are enabled, the protected parts of a message are
+  decrypted concurrently. The registration tables and the fetches on the
+  original message are then protected by the locks of the workers.
+*/
+
+#ifdef PRIVACY_USE_THREADS
+struct mailprivacy_workers {
+  unsigned int max_workers;
+  pthread_mutex_t ref_lock;
+  pthread_mutex_t fetch_lock;
+};
+
+#define REF_LOCK(privacy) \
+  do { \
+    if ((privacy)->workers != NULL) \
+      pthread_mutex_lock(&(privacy)->workers->ref_lock); \
+  } while (0)
+#define REF_UNLOCK(privacy) \
+  do { \
+    if ((privacy)->workers != NULL) \
+      pthread_mutex_unlock(&(privacy)->workers->ref_lock); \
+  } while (0)
+#define FETCH_LOCK(privacy) \
+  do { \
+    if (((privacy) != NULL) && ((privacy)->workers != NULL)) \
+      pthread_mutex_lock(&(privacy)->workers->fetch_lock); \
+  } while (0)
+#define FETCH_UNLOCK(privacy) \
+  do { \
+    if (((privacy) != NULL) && ((privacy)->workers != NULL)) \
+      pthread_mutex_unlock(&(privacy)->workers->fetch_lock); \
+  } while (0)
+#else
+#define REF_LOCK(privacy) do {} while (0)
+#define REF_UNLOCK(privacy) do {} while (0)
+#define FETCH_LOCK(privacy) do {} while (0)
+#define FETCH_UNLOCK(privacy) do {} while (0)
+#endif
 
 carray * mailprivacy_get_protocols(struct mailprivacy * privacy)
 {
@@ -91,6 +138,8 @@ struct mailprivacy * mailprivacy_new(char * tmp_dir, int make_alternative)
     goto free_mime_ref;
 
   privacy->make_alternative = make_alternative;
+  privacy->cache = NULL;
+  privacy->workers = NULL;
   
   return privacy;
   
@@ -110,6 +159,8 @@ struct mailprivacy * mailprivacy_new(char * tmp_dir, int make_alternative)
 
 void mailprivacy_free(struct mailprivacy * privacy)
 {
+  mailprivacy_set_max_workers(privacy, 0);
+  mailprivacy_cache_free(privacy->cache);
   carray_free(privacy->protocols);
   chash_free(privacy->mime_ref);
   chash_free(privacy->mmapstr);
@@ -131,7 +182,9 @@ static int msg_is_modified(struct mailprivacy * privacy,
   key.data = &msg;
   key.len = sizeof(msg);
   
+  REF_LOCK(privacy);
   r = chash_get(privacy->msg_ref, &key, &data);
+  REF_UNLOCK(privacy);
   if (r < 0)
     return 0;
   else
@@ -153,7 +206,9 @@ static int register_msg(struct mailprivacy * privacy,
   data.data = msg;
   data.len = 0;
   
+  REF_LOCK(privacy);
   r = chash_set(privacy->msg_ref, &key, &data, NULL);
+  REF_UNLOCK(privacy);
   if (r < 0)
     return MAIL_ERROR_MEMORY;
   else
@@ -168,7 +223,9 @@ static void unregister_message(struct mailprivacy * privacy,
   key.data = &msg;
   key.len = sizeof(msg);
   
+  REF_LOCK(privacy);
   chash_delete(privacy->msg_ref, &key, NULL);
+  REF_UNLOCK(privacy);
 }
 
 static int result_is_mmapstr(struct mailprivacy * privacy, char * str)
@@ -180,7 +237,9 @@ static int result_is_mmapstr(struct mailprivacy * privacy, char * str)
   key.data = &str;
   key.len = sizeof(str);
   
+  REF_LOCK(privacy);
   r = chash_get(privacy->mmapstr, &key, &data);
+  REF_UNLOCK(privacy);
   if (r < 0)
     return 0;
   else
@@ -199,7 +258,9 @@ static int register_result_mmapstr(struct mailprivacy * privacy,
   data.data = content;
   data.len = 0;
   
+  REF_LOCK(privacy);
   r = chash_set(privacy->mmapstr, &key, &data, NULL);
+  REF_UNLOCK(privacy);
   if (r < 0)
     return MAIL_ERROR_MEMORY;
   
@@ -216,7 +277,9 @@ static void unregister_result_mmapstr(struct mailprivacy * privacy,
   key.data = &str;
   key.len = sizeof(str);
   
+  REF_LOCK(privacy);
   chash_delete(privacy->mmapstr, &key, NULL);
+  REF_UNLOCK(privacy);
 }
 
 static int register_mime(struct mailprivacy * privacy,
@@ -231,7 +294,9 @@ static int register_mime(struct mailprivacy * privacy,
   data.data = mime;
   data.len = 0;
   
+  REF_LOCK(privacy);
   r = chash_set(privacy->mime_ref, &key, &data, NULL);
+  REF_UNLOCK(privacy);
   if (r < 0)
     return MAIL_ERROR_MEMORY;
   else
@@ -246,7 +311,9 @@ static void unregister_mime(struct mailprivacy * privacy,
   key.data = &mime;
   key.len = sizeof(mime);
   
+  REF_LOCK(privacy);
   chash_delete(privacy->mime_ref, &key, NULL);
+  REF_UNLOCK(privacy);
 }
 
 static int mime_is_registered(struct mailprivacy * privacy,
@@ -259,7 +326,9 @@ static int mime_is_registered(struct mailprivacy * privacy,
   key.data = &mime;
   key.len = sizeof(mime);
   
+  REF_LOCK(privacy);
   r = chash_get(privacy->mime_ref, &key, &data);
+  REF_UNLOCK(privacy);
   if (r < 0)
     return 0;
   else
@@ -530,13 +599,19 @@ int mailprivacy_msg_fetch_section(struct mailprivacy * privacy,
     struct mailmime * mime,
     char ** result, size_t * result_len)
 {
+  int r;
+  
   if (msg_is_modified(privacy, msg_info) &&
       mime_is_registered(privacy, mime)) {
     return fetch_registered_part(privacy, mailmessage_fetch_section,
         mime, result, result_len);
   }
 
-  return mailmessage_fetch_section(msg_info, mime, result, result_len);
+  FETCH_LOCK(privacy);
+  r = mailmessage_fetch_section(msg_info, mime, result, result_len);
+  FETCH_UNLOCK(privacy);
+  
+  return r;
 }
 
 int mailprivacy_msg_fetch_section_header(struct mailprivacy * privacy,
@@ -545,13 +620,19 @@ int mailprivacy_msg_fetch_section_header(struct mailprivacy * privacy,
     char ** result,
     size_t * result_len)
 {
+  int r;
+  
   if (msg_is_modified(privacy, msg_info) &&
       mime_is_registered(privacy, mime)) {
     return fetch_registered_part(privacy, mailmessage_fetch_section_header,
         mime, result, result_len);
   }
   
-  return mailmessage_fetch_section_header(msg_info, mime, result, result_len);
+  FETCH_LOCK(privacy);
+  r = mailmessage_fetch_section_header(msg_info, mime, result, result_len);
+  FETCH_UNLOCK(privacy);
+  
+  return r;
 }
 
 int mailprivacy_msg_fetch_section_mime(struct mailprivacy * privacy,
@@ -560,13 +641,19 @@ int mailprivacy_msg_fetch_section_mime(struct mailprivacy * privacy,
     char ** result,
     size_t * result_len)
 {
+  int r;
+  
   if (msg_is_modified(privacy, msg_info) &&
       mime_is_registered(privacy, mime)) {
     return fetch_registered_part(privacy, mailmessage_fetch_section_mime,
         mime, result, result_len);
   }
   
-  return mailmessage_fetch_section_mime(msg_info, mime, result, result_len);
+  FETCH_LOCK(privacy);
+  r = mailmessage_fetch_section_mime(msg_info, mime, result, result_len);
+  FETCH_UNLOCK(privacy);
+  
+  return r;
 }
 
 int mailprivacy_msg_fetch_section_body(struct mailprivacy * privacy,
@@ -575,13 +662,19 @@ int mailprivacy_msg_fetch_section_body(struct mailprivacy * privacy,
     char ** result,
     size_t * result_len)
 {
+  int r;
+  
   if (msg_is_modified(privacy, msg_info) &&
       mime_is_registered(privacy, mime)) {
     return fetch_registered_part(privacy, mailmessage_fetch_section_body,
         mime, result, result_len);
   }
   
-  return mailmessage_fetch_section_body(msg_info, mime, result, result_len);
+  FETCH_LOCK(privacy);
+  r = mailmessage_fetch_section_body(msg_info, mime, result, result_len);
+  FETCH_UNLOCK(privacy);
+  
+  return r;
 }
 
 void mailprivacy_msg_fetch_result_free(struct mailprivacy * privacy,
@@ -598,7 +691,9 @@ void mailprivacy_msg_fetch_result_free(struct mailprivacy * privacy,
     }
   }
   
+  FETCH_LOCK(privacy);
   mailmessage_fetch_result_free(msg_info, msg);
+  FETCH_UNLOCK(privacy);
 }
 
 int mailprivacy_msg_fetch(struct mailprivacy * privacy,
@@ -606,7 +701,13 @@ int mailprivacy_msg_fetch(struct mailprivacy * privacy,
     char ** result,
     size_t * result_len)
 {
-  return mailmessage_fetch(msg_info, result, result_len);
+  int r;
+  
+  FETCH_LOCK(privacy);
+  r = mailmessage_fetch(msg_info, result, result_len);
+  FETCH_UNLOCK(privacy);
+  
+  return r;
 }
 
 int mailprivacy_msg_fetch_header(struct mailprivacy * privacy,
@@ -614,7 +715,13 @@ int mailprivacy_msg_fetch_header(struct mailprivacy * privacy,
     char ** result,
     size_t * result_len)
 {
-  return mailmessage_fetch_header(msg_info, result, result_len);
+  int r;
+  
+  FETCH_LOCK(privacy);
+  r = mailmessage_fetch_header(msg_info, result, result_len);
+  FETCH_UNLOCK(privacy);
+  
+  return r;
 }
 
 /* end of fetch operations */
@@ -694,75 +801,384 @@ mime_add_alternative(struct mailprivacy * privacy,
 }
 
 /*
-  recursive_check_privacy returns MAIL_NO_ERROR if at least one 
-  part is using a privacy protocol.
+  check_privacy_part() runs the protocols on the given part, the result
+  is taken from the cache when it is enabled.
 */
 
-static int recursive_check_privacy(struct mailprivacy * privacy,
+static int check_privacy_part(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, struct mailmime ** result)
+{
+  unsigned char cache_key[MAILPRIVACY_CACHE_KEY_SIZE];
+  int has_cache_key;
+  int r;
+  
+  has_cache_key = 0;
+  if ((privacy->cache != NULL) &&
+      mailprivacy_is_encrypted(privacy, msg, mime)) {
+    r = mailprivacy_cache_get_key(privacy, msg, mime, cache_key);
+    if (r == MAIL_NO_ERROR)
+      has_cache_key = 1;
+  }
+  
+  if (has_cache_key) {
+    r = mailprivacy_cache_get(privacy, cache_key, result);
+    if (r == MAIL_NO_ERROR)
+      return MAIL_NO_ERROR;
+  }
+  
+  r = privacy_handler(privacy, msg, mime, result);
+  if (r != MAIL_NO_ERROR)
+    return r;
+  
+  if (has_cache_key)
+    mailprivacy_cache_set(privacy, cache_key, * result);
+  
+  return MAIL_NO_ERROR;
+}
+
+/* replaces the part with the result of the protocol */
+
+static int apply_privacy_part(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, struct mailmime * alternative)
+{
+  struct mailmime * multipart;
+  int r;
+  
+  if (privacy->make_alternative) {
+    multipart = mime_add_alternative(privacy, msg, mime, alternative);
+    if (multipart == NULL) {
+      mailprivacy_mime_clear(alternative);
+      mailmime_free(alternative);
+      return MAIL_ERROR_MEMORY;
+    }
+  }
+  else {
+    /* registered so that the files are removed on flush */
+    r = recursive_register_mime(privacy, alternative);
+    if (r != MAIL_NO_ERROR) {
+      mailprivacy_recursive_unregister_mime(privacy, alternative);
+      mailprivacy_mime_clear(alternative);
+      mailmime_free(alternative);
+      return MAIL_ERROR_MEMORY;
+    }
+    mailmime_substitute(mime, alternative);
+    mailmime_free(mime);
+  }
+  
+  return MAIL_NO_ERROR;
+}
+
+static int recursive_check_subparts(struct mailprivacy * privacy,
     mailmessage * msg,
     struct mailmime * mime)
 {
   int r;
   clistiter * cur;
-  struct mailmime * alternative;
   int res;
-  struct mailmime * multipart;
   
-  if (privacy == NULL)
+  switch (mime->mm_type) {
+  case MAILMIME_SINGLE:
+    return MAIL_ERROR_INVAL;
+    
+  case MAILMIME_MULTIPLE:
+    res = MAIL_ERROR_INVAL;
+    
+    for(cur = clist_begin(mime->mm_data.mm_multipart.mm_mp_list) ;
+        cur != NULL ; cur = clist_next(cur)) {
+      struct mailmime * child;
+      
+      child = clist_content(cur);
+      
+      r = recursive_check_privacy(privacy, msg, child);
+      if (r == MAIL_NO_ERROR)
+        res = MAIL_NO_ERROR;
+    }
+    
+    return res;
+    
+  case MAILMIME_MESSAGE:
+    if (mime->mm_data.mm_message.mm_msg_mime != NULL)
+      return recursive_check_privacy(privacy, msg,
+          mime->mm_data.mm_message.mm_msg_mime);
+    return MAIL_ERROR_INVAL;
+    
+  default:
+    return MAIL_ERROR_INVAL;
+  }
+}
+
+#ifdef PRIVACY_USE_THREADS
+
+/* ********************************************************************* */
+/* parallel processing of the protected parts */
+
+struct privacy_job {
+  struct mailmime * mime;
+  struct mailmime * result;
+  int error;
+};
+
+struct privacy_job_list {
+  struct mailprivacy * privacy;
+  mailmessage * msg;
+  carray * jobs;
+  unsigned int next;
+  pthread_mutex_t lock;
+};
+
+int mailprivacy_set_max_workers(struct mailprivacy * privacy,
+    unsigned int max_workers)
+{
+  struct mailprivacy_workers * workers;
+  
+  if (max_workers <= 1) {
+    workers = privacy->workers;
+    if (workers != NULL) {
+      privacy->workers = NULL;
+      pthread_mutex_destroy(&workers->fetch_lock);
+      pthread_mutex_destroy(&workers->ref_lock);
+      free(workers);
+    }
     return MAIL_NO_ERROR;
+  }
+  
+  if (privacy->workers != NULL) {
+    privacy->workers->max_workers = max_workers;
+    return MAIL_NO_ERROR;
+  }
+  
+  workers = malloc(sizeof(* workers));
+  if (workers == NULL)
+    goto err;
+  
+  workers->max_workers = max_workers;
+  if (pthread_mutex_init(&workers->ref_lock, NULL) != 0)
+    goto free;
+  if (pthread_mutex_init(&workers->fetch_lock, NULL) != 0)
+    goto destroy_ref_lock;
+  
+  privacy->workers = workers;
+  
+  return MAIL_NO_ERROR;
+  
+ destroy_ref_lock:
+  pthread_mutex_destroy(&workers->ref_lock);
+ free:
+  free(workers);
+ err:
+  return MAIL_ERROR_MEMORY;
+}
+
+/*
+  collects the parts that will be given to the protocols, the subparts
+  of a protected part are handled by the protocol.
+*/
+
+static int collect_protected_parts(struct mailprivacy * privacy,
+    mailmessage * msg, struct mailmime * mime, carray * jobs)
+{
+  clistiter * cur;
+  struct privacy_job * job;
+  int r;
   
   if (mime_is_registered(privacy, mime))
-    return MAIL_ERROR_INVAL;
+    return MAIL_NO_ERROR;
   
-  r = privacy_handler(privacy, msg, mime, &alternative);
-  if (r == MAIL_NO_ERROR) {
-    if (privacy->make_alternative) {
-      multipart = mime_add_alternative(privacy, msg, mime, alternative);
-      if (multipart == NULL) {
-        mailprivacy_mime_clear(alternative);
-        mailmime_free(alternative);
-        return MAIL_ERROR_MEMORY;
-      }
-    }
-    else {
-      mailmime_substitute(mime, alternative);
-      mailmime_free(mime);
-      mime = NULL;
+  if (mailprivacy_is_encrypted(privacy, msg, mime)) {
+    job = malloc(sizeof(* job));
+    if (job == NULL)
+      return MAIL_ERROR_MEMORY;
+    job->mime = mime;
+    job->result = NULL;
+    job->error = MAIL_ERROR_INVAL;
+    
+    r = carray_add(jobs, job, NULL);
+    if (r < 0) {
+      free(job);
+      return MAIL_ERROR_MEMORY;
     }
     
     return MAIL_NO_ERROR;
   }
-  else {
-    switch (mime->mm_type) {
-    case MAILMIME_SINGLE:
-      return MAIL_ERROR_INVAL;
-    
-    case MAILMIME_MULTIPLE:
-      res = MAIL_ERROR_INVAL;
+  
+  switch (mime->mm_type) {
+  case MAILMIME_MULTIPLE:
+    for(cur = clist_begin(mime->mm_data.mm_multipart.mm_mp_list) ;
+        cur != NULL ; cur = clist_next(cur)) {
+      r = collect_protected_parts(privacy, msg, clist_content(cur), jobs);
+      if (r != MAIL_NO_ERROR)
+        return r;
+    }
+    break;
     
-      for(cur = clist_begin(mime->mm_data.mm_multipart.mm_mp_list) ;
-          cur != NULL ; cur = clist_next(cur)) {
-        struct mailmime * child;
-      
-        child = clist_content(cur);
-      
-        r = recursive_check_privacy(privacy, msg, child);
-        if (r == MAIL_NO_ERROR)
-          res = MAIL_NO_ERROR;
-      }
+  case MAILMIME_MESSAGE:
+    if (mime->mm_data.mm_message.mm_msg_mime != NULL)
+      return collect_protected_parts(privacy, msg,
+          mime->mm_data.mm_message.mm_msg_mime, jobs);
+    break;
+  }
+  
+  return MAIL_NO_ERROR;
+}
+
+static void * privacy_worker(void * data)
+{
+  struct privacy_job_list * list;
+  struct privacy_job * job;
+  
+  list = data;
+  
+  while (1) {
+    pthread_mutex_lock(&list->lock);
+    job = NULL;
+    if (list->next < carray_count(list->jobs)) {
+      job = carray_get(list->jobs, list->next);
+      list->next ++;
+    }
+    pthread_mutex_unlock(&list->lock);
     
-      return res;
+    if (job == NULL)
+      break;
     
-    case MAILMIME_MESSAGE:
-      if (mime->mm_data.mm_message.mm_msg_mime != NULL)
-        return recursive_check_privacy(privacy, msg,
-            mime->mm_data.mm_message.mm_msg_mime);
-      return MAIL_ERROR_INVAL;
-
-    default:
-      return MAIL_ERROR_INVAL;
+    job->error = check_privacy_part(list->privacy, list->msg,
+        job->mime, &job->result);
+  }
+  
+  return NULL;
+}
+
+/*
+  parallel_check_privacy() sets * handled_result to 0 when there are not
+  enough protected parts to use the workers, the parts are then checked
+  sequentially.
+*/
+
+static int parallel_check_privacy(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, int * handled_result)
+{
+  struct privacy_job_list list;
+  pthread_t * threads;
+  unsigned int thread_count;
+  unsigned int count;
+  unsigned int i;
+  int res;
+  int r;
+  
+  * handled_result = 0;
+  
+  list.privacy = privacy;
+  list.msg = msg;
+  list.next = 0;
+  list.jobs = carray_new(16);
+  if (list.jobs == NULL)
+    return MAIL_ERROR_MEMORY;
+  
+  r = collect_protected_parts(privacy, msg, mime, list.jobs);
+  if ((r != MAIL_NO_ERROR) || (carray_count(list.jobs) < 2)) {
+    res = MAIL_ERROR_INVAL;
+    goto free_jobs;
+  }
+  
+  if (pthread_mutex_init(&list.lock, NULL) != 0) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_jobs;
+  }
+  
+  /* the caller thread is one of the workers */
+  count = carray_count(list.jobs);
+  if (count > privacy->workers->max_workers)
+    count = privacy->workers->max_workers;
+  thread_count = 0;
+  threads = malloc((count - 1) * sizeof(* threads));
+  if (threads != NULL) {
+    for(i = 0 ; i < count - 1 ; i ++) {
+      if (pthread_create(&threads[thread_count], NULL,
+              privacy_worker, &list) != 0)
+        break;
+      thread_count ++;
     }
   }
+  
+  privacy_worker(&list);
+  
+  for(i = 0 ; i < thread_count ; i ++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+  pthread_mutex_destroy(&list.lock);
+  
+  /* results are applied in the order of the parts */
+  * handled_result = 1;
+  res = MAIL_ERROR_INVAL;
+  for(i = 0 ; i < carray_count(list.jobs) ; i ++) {
+    struct privacy_job * job;
+    
+    job = carray_get(list.jobs, i);
+    if (job->error == MAIL_NO_ERROR)
+      r = apply_privacy_part(privacy, msg, job->mime, job->result);
+    else
+      r = recursive_check_subparts(privacy, msg, job->mime);
+    if (r == MAIL_NO_ERROR)
+      res = MAIL_NO_ERROR;
+  }
+  
+ free_jobs:
+  for(i = 0 ; i < carray_count(list.jobs) ; i ++)
+    free(carray_get(list.jobs, i));
+  carray_free(list.jobs);
+  
+  return res;
+}
+
+#else
+
+int mailprivacy_set_max_workers(struct mailprivacy * privacy,
+    unsigned int max_workers)
+{
+  if (max_workers <= 1)
+    return MAIL_NO_ERROR;
+  
+  return MAIL_ERROR_NOT_IMPLEMENTED;
+}
+
+#endif
+
+/*
+  recursive_check_privacy returns MAIL_NO_ERROR if at least one 
+  part is using a privacy protocol.
+*/
+
+static int recursive_check_privacy(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime)
+{
+  int r;
+  struct mailmime * alternative;
+#ifdef PRIVACY_USE_THREADS
+  int handled;
+#endif
+  
+  if (privacy == NULL)
+    return MAIL_NO_ERROR;
+  
+  if (mime_is_registered(privacy, mime))
+    return MAIL_ERROR_INVAL;
+  
+#ifdef PRIVACY_USE_THREADS
+  if (privacy->workers != NULL) {
+    r = parallel_check_privacy(privacy, msg, mime, &handled);
+    if (handled)
+      return r;
+  }
+#endif
+  
+  r = check_privacy_part(privacy, msg, mime, &alternative);
+  if (r == MAIL_NO_ERROR)
+    return apply_privacy_part(privacy, msg, mime, alternative);
+  
+  return recursive_check_subparts(privacy, msg, mime);
 }
 
 static int privacy_handler(struct mailprivacy * privacy,
@@ -142,4 +142,55 @@ LIBETPAN_EXPORT
 void mailprivacy_recursive_unregister_mime(struct mailprivacy * privacy,
     struct mailmime * mime);
 
+/*
+  mailprivacy_set_cache_size() enables a cache of the decrypted and
+  verified parts, so that a message opened again is not given to the
+  protocols a second time. The parts are encrypted in memory with a key
+  generated when the cache is created.
+
+  max_size is the maximum size in bytes of the cached parts, 0 disables
+  the cache, which is the default.
+
+  returns MAIL_ERROR_NOT_IMPLEMENTED when libetpan is built without
+  OpenSSL.
+*/
+
+LIBETPAN_EXPORT
+int mailprivacy_set_cache_size(struct mailprivacy * privacy, size_t max_size);
+
+/*
+  mailprivacy_cache_set_key_identity() sets a string identifying the
+  keys and the trust settings in use (for example a fingerprint of the
+  keyring), it is part of the key of the cached parts.
+*/
+
+LIBETPAN_EXPORT
+int mailprivacy_cache_set_key_identity(struct mailprivacy * privacy,
+    const char * identity);
+
+/*
+  mailprivacy_cache_invalidate() removes all the cached parts, it must be
+  called when a key or the trust of a certificate changes.
+*/
+
+LIBETPAN_EXPORT
+void mailprivacy_cache_invalidate(struct mailprivacy * privacy);
+
+/*
+  mailprivacy_set_max_workers() sets the number of threads used to
+  decrypt and verify the protected parts of a message, the parts are
+  given to the protocols concurrently and the results are then put in
+  the message in order. 0 or 1 processes the parts sequentially, which
+  is the default.
+
+  This must not be called while a message is being processed.
+
+  returns MAIL_ERROR_NOT_IMPLEMENTED when libetpan is built without
+  threads.
+*/
+
+LIBETPAN_EXPORT
+int mailprivacy_set_max_workers(struct mailprivacy * privacy,
+    unsigned int max_workers);
+
 #endif
@@ -0,0 +1,690 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2013 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "mailprivacy.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+#include <pthread.h>
+#elif (defined WIN32)
+#include <windows.h>
+#endif
+#endif
+#include "mailprivacy_tools.h"
+#include "mailprivacy_tools_private.h"
+
+#if defined(USE_SSL) && !defined(USE_GNUTLS)
+#define MAILPRIVACY_CACHE
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#endif
+
+/*
+  The results of the protocols are kept in memory, encrypted with
+  AES-256-GCM and a key generated for each cache. An entry is found
+  with the SHA-256 of the key identity and of the protected part, the
+  least recently used entries are removed when the cache is full.
+*/
+
+#ifdef MAILPRIVACY_CACHE
+
+#define CACHE_IV_SIZE 12
+#define CACHE_TAG_SIZE 16
+
+struct mailprivacy_cache_entry {
+  unsigned char key[MAILPRIVACY_CACHE_KEY_SIZE];
+  unsigned char iv[CACHE_IV_SIZE];
+  unsigned char tag[CACHE_TAG_SIZE];
+  unsigned char * data;
+  size_t len;
+  struct mailprivacy_cache_entry * prev;
+  struct mailprivacy_cache_entry * next;
+};
+
+struct mailprivacy_cache {
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+  pthread_mutex_t lock;
+#elif (defined WIN32)
+  CRITICAL_SECTION lock;
+#endif
+#endif
+  /* key => entry */
+  chash * entries;
+  /* most recently used first */
+  struct mailprivacy_cache_entry * first;
+  struct mailprivacy_cache_entry * last;
+  size_t size;
+  size_t max_size;
+  char * identity;
+  unsigned char secret[32];
+};
+
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+#define LOCK(lock) pthread_mutex_lock(&lock);
+#define UNLOCK(lock) pthread_mutex_unlock(&lock);
+#elif (defined WIN32)
+#define LOCK(lock) EnterCriticalSection(&lock);
+#define UNLOCK(lock) LeaveCriticalSection(&lock);
+#endif
+#else
+#define LOCK(lock) do {} while (0)
+#define UNLOCK(lock) do {} while (0)
+#endif
+
+static struct mailprivacy_cache * cache_new(size_t max_size)
+{
+  struct mailprivacy_cache * cache;
+
+  cache = malloc(sizeof(* cache));
+  if (cache == NULL)
+    goto err;
+
+  cache->entries = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
+  if (cache->entries == NULL)
+    goto free;
+
+  if (RAND_bytes(cache->secret, sizeof(cache->secret)) != 1)
+    goto free_entries;
+
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+  if (pthread_mutex_init(&cache->lock, NULL) != 0)
+    goto free_entries;
+#elif (defined WIN32)
+  InitializeCriticalSection(&cache->lock);
+#endif
+#endif
+
+  cache->first = NULL;
+  cache->last = NULL;
+  cache->size = 0;
+  cache->max_size = max_size;
+  cache->identity = NULL;
+
+  return cache;
+
+ free_entries:
+  chash_free(cache->entries);
+ free:
+  free(cache);
+ err:
+  return NULL;
+}
+
+static void entry_unlink(struct mailprivacy_cache * cache,
+    struct mailprivacy_cache_entry * entry)
+{
+  if (entry->prev != NULL)
+    entry->prev->next = entry->next;
+  else
+    cache->first = entry->next;
+  if (entry->next != NULL)
+    entry->next->prev = entry->prev;
+  else
+    cache->last = entry->prev;
+  entry->prev = NULL;
+  entry->next = NULL;
+}
+
+static void entry_push_front(struct mailprivacy_cache * cache,
+    struct mailprivacy_cache_entry * entry)
+{
+  entry->prev = NULL;
+  entry->next = cache->first;
+  if (cache->first != NULL)
+    cache->first->prev = entry;
+  else
+    cache->last = entry;
+  cache->first = entry;
+}
+
+static void entry_remove(struct mailprivacy_cache * cache,
+    struct mailprivacy_cache_entry * entry)
+{
+  chashdatum key;
+
+  entry_unlink(cache, entry);
+  key.data = entry->key;
+  key.len = sizeof(entry->key);
+  chash_delete(cache->entries, &key, NULL);
+  cache->size -= entry->len;
+  free(entry->data);
+  free(entry);
+}
+
+static void cache_evict(struct mailprivacy_cache * cache, size_t max_size)
+{
+  while ((cache->last != NULL) && (cache->size > max_size))
+    entry_remove(cache, cache->last);
+}
+
+int mailprivacy_set_cache_size(struct mailprivacy * privacy, size_t max_size)
+{
+  struct mailprivacy_cache * cache;
+
+  cache = privacy->cache;
+  if (max_size == 0) {
+    if (cache != NULL) {
+      privacy->cache = NULL;
+      mailprivacy_cache_free(cache);
+    }
+    return MAIL_NO_ERROR;
+  }
+
+  if (cache == NULL) {
+    cache = cache_new(max_size);
+    if (cache == NULL)
+      return MAIL_ERROR_MEMORY;
+    privacy->cache = cache;
+    return MAIL_NO_ERROR;
+  }
+
+  LOCK(cache->lock);
+  cache->max_size = max_size;
+  cache_evict(cache, max_size);
+  UNLOCK(cache->lock);
+
+  return MAIL_NO_ERROR;
+}
+
+int mailprivacy_cache_set_key_identity(struct mailprivacy * privacy,
+    const char * identity)
+{
+  struct mailprivacy_cache * cache;
+  char * dup_identity;
+
+  cache = privacy->cache;
+  if (cache == NULL)
+    return MAIL_ERROR_INVAL;
+
+  dup_identity = NULL;
+  if (identity != NULL) {
+    dup_identity = strdup(identity);
+    if (dup_identity == NULL)
+      return MAIL_ERROR_MEMORY;
+  }
+
+  LOCK(cache->lock);
+  free(cache->identity);
+  cache->identity = dup_identity;
+  UNLOCK(cache->lock);
+
+  return MAIL_NO_ERROR;
+}
+
+void mailprivacy_cache_invalidate(struct mailprivacy * privacy)
+{
+  struct mailprivacy_cache * cache;
+
+  cache = privacy->cache;
+  if (cache == NULL)
+    return;
+
+  LOCK(cache->lock);
+  cache_evict(cache, 0);
+  UNLOCK(cache->lock);
+}
+
+void mailprivacy_cache_free(struct mailprivacy_cache * cache)
+{
+  if (cache == NULL)
+    return;
+
+  cache_evict(cache, 0);
+  chash_free(cache->entries);
+  free(cache->identity);
+  OPENSSL_cleanse(cache->secret, sizeof(cache->secret));
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+  pthread_mutex_destroy(&cache->lock);
+#elif (defined WIN32)
+  DeleteCriticalSection(&cache->lock);
+#endif
+#endif
+  free(cache);
+}
+
+int mailprivacy_cache_get_key(struct mailprivacy * privacy,
+    mailmessage * msg, struct mailmime * mime, unsigned char * key)
+{
+  struct mailprivacy_cache * cache;
+  MMAPString * str;
+  EVP_MD_CTX * md_ctx;
+  uint32_t identity_len;
+  unsigned int key_len;
+  int r;
+  int res;
+
+  cache = privacy->cache;
+  if (cache == NULL) {
+    res = MAIL_ERROR_INVAL;
+    goto err;
+  }
+
+  r = mailprivacy_fetch_mime_body_to_mem(privacy, msg, mime, &str);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto err;
+  }
+
+  md_ctx = EVP_MD_CTX_create();
+  if (md_ctx == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_str;
+  }
+
+  if (EVP_DigestInit_ex(md_ctx, EVP_sha256(), NULL) != 1) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_md;
+  }
+
+  /* the length separates the identity from the part */
+  LOCK(cache->lock);
+  identity_len = 0;
+  if (cache->identity != NULL)
+    identity_len = (uint32_t) strlen(cache->identity);
+  r = EVP_DigestUpdate(md_ctx, &identity_len, sizeof(identity_len));
+  if ((r == 1) && (identity_len != 0))
+    r = EVP_DigestUpdate(md_ctx, cache->identity, identity_len);
+  UNLOCK(cache->lock);
+  if (r == 1)
+    r = EVP_DigestUpdate(md_ctx, str->str, str->len);
+  if (r == 1)
+    r = EVP_DigestFinal_ex(md_ctx, key, &key_len);
+  if ((r != 1) || (key_len != MAILPRIVACY_CACHE_KEY_SIZE)) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_md;
+  }
+
+  EVP_MD_CTX_destroy(md_ctx);
+  mmap_string_free(str);
+
+  return MAIL_NO_ERROR;
+
+ free_md:
+  EVP_MD_CTX_destroy(md_ctx);
+ free_str:
+  mmap_string_free(str);
+ err:
+  return res;
+}
+
+/* the key of the entry is authenticated with the content */
+
+static int cache_encrypt(struct mailprivacy_cache * cache,
+    struct mailprivacy_cache_entry * entry, char * content, size_t len)
+{
+  EVP_CIPHER_CTX * ctx;
+  int outl;
+  int res;
+
+  if (len > INT_MAX - 1)
+    return MAIL_ERROR_INVAL;
+
+  if (RAND_bytes(entry->iv, sizeof(entry->iv)) != 1)
+    return MAIL_ERROR_MEMORY;
+
+  entry->data = malloc(len + 1);
+  if (entry->data == NULL)
+    return MAIL_ERROR_MEMORY;
+
+  ctx = EVP_CIPHER_CTX_new();
+  if (ctx == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_data;
+  }
+
+  res = MAIL_ERROR_MEMORY;
+  if (EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL,
+          cache->secret, entry->iv) != 1)
+    goto free_ctx;
+  if (EVP_EncryptUpdate(ctx, NULL, &outl,
+          entry->key, sizeof(entry->key)) != 1)
+    goto free_ctx;
+  if (EVP_EncryptUpdate(ctx, entry->data, &outl,
+          (unsigned char *) content, (int) len) != 1)
+    goto free_ctx;
+  entry->len = outl;
+  if (EVP_EncryptFinal_ex(ctx, entry->data + entry->len, &outl) != 1)
+    goto free_ctx;
+  entry->len += outl;
+  if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG,
+          sizeof(entry->tag), entry->tag) != 1)
+    goto free_ctx;
+
+  EVP_CIPHER_CTX_free(ctx);
+
+  return MAIL_NO_ERROR;
+
+ free_ctx:
+  EVP_CIPHER_CTX_free(ctx);
+ free_data:
+  free(entry->data);
+  entry->data = NULL;
+  return res;
+}
+
+static int cache_decrypt(struct mailprivacy_cache * cache,
+    struct mailprivacy_cache_entry * entry, char ** result)
+{
+  EVP_CIPHER_CTX * ctx;
+  unsigned char * content;
+  int outl;
+  int len;
+
+  content = malloc(entry->len + 1);
+  if (content == NULL)
+    return MAIL_ERROR_MEMORY;
+
+  ctx = EVP_CIPHER_CTX_new();
+  if (ctx == NULL)
+    goto free_content;
+
+  if (EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL,
+          cache->secret, entry->iv) != 1)
+    goto free_ctx;
+  if (EVP_DecryptUpdate(ctx, NULL, &outl,
+          entry->key, sizeof(entry->key)) != 1)
+    goto free_ctx;
+  if (EVP_DecryptUpdate(ctx, content, &outl,
+          entry->data, (int) entry->len) != 1)
+    goto free_ctx;
+  len = outl;
+  if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG,
+          sizeof(entry->tag), entry->tag) != 1)
+    goto free_ctx;
+  if (EVP_DecryptFinal_ex(ctx, content + len, &outl) != 1)
+    goto free_ctx;
+
+  EVP_CIPHER_CTX_free(ctx);
+
+  * result = (char *) content;
+
+  return MAIL_NO_ERROR;
+
+ free_ctx:
+  EVP_CIPHER_CTX_free(ctx);
+ free_content:
+  free(content);
+  return MAIL_ERROR_INVAL;
+}
+
+int mailprivacy_cache_get(struct mailprivacy * privacy,
+    unsigned char * key, struct mailmime ** result)
+{
+  struct mailprivacy_cache * cache;
+  struct mailprivacy_cache_entry * entry;
+  chashdatum hash_key;
+  chashdatum value;
+  char * content;
+  size_t len;
+  int r;
+
+  cache = privacy->cache;
+  if (cache == NULL)
+    return MAIL_ERROR_INVAL;
+
+  hash_key.data = key;
+  hash_key.len = MAILPRIVACY_CACHE_KEY_SIZE;
+
+  LOCK(cache->lock);
+  r = chash_get(cache->entries, &hash_key, &value);
+  if (r < 0) {
+    UNLOCK(cache->lock);
+    return MAIL_ERROR_INVAL;
+  }
+  entry = value.data;
+  len = entry->len;
+  r = cache_decrypt(cache, entry, &content);
+  if (r != MAIL_NO_ERROR) {
+    entry_remove(cache, entry);
+    UNLOCK(cache->lock);
+    return r;
+  }
+  entry_unlink(cache, entry);
+  entry_push_front(cache, entry);
+  UNLOCK(cache->lock);
+
+  r = mailprivacy_get_part_from_mem(privacy, 0, 0, content, len, result);
+  OPENSSL_cleanse(content, len);
+  free(content);
+
+  return r;
+}
+
+/*
+  a part that could not be decrypted, for example because of a missing
+  passphrase, must be decrypted again on next access.
+*/
+
+static int result_is_complete(struct mailmime * mime)
+{
+  clistiter * cur;
+
+  switch (mime->mm_type) {
+  case MAILMIME_MULTIPLE:
+    if ((mime->mm_content_type != NULL) &&
+        (strcasecmp(mime->mm_content_type->ct_subtype, "x-decrypted") == 0) &&
+        (clist_count(mime->mm_data.mm_multipart.mm_mp_list) < 2))
+      return 0;
+
+    for(cur = clist_begin(mime->mm_data.mm_multipart.mm_mp_list) ;
+        cur != NULL ; cur = clist_next(cur)) {
+      if (!result_is_complete(clist_content(cur)))
+        return 0;
+    }
+    return 1;
+
+  case MAILMIME_MESSAGE:
+    if (mime->mm_data.mm_message.mm_msg_mime != NULL)
+      return result_is_complete(mime->mm_data.mm_message.mm_msg_mime);
+    return 1;
+
+  default:
+    return 1;
+  }
+}
+
+/* the headers of the part are written since it has no parent */
+
+static int write_result(MMAPString * str, struct mailmime * mime)
+{
+  int col;
+  int r;
+
+  if ((mime->mm_type == MAILMIME_MULTIPLE) &&
+      (mime->mm_content_type != NULL) &&
+      (mailmime_content_param_get(mime->mm_content_type,
+          "boundary") == NULL)) {
+    struct mailmime_parameter * param;
+    char * boundary;
+
+    boundary = mailmime_generate_boundary();
+    if (boundary == NULL)
+      return MAIL_ERROR_MEMORY;
+    param = mailmime_param_new_with_data("boundary", boundary);
+    free(boundary);
+    if (param == NULL)
+      return MAIL_ERROR_MEMORY;
+    r = clist_append(mime->mm_content_type->ct_parameters, param);
+    if (r < 0) {
+      mailmime_parameter_free(param);
+      return MAIL_ERROR_MEMORY;
+    }
+  }
+
+  col = 0;
+  if (mime->mm_content_type != NULL) {
+    r = mailmime_content_write_mem(str, &col, mime->mm_content_type);
+    if (r != MAILIMF_NO_ERROR)
+      return MAIL_ERROR_MEMORY;
+  }
+  if (mime->mm_mime_fields != NULL) {
+    r = mailmime_fields_write_mem(str, &col, mime->mm_mime_fields);
+    if (r != MAILIMF_NO_ERROR)
+      return MAIL_ERROR_MEMORY;
+  }
+  r = mailimf_string_write_mem(str, &col, "\r\n", 2);
+  if (r != MAILIMF_NO_ERROR)
+    return MAIL_ERROR_MEMORY;
+
+  r = mailmime_write_mem(str, &col, mime);
+  if (r != MAILIMF_NO_ERROR)
+    return MAIL_ERROR_FILE;
+
+  return MAIL_NO_ERROR;
+}
+
+void mailprivacy_cache_set(struct mailprivacy * privacy,
+    unsigned char * key, struct mailmime * result)
+{
+  struct mailprivacy_cache * cache;
+  struct mailprivacy_cache_entry * entry;
+  chashdatum hash_key;
+  chashdatum value;
+  MMAPString * str;
+  int r;
+
+  cache = privacy->cache;
+  if (cache == NULL)
+    return;
+
+  if (!result_is_complete(result))
+    return;
+
+  str = mmap_string_new("");
+  if (str == NULL)
+    return;
+
+  r = write_result(str, result);
+  if (r != MAIL_NO_ERROR)
+    goto free_str;
+
+  entry = malloc(sizeof(* entry));
+  if (entry == NULL)
+    goto free_str;
+  memcpy(entry->key, key, sizeof(entry->key));
+  entry->prev = NULL;
+  entry->next = NULL;
+
+  LOCK(cache->lock);
+  r = cache_encrypt(cache, entry, str->str, str->len);
+  if ((r != MAIL_NO_ERROR) || (entry->len > cache->max_size)) {
+    UNLOCK(cache->lock);
+    goto free_entry;
+  }
+
+  hash_key.data = entry->key;
+  hash_key.len = sizeof(entry->key);
+
+  /* replaces the entry stored by another thread meanwhile */
+  r = chash_get(cache->entries, &hash_key, &value);
+  if (r == 0)
+    entry_remove(cache, value.data);
+
+  value.data = entry;
+  value.len = 0;
+  r = chash_set(cache->entries, &hash_key, &value, NULL);
+  if (r < 0) {
+    UNLOCK(cache->lock);
+    goto free_entry;
+  }
+  entry_push_front(cache, entry);
+  cache->size += entry->len;
+  cache_evict(cache, cache->max_size);
+  UNLOCK(cache->lock);
+
+  OPENSSL_cleanse(str->str, str->len);
+  mmap_string_free(str);
+
+  return;
+
+ free_entry:
+  free(entry->data);
+  free(entry);
+ free_str:
+  OPENSSL_cleanse(str->str, str->len);
+  mmap_string_free(str);
+}
+
+#else
+
+int mailprivacy_set_cache_size(struct mailprivacy * privacy, size_t max_size)
+{
+  if (max_size == 0)
+    return MAIL_NO_ERROR;
+
+  return MAIL_ERROR_NOT_IMPLEMENTED;
+}
+
+int mailprivacy_cache_set_key_identity(struct mailprivacy * privacy,
+    const char * identity)
+{
+  return MAIL_ERROR_INVAL;
+}
+
+void mailprivacy_cache_invalidate(struct mailprivacy * privacy)
+{
+}
+
+void mailprivacy_cache_free(struct mailprivacy_cache * cache)
+{
+}
+
+int mailprivacy_cache_get_key(struct mailprivacy * privacy,
+    mailmessage * msg, struct mailmime * mime, unsigned char * key)
+{
+  return MAIL_ERROR_INVAL;
+}
+
+int mailprivacy_cache_get(struct mailprivacy * privacy,
+    unsigned char * key, struct mailmime ** result)
+{
+  return MAIL_ERROR_INVAL;
+}
+
+void mailprivacy_cache_set(struct mailprivacy * privacy,
+    unsigned char * key, struct mailmime * result)
+{
+}
+
+#endif
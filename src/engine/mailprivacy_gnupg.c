@@ -72,6 +72,10 @@
 #include <ctype.h>
 #include <errno.h>
 
+#ifdef USE_GPGME
+#include <gpgme.h>
+#endif
+
 #include "../data-types/syscall_wrappers.h"
 
 enum {
@@ -88,6 +92,13 @@ static char * get_passphrase(struct mailprivacy * privacy,
     char * user_id);
 static int get_userid(char * filename, char * username, size_t length);
 
+#ifdef USE_GPGME
+static struct mailprivacy_protocol pgp_gpgme_protocol;
+
+static void pgp_gpgme_init(void);
+static void pgp_gpgme_done(void);
+#endif
+
 
 static int gpg_command_passphrase(struct mailprivacy * privacy,
     struct mailmessage * msg,
@@ -2837,11 +2848,26 @@ static int mailprivacy_gnupg_init_lock_done = 0;
 #define UNLOCK() LeaveCriticalSection(&encryption_id_hash_lock)
 #endif
 #else
-#define LOCK() do while (0)
-#define UNLOCK() do while (0)
+#define LOCK() do {} while (0)
+#define UNLOCK() do {} while (0)
 #endif
 static chash * encryption_id_hash = NULL;
 
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+static pthread_mutex_t passphrase_hash_lock = PTHREAD_MUTEX_INITIALIZER;
+#define PASSPHRASE_LOCK() pthread_mutex_lock(&passphrase_hash_lock)
+#define PASSPHRASE_UNLOCK() pthread_mutex_unlock(&passphrase_hash_lock)
+#elif (defined WIN32)
+static CRITICAL_SECTION passphrase_hash_lock = {0};
+#define PASSPHRASE_LOCK() EnterCriticalSection(&passphrase_hash_lock)
+#define PASSPHRASE_UNLOCK() LeaveCriticalSection(&passphrase_hash_lock)
+#endif
+#else
+#define PASSPHRASE_LOCK() do {} while (0)
+#define PASSPHRASE_UNLOCK() do {} while (0)
+#endif
+
 static void mailprivacy_gnupg_init_lock(void)
 {
 #ifdef LIBETPAN_REENTRANT
@@ -2849,21 +2875,67 @@ static void mailprivacy_gnupg_init_lock(void)
 #elif (defined WIN32)
   if (InterlockedExchange(&mailprivacy_gnupg_init_lock_done, 1) == 0){
     InitializeCriticalSection(&encryption_id_hash_lock);
+    InitializeCriticalSection(&passphrase_hash_lock);
   }
 #endif
 #endif
 }
 
+/* protocol registered by mailprivacy_gnupg_init() */
+
+static struct mailprivacy_protocol * pgp_backend_protocol = &pgp_protocol;
+
+int mailprivacy_gnupg_set_backend(struct mailprivacy * privacy, int backend)
+{
+  struct mailprivacy_protocol * protocol;
+  int r;
+  
+  switch (backend) {
+  case MAILPRIVACY_GNUPG_BACKEND_COMMAND:
+    protocol = &pgp_protocol;
+    break;
+#ifdef USE_GPGME
+  case MAILPRIVACY_GNUPG_BACKEND_GPGME:
+    pgp_gpgme_init();
+    protocol = &pgp_gpgme_protocol;
+    break;
+#endif
+  default:
+    return MAIL_ERROR_NOT_IMPLEMENTED;
+  }
+  
+  if (protocol == pgp_backend_protocol)
+    return MAIL_NO_ERROR;
+  
+  mailprivacy_unregister(privacy, pgp_backend_protocol);
+  r = mailprivacy_register(privacy, protocol);
+  if (r != MAIL_NO_ERROR) {
+    mailprivacy_register(privacy, pgp_backend_protocol);
+    return r;
+  }
+  pgp_backend_protocol = protocol;
+  
+  return MAIL_NO_ERROR;
+}
+
 int mailprivacy_gnupg_init(struct mailprivacy * privacy)
 {
-  return mailprivacy_register(privacy, &pgp_protocol);
+  mailprivacy_gnupg_init_lock();
+  
+  return mailprivacy_register(privacy, pgp_backend_protocol);
 }
 
 void mailprivacy_gnupg_done(struct mailprivacy * privacy)
 {
   mailprivacy_unregister(privacy, &pgp_protocol);
+#ifdef USE_GPGME
+  mailprivacy_unregister(privacy, &pgp_gpgme_protocol);
+  pgp_gpgme_done();
+#endif
 }
 
+/* the callers hold encryption_id_hash_lock */
+
 static clist * get_list(struct mailprivacy * privacy, mailmessage * msg)
 {
   clist * encryption_id_list;
@@ -3001,18 +3073,22 @@ int mailprivacy_gnupg_set_encryption_id(struct mailprivacy * privacy,
   for(n = buf ; * n != '\0' ; n ++)
     * n = toupper((unsigned char) * n);
   
-  if (passphrase_hash == NULL) {
-    passphrase_hash = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYALL);
-    if (passphrase_hash == NULL)
-      return MAIL_ERROR_MEMORY;
-  }
-  
   key.data = buf;
   key.len = (unsigned int) strlen(buf) + 1;
   value.data = passphrase;
   value.len = (unsigned int) strlen(passphrase) + 1;
   
+  PASSPHRASE_LOCK();
+  if (passphrase_hash == NULL) {
+    passphrase_hash = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYALL);
+    if (passphrase_hash == NULL) {
+      PASSPHRASE_UNLOCK();
+      return MAIL_ERROR_MEMORY;
+    }
+  }
+  
   r = chash_set(passphrase_hash, &key, &value, NULL);
+  PASSPHRASE_UNLOCK();
   if (r < 0) {
     return MAIL_ERROR_MEMORY;
   }
@@ -3035,17 +3111,1637 @@ static char * get_passphrase(struct mailprivacy * privacy,
   for(n = buf ; * n != '\0' ; n ++)
     * n = toupper((unsigned char) * n);
   
-  if (passphrase_hash == NULL)
-    return NULL;
-  
   key.data = buf;
   key.len = (unsigned int) strlen(buf) + 1;
   
-  r = chash_get(passphrase_hash, &key, &value);
-  if (r < 0)
-    return NULL;
-  
-  passphrase = strdup(value.data);
+  passphrase = NULL;
+  PASSPHRASE_LOCK();
+  if (passphrase_hash != NULL) {
+    r = chash_get(passphrase_hash, &key, &value);
+    if (r == 0)
+      passphrase = strdup(value.data);
+  }
+  PASSPHRASE_UNLOCK();
   
   return passphrase;
 }
+
+
+/* ********************************************************************* */
+/* in-process backend, GPGME */
+
+#ifdef USE_GPGME
+
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+static pthread_mutex_t gpgme_keys_lock = PTHREAD_MUTEX_INITIALIZER;
+#define GPGME_LOCK() pthread_mutex_lock(&gpgme_keys_lock)
+#define GPGME_UNLOCK() pthread_mutex_unlock(&gpgme_keys_lock)
+#define GPGME_THREAD_CONTEXT
+#elif (defined WIN32)
+static CRITICAL_SECTION gpgme_keys_lock = {0};
+#define GPGME_LOCK() EnterCriticalSection(&gpgme_keys_lock)
+#define GPGME_UNLOCK() LeaveCriticalSection(&gpgme_keys_lock)
+#else
+#define GPGME_LOCK() do {} while (0)
+#define GPGME_UNLOCK() do {} while (0)
+#endif
+#else
+#define GPGME_LOCK() do {} while (0)
+#define GPGME_UNLOCK() do {} while (0)
+#endif
+
+/*
+  a context runs a gpg engine process, it is kept for the next
+  operations of the thread and released when the thread exits.
+*/
+
+#ifdef GPGME_THREAD_CONTEXT
+static pthread_once_t gpgme_once = PTHREAD_ONCE_INIT;
+static pthread_key_t gpgme_context_key;
+
+static void pgp_gpgme_context_release(void * data)
+{
+  gpgme_release(data);
+}
+#endif
+
+static void pgp_gpgme_engine_init(void)
+{
+  gpgme_check_version(NULL);
+#ifdef GPGME_THREAD_CONTEXT
+  pthread_key_create(&gpgme_context_key, pgp_gpgme_context_release);
+#endif
+}
+
+static void pgp_gpgme_init(void)
+{
+#ifdef GPGME_THREAD_CONTEXT
+  pthread_once(&gpgme_once, pgp_gpgme_engine_init);
+#elif defined(LIBETPAN_REENTRANT) && defined(WIN32)
+  static LONG volatile pgp_gpgme_init_done = 0;
+
+  if (InterlockedExchange(&pgp_gpgme_init_done, 1) == 0) {
+    InitializeCriticalSection(&gpgme_keys_lock);
+    pgp_gpgme_engine_init();
+  }
+#else
+  static int pgp_gpgme_init_done = 0;
+
+  if (!pgp_gpgme_init_done) {
+    pgp_gpgme_init_done = 1;
+    pgp_gpgme_engine_init();
+  }
+#endif
+}
+
+static gpgme_ctx_t pgp_gpgme_get_context(void)
+{
+  gpgme_ctx_t ctx;
+
+#ifdef GPGME_THREAD_CONTEXT
+  ctx = pthread_getspecific(gpgme_context_key);
+  if (ctx != NULL)
+    return ctx;
+#endif
+
+  if (gpgme_new(&ctx) != GPG_ERR_NO_ERROR)
+    return NULL;
+
+  if (gpgme_set_protocol(ctx, GPGME_PROTOCOL_OpenPGP) != GPG_ERR_NO_ERROR) {
+    gpgme_release(ctx);
+    return NULL;
+  }
+  /* passphrases are given by the passphrase callback */
+  gpgme_set_pinentry_mode(ctx, GPGME_PINENTRY_MODE_LOOPBACK);
+
+#ifdef GPGME_THREAD_CONTEXT
+  if (pthread_setspecific(gpgme_context_key, ctx) != 0) {
+    gpgme_release(ctx);
+    return NULL;
+  }
+#endif
+
+  return ctx;
+}
+
+static void pgp_gpgme_put_context(gpgme_ctx_t ctx)
+{
+#ifdef GPGME_THREAD_CONTEXT
+  gpgme_signers_clear(ctx);
+  gpgme_set_passphrase_cb(ctx, NULL, NULL);
+  gpgme_set_armor(ctx, 0);
+#else
+  gpgme_release(ctx);
+#endif
+}
+
+/*
+  the keys are looked up once, the hash maps the upper case address
+  followed by 'S' for a secret key or 'P' for a public key to the key.
+*/
+
+static chash * gpgme_keys = NULL;
+
+static void pgp_gpgme_done(void)
+{
+  chashiter * iter;
+#ifdef GPGME_THREAD_CONTEXT
+  gpgme_ctx_t ctx;
+
+  ctx = pthread_getspecific(gpgme_context_key);
+  if (ctx != NULL) {
+    pthread_setspecific(gpgme_context_key, NULL);
+    gpgme_release(ctx);
+  }
+#endif
+
+  GPGME_LOCK();
+  if (gpgme_keys != NULL) {
+    for(iter = chash_begin(gpgme_keys) ; iter != NULL ;
+        iter = chash_next(gpgme_keys, iter)) {
+      chashdatum value;
+
+      chash_value(iter, &value);
+      gpgme_key_unref(value.data);
+    }
+    chash_free(gpgme_keys);
+    gpgme_keys = NULL;
+  }
+  GPGME_UNLOCK();
+}
+
+static int pgp_gpgme_key_usable(gpgme_key_t key, int secret)
+{
+  if (key->revoked || key->expired || key->disabled || key->invalid)
+    return 0;
+
+  if (secret)
+    return key->can_sign;
+  else
+    return key->can_encrypt;
+}
+
+/* returns a reference on the key, NULL if not found */
+
+static gpgme_key_t pgp_gpgme_find_key(gpgme_ctx_t ctx,
+    char * address, int secret)
+{
+  char buf[MAX_EMAIL_SIZE + 1];
+  char pattern[MAX_EMAIL_SIZE + 2];
+  chashdatum key;
+  chashdatum value;
+  gpgme_key_t found;
+  gpgme_key_t current;
+  size_t len;
+  char * n;
+  int r;
+
+  strncpy(buf, address, MAX_EMAIL_SIZE);
+  buf[MAX_EMAIL_SIZE - 1] = '\0';
+  for(n = buf ; * n != '\0' ; n ++)
+    * n = toupper((unsigned char) * n);
+  len = strlen(buf);
+  buf[len] = secret ? 'S' : 'P';
+  buf[len + 1] = '\0';
+
+  key.data = buf;
+  key.len = (unsigned int) len + 1;
+
+  found = NULL;
+  GPGME_LOCK();
+  if (gpgme_keys != NULL) {
+    r = chash_get(gpgme_keys, &key, &value);
+    if (r == 0) {
+      found = value.data;
+      gpgme_key_ref(found);
+    }
+  }
+  GPGME_UNLOCK();
+  if (found != NULL)
+    return found;
+
+  /* exact match of the address */
+  snprintf(pattern, sizeof(pattern), "<%s>", address);
+  if (gpgme_op_keylist_start(ctx, pattern, secret) != GPG_ERR_NO_ERROR)
+    return NULL;
+  while (gpgme_op_keylist_next(ctx, &current) == GPG_ERR_NO_ERROR) {
+    if ((found == NULL) && pgp_gpgme_key_usable(current, secret))
+      found = current;
+    else
+      gpgme_key_unref(current);
+  }
+  gpgme_op_keylist_end(ctx);
+
+  if (found == NULL)
+    return NULL;
+
+  GPGME_LOCK();
+  if (gpgme_keys == NULL)
+    gpgme_keys = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
+  if (gpgme_keys != NULL) {
+    /* another thread might have stored the key meanwhile */
+    r = chash_get(gpgme_keys, &key, &value);
+    if (r < 0) {
+      value.data = found;
+      value.len = 0;
+      r = chash_set(gpgme_keys, &key, &value, NULL);
+      if (r == 0)
+        gpgme_key_ref(found);
+    }
+  }
+  GPGME_UNLOCK();
+
+  return found;
+}
+
+/* the output of an operation is appended to a string */
+
+static ssize_t pgp_gpgme_output_write(void * handle,
+    const void * buffer, size_t size)
+{
+  MMAPString * str;
+
+  str = handle;
+  if (mmap_string_append_len(str, (char *) buffer, size) == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  return (ssize_t) size;
+}
+
+static struct gpgme_data_cbs pgp_gpgme_output_cbs = {
+  /* read */ NULL,
+  /* write */ pgp_gpgme_output_write,
+  /* seek */ NULL,
+  /* release */ NULL
+};
+
+static int pgp_gpgme_new_output(MMAPString ** result_str,
+    gpgme_data_t * result)
+{
+  MMAPString * str;
+  gpgme_data_t data;
+
+  str = mmap_string_new("");
+  if (str == NULL)
+    return MAIL_ERROR_MEMORY;
+
+  if (gpgme_data_new_from_cbs(&data, &pgp_gpgme_output_cbs,
+          str) != GPG_ERR_NO_ERROR) {
+    mmap_string_free(str);
+    return MAIL_ERROR_MEMORY;
+  }
+
+  * result_str = str;
+  * result = data;
+
+  return MAIL_NO_ERROR;
+}
+
+struct pgp_gpgme_passphrase_hook {
+  struct mailprivacy * privacy;
+  mailmessage * msg;
+};
+
+/*
+  the hint is the key ID followed by the user ID of the key. When no
+  passphrase was given for the address, it is added to the encryption
+  ID list of the message, as the command backend does.
+*/
+
+static gpgme_error_t pgp_gpgme_passphrase(void * hook, const char * uid_hint,
+    const char * passphrase_info, int prev_was_bad, int fd)
+{
+  struct pgp_gpgme_passphrase_hook * passphrase_hook;
+  struct mailimf_mailbox * mb;
+  char user_id[MAX_EMAIL_SIZE];
+  char * passphrase;
+  const char * uid;
+  size_t cur_token;
+  int r;
+
+  (void) passphrase_info;
+  passphrase_hook = hook;
+
+  if (uid_hint == NULL)
+    return gpg_error(GPG_ERR_CANCELED);
+  uid = strchr(uid_hint, ' ');
+  if (uid == NULL)
+    return gpg_error(GPG_ERR_CANCELED);
+  uid ++;
+
+  cur_token = 0;
+  r = mailimf_mailbox_parse(uid, strlen(uid), &cur_token, &mb);
+  if (r != MAILIMF_NO_ERROR)
+    return gpg_error(GPG_ERR_CANCELED);
+  strncpy(user_id, mb->mb_addr_spec, sizeof(user_id));
+  user_id[sizeof(user_id) - 1] = '\0';
+  mailimf_mailbox_free(mb);
+
+  /* the given passphrase was rejected */
+  if (prev_was_bad)
+    return gpg_error(GPG_ERR_BAD_PASSPHRASE);
+
+  passphrase = get_passphrase(passphrase_hook->privacy, user_id);
+  if (passphrase == NULL) {
+    mailprivacy_gnupg_add_encryption_id(passphrase_hook->privacy,
+        passphrase_hook->msg, user_id);
+    return gpg_error(GPG_ERR_CANCELED);
+  }
+
+  r = gpgme_io_writen(fd, passphrase, strlen(passphrase));
+  if (r == 0)
+    r = gpgme_io_writen(fd, "\n", 1);
+  free(passphrase);
+  if (r != 0)
+    return gpg_error(GPG_ERR_CANCELED);
+
+  return GPG_ERR_NO_ERROR;
+}
+
+static int pgp_gpgme_recipient_add_mb(gpgme_ctx_t ctx, carray * keys,
+    struct mailimf_mailbox * mb)
+{
+  gpgme_key_t key;
+  int r;
+
+  if (mb->mb_addr_spec == NULL)
+    return MAIL_NO_ERROR;
+
+  key = pgp_gpgme_find_key(ctx, mb->mb_addr_spec, 0);
+  if (key == NULL)
+    return MAIL_ERROR_INVAL;
+
+  r = carray_add(keys, key, NULL);
+  if (r < 0) {
+    gpgme_key_unref(key);
+    return MAIL_ERROR_MEMORY;
+  }
+
+  return MAIL_NO_ERROR;
+}
+
+static int pgp_gpgme_recipient_add_mb_list(gpgme_ctx_t ctx, carray * keys,
+    struct mailimf_mailbox_list * mb_list)
+{
+  clistiter * cur;
+  int r;
+
+  for(cur = clist_begin(mb_list->mb_list) ; cur != NULL ;
+      cur = clist_next(cur)) {
+    struct mailimf_mailbox * mb;
+
+    mb = clist_content(cur);
+
+    r = pgp_gpgme_recipient_add_mb(ctx, keys, mb);
+    if (r != MAIL_NO_ERROR)
+      return r;
+  }
+
+  return MAIL_NO_ERROR;
+}
+
+static int pgp_gpgme_recipient_add_addr_list(gpgme_ctx_t ctx, carray * keys,
+    struct mailimf_address_list * addr_list)
+{
+  clistiter * cur;
+  int r;
+
+  for(cur = clist_begin(addr_list->ad_list) ; cur != NULL ;
+      cur = clist_next(cur)) {
+    struct mailimf_address * addr;
+
+    addr = clist_content(cur);
+
+    switch (addr->ad_type) {
+    case MAILIMF_ADDRESS_MAILBOX:
+      r = pgp_gpgme_recipient_add_mb(ctx, keys, addr->ad_data.ad_mailbox);
+      break;
+    case MAILIMF_ADDRESS_GROUP:
+      r = pgp_gpgme_recipient_add_mb_list(ctx, keys,
+          addr->ad_data.ad_group->grp_mb_list);
+      break;
+    default:
+      r = MAIL_ERROR_INVAL;
+    }
+    if (r != MAIL_NO_ERROR)
+      return r;
+  }
+
+  return MAIL_NO_ERROR;
+}
+
+static void pgp_gpgme_recipients_free(carray * keys)
+{
+  unsigned int i;
+
+  for(i = 0 ; i < carray_count(keys) ; i ++) {
+    gpgme_key_t key;
+
+    key = carray_get(keys, i);
+    if (key != NULL)
+      gpgme_key_unref(key);
+  }
+  carray_free(keys);
+}
+
+/* the keys of the recipients of the message, NULL terminated */
+
+static int pgp_gpgme_collect_recipients(gpgme_ctx_t ctx,
+    struct mailmime * mime, carray ** result)
+{
+  struct mailimf_single_fields single_fields;
+  struct mailimf_fields * fields;
+  struct mailmime * root;
+  carray * keys;
+  int r;
+  int res;
+
+  root = mime;
+  while (root->mm_parent != NULL)
+    root = root->mm_parent;
+
+  fields = NULL;
+  if (root->mm_type == MAILMIME_MESSAGE)
+    fields = root->mm_data.mm_message.mm_fields;
+  if (fields == NULL) {
+    res = MAIL_ERROR_INVAL;
+    goto err;
+  }
+
+  keys = carray_new(16);
+  if (keys == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+
+  mailimf_single_fields_init(&single_fields, fields);
+
+  if (single_fields.fld_to != NULL) {
+    r = pgp_gpgme_recipient_add_addr_list(ctx, keys,
+        single_fields.fld_to->to_addr_list);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto free_keys;
+    }
+  }
+
+  if (single_fields.fld_cc != NULL) {
+    r = pgp_gpgme_recipient_add_addr_list(ctx, keys,
+        single_fields.fld_cc->cc_addr_list);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto free_keys;
+    }
+  }
+
+  if (single_fields.fld_bcc != NULL) {
+    if (single_fields.fld_bcc->bcc_addr_list != NULL) {
+      r = pgp_gpgme_recipient_add_addr_list(ctx, keys,
+          single_fields.fld_bcc->bcc_addr_list);
+      if (r != MAIL_NO_ERROR) {
+        res = r;
+        goto free_keys;
+      }
+    }
+  }
+
+  if (carray_count(keys) == 0) {
+    res = MAIL_ERROR_INVAL;
+    goto free_keys;
+  }
+
+  r = carray_add(keys, NULL, NULL);
+  if (r < 0) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_keys;
+  }
+
+  * result = keys;
+
+  return MAIL_NO_ERROR;
+
+ free_keys:
+  pgp_gpgme_recipients_free(keys);
+ err:
+  return res;
+}
+
+enum {
+  PGP_GPGME_SIGN,
+  PGP_GPGME_CLEAR_SIGN,
+  PGP_GPGME_ENCRYPT,
+  PGP_GPGME_SIGN_ENCRYPT
+};
+
+/*
+  signs or encrypts the data, the output is ASCII armored.
+  micalg is set to the hash algorithm of a detached signature.
+*/
+
+static int pgp_gpgme_encrypt_data(struct mailprivacy * privacy,
+    mailmessage * msg, struct mailmime * mime, int operation,
+    char * content, size_t content_len,
+    MMAPString ** result, char * micalg, size_t micalg_size)
+{
+  struct pgp_gpgme_passphrase_hook hook;
+  gpgme_ctx_t ctx;
+  gpgme_data_t in;
+  gpgme_data_t out;
+  gpgme_error_t err;
+  gpgme_key_t signer;
+  carray * recipients;
+  MMAPString * out_str;
+  char * email;
+  char * n;
+  int r;
+  int res;
+
+  ctx = pgp_gpgme_get_context();
+  if (ctx == NULL) {
+    res = MAIL_ERROR_COMMAND;
+    goto err;
+  }
+
+  hook.privacy = privacy;
+  hook.msg = msg;
+  gpgme_set_passphrase_cb(ctx, pgp_gpgme_passphrase, &hook);
+  gpgme_set_armor(ctx, 1);
+
+  /* get signing key, the default key is used if not found */
+
+  if (operation != PGP_GPGME_ENCRYPT) {
+    email = get_first_from_addr(mime);
+    if (email != NULL) {
+      signer = pgp_gpgme_find_key(ctx, email, 1);
+      if (signer != NULL) {
+        gpgme_signers_add(ctx, signer);
+        gpgme_key_unref(signer);
+      }
+    }
+  }
+
+  recipients = NULL;
+  if ((operation == PGP_GPGME_ENCRYPT) ||
+      (operation == PGP_GPGME_SIGN_ENCRYPT)) {
+    r = pgp_gpgme_collect_recipients(ctx, mime, &recipients);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto put_context;
+    }
+  }
+
+  if (gpgme_data_new_from_mem(&in, content, content_len,
+          0) != GPG_ERR_NO_ERROR) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_recipients;
+  }
+
+  r = pgp_gpgme_new_output(&out_str, &out);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto release_in;
+  }
+
+  switch (operation) {
+  case PGP_GPGME_SIGN:
+    err = gpgme_op_sign(ctx, in, out, GPGME_SIG_MODE_DETACH);
+    break;
+  case PGP_GPGME_CLEAR_SIGN:
+    err = gpgme_op_sign(ctx, in, out, GPGME_SIG_MODE_CLEAR);
+    break;
+  case PGP_GPGME_ENCRYPT:
+    err = gpgme_op_encrypt(ctx,
+        (gpgme_key_t *) carray_data(recipients), 0, in, out);
+    break;
+  default:
+    err = gpgme_op_encrypt_sign(ctx,
+        (gpgme_key_t *) carray_data(recipients), 0, in, out);
+    break;
+  }
+  if (err != GPG_ERR_NO_ERROR) {
+    res = MAIL_ERROR_COMMAND;
+    goto release_out;
+  }
+
+  if (micalg != NULL) {
+    gpgme_sign_result_t sign_result;
+    const char * name;
+
+    name = NULL;
+    sign_result = gpgme_op_sign_result(ctx);
+    if ((sign_result != NULL) && (sign_result->signatures != NULL))
+      name = gpgme_hash_algo_name(sign_result->signatures->hash_algo);
+    if (name == NULL)
+      name = "SHA1";
+    snprintf(micalg, micalg_size, "pgp-%s", name);
+    for(n = micalg ; * n != '\0' ; n ++)
+      * n = tolower((unsigned char) * n);
+  }
+
+  gpgme_data_release(out);
+  gpgme_data_release(in);
+  if (recipients != NULL)
+    pgp_gpgme_recipients_free(recipients);
+  pgp_gpgme_put_context(ctx);
+
+  * result = out_str;
+
+  return MAIL_NO_ERROR;
+
+ release_out:
+  gpgme_data_release(out);
+  mmap_string_free(out_str);
+ release_in:
+  gpgme_data_release(in);
+ free_recipients:
+  if (recipients != NULL)
+    pgp_gpgme_recipients_free(recipients);
+ put_context:
+  pgp_gpgme_put_context(ctx);
+ err:
+  return res;
+}
+
+static int pgp_gpgme_signatures_valid(gpgme_ctx_t ctx)
+{
+  gpgme_verify_result_t verify_result;
+  gpgme_signature_t sig;
+
+  verify_result = gpgme_op_verify_result(ctx);
+  if ((verify_result == NULL) || (verify_result->signatures == NULL))
+    return 0;
+
+  for(sig = verify_result->signatures ; sig != NULL ; sig = sig->next) {
+    if (gpgme_err_code(sig->status) != GPG_ERR_NO_ERROR)
+      return 0;
+  }
+
+  return 1;
+}
+
+enum {
+  PGP_GPGME_DECRYPT,
+  PGP_GPGME_VERIFY
+};
+
+/*
+  decrypts the data or verifies a clear signed text, the result is the
+  decrypted or the signature stripped text, even when the operation
+  failed. signed_content is the text of a detached signature.
+*/
+
+static int pgp_gpgme_decrypt_data(struct mailprivacy * privacy,
+    mailmessage * msg, int operation, char * content, size_t content_len,
+    char * signed_content, size_t signed_content_len,
+    MMAPString ** result, int * result_ok)
+{
+  struct pgp_gpgme_passphrase_hook hook;
+  gpgme_ctx_t ctx;
+  gpgme_data_t in;
+  gpgme_data_t signed_text;
+  gpgme_data_t out;
+  gpgme_error_t err;
+  MMAPString * out_str;
+  int r;
+  int res;
+  int ok;
+
+  ctx = pgp_gpgme_get_context();
+  if (ctx == NULL) {
+    res = MAIL_ERROR_COMMAND;
+    goto err;
+  }
+
+  hook.privacy = privacy;
+  hook.msg = msg;
+  gpgme_set_passphrase_cb(ctx, pgp_gpgme_passphrase, &hook);
+
+  if (gpgme_data_new_from_mem(&in, content, content_len,
+          0) != GPG_ERR_NO_ERROR) {
+    res = MAIL_ERROR_MEMORY;
+    goto put_context;
+  }
+
+  signed_text = NULL;
+  if (signed_content != NULL) {
+    if (gpgme_data_new_from_mem(&signed_text, signed_content,
+            signed_content_len, 0) != GPG_ERR_NO_ERROR) {
+      res = MAIL_ERROR_MEMORY;
+      goto release_in;
+    }
+  }
+
+  r = pgp_gpgme_new_output(&out_str, &out);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto release_signed;
+  }
+
+  if (operation == PGP_GPGME_DECRYPT) {
+    /* signatures of signed & encrypted parts are checked as well */
+    err = gpgme_op_decrypt_verify(ctx, in, out);
+    ok = (err == GPG_ERR_NO_ERROR);
+  }
+  else {
+    if (signed_text != NULL)
+      err = gpgme_op_verify(ctx, in, signed_text, NULL);
+    else
+      err = gpgme_op_verify(ctx, in, NULL, out);
+    ok = (err == GPG_ERR_NO_ERROR) && pgp_gpgme_signatures_valid(ctx);
+  }
+
+  gpgme_data_release(out);
+  if (signed_text != NULL)
+    gpgme_data_release(signed_text);
+  gpgme_data_release(in);
+  pgp_gpgme_put_context(ctx);
+
+  * result = out_str;
+  * result_ok = ok;
+
+  return MAIL_NO_ERROR;
+
+ release_signed:
+  if (signed_text != NULL)
+    gpgme_data_release(signed_text);
+ release_in:
+  gpgme_data_release(in);
+ put_context:
+  pgp_gpgme_put_context(ctx);
+ err:
+  return res;
+}
+
+/*
+  builds a part with the given content, with the content type and the
+  MIME fields of original when it is not NULL.
+*/
+
+static int pgp_gpgme_new_part(struct mailprivacy * privacy,
+    struct mailmime * original, char * content_type,
+    char * content, size_t content_len, struct mailmime ** result)
+{
+  MMAPString * str;
+  int col;
+  int r;
+  int res;
+
+  str = mmap_string_new("");
+  if (str == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+
+  col = 0;
+  if ((original != NULL) && (original->mm_content_type != NULL)) {
+    r = mailmime_content_write_mem(str, &col, original->mm_content_type);
+  }
+  else {
+    if (content_type == NULL)
+      content_type = "text/plain";
+    r = mailimf_string_write_mem(str, &col, "Content-Type: ", 14);
+    if (r == MAILIMF_NO_ERROR)
+      r = mailimf_string_write_mem(str, &col,
+          content_type, strlen(content_type));
+    if (r == MAILIMF_NO_ERROR)
+      r = mailimf_string_write_mem(str, &col, "\r\n", 2);
+  }
+  if (r != MAILIMF_NO_ERROR) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_str;
+  }
+
+  /* place original MIME fields, the content is not encoded */
+
+  if ((original != NULL) && (original->mm_mime_fields != NULL)) {
+    struct mailmime_fields mime_fields;
+    clistiter * cur;
+
+    mime_fields.fld_list = clist_new();
+    if (mime_fields.fld_list == NULL) {
+      res = MAIL_ERROR_MEMORY;
+      goto free_str;
+    }
+    r = 0;
+    for(cur = clist_begin(original->mm_mime_fields->fld_list) ;
+        cur != NULL ; cur = clist_next(cur)) {
+      struct mailmime_field * field;
+
+      field = clist_content(cur);
+      if ((field->fld_type == MAILMIME_FIELD_TRANSFER_ENCODING) ||
+          (field->fld_type == MAILMIME_FIELD_TYPE))
+        continue;
+      r = clist_append(mime_fields.fld_list, field);
+      if (r < 0)
+        break;
+    }
+    if (r == 0)
+      r = mailmime_fields_write_mem(str, &col, &mime_fields);
+    else
+      r = MAILIMF_ERROR_MEMORY;
+    clist_free(mime_fields.fld_list);
+    if (r != MAILIMF_NO_ERROR) {
+      res = MAIL_ERROR_MEMORY;
+      goto free_str;
+    }
+  }
+
+  r = mailimf_string_write_mem(str, &col, "\r\n", 2);
+  if (r == MAILIMF_NO_ERROR)
+    r = mailimf_string_write_mem(str, &col, content, content_len);
+  if (r != MAILIMF_NO_ERROR) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_str;
+  }
+
+  r = mailprivacy_get_part_from_mem(privacy, 0, 0,
+      str->str, str->len, result);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_str;
+  }
+
+  mmap_string_free(str);
+
+  return MAIL_NO_ERROR;
+
+ free_str:
+  mmap_string_free(str);
+ err:
+  return res;
+}
+
+/* adds the result to the multipart, the result is freed on error */
+
+static int pgp_gpgme_add_part(struct mailmime * multipart,
+    struct mailmime * part)
+{
+  int r;
+
+  r = mailmime_smart_add_part(multipart, part);
+  if (r != MAIL_NO_ERROR) {
+    mailprivacy_mime_clear(part);
+    mailmime_free(part);
+    return MAIL_ERROR_MEMORY;
+  }
+
+  return MAIL_NO_ERROR;
+}
+
+static int pgp_gpgme_add_param(struct mailmime * multipart,
+    char * name, char * value)
+{
+  struct mailmime_parameter * param;
+  int r;
+
+  param = mailmime_param_new_with_data(name, value);
+  if (param == NULL)
+    return MAIL_ERROR_MEMORY;
+
+  r = clist_append(multipart->mm_content_type->ct_parameters, param);
+  if (r < 0) {
+    mailmime_parameter_free(param);
+    return MAIL_ERROR_MEMORY;
+  }
+
+  return MAIL_NO_ERROR;
+}
+
+static int pgp_gpgme_decrypt(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, struct mailmime ** result)
+{
+  struct mailmime * encrypted_mime;
+  struct mailmime * decrypted_mime;
+  MMAPString * decrypted_str;
+  clistiter * cur;
+  char * content;
+  size_t content_len;
+  int decrypt_ok;
+  int r;
+  int res;
+
+  /* get the two parts of the PGP message */
+
+  cur = clist_begin(mime->mm_data.mm_multipart.mm_mp_list);
+  if (cur == NULL) {
+    res = MAIL_ERROR_INVAL;
+    goto err;
+  }
+
+  cur = clist_next(cur);
+  if (cur == NULL) {
+    res = MAIL_ERROR_INVAL;
+    goto err;
+  }
+
+  encrypted_mime = clist_content(cur);
+
+  /* fetch the second section, that's the useful one */
+
+  r = mailprivacy_fetch_decoded_to_mem(privacy, msg, encrypted_mime,
+      &content, &content_len);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto err;
+  }
+
+  r = pgp_gpgme_decrypt_data(privacy, msg, PGP_GPGME_DECRYPT,
+      content, content_len, NULL, 0, &decrypted_str, &decrypt_ok);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_content;
+  }
+
+  /* building the decrypted part */
+
+  decrypted_mime = NULL;
+  if (decrypt_ok) {
+    r = mailprivacy_get_part_from_mem(privacy, 1, 0,
+        decrypted_str->str, decrypted_str->len, &decrypted_mime);
+    if (r != MAIL_NO_ERROR)
+      decrypted_mime = NULL;
+  }
+
+  r = mailprivacy_new_result_part(privacy, "multipart/x-decrypted",
+      decrypt_ok ? PGP_DECRYPT_SUCCESS : PGP_DECRYPT_FAILED,
+      decrypted_mime, result);
+  if (r != MAIL_NO_ERROR) {
+    if (decrypted_mime != NULL) {
+      mailprivacy_mime_clear(decrypted_mime);
+      mailmime_free(decrypted_mime);
+    }
+    res = r;
+    goto free_decrypted;
+  }
+
+  mmap_string_free(decrypted_str);
+  mmap_string_unref(content);
+
+  return MAIL_NO_ERROR;
+
+ free_decrypted:
+  mmap_string_free(decrypted_str);
+ free_content:
+  mmap_string_unref(content);
+ err:
+  return res;
+}
+
+static int pgp_gpgme_verify(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, struct mailmime ** result)
+{
+  struct mailmime * signed_mime;
+  struct mailmime * signature_mime;
+  struct mailmime * signed_msg_mime;
+  MMAPString * signed_str;
+  MMAPString * out_str;
+  clistiter * cur;
+  char * signature;
+  size_t signature_len;
+  int sign_ok;
+  int r;
+  int res;
+
+  /* get the two parts of the PGP message */
+
+  cur = clist_begin(mime->mm_data.mm_multipart.mm_mp_list);
+  if (cur == NULL) {
+    res = MAIL_ERROR_INVAL;
+    goto err;
+  }
+
+  signed_mime = clist_content(cur);
+  cur = clist_next(cur);
+  if (cur == NULL) {
+    res = MAIL_ERROR_INVAL;
+    goto err;
+  }
+
+  signature_mime = clist_content(cur);
+
+  r = mailprivacy_fetch_mime_body_to_mem(privacy, msg, signed_mime,
+      &signed_str);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto err;
+  }
+
+  r = mailprivacy_fetch_decoded_to_mem(privacy, msg, signature_mime,
+      &signature, &signature_len);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_signed;
+  }
+
+  r = pgp_gpgme_decrypt_data(privacy, msg, PGP_GPGME_VERIFY,
+      signature, signature_len, signed_str->str, signed_str->len,
+      &out_str, &sign_ok);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_signature;
+  }
+  mmap_string_free(out_str);
+
+  r = mailprivacy_get_part_from_mem(privacy, 1, 0,
+      signed_str->str, signed_str->len, &signed_msg_mime);
+  if (r != MAIL_NO_ERROR) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_signature;
+  }
+
+  r = mailprivacy_new_result_part(privacy, "multipart/x-verified",
+      sign_ok ? PGP_VERIFY_SUCCESS : PGP_VERIFY_FAILED,
+      signed_msg_mime, result);
+  if (r != MAIL_NO_ERROR) {
+    mailprivacy_mime_clear(signed_msg_mime);
+    mailmime_free(signed_msg_mime);
+    res = r;
+    goto free_signature;
+  }
+
+  mmap_string_unref(signature);
+  mmap_string_free(signed_str);
+
+  return MAIL_NO_ERROR;
+
+ free_signature:
+  mmap_string_unref(signature);
+ free_signed:
+  mmap_string_free(signed_str);
+ err:
+  return res;
+}
+
+static int pgp_gpgme_verify_clearsigned(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime,
+    char * content, size_t content_len, struct mailmime ** result)
+{
+  struct mailmime * stripped_mime;
+  MMAPString * stripped_str;
+  int sign_ok;
+  int r;
+  int res;
+
+  if (mime->mm_parent == NULL) {
+    res = MAIL_ERROR_INVAL;
+    goto err;
+  }
+
+  if (mime->mm_parent->mm_type == MAILMIME_SINGLE) {
+    res = MAIL_ERROR_INVAL;
+    goto err;
+  }
+
+  r = pgp_gpgme_decrypt_data(privacy, msg, PGP_GPGME_VERIFY,
+      content, content_len, NULL, 0, &stripped_str, &sign_ok);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto err;
+  }
+
+  /* building the signature stripped part */
+
+  r = pgp_gpgme_new_part(privacy, mime, NULL,
+      stripped_str->str, stripped_str->len, &stripped_mime);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_stripped;
+  }
+
+  r = mailprivacy_new_result_part(privacy, "multipart/x-verified",
+      sign_ok ? PGP_CLEAR_VERIFY_SUCCESS : PGP_CLEAR_VERIFY_FAILED,
+      stripped_mime, result);
+  if (r != MAIL_NO_ERROR) {
+    mailprivacy_mime_clear(stripped_mime);
+    mailmime_free(stripped_mime);
+    res = r;
+    goto free_stripped;
+  }
+
+  mmap_string_free(stripped_str);
+
+  return MAIL_NO_ERROR;
+
+ free_stripped:
+  mmap_string_free(stripped_str);
+ err:
+  return res;
+}
+
+static int pgp_gpgme_decrypt_armor(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime,
+    char * content, size_t content_len, struct mailmime ** result)
+{
+  struct mailmime * decrypted_mime;
+  MMAPString * decrypted_str;
+  int decrypt_ok;
+  int r;
+  int res;
+
+  if (mime->mm_parent == NULL) {
+    res = MAIL_ERROR_INVAL;
+    goto err;
+  }
+
+  if (mime->mm_parent->mm_type == MAILMIME_SINGLE) {
+    res = MAIL_ERROR_INVAL;
+    goto err;
+  }
+
+  r = pgp_gpgme_decrypt_data(privacy, msg, PGP_GPGME_DECRYPT,
+      content, content_len, NULL, 0, &decrypted_str, &decrypt_ok);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto err;
+  }
+
+  /* building the decrypted part */
+
+  decrypted_mime = NULL;
+  if (decrypt_ok) {
+    r = mailprivacy_get_part_from_mem(privacy, 1, 0,
+        decrypted_str->str, decrypted_str->len, &decrypted_mime);
+    if (r != MAIL_NO_ERROR) {
+      res = r;
+      goto free_decrypted;
+    }
+  }
+
+  r = mailprivacy_new_result_part(privacy, "multipart/x-decrypted",
+      decrypt_ok ? PGP_DECRYPT_ARMOR_SUCCESS : PGP_DECRYPT_ARMOR_FAILED,
+      decrypted_mime, result);
+  if (r != MAIL_NO_ERROR) {
+    if (decrypted_mime != NULL) {
+      mailprivacy_mime_clear(decrypted_mime);
+      mailmime_free(decrypted_mime);
+    }
+    res = r;
+    goto free_decrypted;
+  }
+
+  mmap_string_free(decrypted_str);
+
+  return MAIL_NO_ERROR;
+
+ free_decrypted:
+  mmap_string_free(decrypted_str);
+ err:
+  return res;
+}
+
+static int pgp_gpgme_handler(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, struct mailmime ** result)
+{
+  int r;
+  struct mailmime * alternative_mime;
+
+  alternative_mime = NULL;
+  switch (mime->mm_type) {
+  case MAILMIME_MULTIPLE:
+    r = MAIL_ERROR_INVAL;
+    if (pgp_is_encrypted(mime)) {
+      r = pgp_gpgme_decrypt(privacy, msg, mime, &alternative_mime);
+    }
+    else if (pgp_is_signed(mime)) {
+      r = pgp_gpgme_verify(privacy, msg, mime, &alternative_mime);
+    }
+
+    if (r != MAIL_NO_ERROR)
+      return r;
+
+    * result = alternative_mime;
+
+    return MAIL_NO_ERROR;
+
+  case MAILMIME_SINGLE:
+    /* clear sign or ASCII armor encryption */
+    if (mime_is_text(mime)) {
+      char * parsed_content;
+      size_t parsed_content_len;
+
+      r = mailprivacy_fetch_decoded_to_mem(privacy, msg, mime,
+          &parsed_content, &parsed_content_len);
+      if (r != MAIL_NO_ERROR)
+        return r;
+
+      r = MAIL_ERROR_INVAL;
+      if (pgp_is_clearsigned(parsed_content,
+              parsed_content_len)) {
+        r = pgp_gpgme_verify_clearsigned(privacy,
+            msg, mime, parsed_content, parsed_content_len, &alternative_mime);
+      }
+      else if (pgp_is_crypted_armor(parsed_content,
+                   parsed_content_len)) {
+        r = pgp_gpgme_decrypt_armor(privacy,
+            msg, mime, parsed_content, parsed_content_len, &alternative_mime);
+      }
+
+      mmap_string_unref(parsed_content);
+
+      if (r != MAIL_NO_ERROR)
+        return r;
+
+      * result = alternative_mime;
+
+      return MAIL_NO_ERROR;
+    }
+    break;
+  }
+
+  return MAIL_ERROR_INVAL;
+}
+
+static int pgp_gpgme_sign_mime(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, struct mailmime ** result)
+{
+  struct mailmime * multipart;
+  struct mailmime * to_sign_msg_mime;
+  struct mailmime * signature_mime;
+  MMAPString * to_sign_str;
+  MMAPString * signature_str;
+  char micalg[64];
+  int col;
+  int r;
+  int res;
+
+  /* part to sign */
+
+  /* encode quoted printable all text parts */
+
+  mailprivacy_prepare_mime(mime);
+
+  to_sign_str = mmap_string_new("");
+  if (to_sign_str == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+
+  col = 0;
+  r = mailmime_write_mem(to_sign_str, &col, mime);
+  if (r != MAILIMF_NO_ERROR) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_to_sign;
+  }
+
+  r = pgp_gpgme_encrypt_data(privacy, msg, mime, PGP_GPGME_SIGN,
+      to_sign_str->str, to_sign_str->len, &signature_str,
+      micalg, sizeof(micalg));
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_to_sign;
+  }
+
+  /* multipart */
+
+  multipart = mailprivacy_new_file_part(privacy, NULL,
+      "multipart/signed", -1);
+  if (multipart == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_signature;
+  }
+
+  r = pgp_gpgme_add_param(multipart, "micalg", micalg);
+  if (r == MAIL_NO_ERROR)
+    r = pgp_gpgme_add_param(multipart, "protocol",
+        "application/pgp-signature");
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_multipart;
+  }
+
+  /* signed part */
+
+  r = mailprivacy_get_part_from_mem(privacy, 1, 0,
+      to_sign_str->str, to_sign_str->len, &to_sign_msg_mime);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_multipart;
+  }
+
+  mailprivacy_prepare_mime(to_sign_msg_mime);
+
+  r = pgp_gpgme_add_part(multipart, to_sign_msg_mime);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_multipart;
+  }
+
+  /* signature part */
+
+  r = pgp_gpgme_new_part(privacy, NULL, "application/pgp-signature",
+      signature_str->str, signature_str->len, &signature_mime);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_multipart;
+  }
+
+  r = pgp_gpgme_add_part(multipart, signature_mime);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_multipart;
+  }
+
+  mmap_string_free(signature_str);
+  mmap_string_free(to_sign_str);
+
+  * result = multipart;
+
+  return MAIL_NO_ERROR;
+
+ free_multipart:
+  mailprivacy_mime_clear(multipart);
+  mailmime_free(multipart);
+ free_signature:
+  mmap_string_free(signature_str);
+ free_to_sign:
+  mmap_string_free(to_sign_str);
+ err:
+  return res;
+}
+
+static int pgp_gpgme_encrypt_mime_common(struct mailprivacy * privacy,
+    mailmessage * msg, struct mailmime * mime, int operation,
+    struct mailmime ** result)
+{
+  struct mailmime * multipart;
+  struct mailmime * version_mime;
+  struct mailmime * encrypted_mime;
+  MMAPString * original_str;
+  MMAPString * encrypted_str;
+  int col;
+  int r;
+  int res;
+
+  /* part to encrypt */
+
+  /* encode quoted printable all text parts */
+
+  mailprivacy_prepare_mime(mime);
+
+  original_str = mmap_string_new("");
+  if (original_str == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+
+  col = 0;
+  r = mailmime_write_mem(original_str, &col, mime);
+  if (r != MAILIMF_NO_ERROR) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_original;
+  }
+
+  r = pgp_gpgme_encrypt_data(privacy, msg, mime, operation,
+      original_str->str, original_str->len, &encrypted_str, NULL, 0);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_original;
+  }
+
+  /* multipart */
+
+  multipart = mailprivacy_new_file_part(privacy, NULL,
+      "multipart/encrypted", -1);
+  if (multipart == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_encrypted;
+  }
+
+  r = pgp_gpgme_add_param(multipart, "protocol",
+      "application/pgp-encrypted");
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_multipart;
+  }
+
+  /* version part */
+
+  r = pgp_gpgme_new_part(privacy, NULL, "application/pgp-encrypted",
+      PGP_VERSION, sizeof(PGP_VERSION) - 1, &version_mime);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_multipart;
+  }
+
+  r = pgp_gpgme_add_part(multipart, version_mime);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_multipart;
+  }
+
+  /* encrypted part */
+
+  r = pgp_gpgme_new_part(privacy, NULL, "application/octet-stream",
+      encrypted_str->str, encrypted_str->len, &encrypted_mime);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_multipart;
+  }
+
+  r = pgp_gpgme_add_part(multipart, encrypted_mime);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_multipart;
+  }
+
+  mmap_string_free(encrypted_str);
+  mmap_string_free(original_str);
+
+  * result = multipart;
+
+  return MAIL_NO_ERROR;
+
+ free_multipart:
+  mailprivacy_mime_clear(multipart);
+  mailmime_free(multipart);
+ free_encrypted:
+  mmap_string_free(encrypted_str);
+ free_original:
+  mmap_string_free(original_str);
+ err:
+  return res;
+}
+
+static int pgp_gpgme_encrypt_mime(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, struct mailmime ** result)
+{
+  return pgp_gpgme_encrypt_mime_common(privacy, msg, mime,
+      PGP_GPGME_ENCRYPT, result);
+}
+
+static int pgp_gpgme_sign_encrypt_mime(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, struct mailmime ** result)
+{
+  return pgp_gpgme_encrypt_mime_common(privacy, msg, mime,
+      PGP_GPGME_SIGN_ENCRYPT, result);
+}
+
+/* the text of a single part is replaced with its ASCII armored version */
+
+static int pgp_gpgme_armor_common(struct mailprivacy * privacy,
+    mailmessage * msg, struct mailmime * mime, int operation,
+    struct mailmime ** result)
+{
+  struct mailmime * armored_mime;
+  MMAPString * original_str;
+  MMAPString * armored_str;
+  int col;
+  int r;
+  int res;
+
+  if (mime->mm_type != MAILMIME_SINGLE) {
+    res = MAIL_ERROR_INVAL;
+    goto err;
+  }
+
+  if (mime->mm_data.mm_single == NULL) {
+    res = MAIL_ERROR_INVAL;
+    goto err;
+  }
+
+  /* get the decoded text of the part */
+
+  original_str = mmap_string_new("");
+  if (original_str == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+
+  col = 0;
+  r = mailmime_data_write_mem(original_str, &col, mime->mm_data.mm_single, 1);
+  if (r != MAILIMF_NO_ERROR) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_original;
+  }
+
+  r = pgp_gpgme_encrypt_data(privacy, msg, mime, operation,
+      original_str->str, original_str->len, &armored_str, NULL, 0);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_original;
+  }
+
+  /* building the part with original content type and MIME fields */
+
+  r = pgp_gpgme_new_part(privacy, mime, NULL,
+      armored_str->str, armored_str->len, &armored_mime);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_armored;
+  }
+
+  mmap_string_free(armored_str);
+  mmap_string_free(original_str);
+
+  * result = armored_mime;
+
+  return MAIL_NO_ERROR;
+
+ free_armored:
+  mmap_string_free(armored_str);
+ free_original:
+  mmap_string_free(original_str);
+ err:
+  return res;
+}
+
+static int pgp_gpgme_clear_sign(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, struct mailmime ** result)
+{
+  return pgp_gpgme_armor_common(privacy, msg, mime,
+      PGP_GPGME_CLEAR_SIGN, result);
+}
+
+static int pgp_gpgme_armor_encrypt(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, struct mailmime ** result)
+{
+  return pgp_gpgme_armor_common(privacy, msg, mime,
+      PGP_GPGME_ENCRYPT, result);
+}
+
+static int pgp_gpgme_armor_sign_encrypt(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, struct mailmime ** result)
+{
+  return pgp_gpgme_armor_common(privacy, msg, mime,
+      PGP_GPGME_SIGN_ENCRYPT, result);
+}
+
+static struct mailprivacy_encryption pgp_gpgme_encryption_tab[] = {
+  /* PGP signed part */
+  {
+    /* name */ "signed",
+    /* description */ "PGP signed part",
+    /* encrypt */ pgp_gpgme_sign_mime
+  },
+
+  /* pgp encrypted part */
+
+  {
+    /* name */ "encrypted",
+    /* description */ "PGP encrypted part",
+    /* encrypt */ pgp_gpgme_encrypt_mime
+  },
+
+  /* PGP signed & encrypted part */
+
+  {
+    /* name */ "signed-encrypted",
+    /* description */ "PGP signed & encrypted part",
+    /* encrypt */ pgp_gpgme_sign_encrypt_mime
+  },
+
+  /* PGP clear signed part */
+
+  {
+    /* name */ "clear-signed",
+    /* description */ "PGP clear signed part",
+    /* encrypt */ pgp_gpgme_clear_sign
+  },
+
+  /* PGP armor encrypted part */
+
+  {
+    /* name */ "encrypted-armor",
+    /* description */ "PGP ASCII armor encrypted part",
+    /* encrypt */ pgp_gpgme_armor_encrypt
+  },
+
+  /* PGP armor signed & encrypted part */
+
+  {
+    /* name */ "signed-encrypted-armor",
+    /* description */ "PGP ASCII armor signed & encrypted part",
+    /* encrypt */ pgp_gpgme_armor_sign_encrypt
+  }
+};
+
+/* same name as the command protocol, only one of them is registered */
+
+static struct mailprivacy_protocol pgp_gpgme_protocol = {
+  /* name */ "pgp",
+  /* description */ "OpenPGP",
+
+  /* is_encrypted */ pgp_test_encrypted,
+  /* decrypt */ pgp_gpgme_handler,
+
+  /* encryption_count */
+  (sizeof(pgp_gpgme_encryption_tab) / sizeof(pgp_gpgme_encryption_tab[0])),
+
+  /* encryption_tab */ pgp_gpgme_encryption_tab
+};
+
+#endif
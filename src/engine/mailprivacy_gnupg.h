@@ -45,6 +45,28 @@ int mailprivacy_gnupg_init(struct mailprivacy * privacy);
 LIBETPAN_EXPORT
 void mailprivacy_gnupg_done(struct mailprivacy * privacy);
 
+/*
+  backend of the OpenPGP operations:
+
+  - MAILPRIVACY_GNUPG_BACKEND_COMMAND (default) runs the gpg command
+    with temporary files.
+  - MAILPRIVACY_GNUPG_BACKEND_GPGME runs the operations through GPGME,
+    the MIME parts are given to the engine from memory. Each thread
+    keeps its engine context and the keys are looked up once.
+
+  mailprivacy_gnupg_set_backend() returns MAIL_ERROR_NOT_IMPLEMENTED
+  when the backend is not available (libetpan built without GPGME).
+  The passphrases and the encryption ID lists are shared by the backends.
+*/
+
+enum {
+  MAILPRIVACY_GNUPG_BACKEND_COMMAND,
+  MAILPRIVACY_GNUPG_BACKEND_GPGME
+};
+
+LIBETPAN_EXPORT
+int mailprivacy_gnupg_set_backend(struct mailprivacy * privacy, int backend);
+
 LIBETPAN_EXPORT
 clist * mailprivacy_gnupg_encryption_id_list(struct mailprivacy * privacy,
     mailmessage * msg);
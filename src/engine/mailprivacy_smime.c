@@ -72,6 +72,23 @@
 #include <libetpan/libetpan-config.h>
 #include <errno.h>
 
+#if defined(USE_SSL) && !defined(USE_GNUTLS)
+#include <openssl/opensslv.h>
+#include <openssl/opensslconf.h>
+#if (OPENSSL_VERSION_NUMBER >= 0x10100000L) && !defined(OPENSSL_NO_CMS)
+#define SMIME_CMS
+#endif
+#endif
+
+#ifdef SMIME_CMS
+#include <openssl/bio.h>
+#include <openssl/cms.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#endif
+
 #include "../data-types/syscall_wrappers.h"
 
 /*
@@ -97,9 +114,26 @@ static int CA_check = 1;
 static int store_cert = 0;
 static char private_keys_dir[PATH_MAX] = "";
 
-static char * get_cert_file(char * email);
+static char * get_cert_file(char * email, char * filename, size_t size);
+
+static char * get_private_key_file(char * email,
+    char * filename, size_t size);
+
+static void set_file(chash * hash, char * email, char * filename);
+static carray * get_private_key_emails(void);
+static void emails_free(carray * emails);
+
+static char * get_passphrase(struct mailprivacy * privacy,
+    char * user_id);
 
-static char * get_private_key_file(char * email);
+#ifdef SMIME_CMS
+static struct mailprivacy_protocol smime_cms_protocol;
+
+static void cms_flush_certificates(void);
+static void cms_flush_private_keys(void);
+static void cms_flush_store(void);
+static void cms_cache_free(void);
+#endif
 
 
 static int smime_is_signed(struct mailmime * mime)
@@ -181,8 +215,6 @@ enum {
   ERROR_SMIME_NOPASSPHRASE
 };
 
-#define BUF_SIZE 1024
-
 static char * get_first_from_addr(struct mailmime * mime)
 {
   clistiter * cur;
@@ -235,12 +267,14 @@ static int smime_decrypt(struct mailprivacy * privacy,
   int res;
   int sign_ok;
   struct mailmime * multipart;
-  char * smime_cert;
-  char * smime_key;
+  char smime_cert[PATH_MAX];
+  char smime_key[PATH_MAX];
   char quoted_smime_cert[PATH_MAX];
   char quoted_smime_key[PATH_MAX];
   char * email;
-  chashiter * iter;
+  carray * emails;
+  unsigned int key_count;
+  unsigned int i;
   
   /* fetch the whole multipart and write it to a file */
   
@@ -270,42 +304,36 @@ static int smime_decrypt(struct mailprivacy * privacy,
     goto unlink_decrypted;
   }
   
+  emails = get_private_key_emails();
+  if (emails == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto unlink_description;
+  }
+  
   sign_ok = 0;
-  for(iter = chash_begin(private_keys) ; iter != NULL ;
-      iter = chash_next(private_keys, iter)) {
-    chashdatum key;
-    char email_buf[BUF_SIZE];
-    
-    chash_key(iter, &key);
-    
-    if (key.len >= sizeof(email_buf))
-      continue;
-    
-    strncpy(email_buf, key.data, key.len);
-    email_buf[key.len] = '\0';
-    email = email_buf;
+  for(i = 0 ; i < carray_count(emails) ; i ++) {
+    email = carray_get(emails, i);
     
     /* get encryption key */
     
-    smime_key = get_private_key_file(email);
-    smime_cert = get_cert_file(email);
-    if ((smime_cert == NULL) || (smime_key == NULL)) {
+    if ((get_private_key_file(email, smime_key, sizeof(smime_key)) == NULL) ||
+        (get_cert_file(email, smime_cert, sizeof(smime_cert)) == NULL)) {
       res = MAIL_ERROR_INVAL;
-      goto unlink_description;
+      goto free_emails;
     }
   
     r = mail_quote_filename(quoted_smime_cert, sizeof(quoted_smime_cert),
         smime_cert);
     if (r < 0) {
       res = MAIL_ERROR_MEMORY;
-      goto unlink_description;
+      goto free_emails;
     }
   
     r = mail_quote_filename(quoted_smime_key, sizeof(quoted_smime_key),
         smime_key);
     if (r < 0) {
       res = MAIL_ERROR_MEMORY;
-      goto unlink_description;
+      goto free_emails;
     }
   
     /* run the command */
@@ -314,7 +342,7 @@ static int smime_decrypt(struct mailprivacy * privacy,
         sizeof(quoted_smime_filename), smime_filename);
     if (r < 0) {
       res = MAIL_ERROR_MEMORY;
-      goto unlink_description;
+      goto free_emails;
     }
     
     sign_ok = 0;
@@ -335,10 +363,10 @@ static int smime_decrypt(struct mailprivacy * privacy,
       break;
     case ERROR_SMIME_COMMAND:
       res = MAIL_ERROR_COMMAND;
-      goto unlink_description;
+      goto free_emails;
     case ERROR_SMIME_FILE:
       res = MAIL_ERROR_FILE;
-      goto unlink_description;
+      goto free_emails;
     }
     
     if (sign_ok) {
@@ -346,8 +374,11 @@ static int smime_decrypt(struct mailprivacy * privacy,
     }
   }
   
+  key_count = carray_count(emails);
+  emails_free(emails);
+  
   if (!sign_ok) {
-    if (chash_count(private_keys) == 0) {
+    if (key_count == 0) {
       FILE * description_f;
       
       description_f = mailprivacy_get_tmp_file(privacy, description_filename,
@@ -422,6 +453,8 @@ static int smime_decrypt(struct mailprivacy * privacy,
   
   return MAIL_NO_ERROR;
   
+ free_emails:
+  emails_free(emails);
  unlink_description:
   unlink(description_filename);
  unlink_decrypted:
@@ -718,8 +751,8 @@ static int smime_sign(struct mailprivacy * privacy,
   char command[PATH_MAX];
   char quoted_signed_filename[PATH_MAX];
   struct mailmime * signed_mime;
-  char * smime_cert;
-  char * smime_key;
+  char smime_cert[PATH_MAX];
+  char smime_key[PATH_MAX];
   char quoted_smime_cert[PATH_MAX];
   char quoted_smime_key[PATH_MAX];
   char * email;
@@ -732,9 +765,8 @@ static int smime_sign(struct mailprivacy * privacy,
     goto err;
   }
   
-  smime_key = get_private_key_file(email);
-  smime_cert = get_cert_file(email);
-  if ((smime_cert == NULL) || (smime_key == NULL)) {
+  if ((get_private_key_file(email, smime_key, sizeof(smime_key)) == NULL) ||
+      (get_cert_file(email, smime_cert, sizeof(smime_cert)) == NULL)) {
     res = MAIL_ERROR_INVAL;
     goto err;
   }
@@ -857,7 +889,7 @@ static int smime_sign(struct mailprivacy * privacy,
 static int recipient_add_mb(char * recipient, size_t * len,
     struct mailimf_mailbox * mb)
 {
-  char * filename;
+  char filename[PATH_MAX];
   char quoted_filename[PATH_MAX];
   size_t buflen;
   int r;
@@ -865,8 +897,7 @@ static int recipient_add_mb(char * recipient, size_t * len,
   if (mb->mb_addr_spec == NULL)
     return MAIL_NO_ERROR;
   
-  filename = get_cert_file(mb->mb_addr_spec);
-  if (filename == NULL)
+  if (get_cert_file(mb->mb_addr_spec, filename, sizeof(filename)) == NULL)
     return MAIL_ERROR_INVAL;
   
   r = mail_quote_filename(quoted_filename, sizeof(quoted_filename),
@@ -1152,12 +1183,19 @@ static int smime_sign_encrypt(struct mailprivacy * privacy,
     goto err;
   }
   
+  /* the recipients are found in the headers of the message */
+  signed_part->mm_parent = mime->mm_parent;
   r = smime_encrypt(privacy, msg, signed_part, &encrypted);
+  signed_part->mm_parent = NULL;
   if (r != MAIL_NO_ERROR) {
     res = r;
     goto free_signed;
   }
   
+  /* the encrypted part was built from a copy of the signed part */
+  mailprivacy_mime_clear(signed_part);
+  mailmime_free(signed_part);
+  
   * result = encrypted;
   
   return MAIL_NO_ERROR;
@@ -1223,6 +1261,55 @@ static struct mailprivacy_protocol smime_protocol = {
 #define UNLOCK() do {} while (0)
 #endif
 
+#ifdef SMIME_CMS
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+  static pthread_mutex_t cms_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define CMS_LOCK() pthread_mutex_lock(&cms_cache_lock)
+#define CMS_UNLOCK() pthread_mutex_unlock(&cms_cache_lock)
+#elif (defined WIN32)
+  static CRITICAL_SECTION cms_cache_lock = {0};
+#define CMS_LOCK() EnterCriticalSection(&cms_cache_lock);
+#define CMS_UNLOCK() LeaveCriticalSection(&cms_cache_lock);
+#endif
+#else
+#define CMS_LOCK() do {} while (0)
+#define CMS_UNLOCK() do {} while (0)
+#endif
+#endif
+
+/* certificates and private_keys, the decryption runs in several threads */
+
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+  static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+#define FILES_LOCK() pthread_mutex_lock(&files_lock)
+#define FILES_UNLOCK() pthread_mutex_unlock(&files_lock)
+#elif (defined WIN32)
+  static CRITICAL_SECTION files_lock = {0};
+#define FILES_LOCK() EnterCriticalSection(&files_lock)
+#define FILES_UNLOCK() LeaveCriticalSection(&files_lock)
+#endif
+#else
+#define FILES_LOCK() do {} while (0)
+#define FILES_UNLOCK() do {} while (0)
+#endif
+
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+  static pthread_mutex_t passphrase_hash_lock = PTHREAD_MUTEX_INITIALIZER;
+#define PASSPHRASE_LOCK() pthread_mutex_lock(&passphrase_hash_lock)
+#define PASSPHRASE_UNLOCK() pthread_mutex_unlock(&passphrase_hash_lock)
+#elif (defined WIN32)
+  static CRITICAL_SECTION passphrase_hash_lock = {0};
+#define PASSPHRASE_LOCK() EnterCriticalSection(&passphrase_hash_lock)
+#define PASSPHRASE_UNLOCK() LeaveCriticalSection(&passphrase_hash_lock)
+#endif
+#else
+#define PASSPHRASE_LOCK() do {} while (0)
+#define PASSPHRASE_UNLOCK() do {} while (0)
+#endif
+
 static void mailprivacy_smime_init_lock(void)
 {
 #ifdef LIBETPAN_REENTRANT
@@ -1231,11 +1318,52 @@ static void mailprivacy_smime_init_lock(void)
   static int mailprivacy_smime_init_lock_done = 0;
   if (InterlockedExchange(&mailprivacy_smime_init_lock_done, 1) == 0) {
     InitializeCriticalSection(&encryption_id_hash_lock);
+    InitializeCriticalSection(&files_lock);
+    InitializeCriticalSection(&passphrase_hash_lock);
+#ifdef SMIME_CMS
+    InitializeCriticalSection(&cms_cache_lock);
+#endif
   }
 #endif
 #endif
 }
 
+/* protocol registered by mailprivacy_smime_init() */
+
+static struct mailprivacy_protocol * smime_backend_protocol = &smime_protocol;
+
+int mailprivacy_smime_set_backend(struct mailprivacy * privacy, int backend)
+{
+  struct mailprivacy_protocol * protocol;
+  int r;
+  
+  switch (backend) {
+  case MAILPRIVACY_SMIME_BACKEND_COMMAND:
+    protocol = &smime_protocol;
+    break;
+#ifdef SMIME_CMS
+  case MAILPRIVACY_SMIME_BACKEND_CMS:
+    protocol = &smime_cms_protocol;
+    break;
+#endif
+  default:
+    return MAIL_ERROR_NOT_IMPLEMENTED;
+  }
+  
+  if (protocol == smime_backend_protocol)
+    return MAIL_NO_ERROR;
+  
+  mailprivacy_unregister(privacy, smime_backend_protocol);
+  r = mailprivacy_register(privacy, protocol);
+  if (r != MAIL_NO_ERROR) {
+    mailprivacy_register(privacy, smime_backend_protocol);
+    return r;
+  }
+  smime_backend_protocol = protocol;
+  
+  return MAIL_NO_ERROR;
+}
+
 int mailprivacy_smime_init(struct mailprivacy * privacy)
 {
   mailprivacy_smime_init_lock();
@@ -1249,7 +1377,7 @@ int mailprivacy_smime_init(struct mailprivacy * privacy)
   
   CAcert_dir[0] = '\0';
   
-  return mailprivacy_register(privacy, &smime_protocol);
+  return mailprivacy_register(privacy, smime_backend_protocol);
   
  free_cert:
   chash_free(certificates);
@@ -1260,6 +1388,10 @@ int mailprivacy_smime_init(struct mailprivacy * privacy)
 void mailprivacy_smime_done(struct mailprivacy * privacy)
 {
   mailprivacy_unregister(privacy, &smime_protocol);
+#ifdef SMIME_CMS
+  mailprivacy_unregister(privacy, &smime_cms_protocol);
+  cms_cache_free();
+#endif
   chash_free(private_keys);
   private_keys = NULL;
   chash_free(certificates);
@@ -1332,10 +1464,22 @@ static void set_file(chash * hash, char * email, char * filename)
   data.data = filename;
   data.len = (unsigned int) strlen(filename) + 1;
   
+  FILES_LOCK();
   chash_set(hash, &key, &data, NULL);
+  FILES_UNLOCK();
 }
 
-static char * get_file(chash * hash, char * email)
+static void clear_files(chash * hash)
+{
+  FILES_LOCK();
+  chash_clear(hash);
+  FILES_UNLOCK();
+}
+
+/* the name of the file is copied to filename, NULL if not found */
+
+static char * get_file(chash * hash, char * email,
+    char * filename, size_t size)
 {
   chashdatum key;
   chashdatum data;
@@ -1351,11 +1495,66 @@ static char * get_file(chash * hash, char * email)
   strip_string(buf);
   key.data = buf;
   key.len = (unsigned int) strlen(buf);
+  FILES_LOCK();
   r = chash_get(hash, &key, &data);
+  if (r == 0) {
+    if (data.len <= size)
+      memcpy(filename, data.data, data.len);
+    else
+      r = -1;
+  }
+  FILES_UNLOCK();
   if (r < 0)
     return NULL;
   
-  return data.data;
+  return filename;
+}
+
+/* returns a copy of the addresses that have a private key */
+
+static carray * get_private_key_emails(void)
+{
+  carray * emails;
+  chashiter * iter;
+  
+  emails = carray_new(16);
+  if (emails == NULL)
+    return NULL;
+  
+  FILES_LOCK();
+  for(iter = chash_begin(private_keys) ; iter != NULL ;
+      iter = chash_next(private_keys, iter)) {
+    chashdatum key;
+    char * email;
+    
+    chash_key(iter, &key);
+    email = malloc(key.len + 1);
+    if (email == NULL)
+      goto free;
+    memcpy(email, key.data, key.len);
+    email[key.len] = '\0';
+    if (carray_add(emails, email, NULL) < 0) {
+      free(email);
+      goto free;
+    }
+  }
+  FILES_UNLOCK();
+  
+  return emails;
+  
+ free:
+  FILES_UNLOCK();
+  emails_free(emails);
+  return NULL;
+}
+
+static void emails_free(carray * emails)
+{
+  unsigned int i;
+  
+  for(i = 0 ; i < carray_count(emails) ; i ++)
+    free(carray_get(emails, i));
+  carray_free(emails);
 }
 
 #define CERTIFICATE_SUFFIX "-cert.pem"
@@ -1366,7 +1565,10 @@ void mailprivacy_smime_set_cert_dir(struct mailprivacy * privacy,
   DIR * dir;
   struct dirent * ent;
 
-  chash_clear(certificates);
+  clear_files(certificates);
+#ifdef SMIME_CMS
+  cms_flush_certificates();
+#endif
   
   if (directory == NULL)
     return;
@@ -1434,19 +1636,23 @@ void mailprivacy_smime_set_cert_dir(struct mailprivacy * privacy,
   closedir(dir);
 }
 
-static char * get_cert_file(char * email)
+static char * get_cert_file(char * email, char * filename, size_t size)
 {
-  return get_file(certificates, email);
+  return get_file(certificates, email, filename, size);
 }
 
-static char * get_private_key_file(char * email)
+static char * get_private_key_file(char * email,
+    char * filename, size_t size)
 {
-  return get_file(private_keys, email);
+  return get_file(private_keys, email, filename, size);
 }
 
 void mail_private_smime_clear_private_keys(struct mailprivacy * privacy)
 {
-  chash_clear(private_keys);
+  clear_files(private_keys);
+#ifdef SMIME_CMS
+  cms_flush_private_keys();
+#endif
 }
 
 #define MAX_BUF 1024
@@ -1465,6 +1671,10 @@ void mailprivacy_smime_set_CA_dir(struct mailprivacy * privacy,
   if (* directory == '\0')
     return;
   
+#ifdef SMIME_CMS
+  cms_flush_store();
+#endif
+  
   /* make a temporary file that contains all the CAs */
   
   if (CAfile != NULL) {
@@ -1541,7 +1751,7 @@ static int get_cert_from_sig(struct mailprivacy * privacy,
   char signature_filename[PATH_MAX];
   char quoted_signature_filename[PATH_MAX];
   char * email;
-  char * cert_file;
+  char cert_file[PATH_MAX];
   char store_cert_filename[PATH_MAX];
   char quoted_store_cert_filename[PATH_MAX];
   int r;
@@ -1563,8 +1773,7 @@ static int get_cert_from_sig(struct mailprivacy * privacy,
   if (email == NULL)
     return MAIL_ERROR_INVAL;
   
-  cert_file = get_cert_file(email);
-  if (cert_file != NULL)
+  if (get_cert_file(email, cert_file, sizeof(cert_file)) != NULL)
     return MAIL_NO_ERROR;
 
   /* get the two parts of the S/MIME message */
@@ -1652,7 +1861,10 @@ void mailprivacy_smime_set_private_keys_dir(struct mailprivacy * privacy,
   DIR * dir;
   struct dirent * ent;
 
-  chash_clear(private_keys);
+  clear_files(private_keys);
+#ifdef SMIME_CMS
+  cms_flush_private_keys();
+#endif
   
   if (directory == NULL)
     return;
@@ -1723,6 +1935,7 @@ static int smime_command_passphrase(struct mailprivacy * privacy,
   
   res = mailprivacy_spawn_and_wait(command, passphrase, stdoutfile, stderrfile,
 		       &bad_passphrase);
+  free(passphrase);
   if (res != NO_ERROR_PASSPHRASE) {
     switch (res) {
     case ERROR_PASSPHRASE_COMMAND:
@@ -1751,6 +1964,8 @@ static int smime_command_passphrase(struct mailprivacy * privacy,
 
 static chash * encryption_id_hash = NULL;
 
+/* the callers hold encryption_id_hash_lock */
+
 static clist * get_list(struct mailprivacy * privacy, mailmessage * msg)
 {
   clist * encryption_id_list;
@@ -1886,18 +2101,22 @@ int mailprivacy_smime_set_encryption_id(struct mailprivacy * privacy,
   for(n = buf ; * n != '\0' ; n ++)
     * n = toupper((unsigned char) * n);
   
-  if (passphrase_hash == NULL) {
-    passphrase_hash = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYALL);
-    if (passphrase_hash == NULL)
-      return MAIL_ERROR_MEMORY;
-  }
-  
   key.data = buf;
   key.len = (unsigned int) strlen(buf) + 1;
   value.data = passphrase;
   value.len = (unsigned int) strlen(passphrase) + 1;
   
+  PASSPHRASE_LOCK();
+  if (passphrase_hash == NULL) {
+    passphrase_hash = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYALL);
+    if (passphrase_hash == NULL) {
+      PASSPHRASE_UNLOCK();
+      return MAIL_ERROR_MEMORY;
+    }
+  }
+  
   r = chash_set(passphrase_hash, &key, &value, NULL);
+  PASSPHRASE_UNLOCK();
   if (r < 0) {
     return MAIL_ERROR_MEMORY;
   }
@@ -1920,17 +2139,1056 @@ static char * get_passphrase(struct mailprivacy * privacy,
   for(n = buf ; * n != '\0' ; n ++)
     * n = toupper((unsigned char) * n);
   
-  if (passphrase_hash == NULL)
-    return NULL;
-  
   key.data = buf;
   key.len = (unsigned int) strlen(buf) + 1;
   
-  r = chash_get(passphrase_hash, &key, &value);
-  if (r < 0)
-    return NULL;
-  
-  passphrase = strdup(value.data);
+  passphrase = NULL;
+  PASSPHRASE_LOCK();
+  if (passphrase_hash != NULL) {
+    r = chash_get(passphrase_hash, &key, &value);
+    if (r == 0)
+      passphrase = strdup(value.data);
+  }
+  PASSPHRASE_UNLOCK();
   
   return passphrase;
 }
+
+
+/* ********************************************************************* */
+/* in-process backend, libcrypto CMS */
+
+#ifdef SMIME_CMS
+
+/*
+  the certificates and the private keys are loaded once, the hashes
+  map the name of the file to the object. The store of the
+  certificates of authority is built on first verification.
+*/
+
+static chash * cms_certificates = NULL;
+static chash * cms_private_keys = NULL;
+static X509_STORE * cms_store = NULL;
+
+static void cms_cache_clear(chash * hash, int is_key)
+{
+  chashiter * iter;
+
+  if (hash == NULL)
+    return;
+
+  for(iter = chash_begin(hash) ; iter != NULL ;
+      iter = chash_next(hash, iter)) {
+    chashdatum value;
+
+    chash_value(iter, &value);
+    if (is_key)
+      EVP_PKEY_free(value.data);
+    else
+      X509_free(value.data);
+  }
+  chash_clear(hash);
+}
+
+static void cms_flush_certificates(void)
+{
+  CMS_LOCK();
+  cms_cache_clear(cms_certificates, 0);
+  CMS_UNLOCK();
+}
+
+static void cms_flush_private_keys(void)
+{
+  CMS_LOCK();
+  cms_cache_clear(cms_private_keys, 1);
+  CMS_UNLOCK();
+}
+
+static void cms_flush_store(void)
+{
+  CMS_LOCK();
+  if (cms_store != NULL) {
+    X509_STORE_free(cms_store);
+    cms_store = NULL;
+  }
+  CMS_UNLOCK();
+}
+
+static void cms_cache_free(void)
+{
+  CMS_LOCK();
+  cms_cache_clear(cms_certificates, 0);
+  if (cms_certificates != NULL) {
+    chash_free(cms_certificates);
+    cms_certificates = NULL;
+  }
+  cms_cache_clear(cms_private_keys, 1);
+  if (cms_private_keys != NULL) {
+    chash_free(cms_private_keys);
+    cms_private_keys = NULL;
+  }
+  if (cms_store != NULL) {
+    X509_STORE_free(cms_store);
+    cms_store = NULL;
+  }
+  CMS_UNLOCK();
+}
+
+/* returns a reference on the cached object, NULL if not found */
+
+static void * cms_cache_get(chash * hash, char * filename, int is_key)
+{
+  chashdatum key;
+  chashdatum value;
+  int r;
+
+  if (hash == NULL)
+    return NULL;
+
+  key.data = filename;
+  key.len = (unsigned int) strlen(filename);
+  r = chash_get(hash, &key, &value);
+  if (r < 0)
+    return NULL;
+
+  if (is_key)
+    EVP_PKEY_up_ref(value.data);
+  else
+    X509_up_ref(value.data);
+
+  return value.data;
+}
+
+/*
+  stores the object unless another thread loaded it meanwhile,
+  returns a reference on the cached object
+*/
+
+static void * cms_cache_set(chash ** p_hash, char * filename,
+    void * object, int is_key)
+{
+  void * cached;
+  chashdatum key;
+  chashdatum value;
+
+  cached = cms_cache_get(* p_hash, filename, is_key);
+  if (cached != NULL) {
+    if (is_key)
+      EVP_PKEY_free(object);
+    else
+      X509_free(object);
+    return cached;
+  }
+
+  if (* p_hash == NULL)
+    * p_hash = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
+  if (* p_hash == NULL)
+    return object;
+
+  key.data = filename;
+  key.len = (unsigned int) strlen(filename);
+  value.data = object;
+  value.len = 0;
+  if (chash_set(* p_hash, &key, &value, NULL) < 0)
+    return object;
+
+  if (is_key)
+    EVP_PKEY_up_ref(object);
+  else
+    X509_up_ref(object);
+
+  return object;
+}
+
+static X509 * cms_get_cert(char * filename)
+{
+  X509 * cert;
+  BIO * bio;
+
+  CMS_LOCK();
+  cert = cms_cache_get(cms_certificates, filename, 0);
+  CMS_UNLOCK();
+  if (cert != NULL)
+    return cert;
+
+  bio = BIO_new_file(filename, "r");
+  if (bio == NULL)
+    return NULL;
+  cert = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+  BIO_free(bio);
+  if (cert == NULL) {
+    ERR_clear_error();
+    return NULL;
+  }
+
+  CMS_LOCK();
+  cert = cms_cache_set(&cms_certificates, filename, cert, 0);
+  CMS_UNLOCK();
+
+  return cert;
+}
+
+static int cms_passphrase_cb(char * buf, int size, int rwflag, void * data)
+{
+  char * passphrase;
+  size_t len;
+
+  /* the same passphrase is used to read and to write */
+  (void) rwflag;
+
+  /* never prompt on the terminal */
+  passphrase = data;
+  if (passphrase == NULL)
+    return 0;
+
+  len = strlen(passphrase);
+  if (len > (size_t) size)
+    len = size;
+  memcpy(buf, passphrase, len);
+
+  return (int) len;
+}
+
+/*
+  (* p_bad_passphrase) is set to 1 when the key could not be
+  decrypted with the passphrase given for email
+*/
+
+static EVP_PKEY * cms_get_private_key(struct mailprivacy * privacy,
+    char * filename, char * email, int * p_bad_passphrase)
+{
+  EVP_PKEY * pkey;
+  BIO * bio;
+  char * passphrase;
+
+  * p_bad_passphrase = 0;
+
+  CMS_LOCK();
+  pkey = cms_cache_get(cms_private_keys, filename, 1);
+  CMS_UNLOCK();
+  if (pkey != NULL)
+    return pkey;
+
+  bio = BIO_new_file(filename, "r");
+  if (bio == NULL)
+    return NULL;
+  passphrase = get_passphrase(privacy, email);
+  pkey = PEM_read_bio_PrivateKey(bio, NULL, cms_passphrase_cb, passphrase);
+  free(passphrase);
+  BIO_free(bio);
+  if (pkey == NULL) {
+    ERR_clear_error();
+    * p_bad_passphrase = 1;
+    return NULL;
+  }
+
+  CMS_LOCK();
+  pkey = cms_cache_set(&cms_private_keys, filename, pkey, 1);
+  CMS_UNLOCK();
+
+  return pkey;
+}
+
+static X509_STORE * cms_get_store(void)
+{
+  X509_STORE * store;
+
+  CMS_LOCK();
+  if (cms_store == NULL) {
+    cms_store = X509_STORE_new();
+    if (cms_store != NULL) {
+      if (CAfile != NULL)
+        X509_STORE_load_locations(cms_store, CAfile, NULL);
+      X509_STORE_set_default_paths(cms_store);
+      ERR_clear_error();
+    }
+  }
+  store = cms_store;
+  if (store != NULL)
+    X509_STORE_up_ref(store);
+  CMS_UNLOCK();
+
+  return store;
+}
+
+/* same as mailprivacy_get_part_from_file() with the content of a BIO */
+
+static int cms_get_part_from_bio(struct mailprivacy * privacy,
+    int check_security, BIO * bio, struct mailmime ** result)
+{
+  char * data;
+  long len;
+
+  len = BIO_get_mem_data(bio, &data);
+  if (len < 0)
+    return MAIL_ERROR_INVAL;
+
+  return mailprivacy_get_part_from_mem(privacy, check_security, 0,
+      data, (size_t) len, result);
+}
+
+/* passphrase will be needed */
+
+static int smime_cms_decrypt(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, struct mailmime ** result)
+{
+  MMAPString * smime_str;
+  struct mailmime * decrypted_mime;
+  BIO * decrypted_bio;
+  carray * emails;
+  unsigned int i;
+  int decrypt_ok;
+  int r;
+  int res;
+
+  r = mailprivacy_fetch_mime_body_to_mem(privacy, msg, mime, &smime_str);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto err;
+  }
+
+  decrypted_bio = BIO_new(BIO_s_mem());
+  if (decrypted_bio == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_smime;
+  }
+
+  emails = get_private_key_emails();
+  if (emails == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_decrypted;
+  }
+
+  decrypt_ok = 0;
+  for(i = 0 ; i < carray_count(emails) ; i ++) {
+    char * email;
+    char smime_cert[PATH_MAX];
+    char smime_key[PATH_MAX];
+    int bad_passphrase;
+    X509 * cert;
+    EVP_PKEY * pkey;
+    CMS_ContentInfo * cms;
+    BIO * in;
+
+    email = carray_get(emails, i);
+
+    /* get encryption key */
+
+    if ((get_private_key_file(email, smime_key, sizeof(smime_key)) == NULL) ||
+        (get_cert_file(email, smime_cert, sizeof(smime_cert)) == NULL)) {
+      emails_free(emails);
+      res = MAIL_ERROR_INVAL;
+      goto free_decrypted;
+    }
+
+    cert = cms_get_cert(smime_cert);
+    if (cert == NULL)
+      continue;
+
+    pkey = cms_get_private_key(privacy, smime_key, email,
+        &bad_passphrase);
+    if (pkey == NULL) {
+      X509_free(cert);
+      if (bad_passphrase)
+        mailprivacy_smime_add_encryption_id(privacy, msg, email);
+      continue;
+    }
+
+    in = BIO_new_mem_buf(smime_str->str, (int) smime_str->len);
+    cms = NULL;
+    if (in != NULL)
+      cms = SMIME_read_CMS(in, NULL);
+    if (cms != NULL) {
+      BIO_reset(decrypted_bio);
+      if (CMS_decrypt(cms, pkey, cert, NULL, decrypted_bio, 0) == 1)
+        decrypt_ok = 1;
+      CMS_ContentInfo_free(cms);
+    }
+    ERR_clear_error();
+    BIO_free(in);
+    EVP_PKEY_free(pkey);
+    X509_free(cert);
+
+    if (decrypt_ok)
+      break;
+  }
+  emails_free(emails);
+
+  decrypted_mime = NULL;
+  if (decrypt_ok) {
+    mailprivacy_smime_encryption_id_list_clear(privacy, msg);
+
+    r = cms_get_part_from_bio(privacy, 1, decrypted_bio, &decrypted_mime);
+    if (r != MAIL_NO_ERROR)
+      decrypted_mime = NULL;
+  }
+
+  r = mailprivacy_new_result_part(privacy, "multipart/x-decrypted",
+      decrypt_ok ? SMIME_DECRYPT_SUCCESS : SMIME_DECRYPT_FAILED,
+      decrypted_mime, result);
+  if (r != MAIL_NO_ERROR) {
+    if (decrypted_mime != NULL) {
+      mailprivacy_mime_clear(decrypted_mime);
+      mailmime_free(decrypted_mime);
+    }
+    res = r;
+    goto free_decrypted;
+  }
+
+  BIO_free(decrypted_bio);
+  mmap_string_free(smime_str);
+
+  return MAIL_NO_ERROR;
+
+ free_decrypted:
+  BIO_free(decrypted_bio);
+ free_smime:
+  mmap_string_free(smime_str);
+ err:
+  return res;
+}
+
+/* writes the certificate of the signer to the certificates directory */
+
+static void cms_store_signer_cert(struct mailmime * mime,
+    CMS_ContentInfo * cms)
+{
+  STACK_OF(X509) * signers;
+  char store_cert_filename[PATH_MAX];
+  char cert_file[PATH_MAX];
+  char * email;
+  BIO * bio;
+  int r;
+
+  if (* cert_dir == '\0')
+    return;
+
+  email = get_first_from_addr(mime);
+  if (email == NULL)
+    return;
+
+  if (get_cert_file(email, cert_file, sizeof(cert_file)) != NULL)
+    return;
+
+  signers = CMS_get0_signers(cms);
+  if (signers == NULL)
+    return;
+  if (sk_X509_num(signers) == 0)
+    goto free_signers;
+
+  snprintf(store_cert_filename, sizeof(store_cert_filename),
+      "%s/%s" CERTIFICATE_SUFFIX, cert_dir, email);
+
+  bio = BIO_new_file(store_cert_filename, "w");
+  if (bio == NULL)
+    goto free_signers;
+  r = PEM_write_bio_X509(bio, sk_X509_value(signers, 0));
+  BIO_free(bio);
+  if (r != 1) {
+    unlink(store_cert_filename);
+    goto free_signers;
+  }
+
+  set_file(certificates, email, store_cert_filename);
+
+ free_signers:
+  sk_X509_free(signers);
+}
+
+static int smime_cms_verify(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, struct mailmime ** result)
+{
+  MMAPString * smime_str;
+  MMAPString * stripped_str;
+  struct mailmime * stripped_mime;
+  CMS_ContentInfo * cms;
+  X509_STORE * store;
+  BIO * in;
+  BIO * content;
+  BIO * out;
+  int sign_ok;
+  int flags;
+  int r;
+  int res;
+
+  r = mailprivacy_fetch_mime_body_to_mem(privacy, msg, mime, &smime_str);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto err;
+  }
+
+  out = BIO_new(BIO_s_mem());
+  if (out == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_smime;
+  }
+
+  sign_ok = 0;
+  content = NULL;
+  cms = NULL;
+  in = BIO_new_mem_buf(smime_str->str, (int) smime_str->len);
+  if (in != NULL)
+    cms = SMIME_read_CMS(in, &content);
+  if (cms != NULL) {
+    flags = 0;
+    if (!CA_check)
+      flags |= CMS_NO_SIGNER_CERT_VERIFY;
+
+    store = cms_get_store();
+    if (CMS_verify(cms, NULL, store, content, out, flags) == 1)
+      sign_ok = 1;
+    if (store != NULL)
+      X509_STORE_free(store);
+
+    if (store_cert && (mime->mm_type == MAILMIME_MULTIPLE))
+      cms_store_signer_cert(mime, cms);
+
+    CMS_ContentInfo_free(cms);
+  }
+  ERR_clear_error();
+  BIO_free(content);
+  BIO_free(in);
+
+  /* insert the signed part */
+
+  stripped_mime = NULL;
+  if (sign_ok) {
+    r = cms_get_part_from_bio(privacy, 1, out, &stripped_mime);
+  }
+  else if (mime->mm_type == MAILMIME_MULTIPLE) {
+    clistiter * child_iter;
+    struct mailmime * child;
+
+    child_iter = clist_begin(mime->mm_data.mm_multipart.mm_mp_list);
+    child = clist_content(child_iter);
+
+    r = mailprivacy_fetch_mime_body_to_mem(privacy, msg, child, &stripped_str);
+    if (r == MAIL_NO_ERROR) {
+      r = mailprivacy_get_mime(privacy, 1, 0,
+          stripped_str->str, stripped_str->len, &stripped_mime);
+      mmap_string_free(stripped_str);
+      if ((r == MAIL_NO_ERROR) &&
+          (stripped_mime->mm_type == MAILMIME_MESSAGE) &&
+          (stripped_mime->mm_data.mm_message.mm_msg_mime != NULL)) {
+        struct mailmime * submime;
+
+        submime = stripped_mime->mm_data.mm_message.mm_msg_mime;
+        mailmime_remove_part(submime);
+        mailmime_free(stripped_mime);
+        stripped_mime = submime;
+      }
+    }
+  }
+  else {
+    r = MAIL_ERROR_INVAL;
+  }
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_out;
+  }
+
+  r = mailprivacy_new_result_part(privacy, "multipart/x-verified",
+      sign_ok ? SMIME_VERIFY_SUCCESS : SMIME_VERIFY_FAILED,
+      stripped_mime, result);
+  if (r != MAIL_NO_ERROR) {
+    mailprivacy_mime_clear(stripped_mime);
+    mailmime_free(stripped_mime);
+    res = r;
+    goto free_out;
+  }
+
+  BIO_free(out);
+  mmap_string_free(smime_str);
+
+  return MAIL_NO_ERROR;
+
+ free_out:
+  BIO_free(out);
+ free_smime:
+  mmap_string_free(smime_str);
+ err:
+  return res;
+}
+
+static int smime_cms_handler(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, struct mailmime ** result)
+{
+  int r;
+  struct mailmime * alternative_mime;
+
+  alternative_mime = NULL;
+  switch (mime->mm_type) {
+  case MAILMIME_MULTIPLE:
+    r = MAIL_ERROR_INVAL;
+    if (smime_is_signed(mime))
+      r = smime_cms_verify(privacy, msg, mime, &alternative_mime);
+
+    if (r != MAIL_NO_ERROR)
+      return r;
+
+    * result = alternative_mime;
+
+    return MAIL_NO_ERROR;
+
+  case MAILMIME_SINGLE:
+    r = MAIL_ERROR_INVAL;
+    if (smime_is_encrypted(mime))
+      r = smime_cms_decrypt(privacy, msg, mime, &alternative_mime);
+    else if (smime_is_signed(mime))
+      r = smime_cms_verify(privacy, msg, mime, &alternative_mime);
+
+    if (r != MAIL_NO_ERROR)
+      return r;
+
+    * result = alternative_mime;
+
+    return MAIL_NO_ERROR;
+  }
+
+  return MAIL_ERROR_INVAL;
+}
+
+/* the part is written with the same format as mailmime_write() */
+
+static int cms_write_part(struct mailmime * mime, BIO ** result)
+{
+  MMAPString * str;
+  BIO * bio;
+  int col;
+  int r;
+
+  str = mmap_string_new("");
+  if (str == NULL)
+    return MAIL_ERROR_MEMORY;
+
+  col = 0;
+  r = mailmime_write_mem(str, &col, mime);
+  if (r != MAILIMF_NO_ERROR) {
+    mmap_string_free(str);
+    return MAIL_ERROR_MEMORY;
+  }
+
+  bio = BIO_new(BIO_s_mem());
+  if (bio == NULL) {
+    mmap_string_free(str);
+    return MAIL_ERROR_MEMORY;
+  }
+  r = BIO_write(bio, str->str, (int) str->len);
+  mmap_string_free(str);
+  if (r < 0) {
+    BIO_free(bio);
+    return MAIL_ERROR_MEMORY;
+  }
+
+  * result = bio;
+
+  return MAIL_NO_ERROR;
+}
+
+/* the output of SMIME_write_CMS() replaces the part */
+
+static int cms_get_encrypted_part(struct mailprivacy * privacy,
+    CMS_ContentInfo * cms, BIO * in, int flags, struct mailmime ** result)
+{
+  struct mailmime * encrypted_mime;
+  BIO * out;
+  int r;
+
+  out = BIO_new(BIO_s_mem());
+  if (out == NULL)
+    return MAIL_ERROR_MEMORY;
+
+  if (SMIME_write_CMS(out, cms, in, flags) != 1) {
+    ERR_clear_error();
+    BIO_free(out);
+    return MAIL_ERROR_COMMAND;
+  }
+
+  r = cms_get_part_from_bio(privacy, 0, out, &encrypted_mime);
+  BIO_free(out);
+  if (r != MAIL_NO_ERROR)
+    return r;
+  strip_mime_headers(encrypted_mime);
+
+  * result = encrypted_mime;
+
+  return MAIL_NO_ERROR;
+}
+
+/* passphrase is needed */
+
+static int smime_cms_sign(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, struct mailmime ** result)
+{
+  CMS_ContentInfo * cms;
+  struct mailmime * signed_mime;
+  char smime_cert[PATH_MAX];
+  char smime_key[PATH_MAX];
+  char * email;
+  X509 * cert;
+  EVP_PKEY * pkey;
+  BIO * in;
+  int bad_passphrase;
+  int flags;
+  int r;
+  int res;
+
+  /* get signing key */
+
+  email = get_first_from_addr(mime);
+  if (email == NULL) {
+    res = MAIL_ERROR_INVAL;
+    goto err;
+  }
+
+  if ((get_private_key_file(email, smime_key, sizeof(smime_key)) == NULL) ||
+      (get_cert_file(email, smime_cert, sizeof(smime_cert)) == NULL)) {
+    res = MAIL_ERROR_INVAL;
+    goto err;
+  }
+
+  cert = cms_get_cert(smime_cert);
+  if (cert == NULL) {
+    res = MAIL_ERROR_INVAL;
+    goto err;
+  }
+
+  pkey = cms_get_private_key(privacy, smime_key, email, &bad_passphrase);
+  if (pkey == NULL) {
+    if (bad_passphrase)
+      mailprivacy_smime_add_encryption_id(privacy, msg, email);
+    res = MAIL_ERROR_COMMAND;
+    goto free_cert;
+  }
+
+  /* part to sign */
+
+  /* encode quoted printable all text parts */
+
+  mailprivacy_prepare_mime(mime);
+
+  r = cms_write_part(mime, &in);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_pkey;
+  }
+
+  flags = CMS_DETACHED | CMS_STREAM;
+  cms = CMS_sign(cert, pkey, NULL, in, flags);
+  if (cms == NULL) {
+    ERR_clear_error();
+    res = MAIL_ERROR_COMMAND;
+    goto free_in;
+  }
+
+  r = cms_get_encrypted_part(privacy, cms, in, flags, &signed_mime);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_cms;
+  }
+
+  CMS_ContentInfo_free(cms);
+  BIO_free(in);
+  EVP_PKEY_free(pkey);
+  X509_free(cert);
+
+  * result = signed_mime;
+
+  return MAIL_NO_ERROR;
+
+ free_cms:
+  CMS_ContentInfo_free(cms);
+ free_in:
+  BIO_free(in);
+ free_pkey:
+  EVP_PKEY_free(pkey);
+ free_cert:
+  X509_free(cert);
+ err:
+  return res;
+}
+
+static int cms_recipient_add_mb(STACK_OF(X509) * recipients,
+    struct mailimf_mailbox * mb)
+{
+  char filename[PATH_MAX];
+  X509 * cert;
+
+  if (mb->mb_addr_spec == NULL)
+    return MAIL_NO_ERROR;
+
+  if (get_cert_file(mb->mb_addr_spec, filename, sizeof(filename)) == NULL)
+    return MAIL_ERROR_INVAL;
+
+  cert = cms_get_cert(filename);
+  if (cert == NULL)
+    return MAIL_ERROR_INVAL;
+
+  if (sk_X509_push(recipients, cert) == 0) {
+    X509_free(cert);
+    return MAIL_ERROR_MEMORY;
+  }
+
+  return MAIL_NO_ERROR;
+}
+
+static int cms_recipient_add_mb_list(STACK_OF(X509) * recipients,
+    struct mailimf_mailbox_list * mb_list)
+{
+  clistiter * cur;
+  int r;
+
+  for(cur = clist_begin(mb_list->mb_list) ; cur != NULL ;
+      cur = clist_next(cur)) {
+    struct mailimf_mailbox * mb;
+
+    mb = clist_content(cur);
+
+    r = cms_recipient_add_mb(recipients, mb);
+    if (r != MAIL_NO_ERROR)
+      return r;
+  }
+
+  return MAIL_NO_ERROR;
+}
+
+static int cms_recipient_add_addr_list(STACK_OF(X509) * recipients,
+    struct mailimf_address_list * addr_list)
+{
+  clistiter * cur;
+  int r;
+
+  for(cur = clist_begin(addr_list->ad_list) ; cur != NULL ;
+      cur = clist_next(cur)) {
+    struct mailimf_address * addr;
+
+    addr = clist_content(cur);
+
+    switch (addr->ad_type) {
+    case MAILIMF_ADDRESS_MAILBOX:
+      r = cms_recipient_add_mb(recipients, addr->ad_data.ad_mailbox);
+      break;
+    case MAILIMF_ADDRESS_GROUP:
+      r = cms_recipient_add_mb_list(recipients,
+          addr->ad_data.ad_group->grp_mb_list);
+      break;
+    default:
+      r = MAIL_ERROR_INVAL;
+    }
+    if (r != MAIL_NO_ERROR)
+      return r;
+  }
+
+  return MAIL_NO_ERROR;
+}
+
+static int cms_collect_recipients(STACK_OF(X509) * recipients,
+    struct mailimf_fields * fields)
+{
+  struct mailimf_single_fields single_fields;
+  int r;
+
+  if (fields == NULL)
+    return MAIL_NO_ERROR;
+
+  mailimf_single_fields_init(&single_fields, fields);
+
+  if (single_fields.fld_to != NULL) {
+    r = cms_recipient_add_addr_list(recipients,
+        single_fields.fld_to->to_addr_list);
+    if (r != MAIL_NO_ERROR)
+      return r;
+  }
+
+  if (single_fields.fld_cc != NULL) {
+    r = cms_recipient_add_addr_list(recipients,
+        single_fields.fld_cc->cc_addr_list);
+    if (r != MAIL_NO_ERROR)
+      return r;
+  }
+
+  if (single_fields.fld_bcc != NULL) {
+    if (single_fields.fld_bcc->bcc_addr_list != NULL) {
+      r = cms_recipient_add_addr_list(recipients,
+          single_fields.fld_bcc->bcc_addr_list);
+      if (r != MAIL_NO_ERROR)
+        return r;
+    }
+  }
+
+  return MAIL_NO_ERROR;
+}
+
+static int smime_cms_encrypt(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, struct mailmime ** result)
+{
+  STACK_OF(X509) * recipients;
+  CMS_ContentInfo * cms;
+  struct mailmime * encrypted_mime;
+  struct mailmime * root;
+  struct mailimf_fields * fields;
+  BIO * in;
+  int flags;
+  int r;
+  int res;
+
+  /* the recipients are taken from the headers of the part */
+  (void) msg;
+
+  root = mime;
+  while (root->mm_parent != NULL)
+    root = root->mm_parent;
+
+  fields = NULL;
+  if (root->mm_type == MAILMIME_MESSAGE)
+    fields = root->mm_data.mm_message.mm_fields;
+
+  /* recipient */
+
+  recipients = sk_X509_new_null();
+  if (recipients == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+
+  r = cms_collect_recipients(recipients, fields);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_recipients;
+  }
+  if (sk_X509_num(recipients) == 0) {
+    res = MAIL_ERROR_INVAL;
+    goto free_recipients;
+  }
+
+  /* part to encrypt */
+
+  /* encode quoted printable all text parts */
+
+  mailprivacy_prepare_mime(mime);
+
+  r = cms_write_part(mime, &in);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_recipients;
+  }
+
+  flags = CMS_STREAM;
+  cms = CMS_encrypt(recipients, in, EVP_aes_256_cbc(), flags);
+  if (cms == NULL) {
+    ERR_clear_error();
+    res = MAIL_ERROR_COMMAND;
+    goto free_in;
+  }
+
+  r = cms_get_encrypted_part(privacy, cms, in, flags, &encrypted_mime);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_cms;
+  }
+
+  CMS_ContentInfo_free(cms);
+  BIO_free(in);
+  sk_X509_pop_free(recipients, X509_free);
+
+  * result = encrypted_mime;
+
+  return MAIL_NO_ERROR;
+
+ free_cms:
+  CMS_ContentInfo_free(cms);
+ free_in:
+  BIO_free(in);
+ free_recipients:
+  sk_X509_pop_free(recipients, X509_free);
+ err:
+  return res;
+}
+
+/* passphrase will be needed */
+
+static int smime_cms_sign_encrypt(struct mailprivacy * privacy,
+    mailmessage * msg,
+    struct mailmime * mime, struct mailmime ** result)
+{
+  struct mailmime * signed_part;
+  struct mailmime * encrypted;
+  int r;
+  int res;
+
+  r = smime_cms_sign(privacy, msg, mime, &signed_part);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto err;
+  }
+
+  /* the recipients are found in the headers of the message */
+  signed_part->mm_parent = mime->mm_parent;
+  r = smime_cms_encrypt(privacy, msg, signed_part, &encrypted);
+  signed_part->mm_parent = NULL;
+  if (r != MAIL_NO_ERROR) {
+    res = r;
+    goto free_signed;
+  }
+
+  /* the encrypted part was built from a copy of the signed part */
+  mailprivacy_mime_clear(signed_part);
+  mailmime_free(signed_part);
+
+  * result = encrypted;
+
+  return MAIL_NO_ERROR;
+
+ free_signed:
+  mailprivacy_mime_clear(signed_part);
+  mailmime_free(signed_part);
+ err:
+  return res;
+}
+
+static struct mailprivacy_encryption smime_cms_encryption_tab[] = {
+  /* S/MIME signed part */
+  {
+    /* name */ "signed",
+    /* description */ "S/MIME signed part",
+    /* encrypt */ smime_cms_sign
+  },
+
+  /* S/MIME encrypted part */
+
+  {
+    /* name */ "encrypted",
+    /* description */ "S/MIME encrypted part",
+    /* encrypt */ smime_cms_encrypt
+  },
+
+  /* S/MIME signed & encrypted part */
+
+  {
+    /* name */ "signed-encrypted",
+    /* description */ "S/MIME signed & encrypted part",
+    /* encrypt */ smime_cms_sign_encrypt
+  }
+};
+
+/* same name as the command protocol, only one of them is registered */
+
+static struct mailprivacy_protocol smime_cms_protocol = {
+  /* name */ "smime",
+  /* description */ "S/MIME",
+
+  /* is_encrypted */ smime_test_encrypted,
+  /* decrypt */ smime_cms_handler,
+
+  /* encryption_count */
+  (sizeof(smime_cms_encryption_tab) / sizeof(smime_cms_encryption_tab[0])),
+
+  /* encryption_tab */ smime_cms_encryption_tab
+};
+
+#endif
@@ -45,6 +45,29 @@ int mailprivacy_smime_init(struct mailprivacy * privacy);
 LIBETPAN_EXPORT
 void mailprivacy_smime_done(struct mailprivacy * privacy);
 
+/*
+  backend of the S/MIME operations:
+
+  - MAILPRIVACY_SMIME_BACKEND_COMMAND (default) runs the openssl
+    command with temporary files.
+  - MAILPRIVACY_SMIME_BACKEND_CMS runs the operations in-process with
+    libcrypto. The certificates and the private keys are loaded once,
+    they are reloaded when the directories are set again. Signatures
+    use the detached format and encryption uses AES-256-CBC.
+
+  mailprivacy_smime_set_backend() returns MAIL_ERROR_NOT_IMPLEMENTED
+  when the backend is not available (libetpan built without OpenSSL).
+  The configuration is shared by the backends.
+*/
+
+enum {
+  MAILPRIVACY_SMIME_BACKEND_COMMAND,
+  MAILPRIVACY_SMIME_BACKEND_CMS
+};
+
+LIBETPAN_EXPORT
+int mailprivacy_smime_set_backend(struct mailprivacy * privacy, int backend);
+
 LIBETPAN_EXPORT
 void mailprivacy_smime_set_cert_dir(struct mailprivacy * privacy,
     char * directory);
@@ -63,9 +63,28 @@
 #include <libetpan/libetpan-config.h>
 #include <libetpan/data_message_driver.h>
 #include <errno.h>
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+#	include <pthread.h>
+#endif
+#endif
 
 #include "../data-types/syscall_wrappers.h"
 
+/* the umask is shared by the threads of the process */
+
+#ifdef LIBETPAN_REENTRANT
+#if defined(HAVE_PTHREAD_H) && !defined(IGNORE_PTHREAD_H)
+static pthread_mutex_t tmp_file_lock = PTHREAD_MUTEX_INITIALIZER;
+#define TMP_FILE_LOCK() pthread_mutex_lock(&tmp_file_lock)
+#define TMP_FILE_UNLOCK() pthread_mutex_unlock(&tmp_file_lock)
+#endif
+#endif
+#ifndef TMP_FILE_LOCK
+#define TMP_FILE_LOCK() do {} while (0)
+#define TMP_FILE_UNLOCK() do {} while (0)
+#endif
+
 void mailprivacy_mime_clear(struct mailmime * mime)
 {
   struct mailmime_data * data;
@@ -117,9 +136,11 @@ static FILE * get_tmp_file(char * filename)
   mode_t old_mask;
   FILE * f;
   
+  TMP_FILE_LOCK();
   old_mask = umask(0077);
   fd = Mkstemp(filename);
   umask(old_mask);
+  TMP_FILE_UNLOCK();
   if (fd == -1)
     return NULL;
  
@@ -182,6 +203,13 @@ static char * dup_file(struct mailprivacy * privacy,
   if (r < 0)
     goto close_src;
   
+  /* an empty file cannot be mapped */
+  if (stat_info.st_size == 0) {
+    Close(fd);
+    Fclose(dest_f);
+    return dest_filename;
+  }
+  
   mapping = mmap(NULL, stat_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
   if (mapping == (char *)MAP_FAILED)
     goto close_src;
@@ -204,6 +232,7 @@ static char * dup_file(struct mailprivacy * privacy,
   free(dest_filename);
  close_dest:
   Fclose(dest_f);
+  unlink(filename);
  err:
   return NULL;
 }
@@ -715,6 +744,173 @@ int mailprivacy_fetch_mime_body_to_file(struct mailprivacy * privacy,
 }
 
 
+/* write mime headers and body to memory, CR LF fixed */
+
+int mailprivacy_fetch_mime_body_to_mem(struct mailprivacy * privacy,
+    mailmessage * msg, struct mailmime * mime, MMAPString ** result)
+{
+  MMAPString * str;
+  char * content;
+  size_t content_len;
+  int col;
+  int r;
+  int res;
+
+  if (mime->mm_parent_type == MAILMIME_NONE) {
+    res = MAIL_ERROR_INVAL;
+    goto err;
+  }
+
+  str = mmap_string_new("");
+  if (str == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+
+  r = mailprivacy_msg_fetch_section_mime(privacy, msg, mime,
+      &content, &content_len);
+  if (r != MAIL_NO_ERROR) {
+    res = MAIL_ERROR_FETCH;
+    goto free_str;
+  }
+
+  col = 0;
+  r = mailimf_string_write_mem(str, &col, content, content_len);
+  mailprivacy_msg_fetch_result_free(privacy, msg, content);
+  if (r != MAILIMF_NO_ERROR) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_str;
+  }
+
+  r = mailprivacy_msg_fetch_section(privacy, msg, mime,
+      &content, &content_len);
+  if (r != MAIL_NO_ERROR) {
+    res = MAIL_ERROR_FETCH;
+    goto free_str;
+  }
+
+  r = mailimf_string_write_mem(str, &col, content, content_len);
+  mailprivacy_msg_fetch_result_free(privacy, msg, content);
+  if (r != MAILIMF_NO_ERROR) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_str;
+  }
+
+  * result = str;
+
+  return MAIL_NO_ERROR;
+
+ free_str:
+  mmap_string_free(str);
+ err:
+  return res;
+}
+
+/* same as mailprivacy_get_part_from_file() with content in memory */
+
+int mailprivacy_get_part_from_mem(struct mailprivacy * privacy,
+    int check_security, int reencode, char * content, size_t content_len,
+    struct mailmime ** result_mime)
+{
+  struct mailmime * mime;
+  int r;
+
+  mime = NULL;
+  /* check recursive parts if privacy is set */
+  r = mailprivacy_get_mime(privacy, check_security, reencode,
+      content, content_len, &mime);
+  if (r != MAIL_NO_ERROR)
+    return r;
+
+  if (mime->mm_type == MAILMIME_MESSAGE) {
+    struct mailmime * submime;
+
+    submime = mime->mm_data.mm_message.mm_msg_mime;
+    if (submime != NULL) {
+      mailmime_remove_part(submime);
+      mailmime_free(mime);
+
+      mime = submime;
+    }
+  }
+
+  * result_mime = mime;
+
+  return MAIL_NO_ERROR;
+}
+
+/* the description is a constant string, no file is needed */
+
+static struct mailmime * new_description_part(struct mailprivacy * privacy,
+    char * description)
+{
+  struct mailmime * mime;
+  int r;
+
+  mime = mailprivacy_new_file_part(privacy, NULL,
+      "text/plain", MAILMIME_MECHANISM_8BIT);
+  if (mime == NULL)
+    return NULL;
+
+  r = mailmime_set_body_text(mime, description, strlen(description));
+  if (r != MAILIMF_NO_ERROR) {
+    mailmime_free(mime);
+    return NULL;
+  }
+
+  return mime;
+}
+
+/* builds the multipart with the description and the result */
+
+int mailprivacy_new_result_part(struct mailprivacy * privacy,
+    char * content_type, char * description, struct mailmime * part,
+    struct mailmime ** result)
+{
+  struct mailmime * multipart;
+  struct mailmime * description_mime;
+  int r;
+  int res;
+
+  r = mailmime_new_with_content(content_type, NULL, &multipart);
+  if (r != MAILIMF_NO_ERROR) {
+    res = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+
+  description_mime = new_description_part(privacy, description);
+  if (description_mime == NULL) {
+    res = MAIL_ERROR_MEMORY;
+    goto free_multipart;
+  }
+
+  r = mailmime_smart_add_part(multipart, description_mime);
+  if (r != MAIL_NO_ERROR) {
+    mailmime_free(description_mime);
+    res = MAIL_ERROR_MEMORY;
+    goto free_multipart;
+  }
+
+  if (part != NULL) {
+    r = mailmime_smart_add_part(multipart, part);
+    if (r != MAIL_NO_ERROR) {
+      res = MAIL_ERROR_MEMORY;
+      goto free_multipart;
+    }
+  }
+
+  * result = multipart;
+
+  return MAIL_NO_ERROR;
+
+ free_multipart:
+  mailprivacy_mime_clear(multipart);
+  mailmime_free(multipart);
+ err:
+  return res;
+}
+
+
 int mailprivacy_get_part_from_file(struct mailprivacy * privacy,
     int check_security, int reencode, char * filename,
     struct mailmime ** result_mime)
@@ -744,27 +940,13 @@ int mailprivacy_get_part_from_file(struct mailprivacy * privacy,
     goto Close;
   }
   
-  mime = NULL;
-  /* check recursive parts if privacy is set */
-  r = mailprivacy_get_mime(privacy, check_security, reencode,
+  r = mailprivacy_get_part_from_mem(privacy, check_security, reencode,
       mapping, stat_info.st_size, &mime);
   if (r != MAIL_NO_ERROR) {
     res =  r;
     goto unmap;
   }
 
-  if (mime->mm_type == MAILMIME_MESSAGE) {
-    struct mailmime * submime;
-    
-    submime = mime->mm_data.mm_message.mm_msg_mime;
-    if (mime->mm_data.mm_message.mm_msg_mime != NULL) {
-      mailmime_remove_part(submime);
-      mailmime_free(mime);
-      
-      mime = submime;
-    }
-  }
-
   munmap(mapping, stat_info.st_size);
  
   Close(fd);
@@ -1229,42 +1411,56 @@ mailmime_content_dup(struct mailmime_content * content)
 }
 
 
-int mailprivacy_fetch_decoded_to_file(struct mailprivacy * privacy,
-    char * filename, size_t size,
-    mailmessage * msg, struct mailmime * mime)
+/* the result is freed with mmap_string_unref() */
+
+int mailprivacy_fetch_decoded_to_mem(struct mailprivacy * privacy,
+    mailmessage * msg, struct mailmime * mime,
+    char ** result, size_t * result_len)
 {
   int r;
-  int res;
-  FILE * f;
   char * content;
   size_t content_len;
-  size_t written;
   struct mailmime_single_fields single_fields;
   int encoding;
   size_t cur_token;
-  char * parsed_content;
-  size_t parsed_content_len;
-  
+
   mailmime_single_fields_init(&single_fields, mime->mm_mime_fields,
       mime->mm_content_type);
   if (single_fields.fld_encoding != NULL)
     encoding = single_fields.fld_encoding->enc_type;
   else
     encoding = MAILMIME_MECHANISM_8BIT;
-  
+
   r = mailprivacy_msg_fetch_section(privacy, msg, mime,
       &content, &content_len);
-  if (r != MAIL_NO_ERROR) {
-    res = MAIL_ERROR_FETCH;
-    goto err;
-  }
-  
+  if (r != MAIL_NO_ERROR)
+    return MAIL_ERROR_FETCH;
+
   cur_token = 0;
   r = mailmime_part_parse(content, content_len, &cur_token,
-      encoding, &parsed_content, &parsed_content_len);
+      encoding, result, result_len);
   mailprivacy_msg_fetch_result_free(privacy, msg, content);
-  if (r != MAILIMF_NO_ERROR) {
-    res = MAIL_ERROR_PARSE;
+  if (r != MAILIMF_NO_ERROR)
+    return MAIL_ERROR_PARSE;
+
+  return MAIL_NO_ERROR;
+}
+
+int mailprivacy_fetch_decoded_to_file(struct mailprivacy * privacy,
+    char * filename, size_t size,
+    mailmessage * msg, struct mailmime * mime)
+{
+  int r;
+  int res;
+  FILE * f;
+  size_t written;
+  char * parsed_content;
+  size_t parsed_content_len;
+  
+  r = mailprivacy_fetch_decoded_to_mem(privacy, msg, mime,
+      &parsed_content, &parsed_content_len);
+  if (r != MAIL_NO_ERROR) {
+    res = r;
     goto err;
   }
   
@@ -45,4 +45,44 @@ int mailprivacy_spawn_and_wait(char * command, char * passphrase,
     char * stdoutfile, char * stderrfile,
     int * bad_passphrase);
 
+/*
+  the following functions are the same as the _to_file() and
+  _from_file() versions in mailprivacy_tools.h, without temporary files.
+*/
+
+int mailprivacy_fetch_mime_body_to_mem(struct mailprivacy * privacy,
+    mailmessage * msg, struct mailmime * mime, MMAPString ** result);
+
+int mailprivacy_fetch_decoded_to_mem(struct mailprivacy * privacy,
+    mailmessage * msg, struct mailmime * mime,
+    char ** result, size_t * result_len);
+
+int mailprivacy_get_part_from_mem(struct mailprivacy * privacy,
+    int check_security, int reencode, char * content, size_t content_len,
+    struct mailmime ** result_mime);
+
+/*
+  builds a multipart of the given content type with a text part
+  containing the description followed by the given part
+*/
+
+int mailprivacy_new_result_part(struct mailprivacy * privacy,
+    char * content_type, char * description, struct mailmime * part,
+    struct mailmime ** result);
+
+/* cache of the decrypted parts, see mailprivacy_set_cache_size() */
+
+#define MAILPRIVACY_CACHE_KEY_SIZE 32
+
+void mailprivacy_cache_free(struct mailprivacy_cache * cache);
+
+int mailprivacy_cache_get_key(struct mailprivacy * privacy,
+    mailmessage * msg, struct mailmime * mime, unsigned char * key);
+
+int mailprivacy_cache_get(struct mailprivacy * privacy,
+    unsigned char * key, struct mailmime ** result);
+
+void mailprivacy_cache_set(struct mailprivacy * privacy,
+    unsigned char * key, struct mailmime * result);
+
 #endif
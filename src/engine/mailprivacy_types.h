@@ -42,6 +42,9 @@
 #include <libetpan/mailmessage.h>
 #include <libetpan/mailmime.h>
 
+struct mailprivacy_cache;
+struct mailprivacy_workers;
+
 struct mailprivacy {
   char * tmp_dir;               /* working tmp directory */
   chash * msg_ref;              /* mailmessage => present or not */
@@ -53,6 +56,8 @@ struct mailprivacy {
      part, if 1, adds a multipart/alternative and put the decrypted 
      and encrypted part as subparts.
   */
+  struct mailprivacy_cache * cache; /* decrypted parts, can be NULL */
+  struct mailprivacy_workers * workers; /* NULL when sequential */
 };
 
 struct mailprivacy_encryption {
@@ -40,6 +40,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "carena_wrappers.h"
+
 void mailimap_acl_identifier_free(char * identifier)
 {
   mailimap_astring_free(identifier);
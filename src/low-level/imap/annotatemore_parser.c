@@ -40,6 +40,8 @@
 
 #include <stdlib.h>
 
+#include "carena_wrappers.h"
+
 int
 mailimap_annotatemore_annotate_data_parse(mailstream * fd, MMAPString *buffer,
     size_t * indx, struct mailimap_annotatemore_annotate_data ** result,
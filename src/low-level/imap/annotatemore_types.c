@@ -40,6 +40,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "carena_wrappers.h"
+
 void mailimap_annotatemore_attrib_free(char * attrib)
 {
  mailimap_string_free(attrib);
@@ -44,6 +44,8 @@
 #include "qresync.h"
 #include "qresync_private.h"
 
+#include "carena_wrappers.h"
+
 /*
    capability          =/ "CONDSTORE"
 
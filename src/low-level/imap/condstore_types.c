@@ -33,6 +33,8 @@
 
 #include <stdlib.h>
 
+#include "carena_wrappers.h"
+
 LIBETPAN_EXPORT
 struct mailimap_condstore_fetch_mod_resp * mailimap_condstore_fetch_mod_resp_new(uint64_t cs_modseq_value)
 {
@@ -44,6 +44,7 @@
 #include "mail.h"
 #include "condstore.h"
 #include "condstore_private.h"
+#include "carena.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -374,6 +375,8 @@ message_data_store(mailimap * session,
     struct mailimap_message_data * msg_data)
 {
   uint32_t * expunged;
+  carena * arena;
+  carena * old_arena;
   int r;
   
   switch (msg_data->mdt_type) {
@@ -396,14 +399,24 @@ message_data_store(mailimap * session,
     break;
 
   case MAILIMAP_MESSAGE_DATA_FETCH:
-    r = clist_append(session->imap_response_info->rsp_fetch_list,
+    arena = carena_get_deferred();
+    old_arena = NULL;
+    if (arena != NULL)
+      old_arena = carena_set_current(arena);
+    r = clist_append_arena(session->imap_response_info->rsp_fetch_list,
         msg_data->mdt_msg_att);
+    if (arena != NULL)
+      carena_set_current(old_arena);
     if (r == 0) {
       msg_data->mdt_msg_att->att_number = msg_data->mdt_number;
       msg_data->mdt_msg_att = NULL;
     }
     else {
       /* TODO : must handle error case */
+      if (arena != NULL) {
+        /* owned by the arena */
+        msg_data->mdt_msg_att = NULL;
+      }
     }
     break;
   }
@@ -474,11 +487,25 @@ static void response_done_store(mailimap * session,
   }
 }
 
+/*
+  the msg-att handler is only given to the parser along with the
+  progress functions, see parse_response(). The message attributes
+  are then given to the handler and the fetch list is not returned.
+*/
+
+static int msg_att_handler_used(mailimap * session)
+{
+  return (session->imap_msg_att_handler != NULL) &&
+    ((session->imap_body_progress_fun != NULL) ||
+        (session->imap_items_progress_fun != NULL));
+}
+
 static void
 response_store(mailimap * session,
     struct mailimap_response * response)
 {
   clistiter * cur;
+  carena * arena;
 
   if (session->imap_response_info) {
     mailimap_response_info_free(session->imap_response_info);
@@ -491,6 +518,21 @@ response_store(mailimap * session,
     return;
   }
 
+  arena = carena_get_deferred();
+  if ((arena != NULL) && !msg_att_handler_used(session)) {
+    clist * fetch_list;
+    carena * old_arena;
+    
+    /* the fetch list is released with the arena */
+    old_arena = carena_set_current(arena);
+    fetch_list = clist_new_arena();
+    carena_set_current(old_arena);
+    if (fetch_list != NULL) {
+      clist_free(session->imap_response_info->rsp_fetch_list);
+      session->imap_response_info->rsp_fetch_list = fetch_list;
+    }
+  }
+
   if (response->rsp_cont_req_or_resp_data_list != NULL) {
     for(cur = clist_begin(response->rsp_cont_req_or_resp_data_list) ;
 	cur != NULL ; cur = clist_next(cur)) {
@@ -2411,6 +2453,32 @@ int mailimap_parse_response(mailimap * session,
 }
 
 
+int mailimap_parse_fetch_response(mailimap * session,
+    struct mailimap_response ** result)
+{
+  carena * old_arena;
+  int r;
+  
+  if ((session->imap_fetch_arena == NULL) || msg_att_handler_used(session))
+    return mailimap_parse_response(session, result);
+  
+  old_arena = carena_set_deferred(session->imap_fetch_arena);
+  r = mailimap_parse_response(session, result);
+  carena_set_deferred(old_arena);
+  
+  if (r != MAILIMAP_NO_ERROR) {
+    /* the fetch list stored before the error belongs to the arena,
+       it must not be released with the response info */
+    if ((session->imap_response_info != NULL) &&
+        (session->imap_response_info->rsp_fetch_list != NULL) &&
+        carena_contains(session->imap_fetch_arena,
+            session->imap_response_info->rsp_fetch_list))
+      session->imap_response_info->rsp_fetch_list = NULL;
+  }
+  
+  return r;
+}
+
 static int parse_greeting(mailimap * session,
 	 			struct mailimap_greeting ** result)
 {
@@ -2512,6 +2580,7 @@ mailimap * mailimap_new(size_t imap_progr_rate,
   f->imap_logger = NULL;
   f->imap_logger_context = NULL;
   f->is_163_workaround_enabled = 0;
+  f->imap_fetch_arena = NULL;
   return f;
   
  free_stream_buffer:
@@ -2580,6 +2649,12 @@ void mailimap_set_msg_att_handler(mailimap * session,
   session->imap_msg_att_handler_context = context;
 }
 
+LIBETPAN_EXPORT
+void mailimap_set_fetch_arena(mailimap * session, struct carena_s * arena)
+{
+  session->imap_fetch_arena = arena;
+}
+
 static inline void imap_logger(mailstream * s, int log_type,
     const char * str, size_t size, void * context)
 {
@@ -63,6 +63,9 @@ extern "C" {
 #include <libetpan/condstore.h>
 #include <libetpan/qresync.h>
 #include <libetpan/mailimap_sort.h>
+#include <libetpan/mailimap_thread.h>
+#include <libetpan/notify.h>
+#include <libetpan/mailimap_watcher.h>
 #include <libetpan/mailimap_compress.h>
 #include <libetpan/mailimap_oauth2.h>
 
@@ -737,6 +740,15 @@ char * mailimap_read_line(mailimap * session);
 int mailimap_parse_response(mailimap * session,
     struct mailimap_response ** result);
 
+/*
+    mailimap_parse_fetch_response() parse the response of a FETCH command.
+    The fetch list of the response info and the message attributes are
+    allocated from the fetch arena of the session if any.
+*/
+
+int mailimap_parse_fetch_response(mailimap * session,
+    struct mailimap_response ** result);
+
 /*
     mailimap_set_progress_callback() set IMAP progression callbacks.
 
@@ -769,6 +781,24 @@ void mailimap_set_msg_att_handler(mailimap * session,
                                   mailimap_msg_att_handler * handler,
                                   void * context);
 
+/*
+    mailimap_set_fetch_arena() set the arena the results of FETCH are
+      allocated from.
+
+    @param session    IMAP session
+    @param arena      when not NULL, the list returned by mailimap_fetch(),
+      mailimap_uid_fetch() and their CONDSTORE and QRESYNC variants is
+      allocated from the arena with the message attributes it contains.
+      It is released at once with carena_free() or carena_reset() and
+      must not be given to mailimap_fetch_list_free().
+      NULL restores the allocation on the heap.
+      The arena is not used when a message attribute handler is set.
+      The progress callbacks and the logger are called without it.
+*/
+
+LIBETPAN_EXPORT
+void mailimap_set_fetch_arena(mailimap * session, struct carena_s * arena);
+
 /*
     mailimap_set_timeout() set the network timeout of the IMAP session.
 
@@ -54,6 +54,9 @@
 #include "condstore.h"
 #include "qresync.h"
 #include "mailimap_sort.h"
+#include "mailimap_thread.h"
+
+#include "carena_wrappers.h"
 
 /*
   the list of registered extensions (struct mailimap_extension_api *)
@@ -77,7 +80,8 @@ static struct mailimap_extension_api * internal_extension_list[] = {
   &mailimap_extension_enable,
   &mailimap_extension_condstore,
   &mailimap_extension_qresync,
-  &mailimap_extension_sort
+  &mailimap_extension_sort,
+  &mailimap_extension_thread
 };
 
 LIBETPAN_EXPORT
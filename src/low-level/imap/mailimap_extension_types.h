@@ -55,7 +55,8 @@ enum {
   MAILIMAP_EXTENSION_ENABLE,        /* ENABLE */
   MAILIMAP_EXTENSION_CONDSTORE,     /* CONDSTORE */
   MAILIMAP_EXTENSION_QRESYNC,       /* QRESYNC */
-  MAILIMAP_EXTENSION_SORT           /* SORT */
+  MAILIMAP_EXTENSION_SORT,          /* SORT */
+  MAILIMAP_EXTENSION_THREAD         /* THREAD */
 };
 
 
@@ -37,6 +37,8 @@
 
 #include <stdio.h>
 
+#include "carena_wrappers.h"
+
 static int mailimap_id_response_parse(mailstream * fd,
     MMAPString * buffer, size_t * indx,
     struct mailimap_extension_data ** result);
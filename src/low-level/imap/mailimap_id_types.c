@@ -34,6 +34,8 @@
 
 #include "mailimap_types.h"
 
+#include "carena_wrappers.h"
+
 LIBETPAN_EXPORT
 struct mailimap_id_params_list * mailimap_id_params_list_new(clist * items)
 {
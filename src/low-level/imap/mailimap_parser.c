@@ -45,10 +45,14 @@
 #include "mailimap_keywords.h"
 #include "mailimap_parser.h"
 #include "mailimap_extension.h"
+#include "condstore.h"
+#include "condstore_types.h"
 #include "mmapstring.h"
 #include "mail.h"
 #include "timeutils.h"
 
+#include "carena_wrappers.h"
+
 #ifndef UNSTRICT_SYNTAX
 #define UNSTRICT_SYNTAX
 #endif
@@ -5984,6 +5988,24 @@ static int is_list_wildcards(char ch)
 
 #define MAX_READ_PROGRESS 65536
 
+/* the callbacks of the application don't allocate from the arena */
+
+static void literal_progress(size_t current, size_t maximum,
+    progress_function * progr_fun, mailprogress_function * body_progr_fun,
+    void * context)
+{
+  carena * old_arena;
+
+  old_arena = carena_set_current(NULL);
+  if (progr_fun != NULL) {
+    progr_fun(current, maximum);
+  }
+  if (body_progr_fun != NULL) {
+    body_progr_fun(current, maximum, context);
+  }
+  carena_set_current(old_arena);
+}
+
 static int mailimap_literal_parse_progress(mailstream * fd, MMAPString * buffer,
                                            size_t * indx, char ** result,
                                            size_t * result_len,
@@ -6067,12 +6089,7 @@ static int mailimap_literal_parse_progress(mailstream * fd, MMAPString * buffer,
         goto free_literal;
       }
     if (progr_rate != 0) {
-      if (progr_fun != NULL) {
-        progr_fun(number, number);
-      }
-      if (body_progr_fun != NULL) {
-        body_progr_fun(number, number, context);
-      }
+      literal_progress(number, number, progr_fun, body_progr_fun, context);
     }
     cur_token = cur_token + number;
   }
@@ -6110,12 +6127,8 @@ static int mailimap_literal_parse_progress(mailstream * fd, MMAPString * buffer,
       
       current_prog += read_bytes;
       if (current_prog - last_prog > progr_rate) {
-        if (progr_fun != NULL) {
-          progr_fun(current_prog, number);
-        }
-        if (body_progr_fun != NULL) {
-          body_progr_fun(current_prog, number, context);
-        }
+        literal_progress(current_prog, number, progr_fun, body_progr_fun,
+            context);
         last_prog = current_prog;
       }
     }
@@ -6135,12 +6148,7 @@ static int mailimap_literal_parse_progress(mailstream * fd, MMAPString * buffer,
     cur_token = number_token + 4;
   }
   if (progr_rate != 0) {
-    if (progr_fun != NULL) {
-      progr_fun(number, number);
-    }
-    if (body_progr_fun != NULL) {
-      body_progr_fun(number, number, context);
-    }
+    literal_progress(number, number, progr_fun, body_progr_fun, context);
   }
   
   if (fd == NULL) {
@@ -6156,6 +6164,24 @@ static int mailimap_literal_parse_progress(mailstream * fd, MMAPString * buffer,
     }
   }
   
+  if (carena_get_current() != NULL) {
+    /* the arena keeps a copy, the string is not referenced */
+    literal_p = malloc(literal->len + 1);
+    if (literal_p == NULL) {
+      res = MAILIMAP_ERROR_MEMORY;
+      goto free_literal;
+    }
+    memcpy(literal_p, literal->str, literal->len + 1);
+    if (result_len != NULL)
+      * result_len = literal->len;
+    mmap_string_free(literal);
+    
+    * result = literal_p;
+    * indx = cur_token;
+    
+    return MAILIMAP_NO_ERROR;
+  }
+  
   if (mmap_string_ref(literal) < 0) {
     res = MAILIMAP_ERROR_MEMORY;
     goto free_literal;
@@ -7504,6 +7530,8 @@ mailimap_message_data_parse_progress(mailstream * fd, MMAPString * buffer,
   int type;
   struct mailimap_msg_att * msg_att;
   struct mailimap_message_data * msg_data;
+  carena * arena;
+  carena * old_arena;
   int r;
   int res;
 
@@ -7559,8 +7587,20 @@ mailimap_message_data_parse_progress(mailstream * fd, MMAPString * buffer,
       goto err;
     }
 
+    /*
+      the message attributes are allocated from the deferred arena when
+      they are returned to the caller, see mailimap_set_fetch_arena()
+    */
+    arena = NULL;
+    if (msg_att_handler == NULL)
+      arena = carena_get_deferred();
+    old_arena = NULL;
+    if (arena != NULL)
+      old_arena = carena_set_current(arena);
     r = mailimap_msg_att_parse_progress(fd, buffer, &cur_token, &msg_att,
 			       progr_rate, progr_fun, body_progr_fun, items_progr_fun, context, msg_att_handler, msg_att_context);
+    if (arena != NULL)
+      carena_set_current(old_arena);
     if (r != MAILIMAP_NO_ERROR) {
       res = r;
       goto err;
@@ -7708,6 +7748,584 @@ mailimap_msg_att_item_parse(mailstream * fd, MMAPString * buffer,
   
 }
 
+/*
+  Fast path for the message attributes that are returned in bulk when
+  synchronizing a folder : UID, FLAGS, RFC822.SIZE, INTERNALDATE and
+  MODSEQ.
+  The attributes are scanned directly in the buffer, without trying
+  every alternative of the grammar. MAILIMAP_ERROR_PARSE is returned
+  on anything unusual (other attributes, literals, quoted flags, extra
+  spaces, attribute list not complete in the buffer) and the general
+  parser is then used from the same position.
+*/
+
+static int mailimap_fast_number_parse(MMAPString * buffer, size_t * indx,
+                                      unsigned int max_digits,
+                                      uint64_t * result)
+{
+  size_t cur_token;
+  uint64_t number;
+  unsigned int count;
+  char ch;
+
+  cur_token = * indx;
+  number = 0;
+  count = 0;
+
+  while (1) {
+    ch = buffer->str[cur_token];
+    if ((ch < '0') || (ch > '9'))
+      break;
+    if (count >= max_digits)
+      return MAILIMAP_ERROR_PARSE;
+    number = number * 10 + (ch - '0');
+    count ++;
+    cur_token ++;
+  }
+
+  if (count == 0)
+    return MAILIMAP_ERROR_PARSE;
+
+  * indx = cur_token;
+  * result = number;
+
+  return MAILIMAP_NO_ERROR;
+}
+
+static int mailimap_fast_uint32_parse(MMAPString * buffer, size_t * indx,
+                                      uint32_t * result)
+{
+  uint64_t number;
+  int r;
+
+  r = mailimap_fast_number_parse(buffer, indx, 10, &number);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  if (number > 0xffffffffU)
+    return MAILIMAP_ERROR_PARSE;
+
+  * result = (uint32_t) number;
+
+  return MAILIMAP_NO_ERROR;
+}
+
+static int mailimap_fast_fixed_number_parse(MMAPString * buffer,
+                                            size_t * indx,
+                                            unsigned int digits, int * result)
+{
+  size_t cur_token;
+  unsigned int i;
+  int number;
+  char ch;
+
+  cur_token = * indx;
+  number = 0;
+
+  for(i = 0 ; i < digits ; i ++) {
+    ch = buffer->str[cur_token];
+    if ((ch < '0') || (ch > '9'))
+      return MAILIMAP_ERROR_PARSE;
+    number = number * 10 + (ch - '0');
+    cur_token ++;
+  }
+
+  * indx = cur_token;
+  * result = number;
+
+  return MAILIMAP_NO_ERROR;
+}
+
+static int mailimap_fast_token_parse(MMAPString * buffer, size_t * indx,
+                                     const char * token, size_t len)
+{
+  if (strncasecmp(buffer->str + * indx, token, len) != 0)
+    return MAILIMAP_ERROR_PARSE;
+
+  * indx += len;
+
+  return MAILIMAP_NO_ERROR;
+}
+
+static int mailimap_fast_string_dup(MMAPString * buffer, size_t begin,
+                                    size_t end, char ** result)
+{
+  char * str;
+
+  str = malloc(end - begin + 1);
+  if (str == NULL)
+    return MAILIMAP_ERROR_MEMORY;
+
+  memcpy(str, buffer->str + begin, end - begin);
+  str[end - begin] = '\0';
+
+  * result = str;
+
+  return MAILIMAP_NO_ERROR;
+}
+
+/* "dd-Mon-yyyy hh:mm:ss +zzzz" with the quotes */
+
+static int mailimap_fast_date_time_parse(MMAPString * buffer, size_t * indx,
+                                         struct mailimap_date_time ** result)
+{
+  size_t cur_token;
+  int day;
+  int month;
+  int year;
+  int hour;
+  int min;
+  int sec;
+  int zone;
+  int sign;
+  struct mailimap_date_time * date_time;
+  int r;
+
+  cur_token = * indx;
+
+  if (buffer->str[cur_token] != '"')
+    return MAILIMAP_ERROR_PARSE;
+  cur_token ++;
+
+  if (buffer->str[cur_token] == ' ')
+    cur_token ++;
+  r = mailimap_fast_fixed_number_parse(buffer, &cur_token, 1, &day);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+  if ((buffer->str[cur_token] >= '0') && (buffer->str[cur_token] <= '9')) {
+    day = day * 10 + (buffer->str[cur_token] - '0');
+    cur_token ++;
+  }
+
+  if (buffer->str[cur_token] != '-')
+    return MAILIMAP_ERROR_PARSE;
+  cur_token ++;
+
+  if (buffer->str[cur_token] == ' ')
+    return MAILIMAP_ERROR_PARSE;
+  month = mailimap_month_get_token_value(NULL, buffer, &cur_token);
+  if (month == -1)
+    return MAILIMAP_ERROR_PARSE;
+
+  if (buffer->str[cur_token] != '-')
+    return MAILIMAP_ERROR_PARSE;
+  cur_token ++;
+
+  r = mailimap_fast_fixed_number_parse(buffer, &cur_token, 4, &year);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  if (buffer->str[cur_token] != ' ')
+    return MAILIMAP_ERROR_PARSE;
+  cur_token ++;
+
+  r = mailimap_fast_fixed_number_parse(buffer, &cur_token, 2, &hour);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+  if (buffer->str[cur_token] != ':')
+    return MAILIMAP_ERROR_PARSE;
+  cur_token ++;
+  r = mailimap_fast_fixed_number_parse(buffer, &cur_token, 2, &min);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+  if (buffer->str[cur_token] != ':')
+    return MAILIMAP_ERROR_PARSE;
+  cur_token ++;
+  r = mailimap_fast_fixed_number_parse(buffer, &cur_token, 2, &sec);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  if (buffer->str[cur_token] != ' ')
+    return MAILIMAP_ERROR_PARSE;
+  cur_token ++;
+
+  if (buffer->str[cur_token] == '+')
+    sign = 1;
+  else if (buffer->str[cur_token] == '-')
+    sign = -1;
+  else
+    return MAILIMAP_ERROR_PARSE;
+  cur_token ++;
+  r = mailimap_fast_fixed_number_parse(buffer, &cur_token, 4, &zone);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  if (buffer->str[cur_token] != '"')
+    return MAILIMAP_ERROR_PARSE;
+  cur_token ++;
+
+  date_time = mailimap_date_time_new(day, month, year, hour, min, sec,
+      sign * zone);
+  if (date_time == NULL)
+    return MAILIMAP_ERROR_MEMORY;
+
+  * indx = cur_token;
+  * result = date_time;
+
+  return MAILIMAP_NO_ERROR;
+}
+
+struct mailimap_fast_flag {
+  const char * name;
+  size_t len;
+  int type;
+};
+
+static struct mailimap_fast_flag mailimap_fast_flag_tab[] = {
+  {"Seen",     4, MAILIMAP_FLAG_SEEN},
+  {"Answered", 8, MAILIMAP_FLAG_ANSWERED},
+  {"Flagged",  7, MAILIMAP_FLAG_FLAGGED},
+  {"Deleted",  7, MAILIMAP_FLAG_DELETED},
+  {"Draft",    5, MAILIMAP_FLAG_DRAFT},
+};
+
+static int mailimap_fast_flag_fetch_parse(MMAPString * buffer, size_t * indx,
+                                          struct mailimap_flag_fetch ** result)
+{
+  size_t cur_token;
+  size_t begin;
+  size_t len;
+  struct mailimap_flag * flag;
+  struct mailimap_flag_fetch * flag_fetch;
+  char * keyword;
+  char * extension;
+  int type;
+  unsigned int i;
+  int r;
+
+  cur_token = * indx;
+  keyword = NULL;
+  extension = NULL;
+
+  if (buffer->str[cur_token] == '\\') {
+    cur_token ++;
+    begin = cur_token;
+    while (is_atom_char(buffer->str[cur_token]))
+      cur_token ++;
+    len = cur_token - begin;
+    if (len == 0)
+      return MAILIMAP_ERROR_PARSE;
+
+    if ((len == 6) &&
+        (strncasecmp(buffer->str + begin, "Recent", 6) == 0)) {
+      flag_fetch = mailimap_flag_fetch_new(MAILIMAP_FLAG_FETCH_RECENT, NULL);
+      if (flag_fetch == NULL)
+        return MAILIMAP_ERROR_MEMORY;
+      goto done;
+    }
+
+    type = MAILIMAP_FLAG_EXTENSION;
+    for(i = 0 ; i < sizeof(mailimap_fast_flag_tab) /
+          sizeof(mailimap_fast_flag_tab[0]) ; i ++) {
+      if ((len == mailimap_fast_flag_tab[i].len) &&
+          (strncasecmp(buffer->str + begin, mailimap_fast_flag_tab[i].name,
+                       len) == 0)) {
+        type = mailimap_fast_flag_tab[i].type;
+        break;
+      }
+    }
+
+    if (type == MAILIMAP_FLAG_EXTENSION) {
+      r = mailimap_fast_string_dup(buffer, begin, cur_token, &extension);
+      if (r != MAILIMAP_NO_ERROR)
+        return r;
+    }
+  }
+  else {
+    begin = cur_token;
+    while (is_astring_char(buffer->str[cur_token]))
+      cur_token ++;
+    if (cur_token == begin)
+      return MAILIMAP_ERROR_PARSE;
+
+    type = MAILIMAP_FLAG_KEYWORD;
+    r = mailimap_fast_string_dup(buffer, begin, cur_token, &keyword);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+  }
+
+  flag = mailimap_flag_new(type, keyword, extension);
+  if (flag == NULL) {
+    free(keyword);
+    free(extension);
+    return MAILIMAP_ERROR_MEMORY;
+  }
+
+  flag_fetch = mailimap_flag_fetch_new(MAILIMAP_FLAG_FETCH_OTHER, flag);
+  if (flag_fetch == NULL) {
+    mailimap_flag_free(flag);
+    return MAILIMAP_ERROR_MEMORY;
+  }
+
+ done:
+  * indx = cur_token;
+  * result = flag_fetch;
+
+  return MAILIMAP_NO_ERROR;
+}
+
+static int mailimap_fast_flags_parse(MMAPString * buffer, size_t * indx,
+                                     struct mailimap_msg_att_dynamic ** result)
+{
+  size_t cur_token;
+  clist * list;
+  struct mailimap_flag_fetch * flag_fetch;
+  struct mailimap_msg_att_dynamic * msg_att_dyn;
+  int r;
+  int res;
+
+  cur_token = * indx;
+  list = NULL;
+
+  if (buffer->str[cur_token] != ')') {
+    list = clist_new();
+    if (list == NULL) {
+      res = MAILIMAP_ERROR_MEMORY;
+      goto err;
+    }
+
+    while (1) {
+      r = mailimap_fast_flag_fetch_parse(buffer, &cur_token, &flag_fetch);
+      if (r != MAILIMAP_NO_ERROR) {
+        res = r;
+        goto free;
+      }
+
+      r = clist_append(list, flag_fetch);
+      if (r < 0) {
+        mailimap_flag_fetch_free(flag_fetch);
+        res = MAILIMAP_ERROR_MEMORY;
+        goto free;
+      }
+
+      if (buffer->str[cur_token] != ' ')
+        break;
+      cur_token ++;
+    }
+
+    if (buffer->str[cur_token] != ')') {
+      res = MAILIMAP_ERROR_PARSE;
+      goto free;
+    }
+  }
+  cur_token ++;
+
+  msg_att_dyn = mailimap_msg_att_dynamic_new(list);
+  if (msg_att_dyn == NULL) {
+    res = MAILIMAP_ERROR_MEMORY;
+    goto free;
+  }
+
+  * indx = cur_token;
+  * result = msg_att_dyn;
+
+  return MAILIMAP_NO_ERROR;
+
+ free:
+  if (list != NULL) {
+    clist_foreach(list, (clist_func) mailimap_flag_fetch_free, NULL);
+    clist_free(list);
+  }
+ err:
+  return res;
+}
+
+static int
+mailimap_msg_att_fast_item_parse(MMAPString * buffer, size_t * indx,
+                                 struct mailimap_msg_att_item ** result)
+{
+  size_t cur_token;
+  struct mailimap_msg_att_dynamic * msg_att_dynamic;
+  struct mailimap_msg_att_static * msg_att_static;
+  struct mailimap_extension_data * msg_att_extension;
+  struct mailimap_condstore_fetch_mod_resp * fetch_data;
+  struct mailimap_date_time * internal_date;
+  struct mailimap_msg_att_item * item;
+  uint32_t number;
+  uint64_t modseq;
+  int type;
+  int r;
+  int res;
+
+  cur_token = * indx;
+  msg_att_dynamic = NULL;
+  msg_att_static = NULL;
+  msg_att_extension = NULL;
+
+  switch (buffer->str[cur_token]) {
+  case 'U':
+  case 'u':
+    r = mailimap_fast_token_parse(buffer, &cur_token, "UID ", 4);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+    r = mailimap_fast_uint32_parse(buffer, &cur_token, &number);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+    msg_att_static = mailimap_msg_att_static_new(MAILIMAP_MSG_ATT_UID,
+        NULL, NULL, NULL, NULL, NULL, 0, 0, NULL, NULL, NULL, number);
+    if (msg_att_static == NULL)
+      return MAILIMAP_ERROR_MEMORY;
+    type = MAILIMAP_MSG_ATT_ITEM_STATIC;
+    break;
+
+  case 'R':
+  case 'r':
+    r = mailimap_fast_token_parse(buffer, &cur_token, "RFC822.SIZE ", 12);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+    r = mailimap_fast_uint32_parse(buffer, &cur_token, &number);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+    msg_att_static = mailimap_msg_att_static_new(MAILIMAP_MSG_ATT_RFC822_SIZE,
+        NULL, NULL, NULL, NULL, NULL, 0, number, NULL, NULL, NULL, 0);
+    if (msg_att_static == NULL)
+      return MAILIMAP_ERROR_MEMORY;
+    type = MAILIMAP_MSG_ATT_ITEM_STATIC;
+    break;
+
+  case 'I':
+  case 'i':
+    r = mailimap_fast_token_parse(buffer, &cur_token, "INTERNALDATE ", 13);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+    r = mailimap_fast_date_time_parse(buffer, &cur_token, &internal_date);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+    msg_att_static = mailimap_msg_att_static_new(MAILIMAP_MSG_ATT_INTERNALDATE,
+        NULL, internal_date, NULL, NULL, NULL, 0, 0, NULL, NULL, NULL, 0);
+    if (msg_att_static == NULL) {
+      mailimap_date_time_free(internal_date);
+      return MAILIMAP_ERROR_MEMORY;
+    }
+    type = MAILIMAP_MSG_ATT_ITEM_STATIC;
+    break;
+
+  case 'F':
+  case 'f':
+    r = mailimap_fast_token_parse(buffer, &cur_token, "FLAGS (", 7);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+    r = mailimap_fast_flags_parse(buffer, &cur_token, &msg_att_dynamic);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+    type = MAILIMAP_MSG_ATT_ITEM_DYNAMIC;
+    break;
+
+  case 'M':
+  case 'm':
+    r = mailimap_fast_token_parse(buffer, &cur_token, "MODSEQ (", 8);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+    r = mailimap_fast_number_parse(buffer, &cur_token, 19, &modseq);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+    if (buffer->str[cur_token] != ')')
+      return MAILIMAP_ERROR_PARSE;
+    cur_token ++;
+    fetch_data = mailimap_condstore_fetch_mod_resp_new(modseq);
+    if (fetch_data == NULL)
+      return MAILIMAP_ERROR_MEMORY;
+    msg_att_extension =
+      mailimap_extension_data_new(&mailimap_extension_condstore,
+          MAILIMAP_CONDSTORE_TYPE_FETCH_DATA, fetch_data);
+    if (msg_att_extension == NULL) {
+      mailimap_condstore_fetch_mod_resp_free(fetch_data);
+      return MAILIMAP_ERROR_MEMORY;
+    }
+    type = MAILIMAP_MSG_ATT_ITEM_EXTENSION;
+    break;
+
+  default:
+    return MAILIMAP_ERROR_PARSE;
+  }
+
+  item = mailimap_msg_att_item_new(type, msg_att_dynamic, msg_att_static,
+      msg_att_extension);
+  if (item == NULL) {
+    res = MAILIMAP_ERROR_MEMORY;
+    goto free;
+  }
+
+  * indx = cur_token;
+  * result = item;
+
+  return MAILIMAP_NO_ERROR;
+
+ free:
+  if (msg_att_extension != NULL)
+    mailimap_extension_data_free(msg_att_extension);
+  if (msg_att_dynamic != NULL)
+    mailimap_msg_att_dynamic_free(msg_att_dynamic);
+  if (msg_att_static != NULL)
+    mailimap_msg_att_static_free(msg_att_static);
+  return res;
+}
+
+static int mailimap_msg_att_fast_parse(MMAPString * buffer, size_t * indx,
+                                       struct mailimap_msg_att ** result)
+{
+  size_t cur_token;
+  clist * list;
+  struct mailimap_msg_att_item * item;
+  struct mailimap_msg_att * msg_att;
+  int r;
+  int res;
+
+  cur_token = * indx;
+
+  if (buffer->str[cur_token] != '(')
+    return MAILIMAP_ERROR_PARSE;
+  cur_token ++;
+
+  list = clist_new();
+  if (list == NULL) {
+    res = MAILIMAP_ERROR_MEMORY;
+    goto err;
+  }
+
+  while (1) {
+    r = mailimap_msg_att_fast_item_parse(buffer, &cur_token, &item);
+    if (r != MAILIMAP_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+
+    r = clist_append(list, item);
+    if (r < 0) {
+      mailimap_msg_att_item_free(item);
+      res = MAILIMAP_ERROR_MEMORY;
+      goto free;
+    }
+
+    if (buffer->str[cur_token] != ' ')
+      break;
+    cur_token ++;
+  }
+
+  if (buffer->str[cur_token] != ')') {
+    res = MAILIMAP_ERROR_PARSE;
+    goto free;
+  }
+  cur_token ++;
+
+  msg_att = mailimap_msg_att_new(list);
+  if (msg_att == NULL) {
+    res = MAILIMAP_ERROR_MEMORY;
+    goto free;
+  }
+
+  * indx = cur_token;
+  * result = msg_att;
+
+  return MAILIMAP_NO_ERROR;
+
+ free:
+  clist_foreach(list, (clist_func) mailimap_msg_att_item_free, NULL);
+  clist_free(list);
+ err:
+  return res;
+}
+
 /*
    msg-att         = "(" (msg-att-dynamic / msg-att-static)
                       *(SP (msg-att-dynamic / msg-att-static)) ")"
@@ -7733,6 +8351,17 @@ mailimap_msg_att_parse_progress(mailstream * fd, MMAPString * buffer,
   cur_token = * indx;
   list = NULL;
 
+  r = mailimap_msg_att_fast_parse(buffer, &cur_token, &msg_att);
+  if (r == MAILIMAP_NO_ERROR) {
+    * indx = cur_token;
+    * result = msg_att;
+    return MAILIMAP_NO_ERROR;
+  }
+  if (r != MAILIMAP_ERROR_PARSE) {
+    res = r;
+    goto err;
+  }
+
   r = mailimap_oparenth_parse(fd, buffer, &cur_token);
   if (r != MAILIMAP_NO_ERROR) {
     res = r;
@@ -8813,6 +9442,23 @@ mailimap_quoted_parse(mailstream * fd, MMAPString * buffer,
     goto free;
   }
 
+  if (carena_get_current() != NULL) {
+    char * quoted;
+    
+    /* the arena keeps a copy, the string is not referenced */
+    quoted = strdup(gstr_quoted->str);
+    if (quoted == NULL) {
+      res = MAILIMAP_ERROR_MEMORY;
+      goto free;
+    }
+    mmap_string_free(gstr_quoted);
+    
+    * indx = cur_token;
+    * result = quoted;
+    
+    return MAILIMAP_NO_ERROR;
+  }
+  
   if (mmap_string_ref(gstr_quoted) < 0) {
     res = MAILIMAP_ERROR_MEMORY;
     goto free;
@@ -45,6 +45,8 @@
 #include <stdio.h>
 #include <stdbool.h>
 
+#include "carena_wrappers.h"
+
 
 struct mailimap_sort_key *
 mailimap_sort_key_new(int sortk_type,
@@ -94,7 +94,7 @@ int mailimap_ssl_connect_voip_with_callback(mailimap * f, const char * server, u
   if (s == -1)
     return MAILIMAP_ERROR_CONNECTION_REFUSED;
 
-  stream = mailstream_ssl_open_with_callback_timeout(s, f->imap_timeout, callback, data);
+  stream = mailstream_ssl_open_with_host(s, server, port, f->imap_timeout, callback, data);
   if (stream == NULL) {
 #ifdef WIN32
 	closesocket(s);
@@ -0,0 +1,461 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2013 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "mailimap_thread.h"
+
+#include <stdlib.h>
+
+#include "mailimap.h"
+#include "mailimap_extension.h"
+#include "mailimap_extension_types.h"
+#include "mailimap_sender.h"
+#include "mailimap_parser.h"
+#include "mailimap_keywords.h"
+
+#include "carena_wrappers.h"
+
+enum {
+  MAILIMAP_THREAD_TYPE_THREAD
+};
+
+static int
+mailimap_thread_extension_parse(int calling_parser, mailstream * fd,
+    MMAPString * buffer, size_t * indx,
+    struct mailimap_extension_data ** result,
+    size_t progr_rate, progress_function * progr_fun);
+
+static void
+mailimap_thread_extension_data_free(struct mailimap_extension_data * ext_data);
+
+LIBETPAN_EXPORT
+struct mailimap_extension_api mailimap_extension_thread = {
+  /* name */          "THREAD",
+  /* extension_id */  MAILIMAP_EXTENSION_THREAD,
+  /* parser */        mailimap_thread_extension_parse,
+  /* free */          mailimap_thread_extension_data_free
+};
+
+static const char * algorithm_name(int algorithm)
+{
+  switch (algorithm) {
+  case MAILIMAP_THREAD_ORDEREDSUBJECT:
+    return "ORDEREDSUBJECT";
+  case MAILIMAP_THREAD_REFERENCES:
+    return "REFERENCES";
+  case MAILIMAP_THREAD_REFS:
+    return "REFS";
+  default:
+    return NULL;
+  }
+}
+
+/*
+  thread = ["UID" SP] "THREAD" SP thread-alg SP search-criteria
+  search-criteria = charset 1*(SP search-key)
+*/
+
+static int mailimap_thread_send(mailstream * fd, int uid, int algorithm,
+    const char * charset, struct mailimap_search_key * key)
+{
+  int r;
+
+  if (uid) {
+    r = mailimap_token_send(fd, "UID");
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+    r = mailimap_space_send(fd);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+  }
+
+  r = mailimap_token_send(fd, "THREAD");
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+  r = mailimap_space_send(fd);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+  r = mailimap_token_send(fd, algorithm_name(algorithm));
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  /* the charset is required by THREAD */
+  if (charset == NULL)
+    charset = "UTF-8";
+  r = mailimap_space_send(fd);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+  r = mailimap_astring_send(fd, charset);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  r = mailimap_space_send(fd);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+  if (key != NULL)
+    r = mailimap_search_key_send(fd, key);
+  else
+    r = mailimap_token_send(fd, "ALL");
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  return MAILIMAP_NO_ERROR;
+}
+
+static int mailimap_thread_generic(mailimap * session, int uid,
+    int algorithm, const char * charset,
+    struct mailimap_search_key * key, clist ** result)
+{
+  struct mailimap_response * response;
+  int r;
+  int error_code;
+  clist * thread_result;
+  clistiter * cur;
+
+  if (session->imap_state != MAILIMAP_STATE_SELECTED)
+    return MAILIMAP_ERROR_BAD_STATE;
+
+  if (algorithm_name(algorithm) == NULL)
+    return MAILIMAP_ERROR_INVAL;
+
+  r = mailimap_send_current_tag(session);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  r = mailimap_thread_send(session->imap_stream, uid, algorithm,
+      charset, key);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  r = mailimap_crlf_send(session->imap_stream);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  if (mailstream_flush(session->imap_stream) == -1)
+    return MAILIMAP_ERROR_STREAM;
+
+  if (mailimap_read_line(session) == NULL)
+    return MAILIMAP_ERROR_STREAM;
+
+  r = mailimap_parse_response(session, &response);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  thread_result = NULL;
+  for (cur = clist_begin(session->imap_response_info->rsp_extension_list);
+       cur != NULL; cur = clist_next(cur)) {
+    struct mailimap_extension_data * ext_data;
+
+    ext_data = (struct mailimap_extension_data *) clist_content(cur);
+    if (ext_data->ext_extension->ext_id == MAILIMAP_EXTENSION_THREAD) {
+      if (thread_result == NULL) {
+        thread_result = ext_data->ext_data;
+        ext_data->ext_data = NULL;
+        ext_data->ext_type = -1;
+      }
+    }
+  }
+
+  clist_foreach(session->imap_response_info->rsp_extension_list,
+      (clist_func) mailimap_extension_data_free, NULL);
+  clist_free(session->imap_response_info->rsp_extension_list);
+  session->imap_response_info->rsp_extension_list = NULL;
+
+  error_code = response->rsp_resp_done->rsp_data.rsp_tagged->rsp_cond_state->rsp_type;
+  mailimap_response_free(response);
+
+  if (error_code != MAILIMAP_RESP_COND_STATE_OK) {
+    if (thread_result != NULL)
+      mailimap_thread_result_free(thread_result);
+    return MAILIMAP_ERROR_EXTENSION;
+  }
+
+  if (thread_result == NULL) {
+    /* the untagged response may be missing when no message matches */
+    thread_result = clist_new();
+    if (thread_result == NULL)
+      return MAILIMAP_ERROR_MEMORY;
+  }
+
+  * result = thread_result;
+
+  return MAILIMAP_NO_ERROR;
+}
+
+LIBETPAN_EXPORT
+int mailimap_thread(mailimap * session, int algorithm, const char * charset,
+    struct mailimap_search_key * key, clist ** result)
+{
+  return mailimap_thread_generic(session, 0, algorithm, charset, key, result);
+}
+
+LIBETPAN_EXPORT
+int mailimap_uid_thread(mailimap * session, int algorithm, const char * charset,
+    struct mailimap_search_key * key, clist ** result)
+{
+  return mailimap_thread_generic(session, 1, algorithm, charset, key, result);
+}
+
+LIBETPAN_EXPORT
+void mailimap_thread_result_free(clist * thread_result)
+{
+  clist_foreach(thread_result, (clist_func) mailimap_thread_node_free, NULL);
+  clist_free(thread_result);
+}
+
+LIBETPAN_EXPORT
+int mailimap_has_thread(mailimap * session, int algorithm)
+{
+  switch (algorithm) {
+  case MAILIMAP_THREAD_ORDEREDSUBJECT:
+    return mailimap_has_extension(session, "THREAD=ORDEREDSUBJECT");
+  case MAILIMAP_THREAD_REFERENCES:
+    return mailimap_has_extension(session, "THREAD=REFERENCES");
+  case MAILIMAP_THREAD_REFS:
+    return mailimap_has_extension(session, "THREAD=REFS");
+  default:
+    return 0;
+  }
+}
+
+/*
+  thread-list     = "(" (thread-members / thread-nested) ")"
+  thread-members  = nz-number *(SP nz-number) [SP thread-nested]
+  thread-nested   = 2*thread-list
+
+  The members are a chain where each message is the reply of the
+  previous one, the nested lists are the replies of the last member
+  or, when there is no member, of a missing message.
+  Spaces between the nested lists are accepted.
+*/
+
+static int mailimap_thread_list_parse(mailstream * fd, MMAPString * buffer,
+    size_t * indx, struct mailimap_thread_node ** result)
+{
+  size_t cur_token;
+  struct mailimap_thread_node * first;
+  struct mailimap_thread_node * last;
+  struct mailimap_thread_node * node;
+  clist * children;
+  uint32_t number;
+  int r;
+  int res;
+
+  cur_token = * indx;
+
+  r = mailimap_oparenth_parse(fd, buffer, &cur_token);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  first = NULL;
+  last = NULL;
+  while (1) {
+    r = mailimap_nz_number_parse(fd, buffer, &cur_token, &number);
+    if (r == MAILIMAP_ERROR_PARSE)
+      break;
+    if (r != MAILIMAP_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+
+    children = clist_new();
+    if (children == NULL) {
+      res = MAILIMAP_ERROR_MEMORY;
+      goto free;
+    }
+    node = mailimap_thread_node_new(number, children);
+    if (node == NULL) {
+      clist_free(children);
+      res = MAILIMAP_ERROR_MEMORY;
+      goto free;
+    }
+    if (last == NULL) {
+      first = node;
+    }
+    else if (clist_append(last->thr_children, node) < 0) {
+      mailimap_thread_node_free(node);
+      res = MAILIMAP_ERROR_MEMORY;
+      goto free;
+    }
+    last = node;
+
+    mailimap_space_parse(fd, buffer, &cur_token);
+  }
+
+  if (first == NULL) {
+    children = clist_new();
+    if (children == NULL) {
+      res = MAILIMAP_ERROR_MEMORY;
+      goto free;
+    }
+    first = mailimap_thread_node_new(0, children);
+    if (first == NULL) {
+      clist_free(children);
+      res = MAILIMAP_ERROR_MEMORY;
+      goto free;
+    }
+    last = first;
+  }
+
+  while (1) {
+    r = mailimap_thread_list_parse(fd, buffer, &cur_token, &node);
+    if (r == MAILIMAP_ERROR_PARSE)
+      break;
+    if (r != MAILIMAP_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+
+    if (clist_append(last->thr_children, node) < 0) {
+      mailimap_thread_node_free(node);
+      res = MAILIMAP_ERROR_MEMORY;
+      goto free;
+    }
+
+    mailimap_space_parse(fd, buffer, &cur_token);
+  }
+
+  r = mailimap_cparenth_parse(fd, buffer, &cur_token);
+  if (r != MAILIMAP_NO_ERROR) {
+    res = r;
+    goto free;
+  }
+
+  * indx = cur_token;
+  * result = first;
+
+  return MAILIMAP_NO_ERROR;
+
+ free:
+  if (first != NULL)
+    mailimap_thread_node_free(first);
+  return res;
+}
+
+/*
+  thread-data = "THREAD" [SP 1*thread-list]
+*/
+
+static int mailimap_thread_data_parse(mailstream * fd, MMAPString * buffer,
+    size_t * indx, clist ** result)
+{
+  size_t cur_token;
+  clist * thread_list;
+  struct mailimap_thread_node * node;
+  int r;
+  int res;
+
+  cur_token = * indx;
+
+  r = mailimap_token_case_insensitive_parse(fd, buffer, &cur_token, "THREAD");
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  thread_list = clist_new();
+  if (thread_list == NULL)
+    return MAILIMAP_ERROR_MEMORY;
+
+  mailimap_space_parse(fd, buffer, &cur_token);
+  while (1) {
+    r = mailimap_thread_list_parse(fd, buffer, &cur_token, &node);
+    if (r == MAILIMAP_ERROR_PARSE)
+      break;
+    if (r != MAILIMAP_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+
+    if (clist_append(thread_list, node) < 0) {
+      mailimap_thread_node_free(node);
+      res = MAILIMAP_ERROR_MEMORY;
+      goto free;
+    }
+
+    mailimap_space_parse(fd, buffer, &cur_token);
+  }
+
+  * indx = cur_token;
+  * result = thread_list;
+
+  return MAILIMAP_NO_ERROR;
+
+ free:
+  mailimap_thread_result_free(thread_list);
+  return res;
+}
+
+static int
+mailimap_thread_extension_parse(int calling_parser, mailstream * fd,
+    MMAPString * buffer, size_t * indx,
+    struct mailimap_extension_data ** result,
+    size_t progr_rate, progress_function * progr_fun)
+{
+  size_t cur_token;
+  clist * thread_list;
+  struct mailimap_extension_data * ext_data;
+  int r;
+
+  cur_token = * indx;
+
+  switch (calling_parser) {
+  case MAILIMAP_EXTENDED_PARSER_RESPONSE_DATA:
+  case MAILIMAP_EXTENDED_PARSER_MAILBOX_DATA:
+    r = mailimap_thread_data_parse(fd, buffer, &cur_token, &thread_list);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+
+    ext_data = mailimap_extension_data_new(&mailimap_extension_thread,
+        MAILIMAP_THREAD_TYPE_THREAD, thread_list);
+    if (ext_data == NULL) {
+      mailimap_thread_result_free(thread_list);
+      return MAILIMAP_ERROR_MEMORY;
+    }
+
+    * result = ext_data;
+    * indx = cur_token;
+
+    return MAILIMAP_NO_ERROR;
+
+  default:
+    return MAILIMAP_ERROR_PARSE;
+  }
+}
+
+static void
+mailimap_thread_extension_data_free(struct mailimap_extension_data * ext_data)
+{
+  if (ext_data->ext_data != NULL)
+    mailimap_thread_result_free(ext_data->ext_data);
+  free(ext_data);
+}
@@ -0,0 +1,97 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2013 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef MAILIMAP_THREAD_H
+
+#define MAILIMAP_THREAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libetpan/libetpan-config.h>
+#include <libetpan/mailimap_extension.h>
+#include <libetpan/mailimap_thread_types.h>
+
+LIBETPAN_EXPORT
+extern struct mailimap_extension_api mailimap_extension_thread;
+
+/*
+  mailimap_thread()
+
+  The messages that match the given criteria are returned grouped
+  in threads by the server (RFC 5256).
+
+  @param session    IMAP session
+  @param algorithm  threading algorithm, MAILIMAP_THREAD_REFERENCES,
+    MAILIMAP_THREAD_ORDEREDSUBJECT or MAILIMAP_THREAD_REFS
+  @param charset    This indicates the charset of the strings that appears
+    in the searching criteria, "UTF-8" is used when NULL
+  @param key        This is the searching criteria, all the messages
+    are threaded when NULL
+  @param result     The result is a clist of (struct mailimap_thread_node *),
+    one for each thread, in the order given by the server,
+    and will be stored in (* result).
+
+  @return the return code is one of MAILIMAP_ERROR_XXX or
+    MAILIMAP_NO_ERROR codes
+*/
+
+LIBETPAN_EXPORT
+int mailimap_thread(mailimap * session, int algorithm, const char * charset,
+    struct mailimap_search_key * key, clist ** result);
+
+/*
+  mailimap_uid_thread()
+
+  This function is the same as mailimap_thread() except that
+  the messages are given by their unique identifiers.
+*/
+
+LIBETPAN_EXPORT
+int mailimap_uid_thread(mailimap * session, int algorithm, const char * charset,
+    struct mailimap_search_key * key, clist ** result);
+
+LIBETPAN_EXPORT
+void mailimap_thread_result_free(clist * thread_result);
+
+/*
+  return 1 if the server implements the given threading algorithm
+*/
+
+LIBETPAN_EXPORT
+int mailimap_has_thread(mailimap * session, int algorithm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
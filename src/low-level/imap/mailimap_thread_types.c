@@ -0,0 +1,79 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2013 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "mailimap_thread_types.h"
+
+#include <stdlib.h>
+
+#include "carena_wrappers.h"
+
+struct mailimap_thread_node *
+mailimap_thread_node_new(uint32_t thr_number, clist * thr_children)
+{
+  struct mailimap_thread_node * node;
+
+  node = malloc(sizeof(* node));
+  if (node == NULL)
+    return NULL;
+
+  node->thr_number = thr_number;
+  node->thr_children = thr_children;
+
+  return node;
+}
+
+void mailimap_thread_node_free(struct mailimap_thread_node * node)
+{
+  /* long chains of replies are released without recursion */
+  while (node != NULL) {
+    struct mailimap_thread_node * next;
+    clistiter * cur;
+
+    next = NULL;
+    if (clist_count(node->thr_children) == 1) {
+      next = clist_content(clist_begin(node->thr_children));
+    }
+    else {
+      for(cur = clist_begin(node->thr_children) ; cur != NULL ;
+          cur = clist_next(cur)) {
+        mailimap_thread_node_free(clist_content(cur));
+      }
+    }
+    clist_free(node->thr_children);
+    free(node);
+
+    node = next;
+  }
+}
@@ -0,0 +1,78 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2013 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef MAILIMAP_THREAD_TYPES_H
+
+#define MAILIMAP_THREAD_TYPES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libetpan/mailimap_types.h>
+
+/* threading algorithms of the THREAD command (RFC 5256, RFC 5957) */
+
+enum {
+  MAILIMAP_THREAD_ORDEREDSUBJECT,
+  MAILIMAP_THREAD_REFERENCES,
+  MAILIMAP_THREAD_REFS
+};
+
+/*
+  mailimap_thread_node is a message in the result of THREAD
+
+  - thr_number is the number (or the unique identifier) of the message,
+    0 when the message is missing and only joins its children,
+    for example the first node of "((3)(5))".
+
+  - thr_children is the list of the replies to the message,
+    (struct mailimap_thread_node *). For "(3 6 (4 23)(44 7 96))",
+    3 has the child 6, which has the children 4 and 44.
+*/
+
+struct mailimap_thread_node {
+  uint32_t thr_number;
+  clist * thr_children; /* list of (struct mailimap_thread_node *) */
+};
+
+LIBETPAN_EXPORT
+struct mailimap_thread_node *
+mailimap_thread_node_new(uint32_t thr_number, clist * thr_children);
+
+LIBETPAN_EXPORT
+void mailimap_thread_node_free(struct mailimap_thread_node * node);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
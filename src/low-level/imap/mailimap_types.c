@@ -46,6 +46,8 @@
 #include <stdio.h>
 #include <stdbool.h>
 
+#include "carena_wrappers.h"
+
 /* ************************************************************************* */
 /* ************************************************************************* */
 /* ************************************************************************* */
@@ -3343,6 +3343,9 @@ typedef void mailimap_msg_att_handler(struct mailimap_msg_att * msg_att, void *
 
 typedef struct mailimap mailimap;
 
+/* see carena.h */
+struct carena_s;
+
 struct mailimap {
   char * imap_response;
   
@@ -3387,6 +3390,8 @@ struct mailimap {
   void * imap_logger_context;
   
   int is_163_workaround_enabled;
+  
+  struct carena_s * imap_fetch_arena;
 };
 
 
@@ -42,6 +42,8 @@
 
 #include <stdlib.h>
 
+#include "carena_wrappers.h"
+
 /* ************************************************************************* */
 /* ************************************************************************* */
 /* ************************************************************************* */
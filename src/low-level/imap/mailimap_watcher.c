@@ -0,0 +1,755 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2005 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "mailimap_watcher.h"
+
+#ifdef WIN32
+#	include <win_etpan.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+
+#include "mailimap.h"
+#include "mailimap_parser.h"
+#include "idle.h"
+#include "notify.h"
+#include "mailstream_cancel.h"
+#include "syscall_wrappers.h"
+
+struct watched_session {
+  mailimap * session;
+  char * mailbox;
+  /* NOTIFY is set on the session */
+  int notify;
+  int idling;
+  time_t idle_date;
+  /* number of messages of the selected mailbox */
+  uint32_t exists;
+  /* the session failed and is no more watched */
+  int error;
+};
+
+struct watcher_fd {
+  int fd;
+  struct watched_session * session;
+  int ready;
+};
+
+struct mailimap_watcher {
+  mailimap_watcher_callback * callback;
+  void * context;
+  time_t renew_delay;
+  carray * sessions; /* array of (struct watched_session *) */
+  struct mailstream_cancel * interrupt;
+  /* descriptors of the sessions and of the interruption */
+  struct watcher_fd * fds;
+#ifndef WIN32
+  struct pollfd * pollfds;
+#endif
+  unsigned int fds_size;
+};
+
+LIBETPAN_EXPORT
+struct mailimap_watcher *
+mailimap_watcher_new(mailimap_watcher_callback * callback, void * context)
+{
+  struct mailimap_watcher * watcher;
+
+  watcher = malloc(sizeof(* watcher));
+  if (watcher == NULL)
+    goto err;
+
+  watcher->callback = callback;
+  watcher->context = context;
+  watcher->renew_delay = MAILIMAP_WATCHER_DEFAULT_RENEW_DELAY;
+  watcher->fds = NULL;
+#ifndef WIN32
+  watcher->pollfds = NULL;
+#endif
+  watcher->fds_size = 0;
+
+  watcher->sessions = carray_new(4);
+  if (watcher->sessions == NULL)
+    goto free;
+
+  watcher->interrupt = mailstream_cancel_new();
+  if (watcher->interrupt == NULL)
+    goto free_sessions;
+
+  return watcher;
+
+ free_sessions:
+  carray_free(watcher->sessions);
+ free:
+  free(watcher);
+ err:
+  return NULL;
+}
+
+static int watched_session_stop(struct mailimap_watcher * watcher,
+    struct watched_session * ws);
+
+static void watched_session_free(struct watched_session * ws)
+{
+  free(ws->mailbox);
+  free(ws);
+}
+
+LIBETPAN_EXPORT
+void mailimap_watcher_free(struct mailimap_watcher * watcher)
+{
+  unsigned int i;
+
+  /* the last changes are not reported */
+  watcher->callback = NULL;
+  for(i = 0 ; i < carray_count(watcher->sessions) ; i ++) {
+    struct watched_session * ws;
+
+    ws = carray_get(watcher->sessions, i);
+    watched_session_stop(watcher, ws);
+    watched_session_free(ws);
+  }
+  carray_free(watcher->sessions);
+  mailstream_cancel_free(watcher->interrupt);
+#ifndef WIN32
+  free(watcher->pollfds);
+#endif
+  free(watcher->fds);
+  free(watcher);
+}
+
+LIBETPAN_EXPORT
+void mailimap_watcher_set_renew_delay(struct mailimap_watcher * watcher,
+    time_t delay)
+{
+  watcher->renew_delay = delay;
+}
+
+LIBETPAN_EXPORT
+void mailimap_watcher_interrupt(struct mailimap_watcher * watcher)
+{
+  mailstream_cancel_notify(watcher->interrupt);
+}
+
+/* events */
+
+static void watcher_notify(struct mailimap_watcher * watcher,
+    struct watched_session * ws, int type, const char * mailbox,
+    uint32_t number, struct mailimap_msg_att * msg_att,
+    struct mailimap_mailbox_data_status * status, int error)
+{
+  struct mailimap_watcher_event event;
+
+  if (watcher->callback == NULL)
+    return;
+
+  event.ev_type = type;
+  event.ev_session = ws->session;
+  event.ev_mailbox = mailbox;
+  event.ev_number = number;
+  event.ev_msg_att = msg_att;
+  event.ev_status = status;
+  event.ev_error = error;
+
+  watcher->callback(watcher, &event, watcher->context);
+}
+
+static void watched_session_fail(struct mailimap_watcher * watcher,
+    struct watched_session * ws, int error)
+{
+  ws->error = error;
+  ws->idling = 0;
+  watcher_notify(watcher, ws, MAILIMAP_WATCHER_EVENT_ERROR, ws->mailbox,
+      0, NULL, NULL, error);
+}
+
+static void watched_session_exists(struct mailimap_watcher * watcher,
+    struct watched_session * ws, uint32_t exists)
+{
+  if (exists == ws->exists)
+    return;
+
+  ws->exists = exists;
+  watcher_notify(watcher, ws, MAILIMAP_WATCHER_EVENT_EXISTS, ws->mailbox,
+      exists, NULL, NULL, MAILIMAP_NO_ERROR);
+}
+
+static void watched_session_expunge(struct mailimap_watcher * watcher,
+    struct watched_session * ws, uint32_t number)
+{
+  if (ws->exists > 0)
+    ws->exists --;
+  watcher_notify(watcher, ws, MAILIMAP_WATCHER_EVENT_EXPUNGE, ws->mailbox,
+      number, NULL, NULL, MAILIMAP_NO_ERROR);
+}
+
+/*
+  reports an untagged response received during IDLE. The selection
+  information of the session is updated the same way as for the
+  responses of the commands.
+*/
+
+static int watched_session_response_data(struct mailimap_watcher * watcher,
+    struct watched_session * ws, struct mailimap_response_data * resp_data)
+{
+  struct mailimap_selection_info * sel_info;
+  struct mailimap_mailbox_data * mb_data;
+  struct mailimap_message_data * msg_data;
+
+  sel_info = ws->session->imap_selection_info;
+
+  switch (resp_data->rsp_type) {
+  case MAILIMAP_RESP_DATA_TYPE_COND_BYE:
+    return MAILIMAP_ERROR_FATAL;
+
+  case MAILIMAP_RESP_DATA_TYPE_MAILBOX_DATA:
+    mb_data = resp_data->rsp_data.rsp_mailbox_data;
+    switch (mb_data->mbd_type) {
+    case MAILIMAP_MAILBOX_DATA_EXISTS:
+      if (sel_info != NULL) {
+        sel_info->sel_exists = mb_data->mbd_data.mbd_exists;
+        sel_info->sel_has_exists = 1;
+      }
+      watched_session_exists(watcher, ws, mb_data->mbd_data.mbd_exists);
+      break;
+
+    case MAILIMAP_MAILBOX_DATA_STATUS:
+      watcher_notify(watcher, ws, MAILIMAP_WATCHER_EVENT_STATUS,
+          mb_data->mbd_data.mbd_status->st_mailbox, 0,
+          NULL, mb_data->mbd_data.mbd_status, MAILIMAP_NO_ERROR);
+      break;
+    }
+    break;
+
+  case MAILIMAP_RESP_DATA_TYPE_MESSAGE_DATA:
+    msg_data = resp_data->rsp_data.rsp_message_data;
+    switch (msg_data->mdt_type) {
+    case MAILIMAP_MESSAGE_DATA_EXPUNGE:
+      if ((sel_info != NULL) && (sel_info->sel_exists > 0))
+        sel_info->sel_exists --;
+      watched_session_expunge(watcher, ws, msg_data->mdt_number);
+      break;
+
+    case MAILIMAP_MESSAGE_DATA_FETCH:
+      watcher_notify(watcher, ws, MAILIMAP_WATCHER_EVENT_FETCH, ws->mailbox,
+          msg_data->mdt_number, msg_data->mdt_msg_att, NULL,
+          MAILIMAP_NO_ERROR);
+      break;
+    }
+    break;
+  }
+
+  return MAILIMAP_NO_ERROR;
+}
+
+/*
+  reports the untagged responses received with the response to DONE,
+  they were stored in the session by the parser of the responses.
+*/
+
+static void watched_session_response_info(struct mailimap_watcher * watcher,
+    struct watched_session * ws)
+{
+  struct mailimap_response_info * rsp_info;
+  clistiter * cur;
+
+  rsp_info = ws->session->imap_response_info;
+  if (rsp_info == NULL)
+    return;
+
+  for(cur = clist_begin(rsp_info->rsp_expunged) ; cur != NULL ;
+      cur = clist_next(cur)) {
+    uint32_t * number;
+
+    number = clist_content(cur);
+    watched_session_expunge(watcher, ws, * number);
+  }
+
+  for(cur = clist_begin(rsp_info->rsp_fetch_list) ; cur != NULL ;
+      cur = clist_next(cur)) {
+    struct mailimap_msg_att * msg_att;
+
+    msg_att = clist_content(cur);
+    watcher_notify(watcher, ws, MAILIMAP_WATCHER_EVENT_FETCH, ws->mailbox,
+        msg_att->att_number, msg_att, NULL, MAILIMAP_NO_ERROR);
+  }
+
+  if (rsp_info->rsp_status != NULL) {
+    watcher_notify(watcher, ws, MAILIMAP_WATCHER_EVENT_STATUS,
+        rsp_info->rsp_status->st_mailbox, 0, NULL, rsp_info->rsp_status,
+        MAILIMAP_NO_ERROR);
+  }
+
+  if (ws->session->imap_selection_info != NULL)
+    watched_session_exists(watcher, ws,
+        ws->session->imap_selection_info->sel_exists);
+}
+
+/* IDLE */
+
+static int watched_session_idle(struct watched_session * ws)
+{
+  int r;
+
+  r = mailimap_idle(ws->session);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  ws->idling = 1;
+  ws->idle_date = time(NULL);
+
+  return MAILIMAP_NO_ERROR;
+}
+
+static int watched_session_idle_done(struct mailimap_watcher * watcher,
+    struct watched_session * ws)
+{
+  int r;
+
+  ws->idling = 0;
+  r = mailimap_idle_done(ws->session);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  watched_session_response_info(watcher, ws);
+
+  return MAILIMAP_NO_ERROR;
+}
+
+static int watched_session_renew(struct mailimap_watcher * watcher,
+    struct watched_session * ws)
+{
+  int r;
+
+  if (ws->idling) {
+    r = watched_session_idle_done(watcher, ws);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+  }
+
+  return watched_session_idle(ws);
+}
+
+/* ends IDLE and the notifications, the session can be used again */
+
+static int watched_session_stop(struct mailimap_watcher * watcher,
+    struct watched_session * ws)
+{
+  int r;
+
+  if (ws->error != MAILIMAP_NO_ERROR)
+    return ws->error;
+
+  if (ws->idling) {
+    r = watched_session_idle_done(watcher, ws);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+  }
+
+  if (ws->notify) {
+    ws->notify = 0;
+    r = mailimap_notify_none(ws->session);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+  }
+
+  return MAILIMAP_NO_ERROR;
+}
+
+static int watched_session_has_buffered_data(struct watched_session * ws)
+{
+  return ws->session->imap_stream->read_buffer_len > 0;
+}
+
+/* reads the responses that were received during IDLE */
+
+static int watched_session_read(struct mailimap_watcher * watcher,
+    struct watched_session * ws)
+{
+  do {
+    struct mailimap_response_data * resp_data;
+    size_t indx;
+    char * line;
+    int r;
+
+    line = mailimap_read_line(ws->session);
+    if (line == NULL)
+      return MAILIMAP_ERROR_STREAM;
+
+    if (strncmp(line, "* ", 2) != 0) {
+      /* the server ended IDLE, it will be started again */
+      ws->idling = 0;
+      return MAILIMAP_NO_ERROR;
+    }
+
+    indx = 0;
+    r = mailimap_response_data_parse(ws->session->imap_stream,
+        ws->session->imap_stream_buffer, &indx, &resp_data,
+        ws->session->imap_progr_rate, ws->session->imap_progr_fun);
+    if (r == MAILIMAP_ERROR_PARSE) {
+      /* unknown response */
+      continue;
+    }
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+
+    r = watched_session_response_data(watcher, ws, resp_data);
+    mailimap_response_data_free(resp_data);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+  } while (watched_session_has_buffered_data(ws));
+
+  return MAILIMAP_NO_ERROR;
+}
+
+static int watcher_find(struct mailimap_watcher * watcher,
+    mailimap * session)
+{
+  unsigned int i;
+
+  for(i = 0 ; i < carray_count(watcher->sessions) ; i ++) {
+    struct watched_session * ws;
+
+    ws = carray_get(watcher->sessions, i);
+    if (ws->session == session)
+      return (int) i;
+  }
+
+  return -1;
+}
+
+LIBETPAN_EXPORT
+int mailimap_watcher_add(struct mailimap_watcher * watcher,
+    mailimap * session, const char * mailbox, clist * mailboxes)
+{
+  struct watched_session * ws;
+  int with_notify;
+  int res;
+  int r;
+
+  with_notify = (mailboxes != NULL) && !clist_isempty(mailboxes);
+  if (!mailimap_has_idle(session))
+    return MAILIMAP_ERROR_EXTENSION;
+  if (with_notify && !mailimap_has_notify(session))
+    return MAILIMAP_ERROR_EXTENSION;
+  if (watcher_find(watcher, session) != -1)
+    return MAILIMAP_ERROR_INVAL;
+#ifdef WIN32
+  /* the sessions and the interruption are waited together */
+  if (carray_count(watcher->sessions) + 1 >= MAXIMUM_WAIT_OBJECTS)
+    return MAILIMAP_ERROR_INVAL;
+#endif
+
+  ws = malloc(sizeof(* ws));
+  if (ws == NULL) {
+    res = MAILIMAP_ERROR_MEMORY;
+    goto err;
+  }
+  ws->session = session;
+  ws->mailbox = NULL;
+  ws->notify = 0;
+  ws->idling = 0;
+  ws->idle_date = 0;
+  ws->exists = 0;
+  ws->error = MAILIMAP_NO_ERROR;
+
+  if (mailbox != NULL) {
+    ws->mailbox = strdup(mailbox);
+    if (ws->mailbox == NULL) {
+      res = MAILIMAP_ERROR_MEMORY;
+      goto free;
+    }
+
+    r = mailimap_examine(session, mailbox);
+    if (r != MAILIMAP_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+  }
+  else if (session->imap_state != MAILIMAP_STATE_SELECTED) {
+    res = MAILIMAP_ERROR_BAD_STATE;
+    goto free;
+  }
+  ws->exists = session->imap_selection_info->sel_exists;
+
+  if (with_notify) {
+    r = mailimap_notify_set(session, 1, mailboxes);
+    if (r != MAILIMAP_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+    ws->notify = 1;
+  }
+
+  r = carray_add(watcher->sessions, ws, NULL);
+  if (r < 0) {
+    res = MAILIMAP_ERROR_MEMORY;
+    goto stop;
+  }
+
+  r = watched_session_idle(ws);
+  if (r != MAILIMAP_NO_ERROR) {
+    res = r;
+    goto delete;
+  }
+
+  return MAILIMAP_NO_ERROR;
+
+ delete:
+  carray_delete_slow(watcher->sessions, carray_count(watcher->sessions) - 1);
+ stop:
+  watched_session_stop(watcher, ws);
+ free:
+  watched_session_free(ws);
+ err:
+  return res;
+}
+
+LIBETPAN_EXPORT
+int mailimap_watcher_remove(struct mailimap_watcher * watcher,
+    mailimap * session)
+{
+  struct watched_session * ws;
+  int indx;
+  int r;
+
+  indx = watcher_find(watcher, session);
+  if (indx == -1)
+    return MAILIMAP_ERROR_INVAL;
+
+  ws = carray_get(watcher->sessions, indx);
+  carray_delete_slow(watcher->sessions, indx);
+
+  r = watched_session_stop(watcher, ws);
+  watched_session_free(ws);
+
+  return r;
+}
+
+/* waiting */
+
+static int watcher_fds_reserve(struct mailimap_watcher * watcher,
+    unsigned int count)
+{
+  struct watcher_fd * fds;
+#ifndef WIN32
+  struct pollfd * pollfds;
+#endif
+
+  if (count <= watcher->fds_size)
+    return 0;
+
+  fds = realloc(watcher->fds, count * sizeof(* fds));
+  if (fds == NULL)
+    return -1;
+  watcher->fds = fds;
+
+#ifndef WIN32
+  pollfds = realloc(watcher->pollfds, count * sizeof(* pollfds));
+  if (pollfds == NULL)
+    return -1;
+  watcher->pollfds = pollfds;
+#endif
+
+  watcher->fds_size = count;
+
+  return 0;
+}
+
+/*
+  watcher_poll() waits for data on the first count descriptors or for
+  the interruption, delay is in milliseconds, -1 waits without limit.
+*/
+
+#ifndef WIN32
+static int watcher_poll(struct mailimap_watcher * watcher,
+    unsigned int count, int delay)
+{
+  struct pollfd * pollfds;
+  unsigned int i;
+  int r;
+
+  pollfds = watcher->pollfds;
+  for(i = 0 ; i < count ; i ++) {
+    pollfds[i].fd = watcher->fds[i].fd;
+    pollfds[i].events = POLLIN;
+    pollfds[i].revents = 0;
+  }
+  pollfds[count].fd = mailstream_cancel_get_fd(watcher->interrupt);
+  pollfds[count].events = POLLIN;
+  pollfds[count].revents = 0;
+
+  r = Poll(pollfds, count + 1, delay);
+  if (r < 0)
+    return -1;
+
+  for(i = 0 ; i < count ; i ++) {
+    if ((pollfds[i].revents & (POLLIN | POLLHUP | POLLERR)) != 0)
+      watcher->fds[i].ready = 1;
+  }
+  if ((pollfds[count].revents & POLLIN) != 0)
+    mailstream_cancel_ack(watcher->interrupt);
+
+  return 0;
+}
+#else
+static int watcher_poll(struct mailimap_watcher * watcher,
+    unsigned int count, int delay)
+{
+  HANDLE events[MAXIMUM_WAIT_OBJECTS];
+  HANDLE interrupt;
+  unsigned int i;
+  DWORD r;
+  int res;
+
+  res = 0;
+  for(i = 0 ; i < count ; i ++) {
+    events[i] = CreateEvent(NULL, TRUE, FALSE, NULL);
+    WSAEventSelect(watcher->fds[i].fd, events[i], FD_READ | FD_CLOSE);
+  }
+  interrupt = (HANDLE) mailstream_cancel_get_fd(watcher->interrupt);
+  events[count] = interrupt;
+
+  r = WaitForMultipleObjects(count + 1, events, FALSE,
+      delay < 0 ? INFINITE : (DWORD) delay);
+  if (r == WAIT_FAILED)
+    res = -1;
+
+  for(i = 0 ; i < count ; i ++) {
+    if (WaitForSingleObject(events[i], 0) == WAIT_OBJECT_0)
+      watcher->fds[i].ready = 1;
+    WSAEventSelect(watcher->fds[i].fd, events[i], 0);
+    CloseHandle(events[i]);
+  }
+  if (WaitForSingleObject(interrupt, 0) == WAIT_OBJECT_0)
+    ResetEvent(interrupt);
+
+  return res;
+}
+#endif
+
+/* renews IDLE on the sessions that reached the delay */
+
+static void watcher_renew(struct mailimap_watcher * watcher, time_t now)
+{
+  unsigned int i;
+
+  for(i = 0 ; i < carray_count(watcher->sessions) ; i ++) {
+    struct watched_session * ws;
+    int r;
+
+    ws = carray_get(watcher->sessions, i);
+    if (ws->error != MAILIMAP_NO_ERROR)
+      continue;
+    if (ws->idling && (now < ws->idle_date + watcher->renew_delay))
+      continue;
+
+    r = watched_session_renew(watcher, ws);
+    if (r != MAILIMAP_NO_ERROR)
+      watched_session_fail(watcher, ws, r);
+  }
+}
+
+LIBETPAN_EXPORT
+int mailimap_watcher_wait(struct mailimap_watcher * watcher, int timeout)
+{
+  unsigned int count;
+  unsigned int i;
+  time_t now;
+  int delay;
+  int r;
+
+  now = time(NULL);
+  watcher_renew(watcher, now);
+
+  if (watcher_fds_reserve(watcher, carray_count(watcher->sessions) + 1) < 0)
+    return MAILIMAP_ERROR_MEMORY;
+
+  delay = -1;
+  if (timeout >= 0)
+    delay = timeout < INT_MAX / 1000 ? timeout * 1000 : INT_MAX;
+
+  count = 0;
+  for(i = 0 ; i < carray_count(watcher->sessions) ; i ++) {
+    struct watched_session * ws;
+    time_t remaining;
+
+    ws = carray_get(watcher->sessions, i);
+    if (ws->error != MAILIMAP_NO_ERROR)
+      continue;
+
+    watcher->fds[count].fd = mailimap_idle_get_fd(ws->session);
+    watcher->fds[count].session = ws;
+    watcher->fds[count].ready = 0;
+    count ++;
+
+    /* the responses that were already read are not signalled */
+    if (watched_session_has_buffered_data(ws)) {
+      watcher->fds[count - 1].ready = 1;
+      delay = 0;
+    }
+
+    remaining = ws->idle_date + watcher->renew_delay - now;
+    if (remaining < 0)
+      remaining = 0;
+    if (remaining > INT_MAX / 1000)
+      remaining = INT_MAX / 1000;
+    if ((delay < 0) || (remaining * 1000 < delay))
+      delay = (int) remaining * 1000;
+  }
+
+  r = watcher_poll(watcher, count, delay);
+  if (r < 0)
+    return MAILIMAP_ERROR_STREAM;
+
+  for(i = 0 ; i < count ; i ++) {
+    struct watched_session * ws;
+
+    if (!watcher->fds[i].ready)
+      continue;
+
+    ws = watcher->fds[i].session;
+    r = watched_session_read(watcher, ws);
+    if (r != MAILIMAP_NO_ERROR)
+      watched_session_fail(watcher, ws, r);
+  }
+
+  watcher_renew(watcher, time(NULL));
+
+  return MAILIMAP_NO_ERROR;
+}
@@ -0,0 +1,202 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2005 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef MAILIMAP_WATCHER_H
+
+#define MAILIMAP_WATCHER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libetpan/libetpan-config.h>
+#include <libetpan/mailimap_types.h>
+
+/*
+  A watcher keeps many IMAP sessions in IDLE and waits for the changes
+  of all of them in a single thread. The session can also watch other
+  mailboxes than the selected one when the server supports NOTIFY
+  (RFC 5465), so that one connection is enough for a whole account.
+
+  The sessions are still owned by the caller but they must not be used
+  while they are watched.
+*/
+
+struct mailimap_watcher;
+
+enum {
+  MAILIMAP_WATCHER_EVENT_EXISTS,  /* the number of messages of the
+                                     selected mailbox changed */
+  MAILIMAP_WATCHER_EVENT_EXPUNGE, /* a message of the selected mailbox
+                                     was expunged */
+  MAILIMAP_WATCHER_EVENT_FETCH,   /* the flags of a message of the selected
+                                     mailbox changed */
+  MAILIMAP_WATCHER_EVENT_STATUS,  /* another mailbox changed (NOTIFY) */
+  MAILIMAP_WATCHER_EVENT_ERROR    /* the session failed and is no more
+                                     watched */
+};
+
+/*
+  mailimap_watcher_event is a change reported by a watched session
+
+  - type is the type of the event, MAILIMAP_WATCHER_EVENT_XXX
+
+  - session is the session that reported the change
+
+  - mailbox is the name of the watched mailbox given to
+    mailimap_watcher_add(), or the name of the other mailbox for
+    MAILIMAP_WATCHER_EVENT_STATUS
+
+  - number is the number of messages for MAILIMAP_WATCHER_EVENT_EXISTS,
+    the message number for MAILIMAP_WATCHER_EVENT_EXPUNGE and
+    MAILIMAP_WATCHER_EVENT_FETCH
+
+  - msg_att is the attributes given by the server with
+    MAILIMAP_WATCHER_EVENT_FETCH (flags, UID, ...)
+
+  - status is the STATUS response with MAILIMAP_WATCHER_EVENT_STATUS
+
+  - error is the MAILIMAP_ERROR_XXX code with MAILIMAP_WATCHER_EVENT_ERROR
+
+  The event and its content are only valid during the callback.
+*/
+
+struct mailimap_watcher_event {
+  int ev_type;
+  mailimap * ev_session;
+  const char * ev_mailbox;
+  uint32_t ev_number;
+  struct mailimap_msg_att * ev_msg_att; /* can be NULL */
+  struct mailimap_mailbox_data_status * ev_status; /* can be NULL */
+  int ev_error;
+};
+
+/*
+  The callback is run by mailimap_watcher_wait() in the thread that
+  waits. It must not add or remove sessions.
+*/
+
+typedef void mailimap_watcher_callback(struct mailimap_watcher * watcher,
+    struct mailimap_watcher_event * event, void * context);
+
+/* IDLE is renewed before servers drop the connection (RFC 2177) */
+#define MAILIMAP_WATCHER_DEFAULT_RENEW_DELAY (28 * 60)
+
+LIBETPAN_EXPORT
+struct mailimap_watcher *
+mailimap_watcher_new(mailimap_watcher_callback * callback, void * context);
+
+/*
+  mailimap_watcher_free() ends IDLE on the sessions that are still
+  watched, they are not closed.
+*/
+
+LIBETPAN_EXPORT
+void mailimap_watcher_free(struct mailimap_watcher * watcher);
+
+/*
+  mailimap_watcher_set_renew_delay() sets the delay in seconds after
+  which IDLE is ended and started again on each session.
+*/
+
+LIBETPAN_EXPORT
+void mailimap_watcher_set_renew_delay(struct mailimap_watcher * watcher,
+    time_t delay);
+
+/*
+  mailimap_watcher_add()
+
+  This function starts to watch a session.
+
+  @param watcher    watcher
+  @param session    IMAP session, authenticated
+  @param mailbox    mailbox to watch, it is examined. When it is NULL,
+    the mailbox that is already selected is watched.
+  @param mailboxes  list of (char *), other mailboxes to watch using
+    NOTIFY, it can be NULL
+
+  @return the return code is one of MAILIMAP_ERROR_XXX or
+    MAILIMAP_NO_ERROR codes. MAILIMAP_ERROR_EXTENSION is returned
+    when the server does not support IDLE, or NOTIFY and other
+    mailboxes are given.
+*/
+
+LIBETPAN_EXPORT
+int mailimap_watcher_add(struct mailimap_watcher * watcher,
+    mailimap * session, const char * mailbox, clist * mailboxes);
+
+/*
+  mailimap_watcher_remove()
+
+  This function stops to watch a session. IDLE and the notifications
+  are ended and the session can be used again.
+
+  @return the return code is one of MAILIMAP_ERROR_XXX or
+    MAILIMAP_NO_ERROR codes, it is the error of the session when it
+    failed while it was watched.
+*/
+
+LIBETPAN_EXPORT
+int mailimap_watcher_remove(struct mailimap_watcher * watcher,
+    mailimap * session);
+
+/*
+  mailimap_watcher_wait()
+
+  This function waits for changes on all the watched sessions and runs
+  the callback for each of them. IDLE is renewed on the sessions that
+  reached the renew delay.
+
+  @param watcher  watcher
+  @param timeout  maximum delay in seconds, -1 to wait until a change
+    happens or mailimap_watcher_interrupt() is called
+
+  @return the return code is one of MAILIMAP_ERROR_XXX or
+    MAILIMAP_NO_ERROR codes. The errors of the sessions are reported
+    as events.
+*/
+
+LIBETPAN_EXPORT
+int mailimap_watcher_wait(struct mailimap_watcher * watcher, int timeout);
+
+/*
+  mailimap_watcher_interrupt() makes mailimap_watcher_wait() return,
+  it can be called from any thread.
+*/
+
+LIBETPAN_EXPORT
+void mailimap_watcher_interrupt(struct mailimap_watcher * watcher);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
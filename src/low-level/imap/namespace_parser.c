@@ -43,6 +43,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "carena_wrappers.h"
+
 static int mailimap_namespace_data_parse(mailstream * fd,
                                          MMAPString * buffer, size_t * indx,
                                          struct mailimap_namespace_data ** result,
@@ -34,6 +34,8 @@
 #include "mailimap_types.h"
 #include <stdlib.h>
 
+#include "carena_wrappers.h"
+
 LIBETPAN_EXPORT
 struct mailimap_namespace_response_extension *
 mailimap_namespace_response_extension_new(char * name,
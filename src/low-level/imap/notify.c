@@ -0,0 +1,204 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2005 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "notify.h"
+
+#include <stdlib.h>
+
+#include "mailimap_sender.h"
+#include "mailimap_parser.h"
+#include "mailimap_extension.h"
+#include "mailimap.h"
+
+/*
+notify          = "NOTIFY" SP
+                  (notify-set / notify-none)
+
+notify-set      = "SET" [status-indicator] SP event-groups
+
+event-groups    = event-group *(SP event-group)
+
+event-group     = "(" filter-mailboxes SP events ")"
+
+filter-mailboxes = filter-mailboxes-selected /
+                   filter-mailboxes-other
+
+one-or-more-mailbox = mailbox / many-mailboxes
+*/
+
+static int mailimap_notify_selected_send(mailstream * fd)
+{
+  return mailimap_token_send(fd,
+      "(SELECTED (MessageNew MessageExpunge FlagChange))");
+}
+
+static int mailimap_notify_mailboxes_send(mailstream * fd, clist * mailboxes)
+{
+  int r;
+
+  r = mailimap_token_send(fd, "(MAILBOXES");
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  r = mailimap_space_send(fd);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  r = mailimap_oparenth_send(fd);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  r = mailimap_struct_spaced_list_send(fd, mailboxes,
+      (mailimap_struct_sender *) mailimap_mailbox_send);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  r = mailimap_cparenth_send(fd);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  r = mailimap_token_send(fd, " (MessageNew MessageExpunge))");
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  return MAILIMAP_NO_ERROR;
+}
+
+static int mailimap_notify_set_send(mailstream * fd, int selected,
+    clist * mailboxes)
+{
+  int r;
+
+  r = mailimap_token_send(fd, "NOTIFY SET");
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  if (selected) {
+    r = mailimap_space_send(fd);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+
+    r = mailimap_notify_selected_send(fd);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+  }
+
+  if ((mailboxes != NULL) && !clist_isempty(mailboxes)) {
+    r = mailimap_space_send(fd);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+
+    r = mailimap_notify_mailboxes_send(fd, mailboxes);
+    if (r != MAILIMAP_NO_ERROR)
+      return r;
+  }
+
+  return MAILIMAP_NO_ERROR;
+}
+
+static int mailimap_notify_none_send(mailstream * fd)
+{
+  return mailimap_token_send(fd, "NOTIFY NONE");
+}
+
+static int mailimap_notify_command(mailimap * session, int selected,
+    clist * mailboxes, int none)
+{
+  struct mailimap_response * response;
+  int r;
+  int error_code;
+
+  if ((session->imap_state != MAILIMAP_STATE_AUTHENTICATED) &&
+      (session->imap_state != MAILIMAP_STATE_SELECTED))
+    return MAILIMAP_ERROR_BAD_STATE;
+
+  r = mailimap_send_current_tag(session);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  if (none)
+    r = mailimap_notify_none_send(session->imap_stream);
+  else
+    r = mailimap_notify_set_send(session->imap_stream, selected, mailboxes);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  r = mailimap_crlf_send(session->imap_stream);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  if (mailstream_flush(session->imap_stream) == -1)
+    return MAILIMAP_ERROR_STREAM;
+
+  if (mailimap_read_line(session) == NULL)
+    return MAILIMAP_ERROR_STREAM;
+
+  r = mailimap_parse_response(session, &response);
+  if (r != MAILIMAP_NO_ERROR)
+    return r;
+
+  error_code = response->rsp_resp_done->rsp_data.rsp_tagged->rsp_cond_state->rsp_type;
+
+  mailimap_response_free(response);
+
+  switch (error_code) {
+  case MAILIMAP_RESP_COND_STATE_OK:
+    return MAILIMAP_NO_ERROR;
+
+  default:
+    return MAILIMAP_ERROR_EXTENSION;
+  }
+}
+
+LIBETPAN_EXPORT
+int mailimap_notify_set(mailimap * session, int selected, clist * mailboxes)
+{
+  if (!selected && ((mailboxes == NULL) || clist_isempty(mailboxes)))
+    return MAILIMAP_ERROR_INVAL;
+
+  return mailimap_notify_command(session, selected, mailboxes, 0);
+}
+
+LIBETPAN_EXPORT
+int mailimap_notify_none(mailimap * session)
+{
+  return mailimap_notify_command(session, 0, NULL, 1);
+}
+
+LIBETPAN_EXPORT
+int mailimap_has_notify(mailimap * session)
+{
+  return mailimap_has_extension(session, "NOTIFY");
+}
@@ -0,0 +1,83 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2005 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef MAILIMAP_NOTIFY_H
+
+#define MAILIMAP_NOTIFY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libetpan/mailimap_types.h>
+
+/*
+  mailimap_notify_set()
+
+  This function asks the server to report the changes of mailboxes
+  without polling them (RFC 5465). The changes are reported by untagged
+  responses, as soon as the session is idle.
+  The new, expunged messages and the changes of flags of the selected
+  mailbox are reported with EXISTS, EXPUNGE and FETCH responses.
+  The new and expunged messages of the other mailboxes are reported
+  with STATUS responses.
+
+  @param session    IMAP session
+  @param selected   the changes of the selected mailbox are reported
+    when this value is not 0
+  @param mailboxes  list of (char *), names of other mailboxes
+    to watch, it can be NULL
+
+  @return the return code is one of MAILIMAP_ERROR_XXX or
+    MAILIMAP_NO_ERROR codes
+*/
+
+LIBETPAN_EXPORT
+int mailimap_notify_set(mailimap * session, int selected, clist * mailboxes);
+
+/*
+  mailimap_notify_none()
+
+  This function stops the notifications requested with
+  mailimap_notify_set().
+*/
+
+LIBETPAN_EXPORT
+int mailimap_notify_none(mailimap * session);
+
+LIBETPAN_EXPORT
+int mailimap_has_notify(mailimap * session);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
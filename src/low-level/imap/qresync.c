@@ -43,6 +43,8 @@
 #include "mailimap_keywords.h"
 #include "mailimap_parser.h"
 
+#include "carena_wrappers.h"
+
 /*
 capability          =/ "QRESYNC"
 
@@ -399,7 +401,7 @@ int mailimap_fetch_qresync_vanished(mailimap * session,
   if (mailimap_read_line(session) == NULL)
     return MAILIMAP_ERROR_STREAM;
 
-  r = mailimap_parse_response(session, &response);
+  r = mailimap_parse_fetch_response(session, &response);
   if (r != MAILIMAP_NO_ERROR)
     return r;
 
@@ -424,7 +426,11 @@ int mailimap_fetch_qresync_vanished(mailimap * session,
 
   default:
     if (* fetch_result != NULL) {
-      mailimap_fetch_list_free(* fetch_result);
+      /* a fetch list of the arena is released with the arena */
+      if ((session->imap_fetch_arena == NULL) ||
+          !carena_contains(session->imap_fetch_arena, * fetch_result))
+        mailimap_fetch_list_free(* fetch_result);
+      * fetch_result = NULL;
     }
     if (p_vanished != NULL && * p_vanished != NULL) {
       mailimap_qresync_vanished_free(* p_vanished);
@@ -476,7 +482,7 @@ int mailimap_uid_fetch_qresync_vanished(mailimap * session,
   if (mailimap_read_line(session) == NULL)
     return MAILIMAP_ERROR_STREAM;
 
-  r = mailimap_parse_response(session, &response);
+  r = mailimap_parse_fetch_response(session, &response);
   if (r != MAILIMAP_NO_ERROR) {
     return r;
   }
@@ -502,7 +508,11 @@ int mailimap_uid_fetch_qresync_vanished(mailimap * session,
 
   default:
     if (* fetch_result != NULL) {
-      mailimap_fetch_list_free(* fetch_result);
+      /* a fetch list of the arena is released with the arena */
+      if ((session->imap_fetch_arena == NULL) ||
+          !carena_contains(session->imap_fetch_arena, * fetch_result))
+        mailimap_fetch_list_free(* fetch_result);
+      * fetch_result = NULL;
     }
     if (p_vanished != NULL) {
       if (* p_vanished != NULL) {
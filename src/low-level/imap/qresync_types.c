@@ -35,6 +35,8 @@
 
 #include "mailimap_types.h"
 
+#include "carena_wrappers.h"
+
 LIBETPAN_EXPORT
 struct mailimap_qresync_vanished * mailimap_qresync_vanished_new(int qr_earlier, struct mailimap_set * qr_known_uids)
 {
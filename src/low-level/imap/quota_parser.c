@@ -41,6 +41,8 @@
 
 #include <stdlib.h>
 
+#include "carena_wrappers.h"
+
 int
 mailimap_quota_quota_resource_parse(mailstream * fd, MMAPString *buffer,
     size_t * indx, void * result_ptr,
@@ -40,6 +40,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "carena_wrappers.h"
+
 LIBETPAN_EXPORT
 struct mailimap_quota_quota_resource *
 mailimap_quota_quota_resource_new(char * resource_name,
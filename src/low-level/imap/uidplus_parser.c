@@ -39,6 +39,8 @@
 #include "uidplus_types.h"
 #include "uidplus.h"
 
+#include "carena_wrappers.h"
+
 static int mailimap_uid_range_parse(mailstream * fd, MMAPString * buffer,
     size_t * indx, struct mailimap_set_item ** result);
 
@@ -34,6 +34,8 @@
 #include <stdlib.h>
 #include "mailimap_extension_types.h"
 
+#include "carena_wrappers.h"
+
 LIBETPAN_EXPORT
 struct mailimap_uidplus_resp_code_apnd * mailimap_uidplus_resp_code_apnd_new(uint32_t uid_uidvalidity, struct mailimap_set * uid_set)
 {
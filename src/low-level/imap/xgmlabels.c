@@ -43,6 +43,8 @@
 #include "mailimap_sender.h"
 #include "mailimap.h"
 
+#include "carena_wrappers.h"
+
 struct mailimap_fetch_att * mailimap_fetch_att_new_xgmlabels(void)
 {
   char * keyword;
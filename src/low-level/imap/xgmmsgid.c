@@ -42,6 +42,8 @@
 #include "mailimap_sender.h"
 #include "mailimap.h"
 
+#include "carena_wrappers.h"
+
 enum {
     MAILIMAP_XGMMSGID_TYPE_MSGID
 };
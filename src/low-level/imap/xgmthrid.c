@@ -42,6 +42,8 @@
 #include "mailimap_sender.h"
 #include "mailimap.h"
 
+#include "carena_wrappers.h"
+
 enum {
     MAILIMAP_XGMTHRID_TYPE_THRID
 };
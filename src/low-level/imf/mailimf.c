@@ -57,6 +57,8 @@
 #include <string.h>
 #include "mailmime_decode.h"
 
+#include "carena_wrappers.h"
+
 #ifndef TRUE
 #define TRUE 1
 #endif
@@ -4291,9 +4293,9 @@ static int guess_header_type(const char * message, size_t length, size_t indx)
   }
 }
 
-static int mailimf_field_parse(const char * message, size_t length,
-			       size_t * indx,
-			       struct mailimf_field ** result)
+int mailimf_field_parse(const char * message, size_t length,
+			size_t * indx,
+			struct mailimf_field ** result)
 {
   size_t cur_token;
   int type;
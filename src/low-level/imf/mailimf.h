@@ -46,6 +46,7 @@ extern "C" {
 #include <libetpan/mailimf_write_file.h>
 #include <libetpan/mailimf_write_mem.h>
 #include <libetpan/mailimf_types_helper.h>
+#include <libetpan/mailimf_index.h>
 
 #ifdef HAVE_INTTYPES_H
 #	include <inttypes.h>
@@ -108,6 +109,26 @@ int mailimf_fields_parse(const char * message, size_t length,
 			 size_t * indx,
 			 struct mailimf_fields ** result);
 
+/*
+  mailimf_field_parse will parse the given header field, the field
+  is parsed as an optional field when it is not a known field or
+  when its value cannot be parsed.
+  
+  @param message this is a string containing the header field
+  @param length this is the size of the given string
+  @param indx this is a pointer to the start of the header field in
+    the given string, (* indx) is modified to point at the end
+    of the parsed data
+  @param result the result of the parse operation is stored in
+    (* result)
+
+  @return MAILIMF_NO_ERROR on success, MAILIMF_ERROR_XXX on error
+*/
+LIBETPAN_EXPORT
+int mailimf_field_parse(const char * message, size_t length,
+			size_t * indx,
+			struct mailimf_field ** result);
+
 /*
   mailimf_mailbox_list_parse will parse the given mailbox list
   
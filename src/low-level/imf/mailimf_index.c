@@ -0,0 +1,388 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2005 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "mailimf_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "mailimf.h"
+
+#include "carena_wrappers.h"
+
+/*
+  Only the line ends are searched with memchr(), which is vectorized
+  by the C library, the content of the fields is parsed on demand.
+*/
+
+static int header_index_add(struct mailimf_header_index * hindex,
+    struct mailimf_header_field * field)
+{
+  if (hindex->hi_count >= hindex->hi_size) {
+    struct mailimf_header_field * fields;
+    unsigned int size;
+    
+    size = hindex->hi_size * 2;
+    if (size == 0)
+      size = 32;
+    fields = realloc(hindex->hi_fields, size * sizeof(* fields));
+    if (fields == NULL)
+      return MAILIMF_ERROR_MEMORY;
+    hindex->hi_fields = fields;
+    hindex->hi_size = size;
+  }
+  
+  hindex->hi_fields[hindex->hi_count] = * field;
+  hindex->hi_count ++;
+  
+  return MAILIMF_NO_ERROR;
+}
+
+static int name_match(const char * name, size_t name_len,
+    const char * lower_name)
+{
+  size_t i;
+  
+  for(i = 0 ; i < name_len ; i ++) {
+    if (lower_name[i] == '\0')
+      return 0;
+    if (tolower((unsigned char) name[i]) != lower_name[i])
+      return 0;
+  }
+  
+  return lower_name[i] == '\0';
+}
+
+/* hash is the FNV-1a hash of the lower case name */
+
+static int field_type_from_name(const char * name, size_t name_len,
+    uint32_t hash)
+{
+  const char * lower_name;
+  int type;
+  
+  switch (hash) {
+  case 0x3bc32fbdU:
+    lower_name = "return-path";
+    type = MAILIMF_FIELD_RETURN_PATH;
+    break;
+  case 0x13a153b5U:
+    lower_name = "resent-date";
+    type = MAILIMF_FIELD_RESENT_DATE;
+    break;
+  case 0x3222dc91U:
+    lower_name = "resent-from";
+    type = MAILIMF_FIELD_RESENT_FROM;
+    break;
+  case 0x30a9b478U:
+    lower_name = "resent-sender";
+    type = MAILIMF_FIELD_RESENT_SENDER;
+    break;
+  case 0x57a67708U:
+    lower_name = "resent-to";
+    type = MAILIMF_FIELD_RESENT_TO;
+    break;
+  case 0x43c6ab37U:
+    lower_name = "resent-cc";
+    type = MAILIMF_FIELD_RESENT_CC;
+    break;
+  case 0x520d2affU:
+    lower_name = "resent-bcc";
+    type = MAILIMF_FIELD_RESENT_BCC;
+    break;
+  case 0x2d76730aU:
+    lower_name = "resent-message-id";
+    type = MAILIMF_FIELD_RESENT_MSG_ID;
+    break;
+  case 0xd472dc59U:
+    lower_name = "date";
+    type = MAILIMF_FIELD_ORIG_DATE;
+    break;
+  case 0x95cd8075U:
+    lower_name = "from";
+    type = MAILIMF_FIELD_FROM;
+    break;
+  case 0x9f5eeb64U:
+    lower_name = "sender";
+    type = MAILIMF_FIELD_SENDER;
+    break;
+  case 0x9a998443U:
+    lower_name = "reply-to";
+    type = MAILIMF_FIELD_REPLY_TO;
+    break;
+  case 0x42454824U:
+    lower_name = "to";
+    type = MAILIMF_FIELD_TO;
+    break;
+  case 0x56299123U:
+    lower_name = "cc";
+    type = MAILIMF_FIELD_CC;
+    break;
+  case 0x6fbbef43U:
+    lower_name = "bcc";
+    type = MAILIMF_FIELD_BCC;
+    break;
+  case 0x269f14e6U:
+    lower_name = "message-id";
+    type = MAILIMF_FIELD_MESSAGE_ID;
+    break;
+  case 0x496050efU:
+    lower_name = "in-reply-to";
+    type = MAILIMF_FIELD_IN_REPLY_TO;
+    break;
+  case 0x6392f7cbU:
+    lower_name = "references";
+    type = MAILIMF_FIELD_REFERENCES;
+    break;
+  case 0x891cfe4fU:
+    lower_name = "subject";
+    type = MAILIMF_FIELD_SUBJECT;
+    break;
+  case 0x5886d2d7U:
+    lower_name = "comments";
+    type = MAILIMF_FIELD_COMMENTS;
+    break;
+  case 0xfaf78155U:
+    lower_name = "keywords";
+    type = MAILIMF_FIELD_KEYWORDS;
+    break;
+  default:
+    return MAILIMF_FIELD_OPTIONAL_FIELD;
+  }
+  
+  if (!name_match(name, name_len, lower_name))
+    return MAILIMF_FIELD_OPTIONAL_FIELD;
+  
+  return type;
+}
+
+/*
+  returns the offset following the field starting at cur_token,
+  0 if there is no complete field
+*/
+
+static size_t field_end(const char * message, size_t length,
+    size_t cur_token)
+{
+  const char * p;
+  
+  while (1) {
+    p = memchr(message + cur_token, '\n', length - cur_token);
+    if (p == NULL)
+      return 0;
+    
+    cur_token = p - message + 1;
+    if (cur_token >= length)
+      return cur_token;
+    
+    if ((message[cur_token] != ' ') && (message[cur_token] != '\t'))
+      return cur_token;
+  }
+}
+
+static int header_field_parse(const char * message, size_t length,
+    size_t * indx, struct mailimf_header_field * result)
+{
+  size_t cur_token;
+  size_t end;
+  size_t name_end;
+  size_t i;
+  uint32_t hash;
+  const char * colon;
+  
+  cur_token = * indx;
+  
+  if (cur_token >= length)
+    return MAILIMF_ERROR_PARSE;
+  
+  if ((message[cur_token] == '\r') || (message[cur_token] == '\n'))
+    return MAILIMF_ERROR_PARSE;
+  
+  end = field_end(message, length, cur_token);
+  if (end == 0)
+    return MAILIMF_ERROR_PARSE;
+  
+  colon = memchr(message + cur_token, ':', end - cur_token);
+  if (colon == NULL)
+    return MAILIMF_ERROR_PARSE;
+  
+  /* obsolete syntax allows spaces before the colon */
+  name_end = colon - message;
+  while ((name_end > cur_token) &&
+      ((message[name_end - 1] == ' ') || (message[name_end - 1] == '\t')))
+    name_end --;
+  
+  hash = 0x811c9dc5U;
+  for(i = cur_token ; i < name_end ; i ++) {
+    hash ^= (unsigned char) tolower((unsigned char) message[i]);
+    hash *= 0x01000193U;
+  }
+  
+  result->hf_name = cur_token;
+  result->hf_name_len = name_end - cur_token;
+  result->hf_type = field_type_from_name(message + cur_token,
+      name_end - cur_token, hash);
+  result->hf_value = colon - message + 1;
+  result->hf_end = end;
+  result->hf_parsed = NULL;
+  
+  * indx = end;
+  
+  return MAILIMF_NO_ERROR;
+}
+
+int mailimf_header_index_parse(const char * message, size_t length,
+    size_t * indx, struct mailimf_header_index ** result)
+{
+  struct mailimf_header_index * hindex;
+  size_t cur_token;
+  int r;
+  int res;
+  
+  cur_token = * indx;
+  
+  hindex = malloc(sizeof(* hindex));
+  if (hindex == NULL) {
+    res = MAILIMF_ERROR_MEMORY;
+    goto err;
+  }
+  
+  hindex->hi_message = message;
+  hindex->hi_length = length;
+  hindex->hi_count = 0;
+  hindex->hi_size = 0;
+  hindex->hi_fields = NULL;
+  
+  while (1) {
+    struct mailimf_header_field field;
+    
+    r = header_field_parse(message, length, &cur_token, &field);
+    if (r != MAILIMF_NO_ERROR)
+      break;
+    
+    r = header_index_add(hindex, &field);
+    if (r != MAILIMF_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+  }
+  
+  * indx = cur_token;
+  * result = hindex;
+  
+  return MAILIMF_NO_ERROR;
+  
+ free:
+  mailimf_header_index_free(hindex);
+ err:
+  return res;
+}
+
+void mailimf_header_index_free(struct mailimf_header_index * hindex)
+{
+  unsigned int i;
+  
+  for(i = 0 ; i < hindex->hi_count ; i ++) {
+    if (hindex->hi_fields[i].hf_parsed != NULL)
+      mailimf_field_free(hindex->hi_fields[i].hf_parsed);
+  }
+  free(hindex->hi_fields);
+  free(hindex);
+}
+
+int mailimf_header_index_find(struct mailimf_header_index * hindex,
+    int type, unsigned int start)
+{
+  unsigned int i;
+  
+  for(i = start ; i < hindex->hi_count ; i ++) {
+    if (hindex->hi_fields[i].hf_type == type)
+      return i;
+  }
+  
+  return -1;
+}
+
+int mailimf_header_index_find_name(struct mailimf_header_index * hindex,
+    const char * name, unsigned int start)
+{
+  unsigned int i;
+  size_t len;
+  
+  len = strlen(name);
+  for(i = start ; i < hindex->hi_count ; i ++) {
+    struct mailimf_header_field * field;
+    size_t k;
+    
+    field = &hindex->hi_fields[i];
+    if (field->hf_name_len != len)
+      continue;
+    
+    for(k = 0 ; k < len ; k ++) {
+      if (tolower((unsigned char) hindex->hi_message[field->hf_name + k]) !=
+          tolower((unsigned char) name[k]))
+        break;
+    }
+    if (k == len)
+      return i;
+  }
+  
+  return -1;
+}
+
+int mailimf_header_index_get(struct mailimf_header_index * hindex,
+    unsigned int pos, struct mailimf_field ** result)
+{
+  struct mailimf_header_field * field;
+  size_t cur_token;
+  int r;
+  
+  if (pos >= hindex->hi_count)
+    return MAILIMF_ERROR_INVAL;
+  
+  field = &hindex->hi_fields[pos];
+  if (field->hf_parsed == NULL) {
+    cur_token = field->hf_name;
+    r = mailimf_field_parse(hindex->hi_message, field->hf_end,
+        &cur_token, &field->hf_parsed);
+    if (r != MAILIMF_NO_ERROR)
+      return r;
+  }
+  
+  * result = field->hf_parsed;
+  
+  return MAILIMF_NO_ERROR;
+}
@@ -0,0 +1,159 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2005 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef MAILIMF_INDEX_H
+
+#define MAILIMF_INDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libetpan/mailimf_types.h>
+
+/*
+  mailimf_header_field describes a header field found by
+  mailimf_header_index_parse(), offsets are given from the beginning
+  of the parsed string.
+
+  - hf_type is the type guessed from the field name (MAILIMF_FIELD_XXX),
+    MAILIMF_FIELD_OPTIONAL_FIELD for other fields
+
+  - hf_name is the offset of the field name, hf_name_len its length
+
+  - hf_value is the offset of the value, just after the colon
+
+  - hf_end is the offset following the end of the field, including
+    the folded lines and the final CRLF
+
+  - hf_parsed is the parsed field, it is set by mailimf_header_index_get()
+*/
+
+struct mailimf_header_field {
+  int hf_type;
+  size_t hf_name;
+  size_t hf_name_len;
+  size_t hf_value;
+  size_t hf_end;
+  struct mailimf_field * hf_parsed;
+};
+
+/*
+  mailimf_header_index is the list of the header fields of a message,
+  in the order of the message
+
+  - hi_message is the parsed string, it must stay valid while the
+    index is used
+
+  - hi_count is the number of fields
+
+  - hi_fields is the array of fields
+*/
+
+struct mailimf_header_index {
+  const char * hi_message;
+  size_t hi_length;
+  unsigned int hi_count;
+  unsigned int hi_size;
+  struct mailimf_header_field * hi_fields;
+};
+
+/*
+  mailimf_header_index_parse will find the boundaries of the header
+  fields of the given message without parsing their content.
+  Fields are delimited the same way as mailimf_ignore_field_parse().
+  
+  @param message this is a string containing the header fields
+  @param length this is the size of the given string
+  @param indx this is a pointer to the start of the header fields in
+    the given string, (* indx) is modified to point at the end
+    of the header fields
+  @param result the result of the parse operation is stored in
+    (* result)
+
+  @return MAILIMF_NO_ERROR on success, MAILIMF_ERROR_XXX on error
+*/
+
+LIBETPAN_EXPORT
+int mailimf_header_index_parse(const char * message, size_t length,
+    size_t * indx, struct mailimf_header_index ** result);
+
+LIBETPAN_EXPORT
+void mailimf_header_index_free(struct mailimf_header_index * hindex);
+
+/*
+  mailimf_header_index_find will return the position of the first
+  field of the given type, starting at the given position.
+
+  @param hindex the index of the header
+  @param type the type of field (MAILIMF_FIELD_XXX)
+  @param start the position where to start the search
+
+  @return the position of the field, -1 if it was not found
+*/
+
+LIBETPAN_EXPORT
+int mailimf_header_index_find(struct mailimf_header_index * hindex,
+    int type, unsigned int start);
+
+/*
+  mailimf_header_index_find_name will return the position of the
+  first field with the given name, starting at the given position.
+  The name is compared without case.
+
+  @return the position of the field, -1 if it was not found
+*/
+
+LIBETPAN_EXPORT
+int mailimf_header_index_find_name(struct mailimf_header_index * hindex,
+    const char * name, unsigned int start);
+
+/*
+  mailimf_header_index_get will parse the field at the given position,
+  with the same result as mailimf_fields_parse() for this field.
+  The field is parsed only once, the result is owned by the index.
+
+  @param hindex the index of the header
+  @param pos the position of the field
+  @param result the parsed field is stored in (* result)
+
+  @return MAILIMF_NO_ERROR on success, MAILIMF_ERROR_XXX on error
+*/
+
+LIBETPAN_EXPORT
+int mailimf_header_index_get(struct mailimf_header_index * hindex,
+    unsigned int pos, struct mailimf_field ** result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -37,6 +37,8 @@
 #include "mmapstring.h"
 #include <stdlib.h>
 
+#include "carena_wrappers.h"
+
 LIBETPAN_EXPORT
 void mailimf_atom_free(char * atom)
 {
@@ -48,6 +48,8 @@
 #include "mailimf.h"
 #include "timeutils.h"
 
+#include "carena_wrappers.h"
+
 struct mailimf_mailbox_list *
 mailimf_mailbox_list_new_empty(void)
 {
@@ -54,6 +54,9 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <fcntl.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#	include <sys/inotify.h>
+#endif
 
 #ifdef LIBETPAN_SYSTEM_BASENAME
 #include <libgen.h>
@@ -76,6 +79,12 @@ struct maildir * maildir_new(const char * path)
   md->mdir_counter = 0;
   md->mdir_mtime_new = (time_t) -1;
   md->mdir_mtime_cur = (time_t) -1;
+  md->mdir_mtime_new_nsec = 0;
+  md->mdir_mtime_cur_nsec = 0;
+  md->mdir_incremental = 0;
+  md->mdir_watch_fd = -1;
+  md->mdir_watch_new = -1;
+  md->mdir_watch_cur = -1;
   
   md->mdir_pid = getpid();
   gethostname(md->mdir_hostname, sizeof(md->mdir_hostname));
@@ -105,6 +114,7 @@ static void msg_free(struct maildir_msg * msg);
 
 void maildir_free(struct maildir * md)
 {
+  maildir_watch_stop(md);
   maildir_flush(md, 0);
   maildir_flush(md, 1);
   chash_free(md->mdir_msg_hash);
@@ -180,37 +190,27 @@ static void msg_free(struct maildir_msg * msg)
 }
 
 /*
-  msg_new()
+  msg_parse_filename()
   
-  filename is given without path
+  returns the length of the uid part of the filename and
+  stores the flags in (* pflags).
 */
 
-static struct maildir_msg * msg_new(char * filename, int new_msg)
+static size_t msg_parse_filename(const char * filename, int new_msg,
+    int * pflags)
 {
-  struct maildir_msg * msg;
-  char * p;
+  const char * p;
   int flags;
   size_t uid_len;
-  char * begin_uid;
 
   /* name of file : xxx-xxx_xxx-xxx:2,SRFT */
   
-  msg = malloc(sizeof(* msg));
-  if (msg == NULL)
-    goto err;
-  
-  msg->msg_filename = strdup(filename);
-  if (msg->msg_filename == NULL)
-    goto free;
-  
-  begin_uid = filename;
-  
-  uid_len = strlen(begin_uid);
+  uid_len = strlen(filename);
   
   flags = 0;
   p = strstr(filename, ":2,");
   if (p != NULL) {
-    uid_len = p - begin_uid;
+    uid_len = p - filename;
     
     p += 3;
     
@@ -237,13 +237,40 @@ static struct maildir_msg * msg_new(char * filename, int new_msg)
   if (new_msg)
     flags |= MAILDIR_FLAG_NEW;
   
+  * pflags = flags;
+  
+  return uid_len;
+}
+
+/*
+  msg_new()
+  
+  filename is given without path
+*/
+
+static struct maildir_msg * msg_new(char * filename, int new_msg)
+{
+  struct maildir_msg * msg;
+  int flags;
+  size_t uid_len;
+
+  msg = malloc(sizeof(* msg));
+  if (msg == NULL)
+    goto err;
+  
+  msg->msg_filename = strdup(filename);
+  if (msg->msg_filename == NULL)
+    goto free;
+  
+  uid_len = msg_parse_filename(filename, new_msg, &flags);
+  
   msg->msg_flags = flags;
 
   msg->msg_uid = malloc(uid_len + 1);
   if (msg->msg_uid == NULL)
     goto free_filename;
   
-  strncpy(msg->msg_uid, begin_uid, uid_len);
+  strncpy(msg->msg_uid, filename, uid_len);
   msg->msg_uid[uid_len] = '\0';
   
   return msg;
@@ -295,7 +322,7 @@ static void maildir_flush(struct maildir * md, int new_msg)
 }
 
 static int add_message(struct maildir * md,
-    char * filename, int is_new)
+    char * filename, int is_new, struct maildir_msg ** result)
 {
   struct maildir_msg * msg;
   chashdatum key;
@@ -327,6 +354,9 @@ static int add_message(struct maildir * md,
     goto delete;
   }
   
+  if (result != NULL)
+    * result = msg;
+  
   return MAILDIR_NO_ERROR;
   
  delete:
@@ -370,7 +400,7 @@ static int add_directory(struct maildir * md, char * path, int is_new)
     if (entry->d_name[0] == '.')
       continue;
     
-    r = add_message(md, entry->d_name, is_new);
+    r = add_message(md, entry->d_name, is_new, NULL);
     if (r != MAILDIR_NO_ERROR) {
       /* ignore errors */
     }
@@ -384,48 +414,519 @@ static int add_directory(struct maildir * md, char * path, int is_new)
   return res;
 }
 
+/* incremental update */
+
+/*
+  set_message()
+  
+  adds the message or updates the name and the flags of the known
+  message with the same uid.
+*/
+
+static int set_message(struct maildir * md,
+    char * filename, int is_new, struct maildir_msg ** result)
+{
+  struct maildir_msg * msg;
+  chashdatum key;
+  chashdatum value;
+  size_t uid_len;
+  int flags;
+  char * dup_filename;
+  int r;
+  
+  uid_len = msg_parse_filename(filename, is_new, &flags);
+  
+  key.data = filename;
+  key.len = (unsigned int) uid_len;
+  r = chash_get(md->mdir_msg_hash, &key, &value);
+  if (r < 0)
+    return add_message(md, filename, is_new, result);
+  
+  msg = value.data;
+  if (strcmp(msg->msg_filename, filename) != 0) {
+    dup_filename = strdup(filename);
+    if (dup_filename == NULL)
+      return MAILDIR_ERROR_MEMORY;
+    
+    free(msg->msg_filename);
+    msg->msg_filename = dup_filename;
+  }
+  msg->msg_flags = flags;
+  
+  if (result != NULL)
+    * result = msg;
+  
+  return MAILDIR_NO_ERROR;
+}
+
+static int update_directory(struct maildir * md, char * path, int is_new,
+    chash * found)
+{
+  DIR * d;
+  struct dirent * entry;
+  struct maildir_msg * msg;
+  chashdatum key;
+  chashdatum value;
+  int res;
+  int r;
+  
+  d = opendir(path);
+  if (d == NULL) {
+    res = MAILDIR_ERROR_DIRECTORY;
+    goto err;
+  }
+  
+  while ((entry = readdir(d)) != NULL) {
+    if (entry->d_name[0] == '.')
+      continue;
+    
+    r = set_message(md, entry->d_name, is_new, &msg);
+    if (r != MAILDIR_NO_ERROR) {
+      res = r;
+      goto closedir;
+    }
+    
+    key.data = msg->msg_uid;
+    key.len = (unsigned int) strlen(msg->msg_uid);
+    value.data = msg;
+    value.len = 0;
+    r = chash_set(found, &key, &value, NULL);
+    if (r < 0) {
+      res = MAILDIR_ERROR_MEMORY;
+      goto closedir;
+    }
+  }
+  
+  closedir(d);
+  
+  return MAILDIR_NO_ERROR;
+  
+ closedir:
+  closedir(d);
+ err:
+  return res;
+}
+
+/*
+  remove_messages()
+  
+  if keep is set, the messages of the scanned directories that are not
+  in the given hash are removed, else the messages in the hash are
+  removed.
+*/
+
+static void remove_messages(struct maildir * md, chash * msg_hash, int keep,
+    int scan_new, int scan_cur)
+{
+  unsigned int i;
+  
+  i = 0;
+  while (i < carray_count(md->mdir_msg_list)) {
+    struct maildir_msg * msg;
+    chashdatum key;
+    chashdatum value;
+    int is_new;
+    int listed;
+    int delete;
+    
+    msg = carray_get(md->mdir_msg_list, i);
+    
+    key.data = msg->msg_uid;
+    key.len = (unsigned int) strlen(msg->msg_uid);
+    listed = (chash_get(msg_hash, &key, &value) == 0);
+    
+    if (keep) {
+      is_new = ((msg->msg_flags & MAILDIR_FLAG_NEW) != 0);
+      delete = !listed && ((is_new && scan_new) || (!is_new && scan_cur));
+    }
+    else {
+      delete = listed;
+    }
+    
+    if (delete) {
+      chash_delete(md->mdir_msg_hash, &key, NULL);
+      carray_delete(md->mdir_msg_list, i);
+      msg_free(msg);
+    }
+    else {
+      i ++;
+    }
+  }
+}
+
+static int update_incremental(struct maildir * md,
+    char * path_new, int scan_new, char * path_cur, int scan_cur)
+{
+  chash * found;
+  int res;
+  int r;
+  
+  found = chash_new(carray_count(md->mdir_msg_list) + CHASH_DEFAULTSIZE,
+      CHASH_COPYNONE);
+  if (found == NULL) {
+    res = MAILDIR_ERROR_MEMORY;
+    goto err;
+  }
+  
+  if (scan_new) {
+    r = update_directory(md, path_new, 1, found);
+    if (r != MAILDIR_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+  }
+  
+  if (scan_cur) {
+    r = update_directory(md, path_cur, 0, found);
+    if (r != MAILDIR_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+  }
+  
+  remove_messages(md, found, 1, scan_new, scan_cur);
+  
+  chash_free(found);
+  
+  return MAILDIR_NO_ERROR;
+  
+ free:
+  chash_free(found);
+ err:
+  return res;
+}
+
+void maildir_set_incremental_update(struct maildir * md, int enabled)
+{
+  md->mdir_incremental = enabled;
+}
+
+/* watcher */
+
+#ifdef HAVE_SYS_INOTIFY_H
+static int remove_message_file(struct maildir * md,
+    char * filename, int is_new, chash * removed)
+{
+  struct maildir_msg * msg;
+  chashdatum key;
+  chashdatum value;
+  size_t uid_len;
+  int flags;
+  int r;
+  
+  uid_len = msg_parse_filename(filename, is_new, &flags);
+  
+  key.data = filename;
+  key.len = (unsigned int) uid_len;
+  r = chash_get(md->mdir_msg_hash, &key, &value);
+  if (r < 0)
+    return MAILDIR_NO_ERROR;
+  
+  /* the message has already been renamed */
+  msg = value.data;
+  if (strcmp(msg->msg_filename, filename) != 0)
+    return MAILDIR_NO_ERROR;
+  if (((msg->msg_flags & MAILDIR_FLAG_NEW) != 0) != (is_new != 0))
+    return MAILDIR_NO_ERROR;
+  
+  key.data = msg->msg_uid;
+  value.data = msg;
+  value.len = 0;
+  r = chash_set(removed, &key, &value, NULL);
+  if (r < 0)
+    return MAILDIR_ERROR_MEMORY;
+  
+  return MAILDIR_NO_ERROR;
+}
+
+/*
+  applies the pending events, removals are done at the end since the
+  removal of an entry is usually followed by its new name when the
+  flags of a message are changed.
+*/
+
+static int watch_process_events(struct maildir * md)
+{
+  char buffer[4096]
+    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  chash * removed;
+  ssize_t len;
+  char * p;
+  int res;
+  int r;
+  
+  removed = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYNONE);
+  if (removed == NULL) {
+    res = MAILDIR_ERROR_MEMORY;
+    goto err;
+  }
+  
+  while (1) {
+    len = Read(md->mdir_watch_fd, buffer, sizeof(buffer));
+    if (len < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        break;
+      res = MAILDIR_ERROR_DIRECTORY;
+      goto free;
+    }
+    if (len == 0)
+      break;
+    
+    for(p = buffer ; p < buffer + len ;
+        p += sizeof(struct inotify_event) + ((struct inotify_event *) p)->len) {
+      struct inotify_event * event;
+      int is_new;
+      
+      event = (struct inotify_event *) p;
+      
+      /* events were lost or a directory went away */
+      if ((event->mask & (IN_Q_OVERFLOW | IN_IGNORED |
+                IN_DELETE_SELF | IN_MOVE_SELF)) != 0) {
+        res = MAILDIR_ERROR_DIRECTORY;
+        goto free;
+      }
+      
+      if (event->wd == md->mdir_watch_new)
+        is_new = 1;
+      else if (event->wd == md->mdir_watch_cur)
+        is_new = 0;
+      else
+        continue;
+      
+      if ((event->len == 0) || ((event->mask & IN_ISDIR) != 0))
+        continue;
+      if (event->name[0] == '.')
+        continue;
+      
+      if ((event->mask & (IN_CREATE | IN_MOVED_TO)) != 0) {
+        struct maildir_msg * msg;
+        chashdatum key;
+        
+        r = set_message(md, event->name, is_new, &msg);
+        if (r != MAILDIR_NO_ERROR) {
+          res = r;
+          goto free;
+        }
+        
+        key.data = msg->msg_uid;
+        key.len = (unsigned int) strlen(msg->msg_uid);
+        chash_delete(removed, &key, NULL);
+      }
+      else if ((event->mask & (IN_DELETE | IN_MOVED_FROM)) != 0) {
+        r = remove_message_file(md, event->name, is_new, removed);
+        if (r != MAILDIR_NO_ERROR) {
+          res = r;
+          goto free;
+        }
+      }
+    }
+  }
+  
+  if (chash_count(removed) > 0)
+    remove_messages(md, removed, 0, 1, 1);
+  
+  chash_free(removed);
+  
+  return MAILDIR_NO_ERROR;
+  
+ free:
+  chash_free(removed);
+ err:
+  return res;
+}
+#endif
+
+int maildir_watch_start(struct maildir * md)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+  char path_new[PATH_MAX];
+  char path_cur[PATH_MAX];
+  uint32_t mask;
+  int fd;
+  
+  if (md->mdir_watch_fd != -1)
+    return MAILDIR_NO_ERROR;
+  
+  snprintf(path_new, sizeof(path_new), "%s/new", md->mdir_path);
+  snprintf(path_cur, sizeof(path_cur), "%s/cur", md->mdir_path);
+  
+  fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0)
+    goto err;
+  
+  mask = IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM |
+    IN_DELETE_SELF | IN_MOVE_SELF;
+  
+  md->mdir_watch_new = inotify_add_watch(fd, path_new, mask);
+  if (md->mdir_watch_new < 0)
+    goto Close;
+  
+  md->mdir_watch_cur = inotify_add_watch(fd, path_cur, mask);
+  if (md->mdir_watch_cur < 0)
+    goto Close;
+  
+  md->mdir_watch_fd = fd;
+  md->mdir_incremental = 1;
+  
+  /*
+    changes that happened before the watch was set up are only
+    visible with a scan of the directories.
+  */
+  md->mdir_mtime_new = (time_t) -1;
+  md->mdir_mtime_cur = (time_t) -1;
+  
+  return MAILDIR_NO_ERROR;
+  
+ Close:
+  Close(fd);
+  md->mdir_watch_new = -1;
+  md->mdir_watch_cur = -1;
+ err:
+  return MAILDIR_ERROR_DIRECTORY;
+#else
+  (void) md;
+  
+  return MAILDIR_ERROR_DIRECTORY;
+#endif
+}
+
+void maildir_watch_stop(struct maildir * md)
+{
+  if (md->mdir_watch_fd == -1)
+    return;
+  
+  Close(md->mdir_watch_fd);
+  md->mdir_watch_fd = -1;
+  md->mdir_watch_new = -1;
+  md->mdir_watch_cur = -1;
+}
+
+int maildir_watch_get_fd(struct maildir * md)
+{
+  return md->mdir_watch_fd;
+}
+
+/* update */
+
+static int get_mtime(char * path, time_t * result, long * result_nsec)
+{
+  struct stat stat_info;
+  int r;
+  
+  r = stat(path, &stat_info);
+  if (r < 0)
+    return -1;
+  
+  * result = stat_info.st_mtime;
+#if defined(HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC)
+  * result_nsec = stat_info.st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC)
+  * result_nsec = stat_info.st_mtimespec.tv_nsec;
+#else
+  * result_nsec = 0;
+#endif
+  
+  return 0;
+}
+
+/*
+  check_mtime()
+  
+  returns 1 if the directory changed since the last check.
+  
+  A directory modified during the current second might be modified again
+  with the same timestamp if the filesystem has no sub-second timestamps,
+  the timestamp is then not kept so that the next update checks the
+  directory again.
+*/
+
+static int check_mtime(time_t * mtime, long * mtime_nsec,
+    time_t new_mtime, long new_mtime_nsec)
+{
+  int changed;
+  
+  changed = (* mtime != new_mtime) || (* mtime_nsec != new_mtime_nsec);
+  
+  if ((new_mtime_nsec == 0) && (new_mtime >= time(NULL)))
+    * mtime = (time_t) -1;
+  else
+    * mtime = new_mtime;
+  * mtime_nsec = new_mtime_nsec;
+  
+  return changed;
+}
+
 int maildir_update(struct maildir * md)
 {
   struct stat stat_info;
   char path_new[PATH_MAX];
   char path_cur[PATH_MAX];
   char path_maildirfolder[PATH_MAX];
+  time_t mtime;
+  long mtime_nsec;
   int r;
   int res;
-  int changed;
+  int changed_new;
+  int changed_cur;
   
   snprintf(path_new, sizeof(path_new), "%s/new", md->mdir_path);
   snprintf(path_cur, sizeof(path_cur), "%s/cur", md->mdir_path);
   
-  changed = 0;
+  /* done before the watch shortcut so that every update checks it */
+  snprintf(path_maildirfolder, sizeof(path_maildirfolder),
+      "%s/maildirfolder", md->mdir_path);
+  
+  if (stat(path_maildirfolder, &stat_info) == -1) {
+    int fd;
+    
+    fd = Creat(path_maildirfolder, S_IRUSR | S_IWUSR);
+    if (fd != -1)
+      Close(fd);
+  }
+  
+#ifdef HAVE_SYS_INOTIFY_H
+  if ((md->mdir_watch_fd != -1) && (md->mdir_mtime_new != (time_t) -1) &&
+      (md->mdir_mtime_cur != (time_t) -1)) {
+    r = watch_process_events(md);
+    if (r == MAILDIR_NO_ERROR)
+      return MAILDIR_NO_ERROR;
+    
+    /* events were lost, the directories have to be scanned */
+    md->mdir_mtime_new = (time_t) -1;
+    md->mdir_mtime_cur = (time_t) -1;
+  }
+#endif
   
   /* did new/ changed ? */
   
-  r = stat(path_new, &stat_info);
+  r = get_mtime(path_new, &mtime, &mtime_nsec);
   if (r < 0) {
     res = MAILDIR_ERROR_DIRECTORY;
     goto free;
   }
   
-  if (md->mdir_mtime_new != stat_info.st_mtime) {
-    md->mdir_mtime_new = stat_info.st_mtime;
-    changed = 1;
-  }
+  changed_new = check_mtime(&md->mdir_mtime_new, &md->mdir_mtime_new_nsec,
+      mtime, mtime_nsec);
   
   /* did cur/ changed ? */
   
-  r = stat(path_cur, &stat_info);
+  r = get_mtime(path_cur, &mtime, &mtime_nsec);
   if (r < 0) {
     res = MAILDIR_ERROR_DIRECTORY;
     goto free;
   }
-
-  if (md->mdir_mtime_cur != stat_info.st_mtime) {
-    md->mdir_mtime_cur = stat_info.st_mtime;
-    changed = 1;
-  }
   
-  if (changed) {
+  changed_cur = check_mtime(&md->mdir_mtime_cur, &md->mdir_mtime_cur_nsec,
+      mtime, mtime_nsec);
+  
+  if (md->mdir_incremental && (changed_new || changed_cur)) {
+    r = update_incremental(md, path_new, changed_new, path_cur, changed_cur);
+    if (r != MAILDIR_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+  }
+  else if (changed_new || changed_cur) {
     maildir_flush(md, 0);
     maildir_flush(md, 1);
     
@@ -444,17 +945,6 @@ int maildir_update(struct maildir * md)
     }
   }
   
-  snprintf(path_maildirfolder, sizeof(path_maildirfolder),
-      "%s/maildirfolder", md->mdir_path);
-  
-  if (stat(path_maildirfolder, &stat_info) == -1) {
-    int fd;
-    
-    fd = Creat(path_maildirfolder, S_IRUSR | S_IWUSR);
-    if (fd != -1)
-      Close(fd);
-  }
-  
   return MAILDIR_NO_ERROR;
   
  free:
@@ -502,7 +992,8 @@ int maildir_message_add_uid(struct maildir * md,
   char delivery_new_name[PATH_MAX];
   char * delivery_new_basename;
   int res;
-  struct stat stat_info;
+  time_t mtime;
+  long mtime_nsec;
   
   r = maildir_update(md);
   if (r != MAILDIR_NO_ERROR) {
@@ -574,18 +1065,19 @@ int maildir_message_add_uid(struct maildir * md,
   }
   
   snprintf(path_new, sizeof(path_new), "%s/new", md->mdir_path);
-  r = stat(path_new, &stat_info);
+  r = get_mtime(path_new, &mtime, &mtime_nsec);
   if (r < 0) {
     unlink(delivery_new_name);
     res = MAILDIR_ERROR_FILE;
     goto unlink_tmp;
   }
 
-  md->mdir_mtime_new = stat_info.st_mtime;
+  check_mtime(&md->mdir_mtime_new, &md->mdir_mtime_new_nsec,
+      mtime, mtime_nsec);
   
   delivery_new_basename = libetpan_basename(delivery_new_name);
   
-  r = add_message(md, delivery_new_basename, 1);
+  r = add_message(md, delivery_new_basename, 1, NULL);
   if (r != MAILDIR_NO_ERROR) {
     unlink(delivery_new_name);
     res = MAILDIR_ERROR_FILE;
@@ -45,6 +45,36 @@ void maildir_free(struct maildir * md);
 
 int maildir_update(struct maildir * md);
 
+/*
+  maildir_set_incremental_update() enables the incremental update of the
+  list of messages. Instead of rebuilding the whole list, maildir_update()
+  compares the content of new/ and cur/ with the known messages and only
+  adds, removes or renames the entries that changed.
+*/
+
+void maildir_set_incremental_update(struct maildir * md, int enabled);
+
+/*
+  maildir_watch_start() watches new/ and cur/ for changes (inotify).
+  While the maildir is watched, maildir_update() applies the changes
+  reported by the system instead of scanning the directories.
+  The incremental update is enabled.
+
+  @return MAILDIR_NO_ERROR on success, MAILDIR_ERROR_DIRECTORY if the
+    directories can't be watched on this system.
+*/
+
+int maildir_watch_start(struct maildir * md);
+
+void maildir_watch_stop(struct maildir * md);
+
+/*
+  maildir_watch_get_fd() returns a file descriptor that becomes readable
+  when changes are pending, -1 if the maildir is not watched.
+*/
+
+int maildir_watch_get_fd(struct maildir * md);
+
 int maildir_message_add_uid(struct maildir * md,
     const char * message, size_t size,
     char * uid, size_t max_uid_len);
@@ -88,6 +88,12 @@ struct maildir {
   time_t mdir_mtime_cur;
   carray * mdir_msg_list;
   chash * mdir_msg_hash;
+  long mdir_mtime_new_nsec;
+  long mdir_mtime_cur_nsec;
+  int mdir_incremental;
+  int mdir_watch_fd;
+  int mdir_watch_new;
+  int mdir_watch_cur;
 };
 
 #endif
@@ -61,6 +61,8 @@
 
 #include "mmapstring.h"
 #include "mailmbox_parse.h"
+#include "mailmbox_index.h"
+#include "mailmbox_compact.h"
 #include "maillock.h"
 
 #include "syscall_wrappers.h"
@@ -779,6 +781,9 @@ mailmbox_append_message_list(struct mailmbox_folder * folder,
     goto unlock;
   }
 
+  if (folder->mb_index_filename != NULL)
+    mailmbox_index_save(folder);
+
   mailmbox_timestamp(folder);
 
   mailmbox_write_unlock(folder);
@@ -1334,6 +1339,7 @@ int mailmbox_expunge_no_lock(struct mailmbox_folder * folder)
   int dest_fd;
   size_t size;
   mode_t old_mask;
+  int modified;
   
   if (folder->mb_read_only)
     return MAILMBOX_ERROR_READONLY;
@@ -1344,6 +1350,53 @@ int mailmbox_expunge_no_lock(struct mailmbox_folder * folder)
     return MAILMBOX_NO_ERROR;
   }
 
+  /* try to move the data in place first */
+  r = mailmbox_compact_no_lock(folder, &modified);
+  if (r == MAILMBOX_NO_ERROR) {
+    mailmbox_timestamp(folder);
+
+    folder->mb_changed = FALSE;
+    folder->mb_deleted_count = 0;
+
+    return MAILMBOX_NO_ERROR;
+  }
+  else if (modified) {
+    /*
+      the offsets of the messages are no longer valid, the compaction
+      is completed with the journal and the mailbox is parsed again
+    */
+    res = r;
+    mailmbox_unmap(folder);
+    r = mailmbox_compact_recover(folder);
+    if (r == MAILMBOX_NO_ERROR)
+      res = MAILMBOX_NO_ERROR;
+
+    r = mailmbox_map(folder);
+    if (r != MAILMBOX_NO_ERROR) {
+      res = r;
+      goto err;
+    }
+
+    r = mailmbox_parse(folder);
+    if (r != MAILMBOX_NO_ERROR) {
+      res = r;
+      goto err;
+    }
+
+    mailmbox_timestamp(folder);
+    if (res != MAILMBOX_NO_ERROR)
+      goto err;
+
+    folder->mb_changed = FALSE;
+    folder->mb_deleted_count = 0;
+
+    return MAILMBOX_NO_ERROR;
+  }
+  else if (r != MAILMBOX_ERROR_INVAL) {
+    res = r;
+    goto err;
+  }
+
   snprintf(tmp_file, PATH_MAX, "%sXXXXXX", folder->mb_filename);
   old_mask = umask(0077);
   dest_fd = Mkstemp(tmp_file);
@@ -1502,6 +1555,17 @@ int mailmbox_init(const char * filename,
 		  int force_no_uid,
 		  uint32_t default_written_uid,
 		  struct mailmbox_folder ** result_folder)
+{
+  return mailmbox_init_with_index(filename, NULL,
+      force_readonly, force_no_uid, default_written_uid, result_folder);
+}
+
+int mailmbox_init_with_index(const char * filename,
+    const char * index_filename,
+    int force_readonly,
+    int force_no_uid,
+    uint32_t default_written_uid,
+    struct mailmbox_folder ** result_folder)
 {
   struct mailmbox_folder * folder;
   int r;
@@ -1512,6 +1576,13 @@ int mailmbox_init(const char * filename,
     res = MAILMBOX_ERROR_MEMORY;
     goto err;
   }
+  if (index_filename != NULL) {
+    folder->mb_index_filename = strdup(index_filename);
+    if (folder->mb_index_filename == NULL) {
+      res = MAILMBOX_ERROR_MEMORY;
+      goto free;
+    }
+  }
   folder->mb_no_uid = force_no_uid;
   folder->mb_read_only = force_readonly;
   folder->mb_written_uid = default_written_uid;
@@ -1525,6 +1596,22 @@ int mailmbox_init(const char * filename,
     goto free;
   }
 
+  if ((!folder->mb_read_only) && mailmbox_compact_journal_exists(folder)) {
+    /* complete an interrupted expunge */
+    r = mailmbox_write_lock(folder);
+    if (r != MAILMBOX_NO_ERROR) {
+      res = r;
+      goto Close;
+    }
+
+    r = mailmbox_compact_recover(folder);
+    mailmbox_write_unlock(folder);
+    if (r != MAILMBOX_NO_ERROR) {
+      res = r;
+      goto Close;
+    }
+  }
+
   r = mailmbox_map(folder);
   if (r != MAILMBOX_NO_ERROR) {
     res = r;
@@ -83,6 +83,21 @@ int mailmbox_init(const char * filename,
 		  uint32_t default_written_uid,
 		  struct mailmbox_folder ** result_folder);
 
+/*
+  mailmbox_init_with_index() is the same as mailmbox_init() but
+  keeps the offsets and UIDs of the messages in the given index file
+  so that the mailbox does not need to be parsed again when it is
+  opened later, or only the data appended since.
+  If index_filename is NULL, no index is used.
+*/
+
+int mailmbox_init_with_index(const char * filename,
+    const char * index_filename,
+    int force_readonly,
+    int force_no_uid,
+    uint32_t default_written_uid,
+    struct mailmbox_folder ** result_folder);
+
 void mailmbox_done(struct mailmbox_folder * folder);
 
 /* low-level access primitives */
@@ -0,0 +1,821 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2005 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "mailmbox_compact.h"
+
+#include "mailmbox.h"
+#include "mailmbox_index.h"
+
+#ifdef WIN32
+#	include "win_etpan.h"
+#else
+#	include <unistd.h>
+#	include <sys/mman.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "syscall_wrappers.h"
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#ifndef WIN32
+
+/*
+  The messages that follow the first deleted message are grouped in
+  runs of contiguous data. Each run is moved to its destination
+  block by block, from the beginning to the end of the mailbox, so
+  that the data of a block is never overwritten before it is moved.
+
+  Before a block is moved, its position is written to the journal.
+  When the block overlaps its destination, the data of the block
+  is also written to the journal since the move can't be started
+  again from the mailbox itself. The journal has two slots for the
+  blocks so that the previous block is still valid while the next
+  one is written.
+
+  The journal is removed once the mailbox is truncated to its new
+  size. Whatever the size of the mailbox and of the deleted messages,
+  the journal holds the list of runs and at most two blocks: the data
+  of a block is only needed until the next block is journaled.
+*/
+
+#define JOURNAL_SUFFIX ".compact"
+#define JOURNAL_MAGIC "LEPMBCJ1"
+#define COMPACT_BLOCK_SIZE (4 * 1024 * 1024)
+#define COMPACT_MIN_GAP (64 * 1024)
+
+struct journal_header {
+  char jh_magic[8];
+  uint64_t jh_size;
+  uint64_t jh_final_size;
+  uint64_t jh_dest;
+  uint32_t jh_run_count;
+  uint32_t jh_checksum;
+};
+
+struct journal_run {
+  uint64_t jr_src;
+  uint64_t jr_len;
+};
+
+struct journal_step {
+  uint64_t js_seq;
+  uint64_t js_run;
+  uint64_t js_offset;
+  uint64_t js_len;
+  uint32_t js_has_data;
+  uint32_t js_checksum;
+};
+
+struct compaction {
+  char * c_mapping;
+  int c_journal_fd;
+  struct journal_header c_header;
+  struct journal_run * c_runs;
+  uint64_t * c_dest;
+  off_t c_steps_offset;
+  uint64_t c_seq;
+};
+
+static int get_journal_filename(struct mailmbox_folder * folder,
+    char * filename, size_t size)
+{
+  int r;
+
+  r = snprintf(filename, size, "%s%s", folder->mb_filename, JOURNAL_SUFFIX);
+  if ((r < 0) || ((size_t) r >= size))
+    return MAILMBOX_ERROR_FILE;
+
+  return MAILMBOX_NO_ERROR;
+}
+
+static int write_at(int fd, off_t offset, const void * data, size_t len)
+{
+  const char * p;
+  ssize_t r;
+
+  if (lseek(fd, offset, SEEK_SET) < 0)
+    return -1;
+
+  p = data;
+  while (len > 0) {
+    r = Write(fd, p, len);
+    if (r <= 0)
+      return -1;
+    p += r;
+    len -= r;
+  }
+
+  return 0;
+}
+
+static int read_at(int fd, off_t offset, void * data, size_t len)
+{
+  char * p;
+  ssize_t r;
+
+  if (lseek(fd, offset, SEEK_SET) < 0)
+    return -1;
+
+  p = data;
+  while (len > 0) {
+    r = Read(fd, p, len);
+    if (r <= 0)
+      return -1;
+    p += r;
+    len -= r;
+  }
+
+  return 0;
+}
+
+static uint32_t header_checksum(struct journal_header * header,
+    struct journal_run * runs)
+{
+  struct journal_header copy;
+  uint32_t h;
+
+  copy = * header;
+  copy.jh_checksum = 0;
+  h = mailmbox_checksum(&copy, sizeof(copy));
+
+  return h ^ mailmbox_checksum(runs, header->jh_run_count * sizeof(* runs));
+}
+
+static uint32_t step_checksum(struct journal_step * step, const char * data)
+{
+  struct journal_step copy;
+  uint32_t h;
+
+  copy = * step;
+  copy.js_checksum = 0;
+  h = mailmbox_checksum(&copy, sizeof(copy));
+  if (step->js_has_data)
+    h ^= mailmbox_checksum(data, step->js_len);
+
+  return h;
+}
+
+static off_t step_slot_offset(struct compaction * c, uint64_t seq)
+{
+  return c->c_steps_offset +
+    (off_t) (seq % 2) * (sizeof(struct journal_step) + COMPACT_BLOCK_SIZE);
+}
+
+static int compute_destinations(struct compaction * c)
+{
+  uint64_t dest;
+  unsigned int i;
+
+  c->c_dest = malloc(c->c_header.jh_run_count * sizeof(* c->c_dest) + 1);
+  if (c->c_dest == NULL)
+    return MAILMBOX_ERROR_MEMORY;
+
+  dest = c->c_header.jh_dest;
+  for(i = 0 ; i < c->c_header.jh_run_count ; i ++) {
+    c->c_dest[i] = dest;
+    dest += c->c_runs[i].jr_len;
+  }
+  c->c_steps_offset = sizeof(c->c_header) +
+    c->c_header.jh_run_count * sizeof(* c->c_runs);
+
+  return MAILMBOX_NO_ERROR;
+}
+
+static void sync_range(char * mapping, uint64_t offset, uint64_t len)
+{
+  uint64_t page_size;
+  uint64_t start;
+
+  page_size = sysconf(_SC_PAGESIZE);
+  start = offset - offset % page_size;
+  msync(mapping + start, offset + len - start, MS_SYNC);
+}
+
+static int move_block(struct compaction * c,
+    uint64_t run, uint64_t offset, uint64_t len, const char * data)
+{
+  char * dest;
+
+  dest = c->c_mapping + c->c_dest[run] + offset;
+  if (data != NULL)
+    memcpy(dest, data, len);
+  else
+    memmove(dest, c->c_mapping + c->c_runs[run].jr_src + offset, len);
+  sync_range(c->c_mapping, c->c_dest[run] + offset, len);
+
+  return MAILMBOX_NO_ERROR;
+}
+
+static int journal_block(struct compaction * c,
+    uint64_t run, uint64_t offset, uint64_t len, int has_data)
+{
+  struct journal_step step;
+  const char * data;
+  off_t slot;
+
+  data = c->c_mapping + c->c_runs[run].jr_src + offset;
+
+  memset(&step, 0, sizeof(step));
+  step.js_seq = c->c_seq;
+  step.js_run = run;
+  step.js_offset = offset;
+  step.js_len = len;
+  step.js_has_data = has_data;
+  step.js_checksum = step_checksum(&step, data);
+
+  slot = step_slot_offset(c, c->c_seq);
+  if (has_data) {
+    if (write_at(c->c_journal_fd, slot + sizeof(step), data, len) < 0)
+      return MAILMBOX_ERROR_FILE;
+  }
+  if (write_at(c->c_journal_fd, slot, &step, sizeof(step)) < 0)
+    return MAILMBOX_ERROR_FILE;
+  if (fsync(c->c_journal_fd) < 0)
+    return MAILMBOX_ERROR_FILE;
+
+  c->c_seq ++;
+
+  return MAILMBOX_NO_ERROR;
+}
+
+static int run_compaction(struct compaction * c,
+    uint64_t first_run, uint64_t first_offset)
+{
+  uint64_t run;
+  int r;
+
+  for(run = first_run ; run < c->c_header.jh_run_count ; run ++) {
+    uint64_t offset;
+    uint64_t gap;
+
+    offset = 0;
+    if (run == first_run)
+      offset = first_offset;
+
+    gap = c->c_runs[run].jr_src - c->c_dest[run];
+
+    while (offset < c->c_runs[run].jr_len) {
+      uint64_t len;
+      int has_data;
+
+      len = c->c_runs[run].jr_len - offset;
+      if (len > COMPACT_BLOCK_SIZE)
+        len = COMPACT_BLOCK_SIZE;
+
+      /*
+        when the block overlaps its destination, use smaller blocks
+        if the gap is large enough, else keep a copy of the data.
+      */
+      has_data = FALSE;
+      if (gap < len) {
+        if (gap >= COMPACT_MIN_GAP)
+          len = gap;
+        else
+          has_data = TRUE;
+      }
+
+      r = journal_block(c, run, offset, len, has_data);
+      if (r != MAILMBOX_NO_ERROR)
+        return r;
+
+      r = move_block(c, run, offset, len, NULL);
+      if (r != MAILMBOX_NO_ERROR)
+        return r;
+
+      offset += len;
+    }
+  }
+
+  return MAILMBOX_NO_ERROR;
+}
+
+static int finish_compaction(struct compaction * c, int fd,
+    const char * journal_filename)
+{
+  int r;
+
+  r = Ftruncate(fd, c->c_header.jh_final_size);
+  if (r < 0)
+    return MAILMBOX_ERROR_FILE;
+
+  if (fsync(fd) < 0)
+    return MAILMBOX_ERROR_FILE;
+
+  Close(c->c_journal_fd);
+  c->c_journal_fd = -1;
+  unlink(journal_filename);
+
+  return MAILMBOX_NO_ERROR;
+}
+
+static int build_runs(struct mailmbox_folder * folder,
+    struct compaction * c)
+{
+  unsigned int first;
+  unsigned int i;
+  unsigned int count;
+  uint64_t dest;
+
+  for(first = 0 ; first < carray_count(folder->mb_tab) ; first ++) {
+    struct mailmbox_msg_info * info;
+
+    info = carray_get(folder->mb_tab, first);
+    if (info->msg_deleted)
+      break;
+  }
+
+  if (first == carray_count(folder->mb_tab))
+    return MAILMBOX_ERROR_INVAL;
+
+  c->c_runs = malloc((carray_count(folder->mb_tab) - first) *
+      sizeof(* c->c_runs));
+  if (c->c_runs == NULL)
+    return MAILMBOX_ERROR_MEMORY;
+
+  count = 0;
+  dest = ((struct mailmbox_msg_info *)
+      carray_get(folder->mb_tab, first))->msg_start;
+  c->c_header.jh_dest = dest;
+
+  for(i = first ; i < carray_count(folder->mb_tab) ; i ++) {
+    struct mailmbox_msg_info * info;
+    uint64_t len;
+
+    info = carray_get(folder->mb_tab, i);
+    if (info->msg_deleted)
+      continue;
+
+    len = info->msg_size + info->msg_padding;
+    if ((count > 0) &&
+        (c->c_runs[count - 1].jr_src + c->c_runs[count - 1].jr_len ==
+            info->msg_start)) {
+      c->c_runs[count - 1].jr_len += len;
+    }
+    else {
+      c->c_runs[count].jr_src = info->msg_start;
+      c->c_runs[count].jr_len = len;
+      count ++;
+    }
+    dest += len;
+  }
+
+  memcpy(c->c_header.jh_magic, JOURNAL_MAGIC, sizeof(c->c_header.jh_magic));
+  c->c_header.jh_size = folder->mb_mapping_size;
+  c->c_header.jh_final_size = dest;
+  c->c_header.jh_run_count = count;
+  c->c_header.jh_checksum = header_checksum(&c->c_header, c->c_runs);
+
+  return MAILMBOX_NO_ERROR;
+}
+
+static int update_messages(struct mailmbox_folder * folder)
+{
+  unsigned int i;
+  unsigned int j;
+  size_t dest;
+  int changed;
+
+  changed = FALSE;
+  dest = 0;
+  j = 0;
+  for(i = 0 ; i < carray_count(folder->mb_tab) ; i ++) {
+    struct mailmbox_msg_info * info;
+    size_t delta;
+
+    info = carray_get(folder->mb_tab, i);
+
+    if (info->msg_deleted) {
+      chashdatum key;
+
+      if (!changed) {
+        dest = info->msg_start;
+        changed = TRUE;
+      }
+
+      key.data = &info->msg_uid;
+      key.len = sizeof(info->msg_uid);
+      chash_delete(folder->mb_hash, &key, NULL);
+      mailmbox_msg_info_free(info);
+      continue;
+    }
+
+    if (changed) {
+      delta = info->msg_start - dest;
+      info->msg_start -= delta;
+      info->msg_headers -= delta;
+      info->msg_body -= delta;
+      dest += info->msg_size + info->msg_padding;
+    }
+
+    info->msg_index = j;
+    carray_set(folder->mb_tab, j, info);
+    j ++;
+  }
+
+  return carray_set_size(folder->mb_tab, j);
+}
+
+static void shrink_mapping(struct mailmbox_folder * folder, size_t size)
+{
+  size_t page_size;
+  size_t old_len;
+  size_t new_len;
+
+  page_size = sysconf(_SC_PAGESIZE);
+  old_len = (folder->mb_mapping_size + page_size - 1) / page_size * page_size;
+  new_len = (size + page_size - 1) / page_size * page_size;
+
+  if (new_len < old_len)
+    munmap(folder->mb_mapping + new_len, old_len - new_len);
+  if (new_len == 0)
+    folder->mb_mapping = NULL;
+  folder->mb_mapping_size = size;
+}
+
+int mailmbox_compact_no_lock(struct mailmbox_folder * folder,
+    int * p_modified)
+{
+  char journal_filename[PATH_MAX];
+  struct compaction c;
+  unsigned int i;
+  int r;
+  int res;
+
+  * p_modified = FALSE;
+
+  if (folder->mb_read_only)
+    return MAILMBOX_ERROR_READONLY;
+
+  /* UIDs can only be written by rewriting the mailbox */
+  if (!folder->mb_no_uid) {
+    for(i = 0 ; i < carray_count(folder->mb_tab) ; i ++) {
+      struct mailmbox_msg_info * info;
+
+      info = carray_get(folder->mb_tab, i);
+      if (!info->msg_deleted && !info->msg_written_uid)
+        return MAILMBOX_ERROR_INVAL;
+    }
+  }
+
+  memset(&c, 0, sizeof(c));
+  c.c_journal_fd = -1;
+  c.c_mapping = folder->mb_mapping;
+
+  r = build_runs(folder, &c);
+  if (r != MAILMBOX_NO_ERROR) {
+    res = r;
+    goto err;
+  }
+
+  r = compute_destinations(&c);
+  if (r != MAILMBOX_NO_ERROR) {
+    res = r;
+    goto free_runs;
+  }
+
+  r = get_journal_filename(folder, journal_filename, sizeof(journal_filename));
+  if (r != MAILMBOX_NO_ERROR) {
+    res = r;
+    goto free_dest;
+  }
+  c.c_journal_fd = Creat(journal_filename, S_IRUSR | S_IWUSR);
+  if (c.c_journal_fd < 0) {
+    res = MAILMBOX_ERROR_INVAL;
+    goto free_dest;
+  }
+
+  if ((write_at(c.c_journal_fd, 0, &c.c_header, sizeof(c.c_header)) < 0) ||
+      (write_at(c.c_journal_fd, sizeof(c.c_header), c.c_runs,
+          c.c_header.jh_run_count * sizeof(* c.c_runs)) < 0) ||
+      (fsync(c.c_journal_fd) < 0)) {
+    Close(c.c_journal_fd);
+    unlink(journal_filename);
+    res = MAILMBOX_ERROR_INVAL;
+    goto free_dest;
+  }
+
+  /* the mailbox is modified from here */
+  * p_modified = TRUE;
+
+  r = run_compaction(&c, 0, 0);
+  if (r != MAILMBOX_NO_ERROR) {
+    res = r;
+    goto close_journal;
+  }
+
+  r = finish_compaction(&c, folder->mb_fd, journal_filename);
+  if (r != MAILMBOX_NO_ERROR) {
+    res = r;
+    goto close_journal;
+  }
+
+  shrink_mapping(folder, c.c_header.jh_final_size);
+
+  r = update_messages(folder);
+  if (r < 0) {
+    res = MAILMBOX_ERROR_MEMORY;
+    goto free_dest;
+  }
+
+  if (folder->mb_index_filename != NULL)
+    mailmbox_index_save(folder);
+
+  free(c.c_dest);
+  free(c.c_runs);
+
+  return MAILMBOX_NO_ERROR;
+
+ close_journal:
+  /* the journal is kept to complete the compaction later */
+  if (c.c_journal_fd != -1)
+    Close(c.c_journal_fd);
+ free_dest:
+  free(c.c_dest);
+ free_runs:
+  free(c.c_runs);
+ err:
+  return res;
+}
+
+static int read_journal(struct compaction * c, const char * journal_filename)
+{
+  int r;
+
+  c->c_journal_fd = Open(journal_filename, O_RDWR);
+  if (c->c_journal_fd < 0)
+    return MAILMBOX_ERROR_FILE_NOT_FOUND;
+
+  r = read_at(c->c_journal_fd, 0, &c->c_header, sizeof(c->c_header));
+  if ((r < 0) ||
+      (memcmp(c->c_header.jh_magic, JOURNAL_MAGIC,
+          sizeof(c->c_header.jh_magic)) != 0) ||
+      (c->c_header.jh_run_count > c->c_header.jh_size))
+    return MAILMBOX_ERROR_FILE;
+
+  c->c_runs = malloc(c->c_header.jh_run_count * sizeof(* c->c_runs) + 1);
+  if (c->c_runs == NULL)
+    return MAILMBOX_ERROR_MEMORY;
+
+  r = read_at(c->c_journal_fd, sizeof(c->c_header), c->c_runs,
+      c->c_header.jh_run_count * sizeof(* c->c_runs));
+  if (r < 0)
+    return MAILMBOX_ERROR_FILE;
+
+  if (header_checksum(&c->c_header, c->c_runs) != c->c_header.jh_checksum)
+    return MAILMBOX_ERROR_FILE;
+
+  return compute_destinations(c);
+}
+
+/* returns the last block journaled, if any */
+
+static int read_last_step(struct compaction * c,
+    struct journal_step * result, char * data)
+{
+  struct journal_step steps[2];
+  int valid[2];
+  uint64_t slot;
+  int i;
+  int r;
+
+  for(slot = 0 ; slot < 2 ; slot ++) {
+    struct journal_step * step;
+
+    step = &steps[slot];
+    valid[slot] = FALSE;
+    r = read_at(c->c_journal_fd, step_slot_offset(c, slot),
+        step, sizeof(* step));
+    if (r < 0)
+      continue;
+    if ((step->js_run >= c->c_header.jh_run_count) ||
+        (step->js_len > COMPACT_BLOCK_SIZE) ||
+        (step->js_offset + step->js_len > c->c_runs[step->js_run].jr_len) ||
+        (step->js_seq % 2 != slot))
+      continue;
+    valid[slot] = TRUE;
+  }
+
+  /* try the most recent block first */
+  slot = 0;
+  if (valid[0] && valid[1] && (steps[1].js_seq > steps[0].js_seq))
+    slot = 1;
+  else if (!valid[0])
+    slot = 1;
+
+  for(i = 0 ; i < 2 ; i ++, slot = 1 - slot) {
+    struct journal_step * step;
+
+    if (!valid[slot])
+      continue;
+
+    step = &steps[slot];
+    if (step->js_has_data) {
+      r = read_at(c->c_journal_fd, step_slot_offset(c, slot) + sizeof(* step),
+          data, step->js_len);
+      if (r < 0)
+        continue;
+    }
+    if (step_checksum(step, data) != step->js_checksum)
+      continue;
+
+    * result = * step;
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+int mailmbox_compact_journal_exists(struct mailmbox_folder * folder)
+{
+  char journal_filename[PATH_MAX];
+  struct stat stat_info;
+  int r;
+
+  r = get_journal_filename(folder, journal_filename, sizeof(journal_filename));
+  if (r != MAILMBOX_NO_ERROR)
+    return FALSE;
+
+  if (stat(journal_filename, &stat_info) < 0)
+    return FALSE;
+
+  return TRUE;
+}
+
+int mailmbox_compact_recover(struct mailmbox_folder * folder)
+{
+  char journal_filename[PATH_MAX];
+  struct compaction c;
+  struct journal_step step;
+  struct stat stat_info;
+  uint64_t run;
+  uint64_t offset;
+  char * data;
+  int r;
+  int res;
+
+  memset(&c, 0, sizeof(c));
+  c.c_journal_fd = -1;
+
+  r = get_journal_filename(folder, journal_filename, sizeof(journal_filename));
+  if (r != MAILMBOX_NO_ERROR) {
+    /* no journal can have been created with this name */
+    res = MAILMBOX_NO_ERROR;
+    goto err;
+  }
+  r = read_journal(&c, journal_filename);
+  if (r == MAILMBOX_ERROR_FILE_NOT_FOUND) {
+    res = MAILMBOX_NO_ERROR;
+    goto err;
+  }
+  if (r == MAILMBOX_ERROR_FILE) {
+    /* the mailbox has not been modified before the journal was written */
+    res = MAILMBOX_NO_ERROR;
+    goto unlink;
+  }
+  if (r != MAILMBOX_NO_ERROR) {
+    res = r;
+    goto close_journal;
+  }
+
+  r = fstat(folder->mb_fd, &stat_info);
+  if (r < 0) {
+    res = MAILMBOX_ERROR_FILE;
+    goto close_journal;
+  }
+
+  if ((uint64_t) stat_info.st_size != c.c_header.jh_size) {
+    /* already truncated or the journal is stale */
+    res = MAILMBOX_NO_ERROR;
+    goto unlink;
+  }
+
+  data = malloc(COMPACT_BLOCK_SIZE);
+  if (data == NULL) {
+    res = MAILMBOX_ERROR_MEMORY;
+    goto close_journal;
+  }
+
+  c.c_mapping = (char *) mmap(0, c.c_header.jh_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED, folder->mb_fd, 0);
+  if (c.c_mapping == (char *) MAP_FAILED) {
+    res = MAILMBOX_ERROR_FILE;
+    goto free_data;
+  }
+
+  run = 0;
+  offset = 0;
+  if (read_last_step(&c, &step, data)) {
+    /* the last block may have been partially moved, move it again */
+    move_block(&c, step.js_run, step.js_offset, step.js_len,
+        step.js_has_data ? data : NULL);
+
+    run = step.js_run;
+    offset = step.js_offset + step.js_len;
+    c.c_seq = step.js_seq + 1;
+  }
+
+  r = run_compaction(&c, run, offset);
+  if (r != MAILMBOX_NO_ERROR) {
+    res = r;
+    goto unmap;
+  }
+
+  munmap(c.c_mapping, c.c_header.jh_size);
+  free(data);
+
+  r = finish_compaction(&c, folder->mb_fd, journal_filename);
+  if (r != MAILMBOX_NO_ERROR) {
+    res = r;
+    goto close_journal;
+  }
+
+  free(c.c_dest);
+  free(c.c_runs);
+
+  return MAILMBOX_NO_ERROR;
+
+ unmap:
+  munmap(c.c_mapping, c.c_header.jh_size);
+ free_data:
+  free(data);
+ close_journal:
+  if (c.c_journal_fd != -1)
+    Close(c.c_journal_fd);
+  free(c.c_dest);
+  free(c.c_runs);
+  return res;
+
+ unlink:
+  Close(c.c_journal_fd);
+  unlink(journal_filename);
+  free(c.c_dest);
+  free(c.c_runs);
+ err:
+  return res;
+}
+
+#else
+
+int mailmbox_compact_no_lock(struct mailmbox_folder * folder,
+    int * p_modified)
+{
+  * p_modified = FALSE;
+
+  return MAILMBOX_ERROR_INVAL;
+}
+
+int mailmbox_compact_journal_exists(struct mailmbox_folder * folder)
+{
+  return FALSE;
+}
+
+int mailmbox_compact_recover(struct mailmbox_folder * folder)
+{
+  return MAILMBOX_NO_ERROR;
+}
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2005 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef MAILMBOX_COMPACT_H
+
+#define MAILMBOX_COMPACT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mailmbox_types.h"
+
+/*
+  mailmbox_compact_no_lock() removes the deleted messages by moving
+  the following messages towards the beginning of the mailbox, the
+  data before the first deleted message is left untouched.
+  The progress is kept in a journal next to the mailbox so that an
+  interrupted compaction can be completed by
+  mailmbox_compact_recover().
+
+  The folder must be mapped and write-locked.
+
+  MAILMBOX_ERROR_INVAL is returned when the mailbox can't be
+  compacted in place, for example when UIDs have to be written
+  in the messages or when the journal can't be created.
+  The mailbox is unchanged in that case.
+
+  (* p_modified) is set to TRUE when an error happened after the
+  mailbox was modified, the messages of the folder no longer match
+  the mailbox and the journal is kept.
+*/
+
+int mailmbox_compact_no_lock(struct mailmbox_folder * folder,
+    int * p_modified);
+
+/*
+  mailmbox_compact_journal_exists() returns TRUE when a journal is
+  left next to the mailbox by an interrupted compaction. It does not
+  need any lock, mailmbox_compact_recover() checks the journal again
+  under the write lock.
+*/
+
+int mailmbox_compact_journal_exists(struct mailmbox_folder * folder);
+
+/*
+  mailmbox_compact_recover() completes a compaction that has been
+  interrupted. It does nothing when there is no journal.
+
+  The folder must be opened but not mapped, and write-locked.
+*/
+
+int mailmbox_compact_recover(struct mailmbox_folder * folder);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,547 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2005 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "mailmbox_index.h"
+
+#include "mailmbox.h"
+
+#ifndef WIN32
+#	include <unistd.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "syscall_wrappers.h"
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+/*
+  The index is a binary file in host byte order :
+
+  - a header (struct index_header),
+  - followed by ih_count records (struct index_record),
+    one for each message in the mailbox, in file order.
+    ir_uid is 0 when the UID is not written in the mailbox,
+    temporary UIDs are attributed again once loaded.
+
+  The index matches the mailbox if inode and device are the same
+  and if the ih_tail_len bytes before offset ih_size still have the
+  same checksum. When the size and the modification time of the
+  mailbox are unchanged, the index is used as is, otherwise, when
+  the mailbox grew, the last message is parsed again along with
+  the appended data.
+*/
+
+#define INDEX_MAGIC "LEPMBIX1"
+#define INDEX_VERSION 1
+#define INDEX_BYTE_ORDER 0x01020304
+#define INDEX_TAIL_SIZE 4096
+
+struct index_header {
+  char ih_magic[8];
+  uint32_t ih_version;
+  uint32_t ih_byte_order;
+  uint64_t ih_size;
+  int64_t ih_mtime;
+  uint64_t ih_mtime_nsec;
+  uint64_t ih_ino;
+  uint64_t ih_dev;
+  uint32_t ih_count;
+  uint32_t ih_written_uid;
+  uint32_t ih_tail_len;
+  uint32_t ih_tail_checksum;
+  uint32_t ih_records_checksum;
+  uint32_t ih_reserved;
+};
+
+struct index_record {
+  uint64_t ir_start;
+  uint64_t ir_start_len;
+  uint64_t ir_headers;
+  uint64_t ir_headers_len;
+  uint64_t ir_body;
+  uint64_t ir_body_len;
+  uint64_t ir_size;
+  uint64_t ir_padding;
+  uint32_t ir_uid;
+  uint32_t ir_reserved;
+};
+
+/* FNV-1a */
+
+uint32_t mailmbox_checksum(const void * data, size_t len)
+{
+  const unsigned char * p;
+  uint32_t h;
+  size_t i;
+
+  p = data;
+  h = 2166136261U;
+  for(i = 0 ; i < len ; i ++) {
+    h ^= p[i];
+    h *= 16777619U;
+  }
+
+  return h;
+}
+
+static void get_stat_mtime(struct stat * stat_info,
+    int64_t * result, uint64_t * result_nsec)
+{
+  * result = stat_info->st_mtime;
+#if defined(HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC)
+  * result_nsec = stat_info->st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC)
+  * result_nsec = stat_info->st_mtimespec.tv_nsec;
+#else
+  * result_nsec = 0;
+#endif
+}
+
+static uint32_t tail_checksum(struct mailmbox_folder * folder,
+    size_t size, uint32_t * ptail_len)
+{
+  size_t tail_len;
+
+  tail_len = size;
+  if (tail_len > INDEX_TAIL_SIZE)
+    tail_len = INDEX_TAIL_SIZE;
+  * ptail_len = (uint32_t) tail_len;
+
+  return mailmbox_checksum(folder->mb_mapping + size - tail_len, tail_len);
+}
+
+static int read_file(const char * filename, char ** result, size_t * result_len)
+{
+  struct stat stat_info;
+  char * data;
+  size_t cur;
+  ssize_t r;
+  int fd;
+  int res;
+
+  fd = Open(filename, O_RDONLY);
+  if (fd < 0) {
+    res = MAILMBOX_ERROR_FILE;
+    goto err;
+  }
+
+  if (fstat(fd, &stat_info) < 0) {
+    res = MAILMBOX_ERROR_FILE;
+    goto Close;
+  }
+
+  if ((size_t) stat_info.st_size < sizeof(struct index_header)) {
+    res = MAILMBOX_ERROR_FILE;
+    goto Close;
+  }
+
+  data = malloc(stat_info.st_size);
+  if (data == NULL) {
+    res = MAILMBOX_ERROR_MEMORY;
+    goto Close;
+  }
+
+  cur = 0;
+  while (cur < (size_t) stat_info.st_size) {
+    r = Read(fd, data + cur, stat_info.st_size - cur);
+    if (r <= 0) {
+      res = MAILMBOX_ERROR_FILE;
+      goto free;
+    }
+    cur += r;
+  }
+
+  Close(fd);
+
+  * result = data;
+  * result_len = cur;
+
+  return MAILMBOX_NO_ERROR;
+
+ free:
+  free(data);
+ Close:
+  Close(fd);
+ err:
+  return res;
+}
+
+static int add_record(struct mailmbox_folder * folder,
+    struct index_record * record)
+{
+  struct mailmbox_msg_info * info;
+  unsigned int indx;
+  chashdatum key;
+  chashdatum data;
+  uint32_t uid;
+  int r;
+
+  uid = record->ir_uid;
+  if (uid != 0) {
+    key.data = &uid;
+    key.len = sizeof(uid);
+    r = chash_get(folder->mb_hash, &key, &data);
+    if (r == 0)
+      return MAILMBOX_ERROR_FILE;
+  }
+
+  info = mailmbox_msg_info_new(record->ir_start, record->ir_start_len,
+      record->ir_headers, record->ir_headers_len,
+      record->ir_body, record->ir_body_len,
+      record->ir_size, record->ir_padding, uid);
+  if (info == NULL)
+    return MAILMBOX_ERROR_MEMORY;
+
+  r = carray_add(folder->mb_tab, info, &indx);
+  if (r < 0) {
+    mailmbox_msg_info_free(info);
+    return MAILMBOX_ERROR_MEMORY;
+  }
+  info->msg_index = indx;
+
+  if (uid == 0)
+    return MAILMBOX_NO_ERROR;
+
+  key.data = &info->msg_uid;
+  key.len = sizeof(info->msg_uid);
+  data.data = info;
+  data.len = 0;
+  r = chash_set(folder->mb_hash, &key, &data, NULL);
+  if (r < 0) {
+    carray_delete(folder->mb_tab, indx);
+    mailmbox_msg_info_free(info);
+    return MAILMBOX_ERROR_MEMORY;
+  }
+
+  return MAILMBOX_NO_ERROR;
+}
+
+static void remove_last_record(struct mailmbox_folder * folder)
+{
+  struct mailmbox_msg_info * info;
+  unsigned int indx;
+  chashdatum key;
+
+  indx = carray_count(folder->mb_tab) - 1;
+  info = carray_get(folder->mb_tab, indx);
+
+  if (info->msg_uid != 0) {
+    key.data = &info->msg_uid;
+    key.len = sizeof(info->msg_uid);
+    chash_delete(folder->mb_hash, &key, NULL);
+  }
+  carray_delete_slow(folder->mb_tab, indx);
+  mailmbox_msg_info_free(info);
+}
+
+int mailmbox_index_load(struct mailmbox_folder * folder, size_t * indx)
+{
+  struct index_header header;
+  struct index_record * records;
+  struct stat stat_info;
+  int64_t mtime;
+  uint64_t mtime_nsec;
+  uint32_t tail_len;
+  uint64_t end;
+  char * data;
+  size_t len;
+  size_t cur_token;
+  unsigned int i;
+  int r;
+  int res;
+
+  if (folder->mb_index_filename == NULL) {
+    res = MAILMBOX_ERROR_FILE;
+    goto err;
+  }
+
+  r = stat(folder->mb_filename, &stat_info);
+  if (r < 0) {
+    res = MAILMBOX_ERROR_FILE;
+    goto err;
+  }
+
+  if ((size_t) stat_info.st_size != folder->mb_mapping_size) {
+    res = MAILMBOX_ERROR_FILE;
+    goto err;
+  }
+
+  r = read_file(folder->mb_index_filename, &data, &len);
+  if (r != MAILMBOX_NO_ERROR) {
+    res = r;
+    goto err;
+  }
+
+  memcpy(&header, data, sizeof(header));
+  if ((memcmp(header.ih_magic, INDEX_MAGIC, sizeof(header.ih_magic)) != 0) ||
+      (header.ih_version != INDEX_VERSION) ||
+      (header.ih_byte_order != INDEX_BYTE_ORDER)) {
+    res = MAILMBOX_ERROR_FILE;
+    goto free;
+  }
+
+  if ((len - sizeof(header)) / sizeof(* records) != header.ih_count ||
+      (len - sizeof(header)) % sizeof(* records) != 0) {
+    res = MAILMBOX_ERROR_FILE;
+    goto free;
+  }
+
+  records = (struct index_record *) (data + sizeof(header));
+  if (mailmbox_checksum(records, len - sizeof(header)) !=
+      header.ih_records_checksum) {
+    res = MAILMBOX_ERROR_FILE;
+    goto free;
+  }
+
+  /* is it still the same mailbox ? */
+
+  if ((header.ih_ino != (uint64_t) stat_info.st_ino) ||
+      (header.ih_dev != (uint64_t) stat_info.st_dev) ||
+      (header.ih_size > folder->mb_mapping_size)) {
+    res = MAILMBOX_ERROR_FILE;
+    goto free;
+  }
+
+  if (tail_checksum(folder, header.ih_size, &tail_len) !=
+      header.ih_tail_checksum || tail_len != header.ih_tail_len) {
+    res = MAILMBOX_ERROR_FILE;
+    goto free;
+  }
+
+  get_stat_mtime(&stat_info, &mtime, &mtime_nsec);
+  if ((header.ih_size == folder->mb_mapping_size) &&
+      ((header.ih_mtime != mtime) || (header.ih_mtime_nsec != mtime_nsec))) {
+    /* rewritten in place */
+    res = MAILMBOX_ERROR_FILE;
+    goto free;
+  }
+
+  /* restore the message table */
+
+  end = 0;
+  for(i = 0 ; i < header.ih_count ; i ++) {
+    struct index_record record;
+
+    memcpy(&record, &records[i], sizeof(record));
+
+    if ((record.ir_start < end) ||
+        (record.ir_start + record.ir_size + record.ir_padding >
+            header.ih_size)) {
+      res = MAILMBOX_ERROR_FILE;
+      goto free;
+    }
+
+    end = record.ir_start + record.ir_size + record.ir_padding;
+
+    r = add_record(folder, &record);
+    if (r != MAILMBOX_NO_ERROR) {
+      res = r;
+      goto free;
+    }
+  }
+
+  cur_token = header.ih_size;
+
+  if ((header.ih_size != folder->mb_mapping_size) &&
+      (carray_count(folder->mb_tab) > 0)) {
+    struct mailmbox_msg_info * info;
+
+    /* the last message may continue in the appended data */
+
+    info = carray_get(folder->mb_tab, carray_count(folder->mb_tab) - 1);
+    cur_token = info->msg_start;
+    remove_last_record(folder);
+  }
+
+  if (header.ih_written_uid > folder->mb_written_uid)
+    folder->mb_written_uid = header.ih_written_uid;
+
+  free(data);
+
+  * indx = cur_token;
+
+  return MAILMBOX_NO_ERROR;
+
+ free:
+  free(data);
+ err:
+  return res;
+}
+
+static int write_all(int fd, const void * data, size_t len)
+{
+  const char * p;
+  ssize_t r;
+
+  p = data;
+  while (len > 0) {
+    r = Write(fd, p, len);
+    if (r <= 0)
+      return -1;
+    p += r;
+    len -= r;
+  }
+
+  return 0;
+}
+
+int mailmbox_index_save(struct mailmbox_folder * folder)
+{
+  struct index_header header;
+  struct index_record * records;
+  struct stat stat_info;
+  char tmp_file[PATH_MAX];
+  mode_t old_mask;
+  size_t records_len;
+  uint32_t written_uid;
+  unsigned int i;
+  int fd;
+  int r;
+  int res;
+
+  if (folder->mb_index_filename == NULL) {
+    res = MAILMBOX_ERROR_FILE;
+    goto err;
+  }
+
+  r = stat(folder->mb_filename, &stat_info);
+  if (r < 0) {
+    res = MAILMBOX_ERROR_FILE;
+    goto err;
+  }
+
+  if ((size_t) stat_info.st_size != folder->mb_mapping_size) {
+    res = MAILMBOX_ERROR_FILE;
+    goto err;
+  }
+
+  records_len = carray_count(folder->mb_tab) * sizeof(* records);
+  records = malloc(records_len + 1);
+  if (records == NULL) {
+    res = MAILMBOX_ERROR_MEMORY;
+    goto err;
+  }
+
+  written_uid = 0;
+  for(i = 0 ; i < carray_count(folder->mb_tab) ; i ++) {
+    struct mailmbox_msg_info * info;
+
+    info = carray_get(folder->mb_tab, i);
+
+    memset(&records[i], 0, sizeof(records[i]));
+    records[i].ir_start = info->msg_start;
+    records[i].ir_start_len = info->msg_start_len;
+    records[i].ir_headers = info->msg_headers;
+    records[i].ir_headers_len = info->msg_headers_len;
+    records[i].ir_body = info->msg_body;
+    records[i].ir_body_len = info->msg_body_len;
+    records[i].ir_size = info->msg_size;
+    records[i].ir_padding = info->msg_padding;
+    if (info->msg_written_uid) {
+      records[i].ir_uid = info->msg_uid;
+      if (info->msg_uid > written_uid)
+        written_uid = info->msg_uid;
+    }
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.ih_magic, INDEX_MAGIC, sizeof(header.ih_magic));
+  header.ih_version = INDEX_VERSION;
+  header.ih_byte_order = INDEX_BYTE_ORDER;
+  header.ih_size = folder->mb_mapping_size;
+  get_stat_mtime(&stat_info, &header.ih_mtime, &header.ih_mtime_nsec);
+  if ((header.ih_mtime_nsec == 0) && (header.ih_mtime >= time(NULL))) {
+    /* the mailbox could still change within the same second */
+    header.ih_mtime = -1;
+  }
+  header.ih_ino = stat_info.st_ino;
+  header.ih_dev = stat_info.st_dev;
+  header.ih_count = carray_count(folder->mb_tab);
+  header.ih_written_uid = written_uid;
+  header.ih_tail_checksum = tail_checksum(folder, folder->mb_mapping_size,
+      &header.ih_tail_len);
+  header.ih_records_checksum = mailmbox_checksum(records, records_len);
+
+  snprintf(tmp_file, PATH_MAX, "%sXXXXXX", folder->mb_index_filename);
+  old_mask = umask(0077);
+  fd = Mkstemp(tmp_file);
+  umask(old_mask);
+  if (fd < 0) {
+    res = MAILMBOX_ERROR_FILE;
+    goto free;
+  }
+
+  if ((write_all(fd, &header, sizeof(header)) < 0) ||
+      (write_all(fd, records, records_len) < 0)) {
+    res = MAILMBOX_ERROR_FILE;
+    goto unlink;
+  }
+
+  if (Close(fd) < 0) {
+    res = MAILMBOX_ERROR_FILE;
+    goto unlink_closed;
+  }
+
+  r = rename(tmp_file, folder->mb_index_filename);
+  if (r < 0) {
+    res = MAILMBOX_ERROR_FILE;
+    goto unlink_closed;
+  }
+
+  free(records);
+
+  return MAILMBOX_NO_ERROR;
+
+ unlink:
+  Close(fd);
+ unlink_closed:
+  unlink(tmp_file);
+ free:
+  free(records);
+ err:
+  return res;
+}
@@ -0,0 +1,73 @@
+/*
+ * libEtPan! -- a mail stuff library
+ *
+ * Copyright (C) 2001, 2005 - DINH Viet Hoa
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the libEtPan! project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef MAILMBOX_INDEX_H
+
+#define MAILMBOX_INDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mailmbox_types.h"
+
+/*
+  mailmbox_index_load() restores the message table of the folder from
+  the index file given by mb_index_filename.
+
+  On success, (* indx) is set to the offset in the mapping from which
+  parsing must resume. It is the size of the mailbox at the time the
+  index was written, or the start of the last indexed message when
+  data was appended to the mailbox since.
+
+  MAILMBOX_ERROR_FILE is returned when the index is missing or does
+  not match the mailbox, in that case, the message table is left in
+  an undefined state and must be flushed.
+*/
+
+int mailmbox_index_load(struct mailmbox_folder * folder, size_t * indx);
+
+/*
+  mailmbox_index_save() writes the message table of the folder
+  to the index file. The file is replaced atomically.
+*/
+
+int mailmbox_index_save(struct mailmbox_folder * folder);
+
+/* checksum of the index content, also used by the compaction journal */
+
+uint32_t mailmbox_checksum(const void * data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
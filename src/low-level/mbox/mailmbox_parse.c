@@ -40,6 +40,7 @@
 #include "mailmbox_parse.h"
 
 #include "mailmbox.h"
+#include "mailmbox_index.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -490,6 +491,17 @@ mailmbox_parse_additionnal(struct mailmbox_folder * folder,
 
   first_index = j;
 
+  /* messages restored from the index may have no UID yet */
+  for(i = 0 ; i < j ; i ++) {
+    struct mailmbox_msg_info * info;
+
+    info = carray_get(folder->mb_tab, i);
+    if (info->msg_uid == 0) {
+      first_index = i;
+      break;
+    }
+  }
+
   while (1) {
     struct mailmbox_msg_info * info;
     chashdatum key;
@@ -605,10 +617,25 @@ int mailmbox_parse(struct mailmbox_folder * folder)
   int r;
   int res;
   size_t cur_token;
+  int indexed;
 
   flush_uid(folder);
   
   cur_token = 0;
+  indexed = FALSE;
+
+  if (folder->mb_index_filename != NULL) {
+    r = mailmbox_index_load(folder, &cur_token);
+    if (r == MAILMBOX_NO_ERROR) {
+      /* nothing new since the index was written */
+      if (cur_token == folder->mb_mapping_size)
+        indexed = TRUE;
+    }
+    else {
+      flush_uid(folder);
+      cur_token = 0;
+    }
+  }
 
   r = mailmbox_parse_additionnal(folder, &cur_token);
 
@@ -617,6 +644,12 @@ int mailmbox_parse(struct mailmbox_folder * folder)
     goto err;
   }
 
+  if ((folder->mb_index_filename != NULL) &&
+      !indexed) {
+    /* failure to write the index is not fatal */
+    mailmbox_index_save(folder);
+  }
+
   return MAILMBOX_NO_ERROR;
 
  err:
@@ -214,6 +214,8 @@ struct mailmbox_folder * mailmbox_folder_new(const char * mb_filename)
   folder->mb_written_uid = 0;
   folder->mb_max_uid = 0;
 
+  folder->mb_index_filename = NULL;
+
   folder->mb_hash = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
   if (folder->mb_hash == NULL)
     goto free;
@@ -248,5 +250,6 @@ void mailmbox_folder_free(struct mailmbox_folder * folder)
   
   chash_free(folder->mb_hash);
 
+  free(folder->mb_index_filename);
   free(folder);
 }
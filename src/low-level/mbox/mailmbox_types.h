@@ -82,6 +82,8 @@ struct mailmbox_folder {
 
   chash * mb_hash;
   carray * mb_tab;
+
+  char * mb_index_filename;
 };
 
 struct mailmbox_folder * mailmbox_folder_new(const char * mb_filename);
@@ -46,6 +46,8 @@
 #include "mailmime_types.h"
 #include "mmapstring.h"
 
+#include "carena_wrappers.h"
+
 #ifndef TRUE
 #define TRUE 1
 #endif
@@ -60,6 +60,8 @@
 #include "mmapstring.h"
 #include "mailimf.h"
 
+#include "carena_wrappers.h"
+
 #ifndef TRUE
 #define TRUE 1
 #endif
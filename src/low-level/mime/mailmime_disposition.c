@@ -45,6 +45,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "carena_wrappers.h"
+
 static int
 mailmime_disposition_parm_parse(const char * message, size_t length,
 				size_t * indx,
@@ -627,9 +629,13 @@ mailmime_extended_parm_parse(const char * message, size_t length,
                 }
             }
                                         
-            if (replace_str) {                         
-                built_str = replace_str;
-                replace_str = NULL;
+            if (replace_str) {
+                /* charconv() does not allocate from the arena */
+                free(built_str);
+                built_str = strdup(replace_str);
+                free(replace_str);
+                if (built_str == NULL)
+                    return MAILIMF_ERROR_MEMORY;
             }
         }        
     }
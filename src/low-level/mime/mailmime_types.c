@@ -43,6 +43,8 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "carena_wrappers.h"
+
 void mailmime_attribute_free(char * attribute)
 {
   mailmime_token_free(attribute);
@@ -53,6 +53,8 @@
 #	include "win_etpan.h"
 #endif
 
+#include "carena_wrappers.h"
+
 #define MIME_VERSION (1 << 16)
 
 int mailmime_transfer_encoding_get(struct mailmime_fields * fields)
@@ -91,7 +91,7 @@ int newsnntp_ssl_connect_with_callback(newsnntp * f, const char * server, uint16
   if (s == -1)
     return NEWSNNTP_ERROR_CONNECTION_REFUSED;
 
-  stream = mailstream_ssl_open_with_callback_timeout(s, f->nntp_timeout, callback, data);
+  stream = mailstream_ssl_open_with_host(s, server, port, f->nntp_timeout, callback, data);
   if (stream == NULL) {
 #ifdef WIN32
 	closesocket(s);
@@ -92,7 +92,7 @@ int mailpop3_ssl_connect_with_callback(mailpop3 * f, const char * server, uint16
   if (s == -1)
     return MAILPOP3_ERROR_CONNECTION_REFUSED;
 
-  stream = mailstream_ssl_open_with_callback_timeout(s, f->pop3_timeout, callback, data);
+  stream = mailstream_ssl_open_with_host(s, server, port, f->pop3_timeout, callback, data);
   if (stream == NULL) {
 #ifdef WIN32
 	closesocket(s);
@@ -93,7 +93,7 @@ int mailsmtp_ssl_connect_with_callback(mailsmtp * session,
   if (s == -1)
     return MAILSMTP_ERROR_CONNECTION_REFUSED;
 
-  stream = mailstream_ssl_open_with_callback_timeout(s, session->smtp_timeout, callback, data);
+  stream = mailstream_ssl_open_with_host(s, server, port, session->smtp_timeout, callback, data);
   if (stream == NULL) {
 #ifdef WIN32
 	closesocket(s);
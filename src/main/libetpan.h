@@ -62,6 +62,8 @@ extern int libetpan_cancel_read_write;
 #include <libetpan/mailsem.h>
 #include <libetpan/carray.h>
 #include <libetpan/chash.h>
+#include <libetpan/cohash.h>
+#include <libetpan/carena.h>
 #include <libetpan/maillock.h>
   
 /* mbox driver */
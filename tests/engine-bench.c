@@ -0,0 +1,375 @@
+#include <libetpan/libetpan.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+  engine-bench creates a maildir folder, registers it in a mail engine
+  and shows how many messages per second the reader threads reference
+  and release while a writer thread refreshes the list of messages of
+  the folder.
+*/
+
+#define DEFAULT_COUNT 5000
+#define DEFAULT_READERS 4
+#define DEFAULT_DURATION 2
+
+/* number of lookups between the checks of the end of the run */
+#define LOOKUPS_PER_CHECK 256
+
+struct bench {
+  struct mailengine * engine;
+  struct mailfolder * folder;
+  struct mailmessage_list * msg_list;
+  pthread_mutex_t lock;
+  int stop;
+};
+
+struct reader {
+  struct bench * bench;
+  pthread_t thread;
+  unsigned long count;
+};
+
+struct writer {
+  struct bench * bench;
+  pthread_t thread;
+  unsigned long count;
+  int error;
+};
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int should_stop(struct bench * bench)
+{
+  int stop;
+
+  pthread_mutex_lock(&bench->lock);
+  stop = bench->stop;
+  pthread_mutex_unlock(&bench->lock);
+
+  return stop;
+}
+
+static void set_stop(struct bench * bench, int stop)
+{
+  pthread_mutex_lock(&bench->lock);
+  bench->stop = stop;
+  pthread_mutex_unlock(&bench->lock);
+}
+
+/* room for the names of the files under a path of PATH_MAX */
+#define FILENAME_SIZE (PATH_MAX + 64)
+
+static int create_maildir(const char * path, unsigned int count)
+{
+  char filename[FILENAME_SIZE];
+  unsigned int i;
+  FILE * f;
+  int r;
+
+  r = snprintf(filename, sizeof(filename), "%s/cur", path);
+  if ((r < 0) || ((size_t) r >= sizeof(filename)))
+    return -1;
+  if (mkdir(filename, 0700) < 0)
+    return -1;
+  r = snprintf(filename, sizeof(filename), "%s/new", path);
+  if ((r < 0) || ((size_t) r >= sizeof(filename)))
+    return -1;
+  if (mkdir(filename, 0700) < 0)
+    return -1;
+  r = snprintf(filename, sizeof(filename), "%s/tmp", path);
+  if ((r < 0) || ((size_t) r >= sizeof(filename)))
+    return -1;
+  if (mkdir(filename, 0700) < 0)
+    return -1;
+
+  for(i = 0 ; i < count ; i ++) {
+    r = snprintf(filename, sizeof(filename), "%s/cur/%u.engine-bench:2,S",
+        path, i);
+    if ((r < 0) || ((size_t) r >= sizeof(filename)))
+      return -1;
+    f = fopen(filename, "w");
+    if (f == NULL)
+      return -1;
+    fprintf(f, "From: <bench@example.com>\r\n"
+        "Subject: message %u\r\n"
+        "\r\n"
+        "body of message %u\r\n", i, i);
+    fclose(f);
+  }
+
+  return 0;
+}
+
+static void remove_dir(const char * path)
+{
+  char filename[FILENAME_SIZE];
+  DIR * dir;
+  struct dirent * ent;
+  struct stat stat_info;
+  int r;
+
+  dir = opendir(path);
+  if (dir != NULL) {
+    while ((ent = readdir(dir)) != NULL) {
+      if ((strcmp(ent->d_name, ".") == 0) || (strcmp(ent->d_name, "..") == 0))
+        continue;
+      r = snprintf(filename, sizeof(filename), "%s/%s", path, ent->d_name);
+      if ((r < 0) || ((size_t) r >= sizeof(filename)))
+        continue;
+      if ((stat(filename, &stat_info) == 0) && S_ISDIR(stat_info.st_mode))
+        remove_dir(filename);
+      else
+        unlink(filename);
+    }
+    closedir(dir);
+  }
+  rmdir(path);
+}
+
+/* references and releases the messages of the folder */
+
+static void * reader_run(void * data)
+{
+  struct reader * reader;
+  struct bench * bench;
+  carray * msg_tab;
+  unsigned int i;
+
+  reader = data;
+  bench = reader->bench;
+  msg_tab = bench->msg_list->msg_tab;
+  i = 0;
+  while (!should_stop(bench)) {
+    unsigned int j;
+
+    for(j = 0 ; j < LOOKUPS_PER_CHECK ; j ++) {
+      mailmessage * msg;
+
+      msg = carray_get(msg_tab, i);
+      libetpan_message_ref(bench->engine, msg);
+      libetpan_message_unref(bench->engine, msg);
+      i ++;
+      if (i >= carray_count(msg_tab))
+        i = 0;
+    }
+    reader->count += LOOKUPS_PER_CHECK;
+  }
+
+  return NULL;
+}
+
+/* refreshes the list of messages of the folder */
+
+static void * writer_run(void * data)
+{
+  struct writer * writer;
+  struct bench * bench;
+
+  writer = data;
+  bench = writer->bench;
+  while (!should_stop(bench)) {
+    struct mailmessage_list * new_list;
+    struct mailmessage_list * lost_list;
+    int r;
+
+    r = libetpan_folder_get_msg_list(bench->engine, bench->folder,
+        &new_list, &lost_list);
+    if (r != MAIL_NO_ERROR) {
+      writer->error = r;
+      break;
+    }
+    /* the lost messages are still referenced by the previous lists */
+    carray_set_size(lost_list->msg_tab, 0);
+    mailmessage_list_free(lost_list);
+    libetpan_folder_free_msg_list(bench->engine, bench->folder, new_list);
+    writer->count ++;
+  }
+
+  return NULL;
+}
+
+static int run(struct bench * bench, unsigned int reader_count,
+    int with_writer, unsigned int duration)
+{
+  struct reader * readers;
+  struct writer writer;
+  unsigned long total;
+  unsigned int i;
+  double start;
+  double elapsed;
+
+  readers = calloc(reader_count, sizeof(* readers));
+  if (readers == NULL)
+    return -1;
+
+  set_stop(bench, 0);
+  writer.bench = bench;
+  writer.count = 0;
+  writer.error = MAIL_NO_ERROR;
+
+  start = now();
+  for(i = 0 ; i < reader_count ; i ++) {
+    readers[i].bench = bench;
+    pthread_create(&readers[i].thread, NULL, reader_run, &readers[i]);
+  }
+  if (with_writer)
+    pthread_create(&writer.thread, NULL, writer_run, &writer);
+
+  sleep(duration);
+  set_stop(bench, 1);
+
+  total = 0;
+  for(i = 0 ; i < reader_count ; i ++) {
+    pthread_join(readers[i].thread, NULL);
+    total += readers[i].count;
+  }
+  if (with_writer)
+    pthread_join(writer.thread, NULL);
+  elapsed = now() - start;
+
+  printf("%2u readers %-9s %12.1f lookups/s", reader_count,
+      with_writer ? "+ writer" : "", total / elapsed);
+  if (with_writer)
+    printf("  %8.1f refreshes/s", writer.count / elapsed);
+  printf("\n");
+  fflush(stdout);
+
+  free(readers);
+
+  if (writer.error != MAIL_NO_ERROR) {
+    fprintf(stderr, "could not refresh the folder: %i\n", writer.error);
+    return -1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char ** argv)
+{
+  struct bench bench;
+  struct mailstorage * storage;
+  struct mailmessage_list * lost_list;
+  char path[PATH_MAX];
+  const char * tmp_dir;
+  unsigned int count;
+  unsigned int reader_count;
+  unsigned int duration;
+  unsigned int i;
+  int r;
+
+  count = DEFAULT_COUNT;
+  reader_count = DEFAULT_READERS;
+  duration = DEFAULT_DURATION;
+  for(i = 1 ; i + 1 < (unsigned int) argc ; i += 2) {
+    if (strcmp(argv[i], "-n") == 0)
+      count = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "-t") == 0)
+      reader_count = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "-d") == 0)
+      duration = atoi(argv[i + 1]);
+    else
+      break;
+  }
+  if ((i != (unsigned int) argc) || (count == 0) || (reader_count == 0) ||
+      (duration == 0)) {
+    fprintf(stderr, "syntax: engine-bench [-n messages] [-t readers] [-d seconds]\n");
+    exit(EXIT_FAILURE);
+  }
+
+  tmp_dir = getenv("TMPDIR");
+  if (tmp_dir == NULL)
+    tmp_dir = "/tmp";
+  snprintf(path, sizeof(path), "%s/engine-bench-XXXXXX", tmp_dir);
+  if (mkdtemp(path) == NULL) {
+    fprintf(stderr, "could not create the maildir\n");
+    exit(EXIT_FAILURE);
+  }
+  if (create_maildir(path, count) < 0) {
+    fprintf(stderr, "could not create the maildir\n");
+    goto remove;
+  }
+
+  storage = mailstorage_new(NULL);
+  if (storage == NULL)
+    goto remove;
+  r = maildir_mailstorage_init(storage, path, 0, NULL, NULL);
+  if (r != MAIL_NO_ERROR)
+    goto free_storage;
+  bench.folder = mailfolder_new(storage, path, NULL);
+  if (bench.folder == NULL)
+    goto free_storage;
+
+  pthread_mutex_init(&bench.lock, NULL);
+  bench.engine = libetpan_engine_new(NULL);
+  if (bench.engine == NULL)
+    goto free_folder;
+  r = libetpan_storage_add(bench.engine, storage);
+  if (r != MAIL_NO_ERROR)
+    goto free_engine;
+  r = libetpan_folder_connect(bench.engine, bench.folder);
+  if (r != MAIL_NO_ERROR) {
+    fprintf(stderr, "could not open the maildir: %i\n", r);
+    goto remove_storage;
+  }
+
+  /* the messages stay referenced by this list during the benchmark */
+  r = libetpan_folder_get_msg_list(bench.engine, bench.folder,
+      &bench.msg_list, &lost_list);
+  if (r != MAIL_NO_ERROR)
+    goto disconnect;
+  carray_set_size(lost_list->msg_tab, 0);
+  mailmessage_list_free(lost_list);
+
+  printf("%u messages, %u s per run\n", count, duration);
+  fflush(stdout);
+
+  for(i = 1 ; i <= reader_count ; i *= 2) {
+    if (run(&bench, i, 0, duration) < 0)
+      goto free_list;
+    if (run(&bench, i, 1, duration) < 0)
+      goto free_list;
+    if ((i < reader_count) && (i * 2 > reader_count))
+      i = reader_count / 2;
+  }
+
+  libetpan_folder_free_msg_list(bench.engine, bench.folder, bench.msg_list);
+  libetpan_folder_disconnect(bench.engine, bench.folder);
+  libetpan_storage_remove(bench.engine, storage);
+  libetpan_engine_free(bench.engine);
+  mailfolder_free(bench.folder);
+  mailstorage_free(storage);
+  remove_dir(path);
+
+  exit(EXIT_SUCCESS);
+
+ free_list:
+  libetpan_folder_free_msg_list(bench.engine, bench.folder, bench.msg_list);
+ disconnect:
+  libetpan_folder_disconnect(bench.engine, bench.folder);
+ remove_storage:
+  libetpan_storage_remove(bench.engine, storage);
+ free_engine:
+  libetpan_engine_free(bench.engine);
+ free_folder:
+  mailfolder_free(bench.folder);
+ free_storage:
+  mailstorage_free(storage);
+ remove:
+  remove_dir(path);
+  exit(EXIT_FAILURE);
+}
@@ -0,0 +1,253 @@
+#include <libetpan/libetpan.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+  hash-bench compares chash and cohash: insertion, successful and
+  failed lookups, and deletion of integer keys and of string keys.
+*/
+
+#define DEFAULT_COUNT 1000000
+
+struct bench_ops {
+  const char * name;
+  void * (* new)(unsigned int count);
+  void (* free)(void * hash);
+  int (* set)(void * hash, chashdatum * key, chashdatum * value);
+  int (* get)(void * hash, chashdatum * key, chashdatum * result);
+  int (* delete)(void * hash, chashdatum * key);
+};
+
+/* chash and cohash grow from the default size, only the reserve
+   variant is created for count elements */
+
+static void * bench_chash_new(unsigned int count)
+{
+  (void) count;
+  return chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
+}
+
+static void bench_chash_free(void * hash)
+{
+  chash_free(hash);
+}
+
+static int bench_chash_set(void * hash, chashdatum * key, chashdatum * value)
+{
+  return chash_set(hash, key, value, NULL);
+}
+
+static int bench_chash_get(void * hash, chashdatum * key, chashdatum * result)
+{
+  return chash_get(hash, key, result);
+}
+
+static int bench_chash_delete(void * hash, chashdatum * key)
+{
+  return chash_delete(hash, key, NULL);
+}
+
+static void * bench_cohash_new(unsigned int count)
+{
+  (void) count;
+  return cohash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
+}
+
+static void * bench_cohash_reserve_new(unsigned int count)
+{
+  return cohash_new(count, CHASH_COPYKEY);
+}
+
+static void bench_cohash_free(void * hash)
+{
+  cohash_free(hash);
+}
+
+static int bench_cohash_set(void * hash, chashdatum * key, chashdatum * value)
+{
+  return cohash_set(hash, key, value, NULL);
+}
+
+static int bench_cohash_get(void * hash, chashdatum * key, chashdatum * result)
+{
+  return cohash_get(hash, key, result);
+}
+
+static int bench_cohash_delete(void * hash, chashdatum * key)
+{
+  return cohash_delete(hash, key, NULL);
+}
+
+static struct bench_ops ops_tab[] = {
+  { "chash", bench_chash_new, bench_chash_free,
+    bench_chash_set, bench_chash_get, bench_chash_delete },
+  { "cohash", bench_cohash_new, bench_cohash_free,
+    bench_cohash_set, bench_cohash_get, bench_cohash_delete },
+  { "cohash+r", bench_cohash_reserve_new, bench_cohash_free,
+    bench_cohash_set, bench_cohash_get, bench_cohash_delete },
+};
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/*
+  keys from 0 to count - 1 are inserted, keys from count to
+  2 * count - 1 are the failed lookups
+*/
+
+static void make_key(int strings, uint32_t * numbers, char ** strs,
+    unsigned int i, chashdatum * key)
+{
+  if (strings) {
+    key->data = strs[i];
+    key->len = strlen(strs[i]);
+  }
+  else {
+    key->data = &numbers[i];
+    key->len = sizeof(numbers[i]);
+  }
+}
+
+static int run(struct bench_ops * ops, int strings, unsigned int count,
+    uint32_t * numbers, char ** strs)
+{
+  void * hash;
+  unsigned int i;
+  unsigned int found;
+  double t0, t1, t2, t3, t4;
+
+  hash = ops->new(count);
+  if (hash == NULL)
+    return -1;
+
+  t0 = now();
+  for(i = 0 ; i < count ; i ++) {
+    chashdatum key;
+    chashdatum value;
+
+    make_key(strings, numbers, strs, i, &key);
+    value.data = strs[i];
+    value.len = 0;
+    if (ops->set(hash, &key, &value) < 0) {
+      ops->free(hash);
+      return -1;
+    }
+  }
+  t1 = now();
+
+  found = 0;
+  for(i = 0 ; i < count ; i ++) {
+    chashdatum key;
+    chashdatum value;
+
+    make_key(strings, numbers, strs, i, &key);
+    if ((ops->get(hash, &key, &value) == 0) && (value.data == strs[i]))
+      found ++;
+  }
+  t2 = now();
+
+  for(i = count ; i < 2 * count ; i ++) {
+    chashdatum key;
+    chashdatum value;
+
+    make_key(strings, numbers, strs, i, &key);
+    if (ops->get(hash, &key, &value) == 0)
+      found ++;
+  }
+  t3 = now();
+
+  for(i = 0 ; i < count ; i ++) {
+    chashdatum key;
+
+    make_key(strings, numbers, strs, i, &key);
+    ops->delete(hash, &key);
+  }
+  t4 = now();
+
+  ops->free(hash);
+
+  if (found != count) {
+    fprintf(stderr, "%s: %u keys found instead of %u\n", ops->name,
+        found, count);
+    return -1;
+  }
+
+  printf("%-8s %-6s %8.1f %8.1f %8.1f %8.1f\n", ops->name,
+      strings ? "string" : "int",
+      (t1 - t0) * 1e9 / count, (t2 - t1) * 1e9 / count,
+      (t3 - t2) * 1e9 / count, (t4 - t3) * 1e9 / count);
+
+  return 0;
+}
+
+int main(int argc, char ** argv)
+{
+  unsigned int count;
+  unsigned int i;
+  unsigned int j;
+  uint32_t * numbers;
+  char ** strs;
+  uint32_t seed;
+  int strings;
+  int res;
+
+  count = DEFAULT_COUNT;
+  if ((argc > 2) && (strcmp(argv[1], "-n") == 0)) {
+    count = atoi(argv[2]);
+    if (count == 0)
+      count = 1;
+  }
+  else if (argc != 1) {
+    fprintf(stderr, "syntax: hash-bench [-n count]\n");
+    exit(EXIT_FAILURE);
+  }
+
+  res = EXIT_FAILURE;
+  numbers = malloc(2 * count * sizeof(* numbers));
+  strs = calloc(2 * count, sizeof(* strs));
+  if ((numbers == NULL) || (strs == NULL))
+    goto free;
+
+  /* distinct scattered numbers, and message-id like strings */
+  seed = 2463534242U;
+  for(i = 0 ; i < 2 * count ; i ++) {
+    char buffer[64];
+
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    numbers[i] = i * 2654435761U;
+    snprintf(buffer, sizeof(buffer), "<%08x.%u@mail.example.org>", seed, i);
+    strs[i] = strdup(buffer);
+    if (strs[i] == NULL)
+      goto free;
+  }
+
+  printf("%u keys, ns per operation\n", count);
+  printf("%-8s %-6s %8s %8s %8s %8s\n", "", "keys", "insert", "hit",
+      "miss", "delete");
+  for(strings = 0 ; strings <= 1 ; strings ++) {
+    for(j = 0 ; j < sizeof(ops_tab) / sizeof(ops_tab[0]) ; j ++) {
+      if (run(&ops_tab[j], strings, count, numbers, strs) < 0)
+        goto free;
+    }
+  }
+  res = EXIT_SUCCESS;
+
+ free:
+  if (strs != NULL) {
+    for(i = 0 ; i < 2 * count ; i ++)
+      free(strs[i]);
+    free(strs);
+  }
+  free(numbers);
+  exit(res);
+}
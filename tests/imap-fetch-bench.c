@@ -0,0 +1,367 @@
+#include <libetpan/libetpan.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+  imap-fetch-bench replays a recorded IMAP server transcript of FETCH
+  responses as the reply to a UID FETCH command and shows how many
+  responses per second are parsed.
+*/
+
+#define DEFAULT_ROUNDS 20
+
+struct replay {
+  const char * data;
+  size_t length;
+  size_t pos;
+};
+
+static ssize_t replay_read(mailstream_low * s, void * buf, size_t count)
+{
+  struct replay * replay;
+
+  replay = s->data;
+  if (count > replay->length - replay->pos)
+    count = replay->length - replay->pos;
+  memcpy(buf, replay->data + replay->pos, count);
+  replay->pos += count;
+
+  return count;
+}
+
+static ssize_t replay_write(mailstream_low * s, const void * buf, size_t count)
+{
+  (void) s;
+  (void) buf;
+  return count;
+}
+
+static int replay_close(mailstream_low * s)
+{
+  (void) s;
+  return 0;
+}
+
+static int replay_get_fd(mailstream_low * s)
+{
+  (void) s;
+  return -1;
+}
+
+static void replay_free(mailstream_low * s)
+{
+  free(s);
+}
+
+static void replay_cancel(mailstream_low * s)
+{
+  (void) s;
+}
+
+static struct mailstream_cancel * replay_get_cancel(mailstream_low * s)
+{
+  (void) s;
+  return NULL;
+}
+
+static mailstream_low_driver replay_driver = {
+  /* mailstream_read */ replay_read,
+  /* mailstream_write */ replay_write,
+  /* mailstream_close */ replay_close,
+  /* mailstream_get_fd */ replay_get_fd,
+  /* mailstream_free */ replay_free,
+  /* mailstream_cancel */ replay_cancel,
+  /* mailstream_get_cancel */ replay_get_cancel,
+  /* mailstream_get_certificate_chain */ NULL,
+  /* mailstream_setup_idle */ NULL,
+  /* mailstream_unsetup_idle */ NULL,
+  /* mailstream_interrupt_idle */ NULL,
+};
+
+static const char * flag_names[] = {
+  "\\Seen", "\\Answered", "\\Flagged", "$Forwarded", "\\Draft", "$Junk",
+};
+
+static const char * month_names[] = {
+  "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+  "Jul", "Aug", "Sep", "Oct", "Nov", "Dec",
+};
+
+/* writes a transcript similar to the flags synchronization of a folder */
+
+static void generate(unsigned int count)
+{
+  unsigned int i;
+  unsigned int j;
+
+  for(i = 1 ; i <= count ; i ++) {
+    printf("* %u FETCH (UID %u FLAGS (", i, i * 3);
+    for(j = 0 ; j < sizeof(flag_names) / sizeof(flag_names[0]) ; j ++) {
+      if (((i >> j) & 1) == 0)
+        continue;
+      if ((i & ((1 << j) - 1)) != 0)
+        printf(" ");
+      printf("%s", flag_names[j]);
+    }
+    printf(") RFC822.SIZE %u INTERNALDATE \"%2u-%s-20%02u %02u:%02u:%02u %c%04u\""
+        " MODSEQ (%llu))\r\n",
+        1000 + (i * 7919) % 200000, 1 + i % 28, month_names[i % 12],
+        i % 25, i % 24, i % 60, (i * 7) % 60, (i & 1) ? '+' : '-',
+        (i % 13) * 100, 100000000000ULL + i);
+  }
+  printf("A1 OK FETCH completed\r\n");
+}
+
+static char * load(const char * filename, size_t * result_length)
+{
+  FILE * f;
+  struct stat stat_info;
+  char * data;
+  size_t length;
+  size_t last_line;
+
+  if (stat(filename, &stat_info) != 0)
+    return NULL;
+
+  f = fopen(filename, "r");
+  if (f == NULL)
+    return NULL;
+
+  /* room for the tagged response */
+  data = malloc(stat_info.st_size + 32);
+  if (data == NULL) {
+    fclose(f);
+    return NULL;
+  }
+  length = fread(data, 1, stat_info.st_size, f);
+  fclose(f);
+
+  if ((length > 0) && (data[length - 1] != '\n')) {
+    memcpy(data + length, "\r\n", 2);
+    length += 2;
+  }
+
+  /*
+    the tagged response of the transcript is replaced with one
+    matching the tag of the replayed command, see main()
+  */
+  last_line = length;
+  if (last_line > 0)
+    last_line --;
+  while ((last_line > 0) && (data[last_line - 1] != '\n'))
+    last_line --;
+  if ((length > 0) && (data[last_line] != '*'))
+    length = last_line;
+  memcpy(data + length, "1 OK FETCH completed\r\n", 22);
+  length += 22;
+
+  * result_length = length;
+
+  return data;
+}
+
+static unsigned long long checksum_msg_att(struct mailimap_msg_att * msg_att)
+{
+  clistiter * cur;
+  clistiter * cur_flag;
+  unsigned long long sum;
+
+  sum = 0;
+  for(cur = clist_begin(msg_att->att_list) ; cur != NULL ;
+      cur = clist_next(cur)) {
+    struct mailimap_msg_att_item * item;
+
+    item = clist_content(cur);
+    switch (item->att_type) {
+    case MAILIMAP_MSG_ATT_ITEM_STATIC:
+      switch (item->att_data.att_static->att_type) {
+      case MAILIMAP_MSG_ATT_UID:
+        sum += item->att_data.att_static->att_data.att_uid;
+        break;
+      case MAILIMAP_MSG_ATT_RFC822_SIZE:
+        sum += item->att_data.att_static->att_data.att_rfc822_size;
+        break;
+      case MAILIMAP_MSG_ATT_INTERNALDATE: {
+        struct mailimap_date_time * date_time;
+
+        date_time = item->att_data.att_static->att_data.att_internal_date;
+        sum += date_time->dt_day + date_time->dt_month * 31 +
+          date_time->dt_year * 372 + date_time->dt_hour +
+          date_time->dt_min + date_time->dt_sec + date_time->dt_zone;
+        break;
+      }
+      }
+      break;
+
+    case MAILIMAP_MSG_ATT_ITEM_DYNAMIC:
+      if (item->att_data.att_dyn->att_list == NULL)
+        break;
+      for(cur_flag = clist_begin(item->att_data.att_dyn->att_list) ;
+          cur_flag != NULL ; cur_flag = clist_next(cur_flag)) {
+        struct mailimap_flag_fetch * flag_fetch;
+
+        flag_fetch = clist_content(cur_flag);
+        sum += 1000;
+        if (flag_fetch->fl_type == MAILIMAP_FLAG_FETCH_OTHER) {
+          sum += flag_fetch->fl_flag->fl_type;
+          if (flag_fetch->fl_flag->fl_type == MAILIMAP_FLAG_KEYWORD)
+            sum += strlen(flag_fetch->fl_flag->fl_data.fl_keyword);
+        }
+      }
+      break;
+
+    case MAILIMAP_MSG_ATT_ITEM_EXTENSION:
+      if ((item->att_data.att_extension_data->ext_extension ==
+            &mailimap_extension_condstore) &&
+          (item->att_data.att_extension_data->ext_type ==
+            MAILIMAP_CONDSTORE_TYPE_FETCH_DATA)) {
+        struct mailimap_condstore_fetch_mod_resp * fetch_data;
+
+        fetch_data = item->att_data.att_extension_data->ext_data;
+        sum += fetch_data->cs_modseq_value;
+      }
+      break;
+    }
+  }
+
+  return sum;
+}
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int main(int argc, char ** argv)
+{
+  unsigned int rounds;
+  unsigned int round;
+  unsigned long responses;
+  unsigned long long checksum;
+  struct replay replay;
+  mailstream_low * low;
+  mailimap * imap;
+  struct mailimap_set * set;
+  struct mailimap_fetch_type * fetch_type;
+  char * data;
+  double start;
+  double duration;
+  int i;
+  int r;
+
+  rounds = DEFAULT_ROUNDS;
+  i = 1;
+  if ((argc > 2) && (strcmp(argv[1], "-g") == 0)) {
+    generate(atoi(argv[2]));
+    exit(EXIT_SUCCESS);
+  }
+  if ((argc > 2) && (strcmp(argv[1], "-n") == 0)) {
+    rounds = atoi(argv[2]);
+    if (rounds == 0)
+      rounds = 1;
+    i = 3;
+  }
+
+  if (i != argc - 1) {
+    fprintf(stderr, "syntax: imap-fetch-bench [-n rounds] transcript\n");
+    fprintf(stderr, "        imap-fetch-bench -g count > transcript\n");
+    exit(EXIT_FAILURE);
+  }
+
+  data = load(argv[i], &replay.length);
+  if (data == NULL) {
+    fprintf(stderr, "could not read %s\n", argv[i]);
+    exit(EXIT_FAILURE);
+  }
+  replay.data = data;
+  replay.pos = 0;
+
+  imap = mailimap_new(0, NULL);
+  if (imap == NULL)
+    goto err;
+  low = mailstream_low_new(&replay, &replay_driver);
+  if (low == NULL)
+    goto free_imap;
+  imap->imap_stream = mailstream_new(low, 8192);
+  if (imap->imap_stream == NULL) {
+    mailstream_low_free(low);
+    goto free_imap;
+  }
+  imap->imap_state = MAILIMAP_STATE_SELECTED;
+  imap->imap_selection_info = mailimap_selection_info_new();
+  if (imap->imap_selection_info == NULL)
+    goto free_imap;
+
+  set = mailimap_set_new_interval(1, 0);
+  fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
+  mailimap_fetch_type_new_fetch_att_list_add(fetch_type,
+      mailimap_fetch_att_new_uid());
+  mailimap_fetch_type_new_fetch_att_list_add(fetch_type,
+      mailimap_fetch_att_new_flags());
+  mailimap_fetch_type_new_fetch_att_list_add(fetch_type,
+      mailimap_fetch_att_new_rfc822_size());
+  mailimap_fetch_type_new_fetch_att_list_add(fetch_type,
+      mailimap_fetch_att_new_internaldate());
+
+  responses = 0;
+  checksum = 0;
+  start = now();
+  for(round = 0 ; round < rounds ; round ++) {
+    clist * fetch_list;
+    clistiter * cur;
+
+    replay.pos = 0;
+    /* the command is sent with the tag "1" */
+    imap->imap_tag = 0;
+    r = mailimap_uid_fetch(imap, set, fetch_type, &fetch_list);
+    if (r != MAILIMAP_NO_ERROR) {
+      fprintf(stderr, "could not parse transcript: %i\n", r);
+      goto free_fetch;
+    }
+
+    for(cur = clist_begin(fetch_list) ; cur != NULL ; cur = clist_next(cur)) {
+      if (round == 0)
+        checksum += checksum_msg_att(clist_content(cur));
+      responses ++;
+    }
+    mailimap_fetch_list_free(fetch_list);
+  }
+  duration = now() - start;
+
+  printf("%lu responses, %lu bytes, %u rounds\n", responses / rounds,
+      (unsigned long) replay.length, rounds);
+  printf("checksum %016llx\n", checksum);
+  printf("%8.3f s  %10.1f responses/s  %8.1f MB/s\n", duration,
+      responses / duration,
+      (double) replay.length * rounds / (1024 * 1024) / duration);
+
+  mailimap_fetch_type_free(fetch_type);
+  mailimap_set_free(set);
+  mailstream_close(imap->imap_stream);
+  imap->imap_stream = NULL;
+  mailimap_free(imap);
+  free(data);
+
+  exit(EXIT_SUCCESS);
+
+ free_fetch:
+  mailimap_fetch_type_free(fetch_type);
+  mailimap_set_free(set);
+ free_imap:
+  if (imap->imap_stream != NULL) {
+    mailstream_close(imap->imap_stream);
+    imap->imap_stream = NULL;
+  }
+  mailimap_free(imap);
+ err:
+  free(data);
+  exit(EXIT_FAILURE);
+}
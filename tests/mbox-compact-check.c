@@ -0,0 +1,250 @@
+#include <libetpan/libetpan.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+/*
+  mbox-compact-check deletes a small message near the beginning of a
+  large mailbox and checks that the expunge compacted the mailbox in
+  place (the file keeps its inode, it is not rewritten to a temporary
+  file) and that the remaining messages are intact.
+*/
+
+#define DEFAULT_SIZE 300
+#define SMALL_COUNT 4
+#define DELETED_UID 2
+#define LARGE_MESSAGE_SIZE (1024 * 1024)
+#define LINE_SIZE 64
+
+static int write_message(FILE * f, unsigned int index, size_t size)
+{
+  char line[LINE_SIZE + 1];
+  size_t written;
+  unsigned int i;
+
+  if (fprintf(f, "From sender@example.org Mon Jan  6 10:00:00 2020\n"
+          "From: sender@example.org\n"
+          "To: recipient@example.org\n"
+          "Subject: message %u\n"
+          "\n", index) < 0)
+    return 0;
+
+  for(i = 0 ; i < LINE_SIZE - 1 ; i ++)
+    line[i] = 'a' + (index + i) % 26;
+  line[LINE_SIZE - 1] = '\n';
+  line[LINE_SIZE] = '\0';
+
+  for(written = 0 ; written < size ; written += LINE_SIZE)
+    if (fputs(line, f) < 0)
+      return 0;
+
+  if (fputs("\n", f) < 0)
+    return 0;
+
+  return 1;
+}
+
+static int build_mailbox(const char * filename, unsigned int large_count)
+{
+  FILE * f;
+  unsigned int i;
+  int res;
+
+  f = fopen(filename, "w");
+  if (f == NULL) {
+    perror(filename);
+    return 0;
+  }
+
+  res = 0;
+  for(i = 0 ; i < SMALL_COUNT ; i ++)
+    if (!write_message(f, i + 1, LINE_SIZE))
+      goto close;
+  for(i = 0 ; i < large_count ; i ++)
+    if (!write_message(f, SMALL_COUNT + i + 1, LARGE_MESSAGE_SIZE))
+      goto close;
+
+  res = 1;
+
+ close:
+  if (fclose(f) != 0)
+    res = 0;
+  if (!res)
+    fprintf(stderr, "%s: could not write the mailbox\n", filename);
+
+  return res;
+}
+
+static int check_message(struct mailmbox_folder * folder, uint32_t uid,
+    unsigned int index)
+{
+  char subject[64];
+  char * data;
+  size_t len;
+  size_t subject_len;
+  size_t i;
+  int found;
+  int r;
+
+  r = mailmbox_fetch_msg_headers(folder, uid, &data, &len);
+  if (r != MAILMBOX_NO_ERROR) {
+    fprintf(stderr, "could not fetch message %u: %i\n", uid, r);
+    return 0;
+  }
+
+  snprintf(subject, sizeof(subject), "Subject: message %u\n", index);
+  subject_len = strlen(subject);
+  found = 0;
+  for(i = 0 ; i + subject_len <= len ; i ++) {
+    if (((i == 0) || (data[i - 1] == '\n')) &&
+        (memcmp(data + i, subject, subject_len) == 0)) {
+      found = 1;
+      break;
+    }
+  }
+  mailmbox_fetch_result_free(data);
+
+  if (!found) {
+    fprintf(stderr, "message %u is not message %u of the mailbox\n",
+        uid, index);
+    return 0;
+  }
+
+  return 1;
+}
+
+static int check_compact(const char * filename, unsigned int large_count)
+{
+  struct mailmbox_folder * folder;
+  struct mailmbox_msg_info * info;
+  struct stat stat_before;
+  struct stat stat_after;
+  unsigned int count;
+  unsigned int i;
+  size_t deleted_size;
+  int res;
+  int r;
+
+  if (!build_mailbox(filename, large_count))
+    return 0;
+
+  res = 0;
+  r = mailmbox_init(filename, 0, 1, 0, &folder);
+  if (r != MAILMBOX_NO_ERROR) {
+    fprintf(stderr, "could not open the mailbox: %i\n", r);
+    goto unlink;
+  }
+
+  count = carray_count(folder->mb_tab);
+  if (count != SMALL_COUNT + large_count) {
+    fprintf(stderr, "%u messages found instead of %u\n",
+        count, SMALL_COUNT + large_count);
+    goto done;
+  }
+
+  info = carray_get(folder->mb_tab, DELETED_UID - 1);
+  deleted_size = ((struct mailmbox_msg_info *)
+      carray_get(folder->mb_tab, DELETED_UID))->msg_start - info->msg_start;
+
+  if (stat(filename, &stat_before) < 0) {
+    perror(filename);
+    goto done;
+  }
+
+  r = mailmbox_delete_msg(folder, DELETED_UID);
+  if (r != MAILMBOX_NO_ERROR) {
+    fprintf(stderr, "could not delete message %u: %i\n", DELETED_UID, r);
+    goto done;
+  }
+  r = mailmbox_expunge(folder);
+  if (r != MAILMBOX_NO_ERROR) {
+    fprintf(stderr, "expunge failed: %i\n", r);
+    goto done;
+  }
+  mailmbox_done(folder);
+  folder = NULL;
+
+  if (stat(filename, &stat_after) < 0) {
+    perror(filename);
+    goto unlink;
+  }
+  if ((stat_after.st_ino != stat_before.st_ino) ||
+      (stat_after.st_dev != stat_before.st_dev)) {
+    fprintf(stderr, "the mailbox was rewritten instead of compacted\n");
+    goto unlink;
+  }
+  if (stat_after.st_size != stat_before.st_size - (off_t) deleted_size) {
+    fprintf(stderr, "the size of the mailbox is %lli instead of %lli\n",
+        (long long) stat_after.st_size,
+        (long long) (stat_before.st_size - deleted_size));
+    goto unlink;
+  }
+
+  r = mailmbox_init(filename, 0, 1, 0, &folder);
+  if (r != MAILMBOX_NO_ERROR) {
+    fprintf(stderr, "could not open the compacted mailbox: %i\n", r);
+    goto unlink;
+  }
+
+  count = carray_count(folder->mb_tab);
+  if (count != SMALL_COUNT + large_count - 1) {
+    fprintf(stderr, "%u messages found after the expunge instead of %u\n",
+        count, SMALL_COUNT + large_count - 1);
+    goto done;
+  }
+  for(i = 0 ; i < count ; i ++) {
+    unsigned int index;
+
+    index = i + 1;
+    if (index >= DELETED_UID)
+      index ++;
+    info = carray_get(folder->mb_tab, i);
+    if (!check_message(folder, info->msg_uid, index))
+      goto done;
+  }
+
+  res = 1;
+
+ done:
+  if (folder != NULL)
+    mailmbox_done(folder);
+ unlink:
+  unlink(filename);
+
+  return res;
+}
+
+int main(int argc, char ** argv)
+{
+  char filename[PATH_MAX];
+  const char * tmpdir;
+  unsigned int size;
+
+  size = DEFAULT_SIZE;
+  if ((argc > 2) && (strcmp(argv[1], "-s") == 0)) {
+    size = atoi(argv[2]);
+    if (size == 0)
+      size = 1;
+  }
+  else if (argc != 1) {
+    fprintf(stderr, "syntax: mbox-compact-check [-s megabytes]\n");
+    exit(EXIT_FAILURE);
+  }
+
+  tmpdir = getenv("TMPDIR");
+  if (tmpdir == NULL)
+    tmpdir = "/tmp";
+  snprintf(filename, sizeof(filename), "%s/mbox-compact-check-%lu",
+      tmpdir, (unsigned long) getpid());
+
+  if (!check_compact(filename, size))
+    exit(EXIT_FAILURE);
+
+  printf("ok\n");
+
+  exit(EXIT_SUCCESS);
+}
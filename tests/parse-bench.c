@@ -0,0 +1,266 @@
+#include <libetpan/libetpan.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+  parse-bench parses the MIME structure of all the messages given
+  on the command line (files, or directories containing one message
+  per file such as maildir/cur or MH folders) and compares the heap
+  allocation with the arena allocation.
+*/
+
+#define DEFAULT_ROUNDS 10
+
+struct message {
+  char * data;
+  size_t length;
+};
+
+static struct message * msg_tab = NULL;
+static unsigned int msg_count = 0;
+static unsigned int msg_size = 0;
+static size_t total_length = 0;
+
+static int add_file(const char * filename)
+{
+  FILE * f;
+  struct stat stat_info;
+  char * data;
+
+  if (stat(filename, &stat_info) != 0)
+    return -1;
+  if (!S_ISREG(stat_info.st_mode) || (stat_info.st_size == 0))
+    return 0;
+
+  f = fopen(filename, "r");
+  if (f == NULL)
+    return -1;
+
+  data = malloc(stat_info.st_size);
+  if (data == NULL) {
+    fclose(f);
+    return -1;
+  }
+  if (fread(data, 1, stat_info.st_size, f) != (size_t) stat_info.st_size) {
+    free(data);
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+
+  if (msg_count >= msg_size) {
+    struct message * new_tab;
+    unsigned int new_size;
+
+    new_size = (msg_size == 0) ? 256 : msg_size * 2;
+    new_tab = realloc(msg_tab, new_size * sizeof(* msg_tab));
+    if (new_tab == NULL) {
+      free(data);
+      return -1;
+    }
+    msg_tab = new_tab;
+    msg_size = new_size;
+  }
+
+  msg_tab[msg_count].data = data;
+  msg_tab[msg_count].length = stat_info.st_size;
+  msg_count ++;
+  total_length += stat_info.st_size;
+
+  return 0;
+}
+
+static int add_path(const char * path)
+{
+  struct stat stat_info;
+  DIR * dir;
+  struct dirent * ent;
+
+  if (stat(path, &stat_info) != 0)
+    return -1;
+
+  if (!S_ISDIR(stat_info.st_mode))
+    return add_file(path);
+
+  dir = opendir(path);
+  if (dir == NULL)
+    return -1;
+
+  while ((ent = readdir(dir)) != NULL) {
+    char filename[PATH_MAX];
+
+    if (ent->d_name[0] == '.')
+      continue;
+
+    snprintf(filename, sizeof(filename), "%s/%s", path, ent->d_name);
+    if (add_file(filename) < 0) {
+      closedir(dir);
+      return -1;
+    }
+  }
+  closedir(dir);
+
+  return 0;
+}
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static double bench_heap(unsigned int rounds)
+{
+  unsigned int round;
+  unsigned int i;
+  double start;
+
+  start = now();
+  for(round = 0 ; round < rounds ; round ++) {
+    for(i = 0 ; i < msg_count ; i ++) {
+      struct mailmime * mime;
+      size_t cur_token;
+      int r;
+
+      cur_token = 0;
+      r = mailmime_parse(msg_tab[i].data, msg_tab[i].length,
+          &cur_token, &mime);
+      if (r == MAILIMF_NO_ERROR)
+        mailmime_free(mime);
+    }
+  }
+
+  return now() - start;
+}
+
+static double bench_arena(unsigned int rounds,
+    unsigned long * p_allocations, size_t * p_bytes, unsigned int * p_blocks)
+{
+  unsigned int round;
+  unsigned int i;
+  double start;
+  carena * arena;
+  carena * old;
+  unsigned long allocations;
+  size_t bytes;
+  unsigned int blocks;
+
+  allocations = 0;
+  bytes = 0;
+  blocks = 0;
+
+  arena = carena_new(0);
+  if (arena == NULL)
+    return -1;
+
+  start = now();
+  for(round = 0 ; round < rounds ; round ++) {
+    for(i = 0 ; i < msg_count ; i ++) {
+      struct mailmime * mime;
+      size_t cur_token;
+
+      cur_token = 0;
+      old = carena_set_current(arena);
+      mailmime_parse(msg_tab[i].data, msg_tab[i].length,
+          &cur_token, &mime);
+      carena_set_current(old);
+
+      if (round == 0) {
+        allocations += arena->allocations;
+        bytes += arena->bytes;
+        blocks += arena->blocks;
+      }
+
+      /* the whole tree is released at once */
+      carena_reset(arena);
+    }
+  }
+  start = now() - start;
+
+  carena_free(arena);
+
+  * p_allocations = allocations;
+  * p_bytes = bytes;
+  * p_blocks = blocks;
+
+  return start;
+}
+
+static void report(const char * name, double duration, unsigned int rounds)
+{
+  double mb;
+
+  mb = (double) total_length * rounds / (1024 * 1024);
+  printf("%-6s %8.3f s  %10.1f msg/s  %8.1f MB/s\n", name, duration,
+      msg_count * rounds / duration, mb / duration);
+}
+
+int main(int argc, char ** argv)
+{
+  unsigned int rounds;
+  int i;
+  unsigned long allocations;
+  size_t bytes;
+  unsigned int blocks;
+  double heap_duration;
+  double arena_duration;
+
+  rounds = DEFAULT_ROUNDS;
+  i = 1;
+  if ((argc > 2) && (strcmp(argv[1], "-n") == 0)) {
+    rounds = atoi(argv[2]);
+    if (rounds == 0)
+      rounds = 1;
+    i = 3;
+  }
+
+  if (i >= argc) {
+    fprintf(stderr, "syntax: parse-bench [-n rounds] [file or directory] ...\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for( ; i < argc ; i ++) {
+    if (add_path(argv[i]) < 0) {
+      fprintf(stderr, "could not read %s\n", argv[i]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (msg_count == 0) {
+    fprintf(stderr, "no message found\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* warm up the page cache and the allocator */
+  bench_heap(1);
+
+  heap_duration = bench_heap(rounds);
+  arena_duration = bench_arena(rounds, &allocations, &bytes, &blocks);
+  if (arena_duration < 0) {
+    fprintf(stderr, "could not create arena\n");
+    exit(EXIT_FAILURE);
+  }
+
+  printf("%u messages, %lu bytes, %u rounds\n", msg_count,
+      (unsigned long) total_length, rounds);
+  printf("allocations per message: %.1f (%.0f bytes)\n",
+      (double) allocations / msg_count, (double) bytes / msg_count);
+  printf("arena blocks per message: %.2f\n", (double) blocks / msg_count);
+  report("heap", heap_duration, rounds);
+  report("arena", arena_duration, rounds);
+
+  for(i = 0 ; i < (int) msg_count ; i ++)
+    free(msg_tab[i].data);
+  free(msg_tab);
+
+  exit(EXIT_SUCCESS);
+}
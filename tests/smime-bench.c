@@ -0,0 +1,265 @@
+#include <libetpan/libetpan.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+  smime-bench signs and encrypts a message, then decrypts and verifies
+  it, with the openssl command backend and with the in-process CMS
+  backend of mailprivacy_smime, and shows the messages per second of
+  each backend.
+
+  The certificate and the private key (without passphrase) of the
+  address must be stored in the directories, as
+  [email-address]-cert.pem and [email-address]-private-key.pem.
+*/
+
+#define DEFAULT_ROUNDS 50
+#define BODY_LINES 64
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static MMAPString * generate(const char * email)
+{
+  MMAPString * str;
+  unsigned int i;
+  char line[128];
+
+  str = mmap_string_new("");
+  if (str == NULL)
+    return NULL;
+
+  snprintf(line, sizeof(line), "From: <%s>\r\nTo: <%s>\r\n", email, email);
+  mmap_string_append(str, line);
+  mmap_string_append(str, "Subject: S/MIME benchmark\r\n"
+      "MIME-Version: 1.0\r\n"
+      "Content-Type: text/plain; charset=us-ascii\r\n"
+      "\r\n");
+  for(i = 0 ; i < BODY_LINES ; i ++) {
+    snprintf(line, sizeof(line),
+        "line %u of the message that is signed and encrypted\r\n", i);
+    mmap_string_append(str, line);
+  }
+
+  return str;
+}
+
+static int has_part(struct mailmime * mime, const char * subtype)
+{
+  clistiter * cur;
+
+  if ((mime->mm_content_type != NULL) &&
+      (strcasecmp(mime->mm_content_type->ct_subtype, subtype) == 0))
+    return 1;
+
+  switch (mime->mm_type) {
+  case MAILMIME_MULTIPLE:
+    for(cur = clist_begin(mime->mm_data.mm_multipart.mm_mp_list) ;
+        cur != NULL ; cur = clist_next(cur)) {
+      if (has_part(clist_content(cur), subtype))
+        return 1;
+    }
+    break;
+  case MAILMIME_MESSAGE:
+    if (mime->mm_data.mm_message.mm_msg_mime != NULL)
+      return has_part(mime->mm_data.mm_message.mm_msg_mime, subtype);
+    break;
+  }
+
+  return 0;
+}
+
+/* returns the signed and encrypted message */
+
+static MMAPString * encrypt_message(struct mailprivacy * privacy,
+    MMAPString * message)
+{
+  struct mailmime * root;
+  struct mailmime * part;
+  struct mailmime * encrypted;
+  MMAPString * result;
+  size_t cur_token;
+  int col;
+  int r;
+
+  cur_token = 0;
+  r = mailmime_parse(message->str, message->len, &cur_token, &root);
+  if (r != MAILIMF_NO_ERROR)
+    return NULL;
+
+  result = NULL;
+  part = root->mm_data.mm_message.mm_msg_mime;
+  r = mailprivacy_encrypt(privacy, "smime", "signed-encrypted",
+      part, &encrypted);
+  if (r != MAIL_NO_ERROR)
+    goto free_root;
+
+  root->mm_data.mm_message.mm_msg_mime = encrypted;
+  result = mmap_string_new("");
+  if (result != NULL) {
+    col = 0;
+    r = mailmime_write_mem(result, &col, root);
+    if (r != MAILIMF_NO_ERROR) {
+      mmap_string_free(result);
+      result = NULL;
+    }
+  }
+  root->mm_data.mm_message.mm_msg_mime = part;
+
+  mailprivacy_mime_clear(encrypted);
+  mailmime_free(encrypted);
+ free_root:
+  /* the parts of the message were written to temporary files */
+  mailprivacy_mime_clear(root);
+  mailmime_free(root);
+
+  return result;
+}
+
+/* returns 1 if the message is decrypted and the signature checked */
+
+static int decrypt_message(struct mailprivacy * privacy,
+    MMAPString * message)
+{
+  mailmessage * msg;
+  struct mailmime * mime;
+  int verified;
+  int r;
+
+  msg = data_message_init(message->str, message->len);
+  if (msg == NULL)
+    return 0;
+
+  verified = 0;
+  r = mailprivacy_msg_get_bodystructure(privacy, msg, &mime);
+  if (r == MAIL_NO_ERROR)
+    verified = has_part(msg->msg_mime, "x-verified");
+
+  mailprivacy_msg_flush(privacy, msg);
+  mailmessage_free(msg);
+
+  return verified;
+}
+
+static int bench(struct mailprivacy * privacy, const char * name,
+    MMAPString * message, unsigned int rounds)
+{
+  MMAPString * encrypted;
+  unsigned int round;
+  unsigned int verified;
+  double encrypt_duration;
+  double decrypt_duration;
+  double start;
+
+  encrypted = NULL;
+  encrypt_duration = 0;
+  decrypt_duration = 0;
+  verified = 0;
+  for(round = 0 ; round < rounds ; round ++) {
+    start = now();
+    encrypted = encrypt_message(privacy, message);
+    encrypt_duration += now() - start;
+    if (encrypted == NULL) {
+      fprintf(stderr, "%s: could not sign and encrypt\n", name);
+      return -1;
+    }
+
+    start = now();
+    verified += decrypt_message(privacy, encrypted);
+    decrypt_duration += now() - start;
+
+    mmap_string_free(encrypted);
+  }
+
+  printf("%-8s sign+encrypt %8.1f msg/s  decrypt+verify %8.1f msg/s"
+      "  (%u/%u verified)\n", name,
+      rounds / encrypt_duration, rounds / decrypt_duration,
+      verified, rounds);
+  fflush(stdout);
+
+  return 0;
+}
+
+int main(int argc, char ** argv)
+{
+  struct mailprivacy * privacy;
+  MMAPString * message;
+  unsigned int rounds;
+  const char * tmp_dir;
+  int i;
+  int r;
+
+  rounds = DEFAULT_ROUNDS;
+  i = 1;
+  if ((argc > 2) && (strcmp(argv[1], "-n") == 0)) {
+    rounds = atoi(argv[2]);
+    if (rounds == 0)
+      rounds = 1;
+    i = 3;
+  }
+
+  if (i != argc - 3) {
+    fprintf(stderr, "syntax: smime-bench [-n rounds] email cert-dir private-keys-dir\n");
+    exit(EXIT_FAILURE);
+  }
+
+  tmp_dir = getenv("TMPDIR");
+  if (tmp_dir == NULL)
+    tmp_dir = "/tmp";
+
+  privacy = mailprivacy_new((char *) tmp_dir, 0);
+  if (privacy == NULL)
+    goto err;
+
+  r = mailprivacy_smime_init(privacy);
+  if (r != MAIL_NO_ERROR)
+    goto free_privacy;
+
+  /* the certificates are self-signed */
+  mailprivacy_smime_set_cert_dir(privacy, argv[i + 1]);
+  mailprivacy_smime_set_CA_dir(privacy, argv[i + 1]);
+  mailprivacy_smime_set_private_keys_dir(privacy, argv[i + 2]);
+
+  message = generate(argv[i]);
+  if (message == NULL)
+    goto done_smime;
+
+  printf("%lu bytes, %u rounds\n", (unsigned long) message->len, rounds);
+  /* the children running openssl must not write our buffered output */
+  fflush(stdout);
+
+  mailprivacy_smime_set_backend(privacy, MAILPRIVACY_SMIME_BACKEND_COMMAND);
+  if (bench(privacy, "command", message, rounds) < 0)
+    goto free_message;
+
+  r = mailprivacy_smime_set_backend(privacy, MAILPRIVACY_SMIME_BACKEND_CMS);
+  if (r != MAIL_NO_ERROR) {
+    fprintf(stderr, "CMS backend not available\n");
+    goto free_message;
+  }
+  if (bench(privacy, "cms", message, rounds) < 0)
+    goto free_message;
+
+  mmap_string_free(message);
+  mailprivacy_smime_done(privacy);
+  mailprivacy_free(privacy);
+
+  exit(EXIT_SUCCESS);
+
+ free_message:
+  mmap_string_free(message);
+ done_smime:
+  mailprivacy_smime_done(privacy);
+ free_privacy:
+  mailprivacy_free(privacy);
+ err:
+  exit(EXIT_FAILURE);
+}
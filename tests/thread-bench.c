@@ -0,0 +1,273 @@
+#include <libetpan/libetpan.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+  thread-bench builds the message tree of a synthetic folder with
+  mail_build_thread() and with an incremental threading context, and
+  shows the time of each build and the peak memory of the process.
+*/
+
+#define DEFAULT_COUNT 1000000
+#define NEW_COUNT 1000
+#define MAX_REFERENCES 10
+
+static uint32_t seed = 2463534242U;
+
+static uint32_t next_random(void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static long peak_memory(void)
+{
+  struct rusage usage;
+
+  getrusage(RUSAGE_SELF, &usage);
+
+  /* kilobytes on Linux, bytes on Mac OS X */
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+/*
+  new threads are started by 40% of the messages, the other ones
+  reply to a recent message. Some subjects are encoded and some
+  messages have no Message-ID.
+*/
+
+static mailmessage * generate(unsigned int count, unsigned int i,
+    unsigned int * parent_tab, unsigned int * thread_tab)
+{
+  char header[2048];
+  char references[1024];
+  char date[64];
+  char subject[128];
+  unsigned int thread_id;
+  unsigned int parent;
+  unsigned int ancestor;
+  unsigned int depth;
+  struct mailimf_fields * fields;
+  mailmessage * msg;
+  size_t cur_token;
+  struct tm tm_value;
+  time_t date_value;
+  int r;
+
+  if ((i == 0) || (next_random() % 10 < 4)) {
+    parent = count;
+    thread_id = i;
+  }
+  else {
+    unsigned int window;
+
+    window = (i < 1000) ? i : 1000;
+    parent = i - 1 - next_random() % window;
+    thread_id = thread_tab[parent];
+  }
+  parent_tab[i] = parent;
+  thread_tab[i] = thread_id;
+
+  references[0] = '\0';
+  if (parent != count) {
+    char ancestors[MAX_REFERENCES][64];
+
+    depth = 0;
+    for(ancestor = parent ; (ancestor != count) && (depth < MAX_REFERENCES) ;
+        ancestor = parent_tab[ancestor]) {
+      snprintf(ancestors[depth], sizeof(ancestors[depth]),
+          " <%u.bench@example.org>", ancestor);
+      depth ++;
+    }
+    strcpy(references, "References:");
+    while (depth > 0) {
+      depth --;
+      strcat(references, ancestors[depth]);
+    }
+    strcat(references, "\r\n");
+  }
+
+  if (thread_id % 10 == 0)
+    snprintf(subject, sizeof(subject), "=?utf-8?q?Caf=C3=A9_thread_%u?=",
+        thread_id);
+  else
+    snprintf(subject, sizeof(subject), "Thread %u about something",
+        thread_id);
+
+  date_value = 1577836800 + (time_t) i * 37;
+  gmtime_r(&date_value, &tm_value);
+  strftime(date, sizeof(date), "%d %b %Y %H:%M:%S +0000", &tm_value);
+
+  if (next_random() % 100 == 0)
+    snprintf(header, sizeof(header), "%sSubject: %s%s\r\nDate: %s\r\n\r\n",
+        references, (parent != count) ? "Re: " : "", subject, date);
+  else
+    snprintf(header, sizeof(header),
+        "Message-ID: <%u.bench@example.org>\r\n"
+        "%sSubject: %s%s\r\nDate: %s\r\n\r\n",
+        i, references, (parent != count) ? "Re: " : "", subject, date);
+
+  cur_token = 0;
+  r = mailimf_fields_parse(header, strlen(header), &cur_token, &fields);
+  if (r != MAILIMF_NO_ERROR)
+    return NULL;
+
+  msg = mailmessage_new();
+  if (msg == NULL) {
+    mailimf_fields_free(fields);
+    return NULL;
+  }
+  msg->msg_index = i + 1;
+  msg->msg_fields = fields;
+
+  return msg;
+}
+
+static void report(const char * name, double duration)
+{
+  printf("%-28s %8.3f s  peak %8ld KB\n", name, duration, peak_memory());
+}
+
+int main(int argc, char ** argv)
+{
+  unsigned int count;
+  unsigned int total;
+  unsigned int i;
+  unsigned int * parent_tab;
+  unsigned int * thread_tab;
+  carray * msg_tab;
+  struct mailmessage_list * env_list;
+  struct mailmessage_tree * tree;
+  struct mail_thread_context * ctx;
+  double start;
+  int r;
+
+  count = DEFAULT_COUNT;
+  if ((argc > 2) && (strcmp(argv[1], "-n") == 0)) {
+    count = atoi(argv[2]);
+    if (count == 0)
+      count = 1;
+  }
+  else if (argc != 1) {
+    fprintf(stderr, "syntax: thread-bench [-n count]\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* the last messages are added to the incremental context */
+  total = count + NEW_COUNT;
+  parent_tab = malloc(total * sizeof(* parent_tab));
+  thread_tab = malloc(total * sizeof(* thread_tab));
+  msg_tab = carray_new(total);
+  if ((parent_tab == NULL) || (thread_tab == NULL) || (msg_tab == NULL)) {
+    fprintf(stderr, "not enough memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  start = now();
+  for(i = 0 ; i < total ; i ++) {
+    mailmessage * msg;
+
+    msg = generate(total, i, parent_tab, thread_tab);
+    if ((msg == NULL) || (carray_add(msg_tab, msg, NULL) < 0)) {
+      fprintf(stderr, "could not create message %u\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+  carray_set_size(msg_tab, count);
+  printf("%u messages\n", count);
+  report("generation", now() - start);
+
+  env_list = mailmessage_list_new(msg_tab);
+  if (env_list == NULL) {
+    fprintf(stderr, "not enough memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  start = now();
+  r = mail_build_thread(MAIL_THREAD_REFERENCES, "US-ASCII", env_list,
+      &tree, NULL);
+  if (r != MAIL_NO_ERROR)
+    goto err;
+  report("references", now() - start);
+  mailmessage_tree_free_recursive(tree);
+
+  start = now();
+  r = mail_build_thread(MAIL_THREAD_REFERENCES_NO_SUBJECT, "US-ASCII",
+      env_list, &tree, NULL);
+  if (r != MAIL_NO_ERROR)
+    goto err;
+  report("references without subject", now() - start);
+  mailmessage_tree_free_recursive(tree);
+
+  start = now();
+  r = mail_build_thread(MAIL_THREAD_ORDEREDSUBJECT, "US-ASCII", env_list,
+      &tree, NULL);
+  if (r != MAIL_NO_ERROR)
+    goto err;
+  report("ordered subject", now() - start);
+  mailmessage_tree_free_recursive(tree);
+
+  ctx = mail_thread_context_new(MAIL_THREAD_REFERENCES, "US-ASCII", NULL);
+  if (ctx == NULL) {
+    r = MAIL_ERROR_MEMORY;
+    goto err;
+  }
+
+  start = now();
+  r = mail_thread_context_add_list(ctx, env_list);
+  if (r != MAIL_NO_ERROR)
+    goto free_ctx;
+  r = mail_thread_context_build(ctx, &tree);
+  if (r != MAIL_NO_ERROR)
+    goto free_ctx;
+  report("context, first build", now() - start);
+
+  start = now();
+  for(i = count ; i < total ; i ++) {
+    mailmessage * msg;
+
+    msg = carray_get(msg_tab, i);
+    r = mail_thread_context_add(ctx, msg);
+    if (r != MAIL_NO_ERROR)
+      goto free_ctx;
+  }
+  r = mail_thread_context_build(ctx, &tree);
+  if (r != MAIL_NO_ERROR)
+    goto free_ctx;
+  printf("%u new messages\n", NEW_COUNT);
+  report("context, next build", now() - start);
+
+  mail_thread_context_free(ctx);
+
+  carray_set_size(msg_tab, total);
+  mailmessage_list_free(env_list);
+  free(thread_tab);
+  free(parent_tab);
+
+  exit(EXIT_SUCCESS);
+
+ free_ctx:
+  mail_thread_context_free(ctx);
+ err:
+  fprintf(stderr, "threading failed: %i\n", r);
+  exit(EXIT_FAILURE);
+}
@@ -0,0 +1,411 @@
+#include <libetpan/libetpan.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+  thread-check adds and removes messages in an incremental threading
+  context and checks after each change that the message tree is the
+  one of mail_build_thread() on the same list of messages.
+*/
+
+#define DEFAULT_COUNT 300
+#define ID_COUNT 400
+/* the other identifiers are only referenced */
+#define MAX_COUNT (ID_COUNT - ID_COUNT / 8)
+#define MAX_REFERENCES 6
+
+static uint32_t seed = 2463534242U;
+static char id_used[ID_COUNT];
+
+static uint32_t next_random(void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static mailmessage * message_new(unsigned int index, const char * header)
+{
+  struct mailimf_fields * fields;
+  mailmessage * msg;
+  size_t cur_token;
+  int r;
+
+  cur_token = 0;
+  r = mailimf_fields_parse(header, strlen(header), &cur_token, &fields);
+  if (r != MAILIMF_NO_ERROR)
+    return NULL;
+
+  msg = mailmessage_new();
+  if (msg == NULL) {
+    mailimf_fields_free(fields);
+    return NULL;
+  }
+  msg->msg_index = index;
+  msg->msg_fields = fields;
+  mailmessage_resolve_single_fields(msg);
+
+  return msg;
+}
+
+/*
+  the references of a message are lower identifiers in increasing
+  order and the identifier of the message is higher than all of them,
+  so that the links never make a loop. Messages are added in random
+  order and a message often refers to messages that are not there yet
+  or that give another parent to the same message. Message-IDs are
+  not duplicated.
+*/
+
+static mailmessage * generate(unsigned int index)
+{
+  char header[1024];
+  char references[512];
+  char date[64];
+  unsigned int ref_tab[MAX_REFERENCES];
+  unsigned int id;
+  unsigned int count;
+  unsigned int i;
+
+  do {
+    id = ID_COUNT / 8 + next_random() % (ID_COUNT - ID_COUNT / 8);
+  } while (id_used[id]);
+  id_used[id] = 1;
+
+  count = next_random() % (MAX_REFERENCES + 1);
+  for(i = 0 ; i < count ; i ++)
+    ref_tab[i] = next_random() % id;
+  /* sorted and without duplicates */
+  for(i = 1 ; i < count ; i ++) {
+    unsigned int j;
+    unsigned int value;
+
+    value = ref_tab[i];
+    for(j = i ; (j > 0) && (ref_tab[j - 1] > value) ; j --)
+      ref_tab[j] = ref_tab[j - 1];
+    ref_tab[j] = value;
+  }
+
+  references[0] = '\0';
+  if (count > 0) {
+    strcpy(references, "References:");
+    for(i = 0 ; i < count ; i ++) {
+      char ref[32];
+
+      if ((i > 0) && (ref_tab[i] == ref_tab[i - 1]))
+        continue;
+      snprintf(ref, sizeof(ref), " <%u@example.org>", ref_tab[i]);
+      strcat(references, ref);
+    }
+    strcat(references, "\r\n");
+  }
+
+  snprintf(date, sizeof(date), "%u Jan 2020 %02u:%02u:00 +0000",
+      1 + index / 1440, (index / 60) % 24, index % 60);
+
+  snprintf(header, sizeof(header),
+      "Message-ID: <%u@example.org>\r\n"
+      "%sSubject: message %u\r\nDate: %s\r\n\r\n",
+      id, references, index, date);
+
+  return message_new(index, header);
+}
+
+static int same_tree(struct mailmessage_tree * tree1,
+    struct mailmessage_tree * tree2)
+{
+  unsigned int i;
+
+  if (tree1->node_msg != tree2->node_msg)
+    return 0;
+  if (carray_count(tree1->node_children) !=
+      carray_count(tree2->node_children))
+    return 0;
+
+  for(i = 0 ; i < carray_count(tree1->node_children) ; i ++) {
+    if (!same_tree(carray_get(tree1->node_children, i),
+            carray_get(tree2->node_children, i)))
+      return 0;
+  }
+
+  return 1;
+}
+
+static void print_tree(struct mailmessage_tree * tree, int level)
+{
+  unsigned int i;
+
+  if (tree->node_msg != NULL)
+    printf("%*s%u\n", level * 2, "", tree->node_msg->msg_index);
+
+  for(i = 0 ; i < carray_count(tree->node_children) ; i ++)
+    print_tree(carray_get(tree->node_children, i), level + 1);
+}
+
+/* msg_tab holds the messages of the context in the order they were added */
+
+static int check(struct mail_thread_context * ctx, int type,
+    carray * msg_tab, const char * step)
+{
+  struct mailmessage_list * env_list;
+  struct mailmessage_tree * tree;
+  struct mailmessage_tree * ctx_tree;
+  int res;
+  int r;
+
+  r = mail_thread_context_build(ctx, &ctx_tree);
+  if (r != MAIL_NO_ERROR) {
+    fprintf(stderr, "%s: context build failed: %i\n", step, r);
+    return 0;
+  }
+
+  env_list = mailmessage_list_new(msg_tab);
+  if (env_list == NULL) {
+    fprintf(stderr, "not enough memory\n");
+    return 0;
+  }
+  r = mail_build_thread(type, NULL, env_list, &tree, NULL);
+  /* the messages belong to the caller */
+  free(env_list);
+  if (r != MAIL_NO_ERROR) {
+    fprintf(stderr, "%s: mail_build_thread failed: %i\n", step, r);
+    return 0;
+  }
+
+  res = same_tree(ctx_tree, tree);
+  if (!res) {
+    fprintf(stderr, "%s: the trees are different\n", step);
+    printf("context:\n");
+    print_tree(ctx_tree, 0);
+    printf("mail_build_thread:\n");
+    print_tree(tree, 0);
+  }
+  mailmessage_tree_free_recursive(tree);
+
+  return res;
+}
+
+static int remove_message(struct mail_thread_context * ctx,
+    carray * msg_tab, unsigned int i)
+{
+  int r;
+
+  r = mail_thread_context_remove(ctx, carray_get(msg_tab, i));
+  if (r != MAIL_NO_ERROR)
+    return r;
+  carray_delete_slow(msg_tab, i);
+
+  return MAIL_NO_ERROR;
+}
+
+static int add_message(struct mail_thread_context * ctx,
+    carray * msg_tab, mailmessage * msg)
+{
+  int r;
+
+  r = mail_thread_context_add(ctx, msg);
+  if (r != MAIL_NO_ERROR)
+    return r;
+  if (carray_add(msg_tab, msg, NULL) < 0)
+    return MAIL_ERROR_MEMORY;
+
+  return MAIL_NO_ERROR;
+}
+
+/*
+  y gets its parent from the references of x first, when x is removed
+  the parent given by the references of b must be used
+*/
+
+static int check_lost_link(void)
+{
+  static const char * header_tab[] = {
+    "Message-ID: <x@example.org>\r\n"
+    "References: <a@example.org> <y@example.org>\r\n"
+    "Date: 1 Jan 2020 00:00:00 +0000\r\n\r\n",
+    "Message-ID: <y@example.org>\r\n"
+    "Date: 1 Jan 2020 00:01:00 +0000\r\n\r\n",
+    "Message-ID: <b@example.org>\r\n"
+    "References: <c@example.org> <y@example.org>\r\n"
+    "Date: 1 Jan 2020 00:02:00 +0000\r\n\r\n",
+    "Message-ID: <c@example.org>\r\n"
+    "Date: 1 Jan 2020 00:03:00 +0000\r\n\r\n",
+  };
+  struct mail_thread_context * ctx;
+  carray * msg_tab;
+  carray * all_tab;
+  unsigned int i;
+  int res;
+  int r;
+
+  res = 0;
+  msg_tab = carray_new(4);
+  all_tab = carray_new(4);
+  ctx = mail_thread_context_new(MAIL_THREAD_REFERENCES_NO_SUBJECT,
+      NULL, NULL);
+  if ((msg_tab == NULL) || (all_tab == NULL) || (ctx == NULL)) {
+    fprintf(stderr, "not enough memory\n");
+    goto free;
+  }
+
+  for(i = 0 ; i < sizeof(header_tab) / sizeof(header_tab[0]) ; i ++) {
+    mailmessage * msg;
+
+    msg = message_new(i + 1, header_tab[i]);
+    if ((msg == NULL) || (carray_add(all_tab, msg, NULL) < 0)) {
+      fprintf(stderr, "could not create message %u\n", i);
+      goto free;
+    }
+    r = add_message(ctx, msg_tab, msg);
+    if (r != MAIL_NO_ERROR) {
+      fprintf(stderr, "could not add message %u: %i\n", i, r);
+      goto free;
+    }
+  }
+  if (!check(ctx, MAIL_THREAD_REFERENCES_NO_SUBJECT, msg_tab, "lost link"))
+    goto free;
+
+  r = remove_message(ctx, msg_tab, 0);
+  if (r != MAIL_NO_ERROR) {
+    fprintf(stderr, "could not remove message: %i\n", r);
+    goto free;
+  }
+  if (!check(ctx, MAIL_THREAD_REFERENCES_NO_SUBJECT, msg_tab,
+          "lost link, removal"))
+    goto free;
+
+  res = 1;
+
+ free:
+  if (ctx != NULL)
+    mail_thread_context_free(ctx);
+  if (all_tab != NULL) {
+    for(i = 0 ; i < carray_count(all_tab) ; i ++)
+      mailmessage_free(carray_get(all_tab, i));
+    carray_free(all_tab);
+  }
+  if (msg_tab != NULL)
+    carray_free(msg_tab);
+
+  return res;
+}
+
+static int check_random(unsigned int count)
+{
+  struct mail_thread_context * ctx;
+  carray * msg_tab;
+  carray * removed_tab;
+  carray * all_tab;
+  char step[64];
+  unsigned int i;
+  int res;
+  int r;
+
+  res = 0;
+  msg_tab = carray_new(count);
+  removed_tab = carray_new(count);
+  all_tab = carray_new(count);
+  ctx = mail_thread_context_new(MAIL_THREAD_REFERENCES_NO_SUBJECT,
+      NULL, NULL);
+  if ((msg_tab == NULL) || (removed_tab == NULL) || (all_tab == NULL) ||
+      (ctx == NULL)) {
+    fprintf(stderr, "not enough memory\n");
+    goto free;
+  }
+
+  for(i = 0 ; i < count ; i ++) {
+    mailmessage * msg;
+
+    msg = generate(i + 1);
+    if ((msg == NULL) || (carray_add(all_tab, msg, NULL) < 0)) {
+      fprintf(stderr, "could not create message %u\n", i);
+      goto free;
+    }
+    r = add_message(ctx, msg_tab, msg);
+    if (r != MAIL_NO_ERROR) {
+      fprintf(stderr, "could not add message %u: %i\n", i, r);
+      goto free;
+    }
+  }
+  if (!check(ctx, MAIL_THREAD_REFERENCES_NO_SUBJECT, msg_tab, "add"))
+    goto free;
+
+  /* messages are removed and some of them are added again */
+  for(i = 0 ; i < count ; i ++) {
+    unsigned int index;
+
+    if ((carray_count(removed_tab) > 0) && (next_random() % 3 == 0)) {
+      mailmessage * msg;
+
+      index = next_random() % carray_count(removed_tab);
+      msg = carray_get(removed_tab, index);
+      carray_delete_slow(removed_tab, index);
+      r = add_message(ctx, msg_tab, msg);
+      snprintf(step, sizeof(step), "step %u, add", i);
+    }
+    else if (carray_count(msg_tab) > 0) {
+      index = next_random() % carray_count(msg_tab);
+      if (carray_add(removed_tab, carray_get(msg_tab, index), NULL) < 0) {
+        fprintf(stderr, "not enough memory\n");
+        goto free;
+      }
+      r = remove_message(ctx, msg_tab, index);
+      snprintf(step, sizeof(step), "step %u, removal", i);
+    }
+    else
+      break;
+
+    if (r != MAIL_NO_ERROR) {
+      fprintf(stderr, "%s failed: %i\n", step, r);
+      goto free;
+    }
+    if (!check(ctx, MAIL_THREAD_REFERENCES_NO_SUBJECT, msg_tab, step))
+      goto free;
+  }
+
+  res = 1;
+
+ free:
+  if (ctx != NULL)
+    mail_thread_context_free(ctx);
+  if (all_tab != NULL) {
+    for(i = 0 ; i < carray_count(all_tab) ; i ++)
+      mailmessage_free(carray_get(all_tab, i));
+    carray_free(all_tab);
+  }
+  if (removed_tab != NULL)
+    carray_free(removed_tab);
+  if (msg_tab != NULL)
+    carray_free(msg_tab);
+
+  return res;
+}
+
+int main(int argc, char ** argv)
+{
+  unsigned int count;
+
+  count = DEFAULT_COUNT;
+  if ((argc > 2) && (strcmp(argv[1], "-n") == 0)) {
+    count = atoi(argv[2]);
+    if (count == 0)
+      count = 1;
+    if (count > MAX_COUNT)
+      count = MAX_COUNT;
+  }
+  else if (argc != 1) {
+    fprintf(stderr, "syntax: thread-check [-n count]\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (!check_lost_link())
+    exit(EXIT_FAILURE);
+  if (!check_random(count))
+    exit(EXIT_FAILURE);
+
+  printf("ok\n");
+
+  exit(EXIT_SUCCESS);
+}